@@ -0,0 +1,561 @@
+/**
+ * xcheck基准测试与损坏镜像语料
+ * 按mkfs.c的布局生成指定大小的合成xv6文件系统镜像，包含宽目录树、一条深目录链和使用间接块的大文件，
+ * 再按需注入损坏，分别运行xcheck，输出每个镜像的耗时、吞吐量、子进程的峰值RSS和检查结果，
+ * 用于衡量xcheck的扩展性改动，并确认损坏都被发现、任何镜像都不会让xcheck崩溃
+ *
+ * 损坏类型：
+ *   none    - 不注入损坏，xcheck应返回0
+ *   nlink   - 一个文件的nlink加1
+ *   free    - 把一个被引用的文件标记为空闲
+ *   dup     - 让两个文件共用同一个数据块
+ *   stray   - 在位图中标记一个未使用的块
+ *   badaddr - 一个文件的直接块指向文件系统之外
+ *   orphan  - 删除深目录链顶端的目录项，使整条链成为孤立目录
+ *   fuzz    - 在inode表和根目录块中随机改写字节，只要求xcheck不崩溃
+ *
+ * 编译（在File_Systems_Checker目录下，src/xv6-public与编译xcheck时相同）：
+ *   gcc -O2 bench/bench.c -o xcheck_bench
+ *
+ * 用法：
+ *   xcheck_bench [-b xcheck路径] [-s 大小MB列表] [-c 损坏类型列表] [-t 目录链深度]
+ *                [-r 重复次数] [-a xcheck参数] [-d 目录] [-g]
+ * 列表以逗号分隔，如 -s 16,256,2048；生成的镜像留在目录中，下次运行时复用；-g只生成镜像，不运行xcheck
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define stat xv6_stat // 避免与主机的struct stat冲突
+
+#include "../src/xv6-public/fs.h"
+#include "../src/xv6-public/param.h"
+#include "../src/xv6-public/stat.h"
+#include "../src/xv6-public/types.h"
+#undef stat
+
+#define MAX_LIST    16     // 列表的最大长度
+#define MAX_INODES  65535  // 目录项中的inode号只有16位
+#define FANOUT      8      // 宽目录树中每个目录的子目录数
+#define FREE_SHARE  10     // 数据块中保留为空闲的百分比
+
+/**
+ * 正在生成的镜像
+ */
+struct image {
+    uchar*            data;        // 映射的整个镜像
+    struct superblock sb;          // 超级块
+    uint              next_block;  // 下一个待分配的数据块
+    uint              next_inode;  // 下一个待分配的inode
+};
+
+/**
+ * xorshift64*伪随机数，固定种子保证每次生成的镜像相同
+ */
+static unsigned long next_random(unsigned long* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DUL;
+}
+
+static uchar* block_ptr(struct image* im, uint block) {
+    return im->data + (size_t)block * BSIZE;
+}
+
+static struct dinode* inode_ptr(struct image* im, uint inum) {
+    return (struct dinode*)block_ptr(im, im->sb.inodestart) + inum;
+}
+
+/**
+ * 分配一个数据块，保留FREE_SHARE%的数据块不分配
+ *
+ * @return 块号，空间不足时返回0
+ */
+static uint alloc_block(struct image* im) {
+    if (im->next_block >= im->sb.size - (unsigned long)im->sb.nblocks * FREE_SHARE / 100)
+        return 0;
+    return im->next_block++;
+}
+
+/**
+ * 判断是否还能分配一个inode和num_blocks个数据块
+ * 创建目录或文件前先检查，保证镜像中不会留下只创建了一半的inode
+ */
+static int has_room(struct image* im, uint num_blocks) {
+    return im->next_inode < im->sb.ninodes && im->next_block + num_blocks <= im->sb.size - (unsigned long)im->sb.nblocks * FREE_SHARE / 100;
+}
+
+/**
+ * 分配一个inode
+ *
+ * @return inode号，inode不足时返回0
+ */
+static uint alloc_inode(struct image* im, short type) {
+    if (im->next_inode >= im->sb.ninodes)
+        return 0;
+    struct dinode* nd = inode_ptr(im, im->next_inode);
+    nd->type          = type;
+    nd->nlink         = 1;
+    return im->next_inode++;
+}
+
+/**
+ * 取得inode中第n个逻辑块的块号
+ */
+static uint file_block(struct image* im, struct dinode* nd, uint n) {
+    if (n < NDIRECT)
+        return nd->addrs[n];
+    return ((uint*)block_ptr(im, nd->addrs[NDIRECT]))[n - NDIRECT];
+}
+
+/**
+ * 在inode末尾追加一个数据块，需要时先分配间接块
+ *
+ * @return 新数据块的块号，空间不足或文件已达最大长度时返回0
+ */
+static uint append_block(struct image* im, uint inum) {
+    struct dinode* nd = inode_ptr(im, inum);
+    uint           n  = nd->size / BSIZE;
+    if (n >= NDIRECT + NINDIRECT)
+        return 0;
+    if (n == NDIRECT && (nd->addrs[NDIRECT] = alloc_block(im)) == 0)
+        return 0;
+
+    uint block = alloc_block(im);
+    if (block == 0)
+        return 0;
+    if (n < NDIRECT)
+        nd->addrs[n] = block;
+    else
+        ((uint*)block_ptr(im, nd->addrs[NDIRECT]))[n - NDIRECT] = block;
+    nd->size += BSIZE;
+    return block;
+}
+
+/**
+ * 在目录末尾追加一个目录项，目录的大小总是sizeof(struct dirent)的整数倍
+ *
+ * @return 成功返回0，空间不足返回-1
+ */
+static int dir_add(struct image* im, uint dir, const char* name, uint inum) {
+    struct dinode* nd = inode_ptr(im, dir);
+    if (nd->size % BSIZE == 0) {
+        if (append_block(im, dir) == 0)
+            return -1;
+        nd->size -= BSIZE; // 目录的大小只计已写入的目录项
+    }
+
+    struct dirent* de = (struct dirent*)(block_ptr(im, file_block(im, nd, nd->size / BSIZE)) + nd->size % BSIZE);
+    memset(de, 0, sizeof(*de));
+    de->inum = inum;
+    memcpy(de->name, name, strnlen(name, DIRSIZ)); // 名字恰为DIRSIZ字节时不以'\0'结尾
+    nd->size += sizeof(struct dirent);
+    return 0;
+}
+
+/**
+ * 在parent中创建子目录
+ *
+ * @return 子目录的inode号，空间不足时返回0
+ */
+static uint make_dir(struct image* im, uint parent, const char* name) {
+    uint dir = alloc_inode(im, T_DIR);
+    if (dir == 0 || dir_add(im, dir, ".", dir) < 0 || dir_add(im, dir, "..", parent) < 0 || dir_add(im, parent, name, dir) < 0)
+        return 0;
+    return dir;
+}
+
+/**
+ * 在dir中创建有num_blocks个数据块的文件，数据块内容全为0
+ *
+ * @return 文件的inode号，空间不足时返回0
+ */
+static uint make_file(struct image* im, uint dir, const char* name, uint num_blocks) {
+    uint file = alloc_inode(im, T_FILE);
+    if (file == 0)
+        return 0;
+    for (uint i = 0; i < num_blocks; ++i)
+        if (append_block(im, file) == 0)
+            return 0;
+    if (dir_add(im, dir, name, file) < 0)
+        return 0;
+    return file;
+}
+
+/**
+ * 按文件长度分布抽取一个文件的块数：多数文件只有几个块，少数大文件使用间接块
+ */
+static uint file_length(unsigned long* state) {
+    unsigned long r = next_random(state);
+    if (r % 100 < 70)
+        return 1 + r / 100 % 3;
+    if (r % 100 < 95)
+        return 4 + r / 100 % 9;
+    return NDIRECT + 1 + r / 100 % NINDIRECT;
+}
+
+/**
+ * 生成约size_mb MB的镜像，已存在且大小一致时直接复用
+ *
+ * 算法:
+ * 1. 按mkfs.c的布局划分引导块、超级块、日志、inode表、位图和数据区
+ * 2. 创建根目录，从根目录出发建立一条depth层的深目录链，再按FANOUT建立宽目录树
+ * 3. 把文件轮流放入各个目录，直到inode或数据块用完
+ * 4. 最后按已分配的块写位图
+ */
+static void generate_image(const char* path, long size_mb, int depth) {
+    uint        size = size_mb * (1 << 20) / BSIZE;
+    struct stat st;
+    if (stat(path, &st) == 0 && st.st_size == (off_t)size * BSIZE)
+        return;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t)size * BSIZE) < 0) {
+        perror(path);
+        exit(1);
+    }
+    struct image im;
+    im.data = mmap(NULL, (size_t)size * BSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (im.data == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+
+    uint ninodes     = size / 16 < MAX_INODES ? size / 16 : MAX_INODES;
+    uint ninodeblks  = ninodes / IPB + 1;
+    uint nbitmap     = size / BPB + 1;
+    uint nmeta       = 2 + LOGSIZE + ninodeblks + nbitmap;
+    im.sb.size       = size;
+    im.sb.nblocks    = size - nmeta;
+    im.sb.ninodes    = ninodes;
+    im.sb.nlog       = LOGSIZE;
+    im.sb.logstart   = 2;
+    im.sb.inodestart = 2 + LOGSIZE;
+    im.sb.bmapstart  = 2 + LOGSIZE + ninodeblks;
+    im.next_block    = nmeta;
+    im.next_inode    = 1;
+    memcpy(block_ptr(&im, 1), &im.sb, sizeof(im.sb));
+
+    // 根目录的"."和".."都指向自身
+    uint root = alloc_inode(&im, T_DIR);
+    dir_add(&im, root, ".", root);
+    dir_add(&im, root, "..", root);
+
+    // 目录：深目录链在前，之后为宽目录树
+    uint  max_dirs = ninodes / 8 + depth + 1;
+    uint* dirs     = malloc(max_dirs * sizeof(uint));
+    uint  num_dirs = 0;
+    char  name[DIRSIZ + 1];
+    dirs[num_dirs++] = root;
+    for (uint parent = root, i = 0; i < (uint)depth; ++i) {
+        snprintf(name, sizeof(name), "deep%u", i);
+        if (!has_room(&im, 3) || (parent = make_dir(&im, parent, name)) == 0)
+            break;
+        dirs[num_dirs++] = parent;
+    }
+    for (uint i = 0; num_dirs < max_dirs; ++i) {
+        uint parent = i == 0 ? root : dirs[depth + i];
+        uint child  = 0;
+        for (uint k = 0; k < FANOUT && num_dirs < max_dirs; ++k) {
+            snprintf(name, sizeof(name), "d%u", num_dirs);
+            if (!has_room(&im, 3) || (child = make_dir(&im, parent, name)) == 0)
+                break;
+            dirs[num_dirs++] = child;
+        }
+        if (child == 0 || (uint)depth + i + 1 >= num_dirs)
+            break;
+    }
+
+    // 文件
+    unsigned long state = 0x9E3779B97F4A7C15UL;
+    for (uint i = 0;; ++i) {
+        uint num_blocks = file_length(&state);
+        snprintf(name, sizeof(name), "f%u", i);
+        if (!has_room(&im, num_blocks + 3) || make_file(&im, dirs[i % num_dirs], name, num_blocks) == 0)
+            break;
+    }
+    // 位图：元数据块和所有已分配的数据块
+    for (uint b = 0; b < im.next_block; ++b)
+        block_ptr(&im, im.sb.bmapstart + b / BPB)[b % BPB / 8] |= 1 << (b % 8);
+
+    printf("# generated %s: %u blocks, %u inodes, %u used inodes, %u directories, %u used blocks\n", path, size, ninodes,
+           im.next_inode - 1, num_dirs, im.next_block);
+    free(dirs);
+    munmap(im.data, (size_t)size * BSIZE);
+    close(fd);
+}
+
+/**
+ * 找到第一个编号不小于start、有数据块且引用计数为1的文件
+ */
+static uint find_file(struct image* im, uint start) {
+    for (uint inum = start; inum < im->sb.ninodes; ++inum) {
+        struct dinode* nd = inode_ptr(im, inum);
+        if (nd->type == T_FILE && nd->nlink == 1 && nd->addrs[0] != 0)
+            return inum;
+    }
+    return 0;
+}
+
+/**
+ * 复制基准镜像并注入一种损坏，已存在时直接复用
+ *
+ * @return 成功返回0，镜像中找不到可以损坏的对象时返回-1
+ */
+static int corrupt_image(const char* base, const char* path, const char* kind) {
+    struct stat st;
+    if (access(path, F_OK) == 0)
+        return 0;
+
+    int in  = open(base, O_RDONLY);
+    int out = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (in < 0 || out < 0 || fstat(in, &st) < 0 || ftruncate(out, st.st_size) < 0) {
+        perror(path);
+        exit(1);
+    }
+    struct image im;
+    im.data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, out, 0);
+    uchar* src = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, in, 0);
+    if (im.data == MAP_FAILED || src == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    memcpy(im.data, src, st.st_size);
+    munmap(src, st.st_size);
+    close(in);
+    memcpy(&im.sb, block_ptr(&im, 1), sizeof(im.sb));
+
+    // 损坏的对象选在inode表中部，避免xcheck恰好在最前面的inode上停下
+    uint           mid  = im.sb.ninodes / 2;
+    uint           a    = find_file(&im, mid);
+    uint           b    = a ? find_file(&im, a + 1) : 0;
+    struct dinode* root = inode_ptr(&im, 1);
+    int            ok   = 0;
+    if (strcmp(kind, "nlink") == 0 && a) {
+        inode_ptr(&im, a)->nlink++;
+        ok = 1;
+    } else if (strcmp(kind, "free") == 0 && a) {
+        memset(inode_ptr(&im, a), 0, sizeof(struct dinode));
+        ok = 1;
+    } else if (strcmp(kind, "dup") == 0 && b) {
+        inode_ptr(&im, b)->addrs[0] = inode_ptr(&im, a)->addrs[0];
+        ok = 1;
+    } else if (strcmp(kind, "stray") == 0) {
+        uint last = im.sb.size - 1;
+        uchar* bits = block_ptr(&im, im.sb.bmapstart + last / BPB);
+        ok          = !(bits[last % BPB / 8] & 1 << (last % 8));
+        bits[last % BPB / 8] |= 1 << (last % 8);
+    } else if (strcmp(kind, "badaddr") == 0 && a) {
+        inode_ptr(&im, a)->addrs[0] = im.sb.size + 7;
+        ok = 1;
+    } else if (strcmp(kind, "orphan") == 0) {
+        // 根目录的第三个目录项是深目录链的第一个目录
+        struct dirent* de = (struct dirent*)block_ptr(&im, root->addrs[0]) + 2;
+        ok                = de->inum != 0 && inode_ptr(&im, de->inum)->type == T_DIR;
+        memset(de, 0, sizeof(*de));
+    } else if (strcmp(kind, "fuzz") == 0) {
+        unsigned long state = 0xD1B54A32D192ED03UL;
+        size_t        table = (size_t)im.sb.inodestart * BSIZE;
+        size_t        span  = (size_t)(im.sb.bmapstart - im.sb.inodestart) * BSIZE;
+        for (int i = 0; i < 64; ++i)
+            im.data[table + next_random(&state) % span] = next_random(&state);
+        for (int i = 0; i < 16; ++i)
+            block_ptr(&im, root->addrs[0])[next_random(&state) % BSIZE] = next_random(&state);
+        ok = 1;
+    }
+
+    munmap(im.data, st.st_size);
+    close(out);
+    if (!ok)
+        unlink(path);
+    return ok ? 0 : -1;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * 运行一次xcheck
+ *
+ * @param peak_kb 返回子进程的峰值RSS（KB）
+ * @param status 返回wait4得到的状态
+ * @param message 返回xcheck的第一行输出，没有输出时为"-"
+ * @return 返回耗时（秒）
+ */
+static double run_once(const char* xcheck, const char* args, const char* image, long* peak_kb, int* status, char* message, int len) {
+    FILE* err = tmpfile();
+    if (err == NULL) {
+        perror("tmpfile");
+        exit(1);
+    }
+    fflush(stdout);
+
+    double start = now_seconds();
+    pid_t  pid   = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        dup2(fileno(err), STDERR_FILENO);
+        if (args != NULL)
+            execl(xcheck, xcheck, args, image, ( char* )NULL);
+        else
+            execl(xcheck, xcheck, image, ( char* )NULL);
+        perror(xcheck);
+        _exit(127);
+    }
+
+    struct rusage usage;
+    if (wait4(pid, status, 0, &usage) < 0) {
+        perror("wait4");
+        exit(1);
+    }
+    double elapsed = now_seconds() - start;
+    *peak_kb       = usage.ru_maxrss;
+
+    rewind(err);
+    if (fgets(message, len, err) == NULL)
+        strcpy(message, "-");
+    message[strcspn(message, "\n")] = '\0';
+    fclose(err);
+    return elapsed;
+}
+
+/**
+ * 解析逗号分隔的列表
+ *
+ * @return 列表长度
+ */
+static int parse_list(char* arg, char** out) {
+    int   count = 0;
+    char* token;
+    while ((token = strsep(&arg, ",")) != NULL && count < MAX_LIST) {
+        if (*token != '\0')
+            out[count++] = token;
+    }
+    return count;
+}
+
+static int known_kind(const char* kind) {
+    static const char* kinds[] = {"none", "nlink", "free", "dup", "stray", "badaddr", "orphan", "fuzz"};
+    for (unsigned i = 0; i < sizeof(kinds) / sizeof(kinds[0]); ++i)
+        if (strcmp(kind, kinds[i]) == 0)
+            return 1;
+    return 0;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [-b xcheck] [-s size_mb,...] [-c none,nlink,free,dup,stray,badaddr,orphan,fuzz]\n"
+            "          [-t depth] [-r repeats] [-a xcheck_args] [-d dir] [-g]\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    const char* xcheck       = "./xcheck";
+    const char* dir          = "/tmp";
+    const char* args         = NULL;
+    int         depth        = 64;
+    int         repeats      = 3;
+    int         only_gen     = 0;
+    char*       sizes[MAX_LIST];
+    char*       kinds[MAX_LIST];
+    char        default_sizes[] = "16,64,256";
+    char        default_kinds[] = "none,nlink,free,dup,stray,badaddr,orphan,fuzz";
+    int         num_sizes       = parse_list(default_sizes, sizes);
+    int         num_kinds       = parse_list(default_kinds, kinds);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "b:s:c:t:r:a:d:g")) != -1) {
+        switch (opt) {
+        case 'b': xcheck = optarg; break;
+        case 's': num_sizes = parse_list(optarg, sizes); break;
+        case 'c': num_kinds = parse_list(optarg, kinds); break;
+        case 't': depth = atoi(optarg); break;
+        case 'r': repeats = atoi(optarg); break;
+        case 'a': args = optarg; break;
+        case 'd': dir = optarg; break;
+        case 'g': only_gen = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (num_sizes == 0 || num_kinds == 0 || repeats <= 0 || depth < 0)
+        usage(argv[0]);
+    for (int k = 0; k < num_kinds; ++k)
+        if (!known_kind(kinds[k]))
+            usage(argv[0]);
+
+    printf("# xcheck=%s args=%s depth=%d repeats=%d\n", xcheck, args ? args : "-", depth, repeats);
+    if (!only_gen)
+        printf("%8s %8s %10s %10s %12s %6s %-10s %s\n", "size_mb", "damage", "seconds", "MB/s", "peak_rss_kb", "exit", "result",
+               "message");
+
+    int unexpected = 0;
+    for (int s = 0; s < num_sizes; ++s) {
+        long  size_mb = atol(sizes[s]);
+        char* base    = malloc(strlen(dir) + 64);
+        char* path    = malloc(strlen(dir) + 64);
+        if (size_mb <= 0)
+            usage(argv[0]);
+        sprintf(base, "%s/xcheck_bench_%ld_%d.img", dir, size_mb, depth);
+        generate_image(base, size_mb, depth);
+
+        for (int k = 0; k < num_kinds; ++k) {
+            if (strcmp(kinds[k], "none") == 0) {
+                strcpy(path, base);
+            } else {
+                sprintf(path, "%s/xcheck_bench_%ld_%d_%s.img", dir, size_mb, depth, kinds[k]);
+                if (corrupt_image(base, path, kinds[k]) < 0) {
+                    fprintf(stderr, "xcheck_bench: cannot inject %s into %s\n", kinds[k], base);
+                    continue;
+                }
+            }
+            if (only_gen)
+                continue;
+
+            // 取多次运行中最快的一次，第一次运行同时预热页缓存
+            double best = -1;
+            long   peak = 0;
+            int    status;
+            char   message[256];
+            for (int r = 0; r < repeats; ++r) {
+                long   run_peak;
+                double elapsed = run_once(xcheck, args, path, &run_peak, &status, message, sizeof(message));
+                if (best < 0 || elapsed < best)
+                    best = elapsed;
+                if (run_peak > peak)
+                    peak = run_peak;
+            }
+
+            // 未损坏的镜像应该通过，注入损坏的镜像应该失败，fuzz只要求正常退出
+            const char* result;
+            if (!WIFEXITED(status))
+                result = "CRASH";
+            else if (strcmp(kinds[k], "fuzz") == 0)
+                result = "ok";
+            else
+                result = (WEXITSTATUS(status) == 0) == (strcmp(kinds[k], "none") == 0) ? "ok" : "UNEXPECTED";
+            unexpected |= strcmp(result, "ok") != 0;
+
+            printf("%8ld %8s %10.3f %10.1f %12ld %6d %-10s %s\n", size_mb, kinds[k], best, size_mb / best, peak,
+                   WIFEXITED(status) ? WEXITSTATUS(status) : -WTERMSIG(status), result, message);
+            fflush(stdout);
+        }
+        free(base);
+        free(path);
+    }
+    return unexpected;
+}
@@ -6,9 +6,18 @@
  */
 #include <assert.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #define stat xv6_stat // 避免与主机的struct stat冲突
@@ -18,11 +27,780 @@
 #include "./xv6-public/param.h"
 #include "./xv6-public/stat.h"
 #include "./xv6-public/types.h"
+#undef stat // 之后的struct stat指主机的stat
+
+#define CACHE_BLOCKS 64 // 块缓存的容量
+#define GRAPH_MAGIC "XCHECK1" // 引用图缓存文件的标识，格式变化时修改
+#define MIN_INODES_PER_THREAD 1024 // 每个扫描线程至少分到的inode数，inode较少时不值得启动线程
+#define NUM_CHECKS 14 // 错误检查的项数
+#define DPB (BSIZE / sizeof(struct dirent)) // 每个目录块中的目录项数
+#ifdef NDINDIRECT // fs.h启用了二级间接块：addrs[NDIRECT]为一级间接块，addrs[NDIRECT + 1]为二级间接块
+#define NADDRS (NDIRECT + 2) // inode中的地址数
+#define INODE_BLOCKS (NADDRS + NINDIRECT + NINDIRECT + NDINDIRECT) // 一个inode最多使用的块数，含各级间接块本身
+#else
+#define NADDRS (NDIRECT + 1) // inode中的地址数
+#define INODE_BLOCKS (NADDRS + NINDIRECT) // 一个inode最多使用的块数，含间接块本身
+#endif
+#define MAX_PHASES 16 // --stats最多记录的阶段数
+#define PLAN_MAX_BLOCKS (1 << 18) // 使用块缓存时最多按计划预读的块数，其余的块仍经块缓存读取
+#define PLAN_DATA     1 // 计划中的目录数据块
+#define PLAN_IND      2 // 计划中普通文件或设备的一级间接块，其中的块号不再读取
+#define PLAN_DIR_IND  3 // 计划中目录的一级间接块，其中的块号是目录的数据块
+#define PLAN_DIND     4 // 计划中普通文件或设备的二级间接块，其中的块号是一级间接块
+#define PLAN_DIR_DIND 5 // 计划中目录的二级间接块
+#ifdef NINLINE // fs.h启用了内联数据：不超过NINLINE字节的普通文件把数据存放在addrs中，不占用数据块
+#define IS_INLINE(nd) ((nd)->type == T_FILE && (nd)->size <= NINLINE)
+#else
+#define IS_INLINE(nd) 0
+#endif
 
 int img_file; // 文件系统镜像的文件描述符
+uchar* img; // 只读映射的整个文件系统镜像；使用块缓存时只含常驻的元数据块
+size_t img_size; // 镜像的字节数
+int mapped; // 为1时img是镜像的只读映射
+
+/**
+ * 块缓存的一项
+ * 镜像无法映射时（如块设备），元数据块之外的块经由块缓存读取，按LRU淘汰
+ */
+struct cache_entry {
+    uint          block;        // 缓存的块号
+    unsigned long used;         // 最近一次访问的时间戳，淘汰时选最小者
+    int           valid;        // 为1时data有效
+    uchar         data[BSIZE];  // 块内容
+};
+
+struct cache_entry cache[CACHE_BLOCKS];
+unsigned long cache_clock; // 块缓存的访问计数，作为时间戳
+int cached; // 为1时元数据块之外的块经块缓存读取
+uint meta_blocks; // 使用块缓存时img中常驻的块数：引导块、超级块、日志、inode表和位图
+uchar** planned; // 使用块缓存时由plan_reads预读的块内容，每块一项，未预读的块为NULL
+uint plan_blocks; // plan_reads考虑的块数：文件系统和镜像中较小的一个
+uchar* plan_kind; // plan_reads中每块的计划类型PLAN_*，0表示不在计划中
 
 struct superblock sblock; // 超级块结构体
-struct dinode cur_inode; // 当前处理的inode
+
+uint* ref_cnt; // 每个inode被目录项引用的次数，不含"."和".."
+uint* parent; // 每个inode首次被引用时所在的目录
+
+/**
+ * 可增长的编号列表，用于记录引用图的边和块号
+ */
+struct id_list {
+    uint* items;  // 编号
+    uint  count;  // items中的编号数
+    uint  cap;    // items容量
+};
+
+const char* graph_path; // -c指定的引用图缓存文件，为NULL时不读写缓存
+struct id_list graph; // 所有目录的边按目录的inode号依次排列
+struct id_list slots; // 与graph.items一一对应的目录项序号，建立目录项索引后释放
+uint* edge_start; // 第i个目录的边为graph.items[edge_start[i]]到graph.items[edge_start[i + 1]]
+
+/**
+ * 目录项索引的一项：引用某个inode的一个目录项
+ */
+struct dir_ref {
+    uint dir;   // 目录项所在目录的inode号
+    uint slot;  // 目录项在目录文件中的序号，乘以sizeof(struct dirent)即为偏移
+};
+
+struct dir_ref* refs; // 目录项索引，按被引用的inode号排列；增量检查时不建立，为NULL
+uint* ref_start; // 第i个inode的引用为refs[ref_start[i]]到refs[ref_start[i + 1]]，个数等于ref_cnt[i]
+uchar* reach; // 每个目录沿唯一的父目录能否回到根目录，由find_cycles填充
+
+uint64_t* used; // 块使用位图：每块1位，位的排列与磁盘上的位图相同，由mark_inode并行填充
+int shared_blocks; // 为1时有块被使用了不止一次，需要用owner精确定位重复的块
+uint* owner; // 每个块的所有者：使用该块的最小inode号，只在shared_blocks为1时由claim_inode填充
+int* dup_pos; // 每个inode中第一个重复使用本inode已用块的位置，-1表示没有
+
+/**
+ * 一项检查的开销，指定--stats时由check_begin和check_end累计
+ */
+struct check_stats {
+    unsigned long calls;          // 执行次数
+    unsigned long failures;       // 失败次数
+    unsigned long ns;             // 累计耗时（纳秒），含计时本身的开销
+    unsigned long visited;        // 累计访问的条目数：块地址、目录项、位图字或引用计数
+    unsigned long start_ns;       // 本次执行开始的时间
+    unsigned long start_visited;  // 本次执行开始时的visited
+};
+
+/**
+ * 一个阶段的耗时，阶段内可能有多个线程
+ */
+struct phase_stats {
+    const char*   name;  // 阶段名
+    unsigned long ns;    // 耗时（纳秒）
+};
+
+int show_stats; // 为1时（--stats）退出前输出各阶段和各项检查的开销
+__thread unsigned long visited; // 当前线程访问过的条目数，各项检查在循环中累加
+struct check_stats main_stats[NUM_CHECKS + 1]; // 主线程在扫描之外执行的检查3、6的开销
+struct check_stats* thread_stats; // 每个扫描线程一组，每组NUM_CHECKS + 1项，下标为检查编号
+int num_thread_stats; // thread_stats的组数
+struct phase_stats phases[MAX_PHASES]; // 按执行顺序记录的阶段
+int num_phases; // phases中的阶段数
+unsigned long read_calls; // read和pread的调用次数
+unsigned long read_bytes; // read和pread读到的字节数
+unsigned long cache_hits; // 块缓存命中次数
+unsigned long cache_misses; // 块缓存未命中次数
+unsigned long planned_reads; // plan_reads按计划读取或预读的块数
+
+unsigned long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/**
+ * 一项检查失败的记录
+ */
+struct violation {
+    uint        inode_num;  // 出错的inode号
+    int         check;      // 失败的检查编号，修复模式据此判断能否修复
+    const char* error;      // 错误信息
+};
+
+/**
+ * 一个扫描线程负责的inode范围[begin, end)及其扫描结果
+ */
+struct scan_range {
+    uint                begin;           // 范围内第一个inode号
+    uint                end;             // 范围之后的第一个inode号
+    struct violation*   violations;      // 范围内发现的错误，按inode号递增
+    uint                num_violations;  // violations中的错误数
+    uint                cap;             // violations容量
+    struct check_stats* stats;           // 本线程的检查开销，指向thread_stats中的一组
+};
+
+uint first_error; // 各线程已发现错误的最小inode号，更大的inode不必再检查
+int report_all; // 为1时（-a）收集所有错误后统一输出，否则遇到第一个错误即退出
+int repair; // 为1时（-r）修复位图、文件的引用计数和孤立inode，隐含-a
+
+uchar** dirty; // 修复模式下每个块修改后的内容，未修改的块为NULL
+uint next_free_block; // 修复时分配新块的查找起点
+
+uchar zero_block[BSIZE]; // 块号超出镜像时返回的全零块
+
+/**
+ * 从镜像的offset处读满len字节
+ * 
+ * @return 成功返回0，读取失败或读到文件末尾返回-1
+ */
+int read_at(void* buf, size_t len, off_t offset) {
+    size_t done = 0;
+    while(done < len) {
+        ssize_t n = pread(img_file, (uchar*)buf + done, len - done, offset + done);
+        read_calls++;
+        if(n <= 0)
+            return -1;
+        read_bytes += n;
+        done += n;
+    }
+    return 0;
+}
+
+/**
+ * 经块缓存读取第block块
+ * 
+ * 算法:
+ * 1. 在缓存中查找该块，命中则更新访问时间戳后返回
+ * 2. 未命中时淘汰时间戳最小（最久未使用）的一项，用pread读入该块
+ * 
+ * 说明:
+ * 返回的指针在之后又访问CACHE_BLOCKS个其他块之前一直有效，
+ * 因此遍历间接块时每次都重新调用block_at取间接块，使其保持为最近使用
+ * 
+ * @param block 块号
+ * @return 块内容的指针
+ */
+void* cache_get(uint block) {
+    struct cache_entry* victim = &cache[0];
+    for(uint i = 0; i < CACHE_BLOCKS; ++i) {
+        if(cache[i].valid && cache[i].block == block) {
+            cache[i].used = ++cache_clock;
+            cache_hits++;
+            return cache[i].data; // 命中
+        }
+        if(cache[i].used < victim->used)
+            victim = &cache[i];
+    }
+
+    cache_misses++;
+    if(read_at(victim->data, BSIZE, (off_t)block * BSIZE) < 0)
+        memset(victim->data, 0, BSIZE); // 与越界读取一样视为全零块
+    victim->block = block;
+    victim->valid = 1;
+    victim->used  = ++cache_clock;
+    return victim->data;
+}
+
+/**
+ * 取得镜像中第block块的指针
+ * 
+ * 说明:
+ * 块号超出镜像范围时返回全零块，与原先越界read读不到数据时的行为一致，
+ * 避免损坏的镜像让检查器访问映射之外的内存
+ * 
+ * @param block 块号
+ * @return 块内容的指针
+ */
+void* block_at(uint block) {
+    if((size_t)block * BSIZE + BSIZE > img_size)
+        return zero_block;
+    if(cached && block >= meta_blocks) {
+        if(planned != NULL && block < plan_blocks && planned[block] != NULL)
+            return planned[block];
+        return cache_get(block);
+    }
+    return img + (size_t)block * BSIZE;
+}
+
+/**
+ * 取得第inode_num个磁盘inode的指针，main中已确认整个inode表位于镜像之内，
+ * 使用块缓存时inode表常驻于img中
+ * 
+ * @param inode_num inode号
+ * @return inode的指针
+ */
+struct dinode* inode_at(uint inode_num) {
+    return (struct dinode*)(img + (size_t)sblock.inodestart * BSIZE) + inode_num;
+}
+
+/**
+ * 查询位图中第block块对应的位
+ * 
+ * @param block 块号
+ * @return 块被标记为使用返回1，否则返回0
+ */
+int bitmap_bit(uint block) {
+    uchar* bits = block_at(sblock.bmapstart + block / (8 * BSIZE));
+    return (bits[block % (8 * BSIZE) / 8] >> (block % 8)) & 1;
+}
+
+/**
+ * 在列表末尾追加一个编号
+ */
+void list_push(struct id_list* list, uint id) {
+    if(list->count == list->cap) {
+        list->cap   = list->cap ? list->cap * 2 : 16;
+        list->items = realloc(list->items, list->cap * sizeof(uint));
+        if(list->items == NULL) {
+            fprintf(stderr, "malloc failed\n");
+            close(img_file);
+            exit(1);
+        }
+    }
+    list->items[list->count++] = id;
+}
+
+/**
+ * 一个inode使用的所有块号，由decode_blocks解码
+ * 
+ * 说明:
+ * blocks的排列与claim_block的pos相同：
+ * - 0到NADDRS-1为inode中的地址：直接块、一级间接块本身，启用时还有二级间接块本身
+ * - 之后NINDIRECT项为一级间接块中的块号
+ * - 启用二级间接块时，再之后NINDIRECT项为二级间接块中的间接块号，最后NDINDIRECT项为这些间接块中的块号
+ * 只有前count项有效，文件没有用到的间接块对应的部分全为0
+ */
+struct inode_blocks {
+    uint count;                // 有效的项数
+    uint blocks[INODE_BLOCKS]; // 块号
+};
+
+/**
+ * 解码一个inode使用的所有块号
+ * 
+ * 说明:
+ * 各级间接块只在这里读取一次，mark_inode、claim_inode、scan_dir和各项检查共用结果；
+ * 复制出来而不是保留block_at的指针，因为使用块缓存时之后的访问可能淘汰该块。
+ * 超出文件系统的间接块不读取，它的地址由错误检查2报告；
+ * 内联文件的addrs是文件数据而不是块号，解码为全0，即不使用任何块
+ * 
+ * @param nd 要解码的inode
+ * @param list 返回块号
+ */
+void decode_blocks(const struct dinode* nd, struct inode_blocks* list) {
+    if(IS_INLINE(nd)) {
+        memset(list->blocks, 0, NADDRS * sizeof(uint));
+        list->count = NADDRS;
+        return;
+    }
+
+    memcpy(list->blocks, nd->addrs, NADDRS * sizeof(uint));
+    list->count = NADDRS;
+
+    uint ind = nd->addrs[NDIRECT];
+    if(ind != 0 && ind < sblock.size) {
+        memcpy(list->blocks + NADDRS, block_at(ind), NINDIRECT * sizeof(uint));
+        list->count = NADDRS + NINDIRECT;
+    }
+
+#ifdef NDINDIRECT
+    uint dind = nd->addrs[NDIRECT + 1];
+    if(dind != 0 && dind < sblock.size) {
+        if(list->count == NADDRS)
+            memset(list->blocks + NADDRS, 0, NINDIRECT * sizeof(uint));
+
+        uint* level1 = list->blocks + NADDRS + NINDIRECT;
+        memcpy(level1, block_at(dind), NINDIRECT * sizeof(uint));
+        for(uint i = 0; i < NINDIRECT; ++i) {
+            uint* data = list->blocks + NADDRS + 2 * NINDIRECT + i * NINDIRECT;
+            if(level1[i] != 0 && level1[i] < sblock.size)
+                memcpy(data, block_at(level1[i]), NINDIRECT * sizeof(uint));
+            else
+                memset(data, 0, NINDIRECT * sizeof(uint));
+        }
+        list->count = INODE_BLOCKS;
+    }
+#endif
+}
+
+/**
+ * 取得inode_blocks中第pos项在文件中的逻辑块号
+ * 
+ * @param pos 块在inode中的位置
+ * @return 数据块返回逻辑块号，各级间接块本身返回-1
+ */
+int file_block(uint pos) {
+    if(pos < NDIRECT)
+        return pos;
+    if(pos < NADDRS)
+        return -1; // inode中的间接块地址
+    if(pos < NADDRS + NINDIRECT)
+        return NDIRECT + (pos - NADDRS);
+#ifdef NDINDIRECT
+    if(pos < NADDRS + 2 * NINDIRECT)
+        return -1; // 二级间接块中的间接块地址
+    return NDIRECT + NINDIRECT + (pos - NADDRS - 2 * NINDIRECT);
+#else
+    return -1;
+#endif
+}
+
+/**
+ * 整块解析出的目录数据块
+ * 目录项序号i对应各掩码的第i位
+ */
+struct dir_block {
+    uint     inums[DPB];  // 各目录项的inode号
+    uint64_t valid;       // inum非零的目录项
+    uint64_t dot;         // 名字为"."的目录项
+    uint64_t dotdot;      // 名字为".."的目录项
+};
+
+_Static_assert(DPB <= 64, "dir_block的掩码放不下一个块的目录项");
+
+/**
+ * 一次解析整个目录数据块
+ * 
+ * 算法:
+ * 1. 每个目录项以一个64位字读入，低16位为inum，其后依次是名字的前6个字节
+ * 2. strncmp(name, ".", DIRSIZ)只比较到第一个'\0'，所以名字为"."当且仅当前两个字节为'.'和'\0'，
+ *    为".."当且仅当前三个字节为'.'、'.'和'\0'，对读入的字各做一次掩码比较即可，不必比较14字节的名字
+ * 3. 循环内没有分支，编译器可以向量化；比较结果按目录项序号汇成位掩码，inum同时收集到inums中
+ * 
+ * @param block 目录的数据块号
+ * @param out 返回解析结果
+ */
+void load_dir_block(uint block, struct dir_block* out) {
+    const uchar* data   = block_at(block);
+    uint64_t     valid  = 0;
+    uint64_t     dot    = 0;
+    uint64_t     dotdot = 0;
+
+    for(uint i = 0; i < DPB; ++i) {
+        uint64_t word;
+        memcpy(&word, data + i * sizeof(struct dirent), sizeof(word)); // inum和name[0..5]
+        uint64_t name = word >> (8 * sizeof(ushort));
+
+        out->inums[i] = (ushort)word;
+        valid  |= (uint64_t)((ushort)word != 0) << i;
+        dot    |= (uint64_t)((name & 0xffff) == '.') << i;
+        dotdot |= (uint64_t)((name & 0xffffff) == ('.' | '.' << 8)) << i;
+    }
+    out->valid  = valid;
+    out->dot    = dot;
+    out->dotdot = dotdot;
+}
+
+/**
+ * 找出目录数据块中inode号为inum的目录项
+ * 
+ * @param dir load_dir_block解析出的目录数据块
+ * @param inum 要查找的inode号
+ * @return 目录项的位掩码
+ */
+uint64_t match_inum(const struct dir_block* dir, uint inum) {
+    uint64_t mask = 0;
+    for(uint i = 0; i < DPB; ++i)
+        mask |= (uint64_t)(dir->inums[i] == inum) << i;
+    return mask;
+}
+
+/**
+ * 统计一个目录数据块中的引用
+ * 
+ * 算法:
+ * 1. 用load_dir_block整块解析数据块，按目录项序号遍历有效目录项的掩码
+ * 2. 跳过空目录项、"."和".."，以及超出inode表范围的inode号
+ * 3. 被引用inode的ref_cnt加1，首次被引用时记录所在目录为parent
+ * 4. out不为NULL时把被引用的inode号追加到out中，out_slots不为NULL时同时追加目录项序号
+ * 
+ * @param block 目录的数据块号
+ * @param dir_num 该数据块所属目录的inode号
+ * @param first_slot 该数据块第一个目录项在目录文件中的序号
+ * @param out 记录边的列表，可以为NULL
+ * @param out_slots 记录目录项序号的列表，可以为NULL
+ */
+void scan_dir_block(uint block, uint dir_num, uint first_slot, struct id_list* out, struct id_list* out_slots) {
+    if(block == 0 || block >= sblock.size)
+        return; // 非法块号由错误检查2报告
+
+    struct dir_block dir;
+    load_dir_block(block, &dir);
+
+    for(uint64_t live = dir.valid & ~(dir.dot | dir.dotdot); live != 0; live &= live - 1) {
+        uint i    = __builtin_ctzll(live);
+        uint inum = dir.inums[i];
+        if(inum >= sblock.ninodes)
+            continue;
+
+        if(ref_cnt[inum]++ == 0)
+            parent[inum] = dir_num;
+
+        if(out != NULL)
+            list_push(out, inum);
+        if(out_slots != NULL)
+            list_push(out_slots, first_slot + i);
+    }
+}
+
+/**
+ * 统计一个目录的直接块和各级间接块指向的所有数据块中的引用
+ * 
+ * @param dir_num 目录的inode号
+ * @param out 记录边的列表，可以为NULL
+ * @param out_slots 记录目录项序号的列表，可以为NULL
+ */
+void scan_dir(uint dir_num, struct id_list* out, struct id_list* out_slots) {
+    struct inode_blocks list;
+    decode_blocks(inode_at(dir_num), &list);
+
+    for(uint pos = 0; pos < list.count; ++pos)
+        if(file_block(pos) >= 0)
+            scan_dir_block(list.blocks[pos], dir_num, file_block(pos) * DPB, out, out_slots);
+}
+
+#define REACH_UNKNOWN 0 // 尚未确定
+#define REACH_ON_PATH 1 // 在当前查找的路径上
+#define REACH_ROOT    2 // 能回到根目录，或父目录链在被检查9、12报告的目录处中断
+#define REACH_CYCLE   3 // 父目录链进入了环，从根目录无法到达
+
+/**
+ * 找出从根目录无法到达的目录环
+ * 
+ * 算法:
+ * 1. 从每个尚未确定的目录出发，沿目录项索引中唯一引用它的目录向上走
+ * 2. 到达根目录、非目录或引用数不为1的目录时停止，路径上的目录都记为REACH_ROOT
+ * 3. 走回当前路径上的目录说明遇到了环，遇到已记为REACH_CYCLE的目录说明通向环，
+ *    路径上的目录都记为REACH_CYCLE
+ * 
+ * 说明:
+ * 每个目录只被确定一次，总复杂度为O(inode数)；
+ * 引用数为0或大于1的目录已由检查9、12报告，这里不再把其下的目录重复报告为无法到达
+ */
+void find_cycles() {
+    uint* path = malloc(sblock.ninodes * sizeof(uint));
+    reach      = calloc(sblock.ninodes, 1);
+    if(path == NULL || reach == NULL) {
+        fprintf(stderr, "malloc failed\n");
+        close(img_file);
+        exit(1);
+    }
+
+    for(uint dir = 2; dir < sblock.ninodes; ++dir) {
+        uint  len    = 0;
+        uint  cur    = dir;
+        uchar result = REACH_ROOT;
+        for(;;) {
+            if(reach[cur] != REACH_UNKNOWN) {
+                result = reach[cur] == REACH_ROOT ? REACH_ROOT : REACH_CYCLE; // 走回当前路径，或通向已知的环
+                break;
+            }
+            reach[cur]  = REACH_ON_PATH;
+            path[len++] = cur;
+            if(cur == 1 || inode_at(cur)->type != T_DIR || ref_cnt[cur] != 1)
+                break; // 父目录链的终点
+            cur = refs[ref_start[cur]].dir;
+        }
+
+        for(uint i = 0; i < len; ++i)
+            reach[path[i]] = result;
+    }
+    free(path);
+}
+
+/**
+ * 预先遍历所有目录，建立inode的引用计数和父目录表
+ * 
+ * 算法:
+ * 1. 顺序遍历inode表
+ * 2. 对每个目录inode，统计其直接块和间接块指向的所有数据块中的目录项
+ * 3. 同时按目录记录引用图；指定-c时保存到缓存中供增量检查使用
+ * 4. 把引用图转置为按被引用inode排列的目录项索引，再由find_cycles找出目录环
+ * 
+ * 说明:
+ * 错误检查9、11、12原先对每个待检查的inode都重新扫描全部目录，
+ * 复杂度为O(inode数 x 目录项数)；改为在主循环之前扫描一次，
+ * 之后每项检查只需O(1)查表，检查13还可以O(1)查到引用目录的所有目录项
+ */
+void build_refs() {
+    struct dinode* inodes = inode_at(0);
+    ref_cnt    = calloc(sblock.ninodes, sizeof(uint));
+    parent     = calloc(sblock.ninodes, sizeof(uint));
+    edge_start = calloc((size_t)sblock.ninodes + 1, sizeof(uint));
+    if(ref_cnt == NULL || parent == NULL || edge_start == NULL) {
+        fprintf(stderr, "malloc failed\n");
+        close(img_file);
+        exit(1);
+    }
+
+    for(uint i = 0; i < sblock.ninodes; ++i) {
+        edge_start[i] = graph.count;
+        if(inodes[i].type == T_DIR)
+            scan_dir(i, &graph, &slots);
+    }
+    edge_start[sblock.ninodes] = graph.count;
+
+    // 转置：第i个inode的引用占ref_cnt[i]项，按目录的inode号顺序依次填入
+    ref_start      = malloc(((size_t)sblock.ninodes + 1) * sizeof(uint));
+    refs           = malloc(((size_t)graph.count + 1) * sizeof(struct dir_ref));
+    uint* next_ref = malloc(sblock.ninodes * sizeof(uint));
+    if(ref_start == NULL || refs == NULL || next_ref == NULL) {
+        fprintf(stderr, "malloc failed\n");
+        close(img_file);
+        exit(1);
+    }
+    ref_start[0] = 0;
+    for(uint i = 0; i < sblock.ninodes; ++i) {
+        ref_start[i + 1] = ref_start[i] + ref_cnt[i];
+        next_ref[i]      = ref_start[i];
+    }
+    for(uint dir = 0; dir < sblock.ninodes; ++dir) {
+        for(uint e = edge_start[dir]; e < edge_start[dir + 1]; ++e) {
+            struct dir_ref* r = &refs[next_ref[graph.items[e]]++];
+            r->dir            = dir;
+            r->slot           = slots.items[e];
+        }
+    }
+    free(next_ref);
+    free(slots.items);
+
+    find_cycles();
+}
+
+/**
+ * 加载文件系统镜像
+ * 
+ * 算法:
+ * 1. 普通文件直接只读映射整个镜像
+ * 2. 无法映射但可以定位的镜像（如块设备）改用块缓存：
+ *    a. 先读入超级块，据此一次性预读引导块到位图末尾的全部元数据块，常驻于img中
+ *    b. 目录块和间接块由plan_reads按块号升序预读，其余数据块在访问时经LRU块缓存读取
+ * 3. 无法定位的镜像（如管道）只能顺序读取，整个读入内存
+ * 
+ * 说明:
+ * 三种方式下每个块在一次运行中都只从镜像读取一次（块缓存淘汰后重新访问的块除外），
+ * 所有error_check_*函数都通过block_at和inode_at访问镜像，不关心镜像的来源
+ * 
+ * @return 成功返回0，失败返回-1
+ */
+int load_image() {
+    struct stat st;
+    if(fstat(img_file, &st) < 0)
+        return -1;
+
+    if(S_ISREG(st.st_mode)) {
+        img_size = st.st_size;
+        if(img_size < 2 * BSIZE)
+            return -1;
+        img = mmap(NULL, img_size, PROT_READ, MAP_PRIVATE, img_file, 0);
+        mapped = img != MAP_FAILED;
+        if(mapped)
+            return 0;
+    }
+
+    off_t end = lseek(img_file, 0, SEEK_END);
+    if(end >= 0) {
+        img_size = end;
+        if(img_size < 2 * BSIZE || read_at(&sblock, sizeof(sblock), BSIZE) < 0)
+            return -1;
+
+        // 预读元数据块：inode表和位图之后会被反复访问
+        uint inode_end  = sblock.inodestart + sblock.ninodes / IPB + 1;
+        uint bitmap_end = sblock.bmapstart + sblock.size / BPB + 1;
+        meta_blocks = inode_end > bitmap_end ? inode_end : bitmap_end;
+        if((size_t)meta_blocks * BSIZE > img_size)
+            meta_blocks = img_size / BSIZE;
+
+        img = malloc((size_t)meta_blocks * BSIZE);
+        if(img == NULL || read_at(img, (size_t)meta_blocks * BSIZE, 0) < 0)
+            return -1;
+        cached = 1;
+        return 0;
+    }
+
+    // 管道等无法定位的输入，顺序读入整个镜像
+    size_t cap = 64 * BSIZE;
+    img_size = 0;
+    img      = malloc(cap);
+    while(img != NULL) {
+        ssize_t n = read(img_file, img + img_size, cap - img_size);
+        read_calls++;
+        if(n < 0)
+            return -1;
+        read_bytes += n;
+        if(n == 0)
+            return img_size < 2 * BSIZE ? -1 : 0;
+
+        img_size += n;
+        if(img_size == cap)
+            img = realloc(img, cap *= 2);
+    }
+    return -1;
+}
+
+/**
+ * 把一个块加入下一轮预读计划，每块只加入一次
+ * 
+ * @param wave 下一轮要读取的块号
+ * @param block 块号，非法块号由错误检查2报告，这里跳过
+ * @param kind 块的计划类型PLAN_*
+ */
+void plan_block(struct id_list* wave, uint block, uchar kind) {
+    if(block == 0 || block >= plan_blocks || block < meta_blocks || plan_kind[block] != 0)
+        return; // 元数据块在使用块缓存时已常驻，映射镜像时由inode表的顺序扫描读入
+    plan_kind[block] = kind;
+    list_push(wave, block);
+}
+
+int compare_blocks(const void* a, const void* b) {
+    uint x = *(const uint*)a;
+    uint y = *(const uint*)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * 按块号升序读取一轮计划中的块
+ * 
+ * 说明:
+ * 使用块缓存时块号连续的块合并为一次pread读入新分配的缓冲区，内容记入planned；
+ * 映射镜像时对块号连续的块发出MADV_WILLNEED，由内核按升序异步读入，之后的缺页命中页缓存
+ * 
+ * @param blocks 升序排列的块号
+ * @param n 块数
+ * @return 使用块缓存时返回块内容，第i块位于第i * BSIZE字节；映射镜像时返回NULL
+ */
+uchar* fetch_blocks(const uint* blocks, uint n) {
+    uchar* data = NULL;
+    if(cached && n > 0 && (data = malloc((size_t)n * BSIZE)) == NULL) {
+        fprintf(stderr, "malloc failed\n");
+        close(img_file);
+        exit(1);
+    }
+    size_t page = sysconf(_SC_PAGESIZE);
+    uint   run;
+    for(uint i = 0; i < n; i += run) {
+        for(run = 1; i + run < n && blocks[i + run] == blocks[i] + run; ++run)
+            ;
+        if(cached) {
+            uchar* dst = data + (size_t)i * BSIZE;
+            if(read_at(dst, (size_t)run * BSIZE, (off_t)blocks[i] * BSIZE) < 0)
+                memset(dst, 0, (size_t)run * BSIZE); // 与越界读取一样视为全零块
+            for(uint j = 0; j < run; ++j)
+                planned[blocks[i + j]] = dst + (size_t)j * BSIZE;
+        } else {
+            size_t from = (size_t)blocks[i] * BSIZE / page * page;
+            madvise(img + from, (size_t)(blocks[i] + run) * BSIZE - from, MADV_WILLNEED);
+        }
+    }
+    planned_reads += n;
+    return data;
+}
+
+/**
+ * 按块号升序预读之后的检查会访问的目录块和间接块
+ * 
+ * 算法:
+ * 1. 顺序扫描inode表，收集目录的直接块和所有inode的一级、二级间接块
+ * 2. 每一轮把收集到的块按块号排序后读入，再从本轮读到的间接块中收集下一轮的块：
+ *    目录的间接块中是目录的数据块，二级间接块中是一级间接块，普通文件的一级间接块不再展开
+ * 3. 二级间接块最多需要三轮，每轮都是一次升序扫描
+ * 
+ * 说明:
+ * 原先decode_blocks和scan_dir按检查的顺序读取，在inode表、间接块和分散的目录块之间来回跳转；
+ * 在机械硬盘或网络存储上，按计划升序读取接近顺序扫描镜像的速度。
+ * 使用块缓存时预读超过PLAN_MAX_BLOCKS块后停止，余下的块和损坏的块号指向的块仍经块缓存读取
+ */
+void plan_reads() {
+    plan_blocks = img_size / BSIZE < sblock.size ? img_size / BSIZE : sblock.size;
+    plan_kind   = calloc(plan_blocks, 1);
+    if(cached)
+        planned = calloc(plan_blocks, sizeof(uchar*));
+    if(plan_kind == NULL || (cached && planned == NULL)) {
+        fprintf(stderr, "malloc failed\n");
+        close(img_file);
+        exit(1);
+    }
+
+    struct id_list wave   = {NULL, 0, 0};
+    struct id_list next   = {NULL, 0, 0};
+    struct dinode* inodes = inode_at(0);
+    for(uint i = 0; i < sblock.ninodes; ++i) {
+        const struct dinode* nd = &inodes[i];
+        if(nd->type == 0 || IS_INLINE(nd))
+            continue;
+        int dir = nd->type == T_DIR;
+        for(uint j = 0; dir && j < NDIRECT; ++j)
+            plan_block(&wave, nd->addrs[j], PLAN_DATA);
+        plan_block(&wave, nd->addrs[NDIRECT], dir ? PLAN_DIR_IND : PLAN_IND);
+#ifdef NDINDIRECT
+        plan_block(&wave, nd->addrs[NDIRECT + 1], dir ? PLAN_DIR_DIND : PLAN_DIND);
+#endif
+    }
+
+    uint budget = PLAN_MAX_BLOCKS;
+    while(wave.count > 0) {
+        qsort(wave.items, wave.count, sizeof(uint), compare_blocks);
+        uint n = wave.count;
+        if(cached && n > budget)
+            n = budget;
+        uchar* data = fetch_blocks(wave.items, n);
+        budget -= cached ? n : 0;
+
+        next.count = 0;
+        for(uint i = 0; i < n; ++i) {
+            uint  block = wave.items[i];
+            uchar kind  = plan_kind[block];
+            uchar child = kind == PLAN_DIR_IND ? PLAN_DATA : kind == PLAN_DIND ? PLAN_IND : kind == PLAN_DIR_DIND ? PLAN_DIR_IND : 0;
+            if(child == 0)
+                continue;
+            const uint* addrs = (const uint*)(cached ? data + (size_t)i * BSIZE : block_at(block));
+            for(uint j = 0; j < NINDIRECT; ++j)
+                plan_block(&next, addrs[j], child);
+        }
+        struct id_list swap = wave;
+        wave                = next;
+        next                = swap;
+    }
+    free(wave.items);
+    free(next.items);
+    free(plan_kind);
+    plan_kind = NULL;
+}
 
 /**
  * 错误检查1：检查inode类型是否有效
@@ -47,6 +825,7 @@ struct dinode cur_inode; // 当前处理的inode
  * @return 如果类型无效返回1，否则返回0
  */
 int error_check_1(struct dinode nd) {
+    visited++;
     if(nd.type != 0 && nd.type != T_DEV && nd.type != T_DIR && nd.type != T_FILE) 
         return 1; // 发现无效类型
     return 0;
@@ -60,7 +839,7 @@ int error_check_1(struct dinode nd) {
  *    - 下界：位图区域之后 (bitmap_end)
  *    - 上界：文件系统总大小 (fs_end)
  * 2. 检查inode的所有直接块指针是否在有效范围内
- * 3. 如果inode有间接块，读取间接块内容并检查其指向的所有数据块地址
+ * 3. 如果inode有间接块，检查其指向的所有数据块地址（已由decode_blocks读出）
  * 
  * 判断标准:
  * - 每个非零地址必须大于等于bitmap_end（位图末尾）
@@ -73,30 +852,21 @@ int error_check_1(struct dinode nd) {
  * 2. 访问文件系统界外的内存区域，造成程序崩溃
  * 3. 多个文件错误地共享数据块，导致数据损坏
  * 
- * @param nd 要检查的inode
+ * @param list decode_blocks解码出的块号
  * @return 如果有无效地址返回1，否则返回0
  */
-int error_check_2(struct dinode nd) {
+int error_check_2(const struct inode_blocks* list) {
     uint bitmap_end = sblock.bmapstart + sblock.size / (8 * BSIZE); // 位图结束位置
     uint fs_end = sblock.size - 1; // 文件系统结束位置
 
     if(sblock.size % (8 * BSIZE) != 0)
         bitmap_end++; // 如果有余数，向上取整
     
-    // 循环检查所有直接指针
-    for(uint i = 0; i < NDIRECT + 1; ++i) 
-        if(nd.addrs[i] != 0 && (nd.addrs[i] < bitmap_end || nd.addrs[i] > fs_end)) 
+    // 依次检查inode中的地址和各级间接块中的所有地址
+    for(uint i = 0; i < list->count; ++i) {
+        visited++;
+        if(list->blocks[i] != 0 && (list->blocks[i] < bitmap_end || list->blocks[i] > fs_end)) 
             return 1; // 地址超出有效范围
-        
-    // 检查间接指针指向的所有数据块
-    if(nd.addrs[NDIRECT] != 0) {
-        uint ndirect_ptr;
-        lseek(img_file, nd.addrs[NDIRECT] * BSIZE, SEEK_SET); // 定位到间接块
-        for(uint i = 0; i < NINDIRECT; ++i) {
-            read(img_file, &ndirect_ptr, sizeof(uint)); // 读取指针值
-            if(ndirect_ptr != 0 && (ndirect_ptr < bitmap_end || ndirect_ptr > fs_end)) 
-                return 1; // 地址超出有效范围
-        }
     }
     
     return 0;
@@ -125,25 +895,22 @@ int error_check_2(struct dinode nd) {
  * @return 如果根目录不存在或设置错误返回1，否则返回0
  */
 int error_check_3() {
-    struct dinode root_inode;
-    lseek(img_file, sblock.inodestart * BSIZE + sizeof(struct dinode), SEEK_SET); // 定位到根inode（inode 1）
-    read(img_file, &root_inode, sizeof(struct dinode));
+    struct dinode* root_inode = inode_at(1); // 根inode（inode 1）
 
-    if(root_inode.type != T_DIR)
+    if(root_inode->type != T_DIR)
         return 1; // 根inode不是目录类型
 
-    struct dirent dir_entry;
     for(uint i = 0; i < NDIRECT; ++i)
-        if(root_inode.addrs[i] != 0) {
-            lseek(img_file, root_inode.addrs[i] * BSIZE, SEEK_SET); // 定位到目录数据块
-            for(uint dir_cnt = 0; dir_cnt < BSIZE / (sizeof(struct dirent)); ++dir_cnt) {
-                read(img_file, &dir_entry, sizeof(struct dirent)); // 读取目录项
-
-                if(dir_entry.inum != 0) 
-                    if(strncmp(dir_entry.name, "..", DIRSIZ) == 0 && dir_entry.inum == 1)
-                        return 0; // 找到正确的".."条目
+        if(root_inode->addrs[i] != 0) {
+            struct dir_block dir; // 目录数据块
+            load_dir_block(root_inode->addrs[i], &dir);
+
+            uint64_t found = dir.dotdot & match_inum(&dir, 1);
+            if(found != 0) {
+                visited += __builtin_ctzll(found) + 1;
+                return 0; // 找到正确的".."条目
             }
-            
+            visited += DPB;
         }
 
     return 1; // 未找到正确的".."条目
@@ -175,19 +942,14 @@ int error_check_3() {
  */
 int error_check_4(struct dinode nd, uint inode_num) {
     int chk = 0;
-    struct dirent dir_entry;
     for(uint i = 0; i < NDIRECT; ++i) {
         if(nd.addrs[i] != 0) {
-            lseek(img_file, nd.addrs[i] * BSIZE, SEEK_SET);
-            for(uint dir_cnt = 0; dir_cnt < BSIZE / (sizeof(struct dirent)); ++dir_cnt) {
-                read(img_file, &dir_entry, sizeof(struct dirent));
-
-                if(strncmp(dir_entry.name, ".", DIRSIZ) == 0 && dir_entry.inum == inode_num)
-                    chk += 1; // 找到"."条目
+            struct dir_block dir;
+            load_dir_block(nd.addrs[i], &dir);
+            visited += DPB;
 
-                if(strncmp(dir_entry.name, "..", DIRSIZ) == 0)
-                    chk += 1; // 找到".."条目
-            }
+            chk += __builtin_popcountll(dir.dot & match_inum(&dir, inode_num)); // 找到"."条目
+            chk += __builtin_popcountll(dir.dotdot); // 找到".."条目
         }
     }
     if(chk != 2) // 必须同时找到"."和".."
@@ -203,7 +965,7 @@ int error_check_4(struct dinode nd, uint inode_num) {
  *    a. 计算该块在位图中的字节位置和位偏移
  *    b. 读取相应位图字节
  *    c. 检查该位是否被设置为1(已使用)
- * 2. 如果inode有间接块，读取间接块内容，对每个非零指针重复上述检查
+ * 2. 如果inode有间接块，对间接块中的每个非零指针重复上述检查（已由decode_blocks读出）
  * 
  * 判断标准:
  * - 对于inode使用的每个非零数据块，位图中对应位必须为1
@@ -216,61 +978,79 @@ int error_check_4(struct dinode nd, uint inode_num) {
  * 2. 可能出现同一块被多个文件使用的情况，造成数据损坏
  * 3. 当其中一个文件删除时可能会错误地释放正在使用的块
  * 
- * @param nd 要检查的inode
+ * @param list decode_blocks解码出的块号
  * @return 如果有数据块被标记为空闲返回1，否则返回0
  */
-int error_check_5(struct dinode nd) {
-    // 检查直接块和间接块指针本身
-    for(uint i = 0; i < NDIRECT + 1; ++i) {
-        if(nd.addrs[i] != 0) {
-            uint usebit, shift_amt;
-
-            lseek(img_file, sblock.bmapstart * BSIZE + nd.addrs[i] / 8, SEEK_SET); // 定位到位图字节
-            read(img_file, &usebit, sizeof(uint));
-
-            shift_amt = nd.addrs[i] % 8; // 计算位偏移
-            usebit >>= shift_amt;
-            if((usebit & 1) == 0) // 检查位是否为1
+int error_check_5(const struct inode_blocks* list) {
+    // 检查直接块、各级间接块本身和间接块指向的所有数据块
+    for(uint i = 0; i < list->count; ++i) {
+        visited++;
+        if(list->blocks[i] != 0) {
+            if(bitmap_bit(list->blocks[i]) == 0) // 检查位是否为1
                 return 1; // 块在位图中被标记为空闲
         }
     }
 
-    // 检查间接块指向的所有数据块
-    if(nd.addrs[NDIRECT] != 0) {
-        uint ndirect_ptr;
-        for(uint i = 0; i < NINDIRECT; ++i) {
-            lseek(img_file, nd.addrs[NDIRECT] * BSIZE + i * sizeof(uint), SEEK_SET);
-            read(img_file, &ndirect_ptr, sizeof(uint));
-            if(ndirect_ptr != 0) {
-                uint usebit, shift_amt;
-
-                lseek(img_file, sblock.bmapstart * BSIZE + ndirect_ptr / 8, SEEK_SET);
-                read(img_file, &usebit, sizeof(uint));
-
-                shift_amt = ndirect_ptr % 8;
-                usebit >>= shift_amt;
-                if((usebit & 1) == 0)
-                    return 1; // 块在位图中被标记为空闲
-            }
+    return 0;
+}
+
+/**
+ * 从start块开始，查找第一个在磁盘位图中标记为使用、但used中未标记的块
+ * 
+ * 算法:
+ * 1. 从start所在的字开始，每次取同一位图块中的8个字（512位，相当于一个AVX-512寄存器或两个AVX2寄存器）
+ * 2. 对每个字计算"磁盘位图 & ~used"，并把8个结果按位或归约；这段循环没有分支，编译器可以向量化
+ * 3. 归约结果非零时，再逐字查找第一个非零字，用__builtin_ctzll得到字内最低的置位
+ * 
+ * 说明:
+ * 磁盘位图中第b块对应第b/8个字节的第b%8位，按小端序每次读取8个字节时正好是used中的一个字；
+ * 调用前used中数据区之外的位都已置1，因此这里不需要再屏蔽元数据块和sblock.size之后的位
+ * 
+ * @param start 开始查找的块号
+ * @return 第一个这样的块号，没有时返回-1
+ */
+long next_stray_block(uint start) {
+    uint words = (sblock.size + 63) / 64;
+    for(uint word = start / 64; word < words;) {
+        uint   block  = word / (BPB / 64); // 该字所在的位图块
+        uchar* bitmap = (uchar*)block_at(sblock.bmapstart + block) + (word % (BPB / 64)) * sizeof(uint64_t);
+        uint   left   = (block + 1) * (BPB / 64) < words ? (block + 1) * (BPB / 64) - word : words - word;
+        uint   n      = left < 8 ? left : 8;
+
+        uint64_t stray[8];
+        for(uint k = 0; k < n; ++k) {
+            uint64_t bits;
+            memcpy(&bits, bitmap + k * sizeof(uint64_t), sizeof(uint64_t));
+            stray[k] = bits & ~used[word + k];
         }
+        if(word == start / 64)
+            stray[0] &= ~(((uint64_t)1 << (start % 64)) - 1); // 忽略start之前的块
+
+        uint64_t any = 0;
+        for(uint k = 0; k < n; ++k)
+            any |= stray[k];
+        visited += n;
+        if(any != 0) {
+            for(uint k = 0; k < n; ++k)
+                if(stray[k] != 0)
+                    return (long)(word + k) * 64 + __builtin_ctzll(stray[k]);
+        }
+        word += n;
     }
-
-    return 0;
+    return -1;
 }
 
 /**
  * 错误检查6：验证位图中标记为使用的块确实被某个inode使用
  * 
  * 算法:
- * 1. 读取文件系统位图的相关部分
- * 2. 对每个位图字节:
- *    a. 解析该字节中的8个位，每位对应一个块
- *    b. 对每个标记为已使用(位值为1)的块，检查in_use数组对应值
- *    c. 如果in_use[块号]为0，表示该块在位图中标记为已使用但实际未找到使用者
+ * 1. 把元数据块（数据区之前的所有块）和sblock.size之后的位都在used中置1，它们不属于任何inode
+ * 2. 由next_stray_block每次比较512位，查找磁盘位图为1而used为0的第一个块
+ * 3. 找到这样的块，表示该块在位图中标记为已使用但实际未找到使用者
  * 
  * 判断标准:
- * - 位图中每个标记为已使用的块，必须能在某个inode的直接块或间接块中找到
- * - 通过in_use数组跟踪实际使用情况，由之前的error_check_7和error_check_8填充
+ * - 位图中每个标记为已使用的数据块，必须能在某个inode的直接块或间接块中找到
+ * - 通过used位图跟踪实际使用情况，由mark_inode填充
  * 
  * 错误影响:
  * 如果位图中块标记为已使用但实际未被使用:
@@ -278,42 +1058,122 @@ int error_check_5(struct dinode nd) {
  * 2. 空闲块无法被分配，造成存储空间浪费
  * 3. 长期积累可能导致"磁盘空间不足"的假象
  * 
- * @param in_use 块使用情况数组，由前面的检查函数填充
  * @return 如果有块被标记为使用但实际未使用返回1，否则返回0
  */
-int error_check_6(uint* in_use) {
-    lseek(img_file, sblock.bmapstart * BSIZE + sblock.size / 8 - sblock.nblocks / 8, SEEK_SET);
+int error_check_6() {
+    uint data_start = sblock.size - sblock.nblocks; // 第一个数据块
+    uint words      = (sblock.size + 63) / 64;
+    if(data_start > sblock.size)
+        data_start = sblock.size;
 
-    uchar bits;
-    uint cnt = sblock.bmapstart + 1;
-    for(uint i = cnt; i < sblock.size; i += 8) {
-        read(img_file, &bits, sizeof(uchar)); // 读取位图字节
+    // 元数据块：整字直接置满，最后不足一字的部分按位置1
+    for(uint w = 0; w < data_start / 64; ++w)
+        used[w] = ~(uint64_t)0;
+    if(data_start % 64 != 0)
+        used[data_start / 64] |= ((uint64_t)1 << (data_start % 64)) - 1;
 
-        for(uint offset = 0; offset < 8; ++offset, ++cnt) {
-            if((bits >> offset) % 2) { // 检查位图中的位
-                if(in_use[cnt] == 0) {
-                    return 1; // 块在位图中被标记为使用但实际未使用
-                }
-            }
-        }
-    }
+    // sblock.size之后的位
+    if(sblock.size % 64 != 0)
+        used[words - 1] |= ~(((uint64_t)1 << (sblock.size % 64)) - 1);
+
+    if(next_stray_block(0) >= 0)
+        return 1; // 块在位图中被标记为使用但实际未使用
 
     return 0;
 }
 
 /**
- * 错误检查7：检查直接块是否被多次使用（存在交叉链接）
+ * 在used中标记block块已被使用
+ * 
+ * 说明:
+ * 用原子或运算置位，发现该位已被置位时记下shared_blocks，之后再用claim_inode精确定位
+ * 
+ * @param block 块号
+ */
+void mark_block(uint block) {
+    if(block == 0 || block >= sblock.size)
+        return; // 非法块号由错误检查2报告
+
+    uint64_t bit = (uint64_t)1 << (block % 64);
+    if(__atomic_fetch_or(&used[block / 64], bit, __ATOMIC_RELAXED) & bit)
+        __atomic_store_n(&shared_blocks, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * 在used中标记一个inode使用的所有块，按decode_blocks的顺序
+ * 
+ * @param inode_num inode号
+ */
+void mark_inode(uint inode_num) {
+    struct dinode* nd = inode_at(inode_num);
+    if(nd->type == 0)
+        return; // 空闲inode不参与检查6、7、8
+
+    struct inode_blocks list;
+    decode_blocks(nd, &list);
+    for(uint i = 0; i < list.count; ++i)
+        mark_block(list.blocks[i]);
+}
+
+/**
+ * 记录inode_num使用了block块
  * 
  * 算法:
- * 1. 对inode的每个直接块指针(包括NDIRECT个直接块和1个间接块指针):
- *    a. 检查该块号是否非零
- *    b. 如果非零，检查该块是否已在in_use数组中标记为已使用
- *    c. 如果已被标记，则表示该块被多次使用
- *    d. 否则，将该块在in_use数组中标记为已使用
+ * 1. 用原子比较交换把owner[block]降为inode_num，各线程并行执行时结果仍是使用该块的最小inode号
+ * 2. 如果owner[block]已经是inode_num，说明本inode在更早的位置已经用过该块，记入dup_pos
  * 
- * 判断标准:
- * - 每个数据块应该只被一个inode的一个块指针使用
- * - 如果in_use[块号]已为1，表示该块已被其他inode或同一inode的其他部分使用
+ * 说明:
+ * 只在mark_inode发现有块被多次使用时执行，正常的镜像不需要owner数组；
+ * 块被更小的inode抢占后，本inode内的重复可能不再被发现，
+ * 但此时块的第一次出现已经满足owner < inode_num，检查7、8在同一位置报告错误，结果不变
+ * 
+ * @param block 块号
+ * @param inode_num 使用该块的inode号
+ * @param pos 块在inode中的位置，见struct inode_blocks
+ */
+void claim_block(uint block, uint inode_num, int pos) {
+    if(block == 0 || block >= sblock.size)
+        return; // 非法块号由错误检查2报告
+
+    uint cur = __atomic_load_n(&owner[block], __ATOMIC_RELAXED);
+    while(cur > inode_num) {
+        if(__atomic_compare_exchange_n(&owner[block], &cur, inode_num, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            return;
+    }
+    if(cur == inode_num && dup_pos[inode_num] < 0)
+        dup_pos[inode_num] = pos;
+}
+
+/**
+ * 记录一个inode使用的所有块，按decode_blocks的顺序
+ * 
+ * @param inode_num inode号
+ */
+void claim_inode(uint inode_num) {
+    struct dinode* nd = inode_at(inode_num);
+    if(nd->type == 0)
+        return; // 空闲inode不参与检查7、8
+
+    struct inode_blocks list;
+    decode_blocks(nd, &list);
+    for(uint i = 0; i < list.count; ++i)
+        claim_block(list.blocks[i], inode_num, i);
+}
+
+/**
+ * 错误检查7：检查直接块是否被多次使用（存在交叉链接）
+ * 
+ * 算法:
+ * 1. 检查dup_pos，看本inode是否在直接块指针范围内重复使用了某个块
+ * 2. 对inode中的每个地址(包括NDIRECT个直接块和各级间接块的地址):
+ *    a. 检查该块号是否非零
+ *    b. 如果非零，检查该块的所有者是否为更小的inode
+ * 
+ * 判断标准:
+ * - 每个数据块应该只被一个inode的一个块指针使用
+ * - owner为NULL表示没有任何块被多次使用，直接通过
+ * - owner[块号]小于本inode号，表示该块已被之前的inode使用；
+ *   与按inode号顺序逐个标记in_use数组的结果相同，但不依赖其他inode的检查顺序，可以并行
  * 
  * 错误影响:
  * 如果直接块被多次使用:
@@ -321,16 +1181,22 @@ int error_check_6(uint* in_use) {
  * 2. 一个文件的写操作会影响另一个文件的内容
  * 3. 删除一个文件可能会导致另一个仍在使用同一块的文件数据丢失
  * 
- * @param nd 要检查的inode
- * @param in_use 块使用情况数组，标记每个块是否已被使用
+ * @param list decode_blocks解码出的块号，前NADDRS项为inode中的地址
+ * @param inode_num inode号
  * @return 如果有直接块被多次使用返回1，否则返回0
  */
-int error_check_7(struct dinode nd, uint *in_use) {
-    for(uint i = 0; i < NDIRECT + 1; ++i) {
-        if(nd.addrs[i] != 0) {
-            if(in_use[nd.addrs[i]])
-                return 1; // 块已被使用
-            in_use[nd.addrs[i]] = 1; // 标记块为已使用
+int error_check_7(const struct inode_blocks* list, uint inode_num) {
+    if(owner == NULL)
+        return 0; // 没有块被多次使用
+
+    if(dup_pos[inode_num] >= 0 && dup_pos[inode_num] < NADDRS)
+        return 1; // 块已被本inode使用
+
+    for(uint i = 0; i < NADDRS; ++i) {
+        visited++;
+        if(list->blocks[i] != 0) {
+            if(owner[list->blocks[i]] < inode_num)
+                return 1; // 块已被之前的inode使用
         }
     }
     return 0;
@@ -340,17 +1206,16 @@ int error_check_7(struct dinode nd, uint *in_use) {
  * 错误检查8：检查间接块指向的块是否被多次使用（存在交叉链接）
  * 
  * 算法:
- * 1. 检查inode是否有间接块(addrs[NDIRECT]非零)
- * 2. 如果有，读取间接块内容
- * 3. 对间接块中的每个块指针:
+ * 1. 检查inode是否有间接块
+ * 2. 如果有，取decode_blocks读出的各级间接块内容
+ * 3. 检查dup_pos，看间接块指向的块是否与本inode更早的块重复
+ * 4. 对间接块中的每个块指针:
  *    a. 检查该指针是否非零
- *    b. 如果非零，检查该块是否已在in_use数组中标记为已使用
- *    c. 如果已标记，则表示该块被多次使用
- *    d. 否则，将该块在in_use数组中标记为已使用
+ *    b. 如果非零，检查该块的所有者是否为更小的inode
  * 
  * 判断标准:
  * - 间接块指向的每个数据块应该只被一次使用
- * - 如果in_use[块号]为1，表示该块已被某个直接块或其他间接块引用
+ * - 重复或所有者更小，表示该块已被某个直接块或其他间接块引用
  * 
  * 错误影响:
  * 与直接块重复类似，但影响的可能是文件的扩展部分:
@@ -358,20 +1223,20 @@ int error_check_7(struct dinode nd, uint *in_use) {
  * 2. 可能导致文件内容不一致
  * 3. 同一块的多次引用会引起释放和修改时的问题
  * 
- * @param nd 要检查的inode
- * @param in_use 块使用情况数组
+ * @param list decode_blocks解码出的块号
+ * @param inode_num inode号
  * @return 如果有间接块被多次使用返回1，否则返回0
  */
-int error_check_8(struct dinode nd, uint *in_use) {
-    if(nd.addrs[NDIRECT] != 0) {
-        uint ndirect_ptr;
-        for(uint i = 0; i < NINDIRECT; ++i) {
-            lseek(img_file, nd.addrs[NDIRECT] * BSIZE + i * sizeof(uint), SEEK_SET);
-            read(img_file, &ndirect_ptr, sizeof(uint));
-            if(ndirect_ptr != 0) {
-                if(in_use[ndirect_ptr] == 1)
-                    return 1; // 块已被使用
-                in_use[ndirect_ptr] = 1; // 标记块为已使用
+int error_check_8(const struct inode_blocks* list, uint inode_num) {
+    if(list->count > NADDRS && owner != NULL) {
+        if(dup_pos[inode_num] >= NADDRS)
+            return 1; // 块已被本inode使用
+
+        for(uint i = NADDRS; i < list->count; ++i) {
+            visited++;
+            if(list->blocks[i] != 0) {
+                if(owner[list->blocks[i]] < inode_num)
+                    return 1; // 块已被之前的inode使用
             }
         }
     }
@@ -382,10 +1247,8 @@ int error_check_8(struct dinode nd, uint *in_use) {
  * 错误检查9：验证标记为使用的inode在某个目录中有条目
  * 
  * 算法:
- * 1. 遍历文件系统中的所有inode
- * 2. 对每个类型为目录且不是待检查inode自身或根目录的inode:
- *    a. 检查其所有直接块和间接块中的目录项
- *    b. 查找是否有目录项引用了待检查的inode号
+ * 1. 查询build_refs预先统计的引用计数ref_cnt[inode_num]
+ * 2. 计数不含"."和".."条目，只统计父目录中以名字引用该inode的目录项
  * 
  * 判断标准:
  * - 除了根目录外，每个已使用的inode必须至少被一个目录项引用
@@ -397,54 +1260,14 @@ int error_check_8(struct dinode nd, uint *in_use) {
  * 2. 占用系统资源但无法被用户使用或释放
  * 3. 可能是文件系统不一致或目录损坏的表现
  * 
- * 注意:
- * 此函数中存在一个bug: 在第一个for循环内使用了i++而非j++，
- * 会导致外层循环变量被错误递增，可能跳过目录检查。
- * 
  * @param inode_num 要检查的inode号
  * @return 如果inode不在任何目录中返回1，否则返回0
  */
 int error_check_9(uint inode_num) {
-    struct dinode tmp_inode;
-    for(uint i = 0; i < sblock.ninodes; ++i) {
-        lseek(img_file, sblock.inodestart * BSIZE + i * sizeof(struct dinode), SEEK_SET);
-        read(img_file, &tmp_inode, sizeof(struct dinode));
-
-        if(tmp_inode.type == T_DIR && inode_num != i && i != 1) {
-            for(uint j = 0; j < NDIRECT; ++i) { // 注意: 这里有个bug，应该是j++而不是i++
-                if(tmp_inode.addrs[j] != 0) {
-                    struct dirent dir_entry;
-
-                    lseek(img_file, tmp_inode.addrs[j] * BSIZE, SEEK_SET);
-                    read(img_file, &dir_entry, sizeof(struct dirent));
-
-                    if(dir_entry.inum == inode_num)
-                        return 0; // 在目录中找到inode引用
-                }
-            }
-
-            // 检查间接块
-            if(tmp_inode.addrs[NDIRECT] != 0) {
-                uint addr;
-                for(uint j = 0; j < NINDIRECT; ++j) {
-                    lseek(img_file, tmp_inode.addrs[NDIRECT] * BSIZE + j * sizeof(uint), SEEK_SET);
-                    read(img_file, &addr, sizeof(uint));
-
-                    if(addr != 0) {
-                        struct dirent dir_entry;
-
-                        lseek(img_file, addr * BSIZE, SEEK_SET);
-                        read(img_file, &dir_entry, sizeof(struct dirent));
-
-                        if(dir_entry.inum == inode_num) 
-                            return 0; // 在目录中找到inode引用
-                    }
-                }
-            }
-
-        }
-    }
-    return 1; // 未在任何目录中找到inode引用
+    visited++;
+    if(ref_cnt[inode_num] == 0)
+        return 1; // 未在任何目录中找到inode引用
+    return 0;
 }
 
 /**
@@ -455,7 +1278,7 @@ int error_check_9(uint inode_num) {
  *    a. 读取所有目录项
  *    b. 对每个非零inum的目录项，读取其引用的inode
  *    c. 检查该inode的type是否为非零(已使用)
- * 2. 如果目录有间接块，对其指向的数据块重复上述检查
+ * 2. 如果目录有间接块，对其指向的非零数据块重复上述检查
  * 
  * 判断标准:
  * - 目录中每个有效目录项(inum非零)必须指向一个非空闲的inode
@@ -467,54 +1290,25 @@ int error_check_9(uint inode_num) {
  * 2. 该空闲inode可能被分配给新文件，造成目录指向错误的数据
  * 3. 表示目录结构与inode分配状态不一致
  * 
- * @param nd 要检查的目录inode
+ * @param list decode_blocks解码出的目录块号
  * @return 如果有引用的inode被标记为空闲返回1，否则返回0
  */
-int error_check_10(struct dinode nd) {
-    // 检查直接块中的目录条目
-    for(uint i = 0; i < NDIRECT; ++i) {
-        if(nd.addrs[i] != 0) {
-            struct dirent dir_entry;
-            for(uint j = 0; j < BSIZE / sizeof(struct dirent); ++j) {
-                lseek(img_file, nd.addrs[i] * BSIZE + j * sizeof(struct dirent), SEEK_SET);
-                read(img_file, &dir_entry, sizeof(struct dirent));
-
-                struct dinode tmp_nd;
-                if(dir_entry.inum != 0) {
-                    lseek(img_file, sblock.inodestart * BSIZE + dir_entry.inum * sizeof(struct dinode), SEEK_SET);
-                    read(img_file, &tmp_nd, sizeof(struct dinode));
-
-                    if(tmp_nd.type == 0) {
-                        return 1; // 引用的inode类型为0（空闲）
-                    }
-                }
-            }
-        }
-    }
-
-    // 检查间接块中的目录条目
-    if(nd.addrs[NDIRECT] != 0) {
-        uint addr;
-        struct dirent dir_entry;
-        for(uint i = 0; i < NINDIRECT; ++i) {
-            lseek(img_file, nd.addrs[NDIRECT] * BSIZE + i * sizeof(uint), SEEK_SET);
-            read(img_file, &addr, sizeof(uint));
-
-            for(uint j = 0; j < BSIZE / sizeof(struct dirent); ++j) {
-                lseek(img_file, addr * BSIZE + j * sizeof(struct dirent), SEEK_SET);
-                read(img_file, &dir_entry, sizeof(struct dirent));
-
-                struct dinode tmp_nd;
-                if(dir_entry.inum != 0) {
-                    lseek(img_file, sblock.inodestart * BSIZE + dir_entry.inum * sizeof(struct dinode), SEEK_SET);
-                    read(img_file, &tmp_nd, sizeof(struct dinode));
-
-                    if(tmp_nd.type == 0) {
-                        return 1; // 引用的inode类型为0（空闲）
-                    }
-                }
+int error_check_10(const struct inode_blocks* list) {
+    // 检查直接块和间接块指向的数据块中的目录条目，跳过各级间接块本身
+    for(uint i = 0; i < list->count; ++i) {
+        if(file_block(i) < 0 || list->blocks[i] == 0)
+            continue;
+
+        struct dir_block dir;
+        load_dir_block(list->blocks[i], &dir);
+        for(uint64_t live = dir.valid; live != 0; live &= live - 1) {
+            uint j = __builtin_ctzll(live);
+            if(dir.inums[j] >= sblock.ninodes || inode_at(dir.inums[j])->type == 0) {
+                visited += j + 1;
+                return 1; // 引用的inode超出inode表或类型为0（空闲）
             }
         }
+        visited += DPB;
     }
     return 0;
 }
@@ -523,12 +1317,8 @@ int error_check_10(struct dinode nd) {
  * 错误检查11：验证文件的引用计数是否正确
  * 
  * 算法:
- * 1. 初始化计数器cnt为0
- * 2. 遍历所有inode寻找目录
- * 3. 对每个目录inode:
- *    a. 检查其所有直接块和间接块中的目录项
- *    b. 计算引用了指定inode_num的目录项数量
- * 4. 与inode自身记录的nlink(硬链接数)值比较
+ * 1. 查询build_refs预先统计的引用计数ref_cnt[inode_num]
+ * 2. 与inode自身记录的nlink(硬链接数)值比较
  * 
  * 判断标准:
  * - 文件inode的nlink值必须等于实际在所有目录中引用该inode的目录项数量
@@ -545,52 +1335,8 @@ int error_check_10(struct dinode nd) {
  * @return 如果引用计数不正确返回1，否则返回0
  */
 int error_check_11(struct dinode nd, uint inode_num) {
-    uint cnt = 0; // 引用计数
-    struct dinode tmp_inode;
-    
-    // 遍历所有inode寻找目录
-    for(uint i = 0; i < sblock.ninodes; ++i) {
-        lseek(img_file, sblock.inodestart * BSIZE + i * sizeof(struct dinode), SEEK_SET);
-        read(img_file, &tmp_inode, sizeof(struct dinode));
-
-        if(tmp_inode.type == T_DIR) {
-            // 检查直接块中的目录条目
-            for(uint j = 0; j < NDIRECT; ++j) {
-                if(tmp_inode.addrs[j] != 0) {
-                    struct dirent dir_entry;
-                    for(uint dir_cnt = 0; dir_cnt < BSIZE / sizeof(struct dirent); ++dir_cnt) {
-                        lseek(img_file, tmp_inode.addrs[j] * BSIZE + dir_cnt * sizeof(struct dirent), SEEK_SET);
-                        read(img_file, &dir_entry, sizeof(struct dirent));
-
-                        if(dir_entry.inum == inode_num)
-                            cnt++; // 找到一个引用，增加计数
-                    }
-                }
-            }
-
-            // 检查间接块中的目录条目
-            if(tmp_inode.addrs[NDIRECT] != 0) {
-                uint addr;
-                for(uint j = 0; j < NINDIRECT; ++j) {
-                    lseek(img_file, tmp_inode.addrs[NDIRECT] * BSIZE + j * sizeof(uint), SEEK_SET);
-                    read(img_file, &addr, sizeof(uint));
-
-                    if(addr != 0) {
-                        struct dirent dir_entry;
-                        for(uint dir_cnt = 0; dir_cnt < BSIZE / sizeof(struct dirent); ++dir_cnt) {
-                            lseek(img_file, addr * BSIZE + dir_cnt * sizeof(struct dirent), SEEK_SET);
-                            read(img_file, &dir_entry, sizeof(struct dirent));
-
-                            if(dir_entry.inum == inode_num)
-                                cnt++; // 找到一个引用，增加计数
-                        }
-                    }
-                }
-            }
-        }
-    }
-
-    if(cnt != nd.nlink)
+    visited++;
+    if(ref_cnt[inode_num] != (uint)nd.nlink)
         return 1; // 引用计数不匹配
 
     return 0;
@@ -600,15 +1346,12 @@ int error_check_11(struct dinode nd, uint inode_num) {
  * 错误检查12：验证每个目录只出现一次
  * 
  * 算法:
- * 1. 初始化计数器cnt为0
- * 2. 遍历所有inode寻找目录
- * 3. 对每个目录inode:
- *    a. 检查其所有直接块和间接块中的目录项
- *    b. 计算引用了指定inode_num的目录项数量
- * 4. 检查计数值是否为1
+ * 1. 查询build_refs预先统计的引用计数ref_cnt[inode_num]
+ * 2. 检查计数值是否为1
  * 
  * 判断标准:
  * - 每个目录(除根目录外)必须只有一个父目录引用它
+ * - 计数不含目录自身的"."和子目录的".."，否则每个目录都会被多算
  * - 如果计数不为1，表示目录要么没有父目录，要么有多个父目录
  * 
  * 错误影响:
@@ -623,175 +1366,1338 @@ int error_check_11(struct dinode nd, uint inode_num) {
  * @return 如果目录在多处出现返回1，否则返回0
  */
 int error_check_12(struct dinode nd, uint inode_num) {
-    uint cnt = 0; // 引用计数
-    struct dinode tmp_inode;
-    
-    // 遍历所有inode寻找目录
-    for(uint i = 0; i < sblock.ninodes; ++i) {
-        lseek(img_file, sblock.inodestart * BSIZE + i * sizeof(struct dinode), SEEK_SET);
-        read(img_file, &tmp_inode, sizeof(struct dinode));
-
-        if(tmp_inode.type == T_DIR) {
-            // 检查直接块中的目录条目
-            for(uint j = 0; j < NDIRECT; ++j) {
-                if(tmp_inode.addrs[j] != 0) {
-                    struct dirent dir_entry;
-                    for(uint dir_cnt = 0; dir_cnt < BSIZE / sizeof(struct dirent); ++dir_cnt) {
-                        lseek(img_file, tmp_inode.addrs[j] * BSIZE + dir_cnt * sizeof(struct dirent), SEEK_SET);
-                        read(img_file, &dir_entry, sizeof(struct dirent));
-
-                        if(dir_entry.inum == inode_num)
-                            cnt++; // 找到一个引用，增加计数
-                    }
-                }
-            }
+    visited++;
+    if(ref_cnt[inode_num] != 1) // 目录应该只有一个引用（除了根目录外）
+        return 1;
 
-            // 检查间接块中的目录条目
-            if(tmp_inode.addrs[NDIRECT] != 0) {
-                uint addr;
-                for(uint j = 0; j < NINDIRECT; ++j) {
-                    lseek(img_file, tmp_inode.addrs[NDIRECT] * BSIZE + j * sizeof(uint), SEEK_SET);
-                    read(img_file, &addr, sizeof(uint));
-
-                    if(addr != 0) {
-                        struct dirent dir_entry;
-                        for(uint dir_cnt = 0; dir_cnt < BSIZE / sizeof(struct dirent); ++dir_cnt) {
-                            lseek(img_file, addr * BSIZE + dir_cnt * sizeof(struct dirent), SEEK_SET);
-                            read(img_file, &dir_entry, sizeof(struct dirent));
-
-                            if(dir_entry.inum == inode_num)
-                                cnt++; // 找到一个引用，增加计数
-                        }
-                    }
-                }
-            }
+    return 0;
+}
+
+/**
+ * 错误检查13：验证目录的".."指向引用它的父目录
+ * 
+ * 算法:
+ * 1. 在目录的数据块中查找".."条目
+ * 2. 从目录项索引中取出唯一引用该目录的目录项，比较其所在的目录与".."指向的inode
+ * 
+ * 判断标准:
+ * - 只检查恰好被引用一次的非根目录，引用数不为1时已由检查9、12报告
+ * - ".."必须指向父目录，即父目录中有指向本目录的条目
+ * 
+ * 错误影响:
+ * 如果".."与父目录不一致:
+ * 1. 沿".."向上遍历会进入另一个目录
+ * 2. 删除或重命名目录时会修改错误目录的链接数
+ * 
+ * @param list decode_blocks解码出的目录块号
+ * @param inode_num inode号
+ * @return 如果".."与父目录不一致返回1，否则返回0
+ */
+int error_check_13(const struct inode_blocks* list, uint inode_num) {
+    if(refs == NULL || ref_cnt[inode_num] != 1)
+        return 0; // 增量检查时没有目录项索引
+
+    for(uint i = 0; i < list->count; ++i) {
+        if(file_block(i) < 0 || list->blocks[i] == 0)
+            continue;
+
+        struct dir_block dir;
+        load_dir_block(list->blocks[i], &dir);
+
+        uint64_t found = dir.valid & dir.dotdot;
+        if(found != 0) {
+            uint j = __builtin_ctzll(found);
+            visited += j + 1;
+            return dir.inums[j] != refs[ref_start[inode_num]].dir; // 与唯一引用它的目录比较
         }
+        visited += DPB;
     }
+    return 0; // 没有".."条目，由检查4报告
+}
 
-    if(cnt != 1) // 目录应该只有一个引用（除了根目录外）
-        return 1;
-
+/**
+ * 错误检查14：验证每个目录都能从根目录到达
+ * 
+ * 算法:
+ * 1. 查询find_cycles预先计算的reach[inode_num]
+ * 
+ * 判断标准:
+ * - 沿唯一的父目录向上走必须能回到根目录
+ * - 父目录链形成环或通向环时，这些目录都无法从根目录到达
+ * 
+ * 错误影响:
+ * 如果存在无法到达的目录:
+ * 1. 环中的目录和其下的文件无法通过路径访问，也无法删除
+ * 2. 每个目录都恰好被引用一次，检查9、12发现不了这种情况
+ * 3. 递归遍历目录树的程序如果从环中出发会无限循环
+ * 
+ * @param inode_num inode号
+ * @return 如果目录无法从根目录到达返回1，否则返回0
+ */
+int error_check_14(uint inode_num) {
+    visited++;
+    if(reach != NULL && reach[inode_num] == REACH_CYCLE)
+        return 1; // 增量检查时没有目录项索引，reach为NULL
     return 0;
 }
 
 /**
  * 主函数 - 文件系统检查的入口点
  */
-int main(int argc, char* argv[]) {
-    // 检查命令行参数
-    if(argc != 2) {
-        fprintf(stderr, "Usage: xcheck <file_system_image>\n");
+/**
+ * 记录一项失败的检查
+ * 
+ * @param range 当前线程的扫描范围
+ * @param inode_num 出错的inode号
+ * @param check 失败的检查编号
+ * @param error 错误信息
+ * @return 需要停止检查时（未指定-a）返回1，否则返回0
+ */
+int report(struct scan_range* range, uint inode_num, int check, const char* error) {
+    if(range->num_violations == range->cap) {
+        range->cap        = range->cap ? range->cap * 2 : 16;
+        range->violations = realloc(range->violations, range->cap * sizeof(struct violation));
+        if(range->violations == NULL) {
+            fprintf(stderr, "malloc failed\n");
+            close(img_file);
+            exit(1);
+        }
+    }
+    range->violations[range->num_violations].inode_num = inode_num;
+    range->violations[range->num_violations].check     = check;
+    range->violations[range->num_violations].error     = error;
+    range->num_violations++;
+    return !report_all;
+}
+
+/**
+ * 开始计量一次检查，未指定--stats时不做任何事
+ */
+void check_begin(struct check_stats* stats) {
+    if(!show_stats)
+        return;
+    stats->start_ns      = now_ns();
+    stats->start_visited = visited;
+}
+
+/**
+ * 结束计量一次检查，累计其耗时、访问的条目数和结果
+ * 
+ * @param stats 该检查的开销
+ * @param result 检查的返回值
+ * @return 原样返回result
+ */
+int check_end(struct check_stats* stats, int result) {
+    if(!show_stats)
+        return result;
+    stats->calls++;
+    stats->failures += result != 0;
+    stats->ns += now_ns() - stats->start_ns;
+    stats->visited += visited - stats->start_visited;
+    return result;
+}
+
+// 执行第num项检查call并计入stats；逗号运算符保证先开始计时再执行检查
+#define TIMED_CHECK(stats, num, call) (check_begin(&(stats)[num]), check_end(&(stats)[num], (call)))
+
+/**
+ * 记录一个阶段的耗时
+ * 
+ * @param name 阶段名
+ * @param start 阶段开始时now_ns的返回值
+ */
+void phase_end(const char* name, unsigned long start) {
+    if(!show_stats || num_phases == MAX_PHASES)
+        return;
+    phases[num_phases].name = name;
+    phases[num_phases].ns   = now_ns() - start;
+    num_phases++;
+}
+
+/**
+ * 输出各阶段和各项检查的开销，指定--stats时由atexit注册，任何退出路径都会输出
+ * 
+ * 说明:
+ * 各线程的检查开销相加后输出，耗时是各线程耗时之和，可能大于阶段的墙钟时间；
+ * 映射镜像时读取由缺页完成，不经过read，因此另外输出缺页次数
+ */
+void print_stats() {
+    struct check_stats total[NUM_CHECKS + 1];
+    memcpy(total, main_stats, sizeof(total));
+    for(int t = 0; t < num_thread_stats; ++t) {
+        for(int c = 1; c <= NUM_CHECKS; ++c) {
+            struct check_stats* s = &thread_stats[t * (NUM_CHECKS + 1) + c];
+            total[c].calls += s->calls;
+            total[c].failures += s->failures;
+            total[c].ns += s->ns;
+            total[c].visited += s->visited;
+        }
+    }
+
+    fprintf(stderr, "xcheck: stats\n");
+    fprintf(stderr, "%-16s %12s\n", "phase", "seconds");
+    for(int i = 0; i < num_phases; ++i)
+        fprintf(stderr, "%-16s %12.6f\n", phases[i].name, phases[i].ns / 1e9);
+
+    fprintf(stderr, "%-16s %12s %10s %14s %12s\n", "check", "calls", "failures", "entries", "seconds");
+    for(int c = 1; c <= NUM_CHECKS; ++c)
+        fprintf(stderr, "error_check_%-4d %12lu %10lu %14lu %12.6f\n", c, total[c].calls, total[c].failures, total[c].visited, total[c].ns / 1e9);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(stderr, "io: %lu reads, %lu bytes read, %s %zu bytes, %lu planned blocks, %lu cache hits, %lu cache misses\n", read_calls,
+            read_bytes, cached ? "resident" : "image", cached ? (size_t)meta_blocks * BSIZE : img_size, planned_reads, cache_hits, cache_misses);
+    fprintf(stderr, "faults: %ld minor, %ld major\n", usage.ru_minflt, usage.ru_majflt);
+}
+
+/**
+ * 对一个inode依次执行各项检查
+ * 
+ * 说明:
+ * 指定-a时记录所有失败的检查；但类型无效或块地址非法时，之后依赖块号的检查没有意义，
+ * 也可能越界访问，因此这两种情况下都不再继续检查该inode
+ * 
+ * @param inode_num inode号
+ * @param range 当前线程的扫描范围，失败的检查记录在其中
+ * @return 需要停止扫描时返回1，否则返回0
+ */
+int check_inode(uint inode_num, struct scan_range* range) {
+    struct dinode nd = *inode_at(inode_num);
+
+    if(TIMED_CHECK(range->stats, 1, error_check_1(nd))) {
+        report(range, inode_num, 1, "ERROR: bad inode");
+        return !report_all;
+    }
+
+    // 只检查非空闲的inode
+    if(nd.type == 0)
+        return 0;
+
+    struct inode_blocks list;
+    decode_blocks(&nd, &list);
+
+    if(TIMED_CHECK(range->stats, 2, error_check_2(&list))) {
+        report(range, inode_num, 2, "ERROR: bad indirect address in inode");
+        return !report_all;
+    }
+
+    if(TIMED_CHECK(range->stats, 5, error_check_5(&list)) && report(range, inode_num, 5, "ERROR: address used by inode but marked free in bitmap"))
+        return 1;
+
+    if(TIMED_CHECK(range->stats, 7, error_check_7(&list, inode_num)) && report(range, inode_num, 7, "ERROR: direct address used more than once"))
+        return 1;
+
+    if(TIMED_CHECK(range->stats, 8, error_check_8(&list, inode_num)) && report(range, inode_num, 8, "ERROR: indirect address used more than once"))
         return 1;
+
+    // 目录特有的检查
+    if(nd.type == T_DIR) {
+        if(TIMED_CHECK(range->stats, 4, error_check_4(nd, inode_num)) && report(range, inode_num, 4, "ERROR: directory not properly formatted"))
+            return 1;
+
+        if(inode_num != 1) { // 根目录除外
+            if(TIMED_CHECK(range->stats, 9, error_check_9(inode_num)) && report(range, inode_num, 9, "ERROR: inode marked use but not found in a directory"))
+                return 1;
+
+            if(TIMED_CHECK(range->stats, 12, error_check_12(nd, inode_num)) && report(range, inode_num, 12, "ERROR: directory appears more than once in file system"))
+                return 1;
+        }
+
+        if(TIMED_CHECK(range->stats, 10, error_check_10(&list)) && report(range, inode_num, 10, "ERROR: inode referred to in directory but marked free"))
+            return 1;
+
+        if(inode_num != 1) {
+            if(TIMED_CHECK(range->stats, 13, error_check_13(&list, inode_num)) && report(range, inode_num, 13, "ERROR: parent directory mismatch"))
+                return 1;
+
+            if(TIMED_CHECK(range->stats, 14, error_check_14(inode_num)) && report(range, inode_num, 14, "ERROR: inaccessible directory exists"))
+                return 1;
+        }
+    }
+
+    // 文件特有的检查
+    if(nd.type == T_FILE) {
+        if(TIMED_CHECK(range->stats, 11, error_check_11(nd, inode_num)) && report(range, inode_num, 11, "ERROR: bad reference count for file"))
+            return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * 第一遍扫描的线程函数：在used中标记范围内每个inode使用的块
+ */
+void* mark_worker(void* arg) {
+    struct scan_range* range = arg;
+    for(uint inode_num = range->begin; inode_num < range->end; ++inode_num)
+        mark_inode(inode_num);
+    return NULL;
+}
+
+/**
+ * 有块被多次使用时的补充扫描：记录范围内每个inode使用的块的所有者
+ */
+void* claim_worker(void* arg) {
+    struct scan_range* range = arg;
+    for(uint inode_num = range->begin; inode_num < range->end; ++inode_num)
+        claim_inode(inode_num);
+    return NULL;
+}
+
+/**
+ * 第二遍扫描的线程函数：检查范围内的每个inode，未指定-a时遇到第一个错误即停止
+ * 
+ * 说明:
+ * 未指定-a时只报告inode号最小的错误，因此其他线程已在更小的inode上发现错误时，
+ * 本线程之后的inode都不必再检查
+ */
+void* check_worker(void* arg) {
+    struct scan_range* range = arg;
+    for(uint inode_num = range->begin; inode_num < range->end; ++inode_num) {
+        if(inode_num >= __atomic_load_n(&first_error, __ATOMIC_RELAXED))
+            break;
+
+        if(check_inode(inode_num, range)) {
+            uint cur = __atomic_load_n(&first_error, __ATOMIC_RELAXED);
+            while(cur > inode_num && !__atomic_compare_exchange_n(&first_error, &cur, inode_num, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                ;
+            break;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * 每个范围由一个线程执行worker，当前线程负责第一个范围
+ */
+void run_parallel(void* (*worker)(void*), struct scan_range* ranges, int num_threads) {
+    pthread_t threads[num_threads];
+    for(int i = 1; i < num_threads; ++i) {
+        if(pthread_create(&threads[i], NULL, worker, &ranges[i]) != 0) {
+            fprintf(stderr, "pthread_create failed\n");
+            close(img_file);
+            exit(1);
+        }
+    }
+    worker(&ranges[0]);
+    for(int i = 1; i < num_threads; ++i)
+        pthread_join(threads[i], NULL);
+}
+
+/**
+ * 取得第block块在修复中的可写副本，第一次取时从镜像复制
+ * 
+ * @param block 块号
+ * @return 可写副本的指针
+ */
+uchar* repair_block(uint block) {
+    if(dirty[block] == NULL) {
+        dirty[block] = malloc(BSIZE);
+        if(dirty[block] == NULL) {
+            fprintf(stderr, "malloc failed\n");
+            close(img_file);
+            exit(1);
+        }
+        memcpy(dirty[block], block_at(block), BSIZE);
+    }
+    return dirty[block];
+}
+
+/**
+ * 取得第block块在修复中的当前内容：修改过的返回副本，否则返回镜像中的块
+ */
+uchar* current_block(uint block) {
+    return dirty[block] != NULL ? dirty[block] : block_at(block);
+}
+
+/**
+ * 取得第inode_num个inode在修复中的可写副本
+ */
+struct dinode* repair_inode(uint inode_num) {
+    return (struct dinode*)repair_block(IBLOCK(inode_num, sblock)) + inode_num % IPB;
+}
+
+/**
+ * 取得第inode_num个inode在修复中的当前内容
+ */
+struct dinode* current_inode(uint inode_num) {
+    return (struct dinode*)current_block(IBLOCK(inode_num, sblock)) + inode_num % IPB;
+}
+
+/**
+ * 分配一个数据区中的空闲块并清零，同时在used中标记，之后重写位图时一并写出
+ * 
+ * @return 块号，没有空闲块时返回0
+ */
+uint alloc_block() {
+    if(next_free_block < sblock.size - sblock.nblocks)
+        next_free_block = sblock.size - sblock.nblocks;
+
+    for(; next_free_block < sblock.size; ++next_free_block) {
+        uint block = next_free_block;
+        if((used[block / 64] >> (block % 64) & 1) == 0) {
+            used[block / 64] |= (uint64_t)1 << (block % 64);
+            memset(repair_block(block), 0, BSIZE);
+            return block;
+        }
+    }
+    return 0;
+}
+
+/**
+ * 分配一个空闲inode：类型为0且没有任何目录项引用
+ * 
+ * @return inode号，没有空闲inode时返回0
+ */
+uint alloc_inode() {
+    for(uint inode_num = 2; inode_num < sblock.ninodes; ++inode_num) {
+        if(current_inode(inode_num)->type == 0 && ref_cnt[inode_num] == 0) {
+            struct dinode* nd = repair_inode(inode_num);
+            memset(nd, 0, sizeof(struct dinode));
+            return inode_num;
+        }
+    }
+    return 0;
+}
+
+/**
+ * 在目录中查找名为name的目录项
+ * 
+ * 说明:
+ * 修复只处理目录的直接块，lost+found和根目录的大小都远小于NDIRECT个块
+ * 
+ * @param dir 目录的inode号
+ * @param name 目录项名
+ * @param writable 为1时返回可写副本中的目录项，否则返回当前内容中的目录项
+ * @return 目录项的指针，找不到时返回NULL
+ */
+struct dirent* dir_lookup(uint dir, const char* name, int writable) {
+    struct dinode* dp = current_inode(dir);
+    for(uint off = 0; off < dp->size && off / BSIZE < NDIRECT; off += sizeof(struct dirent)) {
+        if(dp->addrs[off / BSIZE] == 0)
+            break;
+        struct dirent* de = (struct dirent*)(current_block(dp->addrs[off / BSIZE]) + off % BSIZE);
+        if(de->inum != 0 && strncmp(de->name, name, DIRSIZ) == 0)
+            return writable ? (struct dirent*)(repair_block(dp->addrs[off / BSIZE]) + off % BSIZE) : de;
+    }
+    return NULL;
+}
+
+/**
+ * 在目录中添加目录项，与xv6的dirlink相同：优先使用空闲的目录项，否则追加到目录末尾
+ * 
+ * 说明:
+ * 哈希目录先改回线性目录，其内容本身仍是合法的线性目录
+ * 
+ * @param dir 目录的inode号
+ * @param name 目录项名
+ * @param inode_num 目录项引用的inode号
+ * @return 成功返回0，目录已满或没有空闲块时返回-1
+ */
+int dir_link(uint dir, const char* name, uint inode_num) {
+    struct dinode* dp = repair_inode(dir);
+    uint           off;
+#ifdef DIRHASH
+    if(dp->major == DIRHASH)
+        dp->major = 0; // 哈希目录的索引项是inum为0的目录项，下面会被当作空闲项覆盖，因此改回线性目录
+#endif
+    for(off = 0; off < dp->size && off / BSIZE < NDIRECT; off += sizeof(struct dirent)) {
+        if(dp->addrs[off / BSIZE] == 0)
+            break;
+        struct dirent* de = (struct dirent*)(current_block(dp->addrs[off / BSIZE]) + off % BSIZE);
+        if(de->inum == 0)
+            break;
+    }
+    if(off / BSIZE >= NDIRECT)
+        return -1; // 只使用直接块
+
+    if(dp->addrs[off / BSIZE] == 0) {
+        uint block = alloc_block();
+        if(block == 0)
+            return -1;
+        dp->addrs[off / BSIZE] = block;
+    }
+    if(dp->size < off + sizeof(struct dirent))
+        dp->size = off + sizeof(struct dirent);
+
+    struct dirent* de = (struct dirent*)(repair_block(dp->addrs[off / BSIZE]) + off % BSIZE);
+    memset(de, 0, sizeof(struct dirent));
+    de->inum = inode_num;
+    memcpy(de->name, name, strnlen(name, DIRSIZ)); // 与xv6相同，名字恰为DIRSIZ字节时不以'\0'结尾
+    return 0;
+}
+
+/**
+ * 查找根目录下的lost+found目录，不存在时创建
+ * 
+ * @return lost+found的inode号，无法创建时返回0
+ */
+uint lost_found() {
+    struct dirent* de = dir_lookup(1, "lost+found", 0);
+    if(de != NULL)
+        return current_inode(de->inum)->type == T_DIR ? de->inum : 0;
+
+    uint inode_num = alloc_inode();
+    if(inode_num == 0)
+        return 0;
+
+    struct dinode* nd = repair_inode(inode_num);
+    nd->type  = T_DIR;
+    nd->nlink = 1;
+    if(dir_link(inode_num, ".", inode_num) < 0 || dir_link(inode_num, "..", 1) < 0 || dir_link(1, "lost+found", inode_num) < 0)
+        return 0;
+    repair_inode(1)->nlink++; // lost+found的".."
+    ref_cnt[inode_num] = 1;
+    return inode_num;
+}
+
+/**
+ * 把孤立的inode挂到lost+found下，目录项名为"#inode号"；孤立的目录同时把".."改为lost+found
+ * 
+ * @return 成功返回0，失败返回-1
+ */
+int reattach(uint lost, uint inode_num) {
+    char name[DIRSIZ + 1];
+    snprintf(name, sizeof(name), "#%u", inode_num);
+    if(dir_link(lost, name, inode_num) < 0)
+        return -1;
+    ref_cnt[inode_num] = 1;
+
+    if(current_inode(inode_num)->type == T_DIR) {
+        struct dirent* de = dir_lookup(inode_num, "..", 1);
+        if(de != NULL)
+            de->inum = lost;
+        repair_inode(lost)->nlink++;
+    }
+    return 0;
+}
+
+/**
+ * 把used重写为磁盘位图：数据区之外的块保持已使用，sblock.size之后的位清零
+ */
+void rewrite_bitmap() {
+    for(uint block = 0; block * BPB < sblock.size; ++block) {
+        uchar* bitmap = repair_block(sblock.bmapstart + block);
+        memset(bitmap, 0, BSIZE);
+        for(uint i = 0; i < BPB && block * BPB + i < sblock.size; ++i) {
+            uint b = block * BPB + i;
+            if(used[b / 64] >> (b % 64) & 1)
+                bitmap[i / 8] |= 1 << (i % 8);
+        }
+    }
+}
+
+/**
+ * 把修改过的块写回镜像，相邻的块合并为一次pwritev，内容没有变化的块不写
+ * 
+ * @return 写出的块数，写入失败返回-1
+ */
+long flush_repairs() {
+    long         written = 0;
+    struct iovec iov[64];
+    uint         count = 0;
+    uint         start = 0;
+
+    for(uint block = 0; block <= sblock.size; ++block) {
+        int changed = block < sblock.size && dirty[block] != NULL && memcmp(dirty[block], block_at(block), BSIZE) != 0;
+        if(count > 0 && (!changed || block != start + count || count == 64)) {
+            ssize_t n = pwritev(img_file, iov, count, (off_t)start * BSIZE);
+            if(n != (ssize_t)count * BSIZE)
+                return -1;
+            written += count;
+            count = 0;
+        }
+        if(changed) {
+            if(count == 0)
+                start = block;
+            iov[count].iov_base = dirty[block];
+            iov[count].iov_len  = BSIZE;
+            count++;
+        }
+    }
+    if(fsync(img_file) < 0)
+        return -1;
+    return written;
+}
+
+/**
+ * 修复模式：确认所有错误都可以修复后，一次写出所有修改
+ * 
+ * 算法:
+ * 1. 只修复位图（检查5、6）、文件的引用计数（检查11）和孤立inode（检查9，以及引用数为0时的检查12），
+ *    存在其他错误时不做任何修改
+ * 2. 把没有任何目录项引用的文件和目录挂到lost+found下，必要时先创建lost+found
+ * 3. 按build_refs统计的引用数改正文件的nlink
+ * 4. 按used重写位图，包括为lost+found新分配的块
+ * 5. 所有修改先写在块的副本中，最后由flush_repairs只写出内容有变化的块
+ * 
+ * @return 成功返回0，无法修复返回-1
+ */
+int repair_image(struct scan_range* ranges, int num_threads) {
+    for(int i = 0; i < num_threads; ++i) {
+        for(uint j = 0; j < ranges[i].num_violations; ++j) {
+            struct violation* v = &ranges[i].violations[j];
+            if(v->check != 5 && v->check != 9 && v->check != 11 && (v->check != 12 || ref_cnt[v->inode_num] != 0)) {
+                fprintf(stderr, "xcheck: cannot repair: %s (inode %u)\n", v->error, v->inode_num);
+                return -1;
+            }
+        }
+    }
+
+    dirty = calloc(sblock.size, sizeof(uchar*));
+    if(dirty == NULL) {
+        fprintf(stderr, "malloc failed\n");
+        close(img_file);
+        exit(1);
+    }
+
+    // 孤立的文件和目录
+    uint lost = 0;
+    for(uint inode_num = 2; inode_num < sblock.ninodes; ++inode_num) {
+        short type = current_inode(inode_num)->type;
+        if((type != T_FILE && type != T_DIR) || ref_cnt[inode_num] != 0)
+            continue;
+        if(lost == 0 && (lost = lost_found()) == 0) {
+            fprintf(stderr, "xcheck: cannot repair: no room for lost+found\n");
+            return -1;
+        }
+        if(reattach(lost, inode_num) < 0) {
+            fprintf(stderr, "xcheck: cannot repair: lost+found is full\n");
+            return -1;
+        }
+    }
+
+    // 文件的引用计数
+    for(uint inode_num = 0; inode_num < sblock.ninodes; ++inode_num) {
+        if(current_inode(inode_num)->type == T_FILE && (uint)current_inode(inode_num)->nlink != ref_cnt[inode_num])
+            repair_inode(inode_num)->nlink = ref_cnt[inode_num];
+    }
+
+    rewrite_bitmap();
+
+    long written = flush_repairs();
+    if(written < 0) {
+        perror("xcheck: write");
+        return -1;
+    }
+    fprintf(stderr, "xcheck: repaired image, wrote %ld blocks\n", written);
+    return 0;
+}
+
+/**
+ * 引用图缓存文件的头部，之后依次为owner[size]、ref_cnt[ninodes]、parent[ninodes]、
+ * edge_start[ninodes + 1]和graph.items[num_edges]
+ */
+struct graph_header {
+    char              magic[8];   // GRAPH_MAGIC
+    struct superblock sb;         // 生成缓存时的超级块，与当前镜像不同时缓存作废
+    uint64_t          img_size;   // 生成缓存时镜像的字节数
+    uint              num_edges;  // 引用图的边数
+};
+
+uint* block_owner; // 增量检查时每个块的所有者，来自缓存，未使用的块为0xFFFFFFFF
+struct id_list dirty_list; // 脏块列表：-i指定的文件和-l读取的日志头中的块号
+
+/**
+ * 把引用图和块的所有者写入缓存文件，先写临时文件再改名，进程中途退出不会留下不完整的缓存
+ * 
+ * @param owners 每个块的所有者
+ * @return 成功返回0，失败返回-1
+ */
+int save_graph(uint* owners) {
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", graph_path);
+    FILE* fp = fopen(tmp, "wb");
+    if(fp == NULL)
+        return -1;
+
+    struct graph_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, GRAPH_MAGIC, sizeof(hdr.magic));
+    hdr.sb        = sblock;
+    hdr.img_size  = img_size;
+    hdr.num_edges = graph.count;
+
+    int ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1
+          && fwrite(owners, sizeof(uint), sblock.size, fp) == sblock.size
+          && fwrite(ref_cnt, sizeof(uint), sblock.ninodes, fp) == sblock.ninodes
+          && fwrite(parent, sizeof(uint), sblock.ninodes, fp) == sblock.ninodes
+          && fwrite(edge_start, sizeof(uint), sblock.ninodes + 1, fp) == sblock.ninodes + 1
+          && fwrite(graph.items, sizeof(uint), graph.count, fp) == graph.count;
+    if(fclose(fp) != 0 || !ok || rename(tmp, graph_path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * 读入引用图缓存
+ * 
+ * @return 成功返回0；缓存不存在、已损坏或不属于当前镜像时返回-1，此时需要完整检查
+ */
+int load_graph() {
+    FILE* fp = fopen(graph_path, "rb");
+    if(fp == NULL)
+        return -1;
+
+    struct graph_header hdr;
+    if(fread(&hdr, sizeof(hdr), 1, fp) != 1 || memcmp(hdr.magic, GRAPH_MAGIC, sizeof(hdr.magic)) != 0
+       || memcmp(&hdr.sb, &sblock, sizeof(sblock)) != 0 || hdr.img_size != img_size) {
+        fclose(fp);
+        return -1;
+    }
+
+    block_owner = malloc(sblock.size * sizeof(uint));
+    ref_cnt     = malloc(sblock.ninodes * sizeof(uint));
+    parent      = malloc(sblock.ninodes * sizeof(uint));
+    edge_start  = malloc(((size_t)sblock.ninodes + 1) * sizeof(uint));
+    graph.items = malloc((hdr.num_edges ? hdr.num_edges : 1) * sizeof(uint));
+    graph.count = graph.cap = hdr.num_edges;
+    if(block_owner == NULL || ref_cnt == NULL || parent == NULL || edge_start == NULL || graph.items == NULL) {
+        fprintf(stderr, "malloc failed\n");
+        close(img_file);
+        exit(1);
+    }
+
+    int ok = fread(block_owner, sizeof(uint), sblock.size, fp) == sblock.size
+          && fread(ref_cnt, sizeof(uint), sblock.ninodes, fp) == sblock.ninodes
+          && fread(parent, sizeof(uint), sblock.ninodes, fp) == sblock.ninodes
+          && fread(edge_start, sizeof(uint), sblock.ninodes + 1, fp) == sblock.ninodes + 1
+          && fread(graph.items, sizeof(uint), graph.count, fp) == graph.count
+          && edge_start[sblock.ninodes] == graph.count;
+    fclose(fp);
+    return ok ? 0 : -1;
+}
+
+/**
+ * 读入-i指定的脏块列表，块号以空白分隔
+ * 
+ * @return 成功返回0，文件无法打开或格式错误返回-1
+ */
+int read_dirty_list(const char* path) {
+    FILE* fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if(fp == NULL)
+        return -1;
+
+    unsigned long block;
+    int           n;
+    while((n = fscanf(fp, "%lu", &block)) == 1)
+        list_push(&dirty_list, block);
+    if(fp != stdin)
+        fclose(fp);
+    return n == EOF ? 0 : -1;
+}
+
+/**
+ * 把日志头中记录的块加入脏块列表
+ * 
+ * 说明:
+ * xv6的log.c在提交事务时先把日志头写入sblock.logstart块，安装完成后再把n清零；
+ * 因此日志头中的块是最近一次未完成安装的事务修改过的块
+ */
+void read_log_header() {
+    struct {
+        int n;
+        int block[LOGSIZE];
+    }* lh = block_at(sblock.logstart);
+
+    for(int i = 0; i < lh->n && i < LOGSIZE; ++i)
+        list_push(&dirty_list, lh->block[i]);
+}
+
+/**
+ * 增量检查时认领changed inode的一个块
+ * 
+ * @param dup_kind 块已有其他所有者时记录失败的检查编号（7或8）
+ */
+void claim_cached(uint block, uint inode_num, int check, uchar* dup_kind) {
+    if(block == 0 || block >= sblock.size)
+        return; // 非法块号由错误检查2报告
+
+    if(block_owner[block] == 0xFFFFFFFF)
+        block_owner[block] = inode_num;
+    else if(dup_kind[inode_num] == 0)
+        dup_kind[inode_num] = check;
+}
+
+/**
+ * 增量检查：只重新检查与脏块有关的inode
+ * 
+ * 算法:
+ * 1. 由脏块找出内容可能变化的inode（changed）：
+ *    a. inode表中的脏块：块内的所有inode
+ *    b. 位图中的脏块：该位图块覆盖的所有数据块都要重新比较位图
+ *    c. 其他脏块：按缓存中的所有者找到使用它的inode；没有所有者的块重新比较位图
+ * 2. 释放changed inode在缓存中的所有块，再按当前内容重新认领，已有其他所有者的块即为重复使用
+ * 3. 从引用图中删除changed目录原有的边，重新扫描这些目录加入新的边，引用数变化的inode都要重新检查
+ * 4. 对需要重新检查的inode执行check_inode，再比较位图中受影响的块
+ * 
+ * 说明:
+ * 缓存只在上一次检查没有发现错误时写入，因此未变化的inode都是一致的；
+ * 释放旧块时需要遍历一遍owner数组，但只是内存中的比较，不读取镜像
+ * 
+ * @param range 记录失败的检查
+ * @param strays 返回位图中标记为使用但实际未使用的块
+ * @param changed 返回内容可能变化的inode，供merge_graph使用
+ * @param new_edges 返回changed目录重新扫描得到的边
+ */
+void incremental_check(struct scan_range* range, struct id_list* strays, uchar* changed, struct id_list* new_edges) {
+    uint      data_start = sblock.size - sblock.nblocks;
+    uint      inode_end  = sblock.inodestart + (sblock.ninodes + IPB - 1) / IPB;
+    uint      bitmap_end = sblock.bmapstart + (sblock.size + BPB - 1) / BPB;
+    uchar*    recheck    = calloc(sblock.ninodes, 1);
+    uchar*    dup_kind   = calloc(sblock.ninodes, 1);
+    uint64_t* candidate  = calloc((sblock.size + 63) / 64, sizeof(uint64_t)); // 需要重新比较位图的块
+    if(recheck == NULL || dup_kind == NULL || candidate == NULL) {
+        fprintf(stderr, "malloc failed\n");
+        close(img_file);
+        exit(1);
+    }
+
+    // 由脏块找出内容可能变化的inode
+    for(uint i = 0; i < dirty_list.count; ++i) {
+        uint block = dirty_list.items[i];
+        if(block >= sblock.size)
+            continue;
+
+        if(block >= sblock.inodestart && block < inode_end) {
+            for(uint k = 0; k < IPB; ++k)
+                if((block - sblock.inodestart) * IPB + k < sblock.ninodes)
+                    changed[(block - sblock.inodestart) * IPB + k] = 1;
+        } else if(block >= sblock.bmapstart && block < bitmap_end) {
+            for(uint b = (block - sblock.bmapstart) * BPB; b < (block - sblock.bmapstart + 1) * BPB && b < sblock.size; ++b)
+                candidate[b / 64] |= (uint64_t)1 << (b % 64);
+        } else if(block_owner[block] != 0xFFFFFFFF) {
+            changed[block_owner[block]] = 1;
+        } else {
+            candidate[block / 64] |= (uint64_t)1 << (block % 64);
+        }
+    }
+
+    // 释放changed inode的旧块
+    for(uint b = 0; b < sblock.size; ++b) {
+        if(block_owner[b] != 0xFFFFFFFF && changed[block_owner[b]]) {
+            block_owner[b] = 0xFFFFFFFF;
+            candidate[b / 64] |= (uint64_t)1 << (b % 64);
+        }
+    }
+
+    // 按当前内容重新认领
+    for(uint inode_num = 0; inode_num < sblock.ninodes; ++inode_num) {
+        struct dinode* nd = inode_at(inode_num);
+        if(!changed[inode_num] || nd->type == 0 || error_check_1(*nd))
+            continue;
+
+        struct inode_blocks list;
+        decode_blocks(nd, &list);
+        for(uint i = 0; i < list.count; ++i)
+            claim_cached(list.blocks[i], inode_num, i < NADDRS ? 7 : 8, dup_kind);
+    }
+
+    // 更新引用图
+    for(uint inode_num = 0; inode_num < sblock.ninodes; ++inode_num) {
+        if(!changed[inode_num])
+            continue;
+        recheck[inode_num] = 1;
+
+        for(uint e = edge_start[inode_num]; e < edge_start[inode_num + 1]; ++e) {
+            uint child = graph.items[e];
+            ref_cnt[child]--;
+            recheck[child] = 1;
+            if(parent[child] == inode_num)
+                parent[child] = 0;
+        }
+
+        if(inode_at(inode_num)->type == T_DIR) {
+            scan_dir(inode_num, &new_edges[inode_num], NULL);
+            for(uint e = 0; e < new_edges[inode_num].count; ++e)
+                recheck[new_edges[inode_num].items[e]] = 1;
+        }
+    }
+
+    // 重新检查受影响的inode
+    // 块的重复使用已在认领时发现，check_inode中的检查7、8直接通过（owner为NULL）
+    for(uint inode_num = 0; inode_num < sblock.ninodes; ++inode_num) {
+        if(!recheck[inode_num])
+            continue;
+
+        if(check_inode(inode_num, range))
+            break;
+        if(dup_kind[inode_num] != 0
+           && report(range, inode_num, dup_kind[inode_num], dup_kind[inode_num] == 7 ? "ERROR: direct address used more than once" : "ERROR: indirect address used more than once"))
+            break;
+
+        // 被释放的inode仍被未变化的目录引用
+        if(inode_at(inode_num)->type == 0 && ref_cnt[inode_num] > 0
+           && report(range, parent[inode_num] ? parent[inode_num] : inode_num, 10, "ERROR: inode referred to in directory but marked free"))
+            break;
+    }
+
+    // 比较受影响的块在位图中的状态
+    for(uint b = data_start; b < sblock.size; ++b) {
+        if((candidate[b / 64] >> (b % 64) & 1) == 0)
+            continue;
+        if(bitmap_bit(b) && block_owner[b] == 0xFFFFFFFF)
+            list_push(strays, b);
+        else if(!bitmap_bit(b) && block_owner[b] != 0xFFFFFFFF && !changed[block_owner[b]]
+                && report(range, block_owner[b], 5, "ERROR: address used by inode but marked free in bitmap"))
+            break;
+    }
+
+    free(recheck);
+    free(dup_kind);
+    free(candidate);
+}
+
+/**
+ * 用changed目录新的边替换引用图中原有的边，重建edge_start
+ */
+void merge_graph(uchar* changed, struct id_list* new_edges) {
+    struct id_list merged = {NULL, 0, 0};
+    for(uint inode_num = 0; inode_num < sblock.ninodes; ++inode_num) {
+        uint start = merged.count;
+        if(changed[inode_num]) {
+            for(uint e = 0; e < new_edges[inode_num].count; ++e)
+                list_push(&merged, new_edges[inode_num].items[e]);
+            free(new_edges[inode_num].items);
+        } else {
+            for(uint e = edge_start[inode_num]; e < edge_start[inode_num + 1]; ++e)
+                list_push(&merged, graph.items[e]);
+        }
+        edge_start[inode_num] = start;
     }
+    edge_start[sblock.ninodes] = merged.count;
+    free(graph.items);
+    graph = merged;
+}
 
-    // 打开文件系统镜像
-    img_file = open(argv[1], O_RDONLY);
+/**
+ * 检查一个镜像，单镜像模式下由main调用，批量模式下在子进程中调用
+ * 
+ * @param path 镜像路径
+ * @param dirty_path -i指定的脏块列表，可以为NULL
+ * @param use_log 为1时把日志头中的块也作为脏块
+ * @return 镜像一致（或已修复）返回0，否则返回1；部分错误直接exit(1)
+ */
+int check_image(const char* path, const char* dirty_path, int use_log) {
+    if(show_stats)
+        atexit(print_stats);
+
+    // 打开文件系统镜像，修复时需要可写且可以定位
+    img_file = open(path, repair ? O_RDWR : O_RDONLY);
     if(img_file < 0) {
         fprintf(stderr, "image not found\n");
         return 1;
     }
+    if(repair && lseek(img_file, 0, SEEK_CUR) < 0) {
+        fprintf(stderr, "xcheck: cannot repair an image that is not seekable\n");
+        close(img_file);
+        return 1;
+    }
+
+    // 映射或读入镜像，之后所有结构都通过block_at和inode_at访问
+    unsigned long start = now_ns();
+    if(load_image() < 0) {
+        fprintf(stderr, "image not found\n");
+        close(img_file);
+        return 1;
+    }
+    phase_end("load image", start);
 
     // 加载超级块
-    lseek(img_file, BSIZE * 1, SEEK_SET);
-    read(img_file, &sblock, sizeof(sblock));
+    sblock = *(struct superblock*)block_at(1);
 
-    // 初始化块使用数组
-    uint in_use[sblock.size];
-    for(int i = 0; i < sblock.size; ++i)
-        in_use[i] = 0;
+    // inode表必须完整地位于镜像之内，inode_at才能直接返回指针
+    if((size_t)sblock.inodestart * BSIZE + (size_t)sblock.ninodes * sizeof(struct dinode) > img_size) {
+        fprintf(stderr, "ERROR: bad inode\n");
+        close(img_file);
+        exit(1);
+    }
 
-    // 首先检查根目录是否存在
-    if(error_check_3()) {
+    // 首先检查根目录是否存在，指定-a时继续检查其余部分；没有根目录时无法修复
+    uint num_errors = 0;
+    if(TIMED_CHECK(main_stats, 3, error_check_3())) {
         fprintf(stderr, "ERROR: root directory does not exist\n");
+        if(!report_all || repair) {
+            close(img_file);
+            exit(1);
+        }
+        num_errors++;
+    }
+
+    // 有引用图缓存和脏块列表时只做增量检查，否则完整检查
+    // 缓存先删除，检查通过后再写入，任何错误都会让下一次运行回到完整检查
+    int incremental = 0;
+    if(graph_path != NULL) {
+        if(dirty_path != NULL && read_dirty_list(dirty_path) < 0) {
+            fprintf(stderr, "xcheck: cannot read dirty block list %s\n", dirty_path);
+            close(img_file);
+            return 1;
+        }
+        if(use_log)
+            read_log_header();
+        incremental = (dirty_path != NULL || use_log) && load_graph() == 0;
+        unlink(graph_path);
+    }
+
+    // 按块号升序预读目录块和间接块，之后的检查不再随机读取镜像；增量检查只访问少量块，不预读
+    if(!incremental && (cached || mapped)) {
+        start = now_ns();
+        plan_reads();
+        phase_end("plan reads", start);
+    }
+
+    // 统计所有目录项对inode的引用，供错误检查9、11、12查表
+    if(!incremental) {
+        start = now_ns();
+        build_refs();
+        phase_end("build refs", start);
+    }
+
+    // 按inode范围把inode表分给多个线程
+    // 块缓存不是线程安全的，使用块缓存时只用一个线程；增量检查只涉及少量inode，也只用一个线程
+    long num_cpus    = sysconf(_SC_NPROCESSORS_ONLN);
+    int  num_threads = sblock.ninodes / MIN_INODES_PER_THREAD;
+    if(num_threads > num_cpus)
+        num_threads = num_cpus;
+    if(num_threads < 1 || cached || incremental)
+        num_threads = 1;
+
+    struct scan_range ranges[num_threads];
+    thread_stats = calloc((size_t)num_threads * (NUM_CHECKS + 1), sizeof(struct check_stats));
+    if(thread_stats == NULL) {
+        fprintf(stderr, "malloc failed\n");
         close(img_file);
         exit(1);
     }
+    num_thread_stats = num_threads;
+    for(int i = 0; i < num_threads; ++i) {
+        ranges[i].begin          = (unsigned long)sblock.ninodes * i / num_threads;
+        ranges[i].end            = (unsigned long)sblock.ninodes * (i + 1) / num_threads;
+        ranges[i].violations     = NULL;
+        ranges[i].num_violations = 0;
+        ranges[i].cap            = 0;
+        ranges[i].stats          = &thread_stats[i * (NUM_CHECKS + 1)];
+    }
 
-    // 遍历所有inode进行检查
-    for(uint inode_num = 0; inode_num < sblock.ninodes; ++inode_num) {
-        // 加载当前inode
-        lseek(img_file, sblock.inodestart * BSIZE + sizeof(struct dinode) * inode_num, SEEK_SET);
-        read(img_file, &cur_inode, sizeof(struct dinode));
-
-        // 执行各种一致性检查
-        if(error_check_1(cur_inode)) {
-            fprintf(stderr, "ERROR: bad inode\n");
+    struct id_list  strays    = {NULL, 0, 0}; // 增量检查发现的位图中被误标记为使用的块
+    uchar*          changed   = NULL;
+    struct id_list* new_edges = NULL;
+    if(incremental) {
+        changed   = calloc(sblock.ninodes, 1);
+        new_edges = calloc(sblock.ninodes, sizeof(struct id_list));
+        if(changed == NULL || new_edges == NULL) {
+            fprintf(stderr, "malloc failed\n");
             close(img_file);
             exit(1);
         }
-
-        // 只检查非空闲的inode
-        if(cur_inode.type != 0) {
-            if(error_check_2(cur_inode)) {
-                fprintf(stderr, "ERROR: bad indirect address in inode\n");
+        start = now_ns();
+        incremental_check(&ranges[0], &strays, changed, new_edges);
+        phase_end("incremental", start);
+    } else {
+        // 第一遍：标记每个块是否被使用，供检查6使用，并发现是否有块被多次使用
+        used = calloc((sblock.size + 63) / 64, sizeof(uint64_t));
+        if(used == NULL) {
+            fprintf(stderr, "malloc failed\n");
+            close(img_file);
+            exit(1);
+        }
+        start = now_ns();
+        run_parallel(mark_worker, ranges, num_threads);
+        phase_end("mark blocks", start);
+
+        // 有块被多次使用时，再记录每个块的所有者，供检查7、8定位重复的块；写缓存时也需要所有者
+        if(shared_blocks || graph_path != NULL) {
+            owner   = malloc(sblock.size * sizeof(uint));
+            dup_pos = malloc(sblock.ninodes * sizeof(int));
+            if(owner == NULL || dup_pos == NULL) {
+                fprintf(stderr, "malloc failed\n");
                 close(img_file);
                 exit(1);
             }
+            memset(owner, 0xFF, sblock.size * sizeof(uint)); // 初始为0xFFFFFFFF，大于任何inode号
+            memset(dup_pos, 0xFF, sblock.ninodes * sizeof(int));
+            start = now_ns();
+            run_parallel(claim_worker, ranges, num_threads);
+            phase_end("claim blocks", start);
+        }
 
-            if(error_check_5(cur_inode)) {
-                fprintf(stderr, "ERROR: address used by inode but marked free in bitmap\n");
+        // 第二遍：检查所有inode；未指定-a时报告inode号最小的错误，与串行检查的结果一致
+        first_error = sblock.ninodes;
+        start       = now_ns();
+        run_parallel(check_worker, ranges, num_threads);
+        phase_end("check inodes", start);
+    }
+    for(int i = 0; i < num_threads; ++i) {
+        for(uint j = 0; j < ranges[i].num_violations; ++j) {
+            if(!report_all) {
+                fprintf(stderr, "%s\n", ranges[i].violations[j].error);
                 close(img_file);
                 exit(1);
             }
+            fprintf(stderr, "%s (inode %u)\n", ranges[i].violations[j].error, ranges[i].violations[j].inode_num);
+            num_errors++;
+        }
+    }
 
-            if(error_check_7(cur_inode, in_use)) {
-                fprintf(stderr, "ERROR: direct address used more than once\n");
+    // 检查位图一致性，指定-a时列出所有被误标记为使用的块
+    if(incremental) {
+        for(uint i = 0; i < strays.count; ++i) {
+            if(!report_all) {
+                fprintf(stderr, "ERROR: bitmap marks block in use but it is not in use\n");
                 close(img_file);
                 exit(1);
             }
+            fprintf(stderr, "ERROR: bitmap marks block in use but it is not in use (block %u)\n", strays.items[i]);
+            num_errors++;
+        }
+    } else if(TIMED_CHECK(main_stats, 6, error_check_6())) {
+        if(!report_all) {
+            fprintf(stderr, "ERROR: bitmap marks block in use but it is not in use\n");
+            close(img_file);
+            exit(1);
+        }
+        for(long block = next_stray_block(0); block >= 0; block = next_stray_block(block + 1)) {
+            fprintf(stderr, "ERROR: bitmap marks block in use but it is not in use (block %ld)\n", block);
+            num_errors++;
+        }
+    }
 
-            if(error_check_8(cur_inode, in_use)) {
-                fprintf(stderr, "ERROR: indirect address used more than once\n");
-                close(img_file);
-                exit(1);
-            }
+    if(num_errors > 0) {
+        fprintf(stderr, "xcheck: %u errors found\n", num_errors);
+        start        = now_ns();
+        int repaired = repair && repair_image(ranges, num_threads) == 0;
+        if(repair)
+            phase_end("repair", start);
+        for(int i = 0; i < num_threads; ++i)
+            free(ranges[i].violations);
+        close(img_file);
+        if(repaired)
+            return 0;
+        exit(1);
+    }
+
+    // 检查通过，保存引用图供下一次增量检查使用
+    if(graph_path != NULL) {
+        if(incremental)
+            merge_graph(changed, new_edges);
+        if(save_graph(incremental ? block_owner : owner) < 0)
+            fprintf(stderr, "xcheck: cannot write cache %s\n", graph_path);
+    }
+    free(changed);
+    free(new_edges);
+    free(strays.items);
+
+    return 0; // 所有检查通过
+}
+
+/**
+ * 批量检查中一个镜像的状态
+ */
+struct batch_job {
+    const char* path;    // 镜像路径
+    pid_t       pid;     // 检查该镜像的子进程
+    FILE*       output;  // 子进程的标准错误输出，写在临时文件中
+    int         status;  // waitpid返回的状态
+    int         done;    // 为1时子进程已结束
+};
+
+/**
+ * 启动子进程检查一个镜像，子进程的标准错误输出重定向到临时文件
+ */
+void start_job(struct batch_job* job) {
+    job->output = tmpfile();
+    if(job->output == NULL) {
+        perror("xcheck: tmpfile");
+        exit(1);
+    }
+    fflush(stdout);
+    fflush(stderr);
+    job->pid = fork();
+    if(job->pid < 0) {
+        perror("xcheck: fork");
+        exit(1);
+    }
+    if(job->pid == 0) {
+        dup2(fileno(job->output), STDERR_FILENO);
+        exit(check_image(job->path, NULL, 0));
+    }
+}
+
+/**
+ * 输出一个镜像的结果行：路径、结果、错误数和第一条输出，以制表符分隔
+ * 
+ * 说明:
+ * 结果为ok（一致）、repaired（-r修复成功）、fail（有错误）或crash（子进程被信号终止），
+ * 错误数是以"ERROR:"开头的行数，没有输出时第一条输出为"-"
+ * 
+ * @return 结果为ok或repaired时返回0，否则返回1
+ */
+int print_job(struct batch_job* job) {
+    char  line[1024];
+    char  first[1024] = "-";
+    uint  errors      = 0;
+    rewind(job->output);
+    while(fgets(line, sizeof(line), job->output) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        if(strcmp(first, "-") == 0)
+            strcpy(first, line);
+        if(strncmp(line, "ERROR:", 6) == 0)
+            errors++;
+    }
+    fclose(job->output);
+
+    const char* result = "crash";
+    if(WIFEXITED(job->status))
+        result = WEXITSTATUS(job->status) != 0 ? "fail" : errors > 0 ? "repaired" : "ok";
+    printf("%s\t%s\t%u\t%s\n", job->path, result, errors, first);
+    fflush(stdout);
+    return strcmp(result, "ok") != 0 && strcmp(result, "repaired") != 0;
+}
+
+/**
+ * 批量检查多个镜像
+ * 
+ * 算法:
+ * 1. 最多同时运行jobs个子进程，每个子进程检查一个镜像
+ * 2. 任一子进程结束后启动下一个镜像的检查
+ * 3. 按输入顺序输出结果：前面的镜像都已输出时才输出已结束的镜像
+ * 
+ * 说明:
+ * 检查器的状态都是全局变量，发现错误时直接exit，因此每个镜像在单独的进程中检查；
+ * fork复制的是尚未载入任何镜像的进程，开销很小，子进程退出时它的所有临时结构一并释放
+ * 
+ * @param paths 镜像路径
+ * @param count 镜像数
+ * @param jobs 最大并发数
+ * @return 所有镜像都一致（或已修复）返回0，否则返回1
+ */
+int run_batch(char** paths, uint count, int jobs) {
+    struct batch_job* all = calloc(count, sizeof(struct batch_job));
+    if(all == NULL) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
+    for(uint i = 0; i < count; ++i)
+        all[i].path = paths[i];
+
+    uint next_start = 0;
+    uint next_print = 0;
+    int  running    = 0;
+    int  failed     = 0;
+    while(next_print < count) {
+        while(running < jobs && next_start < count) {
+            start_job(&all[next_start++]);
+            running++;
+        }
 
-            // 目录特有的检查
-            if(cur_inode.type == T_DIR) {
-                if(error_check_4(cur_inode, inode_num)) {
-                    fprintf(stderr, "ERROR: directory not properly formatted\n");
-                    close(img_file);
-                    exit(1);
-                }
-                
-                if(inode_num != 1){ // 根目录除外
-                    if(error_check_9(inode_num)) {
-                        fprintf(stderr, "ERROR: inode marked use but not found in a directory\n");
-                        close(img_file);
-                        exit(1);
-                    }
-
-                    if(error_check_12(cur_inode, inode_num)) {
-                        fprintf(stderr, "ERROR: directory appears more than once in file system\n");
-                        close(img_file);
-                        exit(1);
-                    }
-                }
-
-                if(error_check_10(cur_inode)) {
-                    fprintf(stderr, "ERROR: inode referred to in directory but marked free\n");
-                    close(img_file);
-                    exit(1);
-                }
+        int   status;
+        pid_t pid = wait(&status);
+        if(pid < 0) {
+            perror("xcheck: wait");
+            exit(1);
+        }
+        for(uint i = next_print; i < next_start; ++i) {
+            if(all[i].pid == pid && !all[i].done) {
+                all[i].status = status;
+                all[i].done   = 1;
+                running--;
+                break;
             }
+        }
+        while(next_print < count && all[next_print].done)
+            failed |= print_job(&all[next_print++]);
+    }
+    free(all);
+    return failed;
+}
 
-            // 文件特有的检查
-            if(cur_inode.type == T_FILE) {
-                if(error_check_11(cur_inode, inode_num)) {
-                    fprintf(stderr, "ERROR: bad reference count for file\n");
-                    close(img_file);
-                    exit(1);
-                }
+/**
+ * 读取镜像路径列表，每行一个路径，忽略空行；path为"-"时从标准输入读取
+ * 
+ * @param count 返回路径数
+ * @return 路径数组，读取失败返回NULL
+ */
+char** read_image_list(const char* path, uint* count) {
+    FILE* fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if(fp == NULL)
+        return NULL;
+
+    char** paths = NULL;
+    uint   cap   = 0;
+    char*  line  = NULL;
+    size_t len   = 0;
+    *count       = 0;
+    while(getline(&line, &len, fp) >= 0) {
+        line[strcspn(line, "\n")] = '\0';
+        if(line[0] == '\0')
+            continue;
+        if(*count == cap) {
+            cap   = cap ? cap * 2 : 64;
+            paths = realloc(paths, cap * sizeof(char*));
+            if(paths == NULL) {
+                fprintf(stderr, "malloc failed\n");
+                exit(1);
             }
         }
+        paths[(*count)++] = strdup(line);
     }
+    free(line);
+    if(fp != stdin)
+        fclose(fp);
+    return paths;
+}
 
-    // 检查位图一致性
-    if(error_check_6(in_use)) {
-        fprintf(stderr, "ERROR: bitmap marks block in use but it is not in use\n");
-        close(img_file);
-        exit(1);
+int main(int argc, char* argv[]) {
+    // 检查命令行参数
+    int         opt;
+    const char* dirty_path = NULL; // -i指定的脏块列表
+    int         use_log    = 0;    // -l：把日志头中的块也作为脏块
+    int         batch      = 0;    // -b：批量检查参数中或-f列表中的所有镜像
+    const char* list_path  = NULL; // -f指定的镜像路径列表
+    int         jobs       = sysconf(_SC_NPROCESSORS_ONLN);
+    struct option long_options[] = {{"stats", no_argument, NULL, 's'}, {NULL, 0, NULL, 0}};
+    while((opt = getopt_long(argc, argv, "arc:i:lbf:j:", long_options, NULL)) != -1) {
+        switch(opt) {
+        case 'b': batch = 1; break;
+        case 'f': list_path = optarg; batch = 1; break;
+        case 'j': jobs = atoi(optarg); break;
+        case 's': show_stats = 1; break;
+        case 'a': report_all = 1; break;
+        case 'r': report_all = repair = 1; break;
+        case 'c': graph_path = optarg; break;
+        case 'i': dirty_path = optarg; break;
+        case 'l': use_log = 1; break;
+        default: optind = argc; break;
+        }
+    }
+    int bad_usage = (repair && graph_path != NULL) || ((dirty_path != NULL || use_log) && graph_path == NULL);
+    if(batch)
+        bad_usage |= graph_path != NULL || jobs < 1 || (list_path == NULL && optind == argc) || (list_path != NULL && optind != argc);
+    else
+        bad_usage |= optind != argc - 1;
+    if(bad_usage) {
+        fprintf(stderr, "Usage: xcheck [--stats] [-a | -r] [-c <cache> [-i <dirty_blocks>] [-l]] <file_system_image>\n"
+                        "       xcheck -b [-j <jobs>] [--stats] [-a | -r] (-f <image_list> | <file_system_image>...)\n");
+        return 1;
     }
 
-    return 0; // 所有检查通过
-}
\ No newline at end of file
+    if(!batch)
+        return check_image(argv[optind], dirty_path, use_log);
+
+    // 批量模式：从列表或余下的参数取得所有镜像
+    uint   count = argc - optind;
+    char** paths = argv + optind;
+    if(list_path != NULL && (paths = read_image_list(list_path, &count)) == NULL) {
+        fprintf(stderr, "xcheck: cannot read image list %s\n", list_path);
+        return 1;
+    }
+    int failed = run_batch(paths, count, jobs);
+    if(list_path != NULL) {
+        for(uint i = 0; i < count; ++i)
+            free(paths[i]);
+        free(paths);
+    }
+    return failed;
+}
@@ -0,0 +1,286 @@
+/**
+ * MapReduce基准测试
+ * 生成指定大小和键分布（均匀或Zipf）的合成语料，依次以不同的映射/归约线程数运行MR_Run，
+ * 输出吞吐量（emits/s、MB/s）和相对首个配置的加速比，用于衡量发射和洗牌路径的改动
+ *
+ * 编译（在Map_Reduce目录下）：
+ *   gcc -O2 -Iinclude bench/bench.c src/mapreduce.c src/utils.c src/arena.c src/threadpool.c \
+ *       src/spill.c src/stats.c src/affinity.c src/tokenize.c src/compress.c src/topk.c src/sketch.c \
+ *       src/mapfile.c src/inflate.c -lpthread -lm -o mr_bench
+ *
+ * 用法：
+ *   mr_bench [-s 大小MB] [-d uniform|zipf] [-z 指数] [-k 键数] [-f 文件数]
+ *            [-m 映射线程数列表] [-r 归约线程数列表] [-p 每个归约线程的分区数] [-c] [-j] [-o 目录]
+ * 线程数列表以逗号分隔，如 -m 1,2,4,8；两个列表按位置配对，较短的列表重复最后一项
+ */
+#include "mapreduce.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WORDS_PER_LINE 12  // 生成语料时每行的单词数
+#define MAX_CONFIGS    32  // 线程数列表的最大长度
+
+static unsigned long reduced_values;  // 归约函数读到的值总数，用于校验
+
+/**
+ * xorshift64*伪随机数，固定种子保证每次生成的语料相同
+ */
+static unsigned long next_random(unsigned long* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DUL;
+}
+
+/**
+ * 把键编号写成单词，编号相近的单词前缀不同，避免分区时聚集
+ *
+ * @return 单词长度
+ */
+static int format_word(unsigned long id, char* out) {
+    static const char letters[] = "abcdefghijklmnopqrstuvwxyz";
+    int               len       = 0;
+    do {
+        out[len++] = letters[id % 26];
+        id /= 26;
+    } while (id > 0);
+    return len;
+}
+
+/**
+ * 计算Zipf分布的累积分布函数，第i个键的概率正比于1/(i+1)^exponent
+ */
+static double* zipf_cdf(unsigned long num_keys, double exponent) {
+    double* cdf   = ( double* )malloc(sizeof(double) * num_keys);
+    double  total = 0;
+    for (unsigned long i = 0; i < num_keys; ++i) {
+        total += 1.0 / pow(( double )(i + 1), exponent);
+        cdf[i] = total;
+    }
+    for (unsigned long i = 0; i < num_keys; ++i)
+        cdf[i] /= total;
+    return cdf;
+}
+
+/**
+ * 按分布抽取一个键编号，cdf为NULL时均匀抽取
+ */
+static unsigned long sample_key(unsigned long* state, const double* cdf, unsigned long num_keys) {
+    unsigned long r = next_random(state);
+    if (cdf == NULL)
+        return r % num_keys;
+
+    double        u  = (r >> 11) * (1.0 / 9007199254740992.0);
+    unsigned long lo = 0;
+    unsigned long hi = num_keys - 1;
+    while (lo < hi) {
+        unsigned long mid = (lo + hi) / 2;
+        if (cdf[mid] < u)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/**
+ * 生成num_files个语料文件，总大小约为total_bytes
+ *
+ * @return 实际写入的总字节数
+ */
+static long generate_corpus(char** paths, int num_files, long total_bytes, const double* cdf, unsigned long num_keys) {
+    unsigned long state = 0x9E3779B97F4A7C15UL;
+    long          total = 0;
+    char          line[WORDS_PER_LINE * 16];
+
+    for (int f = 0; f < num_files; ++f) {
+        FILE* fp = fopen(paths[f], "w");
+        if (fp == NULL) {
+            perror(paths[f]);
+            exit(1);
+        }
+        long written = 0;
+        while (written < total_bytes / num_files) {
+            int len = 0;
+            for (int w = 0; w < WORDS_PER_LINE; ++w) {
+                len += format_word(sample_key(&state, cdf, num_keys), line + len);
+                line[len++] = w == WORDS_PER_LINE - 1 ? '\n' : ' ';
+            }
+            fwrite(line, 1, len, fp);
+            written += len;
+        }
+        fclose(fp);
+        total += written;
+    }
+    return total;
+}
+
+static void emit_token(const char* token, size_t length, char delim, void* arg) {
+    ( void )delim;
+    ( void )arg;
+    if (length > 0)
+        MR_EmitN(token, length, "1", 1);
+}
+
+/**
+ * 映射函数：映射整个文件后按空白切分，直接发射视图中的片段
+ */
+static void Map(char* file_name) {
+    MR_Chunk chunk = { .file_name = file_name, .offset = 0, .length = -1 };
+    MR_Input input;
+    if (MR_MapInput(&chunk, &input) < 0) {
+        perror(file_name);
+        return;
+    }
+    MR_Tokenize(input.data, input.length, " \n", emit_token, NULL);
+    MR_UnmapInput(&input);
+}
+
+static void Combine(char* key, CombineGetter get_next) {
+    long  count = 0;
+    char* value;
+    while ((value = get_next(key)) != NULL)
+        count += atol(value);
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%ld", count);
+    MR_EmitToReducer(key, buf);
+}
+
+/**
+ * 归约函数：只累加计数，不输出，避免测到标准输出的开销
+ */
+static void Reduce(char* key, Getter get_next, int partition_number) {
+    ( void )get_next;  // 值由MR_GetBatch成批取出
+    unsigned long count = 0;
+    char*         values[256];
+    int           n;
+    while ((n = MR_GetBatch(key, partition_number, values, 256)) > 0) {
+        for (int i = 0; i < n; ++i)
+            count += strtoul(values[i], NULL, 10);
+    }
+    __atomic_fetch_add(&reduced_values, count, __ATOMIC_RELAXED);
+}
+
+/**
+ * 解析逗号分隔的线程数列表
+ *
+ * @return 列表长度
+ */
+static int parse_list(char* arg, int* out) {
+    int   count = 0;
+    char* token;
+    while ((token = strsep(&arg, ",")) != NULL && count < MAX_CONFIGS) {
+        if (*token != '\0' && atoi(token) > 0)
+            out[count++] = atoi(token);
+    }
+    return count;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [-s size_mb] [-d uniform|zipf] [-z exponent] [-k keys] [-f files]\n"
+            "          [-m mappers,...] [-r reducers,...] [-p partitions_per_reducer] [-c] [-j] [-o dir]\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    long          size_mb      = 64;
+    int           zipf         = 1;
+    double        exponent     = 1.0;
+    unsigned long num_keys     = 100000;
+    int           num_files    = 8;
+    int           use_combiner = 0;
+    int           dump_json    = 0;
+    const char*   dir          = "/tmp";
+    int           num_mappers  = 4;
+    int           num_reducers = 4;
+    int           per_reducer  = 1;
+
+    int mappers[MAX_CONFIGS]  = {1, 2, 4, 8};
+    int reducers[MAX_CONFIGS] = {1, 2, 4, 8};
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:d:z:k:f:m:r:p:cjo:")) != -1) {
+        switch (opt) {
+        case 's': size_mb = atol(optarg); break;
+        case 'd': zipf = strcmp(optarg, "zipf") == 0; break;
+        case 'z': exponent = atof(optarg); break;
+        case 'k': num_keys = strtoul(optarg, NULL, 10); break;
+        case 'f': num_files = atoi(optarg); break;
+        case 'm': num_mappers = parse_list(optarg, mappers); break;
+        case 'r': num_reducers = parse_list(optarg, reducers); break;
+        case 'p': per_reducer = atoi(optarg); break;
+        case 'c': use_combiner = 1; break;
+        case 'j': dump_json = 1; break;
+        case 'o': dir = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (size_mb <= 0 || num_keys == 0 || num_files <= 0 || num_mappers == 0 || num_reducers == 0 || per_reducer <= 0)
+        usage(argv[0]);
+    MR_SetPartitionsPerReducer(per_reducer);
+
+    // 生成语料，argv[0]位置留给程序名，与MR_Run的参数约定一致
+    char** files = ( char** )malloc(sizeof(char*) * (num_files + 1));
+    files[0]     = argv[0];
+    for (int i = 0; i < num_files; ++i) {
+        files[i + 1] = ( char* )malloc(strlen(dir) + 32);
+        sprintf(files[i + 1], "%s/mr_bench_%d.txt", dir, i);
+    }
+    double* cdf     = zipf ? zipf_cdf(num_keys, exponent) : NULL;
+    double  start   = now_seconds();
+    long    bytes   = generate_corpus(files + 1, num_files, size_mb << 20, cdf, num_keys);
+    double  gen_sec = now_seconds() - start;
+    free(cdf);
+    printf("# corpus: %.1f MB in %d files, %s keys=%lu, generated in %.2fs\n", bytes / 1048576.0, num_files,
+           zipf ? "zipf" : "uniform", num_keys, gen_sec);
+    if (zipf)
+        printf("# zipf exponent %.2f\n", exponent);
+    printf("%8s %8s %10s %10s %14s %10s\n", "mappers", "reducers", "seconds", "MB/s", "emits/s", "speedup");
+
+    int    runs      = num_mappers > num_reducers ? num_mappers : num_reducers;
+    double base_time = 0;
+    for (int i = 0; i < runs; ++i) {
+        int m = mappers[i < num_mappers ? i : num_mappers - 1];
+        int r = reducers[i < num_reducers ? i : num_reducers - 1];
+
+        reduced_values = 0;
+        start          = now_seconds();
+        MR_RunWithCombiner(num_files + 1, files, Map, m, Reduce, r, use_combiner ? Combine : NULL, MR_DefaultHashPartition);
+        double elapsed = now_seconds() - start;
+
+        const MR_Stats* stats = MR_GetStats();
+        unsigned long   emits = 0;
+        for (int p = 0; p < stats->num_partitions; ++p)
+            emits += stats->emits[p];
+        if (emits != reduced_values)
+            fprintf(stderr, "mr_bench: emitted %lu values but reduced %lu\n", emits, reduced_values);
+        if (i == 0)
+            base_time = elapsed;
+
+        printf("%8d %8d %10.3f %10.1f %14.0f %10.2f\n", m, r, elapsed, bytes / 1048576.0 / elapsed, emits / elapsed,
+               base_time / elapsed);
+        if (dump_json)
+            MR_DumpStats(stats, stdout);
+        fflush(stdout);
+    }
+
+    for (int i = 0; i < num_files; ++i) {
+        unlink(files[i + 1]);
+        free(files[i + 1]);
+    }
+    free(files);
+    return 0;
+}
@@ -0,0 +1,33 @@
+#ifndef __affinity_h__
+#define __affinity_h__
+
+#include <pthread.h>
+
+/**
+ * 进程可用CPU及其所在的NUMA节点，从sched_getaffinity和sysfs读取
+ * 没有NUMA信息时所有CPU都视为在节点0上
+ */
+struct cpu_topology_t {
+    int  num_cpus;   // 进程可以使用的CPU数
+    int* cpus;       // CPU编号，按节点分组、节点内升序
+    int* nodes;      // 与cpus对应的节点编号
+    int  num_nodes;  // 至少含有一个可用CPU的节点数
+};
+
+int load_topology(struct cpu_topology_t* topo);
+
+int topology_cpu_for(const struct cpu_topology_t* topo, int worker);
+
+int topology_node_of(const struct cpu_topology_t* topo, int cpu);
+
+int pin_thread(pthread_t thread, int cpu);
+
+int unpin_thread(pthread_t thread, const struct cpu_topology_t* topo);
+
+int pin_self_to_node(const struct cpu_topology_t* topo, int node);
+
+int restore_self_affinity(void);
+
+void free_topology(struct cpu_topology_t* topo);
+
+#endif
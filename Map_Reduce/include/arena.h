@@ -0,0 +1,30 @@
+#ifndef __arena_h__
+#define __arena_h__
+
+#include <stddef.h>
+
+struct arena_chunk_t {
+    struct arena_chunk_t* next;
+    size_t                used;  // 已分配的字节数
+    size_t                size;  // data区总字节数
+    char                  data[];
+};
+
+struct arena_t {
+    struct arena_chunk_t* head;        // 当前分配所在的块，旧块链在其后
+    struct arena_chunk_t* spare;       // arena_reset后留待复用的空块
+    size_t                chunk_size;  // 新块的默认大小
+    size_t                bytes;       // 正在使用的块的总字节数，不含spare
+};
+
+void arena_init(struct arena_t* arena, size_t chunk_size);
+
+void* arena_alloc(struct arena_t* arena, size_t size);
+
+char* arena_strdup(struct arena_t* arena, const char* str);
+
+void arena_reset(struct arena_t* arena);
+
+void arena_release(struct arena_t* arena);
+
+#endif
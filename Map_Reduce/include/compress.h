@@ -0,0 +1,13 @@
+#ifndef __compress_h__
+#define __compress_h__
+
+#include <stddef.h>
+
+// 压缩结果的最大长度：不可压缩的输入每255字节多出1字节，另加少量头部
+#define LZ4_BOUND(n) ((n) + (n) / 255 + 16)
+
+size_t lz4_compress(const char* src, size_t src_len, char* dst, size_t dst_cap);
+
+size_t lz4_decompress(const char* src, size_t src_len, char* dst, size_t dst_cap);
+
+#endif
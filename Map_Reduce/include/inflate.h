@@ -0,0 +1,13 @@
+#ifndef __inflate_h__
+#define __inflate_h__
+
+#include <stddef.h>
+
+// 解压出的数据按顺序分段交给它
+typedef void (*inflate_sink_t)(const char* data, size_t len, void* arg);
+
+long gzip_inflate(const char* src, size_t src_len, inflate_sink_t sink, void* arg);
+
+size_t bgzf_block_size(const char* src, size_t src_len);
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef __mapfile_h__
+#define __mapfile_h__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define MAPFILE_MAGIC "MRMAP01"  // 文件头的魔数，含结尾的'\0'共8字节
+
+/**
+ * 持久化的映射输出文件
+ * [文件头][分区索引 × 分区数][各分区的记录]
+ * 每个分区的记录按键升序连续存放，每条记录是一个键及其全部值：
+ * [键长][键]['\0'][值个数][整数值个数]{[值长][值]['\0']}{int64_t}
+ * 长度和个数均为uint32_t；键和值都带结尾的'\0'，映射到内存后可以直接当作字符串返回
+ */
+struct mapfile_header_t {
+    char     magic[8];
+    uint32_t num_partitions;
+    uint32_t reserved;
+};
+
+/**
+ * 一个分区的记录在文件中的位置
+ */
+struct mapfile_index_t {
+    uint64_t offset;    // 第一条记录的偏移
+    uint64_t length;    // 记录的总字节数
+    uint64_t num_keys;  // 记录条数
+};
+
+/**
+ * 用mmap打开的映射输出文件
+ * 以私有可写方式映射，归约函数改写返回的字符串不会影响文件
+ */
+struct mapfile_t {
+    char*                   base;
+    size_t                  size;
+    int                     num_partitions;
+    struct mapfile_index_t* index;  // 指向映射中的分区索引
+};
+
+/**
+ * 顺序读取一个分区中记录的游标
+ */
+struct mapfile_cursor_t {
+    char*    pos;        // 下一个未读字节
+    char*    end;        // 分区记录的结尾
+    char*    key;        // 当前键
+    uint32_t remaining;  // 当前键尚未读出的值个数
+    uint32_t ints_left;  // 当前键尚未读出的整数值个数
+};
+
+size_t mapfile_key_size(size_t key_len);
+
+char* mapfile_put_key(char* dst, const char* key, size_t key_len, uint32_t num_values, uint32_t num_ints);
+
+size_t mapfile_value_size(size_t value_len);
+
+char* mapfile_put_value(char* dst, const char* value, size_t value_len);
+
+int mapfile_begin(FILE* out, int num_partitions);
+
+int mapfile_finish(FILE* out, const struct mapfile_index_t* index, int num_partitions);
+
+int mapfile_open(struct mapfile_t* file, const char* path);
+
+void mapfile_close(struct mapfile_t* file);
+
+void mapfile_cursor_open(struct mapfile_cursor_t* cursor, struct mapfile_t* file, int partition_id);
+
+int mapfile_next_key(struct mapfile_cursor_t* cursor);
+
+char* mapfile_next_value(struct mapfile_cursor_t* cursor);
+
+int mapfile_next_int(struct mapfile_cursor_t* cursor, int64_t* value);
+
+#endif
@@ -1,17 +1,334 @@
 #ifndef __mapreduce_h__
 #define __mapreduce_h__
 
-// Different function pointer types used by MR
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// A newline-aligned byte range [offset, offset + length) of an input file.
+// Chunks of a stream (MR_RunStream) have file_name "-" and their bytes in
+// data; data is NULL for file chunks. Chunks of a compressed file are
+// decoded by the framework: map sees the decoded text in data, with offset
+// counting decoded bytes, and compression is always 0 for it.
+typedef struct MR_Chunk {
+    char*       file_name;
+    long        offset;
+    long        length;
+    const char* data;
+    int         compression;  // how the framework has to decode the range, 0 if plain
+} MR_Chunk;
+
+// Read-only view of an input chunk mapped by MR_MapInput; data is not
+// NUL-terminated.
+typedef struct MR_Input {
+    const char* data;
+    long        length;
+    void*       base;
+    size_t      map_length;
+} MR_Input;
+
+// Counters and timings of the most recent job, filled in by the framework.
+// Per-partition arrays have num_partitions entries and thread_busy_seconds
+// has num_threads; they stay valid until the next job starts.
+typedef struct MR_Stats {
+    double         sample_seconds;       // wall time of the MR_SampledPartition pre-pass
+    double         map_seconds;          // wall time of the map phase
+    double         shuffle_seconds;      // thread time moving emit batches into partitions and sorting them
+    double         reduce_seconds;       // wall time of the reduce phase
+    double         lock_wait_seconds;    // thread time blocked on partition locks while flushing emits
+    int            map_threads;          // concurrent mappers allowed when the map phase ended
+    unsigned long  bytes_allocated;      // intermediate bytes held in memory when the map phase ended
+    unsigned long  spilled_bytes;        // bytes written to spill runs
+    unsigned long  released_bytes;       // value storage freed during reduce as partitions finished
+    int            num_partitions;
+    unsigned long* emits;                // MR_Emit calls per partition
+    unsigned long* distinct_keys;        // keys handed to the reducer per partition
+    int            num_threads;
+    double*        thread_busy_seconds;  // time each worker thread spent running tasks
+} MR_Stats;
+
+// One key of the top-K sink, see MR_SetTopK.
+typedef struct MR_TopKEntry {
+    char*   key;
+    int64_t score;
+} MR_TopKEntry;
+
+// Different function pointer types used by MR. Values handed to a Reducer
+// are only valid until it returns: once every key of a partition has been
+// reduced, the partition's value storage is freed.
 typedef char* (*Getter)(char* key, int partition_number);
 typedef void (*Mapper)(char* file_name);
+typedef void (*ChunkMapper)(MR_Chunk* chunk);
 typedef void (*Reducer)(char* key, Getter get_func, int partition_number);
 typedef unsigned long (*Partitioner)(char* key, int num_partitions);
+typedef char* (*CombineGetter)(char* key);
+typedef void (*Combiner)(char* key, CombineGetter get_next);
+typedef int (*ValueComparator)(const char* a, const char* b);
+typedef void (*JoinReducer)(char* key, Getter left, Getter right, int partition_number);
 
 // External functions: these are what you must define
 void MR_Emit(char* key, char* value);
 
+// Emits a key/value given as (pointer, length) slices that need not be
+// NUL-terminated, e.g. tokens inside an MR_Input view.
+void MR_EmitN(const char* key, size_t key_len, const char* value, size_t value_len);
+
+// Emits a fixed-width integer value, stored without any string encoding.
+// Reducers read these with MR_GetNextInt64; string values of the same key
+// are still returned by get_next. When a partition was spilled, reading a
+// key's integers skips its string values that were not read yet.
+void MR_EmitInt64(char* key, int64_t value);
+
+void MR_EmitInt64N(const char* key, size_t key_len, int64_t value);
+
+// Returns 1 and stores the key's next integer value, or 0 when none remain.
+int MR_GetNextInt64(char* key, int partition_number, int64_t* value);
+
+// Bulk getters: store up to max of the key's next values in values and
+// return how many were stored (0 when none remain). They advance the same
+// cursors as get_next / MR_GetNextInt64, so the calls can be mixed. String
+// values read back from a spilled partition stay valid until the next
+// MR_GetBatch call.
+int MR_GetBatch(char* key, int partition_number, char** values, int max);
+
+int MR_GetBatchInt64(char* key, int partition_number, int64_t* values, int max);
+
+// Maps a chunk read-only into memory (length < 0 means to end of file).
+// Returns 0 on success, -1 on error; release with MR_UnmapInput.
+int MR_MapInput(MR_Chunk* chunk, MR_Input* input);
+
+void MR_UnmapInput(MR_Input* input);
+
+// Called by MR_Tokenize for every token; delim is the byte that ended it,
+// or '\0' for the remainder after the last delimiter.
+typedef void (*TokenHandler)(const char* token, size_t length, char delim, void* arg);
+
+// Splits [data, data + length) at any byte of delims, vectorized with
+// AVX2/SSE2 where available. Adjacent delimiters yield empty tokens, and the
+// remainder after the last delimiter is always reported, even when empty.
+void MR_Tokenize(const char* data, size_t length, const char* delims, TokenHandler handler, void* arg);
+
+// Emits are buffered per thread; mapper threads are flushed automatically,
+// other threads calling MR_Emit must flush before MR_Run enters reduce.
+void MR_FlushEmits(void);
+
 unsigned long MR_DefaultHashPartition(char* key, int num_partitions);
 
+// Range partitioner on the leading bytes of the key: partition numbers are
+// non-decreasing in key order, so reducer outputs concatenated in partition
+// order are globally sorted.
+unsigned long MR_SortedPartition(char* key, int num_partitions);
+
+// Range partitioner whose split points come from a sampling pre-pass: the
+// mapper is first run over up to 16 evenly spaced tasks with emits captured
+// in reservoirs, and splits are chosen so every partition gets a similar
+// number of values; a hot key gets a partition of its own. Output is
+// globally sorted like MR_SortedPartition. Sampled tasks are mapped twice,
+// so map must have no side effects besides emitting. Falls back to hash
+// partitioning under MR_RunProcesses.
+unsigned long MR_SampledPartition(char* key, int num_partitions);
+
+// Runs the same job in num_workers forked processes instead of threads.
+// Map workers pull input files from the coordinator over a pipe and write
+// every partition as serialized sorted runs; up to num_workers reduce
+// processes then merge the runs of their partitions. MR_Output still comes
+// out in partition order. Exits the program if a worker fails.
+void MR_RunProcesses(int argc, char* argv[], Mapper map, int num_workers, Reducer reduce, int num_reducers, Combiner combine, Partitioner partition);
+
+// Pins worker threads to CPUs, spreading neighbours across NUMA nodes, and
+// moves the reducer of partition p onto node p % nodes so its reduce-side
+// allocations stay local. Takes effect on the next threaded run.
+void MR_SetAffinity(int enabled);
+
+// Caps the memory held by intermediate pairs (0 = unlimited, the default).
+// Partitions over their share are sorted and spilled to temporary run files,
+// which are k-way merged during reduce. Values read back from a run are only
+// valid until the next get_next call. Takes effect on the next MR_Run.
+void MR_SetMemoryBudget(size_t bytes);
+
+// Splits the intermediate data into factor * num_reducers partitions (default
+// factor 1). Partitioners and Reducers see the larger partition count, and
+// MR_Output and MR_SetOutput files follow it. Reducer threads, or processes
+// under MR_RunProcesses, take partitions from a queue ordered largest first,
+// so one heavy partition no longer decides the length of the reduce phase.
+// Takes effect on the next run.
+void MR_SetPartitionsPerReducer(int factor);
+
+// Spill runs always store keys front-coded against the previous key; with
+// compression enabled each 64 KB block of a run is also LZ4-compressed.
+// Applies to spills and to the runs MR_RunProcesses hands between workers.
+void MR_SetSpillCompression(int enabled);
+
+// Checkpoints every map task of threaded runs into dir (NULL disables): a
+// task's output is written as sorted runs and recorded in dir/manifest.
+// Rerunning a crashed job with the same arguments skips the recorded tasks
+// and resumes from their runs, unless an input file's size or modification
+// time has changed since; checkpoints are removed once the job ends.
+void MR_SetCheckpointDir(const char* dir);
+
+// Saves the map output of threaded runs to path (NULL disables): after the
+// map phase every partition's keys are written in order with all their
+// values, and the reduce phase then reads that file instead. reduce may be
+// NULL to save without reducing. MR_RunReduceOnly can reduce the file again,
+// for example with other reducer settings. Takes effect on the next run.
+void MR_SetMapOutputFile(const char* path);
+
+// Opt-in streaming mode for associative combiners: once the map task queue
+// is empty, idle workers combine the values already shuffled into each
+// partition while the remaining mappers finish, so reduce starts from
+// partial results. Takes effect on the next run with a combiner.
+void MR_SetPipelined(int enabled);
+
+const MR_Stats* MR_GetStats(void);
+
+// Writes stats as a single JSON object followed by a newline.
+void MR_DumpStats(const MR_Stats* stats, FILE* out);
+
+// Pass MR_AUTO as num_mappers or num_reducers, or as num_workers of
+// MR_RunProcesses, to size them from the online CPUs. With automatic mappers
+// the thread runners, including sampled and checkpointed map tasks, also
+// lower the number of mappers running at once while partition lock waits
+// dominate their busy time and raise it back when contention fades; see
+// map_threads in MR_Stats. Forked workers are not adjusted.
+#define MR_AUTO 0
+
 void MR_Run(int argc, char* argv[], Mapper map, int num_mappers, Reducer reduce, int num_reducers, Partitioner partition);
 
+// Like MR_Run, but each mapper thread's buffered values are pre-aggregated
+// per key by combine, which hands its results on with MR_EmitToReducer.
+void MR_RunWithCombiner(int argc, char* argv[], Mapper map, int num_mappers, Reducer reduce, int num_reducers, Combiner combine, Partitioner partition);
+
+// Like MR_RunWithCombiner, but get_next and MR_GetBatch return each key's
+// string values in the order of compare, which returns <0, 0 or >0 like
+// strcmp; values comparing equal come in no particular order. The reducer
+// thread that claims a key sorts its values just before reducing it, so the
+// sort runs in parallel. For a spilled partition the key's values are read
+// from every run and sorted in memory first. Integer values are not sorted.
+void MR_RunSorted(int argc, char* argv[], Mapper map, int num_mappers, Reducer reduce, int num_reducers, Combiner combine, Partitioner partition, ValueComparator compare);
+
+// Reduce-side join of two datasets: the left files are mapped by map_left
+// and the right files by map_right (the usual argv[0] slot is not used).
+// MR_Emit and MR_EmitN values are tagged with the side of the task that
+// emitted them and grouped per key by side before reduce, which reads the
+// key's left values with left and its right values with right. Calling
+// right first skips the left values not read yet. Integer values are not
+// tagged, and MR_SampledPartition falls back to hashing.
+void MR_RunJoin(int num_left, char* left[], Mapper map_left, int num_right, char* right[], Mapper map_right, int num_mappers, JoinReducer reduce, int num_reducers, Partitioner partition);
+
+// Runs only the reduce phase over a file saved with MR_SetMapOutputFile.
+// The file is mmapped, and each partition is reduced in key order by one
+// reducer thread. Keys and values point into the mapping and stay valid
+// until reduce returns. The partition count is the one the file was saved
+// with.
+void MR_RunReduceOnly(const char* path, Reducer reduce, int num_reducers);
+
+// Approximate counting in one pass and bounded memory. Every mapper thread
+// adds its emits to its own count-min sketch of depth rows of width counters
+// instead of shuffling them: MR_Emit counts 1, MR_EmitInt64 adds the value.
+// A heavy-hitter table per thread keeps the heavy keys with the largest
+// estimates; after the map phase the sketches are summed and the candidates
+// re-estimated, and the best heavy are written and returned like the top-K
+// sink. Estimates never undercount and, with probability 1 - 2^-depth,
+// overcount by at most 2/width of the total. There is no reduce phase.
+void MR_RunSketch(int argc, char* argv[], Mapper map, int num_mappers, int width, int depth, int heavy);
+
+// Estimated count of key in the latest MR_RunSketch job, 0 before any.
+int64_t MR_SketchEstimate(const char* key);
+
+// Splits every input file into chunks of about chunk_size bytes, each ending
+// on a line boundary, and runs map once per chunk. combine may be NULL.
+// gzip and zstd files are recognized by their magic numbers and decoded
+// while they are mapped, never staged to disk. A gzip file made of BGZF
+// blocks (bgzip) is split at block boundaries and its chunks decoded in
+// parallel; any other gzip or zstd file is decoded by one mapper thread that
+// maps each chunk_size of text as it comes. zstd files need the zstd program.
+void MR_RunChunked(int argc, char* argv[], ChunkMapper map, int num_mappers, Reducer reduce, int num_reducers, Combiner combine, Partitioner partition, long chunk_size);
+
+// Reads in until end of file, cutting it into newline-aligned chunks of
+// about chunk_size bytes that are handed to map as they are read, so a
+// pipe can be processed without staging it to disk. When a slow pipe goes
+// quiet, the complete lines read so far are handed over without waiting for
+// a full chunk. in is read through its file descriptor, so nothing should
+// be left in its stdio buffer. Reading blocks while too many chunks wait to
+// be mapped. Checkpoints do not apply to streams.
+void MR_RunStream(FILE* in, ChunkMapper map, int num_mappers, Reducer reduce, int num_reducers, Combiner combine, Partitioner partition, long chunk_size);
+
+// A reusable job context that owns a thread pool, the partitions and their
+// allocators. Back-to-back runs on the same job keep the worker threads and
+// the warmed hash tables and arenas; MR_JobDestroy frees everything. One job
+// runs at a time per process, and the MR_Set* settings apply to every run.
+// MR_Run and friends create and destroy a temporary job.
+typedef struct MR_Job MR_Job;
+
+MR_Job* MR_JobCreate(void);
+
+void MR_JobRun(MR_Job* job, int argc, char* argv[], Mapper map, int num_mappers, Reducer reduce, int num_reducers, Combiner combine, Partitioner partition);
+
+void MR_JobRunSorted(MR_Job* job, int argc, char* argv[], Mapper map, int num_mappers, Reducer reduce, int num_reducers, Combiner combine, Partitioner partition, ValueComparator compare);
+
+void MR_JobRunChunked(MR_Job* job, int argc, char* argv[], ChunkMapper map, int num_mappers, Reducer reduce, int num_reducers, Combiner combine, Partitioner partition, long chunk_size);
+
+void MR_JobRunStream(MR_Job* job, FILE* in, ChunkMapper map, int num_mappers, Reducer reduce, int num_reducers, Combiner combine, Partitioner partition, long chunk_size);
+
+void MR_JobRunReduceOnly(MR_Job* job, const char* path, Reducer reduce, int num_reducers);
+
+void MR_JobDestroy(MR_Job* job);
+
+// Asynchronous jobs. MR_Submit queues a job with the MR_RunWithCombiner
+// arguments and returns at once; a background thread runs submitted jobs
+// one at a time in submission order on a single job context, so they share
+// its worker pool and warmed partitions. Jobs do not run concurrently: the
+// running job, stats, top-K result and output are per process, so a later
+// job waits for the earlier ones and gets all the workers once it starts.
+// Settings are read when a job starts, argv must stay valid until it ends,
+// and synchronous runs must not overlap submitted ones. MR_Cancel drops a
+// queued job, or stops a running one from starting new map tasks and keys,
+// with no output written; a cancel that arrives after the output was
+// written leaves the job done. MR_Wait blocks until the job ends, frees the
+// handle, and returns 0 if it completed or -1 if it was cancelled.
+typedef struct MR_Handle MR_Handle;
+
+enum { MR_JOB_QUEUED, MR_JOB_RUNNING, MR_JOB_DONE, MR_JOB_CANCELLED };
+
+MR_Handle* MR_Submit(int argc, char* argv[], Mapper map, int num_mappers, Reducer reduce, int num_reducers, Combiner combine, Partitioner partition);
+
+// Returns the job's state without blocking.
+int MR_Poll(MR_Handle* handle);
+
+int MR_Wait(MR_Handle* handle);
+
+// Returns 0 if the job was cancelled or asked to stop, -1 if it had ended.
+int MR_Cancel(MR_Handle* handle);
+
+// Writes "key value\n" from a Reducer without going through stdio. Output
+// is buffered per key and written after the reduce phase, partition by
+// partition and in key order within a partition, so it does not depend on
+// thread scheduling.
+void MR_Output(char* key, char* value);
+
+// NULL (the default) sends MR_Output to stdout; otherwise partition i is
+// written to "<prefix>-%05d". Takes effect on the next run.
+void MR_SetOutput(const char* prefix);
+
+// Top-K sink (k = 0, the default, disables it). A Reducer offers a key with
+// MR_OutputTopK; every reducer thread or process keeps the best k in a
+// min-heap and the heaps are merged after the reduce phase. The result,
+// highest score first and ties by key, is written as "key score\n" after the
+// MR_Output contents (to "<prefix>-topk" under MR_SetOutput) and can be read
+// back with MR_GetTopK until the next job starts. Takes effect on the next run.
+void MR_SetTopK(int k);
+
+void MR_OutputTopK(char* key, int64_t score);
+
+// Returns the merged top-K entries of the latest job and stores their count.
+const MR_TopKEntry* MR_GetTopK(int* count);
+
+// Only valid inside a Combiner callback.
+void MR_EmitToReducer(char* key, char* value);
+
+// Integer counterparts for combiners; also only valid inside a Combiner.
+int MR_CombineNextInt64(int64_t* value);
+
+void MR_EmitToReducerInt64(char* key, int64_t value);
+
 #endif  // __mapreduce_h__
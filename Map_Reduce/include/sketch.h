@@ -0,0 +1,48 @@
+#ifndef __sketch_h__
+#define __sketch_h__
+
+#include "topk.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * 高频键表中的一个键及其估计值
+ */
+struct heavy_entry_t {
+    char*         key;
+    size_t        key_len;
+    unsigned long hash;
+    uint64_t      estimate;
+};
+
+/**
+ * Count-Min计数草图加高频键表
+ * counts为depth行width列的计数器，一个键在每行按哈希值选一列累加，估计值取各行的最小值，
+ * 只会高估不会低估；高频键表是按估计值排列的小顶堆，保留估计值最大的capacity个键，
+ * slots把键映射到它在堆中的下标
+ */
+struct sketch_t {
+    uint64_t*             counts;
+    int                   width;     // 每行的计数器数，为2的幂
+    int                   depth;     // 行数
+    struct heavy_entry_t* heap;      // 高频键小顶堆
+    int                   size;      // 堆中的键数
+    int                   capacity;  // 高频键表最多保留的键数
+    int*                  slots;     // 开放寻址哈希表，存放堆下标+1，0表示空
+    int                   num_slots; // 槽位数，为2的幂且不小于capacity的两倍
+};
+
+void sketch_init(struct sketch_t* sketch, int width, int depth, int capacity);
+
+void sketch_add(struct sketch_t* sketch, const char* key, size_t key_len, unsigned long hash, uint64_t count);
+
+uint64_t sketch_estimate(const struct sketch_t* sketch, unsigned long hash);
+
+void sketch_merge(struct sketch_t* into, const struct sketch_t* from);
+
+void sketch_heavy_hitters(const struct sketch_t* merged, struct sketch_t* parts, int num_parts, struct topk_t* out);
+
+void sketch_free(struct sketch_t* sketch);
+
+#endif
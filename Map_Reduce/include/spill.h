@@ -0,0 +1,67 @@
+#ifndef __spill_h__
+#define __spill_h__
+
+#include "utils.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * 一个分区溢写到磁盘的有序段
+ * 所有段依次追加到同一个临时文件中，每段由若干块组成：
+ * [解压后长度][存放长度][内容]，存放长度小于解压后长度时内容经过LZ4压缩；
+ * 各块内容连起来按键升序存放
+ * [共同前缀长][键的其余部分长][键的其余部分][值个数][整数值个数]{[值长][值]}{int64_t}，
+ * 长度和个数均为uint32_t，键只存与上一个键不同的部分
+ */
+struct run_list_t {
+    FILE* file;     // 临时文件，由tmpfile创建，关闭后自动删除
+    long* starts;   // 每段在文件中的起始偏移
+    long* ends;     // 每段在文件中的结束偏移
+    int   count;    // 段数量
+    int   cap;      // starts和ends数组容量
+    int   failed;   // 为1时溢写失败过，之后数据留在内存中
+};
+
+/**
+ * 顺序读取一个段的游标，各游标用pread共享同一个文件
+ */
+struct run_reader_t {
+    int      fd;
+    long     pos;        // 下一次从文件读取的偏移
+    long     end;        // 段的结束偏移
+    char*    buf;        // 当前块解压后的内容
+    char*    packed;     // 压缩块的读缓冲区
+    size_t   buf_len;    // 缓冲区中的有效字节数
+    size_t   buf_pos;    // 缓冲区中下一个未读字节
+    char*    key;        // 当前键，以'\0'结尾
+    size_t   key_cap;    // key缓冲区容量
+    uint32_t remaining;  // 当前键尚未读出的值个数
+    uint32_t ints_left;  // 当前键尚未读出的整数值个数
+    char*    value;      // 最近读出的值，以'\0'结尾
+    size_t   value_cap;  // value缓冲区容量
+    int      done;       // 为1时段已读完
+    int      active;     // 为1时当前键参与正在进行的归约
+};
+
+void init_runs(struct run_list_t* runs);
+
+int spill_partition(struct partition_t* part, struct run_list_t* runs, int compress);
+
+void free_runs(struct run_list_t* runs);
+
+int export_runs(struct partition_t* part, struct run_list_t* runs, FILE* out, int compress);
+
+int import_runs(struct run_list_t* runs, FILE* in);
+
+void run_reader_open(struct run_reader_t* reader, struct run_list_t* runs, int index);
+
+void run_reader_next_key(struct run_reader_t* reader);
+
+char* run_reader_next_value(struct run_reader_t* reader);
+
+int run_reader_next_int(struct run_reader_t* reader, int64_t* value);
+
+void run_reader_close(struct run_reader_t* reader);
+
+#endif
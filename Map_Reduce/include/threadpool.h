@@ -0,0 +1,42 @@
+#ifndef __threadpool_h__
+#define __threadpool_h__
+
+#include <pthread.h>
+
+typedef void (*task_func_t)(void* arg);
+
+struct task_t {
+    task_func_t    func;
+    void*          arg;
+    struct task_t* next;
+};
+
+struct threadpool_t {
+    pthread_mutex_t lock;
+    pthread_cond_t  has_task;     // 任务队列非空、并发上限放宽或线程池关闭时通知
+    pthread_cond_t  all_done;     // 已提交的任务全部完成时通知
+    struct task_t*  head;         // 任务队列头，先进先出
+    struct task_t*  tail;         // 任务队列尾
+    int             pending;      // 已提交但尚未完成的任务数
+    int             running;      // 正在执行任务的线程数
+    int             active;       // 同时执行任务的线程数上限
+    int             shutdown;     // 为1时工作线程取完剩余任务后退出
+    int             num_threads;  // 工作线程数
+    pthread_t*      threads;      // 工作线程数组
+    int             started;      // 已启动的工作线程数，用于分配线程编号
+    unsigned long*  busy_ns;      // 每个工作线程执行任务的累计时间（纳秒）
+};
+
+struct threadpool_t* threadpool_create(int num_threads);
+
+void threadpool_submit(struct threadpool_t* pool, task_func_t func, void* arg);
+
+void threadpool_set_active(struct threadpool_t* pool, int active);
+
+void threadpool_wait(struct threadpool_t* pool);
+
+int threadpool_self(void);
+
+void threadpool_destroy(struct threadpool_t* pool);
+
+#endif
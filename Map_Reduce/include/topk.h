@@ -0,0 +1,29 @@
+#ifndef __topk_h__
+#define __topk_h__
+
+#include "mapreduce.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * 保留分数最高的k个键的小顶堆，堆顶是当前保留的键中最差的一个
+ * 分数相同时键的字典序较小者优先
+ */
+struct topk_t {
+    MR_TopKEntry* entries;
+    int           count;  // 堆中的键数，不超过k
+    int           k;
+};
+
+void topk_init(struct topk_t* heap, int k);
+
+void topk_offer(struct topk_t* heap, const char* key, size_t key_len, int64_t score);
+
+void topk_merge(struct topk_t* into, struct topk_t* from);
+
+void topk_sort(struct topk_t* heap);
+
+void topk_free(struct topk_t* heap);
+
+#endif
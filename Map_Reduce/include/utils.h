@@ -1,25 +1,111 @@
 #ifndef __utils_h__
 #define __utils_h__
 
+#include "arena.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
 struct data_node_t {
-    int                 proceed;
     char*               value;
     struct data_node_t* next;
 };
 
 struct info_node_t {
-    int                 proceed;
+    unsigned long       hash;
     char*               info;
+    size_t              info_len;    // 键长度，查找时与哈希值一起先于内容比较
     struct data_node_t* data;
+    struct data_node_t* cursor;      // 归约时下一个要返回的值
+    int64_t*            ints;        // 整数值数组，分配在分段的分配器中
+    unsigned long       num_ints;    // 整数值个数
+    unsigned long       ints_cap;    // ints数组容量
+    unsigned long       int_cursor;  // 归约时下一个要返回的整数值下标
+    char*               output;      // 归约函数通过MR_Output写出的内容，归约阶段结束后按键序输出
+    size_t              output_len;  // output中的字节数
+    size_t              output_cap;  // output容量
     struct info_node_t* next;
 };
 
+/**
+ * 字符串驻留表：相同内容的字符串只在分配器中保存一份
+ * 重复率过低时自动停用，避免为全不相同的值额外维护哈希表
+ */
+struct intern_table_t {
+    char**         slots;     // 开放寻址哈希表，槽位为NULL表示空
+    unsigned long* hashes;    // 与slots对应的哈希值
+    unsigned long  capacity;  // 槽位数，始终为2的幂
+    unsigned long  size;      // 不同字符串的数量
+    unsigned long  lookups;   // 驻留请求次数
+    int            disabled;  // 为1时直接拷贝，不再驻留
+};
+
+#define STRIPE_BITS       3
+#define PARTITION_STRIPES (1 << STRIPE_BITS)  // 每个分区的分段数
+
+/**
+ * 分区的一个分段：按键的哈希值划分，各分段有独立的锁、哈希表和分配器，
+ * 不同映射线程向同一分区提交不同的键时可以并行
+ */
+struct stripe_t {
+    pthread_mutex_t       lock;
+    struct info_node_t*   info_head;
+    struct info_node_t**  table;     // 开放寻址哈希表，槽位为NULL表示空
+    unsigned long         capacity;  // 槽位数，始终为2的幂
+    unsigned long         size;      // 已插入的键数量
+    struct arena_t        keys;      // 键节点及键字符串的分配器，作业结束时整体释放
+    struct arena_t        arena;     // 值节点、整数数组及值字符串的分配器，分区归约完后即释放
+    struct intern_table_t values;    // 值字符串驻留表，如wordcount中的"1"只存一份
+};
+
 struct partition_t {
-    struct info_node_t* info_head;
+    struct stripe_t       stripes[PARTITION_STRIPES];
+    struct info_node_t**  sorted;    // 映射阶段结束后按键排序的键数组
+    unsigned long         size;      // sorted中的键数量
+    unsigned long         next_key;  // 下一个待归约的键在sorted中的下标，归约时原子递增领取
+    int                   stealable; // 为1时sorted已就绪，其他归约线程可以窃取剩余的键
+    unsigned long         reduced;   // 已归约完的键数，各归约线程领完键后原子累加
+    char**                values;    // pack_partition后按键序连续存放的全部字符串值
+    unsigned long*        value_start; // sorted[i]的值为values[value_start[i]]到values[value_start[i+1]-1]
 };
 
-void insert_info(struct partition_t* part, char* key);
+unsigned long now_ns(void);
+
+unsigned long hash_key(char* key);
+
+unsigned long hash_key_n(const char* key, size_t len);
+
+void init_intern(struct intern_table_t* table);
+
+char* intern_string(struct intern_table_t* table, struct arena_t* arena, char* str);
+
+void free_intern(struct intern_table_t* table);
+
+void init_partition(struct partition_t* part);
+
+struct stripe_t* stripe_of(struct partition_t* part, unsigned long hash);
+
+struct info_node_t* find_info(struct partition_t* part, const char* key, size_t len, unsigned long hash);
+
+struct info_node_t* insert_info(struct partition_t* part, const char* key, size_t len, unsigned long hash);
+
+void insert_data(struct partition_t* part, struct info_node_t* info, char* value);
+
+void insert_int(struct partition_t* part, struct info_node_t* info, int64_t value);
+
+void sort_partition(struct partition_t* part);
+
+void pack_partition(struct partition_t* part);
+
+size_t partition_bytes(struct partition_t* part);
+
+size_t release_values(struct partition_t* part);
+
+void clear_partition(struct partition_t* part);
+
+void reset_partition(struct partition_t* part);
 
-void insert_data(struct info_node_t* info, char* value);
+void free_partition(struct partition_t* part);
 
-#endif
\ No newline at end of file
+#endif
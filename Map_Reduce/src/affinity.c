@@ -0,0 +1,182 @@
+#define _GNU_SOURCE
+#include "affinity.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_NODES 64  // 读取sysfs时最多检查的节点编号
+
+static __thread cpu_set_t saved_mask;      // 线程第一次绑定到节点之前的CPU掩码
+static __thread int       mask_saved = 0;  // 为1时saved_mask有效，需由restore_self_affinity恢复
+
+/**
+ * 解析sysfs中"0-3,8-11"格式的CPU列表
+ */
+static void parse_cpulist(const char* list, cpu_set_t* set) {
+    CPU_ZERO(set);
+    while (*list != '\0' && *list != '\n') {
+        char* end;
+        long  first = strtol(list, &end, 10);
+        long  last  = first;
+        if (end == list)
+            return;
+        if (*end == '-')
+            last = strtol(end + 1, &end, 10);
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu)
+            CPU_SET(cpu, set);
+        list = *end == ',' ? end + 1 : end;
+    }
+}
+
+/**
+ * 读取进程可用的CPU并按所在NUMA节点分组
+ * 节点信息来自/sys/devices/system/node/node*\/cpulist，不依赖libnuma
+ *
+ * @param topo 输出的拓扑，用free_topology释放
+ * @return 成功返回0，无法获得进程的CPU掩码返回-1
+ */
+int load_topology(struct cpu_topology_t* topo) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+        return -1;
+
+    int num_allowed = CPU_COUNT(&allowed);
+    topo->cpus      = ( int* )malloc(sizeof(int) * num_allowed);
+    topo->nodes     = ( int* )malloc(sizeof(int) * num_allowed);
+    topo->num_cpus  = 0;
+    topo->num_nodes = 0;
+
+    for (int node = 0; node < MAX_NODES; ++node) {
+        char path[64];
+        char list[4096];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE* fp = fopen(path, "r");
+        if (fp == NULL)
+            continue;
+        if (fgets(list, sizeof(list), fp) == NULL)
+            list[0] = '\0';
+        fclose(fp);
+
+        cpu_set_t node_cpus;
+        parse_cpulist(list, &node_cpus);
+        int found = 0;
+        for (int cpu = 0; cpu < CPU_SETSIZE && topo->num_cpus < num_allowed; ++cpu) {
+            if (!CPU_ISSET(cpu, &node_cpus) || !CPU_ISSET(cpu, &allowed))
+                continue;
+            CPU_CLR(cpu, &allowed);
+            topo->cpus[topo->num_cpus]  = cpu;
+            topo->nodes[topo->num_cpus] = topo->num_nodes;
+            topo->num_cpus++;
+            found = 1;
+        }
+        topo->num_nodes += found;
+    }
+
+    // sysfs不可用或有CPU不属于任何节点时，剩余CPU归入一个额外的节点
+    int rest = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && topo->num_cpus < num_allowed; ++cpu) {
+        if (!CPU_ISSET(cpu, &allowed))
+            continue;
+        topo->cpus[topo->num_cpus]  = cpu;
+        topo->nodes[topo->num_cpus] = topo->num_nodes;
+        topo->num_cpus++;
+        rest = 1;
+    }
+    topo->num_nodes += rest;
+    return 0;
+}
+
+/**
+ * 为第worker个工作线程选择CPU
+ * 相邻的线程轮流分到不同节点，节点内依次使用各CPU，线程数少于CPU数时各节点负载均衡
+ *
+ * @return CPU编号
+ */
+int topology_cpu_for(const struct cpu_topology_t* topo, int worker) {
+    int node  = worker % topo->num_nodes;
+    int index = worker / topo->num_nodes;
+    int first = 0;
+    int count = 0;
+    for (int i = 0; i < topo->num_cpus; ++i) {
+        if (topo->nodes[i] != node)
+            continue;
+        if (count++ == 0)
+            first = i;
+    }
+    return topo->cpus[first + index % count];
+}
+
+/**
+ * 返回cpu所在的节点，不在拓扑中时返回-1
+ */
+int topology_node_of(const struct cpu_topology_t* topo, int cpu) {
+    for (int i = 0; i < topo->num_cpus; ++i) {
+        if (topo->cpus[i] == cpu)
+            return topo->nodes[i];
+    }
+    return -1;
+}
+
+/**
+ * 把线程绑定到单个CPU
+ *
+ * @return 成功返回0，否则返回错误码
+ */
+int pin_thread(pthread_t thread, int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(thread, sizeof(set), &set);
+}
+
+/**
+ * 解除绑定，允许线程在拓扑中的所有CPU上运行
+ *
+ * @return 成功返回0，否则返回错误码
+ */
+int unpin_thread(pthread_t thread, const struct cpu_topology_t* topo) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int i = 0; i < topo->num_cpus; ++i)
+        CPU_SET(topo->cpus[i], &set);
+    return pthread_setaffinity_np(thread, sizeof(set), &set);
+}
+
+/**
+ * 把调用线程绑定到节点的全部CPU上，之后首次写入的内存页也分配在该节点
+ * 第一次绑定前保存线程原来的CPU掩码，由restore_self_affinity恢复
+ *
+ * @return 成功返回0，否则返回错误码
+ */
+int pin_self_to_node(const struct cpu_topology_t* topo, int node) {
+    if (!mask_saved && pthread_getaffinity_np(pthread_self(), sizeof(saved_mask), &saved_mask) == 0)
+        mask_saved = 1;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int i = 0; i < topo->num_cpus; ++i) {
+        if (topo->nodes[i] == node)
+            CPU_SET(topo->cpus[i], &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/**
+ * 恢复调用线程在pin_self_to_node之前的CPU掩码，没有绑定过时不做任何事
+ *
+ * @return 成功返回0，否则返回错误码
+ */
+int restore_self_affinity(void) {
+    if (!mask_saved)
+        return 0;
+    mask_saved = 0;
+    return pthread_setaffinity_np(pthread_self(), sizeof(saved_mask), &saved_mask);
+}
+
+void free_topology(struct cpu_topology_t* topo) {
+    free(topo->cpus);
+    free(topo->nodes);
+    topo->cpus     = NULL;
+    topo->nodes    = NULL;
+    topo->num_cpus = 0;
+}
@@ -0,0 +1,91 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN 8  // 分配结果按8字节对齐，足以存放指针和long
+
+void arena_init(struct arena_t* arena, size_t chunk_size) {
+    arena->head       = NULL;
+    arena->spare      = NULL;
+    arena->chunk_size = chunk_size;
+    arena->bytes      = 0;
+}
+
+/**
+ * 从当前块顺序切分内存，当前块不足时申请新块
+ * 超过默认块大小的请求单独占用一个块
+ *
+ * @param arena 分配器
+ * @param size 请求的字节数
+ * @return 按ARENA_ALIGN对齐的内存，随arena_release一并释放
+ */
+void* arena_alloc(struct arena_t* arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~( size_t )(ARENA_ALIGN - 1);
+
+    struct arena_chunk_t* chunk = arena->head;
+    if (chunk == NULL || chunk->used + size > chunk->size) {
+        size_t chunk_size = size > arena->chunk_size ? size : arena->chunk_size;
+        if (arena->spare != NULL && arena->spare->size >= chunk_size) {
+            chunk        = arena->spare;
+            arena->spare = chunk->next;
+        } else {
+            chunk       = ( struct arena_chunk_t* )malloc(sizeof(struct arena_chunk_t) + chunk_size);
+            chunk->size = chunk_size;
+        }
+        chunk->used = 0;
+        chunk->next = arena->head;
+        arena->head = chunk;
+        arena->bytes += sizeof(struct arena_chunk_t) + chunk->size;
+    }
+
+    void* ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+char* arena_strdup(struct arena_t* arena, const char* str) {
+    size_t len  = strlen(str) + 1;
+    char*  copy = ( char* )arena_alloc(arena, len);
+    memcpy(copy, str, len);
+    return copy;
+}
+
+static void free_chunks(struct arena_chunk_t* chunk) {
+    while (chunk != NULL) {
+        struct arena_chunk_t* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+}
+
+/**
+ * 作废所有已分配的内存，但保留块供之后的分配复用
+ * 超过默认大小的块不易复用，直接释放
+ */
+void arena_reset(struct arena_t* arena) {
+    struct arena_chunk_t* chunk = arena->head;
+    while (chunk != NULL) {
+        struct arena_chunk_t* next = chunk->next;
+        if (chunk->size == arena->chunk_size) {
+            chunk->next  = arena->spare;
+            arena->spare = chunk;
+        } else {
+            free(chunk);
+        }
+        chunk = next;
+    }
+    arena->head  = NULL;
+    arena->bytes = 0;
+}
+
+/**
+ * 一次性释放分配器持有的所有块
+ */
+void arena_release(struct arena_t* arena) {
+    free_chunks(arena->head);
+    free_chunks(arena->spare);
+    arena->head  = NULL;
+    arena->spare = NULL;
+    arena->bytes = 0;
+}
@@ -0,0 +1,155 @@
+/**
+ * LZ4块格式的压缩与解压，用于溢写段
+ * 压缩采用单遍贪心匹配：以4字节为单位哈希到最近出现的位置，匹配成功时尽量向后延伸
+ * 输出与LZ4块格式兼容：[标记][字面量长度扩展][字面量][偏移][匹配长度扩展]，
+ * 末尾至少5字节为字面量，最后一次匹配不晚于结尾前12字节开始
+ */
+#include "compress.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define HASH_BITS    12  // 匹配哈希表的槽位数为2^HASH_BITS
+#define MIN_MATCH    4   // 最短匹配长度
+#define MAX_OFFSET   65535
+#define LAST_LITERAL 5   // 结尾必须保留为字面量的字节数
+#define MATCH_LIMIT  12  // 距结尾不足该字节数时不再开始新的匹配
+
+static inline uint32_t read32(const char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hash4(uint32_t v) {
+    return (v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+/**
+ * 写出长度的扩展字节：先减去标记中已表示的15，之后每字节最多255
+ */
+static char* write_length(char* op, size_t len) {
+    for (; len >= 255; len -= 255)
+        *op++ = ( char )255;
+    *op++ = ( char )len;
+    return op;
+}
+
+/**
+ * 写出一个序列：字面量lit[0, lit_len)及随后的匹配（match_len为0时只有字面量）
+ */
+static char* write_sequence(char* op, const char* lit, size_t lit_len, size_t offset, size_t match_len) {
+    char* token = op++;
+    *token      = ( char )((lit_len >= 15 ? 15 : lit_len) << 4);
+    if (lit_len >= 15)
+        op = write_length(op, lit_len - 15);
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+    if (match_len == 0)
+        return op;
+
+    *op++ = ( char )(offset & 0xff);
+    *op++ = ( char )(offset >> 8);
+    match_len -= MIN_MATCH;
+    *token |= ( char )(match_len >= 15 ? 15 : match_len);
+    if (match_len >= 15)
+        op = write_length(op, match_len - 15);
+    return op;
+}
+
+/**
+ * 压缩src[0, src_len)
+ *
+ * @param dst 输出缓冲区，容量至少为LZ4_BOUND(src_len)
+ * @return 压缩后的长度；dst_cap不足时返回0
+ */
+size_t lz4_compress(const char* src, size_t src_len, char* dst, size_t dst_cap) {
+    if (dst_cap < LZ4_BOUND(src_len))
+        return 0;
+
+    uint32_t    table[1 << HASH_BITS] = {0};  // 位置+1，0表示空
+    const char* ip                    = src;
+    const char* anchor                = src;  // 尚未输出的字面量起点
+    const char* limit                 = src_len > MATCH_LIMIT ? src + src_len - MATCH_LIMIT : src;
+    const char* end                   = src + src_len;
+    char*       op                    = dst;
+
+    while (ip < limit) {
+        uint32_t    h         = hash4(read32(ip));
+        const char* candidate = table[h] != 0 ? src + table[h] - 1 : NULL;
+        table[h]              = ( uint32_t )(ip - src) + 1;
+        if (candidate == NULL || ip - candidate > MAX_OFFSET || read32(candidate) != read32(ip)) {
+            ++ip;
+            continue;
+        }
+
+        // 向后延伸匹配，保留结尾的字面量
+        size_t len = MIN_MATCH;
+        while (ip + len < end - LAST_LITERAL && ip[len] == candidate[len])
+            ++len;
+        op = write_sequence(op, anchor, ip - anchor, ip - candidate, len);
+        ip += len;
+        anchor = ip;
+    }
+    op = write_sequence(op, anchor, end - anchor, 0, 0);
+    return op - dst;
+}
+
+/**
+ * 读取扩展长度字节
+ *
+ * @return 成功返回0，输入截断返回-1
+ */
+static int read_length(const char** ip, const char* end, size_t* len) {
+    unsigned char b;
+    do {
+        if (*ip >= end)
+            return -1;
+        b = ( unsigned char )*(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+/**
+ * 解压lz4_compress的输出，检查所有读写边界
+ *
+ * @return 解压后的长度；输入损坏或dst_cap不足时返回0
+ */
+size_t lz4_decompress(const char* src, size_t src_len, char* dst, size_t dst_cap) {
+    const char* ip      = src;
+    const char* end     = src + src_len;
+    char*       op      = dst;
+    char*       dst_end = dst + dst_cap;
+
+    while (ip < end) {
+        unsigned char token   = ( unsigned char )*ip++;
+        size_t        lit_len = token >> 4;
+        if (lit_len == 15 && read_length(&ip, end, &lit_len) < 0)
+            return 0;
+        if (( size_t )(end - ip) < lit_len || ( size_t )(dst_end - op) < lit_len)
+            return 0;
+        memcpy(op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+        if (ip == end)
+            break;
+
+        if (end - ip < 2)
+            return 0;
+        size_t offset = ( unsigned char )ip[0] | (( size_t )( unsigned char )ip[1] << 8);
+        ip += 2;
+        size_t match_len = token & 15;
+        if (match_len == 15 && read_length(&ip, end, &match_len) < 0)
+            return 0;
+        match_len += MIN_MATCH;
+        if (offset == 0 || offset > ( size_t )(op - dst) || ( size_t )(dst_end - op) < match_len)
+            return 0;
+        // 匹配可能与输出重叠（偏移小于长度），逐字节复制
+        const char* match = op - offset;
+        for (size_t i = 0; i < match_len; ++i)
+            op[i] = match[i];
+        op += match_len;
+    }
+    return op - dst;
+}
@@ -0,0 +1,460 @@
+/**
+ * gzip（RFC 1952）与DEFLATE（RFC 1951）解压，用于读取压缩的输入文件
+ * 输入整段在内存中（通常是mmap的文件），输出写入一个缓冲区，缓冲区满时把新数据交给sink、只保留32KB的回溯窗口，
+ * 因此解压任意大的文件只占用固定的内存。
+ * 哈夫曼码先查低FASTBITS位的表，更长的码再按规范哈夫曼码逐位解码
+ */
+#include "inflate.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAXBITS   15     // 最长的码长
+#define FASTBITS  10     // 查表解码的位数
+#define MAXLCODES 288    // 字面量/长度码的符号数
+#define MAXDCODES 32     // 距离码的符号数
+#define MAXCODES  (MAXLCODES + MAXDCODES)
+#define WINDOW    32768  // 回溯距离的上限
+#define OUTBUF    (4 * WINDOW)
+#define MAXMATCH  258    // 一次匹配的最大长度
+
+/**
+ * 一个规范哈夫曼码
+ */
+struct huffman_t {
+    uint16_t fast[1 << FASTBITS];  // 以逆序的低FASTBITS位为下标：符号<<4|码长，0表示码长超过FASTBITS
+    uint16_t count[MAXBITS + 1];   // 各码长的码数
+    uint16_t symbol[MAXLCODES];    // 按码长、再按符号排序的符号
+};
+
+/**
+ * 解压状态
+ */
+struct inflate_t {
+    const unsigned char* in;
+    size_t               in_len;
+    size_t               pos;     // 下一个未读入位缓冲的字节
+    uint64_t             bits;    // 位缓冲，低位先读
+    int                  nbits;   // 位缓冲中的位数
+    int                  error;   // 为1时输入截断或损坏
+    char*                out;     // 输出缓冲区，开头是回溯用的窗口
+    size_t               out_len;
+    size_t               flushed; // out[0, flushed)已交给sink
+    uint32_t             crc;     // 已交给sink的数据的CRC-32
+    uint32_t             size;    // 本成员解压出的字节数，模2^32
+    inflate_sink_t       sink;
+    void*                arg;
+    struct huffman_t     lencode;
+    struct huffman_t     distcode;
+};
+
+static const uint16_t length_base[29]  = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t  length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t dist_base[30]    = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t  dist_extra[30]   = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+static uint32_t       crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void make_crc_table(void) {
+    for (uint32_t n = 0; n < 256; ++n) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; ++k)
+            c = c & 1 ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+        crc_table[n] = c;
+    }
+}
+
+static uint32_t crc32_update(uint32_t crc, const char* data, size_t len) {
+    crc = ~crc;
+    for (size_t i = 0; i < len; ++i)
+        crc = crc_table[(crc ^ ( unsigned char )data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+/**
+ * 把位缓冲补到至少57位，输入读完时保持原样
+ */
+static inline void refill(struct inflate_t* s) {
+    while (s->nbits <= 56 && s->pos < s->in_len) {
+        s->bits |= ( uint64_t )s->in[s->pos++] << s->nbits;
+        s->nbits += 8;
+    }
+}
+
+/**
+ * 读取n位（n不超过32），输入不足时置错误标志
+ */
+static inline uint32_t getbits(struct inflate_t* s, int n) {
+    refill(s);
+    if (s->nbits < n) {
+        s->error = 1;
+        return 0;
+    }
+    uint32_t v = ( uint32_t )(s->bits & ((( uint64_t )1 << n) - 1));
+    s->bits >>= n;
+    s->nbits -= n;
+    return v;
+}
+
+/**
+ * 丢弃位缓冲中不足一字节的位，把其余整字节退回输入，之后可以按字节读取
+ */
+static void align_input(struct inflate_t* s) {
+    s->pos -= s->nbits / 8;
+    s->bits  = 0;
+    s->nbits = 0;
+}
+
+/**
+ * 由各符号的码长构造规范哈夫曼码
+ *
+ * @return 成功返回0，码长超额（不可能的码）返回-1
+ */
+static int build(struct huffman_t* h, const uint8_t* lengths, int n) {
+    uint16_t offs[MAXBITS + 2];
+    memset(h->count, 0, sizeof(h->count));
+    for (int i = 0; i < n; ++i)
+        h->count[lengths[i]]++;
+
+    int left = 1;
+    for (int len = 1; len <= MAXBITS; ++len) {
+        left <<= 1;
+        left -= h->count[len];
+        if (left < 0)
+            return -1;
+    }
+
+    offs[1] = 0;
+    for (int len = 1; len <= MAXBITS; ++len)
+        offs[len + 1] = offs[len] + h->count[len];
+    for (int i = 0; i < n; ++i)
+        if (lengths[i] != 0)
+            h->symbol[offs[lengths[i]]++] = ( uint16_t )i;
+
+    // 按规范顺序给符号编码，填充查表解码的所有下标
+    memset(h->fast, 0, sizeof(h->fast));
+    uint32_t code  = 0;
+    int      index = 0;
+    for (int len = 1; len <= FASTBITS; ++len) {
+        for (int i = 0; i < h->count[len]; ++i, ++code, ++index) {
+            uint32_t rev = 0;
+            for (int b = 0; b < len; ++b)
+                rev |= ((code >> b) & 1) << (len - 1 - b);
+            for (uint32_t j = rev; j < (1U << FASTBITS); j += 1U << len)
+                h->fast[j] = ( uint16_t )(h->symbol[index] << 4 | len);
+        }
+        code <<= 1;
+    }
+    return 0;
+}
+
+/**
+ * 逐位解码一个长于FASTBITS的码
+ */
+static int decode_slow(struct inflate_t* s, const struct huffman_t* h) {
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len <= MAXBITS; ++len) {
+        code |= ( int )getbits(s, 1);
+        int count = h->count[len];
+        if (code - count < first)
+            return h->symbol[index + (code - first)];
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+    s->error = 1;
+    return -1;
+}
+
+/**
+ * 解码一个符号
+ *
+ * @return 符号，输入损坏返回-1
+ */
+static inline int decode(struct inflate_t* s, const struct huffman_t* h) {
+    refill(s);
+    uint16_t e = h->fast[s->bits & ((1U << FASTBITS) - 1)];
+    if (e != 0 && (e & 15) <= s->nbits) {
+        s->bits >>= e & 15;
+        s->nbits -= e & 15;
+        return e >> 4;
+    }
+    return decode_slow(s, h);
+}
+
+/**
+ * 把尚未交出的输出交给sink，缓冲区中只留下回溯用的最近WINDOW字节；all为1时成员已结束，不再保留
+ */
+static void flush_output(struct inflate_t* s, int all) {
+    if (s->out_len > s->flushed) {
+        s->crc = crc32_update(s->crc, s->out + s->flushed, s->out_len - s->flushed);
+        s->sink(s->out + s->flushed, s->out_len - s->flushed, s->arg);
+    }
+    size_t keep = all ? 0 : s->out_len < WINDOW ? s->out_len : WINDOW;
+    memmove(s->out, s->out + s->out_len - keep, keep);
+    s->out_len = keep;
+    s->flushed = keep;
+}
+
+/**
+ * 解压一个存储块
+ */
+static int stored(struct inflate_t* s) {
+    align_input(s);
+    if (s->in_len - s->pos < 4)
+        return -1;
+    const unsigned char* p   = s->in + s->pos;
+    size_t               len = p[0] | p[1] << 8;
+    if (( size_t )(p[2] | p[3] << 8) != (~len & 0xffff))
+        return -1;
+    s->pos += 4;
+    if (s->in_len - s->pos < len)
+        return -1;
+    while (len > 0) {
+        if (s->out_len == OUTBUF)
+            flush_output(s, 0);
+        size_t n = OUTBUF - s->out_len < len ? OUTBUF - s->out_len : len;
+        memcpy(s->out + s->out_len, s->in + s->pos, n);
+        s->out_len += n;
+        s->pos += n;
+        s->size += ( uint32_t )n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * 用lencode和distcode解压一个块的数据，直到块结束符
+ */
+static int codes(struct inflate_t* s) {
+    for (;;) {
+        if (s->out_len + MAXMATCH > OUTBUF)
+            flush_output(s, 0);
+        int sym = decode(s, &s->lencode);
+        if (sym < 0 || s->error)
+            return -1;
+        if (sym < 256) {
+            s->out[s->out_len++] = ( char )sym;
+            s->size++;
+            continue;
+        }
+        if (sym == 256)
+            return 0;
+
+        sym -= 257;
+        if (sym >= 29)
+            return -1;
+        size_t len = length_base[sym] + getbits(s, length_extra[sym]);
+        int    d   = decode(s, &s->distcode);
+        if (d < 0 || d >= 30)
+            return -1;
+        size_t dist = dist_base[d] + getbits(s, dist_extra[d]);
+        if (s->error || dist > s->out_len)
+            return -1;
+        // 匹配可能与输出重叠（距离小于长度），逐字节复制
+        char*       op    = s->out + s->out_len;
+        const char* match = op - dist;
+        if (dist >= len) {
+            memcpy(op, match, len);
+        } else {
+            for (size_t i = 0; i < len; ++i)
+                op[i] = match[i];
+        }
+        s->out_len += len;
+        s->size += ( uint32_t )len;
+    }
+}
+
+/**
+ * 解压一个使用固定哈夫曼码的块
+ */
+static int fixed(struct inflate_t* s) {
+    uint8_t lengths[MAXLCODES];
+    int     i = 0;
+    for (; i < 144; ++i)
+        lengths[i] = 8;
+    for (; i < 256; ++i)
+        lengths[i] = 9;
+    for (; i < 280; ++i)
+        lengths[i] = 7;
+    for (; i < MAXLCODES; ++i)
+        lengths[i] = 8;
+    build(&s->lencode, lengths, MAXLCODES);
+    for (i = 0; i < MAXDCODES; ++i)
+        lengths[i] = 5;
+    build(&s->distcode, lengths, MAXDCODES);
+    return codes(s);
+}
+
+/**
+ * 解压一个使用动态哈夫曼码的块：先读出码长码，再用它读出字面量/长度码和距离码的码长
+ */
+static int dynamic(struct inflate_t* s) {
+    static const uint8_t order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+    uint8_t              lengths[MAXCODES];
+
+    int nlen  = ( int )getbits(s, 5) + 257;
+    int ndist = ( int )getbits(s, 5) + 1;
+    int ncode = ( int )getbits(s, 4) + 4;
+    if (s->error || nlen > 286 || ndist > 30)
+        return -1;
+
+    memset(lengths, 0, 19);
+    for (int i = 0; i < ncode; ++i)
+        lengths[order[i]] = ( uint8_t )getbits(s, 3);
+    if (s->error || build(&s->lencode, lengths, 19) < 0)
+        return -1;
+
+    for (int i = 0; i < nlen + ndist;) {
+        int sym = decode(s, &s->lencode);
+        if (sym < 0 || s->error)
+            return -1;
+        if (sym < 16) {
+            lengths[i++] = ( uint8_t )sym;
+            continue;
+        }
+        uint8_t len = 0;
+        int     rep;
+        if (sym == 16) {
+            if (i == 0)
+                return -1;
+            len = lengths[i - 1];
+            rep = 3 + ( int )getbits(s, 2);
+        } else if (sym == 17) {
+            rep = 3 + ( int )getbits(s, 3);
+        } else {
+            rep = 11 + ( int )getbits(s, 7);
+        }
+        if (s->error || i + rep > nlen + ndist)
+            return -1;
+        while (rep--)
+            lengths[i++] = len;
+    }
+    // 没有块结束符的码无法结束
+    if (lengths[256] == 0)
+        return -1;
+    if (build(&s->lencode, lengths, nlen) < 0 || build(&s->distcode, lengths + nlen, ndist) < 0)
+        return -1;
+    return codes(s);
+}
+
+/**
+ * 解压一个gzip成员：头部、DEFLATE数据和校验尾部
+ *
+ * @return 成功返回0，输入损坏或截断返回-1
+ */
+static int member(struct inflate_t* s) {
+    const unsigned char* p = s->in + s->pos;
+    size_t               n = s->in_len - s->pos;
+    if (n < 18 || p[0] != 0x1f || p[1] != 0x8b || p[2] != 8)
+        return -1;
+    int    flags = p[3];
+    size_t h     = 10;
+    if (flags & 4) {
+        h += 2 + (p[10] | p[11] << 8);
+    }
+    if (flags & 8) {
+        while (h < n && p[h] != 0)
+            ++h;
+        ++h;
+    }
+    if (flags & 16) {
+        while (h < n && p[h] != 0)
+            ++h;
+        ++h;
+    }
+    if (flags & 2)
+        h += 2;
+    if (h >= n)
+        return -1;
+    s->pos += h;
+    s->bits    = 0;
+    s->nbits   = 0;
+    s->crc     = 0;
+    s->size    = 0;
+    s->out_len = 0;
+    s->flushed = 0;
+
+    int last;
+    do {
+        last     = ( int )getbits(s, 1);
+        int type = ( int )getbits(s, 2);
+        int rc   = -1;
+        if (s->error)
+            return -1;
+        if (type == 0)
+            rc = stored(s);
+        else if (type == 1)
+            rc = fixed(s);
+        else if (type == 2)
+            rc = dynamic(s);
+        if (rc < 0 || s->error)
+            return -1;
+    } while (!last);
+    flush_output(s, 1);
+
+    align_input(s);
+    if (s->in_len - s->pos < 8)
+        return -1;
+    p              = s->in + s->pos;
+    uint32_t crc   = p[0] | p[1] << 8 | p[2] << 16 | ( uint32_t )p[3] << 24;
+    uint32_t isize = p[4] | p[5] << 8 | p[6] << 16 | ( uint32_t )p[7] << 24;
+    s->pos += 8;
+    return crc == s->crc && isize == s->size ? 0 : -1;
+}
+
+/**
+ * 解压src[0, src_len)中连续的gzip成员，解压出的数据按顺序分段交给sink
+ * 最后一个成员之后不是gzip头的内容（如对齐用的填充）被忽略
+ *
+ * @return 成功返回解压用掉的输入字节数，输入损坏或截断返回-1
+ */
+long gzip_inflate(const char* src, size_t src_len, inflate_sink_t sink, void* arg) {
+    pthread_once(&crc_once, make_crc_table);
+    struct inflate_t* s = ( struct inflate_t* )malloc(sizeof(struct inflate_t));
+    s->in               = ( const unsigned char* )src;
+    s->in_len           = src_len;
+    s->pos              = 0;
+    s->error            = 0;
+    s->out              = ( char* )malloc(OUTBUF);
+    s->sink             = sink;
+    s->arg              = arg;
+
+    long used = 0;
+    do {
+        if (member(s) < 0) {
+            used = -1;
+            break;
+        }
+        used = ( long )s->pos;
+    } while (s->in_len - s->pos >= 2 && s->in[s->pos] == 0x1f && s->in[s->pos + 1] == 0x8b);
+    free(s->out);
+    free(s);
+    return used;
+}
+
+/**
+ * 识别BGZF块：额外字段中带"BC"子字段的gzip成员，子字段给出整个块的长度，
+ * 因此不必解压就能找到下一块，各块可以独立并行解压
+ *
+ * @return src开头是BGZF块时返回块的总长度，否则返回0
+ */
+size_t bgzf_block_size(const char* src, size_t src_len) {
+    const unsigned char* p = ( const unsigned char* )src;
+    if (src_len < 18 || p[0] != 0x1f || p[1] != 0x8b || p[2] != 8 || (p[3] & 4) == 0)
+        return 0;
+    size_t xlen = p[10] | p[11] << 8;
+    if (12 + xlen > src_len)
+        return 0;
+    for (size_t i = 12; i + 4 <= 12 + xlen;) {
+        size_t slen = p[i + 2] | p[i + 3] << 8;
+        if (p[i] == 'B' && p[i + 1] == 'C' && slen == 2 && i + 6 <= 12 + xlen)
+            return (p[i + 4] | p[i + 5] << 8) + 1;
+        i += 4 + slen;
+    }
+    return 0;
+}
@@ -0,0 +1,227 @@
+/**
+ * 映射输出文件的写出与读取
+ * 写出时记录由调用者按格式编码后依次写入，最后回填分区索引；
+ * 读取时整个文件用mmap映射，键和值直接指向映射中的字节，不再拷贝和解析成节点
+ */
+#include "mapfile.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * 一条记录中键及值个数部分的字节数
+ */
+size_t mapfile_key_size(size_t key_len) {
+    return sizeof(uint32_t) + key_len + 1 + 2 * sizeof(uint32_t);
+}
+
+/**
+ * 在dst处编码一条记录的键和值个数，之后应紧跟num_values个值和num_ints个整数值
+ *
+ * @return 编码内容之后的位置
+ */
+char* mapfile_put_key(char* dst, const char* key, size_t key_len, uint32_t num_values, uint32_t num_ints) {
+    uint32_t len = key_len;
+    memcpy(dst, &len, sizeof(len));
+    dst += sizeof(len);
+    memcpy(dst, key, key_len);
+    dst += key_len;
+    *dst++ = '\0';
+    memcpy(dst, &num_values, sizeof(num_values));
+    dst += sizeof(num_values);
+    memcpy(dst, &num_ints, sizeof(num_ints));
+    return dst + sizeof(num_ints);
+}
+
+/**
+ * 一个字符串值编码后的字节数
+ */
+size_t mapfile_value_size(size_t value_len) {
+    return sizeof(uint32_t) + value_len + 1;
+}
+
+/**
+ * 在dst处编码一个字符串值
+ *
+ * @return 编码内容之后的位置
+ */
+char* mapfile_put_value(char* dst, const char* value, size_t value_len) {
+    uint32_t len = value_len;
+    memcpy(dst, &len, sizeof(len));
+    dst += sizeof(len);
+    memcpy(dst, value, value_len);
+    dst[value_len] = '\0';
+    return dst + value_len + 1;
+}
+
+/**
+ * 写出文件头并为分区索引留出位置，之后依次写入各分区的记录
+ *
+ * @return 成功返回0，写入出错返回-1
+ */
+int mapfile_begin(FILE* out, int num_partitions) {
+    struct mapfile_header_t header;
+    struct mapfile_index_t  empty = {0, 0, 0};
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAPFILE_MAGIC, sizeof(header.magic));
+    header.num_partitions = num_partitions;
+    fwrite(&header, sizeof(header), 1, out);
+    for (int i = 0; i < num_partitions; ++i)
+        fwrite(&empty, sizeof(empty), 1, out);
+    return ferror(out) ? -1 : 0;
+}
+
+/**
+ * 全部记录写完后回填分区索引
+ *
+ * @return 成功返回0，写入出错返回-1
+ */
+int mapfile_finish(FILE* out, const struct mapfile_index_t* index, int num_partitions) {
+    if (fseek(out, sizeof(struct mapfile_header_t), SEEK_SET) != 0)
+        return -1;
+    fwrite(index, sizeof(struct mapfile_index_t), num_partitions, out);
+    return fflush(out) != 0 || ferror(out) ? -1 : 0;
+}
+
+/**
+ * 映射文件并检查文件头和分区索引
+ *
+ * @return 成功返回0；无法打开、映射或格式不符时返回-1
+ */
+int mapfile_open(struct mapfile_t* file, const char* path) {
+    memset(file, 0, sizeof(*file));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || ( size_t )st.st_size < sizeof(struct mapfile_header_t)) {
+        close(fd);
+        return -1;
+    }
+    void* base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return -1;
+    file->base = ( char* )base;
+    file->size = st.st_size;
+
+    const struct mapfile_header_t* header = ( const struct mapfile_header_t* )file->base;
+    size_t                         n      = header->num_partitions;
+    if (memcmp(header->magic, MAPFILE_MAGIC, sizeof(header->magic)) != 0 || n == 0
+        || n > (file->size - sizeof(*header)) / sizeof(struct mapfile_index_t)) {
+        mapfile_close(file);
+        return -1;
+    }
+    file->num_partitions = n;
+    file->index          = ( struct mapfile_index_t* )(file->base + sizeof(*header));
+    for (size_t i = 0; i < n; ++i) {
+        if (file->index[i].offset > file->size || file->index[i].length > file->size - file->index[i].offset) {
+            mapfile_close(file);
+            return -1;
+        }
+    }
+    // 归约按记录顺序读取
+    madvise(file->base, file->size, MADV_SEQUENTIAL);
+    return 0;
+}
+
+void mapfile_close(struct mapfile_t* file) {
+    if (file->base != NULL)
+        munmap(file->base, file->size);
+    memset(file, 0, sizeof(*file));
+}
+
+/**
+ * 定位到分区的开头，之后调用mapfile_next_key读取第一个键
+ */
+void mapfile_cursor_open(struct mapfile_cursor_t* cursor, struct mapfile_t* file, int partition_id) {
+    cursor->pos       = file->base + file->index[partition_id].offset;
+    cursor->end       = cursor->pos + file->index[partition_id].length;
+    cursor->key       = NULL;
+    cursor->remaining = 0;
+    cursor->ints_left = 0;
+}
+
+/**
+ * 读取一个uint32_t并前移游标
+ *
+ * @return 成功返回0，越过分区结尾返回-1
+ */
+static int read_u32(struct mapfile_cursor_t* cursor, uint32_t* value) {
+    if (cursor->end - cursor->pos < ( long )sizeof(*value))
+        return -1;
+    memcpy(value, cursor->pos, sizeof(*value));
+    cursor->pos += sizeof(*value);
+    return 0;
+}
+
+/**
+ * 读取一个长度前缀、以'\0'结尾的字符串，返回映射中的指针
+ *
+ * @return 字符串，越过分区结尾时返回NULL
+ */
+static char* read_string(struct mapfile_cursor_t* cursor) {
+    uint32_t len;
+    if (read_u32(cursor, &len) < 0 || ( size_t )(cursor->end - cursor->pos) < ( size_t )len + 1)
+        return NULL;
+    char* str = cursor->pos;
+    cursor->pos += len + 1;
+    return str;
+}
+
+/**
+ * 跳过当前键剩余的值并读取下一个键
+ *
+ * @return 读到返回1，分区读完或记录损坏返回0
+ */
+int mapfile_next_key(struct mapfile_cursor_t* cursor) {
+    int64_t skipped;
+    while (mapfile_next_int(cursor, &skipped))
+        ;
+    if (cursor->pos >= cursor->end || (cursor->key = read_string(cursor)) == NULL
+        || read_u32(cursor, &cursor->remaining) < 0 || read_u32(cursor, &cursor->ints_left) < 0) {
+        cursor->key       = NULL;
+        cursor->remaining = 0;
+        cursor->ints_left = 0;
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * 读取当前键的下一个字符串值
+ *
+ * @return 值，指向映射中的字节，在作业结束前有效；值已读完时返回NULL
+ */
+char* mapfile_next_value(struct mapfile_cursor_t* cursor) {
+    if (cursor->remaining == 0)
+        return NULL;
+    cursor->remaining--;
+    char* value = read_string(cursor);
+    if (value == NULL) {
+        cursor->remaining = 0;
+        cursor->ints_left = 0;
+    }
+    return value;
+}
+
+/**
+ * 读取当前键的下一个整数值，尚未读出的字符串值会被跳过
+ *
+ * @return 读到返回1，整数值已读完返回0
+ */
+int mapfile_next_int(struct mapfile_cursor_t* cursor, int64_t* value) {
+    while (cursor->remaining > 0)
+        mapfile_next_value(cursor);
+    if (cursor->ints_left == 0 || cursor->end - cursor->pos < ( long )sizeof(*value)) {
+        cursor->ints_left = 0;
+        return 0;
+    }
+    cursor->ints_left--;
+    memcpy(value, cursor->pos, sizeof(*value));
+    cursor->pos += sizeof(*value);
+    return 1;
+}
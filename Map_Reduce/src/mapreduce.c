@@ -5,278 +5,3739 @@
  */
 #include "mapreduce.h"
 
+#include "affinity.h"
+#include "inflate.h"
+#include "mapfile.h"
+#include "sketch.h"
+#include "spill.h"
+#include "threadpool.h"
+#include "topk.h"
 #include "utils.h"
 
+#include <errno.h>
+#include <fcntl.h>    // open
+#include <poll.h>     // poll
 #include <pthread.h>  // 线程库
-#include <sched.h>    // 线程调度
 #include <signal.h>   // 信号处理
 #include <stdio.h>    // 标准输入输出
 #include <stdlib.h>   // 标准库函数
 #include <string.h>   // 字符串操作
+#include <sys/mman.h>  // mmap
+#include <sys/stat.h>  // fstat
 #include <sys/types.h>
+#include <sys/wait.h>  // waitpid
+#include <unistd.h>  // pread
 
-// 全局变量声明
-pthread_mutex_t*    partition_locks;  // 分区锁数组，用于保护每个分区的数据访问
-struct partition_t* partitions;       // 分区数组，存储中间结果
-int                 num_partitions;   // 分区数量
-Mapper              mapper;           // 映射函数指针
-Reducer             reducer;          // 归约函数指针
-pthread_t*          pthreads;         // 线程数组，-1表示线程可用
+/**
+ * 有溢写段的分区由一个线程顺序归并，MR_Output的内容直接按序追加到分区的输出缓冲区
+ */
+struct output_buffer_t {
+    char*  data;
+    size_t len;
+    size_t cap;
+};
+
+/**
+ * 作业上下文：持有线程池、分区及其分配器，作业结束后保留下来供下一次作业复用
+ * 同一进程同一时刻只运行一个作业，运行中的作业由current指向
+ */
+struct MR_Job {
+    struct threadpool_t*    pool;               // 工作线程池，线程数不足时重建
+    int                     pool_pinned;        // 为1时线程池的线程已绑定到CPU
+    struct partition_t*     partitions;         // 分区数组，存储中间结果
+    int                     num_partitions;     // 分区数量，为归约线程数的partitions_per_reducer倍
+    int                     num_reducers;       // 归约线程数
+    int                     partitions_cap;     // 已分配的分区数，分区数不变时直接重置复用
+    Mapper                  mapper;             // 映射函数指针
+    ChunkMapper             chunk_mapper;       // 按字节范围映射的函数指针
+    Reducer                 reducer;            // 归约函数指针
+    Combiner                combiner;           // 合并函数指针，为NULL时不做映射端合并
+    Partitioner             partitioner;        // 分区函数指针，为NULL时使用默认哈希分区
+    ValueComparator         value_compare;      // 值比较函数，非NULL时每个键的值排序后交给归约函数
+    Mapper                  right_mapper;       // 连接作业右侧输入的映射函数，左侧使用mapper
+    JoinReducer             join_reducer;       // 连接作业的归约函数
+    struct topk_t*          topk_heaps;         // 每个归约线程的前K堆，未开启时为NULL
+    struct sketch_t*        sketches;           // 近似计数作业每个映射线程的草图，其他作业为NULL
+    struct mapfile_t*       saved;              // 非NULL时归约阶段读取持久化的映射输出，不读分区
+    int                     cancelled;          // 为1时作业已被MR_Cancel取消，剩余的映射和归约跳过
+    struct run_list_t*      partition_runs;     // 每个分区溢写到磁盘的段文件
+    size_t                  spill_threshold;    // 单个分区的内存上限，超过后溢写
+    struct arena_t*         output_arenas;      // 每个归约任务存放MR_Output内容的分配器
+    struct output_buffer_t* partition_outputs;  // 每个分区归并时的输出
+    struct cpu_topology_t   topology;           // 开启绑定时使用的CPU拓扑
+    unsigned long           shuffle_ns;         // 提交缓冲区和排序分区的累计时间，原子累加
+    unsigned long           lock_wait_ns;       // 等待分区锁的累计时间，原子累加
+    char**                  splits;             // MR_SampledPartition的分界键，分区i的键不大于splits[i]
+    int                     num_splits;         // 分界键个数，为0时退回哈希分区
+    int*                    reduce_order;       // 归约阶段按中间结果大小降序排列的分区编号
+    int                     next_reduce;        // reduce_order中下一个待领取的下标，原子递增
+    long                    chunk_size;         // 分块作业的名义块大小，压缩输入按它切分解压出的数据
+    int                     auto_mappers;       // 为1时映射线程数由框架决定，映射阶段按锁等待调整并发上限
+    int                     max_mappers;        // 映射阶段的并发上限不超过该值
+    unsigned long           adapt_at;           // 上次调整并发上限的时刻，原子比较交换决定由谁调整
+    unsigned long           adapt_busy;         // 上次调整时各线程忙碌时间之和
+    unsigned long           adapt_wait;         // 上次调整时的锁等待时间
+};
+
+static struct MR_Job* current;      // 正在运行的作业
+static struct topk_t   topk_result;    // 最近一次作业合并后的前K个键
+static struct sketch_t sketch_result;  // 最近一次近似计数作业合并后的草图
+
+// 作业设置，在下一次作业开始时生效
+size_t      memory_budget;   // 中间结果内存上限，0表示不限制
+int         pipelined;       // 为1时空闲的映射线程提前合并分区中的值
+const char* output_prefix;   // MR_Output的输出文件名前缀，为NULL时输出到标准输出
+int         affinity;        // 为1时把工作线程绑定到CPU，归约线程迁到分区所属的NUMA节点
+int         compress_runs;   // 为1时溢写段按块LZ4压缩
+const char* checkpoint_dir;  // 映射任务检查点目录，为NULL时不做检查点
+const char* map_output_file; // 映射输出的持久化文件，为NULL时不保存
+int         partitions_per_reducer = 1;  // 每个归约线程对应的逻辑分区数
+int         topk_k;          // 前K聚合保留的键数，0表示不开启
+MR_Stats    stats;           // 最近一次作业的统计信息
+
+#define EMIT_BATCH_SIZE  1024  // 每个分区缓冲区积累的键值对数达到该值时批量提交
+#define RECENT_SIZE      256   // 缓冲区最近字符串缓存的槽位数，必须为2的幂
+#define PRECOMBINE_BATCH 256   // 提前合并时每持锁处理的键数
+#define INT_VALUE        (( size_t )-1)  // value_offset取该值时键值对的值是整数
+#define SAMPLE_TASKS     16    // 采样预处理最多映射的任务数，从全部任务中等距选取
+#define SAMPLE_KEYS      4096  // 每个采样任务的蓄水池保留的键数
+#define JOIN_LEFT        '\x01'  // 连接作业中左侧输入的值的标记字节
+#define JOIN_RIGHT       '\x02'  // 连接作业中右侧输入的值的标记字节
+#define VALUE_PREFETCH   8       // 归约时提前预取的值个数
+#define ADAPT_INTERVAL_NS 20000000UL  // 自动模式下两次调整映射线程数的最小间隔
+#define ADAPT_WAIT_HIGH   0.20  // 区间内锁等待超过忙碌时间的该比例时减少一个映射线程
+#define ADAPT_WAIT_LOW    0.05  // 低于该比例时增加一个，直到max_mappers
+#define STREAM_IDLE_MS    10    // 流式输入没有新数据到达超过该时间时，先提交已读到的完整行
+
+// MR_Chunk.compression的取值
+#define INPUT_PLAIN 0  // 未压缩
+#define INPUT_GZIP  1  // 整个gzip文件，只能顺序解压
+#define INPUT_BGZF  2  // BGZF文件开头的一段完整块，各段可以并行解压
+#define INPUT_ZSTD  3  // 整个zstd文件，由zstd程序顺序解压
+#define INPUT_BGZF_NEXT 4  // BGZF文件中其后的一段，以前一段的最后一块开始
 
 /**
- * 映射器参数结构体
- * 用于向映射线程传递参数
+ * 映射线程本地的键值对缓冲
+ * 键值字符串连续存放在bytes中，pairs记录其偏移，避免每次发射都分配内存
  */
-struct mapper_arg_t {
-    int   id;   // 线程ID
-    char* arg;  // 输入参数（文件名）
+struct emit_pair_t {
+    unsigned long hash;          // 键的哈希值
+    size_t        key_offset;    // 键在bytes中的偏移
+    size_t        key_len;       // 键长度
+    size_t        value_offset;  // 值在bytes中的偏移，整数值为INT_VALUE
+    int64_t       int_value;     // 整数值
+};
+
+struct emit_buffer_t {
+    struct emit_pair_t* pairs;                // 待提交的键值对
+    int                 count;                // 键值对数量
+    int                 pairs_cap;            // pairs数组容量
+    char*               bytes;                // 键值字符串存储区
+    size_t              bytes_used;           // 已使用的字节数
+    size_t              bytes_cap;            // 存储区容量
+    size_t              recent[RECENT_SIZE];  // 按哈希直接映射的最近字符串偏移+1，0表示空
 };
 
+// 每个映射线程持有num_partitions个缓冲区及发射计数，首次发射时分配
+static __thread struct emit_buffer_t* emit_buffers = NULL;
+static __thread unsigned long*        emit_counts  = NULL;
+
+// 批量提交时按分段排序后的缓冲区下标
+static __thread int* flush_order     = NULL;
+static __thread int  flush_order_cap = 0;
+
+// 合并阶段的线程本地状态：当前分组在排序后顺序中的范围，以及合并输出
+static __thread struct emit_buffer_t* combine_input  = NULL;
+static __thread int*                  combine_order  = NULL;
+static __thread int                   combine_pos    = 0;
+static __thread int                   combine_ipos   = 0;
+static __thread int                   combine_end    = 0;
+static __thread struct emit_buffer_t  combine_output = {0};
+
+// 提前合并时的线程本地状态：当前键节点及尚未交给合并函数的值
+static __thread struct info_node_t* precombine_node   = NULL;
+static __thread struct data_node_t* precombine_cursor = NULL;
+static __thread unsigned long       precombine_ipos   = 0;
+
+// 调用用户分区函数时存放以'\0'结尾的键副本
+static __thread char*  key_scratch     = NULL;
+static __thread size_t key_scratch_cap = 0;
+
+// 连接作业的映射任务所属的一侧，非0时发射的字符串值前加上该标记字节
+static __thread char   join_side       = 0;
+static __thread char*  tag_scratch     = NULL;
+static __thread size_t tag_scratch_cap = 0;
+
+// 连接作业归约时左侧取值函数读到的第一个右侧值，留给右侧取值函数返回
+static __thread char* join_peek = NULL;
+
 /**
- * 归约器参数结构体
- * 用于向归约线程传递参数
+ * 一个采样任务的蓄水池：以相同概率保留任务发射过的SAMPLE_KEYS个键
  */
-struct reducer_arg_t {
-    int   id;            // 线程ID
-    char* key;           // 要处理的键
-    int   partition_id;  // 分区ID
+struct reservoir_t {
+    void*         input;  // 映射任务的参数（文件名或输入块）
+    char**        keys;   // 保留的键
+    int           count;  // keys中的键数
+    unsigned long seen;   // 任务发射的键总数
+    unsigned long rng;    // xorshift随机数状态
 };
 
+// 非NULL时当前线程在执行采样任务，发射的键只进入蓄水池
+static __thread struct reservoir_t* reservoir = NULL;
+
+// 非NULL时当前线程在执行近似计数作业的映射任务，发射的键只累加到草图
+static __thread struct sketch_t* sketch = NULL;
+
+// 检查点模式下映射任务先写入自己的分区，任务结束后整体写成检查点文件；为NULL时写入作业的分区
+static __thread struct partition_t* task_partitions = NULL;
+static __thread struct run_list_t*  task_runs       = NULL;
+
+// 当前线程正在归约的键，MR_GetNext据此跳过哈希查找
+static __thread struct info_node_t* reducing_info = NULL;
+
+// 非NULL时当前键的字符串值是分区展开数组中[packed_next, packed_end)的部分
+static __thread char** packed_next = NULL;
+static __thread char** packed_end  = NULL;
+
+// 当前归约线程的前K堆，未开启前K聚合时为NULL
+static __thread struct topk_t* topk_heap = NULL;
+
+// 当前归约任务的输出分配器，以及正在归并的分区的输出缓冲区
+static __thread struct arena_t*         reduce_arena = NULL;
+static __thread struct output_buffer_t* merge_output = NULL;
+
+// 归约有溢写段的分区时的多路归并状态：各段的读取游标及当前键
+static __thread struct run_reader_t* merge_readers = NULL;
+static __thread int                  merge_count   = 0;
+static __thread int                  merge_pos     = 0;
+static __thread int                  merge_ipos    = 0;
+static __thread char*                merge_key     = NULL;
+static __thread size_t               merge_key_cap = 0;
+static __thread char*                batch_buf     = NULL;  // MR_GetBatch拷贝段文件中值的缓冲区
+static __thread size_t               batch_cap     = 0;
+
+// 设置了值比较函数时排序用的值数组；归并有溢写段的分区时由MR_GetNext依次返回
+static __thread char** sorted_values  = NULL;
+static __thread size_t sorted_cap     = 0;
+static __thread size_t sorted_count   = 0;
+static __thread size_t sorted_pos     = 0;
+static __thread int    serve_sorted   = 0;     // 为1时当前键的字符串值从sorted_values返回
+static __thread char*  sorted_buf     = NULL;  // 拷贝段文件中值的缓冲区
+static __thread size_t sorted_buf_cap = 0;
+
+// 非NULL时当前归约的键来自持久化的映射输出文件
+static __thread struct mapfile_cursor_t* saved_cursor = NULL;
+
+// 保存映射输出时编码一个键的字符串值的缓冲区
+static __thread char*  save_buf     = NULL;
+static __thread size_t save_buf_cap = 0;
+
 /**
  * 获取指定键的下一个值
+ * 没有溢写段的分区从展开后的连续值数组中顺序返回，并预取后面的值；
+ * 分区有溢写段时先依次读出各段中当前键的值，再返回内存中的值；
+ * 此时读自段文件的值只在下一次调用前有效，且只能获取当前归约的键
  * 
  * @param key 要获取值的键
  * @param partition_number 分区编号
  * @return 返回与键对应的下一个值，如果没有更多值则返回NULL
  */
 char* MR_GetNext(char* key, int partition_number) {
-    // 获取分区头节点
-    struct info_node_t* info_ptr = partitions[partition_number].info_head;
-    // 遍历查找匹配的键
-    for (; info_ptr != NULL; info_ptr = info_ptr->next) {
-        if (strcmp(info_ptr->info, key) == 0) {
-            // 如果该键已被处理完成，返回NULL
-            if (info_ptr->proceed == 1)
-                return NULL;
-            // 遍历数据节点查找未处理的值
-            struct data_node_t* data_ptr = info_ptr->data;
-            for (; data_ptr != NULL; data_ptr = data_ptr->next) {
-                if (data_ptr->proceed == 0) {
-                    // 标记为已处理并返回该值
-                    data_ptr->proceed = 1;
-                    return data_ptr->value;
-                }
-            }
-            // 所有值都已处理，标记键为已处理
-            info_ptr->proceed = 1;
+    struct info_node_t* info_ptr = reducing_info;
+    if (saved_cursor != NULL) {
+        if (key != saved_cursor->key && strcmp(key, saved_cursor->key) != 0)
+            return NULL;
+        return mapfile_next_value(saved_cursor);
+    }
+    if (packed_next != NULL && (key == info_ptr->info || strcmp(key, info_ptr->info) == 0)) {
+        if (packed_next == packed_end)
+            return NULL;
+        // 值字符串分散在分配器中，顺序扫描时提前取入后面几个
+        if (packed_end - packed_next > VALUE_PREFETCH)
+            __builtin_prefetch(packed_next[VALUE_PREFETCH]);
+        return *packed_next++;
+    }
+    if (serve_sorted) {
+        if (key != merge_key && strcmp(key, merge_key) != 0)
+            return NULL;
+        return sorted_pos < sorted_count ? sorted_values[sorted_pos++] : NULL;
+    }
+    if (merge_readers != NULL) {
+        if (key != merge_key && strcmp(key, merge_key) != 0)
             return NULL;
+        for (; merge_pos < merge_count; ++merge_pos) {
+            if (!merge_readers[merge_pos].active)
+                continue;
+            char* value = run_reader_next_value(&merge_readers[merge_pos]);
+            if (value != NULL)
+                return value;
         }
+    } else if (info_ptr == NULL || info_ptr->info != key) {
+        // 归约函数传回的通常就是框架传入的键指针，直接使用当前键节点
+        size_t len = strlen(key);
+        info_ptr   = find_info(&current->partitions[partition_number], key, len, hash_key_n(key, len));
     }
     // 未找到匹配的键
-    return NULL;
+    if (info_ptr == NULL)
+        return NULL;
+    // 所有值都已返回
+    if (info_ptr->cursor == NULL)
+        return NULL;
+    // 返回游标处的值并前移游标
+    char* value      = info_ptr->cursor->value;
+    info_ptr->cursor = info_ptr->cursor->next;
+    return value;
 }
 
 /**
- * 映射器线程适配函数
- * 将用户定义的映射函数包装为pthread可用的函数
- * 
- * @param arg 映射器参数结构体
- * @return NULL
- */
-void* MR_MapperAdapt(void* arg) {
-    struct mapper_arg_t* pass_arg = ( struct mapper_arg_t* )arg;
-    pthread_detach(pthread_self());  // 将线程分离，结束时自动回收资源
-    mapper(pass_arg->arg);          // 调用用户定义的映射函数
-    pthreads[pass_arg->id] = -1;    // 标记线程为可用状态
-    return NULL;
+ * 获取指定键的下一个整数值，对应MR_EmitInt64发射的值
+ * 同一键的字符串值与整数值分别迭代；分区有溢写段时整数值在字符串值之后读出，
+ * 读取整数值会跳过该键在段中尚未读出的字符串值
+ *
+ * @param key 要获取值的键
+ * @param partition_number 分区编号
+ * @param value 输出的整数值
+ * @return 读到返回1，没有更多整数值返回0
+ */
+int MR_GetNextInt64(char* key, int partition_number, int64_t* value) {
+    struct info_node_t* info_ptr = reducing_info;
+    if (saved_cursor != NULL) {
+        if (key != saved_cursor->key && strcmp(key, saved_cursor->key) != 0)
+            return 0;
+        return mapfile_next_int(saved_cursor, value);
+    }
+    if (merge_readers != NULL) {
+        if (key != merge_key && strcmp(key, merge_key) != 0)
+            return 0;
+        for (; merge_ipos < merge_count; ++merge_ipos) {
+            if (merge_readers[merge_ipos].active && run_reader_next_int(&merge_readers[merge_ipos], value))
+                return 1;
+        }
+    } else if (info_ptr == NULL || info_ptr->info != key) {
+        size_t len = strlen(key);
+        info_ptr   = find_info(&current->partitions[partition_number], key, len, hash_key_n(key, len));
+    }
+    if (info_ptr == NULL || info_ptr->int_cursor >= info_ptr->num_ints)
+        return 0;
+    *value = info_ptr->ints[info_ptr->int_cursor++];
+    return 1;
 }
 
 /**
- * 归约器线程适配函数
- * 将用户定义的归约函数包装为pthread可用的函数
- * 
- * @param arg 归约器参数结构体
- * @return NULL
- */
-void* MR_ReducerAdapt(void* arg) {
-    struct reducer_arg_t* pass_arg = ( struct reducer_arg_t* )arg;
-    pthread_detach(pthread_self());  // 将线程分离，结束时自动回收资源
-    reducer(pass_arg->key, MR_GetNext, pass_arg->partition_id);  // 调用用户定义的归约函数
-    pthreads[pass_arg->id] = -1;    // 标记线程为可用状态
-    return NULL;
+ * 批量获取指定键的值，一次最多返回max个，与MR_GetNext共用同一游标，可以混合调用
+ * 内存中的值直接返回节点中的指针；读自段文件的值拷贝到线程私有缓冲区，
+ * 只在下一次调用MR_GetBatch前有效
+ *
+ * @param key 要获取值的键
+ * @param partition_number 分区编号
+ * @param values 输出的值数组，至少能容纳max个指针
+ * @param max 本次最多返回的值个数
+ * @return 返回写入values的值个数，为0表示没有更多值
+ */
+int MR_GetBatch(char* key, int partition_number, char** values, int max) {
+    struct info_node_t* info_ptr = reducing_info;
+    int                 count    = 0;
+    if (max <= 0)
+        return 0;
+    if (saved_cursor != NULL) {
+        if (key != saved_cursor->key && strcmp(key, saved_cursor->key) != 0)
+            return 0;
+        while (count < max && (values[count] = mapfile_next_value(saved_cursor)) != NULL)
+            ++count;
+        return count;
+    }
+    if (packed_next != NULL && (key == info_ptr->info || strcmp(key, info_ptr->info) == 0)) {
+        count = packed_end - packed_next < max ? ( int )(packed_end - packed_next) : max;
+        memcpy(values, packed_next, sizeof(char*) * count);
+        packed_next += count;
+        return count;
+    }
+    if (serve_sorted) {
+        if (key != merge_key && strcmp(key, merge_key) != 0)
+            return 0;
+        while (count < max && sorted_pos < sorted_count)
+            values[count++] = sorted_values[sorted_pos++];
+        return count;
+    }
+    if (merge_readers != NULL) {
+        if (key != merge_key && strcmp(key, merge_key) != 0)
+            return 0;
+        // 先把各值在缓冲区中的偏移记在values中，缓冲区不再扩容后再换算成指针
+        size_t used = 0;
+        for (; merge_pos < merge_count && count < max; ++merge_pos) {
+            if (!merge_readers[merge_pos].active)
+                continue;
+            char* value;
+            while (count < max && (value = run_reader_next_value(&merge_readers[merge_pos])) != NULL) {
+                size_t len = strlen(value) + 1;
+                if (used + len > batch_cap) {
+                    batch_cap = used + len > 2 * batch_cap ? used + len : 2 * batch_cap;
+                    batch_buf = ( char* )realloc(batch_buf, batch_cap);
+                }
+                memcpy(batch_buf + used, value, len);
+                values[count++] = ( char* )( uintptr_t )used;
+                used += len;
+            }
+            if (count == max)
+                break;
+        }
+        for (int i = 0; i < count; ++i)
+            values[i] = batch_buf + ( uintptr_t )values[i];
+    } else if (info_ptr == NULL || info_ptr->info != key) {
+        size_t len = strlen(key);
+        info_ptr   = find_info(&current->partitions[partition_number], key, len, hash_key_n(key, len));
+    }
+    if (info_ptr == NULL)
+        return count;
+    for (; count < max && info_ptr->cursor != NULL; info_ptr->cursor = info_ptr->cursor->next)
+        values[count++] = info_ptr->cursor->value;
+    return count;
 }
 
 /**
- * 默认哈希分区函数
- * 用于确定键应该分配到哪个分区
- * 
- * @param key 需要计算哈希值的键
- * @param num_partitions 分区数量
- * @return 键的哈希值对应的分区索引
+ * 批量获取指定键的整数值，一次最多返回max个，与MR_GetNextInt64共用同一游标
+ * 内存中的整数值本来就连续存放，直接整段拷贝
+ *
+ * @param key 要获取值的键
+ * @param partition_number 分区编号
+ * @param values 输出的整数数组，至少能容纳max个值
+ * @param max 本次最多返回的值个数
+ * @return 返回写入values的值个数，为0表示没有更多整数值
  */
-unsigned long MR_DefaultHashPartition(char* key, int num_partitions) {
-    unsigned long hash = 5381;  // 初始哈希值
-    int           c;
-    // DJB哈希算法
-    while ((c = *key++) != '\0')
-        hash = hash * 33 + c;
-    return hash % num_partitions;  // 取模确定分区
+int MR_GetBatchInt64(char* key, int partition_number, int64_t* values, int max) {
+    struct info_node_t* info_ptr = reducing_info;
+    int                 count    = 0;
+    if (max <= 0)
+        return 0;
+    if (saved_cursor != NULL) {
+        if (key != saved_cursor->key && strcmp(key, saved_cursor->key) != 0)
+            return 0;
+        while (count < max && mapfile_next_int(saved_cursor, &values[count]))
+            ++count;
+        return count;
+    }
+    if (merge_readers != NULL) {
+        if (key != merge_key && strcmp(key, merge_key) != 0)
+            return 0;
+        while (merge_ipos < merge_count && count < max) {
+            if (merge_readers[merge_ipos].active && run_reader_next_int(&merge_readers[merge_ipos], &values[count]))
+                ++count;
+            else
+                ++merge_ipos;
+        }
+    } else if (info_ptr == NULL || info_ptr->info != key) {
+        size_t len = strlen(key);
+        info_ptr   = find_info(&current->partitions[partition_number], key, len, hash_key_n(key, len));
+    }
+    if (info_ptr == NULL || info_ptr->int_cursor >= info_ptr->num_ints)
+        return count;
+    unsigned long n = info_ptr->num_ints - info_ptr->int_cursor;
+    if (n > ( unsigned long )(max - count))
+        n = max - count;
+    memcpy(values + count, info_ptr->ints + info_ptr->int_cursor, sizeof(int64_t) * n);
+    info_ptr->int_cursor += n;
+    return count + ( int )n;
 }
 
 /**
- * MapReduce框架的主要执行函数
- * 协调执行整个MapReduce流程
- * 
- * @param argc 命令行参数数量
- * @param argv 命令行参数数组
- * @param map 用户定义的映射函数
- * @param num_mappers 映射器线程数量
- * @param reduce 用户定义的归约函数
- * @param num_reducers 归约器线程数量
- * @param partition 用于确定键归属分区的函数（本实现中未使用）
+ * 压缩输入解压出的数据：攒满约chunk_size字节后在最后一个换行符处切出一块，
+ * 作为内存中的块交给分块映射函数，剩余的半行留给下一块
  */
-void MR_Run(int argc, char* argv[], Mapper map, int num_mappers, Reducer reduce, int num_reducers, Partitioner partition) {
-    // 创建分区锁和分区数组
-    num_partitions = num_reducers;
+struct decoded_t {
+    MR_Chunk* chunk;   // 被解压的输入块
+    char*     buf;
+    size_t    len;
+    size_t    cap;
+    long      offset;  // buf[0]在解压出的数据中的偏移
+    size_t    piece;   // 名义块大小
+    int       skip;    // 为1时丢弃到第一个换行符为止的内容，这一行属于前一块
+    int       tail;    // 为1时只再收下到第一个换行符为止的内容，之后的属于后一块
+    int       done;    // tail时已收到换行符
+};
 
-    partition_locks = ( pthread_mutex_t* )malloc(sizeof(pthread_mutex_t) * num_partitions);
-    partitions      = ( struct partition_t* )malloc(sizeof(struct partition_t) * num_partitions);
-    for (int i = 0; i < num_partitions; ++i) {
-        pthread_mutex_t tmp     = PTHREAD_MUTEX_INITIALIZER;
-        partition_locks[i]      = tmp;
-        partitions[i].info_head = NULL;
+/**
+ * 把buf开头的n字节交给映射函数
+ */
+static void map_decoded(struct decoded_t* d, size_t n) {
+    if (!__atomic_load_n(&current->cancelled, __ATOMIC_RELAXED)) {
+        MR_Chunk piece;
+        piece.file_name   = d->chunk->file_name;
+        piece.offset      = d->offset;
+        piece.length      = ( long )n;
+        piece.data        = d->buf;
+        piece.compression = INPUT_PLAIN;
+        current->chunk_mapper(&piece);
     }
+    memmove(d->buf, d->buf + n, d->len - n);
+    d->len -= n;
+    d->offset += ( long )n;
+}
 
-    int current_work = 1;        // 当前要处理的工作索引
-    int total_work   = argc - 1; // 总工作数量
-
-    // 设置映射函数和创建线程数组
-    mapper   = map;
-    pthreads = ( pthread_t* )malloc(sizeof(pthread_t) * num_mappers);
+static void decoded_sink(const char* data, size_t len, void* arg) {
+    struct decoded_t* d = ( struct decoded_t* )arg;
+    if (d->done)
+        return;
+    if (d->skip) {
+        const char* nl = ( const char* )memchr(data, '\n', len);
+        size_t      n  = nl != NULL ? ( size_t )(nl + 1 - data) : len;
+        d->offset += ( long )n;
+        data += n;
+        len -= n;
+        d->skip = nl == NULL;
+    }
+    if (d->tail) {
+        const char* nl = ( const char* )memchr(data, '\n', len);
+        if (nl != NULL) {
+            len     = nl + 1 - data;
+            d->done = 1;
+        }
+    }
 
-    // 初始化线程数组，-1表示线程可用
-    for (int i = 0; i < num_mappers; ++i) {
-        pthreads[i] = -1;
+    if (d->len + len > d->cap) {
+        d->cap = d->len + len > 2 * d->cap ? d->len + len : 2 * d->cap;
+        d->buf = ( char* )realloc(d->buf, d->cap);
     }
-    
-    // 执行映射阶段
-    // 动态分配工作给可用的线程
-    while (current_work <= total_work) {
-        for (int i = 0; i < num_mappers; ++i) {
-            // 检查线程是否可用
-            if (pthreads[i] == -1) {
-                if (current_work <= total_work) {
-                    // 创建并初始化映射参数
-                    struct mapper_arg_t* pass_arg = ( struct mapper_arg_t* )malloc(sizeof(struct mapper_arg_t));
-                    pass_arg->arg                 = argv[current_work++];
-                    pass_arg->id                  = i;
-                    // 创建新线程执行映射任务
-                    pthread_create(&pthreads[i], NULL, MR_MapperAdapt, pass_arg);
-                }
-                continue;
+    memcpy(d->buf + d->len, data, len);
+    d->len += len;
+    if (d->len >= d->piece) {
+        // 只需在新收到的部分中查找，之前剩余的半行中没有换行符
+        for (char* p = d->buf + d->len; p > d->buf + d->len - len; --p) {
+            if (p[-1] == '\n') {
+                map_decoded(d, p - d->buf);
+                break;
             }
         }
     }
-    
-    // 等待所有映射器线程完成
-    int all_finished = 0;
-    while (all_finished == 0) {
-        all_finished = 1;
-        for (int i = 0; i < num_mappers; ++i) {
-            if (pthreads[i] == -1)
-                continue;
-            else
-                all_finished = 0;
-        }
-    }
-
-    // 调试代码（注释掉）：打印分区内容
-    // for (int i = 0; i < num_partitions; ++i) {
-    //     if (partitions[i].info_head != NULL) {
-    //         printf("partition: %d\n", i);
-    //         struct info_node_t* info = partitions[i].info_head;
-    //         for (; info != NULL; info = info->next) {
-    //             printf("info: %s\n", info->info);
-    //             struct data_node_t* data = info->data;
-    //             for (; data != NULL; data = data->next) {
-    //                 printf("data: %s\n", data->value);
-    //             }
-    //         }
-    //     }
-    // }
-
-    // 设置归约函数
-    reducer = reduce;
-    free(pthreads);
-    // 为归约阶段创建线程数组
-    pthreads = ( pthread_t* )malloc(sizeof(pthread_t) * num_reducers);
-
-    // 初始化归约线程数组
-    for (int i = 0; i < num_reducers; ++i) {
-        pthreads[i] = -1;
-    }
-    
-    // 执行归约阶段
-    int finished_reduce = 0;
-    while (finished_reduce == 0) {
-        finished_reduce = 1;
-        for (int i = 0; i < num_reducers; ++i) {
-            // 如果线程正在运行，继续检查下一个
-            if (pthreads[i] != -1) {
-                finished_reduce = 0;
-                continue;
-            }
-            
-            // 查找分区中未处理的键
-            struct info_node_t* info_ptr = partitions[i].info_head;
-            for (; info_ptr != NULL; info_ptr = info_ptr->next) {
-                if (info_ptr->proceed == 0)
-                    break;
+}
+
+static void last_byte_sink(const char* data, size_t len, void* arg) {
+    if (len > 0)
+        *( char* )arg = data[len - 1];
+}
+
+/**
+ * 解压BGZF文件中的一段完整块
+ * 不在文件开头的段以前一段的最后一块开始，只用它的最后一个字节判断段是否从行首开始；
+ * 段末尾的行没有结束时继续解压后面的块，直到换行符
+ *
+ * @return 成功返回0，数据损坏返回-1
+ */
+static int decode_bgzf(const char* base, size_t size, struct decoded_t* d) {
+    size_t pos = d->chunk->offset;
+    size_t end = pos + d->chunk->length;
+    if (d->chunk->compression == INPUT_BGZF_NEXT) {
+        size_t n    = bgzf_block_size(base + pos, size - pos);
+        char   last = '\n';
+        if (n == 0 || n > end - pos || gzip_inflate(base + pos, n, last_byte_sink, &last) < 0)
+            return -1;
+        d->skip = last != '\n';
+        pos += n;
+    }
+    if (gzip_inflate(base + pos, end - pos, decoded_sink, d) < 0)
+        return -1;
+
+    d->tail = 1;
+    for (pos = end; !d->skip && !d->done && d->len > 0 && d->buf[d->len - 1] != '\n' && pos < size;) {
+        size_t n = bgzf_block_size(base + pos, size - pos);
+        if (n == 0 || n > size - pos)
+            break;
+        if (gzip_inflate(base + pos, n, decoded_sink, d) < 0)
+            return -1;
+        pos += n;
+    }
+    return 0;
+}
+
+static pthread_mutex_t spawn_lock = PTHREAD_MUTEX_INITIALIZER;  // 创建管道到关闭写端之间不让其他线程fork
+
+/**
+ * 用zstd程序解压文件，从管道中边读边切块
+ *
+ * @return 成功返回0，无法运行zstd或解压失败返回-1
+ */
+static int decode_zstd(const char* file_name, struct decoded_t* d) {
+    int fds[2];
+    pthread_mutex_lock(&spawn_lock);
+    if (pipe(fds) < 0) {
+        pthread_mutex_unlock(&spawn_lock);
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execlp("zstd", "zstd", "-dcq", "--", file_name, ( char* )NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+    pthread_mutex_unlock(&spawn_lock);
+    if (pid < 0) {
+        close(fds[0]);
+        return -1;
+    }
+
+    char*   buf = ( char* )malloc(1 << 16);
+    ssize_t n;
+    while ((n = read(fds[0], buf, 1 << 16)) != 0) {
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            break;
+        decoded_sink(buf, n, d);
+    }
+    free(buf);
+    close(fds[0]);
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+        ;
+    return n == 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+/**
+ * 对一个输入块调用分块映射函数；压缩文件的块边解压边切分，一次交给映射函数一块解压出的数据
+ *
+ * @param chunk 输入块
+ */
+static void map_chunk(MR_Chunk* chunk) {
+    if (chunk->compression == INPUT_PLAIN) {
+        current->chunk_mapper(chunk);
+        return;
+    }
+
+    struct decoded_t d;
+    memset(&d, 0, sizeof(d));
+    d.chunk = chunk;
+    d.piece = current->chunk_size;
+    int rc  = -1;
+    if (chunk->compression == INPUT_ZSTD) {
+        rc = decode_zstd(chunk->file_name, &d);
+    } else {
+        int         fd = open(chunk->file_name, O_RDONLY);
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (base != MAP_FAILED) {
+                madvise(base, st.st_size, MADV_SEQUENTIAL);
+                if (chunk->compression == INPUT_BGZF || chunk->compression == INPUT_BGZF_NEXT)
+                    rc = decode_bgzf(( const char* )base, st.st_size, &d);
+                else
+                    rc = gzip_inflate(( const char* )base, st.st_size, decoded_sink, &d) < 0 ? -1 : 0;
+                munmap(base, st.st_size);
             }
-            
-            // 如果当前分区所有键已处理完，继续下一个分区
-            if (info_ptr == NULL) {
-                continue;
+        }
+        if (fd >= 0)
+            close(fd);
+    }
+    if (rc < 0)
+        fprintf(stderr, "mapreduce: cannot decompress '%s'\n", chunk->file_name);
+    if (d.len > 0)
+        map_decoded(&d, d.len);
+    free(d.buf);
+}
+
+/**
+ * 自动模式下在映射任务结束时调整映射线程的并发上限
+ * 每隔ADAPT_INTERVAL_NS由一个线程比较这段时间内的锁等待和各线程忙碌时间：
+ * 等待占比高说明线程在分区锁上互相阻塞，减少一个；占比低且未到上限时增加一个
+ * 忙碌时间在任务结束时才计入，所以只在任务边界上判断
+ */
+static void adapt_mappers(void) {
+    struct MR_Job* job = current;
+    if (!job->auto_mappers)
+        return;
+    unsigned long now = now_ns();
+    unsigned long at  = __atomic_load_n(&job->adapt_at, __ATOMIC_RELAXED);
+    if (now - at < ADAPT_INTERVAL_NS || !__atomic_compare_exchange_n(&job->adapt_at, &at, now, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        return;
+
+    struct threadpool_t* pool = job->pool;
+    unsigned long        busy = 0;
+    for (int i = 0; i < pool->num_threads; ++i)
+        busy += __atomic_load_n(&pool->busy_ns[i], __ATOMIC_RELAXED);
+    unsigned long wait   = __atomic_load_n(&job->lock_wait_ns, __ATOMIC_RELAXED);
+    unsigned long d_busy = busy - job->adapt_busy;
+    unsigned long d_wait = wait - job->adapt_wait;
+    job->adapt_busy      = busy;
+    job->adapt_wait      = wait;
+    if (d_busy == 0)
+        return;
+
+    int    active = __atomic_load_n(&pool->active, __ATOMIC_RELAXED);
+    double ratio  = ( double )d_wait / d_busy;
+    if (ratio > ADAPT_WAIT_HIGH && active > 1)
+        threadpool_set_active(pool, active - 1);
+    else if (ratio < ADAPT_WAIT_LOW && active < job->max_mappers)
+        threadpool_set_active(pool, active + 1);
+}
+
+/**
+ * 映射任务函数
+ * 在线程池的工作线程上对一个输入文件调用用户定义的映射函数
+ * 
+ * @param arg 输入文件名
+ */
+void MR_MapperAdapt(void* arg) {
+    if (!__atomic_load_n(&current->cancelled, __ATOMIC_RELAXED))
+        current->mapper(( char* )arg);  // 调用用户定义的映射函数
+    MR_FlushEmits();       // 提交本线程缓冲区中剩余的键值对
+    adapt_mappers();
+}
+
+/**
+ * 分块映射任务函数
+ * 对输入文件的一个字节范围调用用户定义的分块映射函数
+ *
+ * @param arg 输入块
+ */
+void MR_ChunkMapperAdapt(void* arg) {
+    if (!__atomic_load_n(&current->cancelled, __ATOMIC_RELAXED))
+        map_chunk(( MR_Chunk* )arg);
+    MR_FlushEmits();
+    adapt_mappers();
+}
+
+static int compare_values(const void* a, const void* b) {
+    return current->value_compare(*( char* const* )a, *( char* const* )b);
+}
+
+/**
+ * 确保排序用的值数组至少能容纳n个值
+ */
+static void reserve_sorted(size_t n) {
+    if (n > sorted_cap) {
+        sorted_cap    = n > 2 * sorted_cap ? n : 2 * sorted_cap;
+        sorted_values = ( char** )realloc(sorted_values, sizeof(char*) * sorted_cap);
+    }
+}
+
+/**
+ * 释放排序用的值数组和拷贝缓冲区
+ */
+static void free_sorted(void) {
+    free(sorted_values);
+    free(sorted_buf);
+    sorted_values  = NULL;
+    sorted_cap     = 0;
+    sorted_count   = 0;
+    sorted_buf     = NULL;
+    sorted_buf_cap = 0;
+}
+
+/**
+ * 归并时读出当前键在各来源中的全部字符串值并排序，之后由MR_GetNext依次返回
+ * 段文件中的值拷贝到sorted_buf，内存中的值直接引用
+ */
+static void gather_sorted_values(void) {
+    size_t used  = 0;
+    sorted_count = 0;
+    for (int i = 0; i < merge_count; ++i) {
+        if (!merge_readers[i].active)
+            continue;
+        char* value;
+        while ((value = run_reader_next_value(&merge_readers[i])) != NULL) {
+            size_t len = strlen(value) + 1;
+            if (used + len > sorted_buf_cap) {
+                sorted_buf_cap = used + len > 2 * sorted_buf_cap ? used + len : 2 * sorted_buf_cap;
+                sorted_buf     = ( char* )realloc(sorted_buf, sorted_buf_cap);
             }
-            
-            // 找到未处理的键，创建新线程处理
-            finished_reduce                = 0;
-            struct reducer_arg_t* pass_arg = ( struct reducer_arg_t* )malloc(sizeof(struct reducer_arg_t));
-            pass_arg->id                   = i;
-            pass_arg->key                  = info_ptr->info;
-            pass_arg->partition_id         = i;
-            pthread_create(&pthreads[i], NULL, MR_ReducerAdapt, pass_arg);
+            memcpy(sorted_buf + used, value, len);
+            reserve_sorted(sorted_count + 1);
+            // 缓冲区还会扩容，先记下偏移
+            sorted_values[sorted_count++] = ( char* )( uintptr_t )used;
+            used += len;
         }
     }
+    for (size_t i = 0; i < sorted_count; ++i)
+        sorted_values[i] = sorted_buf + ( uintptr_t )sorted_values[i];
+    if (reducing_info != NULL) {
+        for (; reducing_info->cursor != NULL; reducing_info->cursor = reducing_info->cursor->next) {
+            reserve_sorted(sorted_count + 1);
+            sorted_values[sorted_count++] = reducing_info->cursor->value;
+        }
+    }
+    qsort(sorted_values, sorted_count, sizeof(char*), compare_values);
+    sorted_pos   = 0;
+    serve_sorted = 1;
 }
 
 /**
- * 生成键值对，将中间结果添加到对应分区
- * 由映射函数调用以产生中间结果
+ * 对有溢写段的分区做多路归并归约
+ * 各段文件和已排序的内存部分都按键升序，每轮取出所有来源中最小的键，
+ * 所有持有该键的来源一起参与这次归约
+ *
+ * @param partition_id 分区编号
+ */
+static void merge_partition(int partition_id) {
+    struct partition_t* part = &current->partitions[partition_id];
+    struct run_list_t*  runs = &current->partition_runs[partition_id];
+
+    merge_count   = runs->count;
+    merge_readers = ( struct run_reader_t* )malloc(sizeof(struct run_reader_t) * merge_count);
+    for (int i = 0; i < merge_count; ++i)
+        run_reader_open(&merge_readers[i], runs, i);
+
+    for (;;) {
+        // 找出最小的键
+        char* min_key = NULL;
+        for (int i = 0; i < merge_count; ++i) {
+            if (!merge_readers[i].done && (min_key == NULL || strcmp(merge_readers[i].key, min_key) < 0))
+                min_key = merge_readers[i].key;
+        }
+        if (part->next_key < part->size && (min_key == NULL || strcmp(part->sorted[part->next_key]->info, min_key) < 0))
+            min_key = part->sorted[part->next_key]->info;
+        if (min_key == NULL || __atomic_load_n(&current->cancelled, __ATOMIC_RELAXED))
+            break;
+
+        size_t len = strlen(min_key) + 1;
+        if (len > merge_key_cap) {
+            merge_key_cap = len > 64 ? len : 64;
+            merge_key     = ( char* )realloc(merge_key, merge_key_cap);
+        }
+        memcpy(merge_key, min_key, len);
+
+        // 标记持有该键的来源
+        for (int i = 0; i < merge_count; ++i)
+            merge_readers[i].active = !merge_readers[i].done && strcmp(merge_readers[i].key, merge_key) == 0;
+        reducing_info = NULL;
+        if (part->next_key < part->size && strcmp(part->sorted[part->next_key]->info, merge_key) == 0)
+            reducing_info = part->sorted[part->next_key++];
+
+        merge_pos  = 0;
+        merge_ipos = 0;
+        if (current->value_compare != NULL)
+            gather_sorted_values();
+        current->reducer(merge_key, MR_GetNext, partition_id);
+        serve_sorted = 0;
+        stats.distinct_keys[partition_id]++;
+
+        for (int i = 0; i < merge_count; ++i) {
+            if (merge_readers[i].active)
+                run_reader_next_key(&merge_readers[i]);
+        }
+    }
+
+    for (int i = 0; i < merge_count; ++i)
+        run_reader_close(&merge_readers[i]);
+    free(merge_readers);
+    free(merge_key);
+    free(batch_buf);
+    merge_readers = NULL;
+    merge_count   = 0;
+    merge_key     = NULL;
+    merge_key_cap = 0;
+    batch_buf     = NULL;
+    batch_cap     = 0;
+    reducing_info = NULL;
+    free_sorted();
+}
+
+/**
+ * 释放已归约完的分区中的值，分区越分越细时归约阶段的内存占用随之逐步下降
+ */
+static void release_partition(int partition_id) {
+    size_t bytes = release_values(&current->partitions[partition_id]);
+    __atomic_fetch_add(&stats.released_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * 从分区中逐个领取尚未归约的键并调用归约函数
+ * 通过原子递增next_key领取，多个线程可以同时归约同一分区的不同键；
+ * 领完后把本线程归约的键数累加到分区，使累计数达到键总数的线程负责释放分区中的值
+ *
+ * @param partition_id 分区编号
+ */
+static void reduce_keys(int partition_id) {
+    struct partition_t* part    = &current->partitions[partition_id];
+    unsigned long       reduced = 0;
+    unsigned long       index;
+    while (!__atomic_load_n(&current->cancelled, __ATOMIC_RELAXED)
+           && (index = __atomic_fetch_add(&part->next_key, 1, __ATOMIC_RELAXED)) < part->size) {
+        reducing_info = part->sorted[index];
+        packed_next   = part->values + part->value_start[index];
+        packed_end    = part->values + part->value_start[index + 1];
+        if (index + 1 < part->size)
+            __builtin_prefetch(part->sorted[index + 1]);
+        // 值已在展开数组中连续存放，直接原地排序
+        if (current->value_compare != NULL)
+            qsort(packed_next, packed_end - packed_next, sizeof(char*), compare_values);
+        current->reducer(reducing_info->info, MR_GetNext, partition_id);  // 调用用户定义的归约函数
+        reduced++;
+    }
+    reducing_info = NULL;
+    packed_next   = NULL;
+    packed_end    = NULL;
+    __atomic_fetch_add(&stats.distinct_keys[partition_id], reduced, __ATOMIC_RELAXED);
+    // 领到过键的线程中只有最后一个看到累计数等于键总数
+    if (reduced > 0 && __atomic_add_fetch(&part->reduced, reduced, __ATOMIC_ACQ_REL) == part->size)
+        release_partition(partition_id);
+}
+
+/**
+ * 归约持久化映射输出中的一个分区：按记录顺序依次归约其中的键，
+ * 键和值直接指向文件的映射，MR_Output写入分区的输出缓冲
+ *
+ * @param partition_id 分区编号
+ */
+static void reduce_saved_partition(int partition_id) {
+    struct mapfile_cursor_t cursor;
+    mapfile_cursor_open(&cursor, current->saved, partition_id);
+    merge_output = &current->partition_outputs[partition_id];
+    saved_cursor = &cursor;
+    while (mapfile_next_key(&cursor)) {
+        current->reducer(cursor.key, MR_GetNext, partition_id);
+        stats.distinct_keys[partition_id]++;
+    }
+    saved_cursor = NULL;
+    merge_output = NULL;
+}
+
+/**
+ * 归约一个分区：先对分区的键排序，再依次归约其中的键
+ * 有溢写段的分区需要顺序归并，不参与窃取；其余分区排序并把值展开成连续数组后
+ * 即可被其他线程窃取
+ * 调用者需先设置reduce_arena
+ *
+ * @param partition_id 分区编号
+ */
+static void reduce_partition(int partition_id) {
+    struct partition_t* part = &current->partitions[partition_id];
+    if (current->saved != NULL) {
+        reduce_saved_partition(partition_id);
+        return;
+    }
+
+    // 分区按编号轮流分配到各节点，排序数组、归并缓冲和输出都在该节点上首次写入
+    if (affinity && current->topology.num_nodes > 1)
+        pin_self_to_node(&current->topology, partition_id % current->topology.num_nodes);
+
+    unsigned long start = now_ns();
+    sort_partition(part);
+    __atomic_fetch_add(&current->shuffle_ns, now_ns() - start, __ATOMIC_RELAXED);
+    if (current->partition_runs[partition_id].count > 0) {
+        merge_output = &current->partition_outputs[partition_id];
+        merge_partition(partition_id);
+        merge_output = NULL;
+        release_partition(partition_id);
+    } else {
+        start = now_ns();
+        pack_partition(part);
+        __atomic_fetch_add(&current->shuffle_ns, now_ns() - start, __ATOMIC_RELAXED);
+        __atomic_store_n(&part->stealable, 1, __ATOMIC_RELEASE);
+        reduce_keys(partition_id);
+    }
+}
+
+/**
+ * 归约任务函数
+ * 每个归约线程运行一个任务，从reduce_order中按原子递增的下标逐个领取分区，
+ * 大分区排在前面先被领走，小分区留到最后填补各线程的空隙；
+ * 分区都领完后，继续从其他已排序的分区窃取剩余的键，
+ * 使倾斜数据下的尾延迟取决于最重的单个键而不是最重的分区
  * 
+ * @param arg 归约线程编号，决定MR_Output使用的分配器
+ */
+void MR_ReducerAdapt(void* arg) {
+    int reducer_id = ( int )( long )arg;
+    int index;
+
+    reduce_arena = &current->output_arenas[reducer_id];
+    topk_heap    = current->topk_heaps != NULL ? &current->topk_heaps[reducer_id] : NULL;
+    while (!__atomic_load_n(&current->cancelled, __ATOMIC_RELAXED)
+           && (index = __atomic_fetch_add(&current->next_reduce, 1, __ATOMIC_RELAXED)) < current->num_partitions)
+        reduce_partition(current->reduce_order[index]);
+
+    for (int i = 0; i < current->num_partitions && !__atomic_load_n(&current->cancelled, __ATOMIC_RELAXED); ++i) {
+        int victim = (reducer_id + i) % current->num_partitions;
+        if (__atomic_load_n(&current->partitions[victim].stealable, __ATOMIC_ACQUIRE))
+            reduce_keys(victim);
+    }
+    // 按分区绑定到节点的线程回到原来的CPU上，之后的任务不受最后一个分区所在节点的限制
+    restore_self_affinity();
+    reduce_arena = NULL;
+    topk_heap    = NULL;
+    free(save_buf);
+    save_buf     = NULL;
+    save_buf_cap = 0;
+}
+
+/**
+ * 一个分区及其中间结果的字节数，用于按大小排列归约顺序
+ */
+struct partition_size_t {
+    size_t bytes;
+    int    id;
+};
+
+static int compare_partition_size(const void* a, const void* b) {
+    const struct partition_size_t* pa = ( const struct partition_size_t* )a;
+    const struct partition_size_t* pb = ( const struct partition_size_t* )b;
+    if (pa->bytes != pb->bytes)
+        return pa->bytes > pb->bytes ? -1 : 1;
+    return pa->id - pb->id;
+}
+
+/**
+ * 把分区编号按中间结果字节数降序写入order，大小相同时编号小的在前
+ *
+ * @param bytes 每个分区的字节数
+ * @param order 输出的分区编号，至少能容纳n个
+ */
+static void order_partitions(const size_t* bytes, int* order, int n) {
+    struct partition_size_t* sizes = ( struct partition_size_t* )malloc(sizeof(struct partition_size_t) * (n + 1));
+    for (int i = 0; i < n; ++i) {
+        sizes[i].bytes = bytes[i];
+        sizes[i].id    = i;
+    }
+    qsort(sizes, n, sizeof(struct partition_size_t), compare_partition_size);
+    for (int i = 0; i < n; ++i)
+        order[i] = sizes[i].id;
+    free(sizes);
+}
+
+/**
+ * 在当前键节点（或归并中分区的缓冲区）中为归约输出预留need个字节
+ *
+ * @return 预留的位置；不在归约函数中时返回NULL
+ */
+static char* reserve_output(size_t need) {
+    char* dst;
+    if (merge_output != NULL) {
+        struct output_buffer_t* out = merge_output;
+        if (out->len + need > out->cap) {
+            out->cap  = out->len + need > out->cap * 2 ? out->len + need : out->cap * 2;
+            out->data = ( char* )realloc(out->data, out->cap);
+        }
+        dst = out->data + out->len;
+        out->len += need;
+    } else if (reducing_info != NULL && reduce_arena != NULL) {
+        struct info_node_t* node = reducing_info;
+        if (node->output_len + need > node->output_cap) {
+            size_t new_cap = node->output_len + need > node->output_cap * 2 ? node->output_len + need : node->output_cap * 2;
+            char*  output  = ( char* )arena_alloc(reduce_arena, new_cap);
+            if (node->output_len > 0)
+                memcpy(output, node->output, node->output_len);
+            node->output     = output;
+            node->output_cap = new_cap;
+        }
+        dst = node->output + node->output_len;
+        node->output_len += need;
+    } else {
+        return NULL;
+    }
+    return dst;
+}
+
+/**
+ * 归约函数输出一条结果，格式为"键 值\n"
+ * 内容先写入当前键节点（或归并中分区的缓冲区），不经过stdio的全局锁；
+ * 归约阶段结束后按分区编号、分区内按键序统一写出，输出顺序与线程调度无关
+ * 在归约函数之外调用时直接写到标准输出
+ *
  * @param key 键
  * @param value 值
  */
-void MR_Emit(char* key, char* value) {
-    // 计算键应该分配到哪个分区
-    unsigned long partition_index = MR_DefaultHashPartition(key, num_partitions);
-    // 加锁保护分区数据访问
-    pthread_mutex_lock(&partition_locks[partition_index]);
-    
-    // 查找是否已存在该键
-    struct info_node_t* info_ptr = partitions[partition_index].info_head;
-    for (; info_ptr != NULL; info_ptr = info_ptr->next) {
-        if (strcmp(info_ptr->info, key) == 0) {
-            // 键已存在，添加新值
-            insert_data(info_ptr, value);
-            pthread_mutex_unlock(&partition_locks[partition_index]); // 解锁
-            return;
+void MR_Output(char* key, char* value) {
+    size_t key_len   = strlen(key);
+    size_t value_len = strlen(value);
+    size_t need      = key_len + value_len + 2;
+
+    char* dst = reserve_output(need);
+    if (dst == NULL) {
+        printf("%s %s\n", key, value);
+        return;
+    }
+    memcpy(dst, key, key_len);
+    dst[key_len] = ' ';
+    memcpy(dst + key_len + 1, value, value_len);
+    dst[need - 1] = '\n';
+}
+
+/**
+ * 保存映射输出时使用的归约函数：把键的全部值编码成一条记录写入归约输出，
+ * 输出按键序写出后即为文件中该分区的记录
+ */
+static void save_reduce(char* key, Getter get_next, int partition_number) {
+    size_t   used       = 0;
+    uint32_t num_values = 0;
+    uint32_t num_ints   = 0;
+    char*    value;
+    int64_t  int_value;
+    while ((value = get_next(key, partition_number)) != NULL) {
+        size_t len  = strlen(value);
+        size_t need = used + mapfile_value_size(len);
+        if (need > save_buf_cap) {
+            save_buf_cap = need > 2 * save_buf_cap ? need : 2 * save_buf_cap;
+            save_buf     = ( char* )realloc(save_buf, save_buf_cap);
+        }
+        mapfile_put_value(save_buf + used, value, len);
+        used = need;
+        num_values++;
+    }
+    while (MR_GetNextInt64(key, partition_number, &int_value)) {
+        if (used + sizeof(int_value) > save_buf_cap) {
+            save_buf_cap = used + sizeof(int_value) > 2 * save_buf_cap ? used + sizeof(int_value) : 2 * save_buf_cap;
+            save_buf     = ( char* )realloc(save_buf, save_buf_cap);
+        }
+        memcpy(save_buf + used, &int_value, sizeof(int_value));
+        used += sizeof(int_value);
+        num_ints++;
+    }
+
+    size_t key_len = strlen(key);
+    char*  dst     = reserve_output(mapfile_key_size(key_len) + used);
+    dst            = mapfile_put_key(dst, key, key_len, num_values, num_ints);
+    if (used > 0)
+        memcpy(dst, save_buf, used);
+}
+
+/**
+ * 把一个分区中MR_Output的内容写到out
+ */
+static void write_partition_output(int partition_id, FILE* out) {
+    struct partition_t* part = &current->partitions[partition_id];
+    if (current->partition_outputs[partition_id].len > 0) {
+        fwrite(current->partition_outputs[partition_id].data, 1, current->partition_outputs[partition_id].len, out);
+        return;
+    }
+    for (unsigned long k = 0; k < part->size; ++k) {
+        if (part->sorted[k]->output_len > 0)
+            fwrite(part->sorted[k]->output, 1, part->sorted[k]->output_len, out);
+    }
+}
+
+/**
+ * 打开分区的输出文件"前缀-分区编号"
+ *
+ * @return 文件，无法打开时打印错误并返回NULL
+ */
+static FILE* open_output(const char* prefix, int partition_id) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s-%05d", prefix, partition_id);
+    FILE* out = fopen(path, "w");
+    if (out == NULL)
+        fprintf(stderr, "mapreduce: cannot open output file '%s'\n", path);
+    return out;
+}
+
+/**
+ * 归约阶段结束后写出所有MR_Output的内容
+ * 设置了输出前缀时每个分区写入"前缀-分区编号"文件，否则按分区顺序写到标准输出
+ */
+static void write_outputs(void) {
+    for (int i = 0; i < current->num_partitions; ++i) {
+        if (output_prefix == NULL) {
+            write_partition_output(i, stdout);
+        } else {
+            FILE* out = open_output(output_prefix, i);
+            if (out != NULL) {
+                write_partition_output(i, out);
+                fclose(out);
+            }
         }
     }
-    
-    // 键不存在，创建新键并添加值
-    insert_info(&partitions[partition_index], key);
-    insert_data(partitions[partition_index].info_head, value);
-    // 解锁
-    pthread_mutex_unlock(&partition_locks[partition_index]);
+    fflush(stdout);
+}
+
+/**
+ * 归约函数提交一个键及其分数给前K聚合，只保留分数最高的K个键
+ * 未开启前K聚合或在归约函数之外调用时忽略
+ *
+ * @param key 键
+ * @param score 分数，如键的出现次数
+ */
+void MR_OutputTopK(char* key, int64_t score) {
+    if (topk_heap != NULL)
+        topk_offer(topk_heap, key, strlen(key), score);
+}
+
+/**
+ * 返回最近一次作业合并后的前K个键，按分数从高到低排列，在下一次作业开始前有效
+ *
+ * @param count 输出的键数
+ */
+const MR_TopKEntry* MR_GetTopK(int* count) {
+    *count = topk_result.count;
+    return topk_result.entries;
+}
+
+/**
+ * 开始新作业前清空上一次的前K结果，按本次作业保留的键数重新准备
+ */
+static void reset_topk(int k) {
+    topk_free(&topk_result);
+    topk_init(&topk_result, k);
+}
+
+/**
+ * 把合并后的前K个键排序并写出，每行"键 分数"
+ * 设置了输出前缀时写入"前缀-topk"文件，否则写到标准输出
+ */
+static void write_topk(void) {
+    topk_sort(&topk_result);
+    FILE* out = stdout;
+    if (output_prefix != NULL) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s-topk", output_prefix);
+        if ((out = fopen(path, "w")) == NULL) {
+            fprintf(stderr, "mapreduce: cannot open output file '%s'\n", path);
+            return;
+        }
+    }
+    for (int i = 0; i < topk_result.count; ++i)
+        fprintf(out, "%s %ld\n", topk_result.entries[i].key, ( long )topk_result.entries[i].score);
+    if (out != stdout)
+        fclose(out);
+    fflush(stdout);
+}
+
+/**
+ * 默认哈希分区函数
+ * 用于确定键应该分配到哪个分区
+ * 
+ * @param key 需要计算哈希值的键
+ * @param num_partitions 分区数量
+ * @return 键的哈希值对应的分区索引
+ */
+unsigned long MR_DefaultHashPartition(char* key, int num_partitions) {
+    // 与分区内哈希表使用同一哈希值
+    return hash_key(key) % num_partitions;  // 取模确定分区
+}
+
+/**
+ * 有序范围分区函数
+ * 把键的前4个字节看作可打印ASCII（0x20~0x7e，其余字节截断到两端）上的
+ * 96进制小数，按其大小线性映射到分区。该映射随键的字典序单调不减，
+ * 而分区内的键在归约前已排序，因此按分区编号顺序拼接各归约器的输出
+ * 即得到全局有序的结果。
+ *
+ * @param key 键
+ * @param num_partitions 分区数量
+ * @return 分区索引
+ */
+unsigned long MR_SortedPartition(char* key, int num_partitions) {
+    const unsigned long base  = 96;
+    unsigned long       value = 0;
+    int                 i     = 0;
+    for (; i < 4 && key[i] != '\0'; ++i) {
+        unsigned char c     = ( unsigned char )key[i];
+        unsigned long digit = c < 0x20 ? 0 : (c > 0x7e ? base - 1 : ( unsigned long )(c - 0x20));
+        value               = value * base + digit;
+    }
+    for (; i < 4; ++i)
+        value *= base;
+    return value * num_partitions / (base * base * base * base);
+}
+
+/**
+ * 按采样得到的分界键做范围分区
+ * 传给MR_Run等函数时，映射阶段之前先对部分输入运行映射函数并采样发射的键，
+ * 按采样中各键的出现频率选出分界键，使各分区的值数量接近；
+ * 出现频率超过一个分区份额的热点键单独占一个分区。
+ * 分区编号随键的字典序单调不减，按分区顺序拼接输出即全局有序。
+ * 采样的任务会被映射两次，映射函数除发射外不能有其他副作用；
+ * 没有分界键时（如多进程模式）退回默认哈希分区
+ *
+ * @param key 键
+ * @param num_partitions 分区数量
+ * @return 分区索引
+ */
+unsigned long MR_SampledPartition(char* key, int num_partitions) {
+    if (current == NULL || current->num_splits == 0)
+        return MR_DefaultHashPartition(key, num_partitions);
+    // 第一个不小于key的分界键的下标即分区编号
+    int lo = 0;
+    int hi = current->num_splits;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (strcmp(current->splits[mid], key) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/**
+ * 把键加入当前线程的蓄水池（算法R）
+ */
+static void sample_key(const char* key, size_t key_len) {
+    struct reservoir_t* res  = reservoir;
+    int                 slot = res->count;
+    res->seen++;
+    if (res->count == SAMPLE_KEYS) {
+        res->rng ^= res->rng << 13;
+        res->rng ^= res->rng >> 7;
+        res->rng ^= res->rng << 17;
+        unsigned long pick = res->rng % res->seen;
+        if (pick >= SAMPLE_KEYS)
+            return;
+        slot = ( int )pick;
+        free(res->keys[slot]);
+    } else {
+        res->count++;
+    }
+    res->keys[slot] = strndup(key, key_len);
+}
+
+/**
+ * 采样任务函数：运行映射函数，发射的键只进入任务自己的蓄水池
+ *
+ * @param arg 蓄水池
+ */
+static void MR_SampleAdapt(void* arg) {
+    reservoir = ( struct reservoir_t* )arg;
+    if (current->chunk_mapper != NULL)
+        map_chunk(( MR_Chunk* )reservoir->input);
+    else
+        current->mapper(( char* )reservoir->input);
+    reservoir = NULL;
+    adapt_mappers();
+}
+
+/**
+ * 一个采样键及其代表的发射次数
+ */
+struct weighted_key_t {
+    char*  key;
+    double weight;
+};
+
+static int compare_weighted(const void* a, const void* b) {
+    return strcmp((( const struct weighted_key_t* )a)->key, (( const struct weighted_key_t* )b)->key);
+}
+
+/**
+ * 记录一个分界键：分区编号不超过当前分界键个数的键都不大于它
+ */
+static void add_split(struct MR_Job* job, const char* key) {
+    job->splits[job->num_splits++] = strdup(key);
+}
+
+/**
+ * 对等距选取的若干映射任务采样并计算分界键
+ * 各任务的蓄水池大小相同而发射量不同，每个采样键按seen/count加权。
+ * 按键排序后依次累加权重，达到剩余权重的平均份额时切分；
+ * 单个键的权重超过份额时在它前后各切一次，使它独占一个分区
+ *
+ * @param inputs 映射任务参数数组
+ * @param num_inputs 任务数
+ */
+static void compute_splits(struct MR_Job* job, struct threadpool_t* pool, void** inputs, int num_inputs) {
+    int                 num_samples = num_inputs < SAMPLE_TASKS ? num_inputs : SAMPLE_TASKS;
+    struct reservoir_t* samples     = ( struct reservoir_t* )calloc(num_samples, sizeof(struct reservoir_t));
+    for (int i = 0; i < num_samples; ++i) {
+        samples[i].input = inputs[( long )i * num_inputs / num_samples];
+        samples[i].keys  = ( char** )malloc(sizeof(char*) * SAMPLE_KEYS);
+        samples[i].rng   = 0x9E3779B97F4A7C15UL * (i + 1);
+        threadpool_submit(pool, MR_SampleAdapt, &samples[i]);
+    }
+    threadpool_wait(pool);
+
+    int total = 0;
+    for (int i = 0; i < num_samples; ++i)
+        total += samples[i].count;
+    struct weighted_key_t* keys   = ( struct weighted_key_t* )malloc(sizeof(struct weighted_key_t) * (total + 1));
+    double                 weight = 0;
+    int                    n      = 0;
+    for (int i = 0; i < num_samples; ++i) {
+        for (int j = 0; j < samples[i].count; ++j) {
+            keys[n].key    = samples[i].keys[j];
+            keys[n].weight = ( double )samples[i].seen / samples[i].count;
+            weight += keys[n++].weight;
+        }
+    }
+    qsort(keys, n, sizeof(struct weighted_key_t), compare_weighted);
+
+    job->splits     = ( char** )malloc(sizeof(char*) * job->num_partitions);
+    job->num_splits = 0;
+    int    parts_left = job->num_partitions;
+    double acc        = 0;
+    for (int i = 0; i < n && parts_left > 1;) {
+        // 合并相同的键
+        int    j     = i;
+        double group = 0;
+        for (; j < n && strcmp(keys[j].key, keys[i].key) == 0; ++j)
+            group += keys[j].weight;
+        double share = weight / parts_left;
+
+        if (acc > 0 && group >= share) {
+            // 热点键：先结束前一个分区
+            add_split(job, keys[i - 1].key);
+            weight -= acc;
+            acc = 0;
+            parts_left--;
+            share = weight / parts_left;
+        }
+        acc += group;
+        if (acc >= share && parts_left > 1 && j < n) {
+            add_split(job, keys[i].key);
+            weight -= acc;
+            acc = 0;
+            parts_left--;
+        }
+        i = j;
+    }
+
+    for (int i = 0; i < n; ++i)
+        free(keys[i].key);
+    free(keys);
+    for (int i = 0; i < num_samples; ++i)
+        free(samples[i].keys);
+    free(samples);
+}
+
+/**
+ * MapReduce框架的主要执行函数
+ * 协调执行整个MapReduce流程
+ * 
+ * @param argc 命令行参数数量
+ * @param argv 命令行参数数组
+ * @param map 用户定义的映射函数
+ * @param num_mappers 映射器线程数量
+ * @param reduce 用户定义的归约函数
+ * @param num_reducers 归约器线程数量
+ * @param partition 用于确定键归属分区的函数，为NULL时使用MR_DefaultHashPartition
+ */
+void MR_Run(int argc, char* argv[], Mapper map, int num_mappers, Reducer reduce, int num_reducers, Partitioner partition) {
+    MR_RunWithCombiner(argc, argv, map, num_mappers, reduce, num_reducers, NULL, partition);
+}
+
+/**
+ * 设置前K聚合保留的键数，在下一次作业时生效
+ * 开启后归约函数通过MR_OutputTopK提交键和分数，每个归约线程只在小顶堆中保留K个，
+ * 归约阶段结束后合并各堆并按分数从高到低写出，省去输出全部键后再排序
+ *
+ * @param k 保留的键数，0表示关闭
+ */
+void MR_SetTopK(int k) {
+    topk_k = k > 0 ? k : 0;
+}
+
+/**
+ * 设置中间结果的内存上限，在下一次MR_Run时生效
+ * 每个分区分得上限的1/num_reducers，超过后排序溢写到临时文件，归约时多路归并
+ *
+ * @param bytes 内存上限（字节），0表示不限制
+ */
+void MR_SetMemoryBudget(size_t bytes) {
+    memory_budget = bytes;
+}
+
+/**
+ * 设置每个归约线程对应的逻辑分区数，在下一次作业时生效
+ * 分区数为归约线程数的factor倍，分区函数收到的分区数随之变为该值；
+ * 归约阶段各线程按中间结果从大到小动态领取分区，一个过大的分区
+ * 不会再独占一个线程，其余线程可以分担别的分区
+ *
+ * @param factor 倍数，小于1时按1处理
+ */
+void MR_SetPartitionsPerReducer(int factor) {
+    partitions_per_reducer = factor > 1 ? factor : 1;
+}
+
+/**
+ * 开启或关闭溢写段压缩，在下一次作业时生效
+ * 段中的键始终按前缀编码；开启后每64KB的块再用LZ4压缩，
+ * 用少量CPU时间换取更少的磁盘读写，多进程模式下的段文件同样压缩
+ *
+ * @param enabled 非0时开启
+ */
+void MR_SetSpillCompression(int enabled) {
+    compress_runs = enabled != 0;
+}
+
+/**
+ * 设置映射任务的检查点目录，在下一次线程模式的作业时生效
+ * 每个映射任务完成后把输出写成目录下的检查点文件并记入清单；作业中途崩溃后
+ * 以同样的参数重新运行，清单中已完成的任务不再映射，直接读回其检查点
+ * 作业成功结束后删除检查点。采样分区对相同的输入给出相同的分界键，可以一起使用
+ *
+ * @param dir 已存在的目录，为NULL时关闭；字符串需在作业期间保持有效
+ */
+void MR_SetCheckpointDir(const char* dir) {
+    checkpoint_dir = dir;
+}
+
+/**
+ * 设置保存映射输出的文件，在下一次线程模式的作业时生效
+ * 映射阶段结束后每个分区的键按序连同全部值写入文件，归约阶段改为读取该文件；
+ * 归约函数为NULL时只保存不归约。之后可以用MR_RunReduceOnly对同一份输出反复归约
+ *
+ * @param path 文件路径，为NULL时关闭；字符串需在作业期间保持有效
+ */
+void MR_SetMapOutputFile(const char* path) {
+    map_output_file = path;
+}
+
+/**
+ * 返回最近一次作业的统计信息，在下一次作业开始前有效
+ */
+const MR_Stats* MR_GetStats(void) {
+    return &stats;
+}
+
+/**
+ * 开启或关闭线程绑定，在下一次MR_Run等线程模式的作业时生效
+ * 开启后第i个工作线程绑定到一个CPU，相邻线程轮流分到不同的NUMA节点；
+ * 归约分区p的线程在归约前迁到节点p % 节点数，使该分区归约阶段分配的内存
+ * 按首次访问策略落在同一节点上
+ *
+ * @param enabled 非0时开启
+ */
+void MR_SetAffinity(int enabled) {
+    affinity = enabled != 0;
+}
+
+/**
+ * 设置MR_Output的输出位置，在下一次作业时生效
+ *
+ * @param prefix 为NULL时按分区顺序输出到标准输出；否则每个分区写入"prefix-%05d"文件，
+ *               字符串需在作业期间保持有效
+ */
+void MR_SetOutput(const char* prefix) {
+    output_prefix = prefix;
+}
+
+/**
+ * 开启或关闭流水线模式，在下一次MR_RunWithCombiner或MR_RunChunked时生效
+ * 开启后，映射任务队列取空后空闲下来的线程在其余映射线程仍在运行时，
+ * 用合并函数把各分区中已提交的值合并为部分结果，缩短归约阶段
+ * 要求合并函数满足结合律，且合并结果可以再次作为合并函数的输入
+ *
+ * @param enabled 非0时开启
+ */
+void MR_SetPipelined(int enabled) {
+    pipelined = enabled != 0;
+}
+
+/**
+ * 在块数组末尾加入一块，容量不足时扩容
+ */
+static void add_chunk(MR_Chunk** chunks, int* num_chunks, int* chunks_cap, char* file_name, long offset, long length, int compression) {
+    if (*num_chunks == *chunks_cap) {
+        *chunks_cap = *chunks_cap == 0 ? 64 : *chunks_cap * 2;
+        *chunks     = ( MR_Chunk* )realloc(*chunks, sizeof(MR_Chunk) * *chunks_cap);
+    }
+    MR_Chunk* chunk    = &(*chunks)[(*num_chunks)++];
+    chunk->file_name   = file_name;
+    chunk->offset      = offset;
+    chunk->length      = length;
+    chunk->data        = NULL;
+    chunk->compression = compression;
+}
+
+/**
+ * 由文件开头的字节判断压缩格式
+ *
+ * @param head 文件开头的至多64字节
+ * @param len head的长度
+ * @return INPUT_PLAIN、INPUT_GZIP、INPUT_BGZF或INPUT_ZSTD
+ */
+static int input_compression(const char* head, ssize_t len) {
+    const unsigned char* p = ( const unsigned char* )head;
+    if (len >= 4 && p[0] == 0x28 && p[1] == 0xb5 && p[2] == 0x2f && p[3] == 0xfd)
+        return INPUT_ZSTD;
+    if (len >= 3 && p[0] == 0x1f && p[1] == 0x8b && p[2] == 8)
+        return bgzf_block_size(head, len) > 0 ? INPUT_BGZF : INPUT_GZIP;
+    return INPUT_PLAIN;
+}
+
+/**
+ * 按块头给出的长度遍历BGZF文件，把解压后约chunk_size字节的连续块切成一段，不必解压。
+ * 除第一段外每段都以前一段的最后一块开始，用来判断行是否跨段（见decode_bgzf）；
+ * 解压后为空的块不作段的分界
+ */
+static void split_bgzf(int fd, char* file_name, long size, long chunk_size, MR_Chunk** chunks, int* num_chunks, int* chunks_cap) {
+    int           compression = INPUT_BGZF;
+    char          head[64];
+    unsigned char isize[4];
+    long          start = 0;
+    long          pos   = 0;
+    long          bytes = 0;  // 本段解压后的字节数
+    while (pos < size) {
+        ssize_t n     = pread(fd, head, sizeof(head), pos);
+        long    block = n > 0 ? ( long )bgzf_block_size(head, n) : 0;
+        if (block == 0 || block > size - pos || pread(fd, isize, 4, pos + block - 4) != 4)
+            break;
+        long decoded = isize[0] | isize[1] << 8 | isize[2] << 16 | ( long )isize[3] << 24;
+        bytes += decoded;
+        pos += block;
+        if (bytes >= chunk_size && decoded > 0 && pos < size) {
+            add_chunk(chunks, num_chunks, chunks_cap, file_name, start, pos - start, compression);
+            compression = INPUT_BGZF_NEXT;
+            start       = pos - block;
+            bytes       = 0;
+        }
+    }
+    add_chunk(chunks, num_chunks, chunks_cap, file_name, start, size - start, compression);
+}
+
+/**
+ * 把文件切分为约chunk_size字节的块，每块除最后一块外都在换行符之后结束
+ * 从名义边界处向后读取，找到第一个换行符作为实际边界
+ *
+ * @param file_name 输入文件名
+ * @param chunk_size 名义块大小
+ * @param chunks 块数组，容量不足时扩容
+ * @param num_chunks 块数量
+ * @param chunks_cap 块数组容量
+ * @return 成功返回0，无法读取文件返回-1
+ */
+static int split_file(char* file_name, long chunk_size, MR_Chunk** chunks, int* num_chunks, int* chunks_cap) {
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    char    buf[4096];
+    ssize_t head        = pread(fd, buf, 64, 0);
+    int     compression = input_compression(buf, head);
+    if (compression == INPUT_BGZF) {
+        split_bgzf(fd, file_name, st.st_size, chunk_size, chunks, num_chunks, chunks_cap);
+        close(fd);
+        return 0;
+    }
+    if (compression != INPUT_PLAIN) {
+        add_chunk(chunks, num_chunks, chunks_cap, file_name, 0, st.st_size, compression);
+        close(fd);
+        return 0;
+    }
+
+    long start = 0;
+    while (start < st.st_size) {
+        long end = start + chunk_size;
+        if (end >= st.st_size) {
+            end = st.st_size;
+        } else {
+            // 从end-1开始查找换行符，块包含该换行符
+            long    pos = end - 1;
+            ssize_t n;
+            end = st.st_size;
+            while ((n = pread(fd, buf, sizeof(buf), pos)) > 0) {
+                char* nl = memchr(buf, '\n', n);
+                if (nl != NULL) {
+                    end = pos + (nl - buf) + 1;
+                    break;
+                }
+                pos += n;
+            }
+        }
+
+        add_chunk(chunks, num_chunks, chunks_cap, file_name, start, end - start, INPUT_PLAIN);
+        start = end;
+    }
+
+    close(fd);
+    return 0;
+}
+
+static void MR_PrecombineAdapt(void* arg);
+
+/**
+ * 重置统计信息，上一次作业的数组在这里释放
+ */
+static void reset_stats(int num_partitions, int num_threads) {
+    free(stats.emits);
+    free(stats.distinct_keys);
+    free(stats.thread_busy_seconds);
+    memset(&stats, 0, sizeof(stats));
+    stats.num_partitions      = num_partitions;
+    stats.emits               = ( unsigned long* )calloc(num_partitions, sizeof(unsigned long));
+    stats.distinct_keys       = ( unsigned long* )calloc(num_partitions, sizeof(unsigned long));
+    stats.num_threads         = num_threads;
+    stats.thread_busy_seconds = ( double* )calloc(num_threads, sizeof(double));
+}
+
+/**
+ * 释放作业的分区数组及各分区的段列表和输出缓冲
+ */
+static void release_partitions(struct MR_Job* job) {
+    for (int i = 0; i < job->partitions_cap; ++i) {
+        free_partition(&job->partitions[i]);
+        free_runs(&job->partition_runs[i]);
+        arena_release(&job->output_arenas[i]);
+        free(job->partition_outputs[i].data);
+    }
+    free(job->partitions);
+    free(job->partition_runs);
+    free(job->output_arenas);
+    free(job->partition_outputs);
+    job->partitions        = NULL;
+    job->partition_runs    = NULL;
+    job->output_arenas     = NULL;
+    job->partition_outputs = NULL;
+    job->partitions_cap    = 0;
+}
+
+/**
+ * 准备作业的分区并把它设为当前作业，归约线程数默认与分区数相同
+ * 分区数与上一次作业相同时重置并复用已有的分区、哈希表和分配器，
+ * 否则重新创建，每个分区的各分段带有自己的锁
+ */
+static void init_job(struct MR_Job* job, int num_partitions, Combiner combine, Partitioner partition) {
+    if (job->partitions_cap != num_partitions) {
+        release_partitions(job);
+        job->partitions        = ( struct partition_t* )malloc(sizeof(struct partition_t) * num_partitions);
+        job->partition_runs    = ( struct run_list_t* )malloc(sizeof(struct run_list_t) * num_partitions);
+        job->output_arenas     = ( struct arena_t* )malloc(sizeof(struct arena_t) * num_partitions);
+        job->partition_outputs = ( struct output_buffer_t* )calloc(num_partitions, sizeof(struct output_buffer_t));
+        job->partitions_cap    = num_partitions;
+        for (int i = 0; i < num_partitions; ++i) {
+            init_partition(&job->partitions[i]);
+            init_runs(&job->partition_runs[i]);
+            arena_init(&job->output_arenas[i], 64 * 1024);
+        }
+    } else {
+        for (int i = 0; i < num_partitions; ++i) {
+            reset_partition(&job->partitions[i]);
+            arena_reset(&job->output_arenas[i]);
+            job->partition_outputs[i].len = 0;
+        }
+    }
+
+    job->num_partitions = num_partitions;
+    job->num_reducers   = num_partitions;
+    job->combiner       = combine;
+    job->partitioner    = partition;
+    job->value_compare  = NULL;
+    job->shuffle_ns     = 0;
+    job->lock_wait_ns   = 0;
+
+    job->spill_threshold = memory_budget / num_partitions;
+    if (memory_budget > 0 && job->spill_threshold == 0)
+        job->spill_threshold = 1;
+    current = job;
+}
+
+/**
+ * 作业结束：统计并删除溢写段，分区保留到下一次作业或MR_JobDestroy
+ */
+static void finish_job(struct MR_Job* job) {
+    for (int i = 0; i < job->num_partitions; ++i) {
+        for (int j = 0; j < job->partition_runs[i].count; ++j)
+            stats.spilled_bytes += job->partition_runs[i].ends[j] - job->partition_runs[i].starts[j];
+        free_runs(&job->partition_runs[i]);
+    }
+    for (int i = 0; i < job->num_splits; ++i)
+        free(job->splits[i]);
+    free(job->splits);
+    job->splits     = NULL;
+    job->num_splits = 0;
+    current         = NULL;
+}
+
+/**
+ * 准备至少num_threads个线程的线程池，已有的线程池足够大时直接复用
+ * 开启绑定时把每个工作线程绑定到CPU；关闭后解除之前作业的绑定
+ */
+static struct threadpool_t* prepare_pool(struct MR_Job* job, int num_threads) {
+    if (job->pool != NULL && job->pool->num_threads < num_threads) {
+        threadpool_destroy(job->pool);
+        job->pool = NULL;
+    }
+    if (job->pool == NULL) {
+        job->pool        = threadpool_create(num_threads);
+        job->pool_pinned = 0;
+    }
+
+    struct threadpool_t* pool = job->pool;
+    memset(pool->busy_ns, 0, sizeof(unsigned long) * pool->num_threads);
+    if ((affinity || job->pool_pinned) && job->topology.num_cpus == 0 && load_topology(&job->topology) < 0)
+        return pool;
+    for (int i = 0; i < pool->num_threads && (affinity || job->pool_pinned); ++i) {
+        if (affinity)
+            pin_thread(pool->threads[i], topology_cpu_for(&job->topology, i));
+        else
+            unpin_thread(pool->threads[i], &job->topology);
+    }
+    job->pool_pinned = affinity;
+    return pool;
+}
+
+/**
+ * 检查点清单：记录已完成的映射任务，进程重启后据此跳过
+ * 首行为"mapreduce-checkpoint 分区数"，之后每行"任务编号 任务标识"，
+ * 任务标识为文件名，分块时为"文件名:偏移:长度"
+ */
+struct checkpoint_t {
+    FILE*           manifest;
+    pthread_mutex_t lock;  // 保护清单的追加
+};
+
+/**
+ * 检查点模式下的一个映射任务
+ */
+struct checkpoint_task_t {
+    void*                input;       // 文件名或输入块
+    int                  index;       // 任务编号，决定检查点文件名
+    int                  done;        // 为1时检查点已存在，跳过映射
+    int                  failed;      // 为1时检查点写入失败
+    struct checkpoint_t* checkpoint;  // 所属作业的清单
+};
+
+static void checkpoint_path(char* path, size_t size, int index) {
+    snprintf(path, size, "%s/map-%05d", checkpoint_dir, index);
+}
+
+/**
+ * 任务在清单中的标识：文件名、文件大小和修改时间，输入块还有块的偏移和长度
+ * 输入文件在两次运行之间被改写时标识不同，旧的检查点不会被误用
+ */
+static void task_identity(char* id, size_t size, void* input) {
+    const char* file_name = current->chunk_mapper != NULL ? (( MR_Chunk* )input)->file_name : ( char* )input;
+    struct stat st;
+    if (stat(file_name, &st) < 0)
+        memset(&st, 0, sizeof(st));
+    int n = snprintf(id, size, "%s:%lld:%lld.%09ld", file_name, ( long long )st.st_size, ( long long )st.st_mtim.tv_sec, ( long )st.st_mtim.tv_nsec);
+    if (current->chunk_mapper != NULL && n >= 0 && ( size_t )n < size) {
+        MR_Chunk* chunk = ( MR_Chunk* )input;
+        snprintf(id + n, size - n, ":%ld:%ld", chunk->offset, chunk->length);
+    }
+}
+
+/**
+ * 读取清单，把编号和标识都与本次作业相同的任务标记为已完成
+ * 清单不存在或分区数不同时重新创建
+ *
+ * @return 成功返回0，无法创建清单返回-1
+ */
+static int open_checkpoint(struct checkpoint_t* checkpoint, struct checkpoint_task_t* tasks, int num_tasks) {
+    char path[4096];
+    char line[4096 + 64];
+    char id[4096];
+    snprintf(path, sizeof(path), "%s/manifest", checkpoint_dir);
+    pthread_mutex_init(&checkpoint->lock, NULL);
+
+    FILE* in         = fopen(path, "r");
+    int   partitions = -1;
+    if (in != NULL && fgets(line, sizeof(line), in) != NULL && sscanf(line, "mapreduce-checkpoint %d", &partitions) == 1
+        && partitions == current->num_partitions) {
+        while (fgets(line, sizeof(line), in) != NULL) {
+            int index;
+            int offset;
+            if (sscanf(line, "%d %n", &index, &offset) != 1 || index < 0 || index >= num_tasks)
+                continue;
+            line[strcspn(line, "\n")] = '\0';
+            task_identity(id, sizeof(id), tasks[index].input);
+            if (strcmp(line + offset, id) == 0)
+                tasks[index].done = 1;
+        }
+        checkpoint->manifest = fopen(path, "a");
+    } else {
+        checkpoint->manifest = fopen(path, "w");
+        if (checkpoint->manifest != NULL)
+            fprintf(checkpoint->manifest, "mapreduce-checkpoint %d\n", current->num_partitions);
+    }
+    if (in != NULL)
+        fclose(in);
+    if (checkpoint->manifest == NULL) {
+        fprintf(stderr, "mapreduce: cannot write checkpoint manifest '%s'\n", path);
+        pthread_mutex_destroy(&checkpoint->lock);
+        return -1;
+    }
+    fflush(checkpoint->manifest);
+    return 0;
+}
+
+/**
+ * 把任务分区的内容写成检查点文件
+ * 先写临时文件并fsync，再改名为正式文件名，最后把任务追加到清单，
+ * 进程在任何时刻崩溃都不会留下清单中记录了却不完整的检查点
+ *
+ * @return 成功返回0，否则返回-1
+ */
+static int write_checkpoint(struct checkpoint_task_t* task, struct partition_t* parts, struct run_list_t* runs) {
+    char path[4096];
+    char tmp[4096 + 8];
+    char id[4096];
+    checkpoint_path(path, sizeof(path), task->index);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    FILE* out = fopen(tmp, "w");
+    if (out == NULL)
+        return -1;
+    int failed = 0;
+    for (int i = 0; i < current->num_partitions && !failed; ++i)
+        failed = export_runs(&parts[i], &runs[i], out, compress_runs) < 0;
+    if (failed || fflush(out) != 0 || fsync(fileno(out)) < 0) {
+        fclose(out);
+        unlink(tmp);
+        return -1;
+    }
+    fclose(out);
+    if (rename(tmp, path) < 0)
+        return -1;
+
+    task_identity(id, sizeof(id), task->input);
+    pthread_mutex_lock(&task->checkpoint->lock);
+    fprintf(task->checkpoint->manifest, "%d %s\n", task->index, id);
+    failed = fflush(task->checkpoint->manifest) != 0 || fsync(fileno(task->checkpoint->manifest)) < 0;
+    pthread_mutex_unlock(&task->checkpoint->lock);
+    return failed ? -1 : 0;
+}
+
+/**
+ * 检查点模式下的映射任务函数
+ * 映射输出写入任务自己的一组分区，完成后写成检查点文件，
+ * 映射阶段结束后再由import_runs读入作业的分区
+ *
+ * @param arg 检查点任务
+ */
+static void MR_CheckpointAdapt(void* arg) {
+    struct checkpoint_task_t* task  = ( struct checkpoint_task_t* )arg;
+    int                       n     = current->num_partitions;
+    struct partition_t*       parts = ( struct partition_t* )malloc(sizeof(struct partition_t) * n);
+    struct run_list_t*        runs  = ( struct run_list_t* )malloc(sizeof(struct run_list_t) * n);
+    for (int i = 0; i < n; ++i) {
+        init_partition(&parts[i]);
+        init_runs(&runs[i]);
+    }
+
+    task_partitions = parts;
+    task_runs       = runs;
+    if (current->chunk_mapper != NULL)
+        map_chunk(( MR_Chunk* )task->input);
+    else
+        current->mapper(( char* )task->input);
+    MR_FlushEmits();
+    task_partitions = NULL;
+    task_runs       = NULL;
+    adapt_mappers();
+
+    if (write_checkpoint(task, parts, runs) < 0) {
+        fprintf(stderr, "mapreduce: cannot write checkpoint for task %d\n", task->index);
+        task->failed = 1;
+    }
+    for (int i = 0; i < n; ++i) {
+        free_partition(&parts[i]);
+        free_runs(&runs[i]);
+    }
+    free(parts);
+    free(runs);
+}
+
+/**
+ * 检查点模式的映射阶段：跳过清单中已完成的任务，其余任务映射后写检查点，
+ * 最后把全部检查点中的段读入作业的分区。作业成功结束后删除检查点
+ *
+ * @return 成功返回0；检查点无法写入或读回时返回-1
+ */
+static int map_with_checkpoints(struct threadpool_t* pool, void** inputs, int num_tasks) {
+    struct checkpoint_t       checkpoint;
+    struct checkpoint_task_t* tasks = ( struct checkpoint_task_t* )calloc(num_tasks + 1, sizeof(struct checkpoint_task_t));
+    for (int i = 0; i < num_tasks; ++i) {
+        tasks[i].input      = inputs[i];
+        tasks[i].index      = i;
+        tasks[i].checkpoint = &checkpoint;
+    }
+    if (open_checkpoint(&checkpoint, tasks, num_tasks) < 0) {
+        free(tasks);
+        return -1;
+    }
+
+    for (int i = 0; i < num_tasks; ++i) {
+        if (!tasks[i].done)
+            threadpool_submit(pool, MR_CheckpointAdapt, &tasks[i]);
+    }
+    threadpool_wait(pool);
+    fclose(checkpoint.manifest);
+    pthread_mutex_destroy(&checkpoint.lock);
+
+    int failed = 0;
+    for (int i = 0; i < num_tasks && !failed; ++i) {
+        char path[4096];
+        checkpoint_path(path, sizeof(path), i);
+        FILE* in = tasks[i].failed ? NULL : fopen(path, "r");
+        for (int p = 0; p < current->num_partitions && in != NULL && !failed; ++p)
+            failed = import_runs(&current->partition_runs[p], in) < 0;
+        if (in == NULL || failed) {
+            fprintf(stderr, "mapreduce: cannot read checkpoint '%s'\n", path);
+            failed = 1;
+        }
+        if (in != NULL)
+            fclose(in);
+    }
+    free(tasks);
+    return failed ? -1 : 0;
+}
+
+/**
+ * 作业成功结束后删除检查点文件和清单
+ */
+static void remove_checkpoints(int num_tasks) {
+    char path[4096];
+    for (int i = 0; i < num_tasks; ++i) {
+        checkpoint_path(path, sizeof(path), i);
+        unlink(path);
+    }
+    snprintf(path, sizeof(path), "%s/manifest", checkpoint_dir);
+    unlink(path);
+}
+
+/**
+ * MR_AUTO对应的线程数：在线的CPU数
+ */
+static int online_cpus(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? ( int )cpus : 1;
+}
+
+/**
+ * 准备作业的分区、线程池和统计信息，并把线程池的并发上限设为映射线程数
+ * 两个阶段共用一个线程池，通过并发上限区分映射线程数和归约线程数
+ *
+ * @return 作业的线程池
+ */
+static struct threadpool_t* begin_job(struct MR_Job* job, Mapper map, ChunkMapper chunk_map, int num_mappers, int num_reducers, Combiner combine, Partitioner partition) {
+    int auto_mappers = num_mappers <= 0;
+    if (auto_mappers)
+        num_mappers = online_cpus();
+    if (num_reducers <= 0)
+        num_reducers = online_cpus();
+    int num_threads = num_mappers > num_reducers ? num_mappers : num_reducers;
+    init_job(job, num_reducers * partitions_per_reducer, combine, partition);
+    job->num_reducers = num_reducers;
+    job->auto_mappers = auto_mappers;
+    job->max_mappers  = num_mappers;
+    job->adapt_at     = now_ns();
+    job->adapt_busy   = 0;
+    job->adapt_wait   = 0;
+
+    struct threadpool_t* pool = prepare_pool(job, num_threads);
+    reset_stats(job->num_partitions, pool->num_threads);
+    job->mapper       = map;
+    job->chunk_mapper = chunk_map;
+    threadpool_set_active(pool, num_mappers);
+    return pool;
+}
+
+/**
+ * 结束映射阶段：提交提前合并任务并等待全部映射任务完成
+ * 提前合并任务排在所有映射任务之后，由先完成映射的线程在其他映射线程仍在运行时执行
+ *
+ * @param phase_start 映射阶段的开始时间
+ */
+static void end_map_phase(struct MR_Job* job, struct threadpool_t* pool, unsigned long phase_start) {
+    if (pipelined && job->combiner != NULL) {
+        for (int i = 0; i < job->num_partitions; ++i)
+            threadpool_submit(pool, MR_PrecombineAdapt, ( void* )( long )i);
+    }
+    // 在条件变量上等待所有映射任务完成
+    threadpool_wait(pool);
+    stats.map_seconds = (now_ns() - phase_start) / 1e9;
+    stats.map_threads = pool->active;
+    for (int i = 0; i < job->num_partitions; ++i)
+        stats.bytes_allocated += partition_bytes(&job->partitions[i]);
+}
+
+/**
+ * 按中间结果字节数从大到小排列分区，每个归约线程一个任务依次领取，等待全部归约完成
+ * 归约持久化的映射输出时按文件中各分区的字节数排列
+ */
+static void run_reducers(struct MR_Job* job, struct threadpool_t* pool) {
+    int     n     = job->num_partitions;
+    size_t* bytes = ( size_t* )malloc(sizeof(size_t) * n);
+    for (int i = 0; i < n; ++i) {
+        if (job->saved != NULL) {
+            bytes[i] = job->saved->index[i].length;
+            continue;
+        }
+        struct run_list_t* runs = &job->partition_runs[i];
+        bytes[i]                = partition_bytes(&job->partitions[i]);
+        for (int j = 0; j < runs->count; ++j)
+            bytes[i] += runs->ends[j] - runs->starts[j];
+    }
+    job->reduce_order = ( int* )malloc(sizeof(int) * n);
+    job->next_reduce  = 0;
+    order_partitions(bytes, job->reduce_order, n);
+    free(bytes);
+
+    threadpool_set_active(pool, job->num_reducers);
+    for (int i = 0; i < job->num_reducers; ++i)
+        threadpool_submit(pool, MR_ReducerAdapt, ( void* )( long )i);
+    threadpool_wait(pool);
+    free(job->reduce_order);
+    job->reduce_order = NULL;
+}
+
+/**
+ * 把映射阶段的输出写到持久化文件，再把文件映射进来作为归约阶段的输入
+ * 每个分区的键按序编码成记录，经过与归约相同的路径，溢写段中的值也一并归并写出；
+ * 写出后分区被清空，归约阶段只读取文件
+ *
+ * @param out 已打开的映射输出文件，由这里关闭
+ * @param file 写出后映射进来的文件
+ * @return 成功返回0，写入或映射失败返回-1
+ */
+static int save_map_output(struct MR_Job* job, struct threadpool_t* pool, FILE* out, struct mapfile_t* file) {
+    int                     n     = job->num_partitions;
+    struct mapfile_index_t* index = ( struct mapfile_index_t* )calloc(n, sizeof(struct mapfile_index_t));
+    unsigned long           start = now_ns();
+    job->reducer                  = save_reduce;
+    run_reducers(job, pool);
+
+    int failed = mapfile_begin(out, n) < 0;
+    for (int i = 0; i < n && !failed; ++i) {
+        index[i].offset = ftell(out);
+        write_partition_output(i, out);
+        index[i].length   = ftell(out) - index[i].offset;
+        index[i].num_keys = stats.distinct_keys[i];
+    }
+    failed = failed || mapfile_finish(out, index, n) < 0;
+    failed = fclose(out) != 0 || failed;
+    free(index);
+
+    for (int i = 0; i < n; ++i) {
+        reset_partition(&job->partitions[i]);
+        arena_reset(&job->output_arenas[i]);
+        job->partition_outputs[i].len = 0;
+        stats.distinct_keys[i]        = 0;
+    }
+    job->shuffle_ns += now_ns() - start;
+    if (failed || mapfile_open(file, map_output_file) < 0)
+        return -1;
+    job->saved = file;
+    return 0;
+}
+
+/**
+ * 执行归约阶段并写出结果
+ * 分区按内存中和溢写段中的中间结果字节数从大到小排列，
+ * 每个归约线程一个任务，从中动态领取分区，排序后依次归约其中所有键
+ *
+ * @return 作业已被取消、没有写出结果时返回1，否则返回0
+ */
+static int reduce_phase(struct MR_Job* job, struct threadpool_t* pool, Reducer reduce) {
+    job->reducer = reduce;
+
+    unsigned long phase_start = now_ns();
+    reset_topk(topk_k);
+    if (topk_k > 0) {
+        job->topk_heaps = ( struct topk_t* )malloc(sizeof(struct topk_t) * job->num_reducers);
+        for (int i = 0; i < job->num_reducers; ++i)
+            topk_init(&job->topk_heaps[i], topk_k);
+    }
+
+    run_reducers(job, pool);
+    if (job->topk_heaps != NULL) {
+        for (int i = 0; i < job->num_reducers; ++i) {
+            topk_merge(&topk_result, &job->topk_heaps[i]);
+            topk_free(&job->topk_heaps[i]);
+        }
+        free(job->topk_heaps);
+        job->topk_heaps = NULL;
+    }
+    stats.reduce_seconds    = (now_ns() - phase_start) / 1e9;
+    stats.shuffle_seconds   = job->shuffle_ns / 1e9;
+    stats.lock_wait_seconds = job->lock_wait_ns / 1e9;
+    for (int i = 0; i < pool->num_threads; ++i)
+        stats.thread_busy_seconds[i] = pool->busy_ns[i] / 1e9;
+
+    // 取消的作业只有部分结果，不写出
+    if (__atomic_load_n(&job->cancelled, __ATOMIC_RELAXED))
+        return 1;
+    write_outputs();
+    if (topk_k > 0)
+        write_topk();
+    return 0;
+}
+
+/**
+ * 流式输入的读取状态，限制已读出但尚未映射完的块数，读取速度快于映射时阻塞读取
+ */
+struct stream_t {
+    pthread_mutex_t lock;
+    pthread_cond_t  room;       // 有块映射完成时通知
+    int             in_flight;  // 已提交但尚未映射完的块数
+};
+
+/**
+ * 流式输入的一个块，数据紧跟在结构体之后，映射完成后释放
+ */
+struct stream_chunk_t {
+    MR_Chunk         chunk;
+    struct stream_t* stream;
+};
+
+/**
+ * 流式块的映射任务函数
+ *
+ * @param arg 流式块
+ */
+static void MR_StreamMapperAdapt(void* arg) {
+    struct stream_chunk_t* chunk  = ( struct stream_chunk_t* )arg;
+    struct stream_t*       stream = chunk->stream;
+    MR_ChunkMapperAdapt(&chunk->chunk);
+    free(chunk);
+
+    pthread_mutex_lock(&stream->lock);
+    stream->in_flight--;
+    pthread_cond_signal(&stream->room);
+    pthread_mutex_unlock(&stream->lock);
+}
+
+/**
+ * 从流中读出下一个以换行符结尾的块
+ * 直接从文件描述符读取，读满chunk_size字节时在最后一个换行符处截断，剩余的半行留到下一块；
+ * 读取不足且输入空闲超过STREAM_IDLE_MS时，不等读满就提交已读到的完整行，
+ * 慢速的管道不会让已到达的数据一直等在缓冲区中。
+ * 超过chunk_size的长行会继续读取直到遇到换行符，流结束时剩余的内容单独成块
+ *
+ * @param carry 上一块截断后剩余的半行，返回时更新
+ * @param offset 块在流中的起始偏移，返回时前移到下一块
+ * @param failed 读取出错时置1，出错前读到的内容照常返回
+ * @return 返回新块，流已读完返回NULL
+ */
+static struct stream_chunk_t* read_stream_chunk(int fd, long chunk_size, char** carry, size_t* carry_len, long* offset, int* failed) {
+    size_t                 cap   = *carry_len + chunk_size;
+    struct stream_chunk_t* chunk = ( struct stream_chunk_t* )malloc(sizeof(struct stream_chunk_t) + cap);
+    char*                  data  = ( char* )(chunk + 1);
+    size_t                 len   = *carry_len;
+    size_t                 cut   = 0;
+    if (len > 0)
+        memcpy(data, *carry, len);
+
+    for (;;) {
+        ssize_t n = read(fd, data + len, cap - len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            if (n < 0)
+                *failed = 1;
+            cut = len;
+            break;
+        }
+        // 只需在新读到的部分中查找，剩余的半行中没有换行符
+        for (char* p = data + len + n; p > data + len; --p) {
+            if (p[-1] == '\n') {
+                cut = p - data;
+                break;
+            }
+        }
+        int short_read = ( size_t )n < cap - len;
+        len += n;
+        if (cut > 0 && len >= ( size_t )chunk_size)
+            break;
+        if (cut > 0 && short_read) {
+            struct pollfd pfd = { .fd = fd, .events = POLLIN };
+            if (poll(&pfd, 1, STREAM_IDLE_MS) == 0)
+                break;
+        }
+        if (len == cap) {
+            cap *= 2;
+            chunk = ( struct stream_chunk_t* )realloc(chunk, sizeof(struct stream_chunk_t) + cap);
+            data  = ( char* )(chunk + 1);
+        }
+    }
+    if (len == 0) {
+        free(chunk);
+        *carry_len = 0;
+        return NULL;
+    }
+
+    *carry_len = len - cut;
+    *carry     = ( char* )realloc(*carry, *carry_len > 0 ? *carry_len : 1);
+    memcpy(*carry, data + cut, *carry_len);
+    chunk->chunk.file_name   = "-";
+    chunk->chunk.offset      = *offset;
+    chunk->chunk.length      = cut;
+    chunk->chunk.data        = data;
+    chunk->chunk.compression = INPUT_PLAIN;
+    *offset += cut;
+    return chunk;
+}
+
+/**
+ * 提交一个流式块，已提交未完成的块达到上限时等待
+ */
+static void submit_stream_chunk(struct threadpool_t* pool, struct stream_t* stream, struct stream_chunk_t* chunk, int max_in_flight) {
+    pthread_mutex_lock(&stream->lock);
+    while (stream->in_flight >= max_in_flight)
+        pthread_cond_wait(&stream->room, &stream->lock);
+    stream->in_flight++;
+    pthread_mutex_unlock(&stream->lock);
+    chunk->stream = stream;
+    threadpool_submit(pool, MR_StreamMapperAdapt, chunk);
+}
+
+/**
+ * 以流为输入运行一个作业
+ * 调用线程读取并切分输入，每读出一块就提交给映射线程，读取与映射重叠进行；
+ * 采样分区先读出开头的若干块采样，再提交这些块
+ */
+static void run_stream(struct MR_Job* job, FILE* in, ChunkMapper map, long chunk_size, int num_mappers, Reducer reduce, int num_reducers, Combiner combine, Partitioner partition) {
+    struct threadpool_t* pool = begin_job(job, NULL, map, num_mappers, num_reducers, combine, partition);
+
+    struct stream_t stream;
+    pthread_mutex_init(&stream.lock, NULL);
+    pthread_cond_init(&stream.room, NULL);
+    stream.in_flight = 0;
+
+    int                    max_in_flight = 2 * pool->num_threads;
+    int                    fd            = fileno(in);
+    int                    failed        = 0;
+    char*                  carry         = NULL;
+    size_t                 carry_len     = 0;
+    long                   offset        = 0;
+    struct stream_chunk_t* chunk;
+
+    unsigned long phase_start = now_ns();
+    if (partition == MR_SampledPartition) {
+        void* head[SAMPLE_TASKS];
+        int   num_head = 0;
+        while (num_head < SAMPLE_TASKS && (chunk = read_stream_chunk(fd, chunk_size, &carry, &carry_len, &offset, &failed)) != NULL)
+            head[num_head++] = chunk;
+        compute_splits(job, pool, head, num_head);
+        stats.sample_seconds = (now_ns() - phase_start) / 1e9;
+        phase_start          = now_ns();
+        // 开头的块已在内存中，不计入在途上限
+        for (int i = 0; i < num_head; ++i)
+            submit_stream_chunk(pool, &stream, ( struct stream_chunk_t* )head[i], max_in_flight + num_head);
+    }
+    while ((chunk = read_stream_chunk(fd, chunk_size, &carry, &carry_len, &offset, &failed)) != NULL)
+        submit_stream_chunk(pool, &stream, chunk, max_in_flight);
+    if (failed)
+        fprintf(stderr, "mapreduce: error reading input stream\n");
+    free(carry);
+
+    end_map_phase(job, pool, phase_start);
+    pthread_mutex_destroy(&stream.lock);
+    pthread_cond_destroy(&stream.room);
+
+    reduce_phase(job, pool, reduce);
+    finish_job(job);
+}
+
+/**
+ * 在作业上下文中执行一个MapReduce作业
+ * 映射函数map与分块映射函数chunk_map二者只设其一
+ *
+ * @return 作业因取消而提前结束、没有写出结果时返回1，否则返回0
+ */
+static int run_job(struct MR_Job* job, int argc, char* argv[], Mapper map, ChunkMapper chunk_map, long chunk_size, int num_mappers, Reducer reduce, int num_reducers, Combiner combine, Partitioner partition, ValueComparator compare) {
+    // 先打开映射输出文件，无法创建时在映射之前就报错
+    FILE* out = NULL;
+    if (map_output_file != NULL && (out = fopen(map_output_file, "w")) == NULL) {
+        fprintf(stderr, "mapreduce: cannot open map output file '%s'\n", map_output_file);
+        return 0;
+    }
+
+    struct threadpool_t* pool = begin_job(job, map, chunk_map, num_mappers, num_reducers, combine, partition);
+    job->value_compare        = compare;
+    job->chunk_size           = chunk_size;
+
+    // 每个输入文件或输入块作为一个映射任务
+    // 先切分全部文件再提交，块数组扩容不会使已提交的任务参数失效
+    MR_Chunk* chunks     = NULL;
+    int       num_chunks = 0;
+    int       chunks_cap = 0;
+    int       num_tasks  = argc - 1;
+    void**    tasks      = ( void** )argv + 1;
+    if (chunk_map != NULL) {
+        for (int i = 1; i < argc; ++i) {
+            if (split_file(argv[i], chunk_size, &chunks, &num_chunks, &chunks_cap) < 0)
+                fprintf(stderr, "mapreduce: cannot open file '%s'\n", argv[i]);
+        }
+        num_tasks = num_chunks;
+        tasks     = ( void** )malloc(sizeof(void*) * (num_chunks + 1));
+        for (int i = 0; i < num_chunks; ++i)
+            tasks[i] = &chunks[i];
+    }
+
+    // 采样分区在映射阶段之前先确定分界键
+    unsigned long phase_start = now_ns();
+    if (partition == MR_SampledPartition && num_tasks > 0) {
+        compute_splits(job, pool, tasks, num_tasks);
+        stats.sample_seconds = (now_ns() - phase_start) / 1e9;
+    }
+
+    // 执行映射阶段
+    phase_start = now_ns();
+    if (checkpoint_dir != NULL) {
+        // 检查点不完整时无法得到正确结果，保留已有的检查点供重启后继续
+        if (map_with_checkpoints(pool, tasks, num_tasks) < 0) {
+            fprintf(stderr, "mapreduce: map phase failed, restart the job to resume from the checkpoints\n");
+            exit(1);
+        }
+    } else {
+        for (int i = 0; i < num_tasks; ++i)
+            threadpool_submit(pool, chunk_map != NULL ? MR_ChunkMapperAdapt : MR_MapperAdapt, tasks[i]);
+    }
+    end_map_phase(job, pool, phase_start);
+    if (chunk_map != NULL)
+        free(tasks);
+    free(chunks);
+    // 只映射的作业在映射阶段结束时已经决定了结果是否完整
+    int stopped = reduce == NULL && __atomic_load_n(&job->cancelled, __ATOMIC_RELAXED);
+
+    // 保存映射输出时归约阶段改为读取写出的文件
+    struct mapfile_t file;
+    if (out != NULL && save_map_output(job, pool, out, &file) < 0) {
+        fprintf(stderr, "mapreduce: cannot write map output file '%s'\n", map_output_file);
+        exit(1);
+    }
+    if (reduce != NULL)
+        stopped = reduce_phase(job, pool, reduce);
+    if (job->saved != NULL) {
+        mapfile_close(&file);
+        job->saved = NULL;
+    }
+    if (checkpoint_dir != NULL)
+        remove_checkpoints(num_tasks);
+    finish_job(job);
+    return stopped;
+}
+
+/**
+ * 连接作业的一个映射任务：输入文件及其所属的一侧
+ */
+struct join_task_t {
+    char* file_name;
+    char  side;  // JOIN_LEFT或JOIN_RIGHT
+};
+
+/**
+ * 连接作业的映射任务函数，发射的值带上任务所属一侧的标记
+ *
+ * @param arg 连接任务
+ */
+static void MR_JoinMapperAdapt(void* arg) {
+    struct join_task_t* task = ( struct join_task_t* )arg;
+    join_side                = task->side;
+    if (task->side == JOIN_LEFT)
+        current->mapper(task->file_name);
+    else
+        current->right_mapper(task->file_name);
+    MR_FlushEmits();
+    join_side = 0;
+}
+
+/**
+ * 只比较标记字节，使一个键的左侧值排在右侧值之前
+ */
+static int compare_join_side(const char* a, const char* b) {
+    return ( unsigned char )a[0] - ( unsigned char )b[0];
+}
+
+/**
+ * 左侧取值函数：依次返回当前键的左侧值，遇到第一个右侧值时留给右侧取值函数
+ */
+static char* join_next_left(char* key, int partition_number) {
+    if (join_peek != NULL)
+        return NULL;
+    char* value = MR_GetNext(key, partition_number);
+    if (value == NULL)
+        return NULL;
+    if (value[0] == JOIN_RIGHT) {
+        join_peek = value;
+        return NULL;
+    }
+    return value + 1;
+}
+
+/**
+ * 右侧取值函数：跳过尚未读出的左侧值，依次返回当前键的右侧值
+ * 值已按标记分组，左侧值后面才是右侧值
+ */
+static char* join_next_right(char* key, int partition_number) {
+    char* value = join_peek;
+    join_peek   = NULL;
+    while (value == NULL || value[0] != JOIN_RIGHT) {
+        if ((value = MR_GetNext(key, partition_number)) == NULL)
+            return NULL;
+    }
+    return value + 1;
+}
+
+/**
+ * 连接作业交给框架的归约函数，以左右两个取值函数调用用户的连接归约函数
+ */
+static void join_reduce(char* key, Getter get_next, int partition_number) {
+    ( void )get_next;  // 值由join_next_left和join_next_right分两侧取出
+    join_peek = NULL;
+    current->join_reducer(key, join_next_left, join_next_right, partition_number);
+    join_peek = NULL;
+}
+
+/**
+ * 运行一个连接作业
+ * 左右两侧的每个输入文件各作为一个映射任务；一个键的值在归约前按标记排序，
+ * 左侧值在前、右侧值在后，归约函数通过两个取值函数分别读取
+ */
+static void run_join(struct MR_Job* job, int num_left, char* left[], Mapper map_left, int num_right, char* right[], Mapper map_right, int num_mappers, JoinReducer reduce, int num_reducers, Partitioner partition) {
+    struct threadpool_t* pool = begin_job(job, map_left, NULL, num_mappers, num_reducers, NULL, partition);
+    job->right_mapper         = map_right;
+    job->value_compare        = compare_join_side;
+    job->join_reducer         = reduce;
+
+    int                 num_tasks = num_left + num_right;
+    struct join_task_t* tasks     = ( struct join_task_t* )malloc(sizeof(struct join_task_t) * (num_tasks + 1));
+    for (int i = 0; i < num_tasks; ++i) {
+        tasks[i].file_name = i < num_left ? left[i] : right[i - num_left];
+        tasks[i].side      = i < num_left ? JOIN_LEFT : JOIN_RIGHT;
+    }
+
+    unsigned long phase_start = now_ns();
+    for (int i = 0; i < num_tasks; ++i)
+        threadpool_submit(pool, MR_JoinMapperAdapt, &tasks[i]);
+    end_map_phase(job, pool, phase_start);
+    free(tasks);
+
+    reduce_phase(job, pool, join_reduce);
+    finish_job(job);
+}
+
+/**
+ * 近似计数作业的映射任务函数，发射的键累加到执行线程自己的草图
+ *
+ * @param arg 输入文件名
+ */
+static void MR_SketchMapperAdapt(void* arg) {
+    sketch = &current->sketches[threadpool_self()];
+    current->mapper(( char* )arg);
+    sketch = NULL;
+}
+
+/**
+ * 运行一个近似计数作业
+ * 映射线程各自维护草图和高频键表，全部映射任务完成后按计数器相加合并，
+ * 各线程的高频键在合并后的草图上重新估计，估计值最大的heavy个写入前K结果
+ */
+static void run_sketch(struct MR_Job* job, int argc, char* argv[], Mapper map, int num_mappers, int width, int depth, int heavy) {
+    struct threadpool_t* pool = begin_job(job, map, NULL, num_mappers, 1, NULL, NULL);
+    int                  n    = pool->num_threads;
+    job->sketches             = ( struct sketch_t* )malloc(sizeof(struct sketch_t) * n);
+    for (int i = 0; i < n; ++i)
+        sketch_init(&job->sketches[i], width, depth, heavy);
+
+    unsigned long phase_start = now_ns();
+    for (int i = 1; i < argc; ++i)
+        threadpool_submit(pool, MR_SketchMapperAdapt, argv[i]);
+    end_map_phase(job, pool, phase_start);
+
+    // 合并阶段计入归约时间
+    phase_start = now_ns();
+    sketch_free(&sketch_result);
+    sketch_init(&sketch_result, width, depth, 0);
+    for (int i = 0; i < n; ++i)
+        sketch_merge(&sketch_result, &job->sketches[i]);
+    reset_topk(heavy);
+    sketch_heavy_hitters(&sketch_result, job->sketches, n, &topk_result);
+    for (int i = 0; i < n; ++i)
+        sketch_free(&job->sketches[i]);
+    free(job->sketches);
+    job->sketches        = NULL;
+    stats.reduce_seconds = (now_ns() - phase_start) / 1e9;
+    for (int i = 0; i < pool->num_threads; ++i)
+        stats.thread_busy_seconds[i] = pool->busy_ns[i] / 1e9;
+
+    if (heavy > 0)
+        write_topk();
+    finish_job(job);
+}
+
+/**
+ * 只运行归约阶段：分区数取自文件，归约函数按文件中的记录依次读取每个键的值
+ */
+static void run_reduce_only(struct MR_Job* job, const char* path, Reducer reduce, int num_reducers) {
+    struct mapfile_t file;
+    if (mapfile_open(&file, path) < 0) {
+        fprintf(stderr, "mapreduce: cannot read map output file '%s'\n", path);
+        return;
+    }
+    init_job(job, file.num_partitions, NULL, NULL);
+    job->num_reducers         = num_reducers;
+    struct threadpool_t* pool = prepare_pool(job, num_reducers);
+    reset_stats(job->num_partitions, pool->num_threads);
+    job->saved = &file;
+    reduce_phase(job, pool, reduce);
+    job->saved = NULL;
+    mapfile_close(&file);
+    finish_job(job);
+}
+
+/**
+ * 创建作业上下文
+ * 线程池和分区在第一次运行时创建，之后的作业复用，直到MR_JobDestroy
+ *
+ * @return 作业上下文
+ */
+MR_Job* MR_JobCreate(void) {
+    return ( MR_Job* )calloc(1, sizeof(MR_Job));
+}
+
+/**
+ * 在作业上下文中运行一个作业，参数同MR_RunWithCombiner
+ */
+void MR_JobRun(MR_Job* job, int argc, char* argv[], Mapper map, int num_mappers, Reducer reduce, int num_reducers, Combiner combine, Partitioner partition) {
+    run_job(job, argc, argv, map, NULL, 0, num_mappers, reduce, num_reducers, combine, partition, NULL);
+}
+
+/**
+ * 在作业上下文中运行一个值排序的作业，参数同MR_RunSorted
+ */
+void MR_JobRunSorted(MR_Job* job, int argc, char* argv[], Mapper map, int num_mappers, Reducer reduce, int num_reducers, Combiner combine, Partitioner partition, ValueComparator compare) {
+    run_job(job, argc, argv, map, NULL, 0, num_mappers, reduce, num_reducers, combine, partition, compare);
+}
+
+/**
+ * 在作业上下文中运行一个分块作业，参数同MR_RunChunked
+ */
+void MR_JobRunChunked(MR_Job* job, int argc, char* argv[], ChunkMapper map, int num_mappers, Reducer reduce, int num_reducers, Combiner combine, Partitioner partition, long chunk_size) {
+    run_job(job, argc, argv, NULL, map, chunk_size > 0 ? chunk_size : 1, num_mappers, reduce, num_reducers, combine, partition, NULL);
+}
+
+/**
+ * 在作业上下文中运行一个流式作业，参数同MR_RunStream
+ */
+void MR_JobRunStream(MR_Job* job, FILE* in, ChunkMapper map, int num_mappers, Reducer reduce, int num_reducers, Combiner combine, Partitioner partition, long chunk_size) {
+    run_stream(job, in, map, chunk_size > 0 ? chunk_size : 1, num_mappers, reduce, num_reducers, combine, partition);
+}
+
+/**
+ * 在作业上下文中对持久化的映射输出只运行归约阶段，参数同MR_RunReduceOnly
+ */
+void MR_JobRunReduceOnly(MR_Job* job, const char* path, Reducer reduce, int num_reducers) {
+    run_reduce_only(job, path, reduce, num_reducers > 0 ? num_reducers : online_cpus());
+}
+
+/**
+ * 回收作业上下文的工作线程并释放全部分区和分配器
+ */
+void MR_JobDestroy(MR_Job* job) {
+    if (job->pool != NULL)
+        threadpool_destroy(job->pool);
+    release_partitions(job);
+    free_topology(&job->topology);
+    free(job);
+}
+
+/**
+ * 提交的作业：MR_RunWithCombiner的参数及其状态，状态由dispatcher.lock保护
+ */
+struct MR_Handle {
+    int               argc;
+    char**            argv;
+    Mapper            map;
+    int               num_mappers;
+    Reducer           reduce;
+    int               num_reducers;
+    Combiner          combine;
+    Partitioner       partition;
+    int               state;  // MR_JOB_QUEUED等
+    struct MR_Handle* next;   // 等待队列中的下一个作业
+};
+
+/**
+ * 后台调度线程：按提交顺序逐个运行作业，所有作业共用同一个作业上下文，
+ * 线程池和预热过的分区在作业之间保留
+ */
+static struct {
+    pthread_mutex_t   lock;
+    pthread_cond_t    changed;  // 有新作业提交或有作业状态改变时广播
+    struct MR_Handle* head;     // 等待队列头
+    struct MR_Handle* tail;     // 等待队列尾
+    struct MR_Handle* running;  // 正在运行的作业
+    MR_Job*           job;      // 共用的作业上下文
+    int               started;  // 为1时调度线程已启动
+} dispatcher = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, NULL, NULL, 0};
+
+/**
+ * 调度线程主循环：取出队列头的作业运行，结束后更新状态并通知等待者
+ * 取消请求来得太晚、结果已经写出的作业仍算作完成
+ */
+static void* dispatch_loop(void* arg) {
+    ( void )arg;
+    pthread_mutex_lock(&dispatcher.lock);
+    for (;;) {
+        while (dispatcher.head == NULL)
+            pthread_cond_wait(&dispatcher.changed, &dispatcher.lock);
+        struct MR_Handle* handle = dispatcher.head;
+        dispatcher.head          = handle->next;
+        if (dispatcher.head == NULL)
+            dispatcher.tail = NULL;
+        handle->state             = MR_JOB_RUNNING;
+        dispatcher.running        = handle;
+        dispatcher.job->cancelled = 0;
+        pthread_cond_broadcast(&dispatcher.changed);
+        pthread_mutex_unlock(&dispatcher.lock);
+
+        int stopped = run_job(dispatcher.job, handle->argc, handle->argv, handle->map, NULL, 0, handle->num_mappers, handle->reduce, handle->num_reducers, handle->combine, handle->partition, NULL);
+
+        pthread_mutex_lock(&dispatcher.lock);
+        handle->state      = stopped ? MR_JOB_CANCELLED : MR_JOB_DONE;
+        dispatcher.running = NULL;
+        pthread_cond_broadcast(&dispatcher.changed);
+    }
+    return NULL;
+}
+
+/**
+ * 异步提交一个作业，立即返回句柄，参数同MR_RunWithCombiner
+ * 作业在后台调度线程上按提交顺序逐个运行，不会并发执行，运行时读取当时的MR_Set*设置；
+ * argv及其中的字符串需保持有效直到作业结束
+ *
+ * @return 作业句柄，需要用MR_Wait释放；无法启动调度线程时返回NULL
+ */
+MR_Handle* MR_Submit(int argc, char* argv[], Mapper map, int num_mappers, Reducer reduce, int num_reducers, Combiner combine, Partitioner partition) {
+    struct MR_Handle* handle = ( struct MR_Handle* )malloc(sizeof(struct MR_Handle));
+    handle->argc             = argc;
+    handle->argv             = argv;
+    handle->map              = map;
+    handle->num_mappers      = num_mappers;
+    handle->reduce           = reduce;
+    handle->num_reducers     = num_reducers;
+    handle->combine          = combine;
+    handle->partition        = partition;
+    handle->state            = MR_JOB_QUEUED;
+    handle->next             = NULL;
+
+    pthread_mutex_lock(&dispatcher.lock);
+    if (!dispatcher.started) {
+        pthread_t thread;
+        dispatcher.job = MR_JobCreate();
+        if (pthread_create(&thread, NULL, dispatch_loop, NULL) != 0) {
+            MR_JobDestroy(dispatcher.job);
+            dispatcher.job = NULL;
+            pthread_mutex_unlock(&dispatcher.lock);
+            free(handle);
+            return NULL;
+        }
+        pthread_detach(thread);
+        dispatcher.started = 1;
+    }
+    if (dispatcher.tail == NULL)
+        dispatcher.head = handle;
+    else
+        dispatcher.tail->next = handle;
+    dispatcher.tail = handle;
+    pthread_cond_broadcast(&dispatcher.changed);
+    pthread_mutex_unlock(&dispatcher.lock);
+    return handle;
+}
+
+/**
+ * 返回作业的当前状态，不阻塞
+ *
+ * @return MR_JOB_QUEUED、MR_JOB_RUNNING、MR_JOB_DONE或MR_JOB_CANCELLED
+ */
+int MR_Poll(MR_Handle* handle) {
+    pthread_mutex_lock(&dispatcher.lock);
+    int state = handle->state;
+    pthread_mutex_unlock(&dispatcher.lock);
+    return state;
+}
+
+/**
+ * 阻塞等待作业结束并释放句柄
+ *
+ * @return 作业完成返回0，被取消返回-1
+ */
+int MR_Wait(MR_Handle* handle) {
+    pthread_mutex_lock(&dispatcher.lock);
+    while (handle->state == MR_JOB_QUEUED || handle->state == MR_JOB_RUNNING)
+        pthread_cond_wait(&dispatcher.changed, &dispatcher.lock);
+    int state = handle->state;
+    pthread_mutex_unlock(&dispatcher.lock);
+    free(handle);
+    return state == MR_JOB_DONE ? 0 : -1;
+}
+
+/**
+ * 取消作业：排队中的作业直接出队，不再运行；
+ * 运行中的作业不再开始新的映射任务和新的键，已在执行的映射和归约函数照常返回，
+ * 作业随后结束且不写出结果；结果已写出后才到达的取消不改变作业的完成状态。句柄仍需用MR_Wait释放
+ *
+ * @return 已取消或已请求取消返回0，作业已经结束返回-1
+ */
+int MR_Cancel(MR_Handle* handle) {
+    int result = 0;
+    pthread_mutex_lock(&dispatcher.lock);
+    if (handle->state == MR_JOB_QUEUED) {
+        struct MR_Handle** link = &dispatcher.head;
+        while (*link != handle)
+            link = &(*link)->next;
+        *link = handle->next;
+        if (dispatcher.tail == handle) {
+            dispatcher.tail = NULL;
+            for (struct MR_Handle* h = dispatcher.head; h != NULL; h = h->next)
+                dispatcher.tail = h;
+        }
+        handle->state = MR_JOB_CANCELLED;
+        pthread_cond_broadcast(&dispatcher.changed);
+    } else if (handle->state == MR_JOB_RUNNING) {
+        __atomic_store_n(&dispatcher.job->cancelled, 1, __ATOMIC_RELAXED);
+    } else {
+        result = -1;
+    }
+    pthread_mutex_unlock(&dispatcher.lock);
+    return result;
+}
+
+/**
+ * 带映射端合并的MapReduce执行函数
+ * 映射线程缓冲区中相同键的值在提交到分区前先由combine合并，
+ * 合并结果通过MR_EmitToReducer输出
+ *
+ * @param combine 用户定义的合并函数，为NULL时等价于MR_Run
+ * 其余参数同MR_Run
+ */
+void MR_RunWithCombiner(int argc, char* argv[], Mapper map, int num_mappers, Reducer reduce, int num_reducers, Combiner combine, Partitioner partition) {
+    MR_Job* job = MR_JobCreate();
+    MR_JobRun(job, argc, argv, map, num_mappers, reduce, num_reducers, combine, partition);
+    MR_JobDestroy(job);
+}
+
+/**
+ * 值排序的MapReduce执行函数
+ * 每个键的字符串值按compare排序后再交给归约函数，时间序列、连接等需要有序值的归约
+ * 可以边读边处理，不必自己缓存排序。排序在领取该键的归约线程上进行，各线程并行；
+ * 有溢写段的分区先把该键在各段和内存中的值全部读出，排序后再依次返回
+ *
+ * @param compare 值比较函数，返回值的含义同strcmp
+ * 其余参数同MR_RunWithCombiner
+ */
+void MR_RunSorted(int argc, char* argv[], Mapper map, int num_mappers, Reducer reduce, int num_reducers, Combiner combine, Partitioner partition, ValueComparator compare) {
+    MR_Job* job = MR_JobCreate();
+    MR_JobRunSorted(job, argc, argv, map, num_mappers, reduce, num_reducers, combine, partition, compare);
+    MR_JobDestroy(job);
+}
+
+/**
+ * 对两个数据集按键做归约端连接的MapReduce执行函数
+ * left中的文件由map_left映射，right中的文件由map_right映射，发射的值按来源打上标记；
+ * 归约时每个键调用一次reduce，它通过left和right两个取值函数分别读取该键来自两侧的值，
+ * 不必自己把值拷贝到临时数组中再区分来源
+ *
+ * @param num_left 左侧输入文件数
+ * @param left 左侧输入文件名数组
+ * @param map_left 左侧的映射函数
+ * @param num_right 右侧输入文件数
+ * @param right 右侧输入文件名数组
+ * @param map_right 右侧的映射函数
+ * @param reduce 用户定义的连接归约函数
+ * 其余参数同MR_Run
+ */
+void MR_RunJoin(int num_left, char* left[], Mapper map_left, int num_right, char* right[], Mapper map_right, int num_mappers, JoinReducer reduce, int num_reducers, Partitioner partition) {
+    MR_Job* job = MR_JobCreate();
+    run_join(job, num_left, left, map_left, num_right, right, map_right, num_mappers, reduce, num_reducers, partition);
+    MR_JobDestroy(job);
+}
+
+/**
+ * 近似计数的MapReduce执行函数，一遍扫描、内存有界地统计键的出现次数
+ * 映射函数照常发射，MR_Emit和MR_EmitN每次计1，MR_EmitInt64和MR_EmitInt64N累加其值（负值计0）；
+ * 键不进入分区，也没有归约阶段，每个映射线程只占用width*depth个计数器和heavy个键。
+ * 作业结束后估计值最大的heavy个键按"键 估计值"写出并可由MR_GetTopK读取，
+ * 任意键的估计值可由MR_SketchEstimate查询。估计值不小于真实值，
+ * 以1-(1/2)^depth的概率高估不超过总计数的2/width
+ *
+ * @param width 每行的计数器数，向上取整为2的幂
+ * @param depth 行数，即每个键更新的计数器数
+ * @param heavy 跟踪并输出的高频键个数，0表示不跟踪
+ * 其余参数同MR_Run
+ */
+void MR_RunSketch(int argc, char* argv[], Mapper map, int num_mappers, int width, int depth, int heavy) {
+    MR_Job* job = MR_JobCreate();
+    run_sketch(job, argc, argv, map, num_mappers, width > 0 ? width : 1, depth, heavy);
+    MR_JobDestroy(job);
+}
+
+/**
+ * 估计键在最近一次近似计数作业中的计数，尚未运行过近似计数作业时返回0
+ *
+ * @param key 键
+ */
+int64_t MR_SketchEstimate(const char* key) {
+    if (sketch_result.counts == NULL)
+        return 0;
+    return ( int64_t )sketch_estimate(&sketch_result, hash_key_n(key, strlen(key)));
+}
+
+/**
+ * 对MR_SetMapOutputFile保存的映射输出只运行归约阶段，省去重新映射
+ * 文件用mmap映射，每个分区由一个归约线程按记录顺序归约，键和值直接指向映射中的字节，
+ * 在归约函数返回前有效；分区数与保存时相同，MR_Output按分区写出
+ *
+ * @param path 映射输出文件
+ * @param reduce 用户定义的归约函数
+ * @param num_reducers 归约线程数
+ */
+void MR_RunReduceOnly(const char* path, Reducer reduce, int num_reducers) {
+    MR_Job* job = MR_JobCreate();
+    MR_JobRunReduceOnly(job, path, reduce, num_reducers);
+    MR_JobDestroy(job);
+}
+
+/**
+ * 按字节范围切分输入的MapReduce执行函数
+ * 每个输入文件被切分为约chunk_size字节、以换行符结尾的块，
+ * 每块作为一个映射任务，单个大文件也能由多个映射线程并行处理
+ *
+ * @param map 用户定义的分块映射函数，参数块的offset和length给出要处理的字节范围
+ * @param combine 用户定义的合并函数，可为NULL
+ * @param chunk_size 名义块大小（字节）
+ * 其余参数同MR_Run
+ */
+void MR_RunChunked(int argc, char* argv[], ChunkMapper map, int num_mappers, Reducer reduce, int num_reducers, Combiner combine, Partitioner partition, long chunk_size) {
+    MR_Job* job = MR_JobCreate();
+    MR_JobRunChunked(job, argc, argv, map, num_mappers, reduce, num_reducers, combine, partition, chunk_size);
+    MR_JobDestroy(job);
+}
+
+/**
+ * 以流为输入的MapReduce执行函数，如标准输入或管道
+ * 输入不必先落盘：框架边读边切分为约chunk_size字节、以换行符结尾的块，
+ * 每读满一块就交给映射线程，映射函数通过MR_MapInput访问块中的数据
+ *
+ * @param in 输入流，读到文件结束为止
+ * @param map 用户定义的分块映射函数
+ * @param combine 用户定义的合并函数，可为NULL
+ * @param chunk_size 名义块大小（字节）
+ * 其余参数同MR_Run
+ */
+void MR_RunStream(FILE* in, ChunkMapper map, int num_mappers, Reducer reduce, int num_reducers, Combiner combine, Partitioner partition, long chunk_size) {
+    MR_Job* job = MR_JobCreate();
+    MR_JobRunStream(job, in, map, num_mappers, reduce, num_reducers, combine, partition, chunk_size);
+    MR_JobDestroy(job);
+}
+
+/**
+ * 多进程模式下映射进程w为分区p写出的段文件路径
+ */
+static void map_output_path(char* path, size_t size, pid_t job, int worker, int partition_id) {
+    const char* dir = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+    snprintf(path, size, "%s/mr-%d-map-%d-%05d", dir, ( int )job, worker, partition_id);
+}
+
+/**
+ * 多进程模式下归约进程为分区p暂存的输出路径，由协调进程按分区顺序拼接到标准输出
+ */
+static void reduce_output_path(char* path, size_t size, pid_t job, int partition_id) {
+    const char* dir = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+    snprintf(path, size, "%s/mr-%d-out-%05d", dir, ( int )job, partition_id);
+}
+
+/**
+ * 多进程模式下归约进程w写出的前K堆路径，由协调进程合并
+ */
+static void topk_output_path(char* path, size_t size, pid_t job, int worker) {
+    const char* dir = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+    snprintf(path, size, "%s/mr-%d-topk-%d", dir, ( int )job, worker);
+}
+
+/**
+ * 把前K堆写成文件，每个键为[分数int64_t][键长uint32_t][键]
+ *
+ * @return 成功返回0，否则返回-1
+ */
+static int export_topk(struct topk_t* heap, const char* path) {
+    FILE* out = fopen(path, "w");
+    if (out == NULL)
+        return -1;
+    for (int i = 0; i < heap->count; ++i) {
+        uint32_t len = strlen(heap->entries[i].key);
+        fwrite(&heap->entries[i].score, sizeof(int64_t), 1, out);
+        fwrite(&len, sizeof(len), 1, out);
+        fwrite(heap->entries[i].key, 1, len, out);
+    }
+    return fclose(out) == 0 ? 0 : -1;
+}
+
+/**
+ * 读入export_topk写出的文件并把其中的键提交到heap
+ *
+ * @return 成功返回0，文件无法读取或不完整时返回-1
+ */
+static int import_topk(struct topk_t* heap, const char* path) {
+    FILE* in = fopen(path, "r");
+    if (in == NULL)
+        return -1;
+    char*    key = NULL;
+    int64_t  score;
+    uint32_t len;
+    int      failed = 0;
+    while (fread(&score, sizeof(score), 1, in) == 1) {
+        if (fread(&len, sizeof(len), 1, in) != 1 || (key = ( char* )realloc(key, len + 1)) == NULL || fread(key, 1, len, in) != len) {
+            failed = 1;
+            break;
+        }
+        topk_offer(heap, key, len, score);
+    }
+    free(key);
+    fclose(in);
+    return failed ? -1 : 0;
+}
+
+/**
+ * 映射进程主函数
+ * 从管道中逐个读取输入文件下标并映射，结束后把每个分区排序写成段文件
+ *
+ * @return 进程退出码
+ */
+static int map_worker(int worker, int task_fd, pid_t job, char* argv[], Mapper map, int num_partitions, Combiner combine, Partitioner partition) {
+    init_job(MR_JobCreate(), num_partitions, combine, partition);
+    reset_stats(num_partitions, 1);
+    current->mapper = map;
+
+    // 每次写入的下标不超过PIPE_BUF，多个进程同时读取时不会拆开
+    int index;
+    while (read(task_fd, &index, sizeof(index)) == sizeof(index))
+        MR_MapperAdapt(argv[index]);
+    close(task_fd);
+
+    for (int i = 0; i < current->num_partitions; ++i) {
+        char path[4096];
+        map_output_path(path, sizeof(path), job, worker, i);
+        FILE* out = fopen(path, "w");
+        if (out == NULL || export_runs(&current->partitions[i], &current->partition_runs[i], out, compress_runs) < 0) {
+            fprintf(stderr, "mapreduce: cannot write '%s'\n", path);
+            return 1;
+        }
+        fclose(out);
+    }
+    return 0;
+}
+
+/**
+ * 归约进程主函数
+ * 从管道中逐个读取分区编号：读入所有映射进程为该分区写出的段后归并归约
+ *
+ * @return 进程退出码
+ */
+static int reduce_worker(int worker, int task_fd, int num_map_procs, pid_t job, Reducer reduce, int num_partitions, Combiner combine, Partitioner partition) {
+    struct topk_t heap;
+    init_job(MR_JobCreate(), num_partitions, combine, partition);
+    reset_stats(num_partitions, 1);
+    current->reducer = reduce;
+    reduce_arena     = &current->output_arenas[0];
+    topk_init(&heap, topk_k);
+    topk_heap = topk_k > 0 ? &heap : NULL;
+
+    int i;
+    while (read(task_fd, &i, sizeof(i)) == sizeof(i)) {
+        char path[4096];
+        for (int m = 0; m < num_map_procs; ++m) {
+            map_output_path(path, sizeof(path), job, m, i);
+            FILE* in = fopen(path, "r");
+            if (in == NULL || import_runs(&current->partition_runs[i], in) < 0) {
+                fprintf(stderr, "mapreduce: cannot read '%s'\n", path);
+                return 1;
+            }
+            fclose(in);
+        }
+        reduce_partition(i);
+
+        FILE* out;
+        if (output_prefix != NULL) {
+            out = open_output(output_prefix, i);
+        } else {
+            reduce_output_path(path, sizeof(path), job, i);
+            out = fopen(path, "w");
+        }
+        if (out == NULL)
+            return 1;
+        write_partition_output(i, out);
+        fclose(out);
+    }
+    close(task_fd);
+    if (topk_k > 0) {
+        char path[4096];
+        topk_output_path(path, sizeof(path), job, worker);
+        if (export_topk(&heap, path) < 0) {
+            fprintf(stderr, "mapreduce: cannot write '%s'\n", path);
+            return 1;
+        }
+    }
+    fflush(stdout);
+    return 0;
+}
+
+/**
+ * 等待所有子进程退出
+ *
+ * @return 全部正常退出返回0，否则返回-1
+ */
+static int wait_workers(pid_t* pids, int count) {
+    int failed = 0;
+    for (int i = 0; i < count; ++i) {
+        int status;
+        if (pids[i] > 0 && (waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0))
+            failed = 1;
+    }
+    return failed ? -1 : 0;
+}
+
+/**
+ * 多进程MapReduce执行函数
+ * 协调进程fork出num_workers个映射进程，通过管道动态分派输入文件；
+ * 每个映射进程把各分区排序后写成段文件，再由最多num_workers个归约进程
+ * 同样通过管道按段文件总大小从大到小领取分区，读入分区的全部段，多路归并后调用归约函数
+ * 映射和归约函数与MR_Run相同，MR_Output的内容最终按分区顺序写到标准输出
+ * 或MR_SetOutput指定的文件；子进程直接printf的内容不保证顺序
+ *
+ * @param num_workers 映射进程数，同时也是归约进程数的上限
+ * 其余参数同MR_RunWithCombiner
+ */
+void MR_RunProcesses(int argc, char* argv[], Mapper map, int num_workers, Reducer reduce, int num_reducers, Combiner combine, Partitioner partition) {
+    if (num_workers <= 0)
+        num_workers = online_cpus();
+    if (num_reducers <= 0)
+        num_reducers = online_cpus();
+    pid_t  job              = getpid();
+    int    num_partitions   = num_reducers * partitions_per_reducer;
+    int    num_reduce_procs = num_workers < num_reducers ? num_workers : num_reducers;
+    pid_t* pids             = ( pid_t* )calloc(num_workers, sizeof(pid_t));
+    int    failed           = 0;
+
+    // 避免缓冲区中尚未输出的内容被子进程重复输出
+    fflush(stdout);
+    fflush(stderr);
+    reset_stats(num_partitions, 0);
+    reset_topk(topk_k);
+
+    // 映射阶段
+    unsigned long phase_start = now_ns();
+    int           task_pipe[2];
+    if (pipe(task_pipe) < 0) {
+        perror("mapreduce: pipe");
+        exit(1);
+    }
+    for (int i = 0; i < num_workers; ++i) {
+        if ((pids[i] = fork()) == 0) {
+            close(task_pipe[1]);
+            _exit(map_worker(i, task_pipe[0], job, argv, map, num_partitions, combine, partition));
+        } else if (pids[i] < 0) {
+            perror("mapreduce: fork");
+            failed = 1;
+        }
+    }
+    close(task_pipe[0]);
+    for (int i = 1; i < argc; ++i) {
+        if (write(task_pipe[1], &i, sizeof(i)) != sizeof(i))
+            failed = 1;
+    }
+    close(task_pipe[1]);
+    if (wait_workers(pids, num_workers) < 0 || failed) {
+        fprintf(stderr, "mapreduce: map worker failed\n");
+        failed = 1;
+    }
+    stats.map_seconds = (now_ns() - phase_start) / 1e9;
+
+    // 归约阶段：分区按各映射进程为它写出的段文件总大小从大到小分派
+    char path[4096];
+    phase_start = now_ns();
+    if (!failed) {
+        if (pipe(task_pipe) < 0) {
+            perror("mapreduce: pipe");
+            exit(1);
+        }
+        for (int i = 0; i < num_reduce_procs; ++i) {
+            if ((pids[i] = fork()) == 0) {
+                close(task_pipe[1]);
+                _exit(reduce_worker(i, task_pipe[0], num_workers, job, reduce, num_partitions, combine, partition));
+            } else if (pids[i] < 0) {
+                perror("mapreduce: fork");
+                failed = 1;
+            }
+        }
+        close(task_pipe[0]);
+        size_t* bytes = ( size_t* )calloc(num_partitions, sizeof(size_t));
+        int*    order = ( int* )malloc(sizeof(int) * (num_partitions + 1));
+        for (int i = 0; i < num_partitions; ++i) {
+            for (int m = 0; m < num_workers; ++m) {
+                struct stat st;
+                map_output_path(path, sizeof(path), job, m, i);
+                if (stat(path, &st) == 0)
+                    bytes[i] += st.st_size;
+            }
+        }
+        order_partitions(bytes, order, num_partitions);
+        for (int i = 0; i < num_partitions; ++i) {
+            if (write(task_pipe[1], &order[i], sizeof(order[i])) != sizeof(order[i]))
+                failed = 1;
+        }
+        close(task_pipe[1]);
+        free(bytes);
+        free(order);
+        if (wait_workers(pids, num_reduce_procs) < 0 || failed) {
+            fprintf(stderr, "mapreduce: reduce worker failed\n");
+            failed = 1;
+        }
+    }
+    for (int i = 0; i < num_reduce_procs && topk_k > 0; ++i) {
+        topk_output_path(path, sizeof(path), job, i);
+        if (!failed && import_topk(&topk_result, path) < 0) {
+            fprintf(stderr, "mapreduce: cannot read '%s'\n", path);
+            failed = 1;
+        }
+        unlink(path);
+    }
+    stats.reduce_seconds = (now_ns() - phase_start) / 1e9;
+
+    // 按分区顺序拼接输出并删除中间文件
+    char buf[64 * 1024];
+    for (int i = 0; i < num_partitions; ++i) {
+        for (int m = 0; m < num_workers; ++m) {
+            map_output_path(path, sizeof(path), job, m, i);
+            unlink(path);
+        }
+        if (output_prefix != NULL)
+            continue;
+        reduce_output_path(path, sizeof(path), job, i);
+        FILE* in = fopen(path, "r");
+        if (in == NULL)
+            continue;
+        size_t got;
+        while ((got = fread(buf, 1, sizeof(buf), in)) > 0)
+            fwrite(buf, 1, got, stdout);
+        fclose(in);
+        unlink(path);
+    }
+    if (topk_k > 0 && !failed)
+        write_topk();
+    fflush(stdout);
+    free(pids);
+    if (failed)
+        exit(1);
+}
+
+/**
+ * 把字符串存入缓冲区存储区，返回其偏移
+ * 若最近存过相同内容的字符串则直接复用，重复的键和值只占一份空间
+ *
+ * @param str 字符串，不要求以'\0'结尾
+ * @param len 字符串长度
+ * @param hash 字符串的哈希值
+ */
+static size_t buffer_intern(struct emit_buffer_t* buf, const char* str, size_t len, unsigned long hash) {
+    size_t* recent = &buf->recent[hash & (RECENT_SIZE - 1)];
+    if (*recent != 0) {
+        char* cached = buf->bytes + *recent - 1;
+        // 缓存的字符串比str短时不能读到存储区之外
+        if (*recent + len <= buf->bytes_used && memcmp(cached, str, len) == 0 && cached[len] == '\0')
+            return *recent - 1;
+    }
+
+    if (buf->bytes_used + len + 1 > buf->bytes_cap) {
+        size_t new_cap = buf->bytes_cap == 0 ? 4096 : buf->bytes_cap;
+        while (buf->bytes_used + len + 1 > new_cap)
+            new_cap *= 2;
+        buf->bytes     = ( char* )realloc(buf->bytes, new_cap);
+        buf->bytes_cap = new_cap;
+    }
+    size_t offset = buf->bytes_used;
+    memcpy(buf->bytes + offset, str, len);
+    buf->bytes[offset + len] = '\0';
+    buf->bytes_used += len + 1;
+    *recent = offset + 1;
+    return offset;
+}
+
+/**
+ * 清空缓冲区，保留已分配的存储区供复用
+ */
+static void buffer_reset(struct emit_buffer_t* buf) {
+    buf->count      = 0;
+    buf->bytes_used = 0;
+    memset(buf->recent, 0, sizeof(buf->recent));
+}
+
+/**
+ * 向缓冲区追加一个键值对，字符串经buffer_intern存入存储区
+ * value为NULL时追加整数值int_value
+ */
+static void buffer_append(struct emit_buffer_t* buf, const char* key, size_t key_len, const char* value, size_t value_len, int64_t int_value, unsigned long hash) {
+    if (buf->count == buf->pairs_cap) {
+        buf->pairs_cap = buf->pairs_cap == 0 ? EMIT_BATCH_SIZE : buf->pairs_cap * 2;
+        buf->pairs     = ( struct emit_pair_t* )realloc(buf->pairs, sizeof(struct emit_pair_t) * buf->pairs_cap);
+    }
+
+    struct emit_pair_t* pair = &buf->pairs[buf->count++];
+    pair->hash               = hash;
+    pair->key_offset         = buffer_intern(buf, key, key_len, hash);
+    pair->key_len            = key_len;
+    pair->value_offset       = value == NULL ? INT_VALUE : buffer_intern(buf, value, value_len, hash_key_n(value, value_len));
+    pair->int_value          = int_value;
+}
+
+/**
+ * 按(哈希值, 键长, 键)排序缓冲区下标的比较函数，使相同键相邻
+ */
+static int compare_pairs(const void* a, const void* b) {
+    const struct emit_pair_t* pa = &combine_input->pairs[*( const int* )a];
+    const struct emit_pair_t* pb = &combine_input->pairs[*( const int* )b];
+    if (pa->hash != pb->hash)
+        return pa->hash < pb->hash ? -1 : 1;
+    if (pa->key_len != pb->key_len)
+        return pa->key_len < pb->key_len ? -1 : 1;
+    return memcmp(combine_input->bytes + pa->key_offset, combine_input->bytes + pb->key_offset, pa->key_len);
+}
+
+/**
+ * 提前合并使用的取值函数，依次返回键节点中已提交的值
+ */
+static char* precombine_get_next(char* key) {
+    ( void )key;
+    if (precombine_cursor == NULL)
+        return NULL;
+    char* value       = precombine_cursor->value;
+    precombine_cursor = precombine_cursor->next;
+    return value;
+}
+
+/**
+ * 合并函数使用的取值函数，依次返回当前分组中的字符串值
+ * 提前合并时改为返回键节点中已提交的值
+ */
+static char* combine_get_next(char* key) {
+    if (precombine_node != NULL)
+        return precombine_get_next(key);
+    while (combine_pos < combine_end) {
+        struct emit_pair_t* pair = &combine_input->pairs[combine_order[combine_pos++]];
+        if (pair->value_offset != INT_VALUE)
+            return combine_input->bytes + pair->value_offset;
+    }
+    return NULL;
+}
+
+/**
+ * 合并函数读取当前分组中的下一个整数值，与字符串值分别迭代
+ * 只能在Combiner回调中调用
+ *
+ * @param value 输出的整数值
+ * @return 读到返回1，没有更多整数值返回0
+ */
+int MR_CombineNextInt64(int64_t* value) {
+    if (precombine_node != NULL) {
+        if (precombine_ipos >= precombine_node->num_ints)
+            return 0;
+        *value = precombine_node->ints[precombine_ipos++];
+        return 1;
+    }
+    while (combine_ipos < combine_end) {
+        struct emit_pair_t* pair = &combine_input->pairs[combine_order[combine_ipos++]];
+        if (pair->value_offset == INT_VALUE) {
+            *value = pair->int_value;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * 在缓冲区内原地合并：按键分组后对每组调用combiner，
+ * 用合并输出替换缓冲区内容
+ */
+static void combine_buffer(struct emit_buffer_t* buf) {
+    if (buf->count == 0)
+        return;
+
+    combine_input = buf;
+    combine_order = ( int* )realloc(combine_order, sizeof(int) * buf->count);
+    for (int i = 0; i < buf->count; ++i)
+        combine_order[i] = i;
+    qsort(combine_order, buf->count, sizeof(int), compare_pairs);
+
+    buffer_reset(&combine_output);
+    for (int start = 0; start < buf->count; start = combine_end) {
+        struct emit_pair_t* first = &buf->pairs[combine_order[start]];
+        char*               key   = buf->bytes + first->key_offset;
+        // 找出与首个键相同的连续区间
+        combine_end = start + 1;
+        while (combine_end < buf->count) {
+            struct emit_pair_t* next = &buf->pairs[combine_order[combine_end]];
+            if (next->hash != first->hash || next->key_len != first->key_len || memcmp(buf->bytes + next->key_offset, key, first->key_len) != 0)
+                break;
+            combine_end++;
+        }
+        combine_pos  = start;
+        combine_ipos = start;
+        current->combiner(key, combine_get_next);
+    }
+
+    // 交换存储区，原缓冲区的内存留给下一次合并输出复用
+    struct emit_buffer_t tmp = *buf;
+    *buf                     = combine_output;
+    combine_output           = tmp;
+    combine_input            = NULL;
+}
+
+/**
+ * 判断分区是否有分段超过内存上限，调用者需持有所有分段的锁
+ */
+static int over_budget(struct partition_t* part) {
+    for (int i = 0; i < PARTITION_STRIPES; ++i) {
+        if (part->stripes[i].keys.bytes + part->stripes[i].arena.bytes > current->spill_threshold / PARTITION_STRIPES)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * 按分段编号升序锁住分区的所有分段后把分区溢写为段文件
+ * 其他线程只会同时持有一个分段锁，因此按固定顺序加锁不会死锁
+ *
+ * @param partition_index 分区编号
+ */
+static void spill(unsigned long partition_index) {
+    struct partition_t* part = task_partitions != NULL ? &task_partitions[partition_index] : &current->partitions[partition_index];
+    struct run_list_t*  runs = task_runs != NULL ? &task_runs[partition_index] : &current->partition_runs[partition_index];
+
+    for (int i = 0; i < PARTITION_STRIPES; ++i)
+        pthread_mutex_lock(&part->stripes[i].lock);
+    // 等待加锁期间分区可能已被其他线程溢写，重新检查
+    if (!runs->failed && over_budget(part) && spill_partition(part, runs, compress_runs) < 0) {
+        fprintf(stderr, "mapreduce: cannot spill partition %lu, keeping it in memory\n", partition_index);
+        runs->failed = 1;
+    }
+    for (int i = PARTITION_STRIPES - 1; i >= 0; --i)
+        pthread_mutex_unlock(&part->stripes[i].lock);
+}
+
+/**
+ * 将一个分区缓冲区中的键值对批量插入分区
+ * 先按键所在的分段对整批计数排序，每个分段只加锁一次，
+ * 不同线程向同一分区的不同分段提交时互不阻塞；提交后清空缓冲区
+ *
+ * @param partition_index 分区编号
+ */
+static void flush_buffer(unsigned long partition_index) {
+    struct emit_buffer_t* buf = &emit_buffers[partition_index];
+    if (buf->count == 0)
+        return;
+
+    struct partition_t* part  = task_partitions != NULL ? &task_partitions[partition_index] : &current->partitions[partition_index];
+    struct run_list_t*  runs  = task_runs != NULL ? &task_runs[partition_index] : &current->partition_runs[partition_index];
+    unsigned long       start = now_ns();
+
+    int first[PARTITION_STRIPES + 1] = {0};
+    for (int i = 0; i < buf->count; ++i)
+        first[stripe_of(part, buf->pairs[i].hash) - part->stripes + 1]++;
+    for (int i = 0; i < PARTITION_STRIPES; ++i)
+        first[i + 1] += first[i];
+    if (buf->count > flush_order_cap) {
+        flush_order_cap = buf->count;
+        flush_order     = ( int* )realloc(flush_order, sizeof(int) * flush_order_cap);
+    }
+    int next[PARTITION_STRIPES];
+    memcpy(next, first, sizeof(next));
+    for (int i = 0; i < buf->count; ++i)
+        flush_order[next[stripe_of(part, buf->pairs[i].hash) - part->stripes]++] = i;
+
+    unsigned long wait       = 0;
+    int           need_spill = 0;
+    for (int s = 0; s < PARTITION_STRIPES; ++s) {
+        if (first[s] == first[s + 1])
+            continue;
+        struct stripe_t* stripe = &part->stripes[s];
+        unsigned long    before = now_ns();
+        pthread_mutex_lock(&stripe->lock);
+        wait += now_ns() - before;
+        for (int j = first[s]; j < first[s + 1]; ++j) {
+            struct emit_pair_t* pair     = &buf->pairs[flush_order[j]];
+            char*               key      = buf->bytes + pair->key_offset;
+            struct info_node_t* info_ptr = find_info(part, key, pair->key_len, pair->hash);
+            if (info_ptr == NULL)
+                info_ptr = insert_info(part, key, pair->key_len, pair->hash);
+            if (pair->value_offset == INT_VALUE)
+                insert_int(part, info_ptr, pair->int_value);
+            else
+                insert_data(part, info_ptr, buf->bytes + pair->value_offset);
+        }
+        if (current->spill_threshold > 0 && !runs->failed && stripe->keys.bytes + stripe->arena.bytes > current->spill_threshold / PARTITION_STRIPES)
+            need_spill = 1;
+        pthread_mutex_unlock(&stripe->lock);
+    }
+    // 超过内存上限时把分区排序后溢写为段文件
+    if (need_spill)
+        spill(partition_index);
+    __atomic_fetch_add(&current->lock_wait_ns, wait, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&current->shuffle_ns, now_ns() - start, __ATOMIC_RELAXED);
+
+    buffer_reset(buf);
+}
+
+/**
+ * 提交并释放当前线程的所有发射缓冲区
+ * 映射函数返回后由MR_MapperAdapt调用
+ */
+void MR_FlushEmits(void) {
+    if (emit_buffers == NULL)
+        return;
+    for (int i = 0; i < current->num_partitions; ++i) {
+        if (current->combiner != NULL)
+            combine_buffer(&emit_buffers[i]);
+        flush_buffer(i);
+        free(emit_buffers[i].pairs);
+        free(emit_buffers[i].bytes);
+        __atomic_fetch_add(&stats.emits[i], emit_counts[i], __ATOMIC_RELAXED);
+    }
+    free(emit_buffers);
+    free(emit_counts);
+    free(flush_order);
+    emit_buffers    = NULL;
+    emit_counts     = NULL;
+    flush_order     = NULL;
+    flush_order_cap = 0;
+
+    free(combine_output.pairs);
+    free(combine_output.bytes);
+    memset(&combine_output, 0, sizeof(combine_output));
+    free(combine_order);
+    combine_order = NULL;
+    free(key_scratch);
+    key_scratch     = NULL;
+    key_scratch_cap = 0;
+    free(tag_scratch);
+    tag_scratch     = NULL;
+    tag_scratch_cap = 0;
+}
+
+/**
+ * 生成键值对，将中间结果添加到对应分区
+ * 由映射函数调用以产生中间结果
+ *
+ * @param key 键
+ * @param value 值
+ */
+void MR_Emit(char* key, char* value) {
+    MR_EmitN(key, strlen(key), value, strlen(value));
+}
+
+/**
+ * 把键值对写入线程本地缓冲区，积累到EMIT_BATCH_SIZE后再批量加锁提交；
+ * 设置了合并函数时先原地合并，合并后仍超过一半容量才提交
+ * value为NULL时发射整数值int_value
+ */
+static void emit(const char* key, size_t key_len, const char* value, size_t value_len, int64_t int_value) {
+    if (reservoir != NULL) {
+        sample_key(key, key_len);
+        return;
+    }
+    if (sketch != NULL) {
+        sketch_add(sketch, key, key_len, hash_key_n(key, key_len), value != NULL ? 1 : int_value > 0 ? ( uint64_t )int_value : 0);
+        return;
+    }
+
+    // 计算一次哈希值用于分区内哈希表查找，默认分区函数直接复用该哈希值
+    unsigned long hash = hash_key_n(key, key_len);
+    unsigned long partition_index;
+    if (current->partitioner == NULL || current->partitioner == MR_DefaultHashPartition) {
+        partition_index = hash % current->num_partitions;
+    } else {
+        // 用户分区函数需要以'\0'结尾的键
+        if (key_len + 1 > key_scratch_cap) {
+            key_scratch_cap = key_len + 1 > 256 ? key_len + 1 : 256;
+            key_scratch     = ( char* )realloc(key_scratch, key_scratch_cap);
+        }
+        memcpy(key_scratch, key, key_len);
+        key_scratch[key_len] = '\0';
+        partition_index      = current->partitioner(key_scratch, current->num_partitions) % current->num_partitions;
+    }
+
+    if (join_side != 0 && value != NULL) {
+        if (value_len + 1 > tag_scratch_cap) {
+            tag_scratch_cap = value_len + 1 > 256 ? value_len + 1 : 256;
+            tag_scratch     = ( char* )realloc(tag_scratch, tag_scratch_cap);
+        }
+        tag_scratch[0] = join_side;
+        memcpy(tag_scratch + 1, value, value_len);
+        value = tag_scratch;
+        value_len++;
+    }
+
+    if (emit_buffers == NULL) {
+        emit_buffers = ( struct emit_buffer_t* )calloc(current->num_partitions, sizeof(struct emit_buffer_t));
+        emit_counts  = ( unsigned long* )calloc(current->num_partitions, sizeof(unsigned long));
+    }
+    emit_counts[partition_index]++;
+    struct emit_buffer_t* buf = &emit_buffers[partition_index];
+    buffer_append(buf, key, key_len, value, value_len, int_value, hash);
+
+    // 缓冲区已满，批量提交
+    if (buf->count >= EMIT_BATCH_SIZE) {
+        if (current->combiner != NULL)
+            combine_buffer(buf);
+        if (buf->count > EMIT_BATCH_SIZE / 2)
+            flush_buffer(partition_index);
+    }
+}
+
+
+/**
+ * 生成键值对，键和值以指针加长度给出，不要求以'\0'结尾
+ * 映射函数可以直接发射MR_MapInput视图中的片段，无需先拷贝出来
+ *
+ * @param key 键
+ * @param key_len 键的长度
+ * @param value 值
+ * @param value_len 值的长度
+ */
+void MR_EmitN(const char* key, size_t key_len, const char* value, size_t value_len) {
+    emit(key, key_len, value, value_len, 0);
+}
+
+/**
+ * 生成值为整数的键值对，整数以定长形式存放，归约时用MR_GetNextInt64读取，
+ * 省去字符串值的编码、驻留和解析
+ *
+ * @param key 键
+ * @param value 整数值
+ */
+void MR_EmitInt64(char* key, int64_t value) {
+    emit(key, strlen(key), NULL, 0, value);
+}
+
+/**
+ * 同MR_EmitInt64，键以指针加长度给出
+ */
+void MR_EmitInt64N(const char* key, size_t key_len, int64_t value) {
+    emit(key, key_len, NULL, 0, value);
+}
+
+/**
+ * 合并函数输出合并后的键值对
+ * 只能在Combiner回调中调用
+ *
+ * @param key 键
+ * @param value 合并后的值
+ */
+void MR_EmitToReducer(char* key, char* value) {
+    size_t key_len = strlen(key);
+    buffer_append(&combine_output, key, key_len, value, strlen(value), 0, hash_key_n(key, key_len));
+}
+
+/**
+ * 合并函数输出合并后的整数值
+ * 只能在Combiner回调中调用
+ */
+void MR_EmitToReducerInt64(char* key, int64_t value) {
+    size_t key_len = strlen(key);
+    buffer_append(&combine_output, key, key_len, NULL, 0, value, hash_key_n(key, key_len));
+}
+
+/**
+ * 将输入块映射到内存，给出只读的指针加长度视图
+ * 映射起点按页对齐，data指向块的第一个字节；块长度为负时映射到文件末尾；
+ * 流式块直接返回其内存中的数据
+ *
+ * @param chunk 输入块
+ * @param input 输出的视图，用毕调用MR_UnmapInput释放
+ * @return 成功返回0，失败返回-1
+ */
+int MR_MapInput(MR_Chunk* chunk, MR_Input* input) {
+    memset(input, 0, sizeof(*input));
+    if (chunk->data != NULL) {
+        // 流式块已在内存中
+        input->data   = chunk->data;
+        input->length = chunk->length;
+        return 0;
+    }
+    int fd = open(chunk->file_name, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    long length = chunk->length;
+    if (length < 0) {
+        struct stat st;
+        if (fstat(fd, &st) < 0) {
+            close(fd);
+            return -1;
+        }
+        length = st.st_size > chunk->offset ? st.st_size - chunk->offset : 0;
+    }
+    if (length == 0) {
+        close(fd);
+        return 0;
+    }
+
+    long  page  = sysconf(_SC_PAGESIZE);
+    long  start = chunk->offset - chunk->offset % page;
+    void* base  = mmap(NULL, length + (chunk->offset - start), PROT_READ, MAP_PRIVATE, fd, start);
+    close(fd);
+    if (base == MAP_FAILED)
+        return -1;
+    madvise(base, length + (chunk->offset - start), MADV_SEQUENTIAL);
+
+    input->base       = base;
+    input->map_length = length + (chunk->offset - start);
+    input->data       = ( const char* )base + (chunk->offset - start);
+    input->length     = length;
+    return 0;
+}
+
+/**
+ * 解除MR_MapInput建立的映射
+ */
+void MR_UnmapInput(MR_Input* input) {
+    if (input->base != NULL)
+        munmap(input->base, input->map_length);
+    memset(input, 0, sizeof(*input));
+}
+
+/**
+ * 用合并函数把一个键的全部值替换为合并结果
+ * 合并函数输出的值都归入该键，调用者需持有键所在分段的锁
+ */
+static void precombine_key(struct partition_t* part, struct info_node_t* node) {
+    buffer_reset(&combine_output);
+    precombine_node   = node;
+    precombine_cursor = node->data;
+    precombine_ipos   = 0;
+    current->combiner(node->info, combine_get_next);
+    precombine_node   = NULL;
+    precombine_cursor = NULL;
+
+    // 旧的值节点留在分配器中，随分区一起释放；整数数组原地复用
+    node->data     = NULL;
+    node->cursor   = NULL;
+    node->num_ints = 0;
+    for (int i = 0; i < combine_output.count; ++i) {
+        struct emit_pair_t* pair = &combine_output.pairs[i];
+        if (pair->value_offset == INT_VALUE)
+            insert_int(part, node, pair->int_value);
+        else
+            insert_data(part, node, combine_output.bytes + pair->value_offset);
+    }
+}
+
+/**
+ * 提前合并任务函数
+ * 逐个分段遍历有多个值的键并就地合并，每处理PRECOMBINE_BATCH个键释放一次分段锁，
+ * 让仍在运行的映射线程可以继续提交；释放锁期间分区若被溢写则停止
+ *
+ * @param arg 分区编号
+ */
+static void MR_PrecombineAdapt(void* arg) {
+    int                 partition_id = ( int )( long )arg;
+    struct partition_t* part         = &current->partitions[partition_id];
+
+    for (int s = 0; s < PARTITION_STRIPES; ++s) {
+        struct stripe_t* stripe = &part->stripes[s];
+        pthread_mutex_lock(&stripe->lock);
+        int                 num_runs = current->partition_runs[partition_id].count;
+        struct info_node_t* node     = stripe->info_head;
+        for (int batch = 1; node != NULL; node = node->next, ++batch) {
+            if ((node->data != NULL && node->data->next != NULL) || node->num_ints > 1)
+                precombine_key(part, node);
+            if (batch % PRECOMBINE_BATCH == 0) {
+                // 键节点分配在分段的分配器中，新键只插入链表头部，解锁后仍可继续遍历
+                pthread_mutex_unlock(&stripe->lock);
+                pthread_mutex_lock(&stripe->lock);
+                if (current->partition_runs[partition_id].count != num_runs)
+                    break;
+            }
+        }
+        pthread_mutex_unlock(&stripe->lock);
+    }
+
+    free(combine_output.pairs);
+    free(combine_output.bytes);
+    memset(&combine_output, 0, sizeof(combine_output));
 }
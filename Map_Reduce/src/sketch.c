@@ -0,0 +1,220 @@
+/**
+ * 近似计数：Count-Min草图与高频键表
+ * 每个映射线程维护自己的草图，只做无锁的计数器累加，内存与键的个数无关；
+ * 作业结束时各草图按计数器相加，各线程的高频键在合并后的草图上重新估计，
+ * 选出整体估计值最大的键
+ */
+#include "sketch.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * 第row行中键所在的列，由一个64位哈希值按双重哈希导出各行的列
+ */
+static inline int column_of(const struct sketch_t* sketch, unsigned long hash, int row) {
+    unsigned long h1 = hash;
+    unsigned long h2 = (hash >> 32 | hash << 32) * 0x9E3779B97F4A7C15UL | 1;
+    return ( int )((h1 + row * h2) & (sketch->width - 1));
+}
+
+/**
+ * @param width 每行的计数器数，向上取整为2的幂
+ * @param depth 行数
+ * @param capacity 高频键表保留的键数，0表示不跟踪高频键
+ */
+void sketch_init(struct sketch_t* sketch, int width, int depth, int capacity) {
+    int w = 1;
+    while (w < width)
+        w *= 2;
+    sketch->width    = w;
+    sketch->depth    = depth > 0 ? depth : 1;
+    sketch->counts   = ( uint64_t* )calloc(( size_t )sketch->width * sketch->depth, sizeof(uint64_t));
+    sketch->capacity = capacity > 0 ? capacity : 0;
+    sketch->size     = 0;
+    sketch->heap     = ( struct heavy_entry_t* )malloc(sizeof(struct heavy_entry_t) * (sketch->capacity + 1));
+    sketch->num_slots = 1;
+    while (sketch->num_slots < 2 * sketch->capacity)
+        sketch->num_slots *= 2;
+    sketch->slots = ( int* )calloc(sketch->num_slots, sizeof(int));
+}
+
+/**
+ * 查找键在哈希表中的槽位，不存在时返回应插入的空槽位
+ */
+static int find_slot(const struct sketch_t* sketch, const char* key, size_t key_len, unsigned long hash) {
+    int slot = ( int )((hash * 0x9E3779B97F4A7C15UL) >> 40) & (sketch->num_slots - 1);
+    for (; sketch->slots[slot] != 0; slot = (slot + 1) & (sketch->num_slots - 1)) {
+        const struct heavy_entry_t* e = &sketch->heap[sketch->slots[slot] - 1];
+        if (e->hash == hash && e->key_len == key_len && memcmp(e->key, key, key_len) == 0)
+            return slot;
+    }
+    return slot;
+}
+
+/**
+ * 从哈希表中删除一个槽位，把后面同一探测链上的槽位前移填补空位
+ */
+static void remove_slot(struct sketch_t* sketch, int slot) {
+    int mask = sketch->num_slots - 1;
+    int next = slot;
+    sketch->slots[slot] = 0;
+    for (;;) {
+        next = (next + 1) & mask;
+        if (sketch->slots[next] == 0)
+            return;
+        const struct heavy_entry_t* e    = &sketch->heap[sketch->slots[next] - 1];
+        int                         home = ( int )((e->hash * 0x9E3779B97F4A7C15UL) >> 40) & mask;
+        // home不在(slot, next]之间时，该槽位可以移到slot
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            sketch->slots[slot] = sketch->slots[next];
+            sketch->slots[next] = 0;
+            slot                = next;
+        }
+    }
+}
+
+/**
+ * 交换堆中的两个键，同时更新哈希表中它们的下标
+ */
+static void swap_entries(struct sketch_t* sketch, int a, int b) {
+    struct heavy_entry_t* ea     = &sketch->heap[a];
+    struct heavy_entry_t* eb     = &sketch->heap[b];
+    int                   slot_a = find_slot(sketch, ea->key, ea->key_len, ea->hash);
+    int                   slot_b = find_slot(sketch, eb->key, eb->key_len, eb->hash);
+    struct heavy_entry_t  tmp    = *ea;
+    *ea                          = *eb;
+    *eb                          = tmp;
+    sketch->slots[slot_a]        = b + 1;
+    sketch->slots[slot_b]        = a + 1;
+}
+
+static void sift_up(struct sketch_t* sketch, int i) {
+    while (i > 0 && sketch->heap[i].estimate < sketch->heap[(i - 1) / 2].estimate) {
+        swap_entries(sketch, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void sift_down(struct sketch_t* sketch, int i) {
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= sketch->size)
+            return;
+        if (child + 1 < sketch->size && sketch->heap[child + 1].estimate < sketch->heap[child].estimate)
+            child++;
+        if (sketch->heap[i].estimate <= sketch->heap[child].estimate)
+            return;
+        swap_entries(sketch, i, child);
+        i = child;
+    }
+}
+
+/**
+ * 更新高频键表：已有的键更新估计值；表未满时插入；
+ * 表已满且估计值超过堆顶时替换堆顶
+ */
+static void track(struct sketch_t* sketch, const char* key, size_t key_len, unsigned long hash, uint64_t estimate) {
+    int slot = find_slot(sketch, key, key_len, hash);
+    if (sketch->slots[slot] != 0) {
+        int i                    = sketch->slots[slot] - 1;
+        sketch->heap[i].estimate = estimate;
+        sift_down(sketch, i);
+        return;
+    }
+
+    int i;
+    if (sketch->size < sketch->capacity) {
+        i = sketch->size++;
+    } else if (estimate > sketch->heap[0].estimate) {
+        struct heavy_entry_t* top = &sketch->heap[0];
+        remove_slot(sketch, find_slot(sketch, top->key, top->key_len, top->hash));
+        free(top->key);
+        i    = 0;
+        slot = find_slot(sketch, key, key_len, hash);
+    } else {
+        return;
+    }
+    struct heavy_entry_t* e = &sketch->heap[i];
+    e->key                  = ( char* )malloc(key_len + 1);
+    memcpy(e->key, key, key_len);
+    e->key[key_len]     = '\0';
+    e->key_len          = key_len;
+    e->hash             = hash;
+    e->estimate         = estimate;
+    sketch->slots[slot] = i + 1;
+    if (i == 0)
+        sift_down(sketch, 0);
+    else
+        sift_up(sketch, i);
+}
+
+/**
+ * 把键的计数加上count，并用新的估计值更新高频键表
+ *
+ * @param key 键，不要求以'\0'结尾
+ * @param hash 键的哈希值（由hash_key_n计算）
+ */
+void sketch_add(struct sketch_t* sketch, const char* key, size_t key_len, unsigned long hash, uint64_t count) {
+    uint64_t estimate = UINT64_MAX;
+    for (int row = 0; row < sketch->depth; ++row) {
+        uint64_t* c = &sketch->counts[( size_t )row * sketch->width + column_of(sketch, hash, row)];
+        *c += count;
+        if (*c < estimate)
+            estimate = *c;
+    }
+    if (sketch->capacity > 0)
+        track(sketch, key, key_len, hash, estimate);
+}
+
+/**
+ * 估计哈希值为hash的键的计数，不小于真实值
+ */
+uint64_t sketch_estimate(const struct sketch_t* sketch, unsigned long hash) {
+    uint64_t estimate = UINT64_MAX;
+    for (int row = 0; row < sketch->depth; ++row) {
+        uint64_t c = sketch->counts[( size_t )row * sketch->width + column_of(sketch, hash, row)];
+        if (c < estimate)
+            estimate = c;
+    }
+    return estimate;
+}
+
+/**
+ * 把from的计数器加到into上，两者的宽度和行数必须相同；高频键表不合并
+ */
+void sketch_merge(struct sketch_t* into, const struct sketch_t* from) {
+    size_t n = ( size_t )into->width * into->depth;
+    for (size_t i = 0; i < n; ++i)
+        into->counts[i] += from->counts[i];
+}
+
+/**
+ * 以各部分高频键表中的键为候选，在合并后的草图上重新估计，把估计值最大的键放入out
+ * 同一个键可能出现在多个部分中，只提交一次
+ *
+ * @param merged 合并后的草图
+ * @param parts 各线程的草图
+ * @param out 结果，容量即保留的键数
+ */
+void sketch_heavy_hitters(const struct sketch_t* merged, struct sketch_t* parts, int num_parts, struct topk_t* out) {
+    for (int p = 0; p < num_parts; ++p) {
+        for (int i = 0; i < parts[p].size; ++i) {
+            const struct heavy_entry_t* e = &parts[p].heap[i];
+            int seen = 0;
+            for (int q = 0; q < p && !seen; ++q)
+                seen = parts[q].slots[find_slot(&parts[q], e->key, e->key_len, e->hash)] != 0;
+            if (!seen)
+                topk_offer(out, e->key, e->key_len, ( int64_t )sketch_estimate(merged, e->hash));
+        }
+    }
+}
+
+void sketch_free(struct sketch_t* sketch) {
+    for (int i = 0; i < sketch->size; ++i)
+        free(sketch->heap[i].key);
+    free(sketch->counts);
+    free(sketch->heap);
+    free(sketch->slots);
+    memset(sketch, 0, sizeof(*sketch));
+}
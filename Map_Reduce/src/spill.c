@@ -0,0 +1,378 @@
+#include "spill.h"
+
+#include "compress.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BLOCK_SIZE (64 * 1024)  // 段中每块解压后的最大字节数
+#define RUNS_END   UINT64_MAX    // export_runs写在一个分区全部段之后的结束标记
+
+/**
+ * 按块写出段：内容先攒在raw中，满一块后（可选压缩）加上块头写到文件
+ */
+struct run_writer_t {
+    FILE*  fp;
+    int    compress;  // 为1时每块用LZ4压缩，压缩后不变小的块原样存放
+    char*  raw;       // 当前块的未压缩内容
+    size_t raw_len;   // raw中的字节数
+    char*  packed;    // 压缩输出缓冲区
+    char*  prev_key;  // 上一个键，用于前缀编码
+    size_t prev_len;  // 上一个键的长度
+};
+
+void init_runs(struct run_list_t* runs) {
+    runs->file   = NULL;
+    runs->starts = NULL;
+    runs->ends   = NULL;
+    runs->count  = 0;
+    runs->cap    = 0;
+    runs->failed = 0;
+}
+
+/**
+ * 写出一块：[解压后长度][存放长度][内容]，存放长度小于解压后长度时内容经过压缩
+ */
+static void flush_block(struct run_writer_t* writer) {
+    if (writer->raw_len == 0)
+        return;
+    uint32_t    raw_len    = writer->raw_len;
+    uint32_t    stored_len = raw_len;
+    const char* payload    = writer->raw;
+    if (writer->compress) {
+        size_t packed_len = lz4_compress(writer->raw, raw_len, writer->packed, LZ4_BOUND(BLOCK_SIZE));
+        if (packed_len > 0 && packed_len < raw_len) {
+            stored_len = packed_len;
+            payload    = writer->packed;
+        }
+    }
+    fwrite(&raw_len, sizeof(raw_len), 1, writer->fp);
+    fwrite(&stored_len, sizeof(stored_len), 1, writer->fp);
+    fwrite(payload, 1, stored_len, writer->fp);
+    writer->raw_len = 0;
+}
+
+static void put_bytes(struct run_writer_t* writer, const void* data, size_t n) {
+    const char* src = ( const char* )data;
+    while (n > 0) {
+        size_t take = BLOCK_SIZE - writer->raw_len;
+        if (take > n)
+            take = n;
+        memcpy(writer->raw + writer->raw_len, src, take);
+        writer->raw_len += take;
+        src += take;
+        n -= take;
+        if (writer->raw_len == BLOCK_SIZE)
+            flush_block(writer);
+    }
+}
+
+static void put_string(struct run_writer_t* writer, const char* str, uint32_t len) {
+    put_bytes(writer, &len, sizeof(len));
+    put_bytes(writer, str, len);
+}
+
+/**
+ * 写出键：[与上一个键相同的前缀长度][剩余部分长度][剩余部分]
+ * 段中的键有序，相邻键通常有较长的公共前缀
+ */
+static void put_key(struct run_writer_t* writer, const char* key, size_t len) {
+    uint32_t shared = 0;
+    while (shared < writer->prev_len && shared < len && writer->prev_key[shared] == key[shared])
+        shared++;
+    put_bytes(writer, &shared, sizeof(shared));
+    put_string(writer, key + shared, len - shared);
+    writer->prev_key = ( char* )key;
+    writer->prev_len = len;
+}
+
+/**
+ * 将分区中的全部键值对按键排序后写到fp的当前位置，组成一个段
+ */
+static void write_run(struct partition_t* part, FILE* fp, int compress) {
+    struct run_writer_t writer = {fp, compress, ( char* )malloc(BLOCK_SIZE), 0, NULL, NULL, 0};
+    if (compress)
+        writer.packed = ( char* )malloc(LZ4_BOUND(BLOCK_SIZE));
+
+    sort_partition(part);
+    for (unsigned long i = 0; i < part->size; ++i) {
+        struct info_node_t* node  = part->sorted[i];
+        uint32_t            count = 0;
+        for (struct data_node_t* data = node->data; data != NULL; data = data->next)
+            count++;
+        uint32_t num_ints = node->num_ints;
+        put_key(&writer, node->info, node->info_len);
+        put_bytes(&writer, &count, sizeof(count));
+        put_bytes(&writer, &num_ints, sizeof(num_ints));
+        for (struct data_node_t* data = node->data; data != NULL; data = data->next)
+            put_string(&writer, data->value, strlen(data->value));
+        put_bytes(&writer, node->ints, sizeof(int64_t) * num_ints);
+    }
+    flush_block(&writer);
+    free(writer.raw);
+    free(writer.packed);
+    free(part->sorted);
+    part->sorted = NULL;
+}
+
+static void add_run(struct run_list_t* runs, long start, long end) {
+    if (runs->count == runs->cap) {
+        runs->cap    = runs->cap == 0 ? 8 : runs->cap * 2;
+        runs->starts = ( long* )realloc(runs->starts, sizeof(long) * runs->cap);
+        runs->ends   = ( long* )realloc(runs->ends, sizeof(long) * runs->cap);
+    }
+    runs->starts[runs->count] = start;
+    runs->ends[runs->count]   = end;
+    runs->count++;
+}
+
+/**
+ * 将分区中的全部键值对按键排序后作为新的一段追加到临时文件，然后清空分区
+ * 调用者需持有分区所有分段的锁
+ *
+ * @param part 分区
+ * @param runs 分区的段列表
+ * @param compress 为1时用LZ4压缩段中的每块
+ * @return 成功返回0；无法创建或写入临时文件时返回-1，分区内容保持不变
+ */
+int spill_partition(struct partition_t* part, struct run_list_t* runs, int compress) {
+    if (runs->file == NULL && (runs->file = tmpfile()) == NULL)
+        return -1;
+
+    FILE* fp = runs->file;
+    fseek(fp, 0, SEEK_END);
+    long start = ftell(fp);
+    write_run(part, fp, compress);
+    if (fflush(fp) != 0 || ferror(fp))
+        return -1;
+
+    add_run(runs, start, ftell(fp));
+    clear_partition(part);
+    return 0;
+}
+
+void free_runs(struct run_list_t* runs) {
+    if (runs->file != NULL)
+        fclose(runs->file);
+    free(runs->starts);
+    free(runs->ends);
+    init_runs(runs);
+}
+
+/**
+ * 把分区已溢写的段和内存中的数据依次写到out，供其他进程用import_runs读入
+ * 每段前加一个uint64_t长度，内存中的数据排序后作为最后一段，之后写结束标记，
+ * 同一个文件中可以依次写入多个分区
+ *
+ * @return 成功返回0，读写出错返回-1
+ */
+int export_runs(struct partition_t* part, struct run_list_t* runs, FILE* out, int compress) {
+    char buf[64 * 1024];
+    for (int i = 0; i < runs->count; ++i) {
+        uint64_t len = runs->ends[i] - runs->starts[i];
+        fwrite(&len, sizeof(len), 1, out);
+        for (long pos = runs->starts[i]; pos < runs->ends[i];) {
+            long    want = runs->ends[i] - pos < ( long )sizeof(buf) ? runs->ends[i] - pos : ( long )sizeof(buf);
+            ssize_t got  = pread(fileno(runs->file), buf, want, pos);
+            if (got <= 0)
+                return -1;
+            fwrite(buf, 1, got, out);
+            pos += got;
+        }
+    }
+
+    // 先写长度占位，段写完后回填
+    uint64_t len   = 0;
+    long     start = ftell(out);
+    fwrite(&len, sizeof(len), 1, out);
+    write_run(part, out, compress);
+    long end = ftell(out);
+    len      = end - start - sizeof(len);
+    fseek(out, start, SEEK_SET);
+    fwrite(&len, sizeof(len), 1, out);
+    fseek(out, end, SEEK_SET);
+    len = RUNS_END;
+    fwrite(&len, sizeof(len), 1, out);
+    return fflush(out) != 0 || ferror(out) ? -1 : 0;
+}
+
+/**
+ * 读入export_runs写出的一个分区的各段，逐段追加到本进程分区的临时文件中
+ * 读到结束标记时停止，in停在下一个分区的开头
+ *
+ * @return 成功返回0，读写出错返回-1
+ */
+int import_runs(struct run_list_t* runs, FILE* in) {
+    if (runs->file == NULL && (runs->file = tmpfile()) == NULL)
+        return -1;
+
+    char     buf[64 * 1024];
+    uint64_t len;
+    fseek(runs->file, 0, SEEK_END);
+    int ended = 0;
+    while (fread(&len, sizeof(len), 1, in) == 1 && !(ended = len == RUNS_END)) {
+        long start = ftell(runs->file);
+        for (uint64_t left = len; left > 0;) {
+            size_t got = fread(buf, 1, left < sizeof(buf) ? left : sizeof(buf), in);
+            if (got == 0)
+                return -1;
+            fwrite(buf, 1, got, runs->file);
+            left -= got;
+        }
+        if (len > 0)
+            add_run(runs, start, ftell(runs->file));
+    }
+    return !ended || fflush(runs->file) != 0 || ferror(runs->file) ? -1 : 0;
+}
+
+/**
+ * 用pread读入下一块，压缩过的块解压到buf中
+ *
+ * @return 成功返回0，段结束或出错返回-1
+ */
+static int read_block(struct run_reader_t* reader) {
+    uint32_t header[2];
+    if (reader->end - reader->pos < ( long )sizeof(header)
+        || pread(reader->fd, header, sizeof(header), reader->pos) != sizeof(header)
+        || header[0] > BLOCK_SIZE || header[1] > header[0])
+        return -1;
+    reader->pos += sizeof(header);
+
+    char* dst = header[1] < header[0] ? reader->packed : reader->buf;
+    if (pread(reader->fd, dst, header[1], reader->pos) != ( ssize_t )header[1])
+        return -1;
+    reader->pos += header[1];
+    if (header[1] < header[0] && lz4_decompress(reader->packed, header[1], reader->buf, BLOCK_SIZE) != header[0])
+        return -1;
+    reader->buf_len = header[0];
+    reader->buf_pos = 0;
+    return 0;
+}
+
+/**
+ * 从段中读取n个字节，缓冲区读空时读入下一块
+ *
+ * @return 成功返回0，段结束或出错返回-1
+ */
+static int read_bytes(struct run_reader_t* reader, void* dst, size_t n) {
+    char* out = ( char* )dst;
+    while (n > 0) {
+        if (reader->buf_pos == reader->buf_len && read_block(reader) < 0)
+            return -1;
+        size_t take = reader->buf_len - reader->buf_pos;
+        if (take > n)
+            take = n;
+        memcpy(out, reader->buf + reader->buf_pos, take);
+        reader->buf_pos += take;
+        out += take;
+        n -= take;
+    }
+    return 0;
+}
+
+/**
+ * 读取一个长度前缀的字符串，接在缓冲区前keep个字节之后，缓冲区不足时扩容
+ *
+ * @return 成功返回0，段结束或出错返回-1
+ */
+static int read_string(struct run_reader_t* reader, char** buf, size_t* cap, size_t keep) {
+    uint32_t len;
+    if (read_bytes(reader, &len, sizeof(len)) < 0)
+        return -1;
+    if (keep + len + 1 > *cap) {
+        *cap = keep + len + 1 > 64 ? keep + len + 1 : 64;
+        *buf = ( char* )realloc(*buf, *cap);
+    }
+    if (read_bytes(reader, *buf + keep, len) < 0)
+        return -1;
+    (*buf)[keep + len] = '\0';
+    return 0;
+}
+
+/**
+ * 读取前缀编码的键，与上一个键相同的前缀保留在key缓冲区中
+ *
+ * @return 成功返回0，段结束或出错返回-1
+ */
+static int read_key(struct run_reader_t* reader) {
+    uint32_t shared;
+    if (read_bytes(reader, &shared, sizeof(shared)) < 0 || (shared > 0 && shared >= reader->key_cap))
+        return -1;
+    return read_string(reader, &reader->key, &reader->key_cap, shared);
+}
+
+/**
+ * 打开第index段并定位到第一个键
+ */
+void run_reader_open(struct run_reader_t* reader, struct run_list_t* runs, int index) {
+    memset(reader, 0, sizeof(*reader));
+    reader->fd  = fileno(runs->file);
+    reader->pos = runs->starts[index];
+    reader->end = runs->ends[index];
+    reader->buf    = ( char* )malloc(BLOCK_SIZE);
+    reader->packed = ( char* )malloc(BLOCK_SIZE);
+    run_reader_next_key(reader);
+}
+
+/**
+ * 跳过当前键剩余的值并读取下一个键，段读完时置done
+ */
+void run_reader_next_key(struct run_reader_t* reader) {
+    int64_t skipped;
+    while (reader->remaining > 0)
+        run_reader_next_value(reader);
+    while (run_reader_next_int(reader, &skipped))
+        ;
+    reader->active = 0;
+    if (read_key(reader) < 0
+        || read_bytes(reader, &reader->remaining, sizeof(reader->remaining)) < 0
+        || read_bytes(reader, &reader->ints_left, sizeof(reader->ints_left)) < 0) {
+        reader->done      = 1;
+        reader->remaining = 0;
+        reader->ints_left = 0;
+    }
+}
+
+/**
+ * 读取当前键的下一个值
+ *
+ * @return 值，在下一次读取前有效；当前键的值已读完时返回NULL
+ */
+char* run_reader_next_value(struct run_reader_t* reader) {
+    if (reader->remaining == 0)
+        return NULL;
+    reader->remaining--;
+    if (read_string(reader, &reader->value, &reader->value_cap, 0) < 0) {
+        reader->remaining = 0;
+        return NULL;
+    }
+    return reader->value;
+}
+
+/**
+ * 读取当前键的下一个整数值
+ * 整数值存放在字符串值之后，尚未读出的字符串值会被跳过
+ *
+ * @return 读到返回1，当前键的整数值已读完返回0
+ */
+int run_reader_next_int(struct run_reader_t* reader, int64_t* value) {
+    while (reader->remaining > 0)
+        run_reader_next_value(reader);
+    if (reader->ints_left == 0)
+        return 0;
+    reader->ints_left--;
+    if (read_bytes(reader, value, sizeof(*value)) < 0) {
+        reader->ints_left = 0;
+        return 0;
+    }
+    return 1;
+}
+
+void run_reader_close(struct run_reader_t* reader) {
+    free(reader->buf);
+    free(reader->packed);
+    free(reader->key);
+    free(reader->value);
+    memset(reader, 0, sizeof(*reader));
+}
@@ -0,0 +1,36 @@
+/**
+ * 作业统计信息的JSON输出
+ */
+#include "mapreduce.h"
+
+static void dump_ulongs(FILE* out, const char* name, const unsigned long* values, int count) {
+    fprintf(out, ",\"%s\":[", name);
+    for (int i = 0; i < count; ++i)
+        fprintf(out, "%s%lu", i == 0 ? "" : ",", values[i]);
+    fputc(']', out);
+}
+
+/**
+ * 把统计信息输出为一个JSON对象，便于在生产环境中记录并追踪性能回退
+ *
+ * @param stats 统计信息，通常来自MR_GetStats
+ * @param out 输出流
+ */
+void MR_DumpStats(const MR_Stats* stats, FILE* out) {
+    fprintf(out, "{\"sample_seconds\":%.6f", stats->sample_seconds);
+    fprintf(out, ",\"map_seconds\":%.6f", stats->map_seconds);
+    fprintf(out, ",\"shuffle_seconds\":%.6f", stats->shuffle_seconds);
+    fprintf(out, ",\"reduce_seconds\":%.6f", stats->reduce_seconds);
+    fprintf(out, ",\"lock_wait_seconds\":%.6f", stats->lock_wait_seconds);
+    fprintf(out, ",\"map_threads\":%d", stats->map_threads);
+    fprintf(out, ",\"bytes_allocated\":%lu", stats->bytes_allocated);
+    fprintf(out, ",\"spilled_bytes\":%lu", stats->spilled_bytes);
+    fprintf(out, ",\"released_bytes\":%lu", stats->released_bytes);
+    fprintf(out, ",\"num_partitions\":%d", stats->num_partitions);
+    dump_ulongs(out, "emits", stats->emits, stats->num_partitions);
+    dump_ulongs(out, "distinct_keys", stats->distinct_keys, stats->num_partitions);
+    fprintf(out, ",\"num_threads\":%d,\"thread_busy_seconds\":[", stats->num_threads);
+    for (int i = 0; i < stats->num_threads; ++i)
+        fprintf(out, "%s%.6f", i == 0 ? "" : ",", stats->thread_busy_seconds[i]);
+    fputs("]}\n", out);
+}
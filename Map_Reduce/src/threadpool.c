@@ -0,0 +1,139 @@
+#include "threadpool.h"
+#include "utils.h"
+
+#include <stdlib.h>
+
+static __thread int pool_self = -1;  // 当前工作线程在线程池中的编号
+
+/**
+ * 工作线程主循环
+ * 从队列头取任务执行，队列为空或已达并发上限时在条件变量上睡眠，
+ * 线程池关闭且队列为空时退出
+ */
+static void* worker_loop(void* arg) {
+    struct threadpool_t* pool = ( struct threadpool_t* )arg;
+    pthread_mutex_lock(&pool->lock);
+    int self  = pool->started++;
+    pool_self = self;
+    for (;;) {
+        while ((pool->head == NULL || pool->running >= pool->active) && !pool->shutdown)
+            pthread_cond_wait(&pool->has_task, &pool->lock);
+        if (pool->head == NULL) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        struct task_t* task = pool->head;
+        pool->head          = task->next;
+        if (pool->head == NULL)
+            pool->tail = NULL;
+        pool->running++;
+        pthread_mutex_unlock(&pool->lock);
+
+        unsigned long start = now_ns();
+        task->func(task->arg);
+        __atomic_fetch_add(&pool->busy_ns[self], now_ns() - start, __ATOMIC_RELAXED);
+        free(task);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->running--;
+        if (--pool->pending == 0)
+            pthread_cond_broadcast(&pool->all_done);
+        else if (pool->head != NULL)
+            pthread_cond_signal(&pool->has_task);
+    }
+}
+
+/**
+ * 创建线程池并启动工作线程
+ *
+ * @param num_threads 工作线程数
+ * @return 线程池
+ */
+struct threadpool_t* threadpool_create(int num_threads) {
+    struct threadpool_t* pool = ( struct threadpool_t* )malloc(sizeof(struct threadpool_t));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->has_task, NULL);
+    pthread_cond_init(&pool->all_done, NULL);
+    pool->head        = NULL;
+    pool->tail        = NULL;
+    pool->pending     = 0;
+    pool->running     = 0;
+    pool->active      = num_threads;
+    pool->shutdown    = 0;
+    pool->num_threads = num_threads;
+    pool->threads     = ( pthread_t* )malloc(sizeof(pthread_t) * num_threads);
+    pool->started     = 0;
+    pool->busy_ns     = ( unsigned long* )calloc(num_threads, sizeof(unsigned long));
+    for (int i = 0; i < num_threads; ++i)
+        pthread_create(&pool->threads[i], NULL, worker_loop, pool);
+    return pool;
+}
+
+/**
+ * 向任务队列尾部追加任务并唤醒一个空闲线程
+ */
+void threadpool_submit(struct threadpool_t* pool, task_func_t func, void* arg) {
+    struct task_t* task = ( struct task_t* )malloc(sizeof(struct task_t));
+    task->func          = func;
+    task->arg           = arg;
+    task->next          = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail == NULL)
+        pool->head = task;
+    else
+        pool->tail->next = task;
+    pool->tail = task;
+    pool->pending++;
+    pthread_cond_signal(&pool->has_task);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * 设置同时执行任务的线程数上限，多余的线程保持睡眠
+ * 用于让同一个线程池在不同阶段以不同的并发度运行
+ */
+void threadpool_set_active(struct threadpool_t* pool, int active) {
+    pthread_mutex_lock(&pool->lock);
+    pool->active = active < pool->num_threads ? active : pool->num_threads;
+    pthread_cond_broadcast(&pool->has_task);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * 阻塞等待已提交的任务全部完成，调用者在条件变量上睡眠
+ * 线程池在返回后仍可继续提交任务
+ */
+void threadpool_wait(struct threadpool_t* pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0)
+        pthread_cond_wait(&pool->all_done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * 返回当前线程在所属线程池中的编号（0到num_threads-1），不是工作线程时返回-1
+ */
+int threadpool_self(void) {
+    return pool_self;
+}
+
+/**
+ * 关闭线程池：等待已提交的任务全部执行完，回收工作线程并释放线程池
+ */
+void threadpool_destroy(struct threadpool_t* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->has_task);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->num_threads; ++i)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->has_task);
+    pthread_cond_destroy(&pool->all_done);
+    free(pool->threads);
+    free(pool->busy_ns);
+    free(pool);
+}
@@ -0,0 +1,115 @@
+/**
+ * 向量化的分隔符扫描
+ * 每次比较16（SSE2）或32（AVX2）个字节，把命中分隔符的位置压成位掩码后逐位报告单词，
+ * 单词之间只有一次分支，不再逐字节判断；不支持的平台退回逐字节查表
+ */
+#include "mapreduce.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__SSE2__)
+#include <immintrin.h>
+#define HAVE_SSE2 1
+#endif
+
+#define MAX_SIMD_DELIMS 8  // 向量路径支持的最多分隔符个数，超过时逐字节查表
+
+/**
+ * 报告位掩码中每个分隔符之前的单词
+ *
+ * @param block 掩码对应的起始地址
+ * @param mask 第i位为1表示block[i]是分隔符
+ * @param token 当前单词的起始地址
+ * @return 最后一个分隔符之后的单词起始地址
+ */
+static inline const char* report_mask(const char* block, unsigned int mask, const char* token, TokenHandler handler, void* arg) {
+    while (mask != 0) {
+        const char* delim = block + __builtin_ctz(mask);
+        handler(token, delim - token, *delim, arg);
+        token = delim + 1;
+        mask &= mask - 1;
+    }
+    return token;
+}
+
+/**
+ * 逐字节扫描[p, end)，返回最后一个分隔符之后的单词起始地址
+ */
+static const char* scan_scalar(const char* p, const char* end, const char* token, const unsigned char* is_delim, TokenHandler handler, void* arg) {
+    for (; p < end; ++p) {
+        if (!is_delim[( unsigned char )*p])
+            continue;
+        handler(token, p - token, *p, arg);
+        token = p + 1;
+    }
+    return token;
+}
+
+#ifdef HAVE_SSE2
+static const char* scan_sse2(const char** pos, const char* end, const char* token, const char* delims, int num_delims, TokenHandler handler, void* arg) {
+    __m128i sets[MAX_SIMD_DELIMS];
+    for (int i = 0; i < num_delims; ++i)
+        sets[i] = _mm_set1_epi8(delims[i]);
+
+    const char* p = *pos;
+    for (; end - p >= 16; p += 16) {
+        __m128i block = _mm_loadu_si128(( const __m128i* )p);
+        __m128i hits  = _mm_cmpeq_epi8(block, sets[0]);
+        for (int i = 1; i < num_delims; ++i)
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, sets[i]));
+        token = report_mask(p, ( unsigned int )_mm_movemask_epi8(hits), token, handler, arg);
+    }
+    *pos = p;
+    return token;
+}
+
+__attribute__((target("avx2"))) static const char* scan_avx2(const char** pos, const char* end, const char* token, const char* delims, int num_delims, TokenHandler handler, void* arg) {
+    __m256i sets[MAX_SIMD_DELIMS];
+    for (int i = 0; i < num_delims; ++i)
+        sets[i] = _mm256_set1_epi8(delims[i]);
+
+    const char* p = *pos;
+    for (; end - p >= 32; p += 32) {
+        __m256i block = _mm256_loadu_si256(( const __m256i* )p);
+        __m256i hits  = _mm256_cmpeq_epi8(block, sets[0]);
+        for (int i = 1; i < num_delims; ++i)
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, sets[i]));
+        token = report_mask(p, ( unsigned int )_mm256_movemask_epi8(hits), token, handler, arg);
+    }
+    *pos = p;
+    return token;
+}
+#endif
+
+/**
+ * 按分隔符切分一段文本
+ * 每个分隔符结束一个单词，相邻分隔符之间报告空单词；最后一个分隔符之后
+ * 剩余的内容作为最后一个单词报告，其delim为'\0'（文本以分隔符结尾时为空单词）
+ * 支持AVX2的CPU上每次比较32字节，否则在x86-64上用SSE2每次比较16字节
+ *
+ * @param data 文本，不要求以'\0'结尾
+ * @param length 文本长度
+ * @param delims 分隔符集合，如" \t\n\r"，不能包含'\0'
+ * @param handler 每个单词调用一次
+ * @param arg 原样传给handler
+ */
+void MR_Tokenize(const char* data, size_t length, const char* delims, TokenHandler handler, void* arg) {
+    const char* p          = data;
+    const char* end        = data + length;
+    const char* token      = data;
+    int         num_delims = strlen(delims);
+
+#ifdef HAVE_SSE2
+    if (num_delims > 0 && num_delims <= MAX_SIMD_DELIMS) {
+        if (__builtin_cpu_supports("avx2"))
+            token = scan_avx2(&p, end, token, delims, num_delims, handler, arg);
+        token = scan_sse2(&p, end, token, delims, num_delims, handler, arg);
+    }
+#endif
+
+    unsigned char is_delim[256] = {0};
+    for (const char* d = delims; *d != '\0'; ++d)
+        is_delim[( unsigned char )*d] = 1;
+    token = scan_scalar(p, end, token, is_delim, handler, arg);
+    handler(token, end - token, '\0', arg);
+}
@@ -0,0 +1,120 @@
+/**
+ * 前K个键的聚合
+ * 每个归约线程维护一个大小为K的小顶堆，归约阶段结束后把各堆合并为一个，
+ * 不必输出全部键再在外部排序
+ */
+#include "topk.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void topk_init(struct topk_t* heap, int k) {
+    heap->entries = k > 0 ? ( MR_TopKEntry* )malloc(sizeof(MR_TopKEntry) * k) : NULL;
+    heap->count   = 0;
+    heap->k       = k;
+}
+
+/**
+ * 判断a是否比b差：分数更低，或分数相同而键更大
+ */
+static int worse(const MR_TopKEntry* a, const MR_TopKEntry* b) {
+    if (a->score != b->score)
+        return a->score < b->score;
+    return strcmp(a->key, b->key) > 0;
+}
+
+static void sift_up(struct topk_t* heap, int i) {
+    MR_TopKEntry* e = heap->entries;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!worse(&e[i], &e[parent]))
+            break;
+        MR_TopKEntry tmp = e[i];
+        e[i]             = e[parent];
+        e[parent]        = tmp;
+        i                = parent;
+    }
+}
+
+static void sift_down(struct topk_t* heap, int i) {
+    MR_TopKEntry* e = heap->entries;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= heap->count)
+            break;
+        if (child + 1 < heap->count && worse(&e[child + 1], &e[child]))
+            child++;
+        if (!worse(&e[child], &e[i]))
+            break;
+        MR_TopKEntry tmp = e[i];
+        e[i]             = e[child];
+        e[child]         = tmp;
+        i                = child;
+    }
+}
+
+/**
+ * 提交一个键的分数，堆未满或它比堆顶好时才拷贝键并入堆
+ *
+ * @param key 键，不要求以'\0'结尾
+ * @param key_len 键长度
+ */
+void topk_offer(struct topk_t* heap, const char* key, size_t key_len, int64_t score) {
+    if (heap->k <= 0)
+        return;
+    if (heap->count == heap->k) {
+        // 与堆顶比较：分数相同时按键比较，需要先得到以'\0'结尾的比较结果
+        MR_TopKEntry* top = &heap->entries[0];
+        if (score < top->score)
+            return;
+        if (score == top->score) {
+            int cmp = strncmp(key, top->key, key_len);
+            if (cmp > 0 || (cmp == 0 && top->key[key_len] == '\0'))
+                return;
+        }
+        free(top->key);
+        top->key   = strndup(key, key_len);
+        top->score = score;
+        sift_down(heap, 0);
+        return;
+    }
+    MR_TopKEntry* entry = &heap->entries[heap->count++];
+    entry->key          = strndup(key, key_len);
+    entry->score        = score;
+    sift_up(heap, heap->count - 1);
+}
+
+/**
+ * 把from中的键并入into，并清空from
+ */
+void topk_merge(struct topk_t* into, struct topk_t* from) {
+    for (int i = 0; i < from->count; ++i) {
+        topk_offer(into, from->entries[i].key, strlen(from->entries[i].key), from->entries[i].score);
+        free(from->entries[i].key);
+    }
+    from->count = 0;
+}
+
+static int compare_entries(const void* a, const void* b) {
+    const MR_TopKEntry* ea = ( const MR_TopKEntry* )a;
+    const MR_TopKEntry* eb = ( const MR_TopKEntry* )b;
+    if (worse(ea, eb))
+        return 1;
+    return worse(eb, ea) ? -1 : 0;
+}
+
+/**
+ * 把堆中的键按分数从高到低排列，之后不能再提交
+ */
+void topk_sort(struct topk_t* heap) {
+    qsort(heap->entries, heap->count, sizeof(MR_TopKEntry), compare_entries);
+}
+
+void topk_free(struct topk_t* heap) {
+    for (int i = 0; i < heap->count; ++i)
+        free(heap->entries[i].key);
+    free(heap->entries);
+    heap->entries = NULL;
+    heap->count   = 0;
+    heap->k       = 0;
+}
@@ -2,25 +2,450 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
-void insert_info(struct partition_t* part, char* key) {
-    struct info_node_t* new_info = ( struct info_node_t* )malloc(sizeof(struct info_node_t));
+#define INIT_CAPACITY 64          // 哈希表初始槽位数
+#define ARENA_CHUNK   (64 * 1024)  // 分区分配器每块的大小
+#define INTERN_PROBE  4096         // 驻留请求达到该次数后检查重复率
+#define PACK_PREFETCH 4            // 展开值链表时提前预取的键节点数
 
-    new_info->info    = ( char* )malloc(sizeof(char) * (strlen(key) + 1));
-    new_info->data    = NULL;
-    new_info->proceed = 0;
-    new_info->next    = NULL;
-    strcpy(new_info->info, key);
+/**
+ * 由哈希值计算起始槽位
+ * 同一分区内的键哈希值模分区数相同，低位分布不均，
+ * 因此先乘以黄金分割常数再取高位，打散后再按容量取模
+ */
+static inline unsigned long slot_of(unsigned long hash, unsigned long capacity) {
+    return ((hash * 0x9E3779B97F4A7C15UL) >> 32) & (capacity - 1);
+}
+
+/**
+ * 单调时钟的当前时间（纳秒），用于统计各阶段耗时
+ */
+unsigned long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ( unsigned long )ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/**
+ * 64位乘法的高低两半异或，wyhash的基本混合步骤
+ */
+static inline uint64_t mix64(uint64_t a, uint64_t b) {
+    __uint128_t product = ( __uint128_t )a * b;
+    return ( uint64_t )product ^ ( uint64_t )(product >> 64);
+}
+
+/**
+ * 对长度为len、不要求以'\0'结尾的字符串计算哈希值，分区函数与分区内哈希表共用
+ * 按wyhash的方式每次读入8字节做一次乘法混合，比逐字节的DJB哈希快，
+ * 且低位分布均匀，按分区数取模时各分区的键数更接近
+ *
+ * @param key 字符串
+ * @param len 字符串长度
+ * @return 哈希值
+ */
+unsigned long hash_key_n(const char* key, size_t len) {
+    const uint64_t seed0 = 0xa0761d6478bd642fUL;
+    const uint64_t seed1 = 0xe7037ed1a0b428dbUL;
+    uint64_t       hash  = seed0 ^ len;
+    uint64_t       word;
+    for (; len >= 8; key += 8, len -= 8) {
+        memcpy(&word, key, 8);
+        hash = mix64(hash ^ word, seed1);
+    }
+    word = 0;
+    memcpy(&word, key, len);
+    return mix64(hash ^ word, seed1 ^ len);
+}
+
+/**
+ * 计算以'\0'结尾的键的哈希值，结果与hash_key_n一致
+ */
+unsigned long hash_key(char* key) {
+    return hash_key_n(key, strlen(key));
+}
+
+void init_intern(struct intern_table_t* table) {
+    table->capacity = INIT_CAPACITY;
+    table->size     = 0;
+    table->lookups  = 0;
+    table->disabled = 0;
+    table->slots    = ( char** )calloc(table->capacity, sizeof(char*));
+    table->hashes   = ( unsigned long* )malloc(sizeof(unsigned long) * table->capacity);
+}
+
+static void grow_intern(struct intern_table_t* table) {
+    unsigned long  new_capacity = table->capacity * 2;
+    char**         new_slots    = ( char** )calloc(new_capacity, sizeof(char*));
+    unsigned long* new_hashes   = ( unsigned long* )malloc(sizeof(unsigned long) * new_capacity);
+
+    for (unsigned long i = 0; i < table->capacity; ++i) {
+        if (table->slots[i] == NULL)
+            continue;
+        unsigned long slot = slot_of(table->hashes[i], new_capacity);
+        while (new_slots[slot] != NULL)
+            slot = (slot + 1) & (new_capacity - 1);
+        new_slots[slot]  = table->slots[i];
+        new_hashes[slot] = table->hashes[i];
+    }
+
+    free(table->slots);
+    free(table->hashes);
+    table->slots    = new_slots;
+    table->hashes   = new_hashes;
+    table->capacity = new_capacity;
+}
+
+/**
+ * 返回与str内容相同的驻留副本，不存在时在arena中创建
+ * 前INTERN_PROBE次请求中若超过一半是新字符串，则认为重复率过低，
+ * 之后直接拷贝并释放哈希表
+ *
+ * @param table 驻留表
+ * @param arena 存放字符串的分配器
+ * @param str 要驻留的字符串
+ * @return 驻留副本，生命周期与arena相同
+ */
+char* intern_string(struct intern_table_t* table, struct arena_t* arena, char* str) {
+    if (table->disabled)
+        return arena_strdup(arena, str);
+
+    unsigned long hash = hash_key(str);
+    unsigned long slot = slot_of(hash, table->capacity);
+    for (; table->slots[slot] != NULL; slot = (slot + 1) & (table->capacity - 1)) {
+        if (table->hashes[slot] == hash && strcmp(table->slots[slot], str) == 0) {
+            table->lookups++;
+            return table->slots[slot];
+        }
+    }
+
+    char* copy          = arena_strdup(arena, str);
+    table->slots[slot]  = copy;
+    table->hashes[slot] = hash;
+    table->size++;
+    table->lookups++;
+
+    if (table->lookups == INTERN_PROBE && table->size * 2 > table->lookups) {
+        free_intern(table);
+        table->disabled = 1;
+    } else if (table->size * 2 > table->capacity) {
+        grow_intern(table);
+    }
+    return copy;
+}
+
+void free_intern(struct intern_table_t* table) {
+    free(table->slots);
+    free(table->hashes);
+    table->slots  = NULL;
+    table->hashes = NULL;
+}
+
+static void init_stripe(struct stripe_t* stripe) {
+    stripe->info_head = NULL;
+    stripe->capacity  = INIT_CAPACITY;
+    stripe->size      = 0;
+    stripe->table     = ( struct info_node_t** )calloc(stripe->capacity, sizeof(struct info_node_t*));
+    arena_init(&stripe->keys, ARENA_CHUNK);
+    arena_init(&stripe->arena, ARENA_CHUNK);
+    init_intern(&stripe->values);
+}
+
+static void release_stripe(struct stripe_t* stripe) {
+    free(stripe->table);
+    free_intern(&stripe->values);
+    arena_release(&stripe->keys);
+    arena_release(&stripe->arena);
+    stripe->table     = NULL;
+    stripe->info_head = NULL;
+    stripe->size      = 0;
+}
+
+void init_partition(struct partition_t* part) {
+    for (int i = 0; i < PARTITION_STRIPES; ++i) {
+        pthread_mutex_init(&part->stripes[i].lock, NULL);
+        init_stripe(&part->stripes[i]);
+    }
+    part->sorted      = NULL;
+    part->size        = 0;
+    part->next_key    = 0;
+    part->stealable   = 0;
+    part->reduced     = 0;
+    part->values      = NULL;
+    part->value_start = NULL;
+}
+
+/**
+ * 由哈希值确定键所在的分段
+ * 取混合后的最高几位，与slot_of使用的位不重叠
+ */
+struct stripe_t* stripe_of(struct partition_t* part, unsigned long hash) {
+    return &part->stripes[(hash * 0x9E3779B97F4A7C15UL) >> (64 - STRIPE_BITS)];
+}
+
+/**
+ * 将哈希表扩容为原来的两倍并重新插入所有键
+ * 键链表info_head保持不变，只重建槽位数组
+ */
+static void grow_table(struct stripe_t* stripe) {
+    unsigned long        new_capacity = stripe->capacity * 2;
+    struct info_node_t** new_table    = ( struct info_node_t** )calloc(new_capacity, sizeof(struct info_node_t*));
+
+    for (unsigned long i = 0; i < stripe->capacity; ++i) {
+        struct info_node_t* node = stripe->table[i];
+        if (node == NULL)
+            continue;
+        unsigned long slot = slot_of(node->hash, new_capacity);
+        while (new_table[slot] != NULL)
+            slot = (slot + 1) & (new_capacity - 1);
+        new_table[slot] = node;
+    }
 
-    new_info->next  = part->info_head;
-    part->info_head = new_info;
+    free(stripe->table);
+    stripe->table    = new_table;
+    stripe->capacity = new_capacity;
 }
 
-void insert_data(struct info_node_t* info, char* value) {
-    struct data_node_t* new_node = ( struct data_node_t* )malloc(sizeof(struct data_node_t));
-    new_node->value              = ( char* )malloc(sizeof(char) * (strlen(value) + 1));
-    new_node->proceed            = 0;
-    strcpy(new_node->value, value);
-    new_node->next = info->data;
-    info->data     = new_node;
-}
\ No newline at end of file
+/**
+ * 在键所在的分段中线性探测查找键
+ * 映射阶段调用者需持有该分段的锁
+ *
+ * @param part 分区
+ * @param key 要查找的键，不要求以'\0'结尾
+ * @param len 键长度
+ * @param hash 键的哈希值（由hash_key_n计算）
+ * @return 找到返回键节点，否则返回NULL
+ */
+struct info_node_t* find_info(struct partition_t* part, const char* key, size_t len, unsigned long hash) {
+    struct stripe_t* stripe = stripe_of(part, hash);
+    unsigned long    slot   = slot_of(hash, stripe->capacity);
+    for (; stripe->table[slot] != NULL; slot = (slot + 1) & (stripe->capacity - 1)) {
+        struct info_node_t* node = stripe->table[slot];
+        if (node->hash == hash && node->info_len == len && memcmp(node->info, key, len) == 0)
+            return node;
+    }
+    return NULL;
+}
+
+/**
+ * 插入新键，调用者需保证该键尚不存在并持有其分段的锁
+ * 装载因子超过1/2时扩容
+ *
+ * @return 新建的键节点
+ */
+struct info_node_t* insert_info(struct partition_t* part, const char* key, size_t len, unsigned long hash) {
+    struct stripe_t*    stripe   = stripe_of(part, hash);
+    struct info_node_t* new_info = ( struct info_node_t* )arena_alloc(&stripe->keys, sizeof(struct info_node_t));
+
+    new_info->info = ( char* )arena_alloc(&stripe->keys, len + 1);
+    memcpy(new_info->info, key, len);
+    new_info->info[len] = '\0';
+    new_info->info_len  = len;
+    new_info->hash      = hash;
+    new_info->data      = NULL;
+    new_info->cursor    = NULL;
+    new_info->next      = NULL;
+
+    new_info->ints       = NULL;
+    new_info->num_ints   = 0;
+    new_info->ints_cap   = 0;
+    new_info->int_cursor = 0;
+    new_info->output     = NULL;
+    new_info->output_len = 0;
+    new_info->output_cap = 0;
+
+    new_info->next    = stripe->info_head;
+    stripe->info_head = new_info;
+
+    if ((stripe->size + 1) * 2 > stripe->capacity)
+        grow_table(stripe);
+    unsigned long slot = slot_of(hash, stripe->capacity);
+    while (stripe->table[slot] != NULL)
+        slot = (slot + 1) & (stripe->capacity - 1);
+    stripe->table[slot] = new_info;
+    stripe->size++;
+
+    return new_info;
+}
+
+void insert_data(struct partition_t* part, struct info_node_t* info, char* value) {
+    struct stripe_t*    stripe   = stripe_of(part, info->hash);
+    struct data_node_t* new_node = ( struct data_node_t* )arena_alloc(&stripe->arena, sizeof(struct data_node_t));
+    new_node->value              = intern_string(&stripe->values, &stripe->arena, value);
+    new_node->next               = info->data;
+    info->data                   = new_node;
+    info->cursor                 = new_node;
+}
+
+/**
+ * 追加一个整数值，数组满时在分配器中按两倍容量重新分配
+ * 旧数组留在分配器中随分区释放，总占用不超过最终容量的两倍
+ */
+void insert_int(struct partition_t* part, struct info_node_t* info, int64_t value) {
+    if (info->num_ints == info->ints_cap) {
+        struct stripe_t* stripe  = stripe_of(part, info->hash);
+        unsigned long    new_cap = info->ints_cap == 0 ? 4 : info->ints_cap * 2;
+        int64_t*         ints    = ( int64_t* )arena_alloc(&stripe->arena, sizeof(int64_t) * new_cap);
+        if (info->num_ints > 0)
+            memcpy(ints, info->ints, sizeof(int64_t) * info->num_ints);
+        info->ints     = ints;
+        info->ints_cap = new_cap;
+    }
+    info->ints[info->num_ints++] = value;
+}
+
+static int compare_info(const void* a, const void* b) {
+    return strcmp((*( struct info_node_t* const* )a)->info, (*( struct info_node_t* const* )b)->info);
+}
+
+/**
+ * 映射阶段结束后对分区所有分段的键统一排序
+ * 结果存入part->sorted，归约阶段按此顺序依次处理各键
+ */
+void sort_partition(struct partition_t* part) {
+    part->size = 0;
+    for (int i = 0; i < PARTITION_STRIPES; ++i)
+        part->size += part->stripes[i].size;
+    part->sorted = ( struct info_node_t** )malloc(sizeof(struct info_node_t*) * (part->size + 1));
+
+    unsigned long n = 0;
+    for (int i = 0; i < PARTITION_STRIPES; ++i) {
+        for (struct info_node_t* node = part->stripes[i].info_head; node != NULL; node = node->next)
+            part->sorted[n++] = node;
+    }
+    qsort(part->sorted, part->size, sizeof(struct info_node_t*), compare_info);
+    part->next_key = 0;
+}
+
+/**
+ * 把已排序分区中各键的值链表展开到连续数组：第i个键的值在values中占一段连续区间，
+ * 顺序与链表相同。归约时顺序扫描数组并预取后面的值，不必逐个追随分散在分配器中的节点
+ * 链表保持不变，按键查找的旧路径仍然可用
+ */
+void pack_partition(struct partition_t* part) {
+    size_t cap        = part->size + 1;
+    size_t n          = 0;
+    part->values      = ( char** )malloc(sizeof(char*) * cap);
+    part->value_start = ( unsigned long* )malloc(sizeof(unsigned long) * (part->size + 1));
+    for (unsigned long k = 0; k < part->size; ++k) {
+        // 提前取入后面的键节点，展开当前链表时它们的首个值节点地址已经就绪
+        if (k + PACK_PREFETCH < part->size)
+            __builtin_prefetch(part->sorted[k + PACK_PREFETCH]);
+        part->value_start[k] = n;
+        for (struct data_node_t* data = part->sorted[k]->data; data != NULL; data = data->next) {
+            if (data->next != NULL)
+                __builtin_prefetch(data->next);
+            if (n == cap) {
+                cap *= 2;
+                part->values = ( char** )realloc(part->values, sizeof(char*) * cap);
+            }
+            part->values[n++] = data->value;
+        }
+    }
+    part->value_start[part->size] = n;
+}
+
+/**
+ * 释放pack_partition展开的值数组
+ */
+static void free_packed(struct partition_t* part) {
+    free(part->values);
+    free(part->value_start);
+    part->values      = NULL;
+    part->value_start = NULL;
+}
+
+/**
+ * 分区各分段分配器向系统申请的总字节数
+ */
+size_t partition_bytes(struct partition_t* part) {
+    size_t bytes = 0;
+    for (int i = 0; i < PARTITION_STRIPES; ++i)
+        bytes += part->stripes[i].keys.bytes + part->stripes[i].arena.bytes;
+    return bytes;
+}
+
+/**
+ * 分区的键都归约完后，把各分段中的值节点、整数数组和值字符串还给系统
+ * 键节点和排序数组保留下来，归约阶段结束后仍要按键序写出MR_Output的内容；
+ * 各键的值指针一并清空，之后再读取这些键只会得到没有更多值
+ *
+ * @return 释放的字节数
+ */
+size_t release_values(struct partition_t* part) {
+    size_t bytes = 0;
+    for (unsigned long k = 0; k < part->size; ++k) {
+        struct info_node_t* node = part->sorted[k];
+        node->data               = NULL;
+        node->cursor             = NULL;
+        node->ints               = NULL;
+        node->num_ints           = 0;
+        node->ints_cap           = 0;
+        node->int_cursor         = 0;
+    }
+    for (int i = 0; i < PARTITION_STRIPES; ++i) {
+        struct stripe_t* stripe = &part->stripes[i];
+        bytes += stripe->arena.bytes;
+        arena_release(&stripe->arena);
+        free_intern(&stripe->values);
+        init_intern(&stripe->values);
+    }
+    if (part->values != NULL)
+        bytes += sizeof(char*) * part->value_start[part->size] + sizeof(unsigned long) * (part->size + 1);
+    free_packed(part);
+    return bytes;
+}
+
+/**
+ * 清空分区中的全部键值对，分段锁保持不变
+ * 溢写后调用，调用者需持有所有分段的锁
+ */
+void clear_partition(struct partition_t* part) {
+    for (int i = 0; i < PARTITION_STRIPES; ++i) {
+        release_stripe(&part->stripes[i]);
+        init_stripe(&part->stripes[i]);
+    }
+    free(part->sorted);
+    free_packed(part);
+    part->sorted   = NULL;
+    part->size     = 0;
+    part->next_key = 0;
+}
+
+/**
+ * 清空分区以便下一个作业复用：哈希表保留已扩容的槽位数组，
+ * 分配器保留已申请的块，下一个作业不必从头扩容
+ */
+void reset_partition(struct partition_t* part) {
+    for (int i = 0; i < PARTITION_STRIPES; ++i) {
+        struct stripe_t* stripe = &part->stripes[i];
+        memset(stripe->table, 0, sizeof(struct info_node_t*) * stripe->capacity);
+        stripe->info_head = NULL;
+        stripe->size      = 0;
+        arena_reset(&stripe->keys);
+        arena_reset(&stripe->arena);
+        free_intern(&stripe->values);
+        init_intern(&stripe->values);
+    }
+    free(part->sorted);
+    free_packed(part);
+    part->sorted    = NULL;
+    part->size      = 0;
+    part->next_key  = 0;
+    part->stealable = 0;
+    part->reduced   = 0;
+}
+
+/**
+ * 释放分区的哈希表、排序数组、分段锁以及分配器中的全部节点和字符串
+ */
+void free_partition(struct partition_t* part) {
+    for (int i = 0; i < PARTITION_STRIPES; ++i) {
+        release_stripe(&part->stripes[i]);
+        pthread_mutex_destroy(&part->stripes[i].lock);
+    }
+    free(part->sorted);
+    free_packed(part);
+    part->sorted = NULL;
+    part->size   = 0;
+}
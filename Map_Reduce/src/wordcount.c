@@ -6,32 +6,58 @@
 #include <stdlib.h>
 #include <string.h>
 
-void Map(char* file_name) {
-    FILE* fp = fopen(file_name, "r");
-    assert(fp != NULL);
-
-    char*  line = NULL;
-    size_t size = 0;
-    while (getline(&line, &size, fp) != -1) {
-        char *token, *dummy = line;
-        while ((token = strsep(&dummy, " \t\n\r")) != NULL) {
-            MR_Emit(token, "1");
-        }
-    }
-    free(line);
-    fclose(fp);
+static void emit_word(const char* token, size_t length, char delim, void* arg) {
+    ( void )arg;
+    // 以'\n'结尾的行之后不再有剩余内容，行末的空单词已在换行符处发射
+    if (delim == '\0' && length == 0 && token[-1] == '\n')
+        return;
+    MR_EmitInt64N(token, length, 1);
+    if (delim == '\n')
+        MR_EmitInt64N(token + length + 1, 0, 1);
+}
+
+// Same tokens as running strsep(" \t\n\r") over each line, but straight
+// out of the mapped chunk: every delimiter ends a token, and every line
+// ends with one more (possibly empty) token after its last delimiter.
+void Map(MR_Chunk* chunk) {
+    MR_Input input;
+    int      rc = MR_MapInput(chunk, &input);
+    assert(rc == 0);
+
+    if (input.length > 0)
+        MR_Tokenize(input.data, input.length, " \t\n\r", emit_word, NULL);
+    MR_UnmapInput(&input);
+}
+
+void Combine(char* key, CombineGetter get_next) {
+    ( void )get_next;  // 整数值由MR_CombineNextInt64取出
+    int64_t count = 0;
+    int64_t value;
+    while (MR_CombineNextInt64(&value))
+        count += value;
+    MR_EmitToReducerInt64(key, count);
 }
 
 void Reduce(char* key, Getter get_next, int partition_number) {
-    int   count = 0;
-    char* value;
-    while ((value = get_next(key, partition_number)) != NULL)
-        count++;
-    printf("%s %d\n", key, count);
+    ( void )get_next;  // 值由MR_GetBatchInt64成批取出
+    int64_t count = 0;
+    int64_t values[256];
+    int     n;
+    while ((n = MR_GetBatchInt64(key, partition_number, values, 256)) > 0) {
+        for (int i = 0; i < n; ++i)
+            count += values[i];
+    }
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%ld", ( long )count);
+    MR_Output(key, buf);
 }
 
 int main(int argc, char* argv[]) {
-    MR_Run(argc, argv, Map, 10, Reduce, 10, MR_DefaultHashPartition);
+    // 没有输入文件时统计标准输入
+    if (argc < 2)
+        MR_RunStream(stdin, Map, MR_AUTO, Reduce, MR_AUTO, Combine, MR_DefaultHashPartition, 4 << 20);
+    else
+        MR_RunChunked(argc, argv, Map, MR_AUTO, Reduce, MR_AUTO, Combine, MR_DefaultHashPartition, 4 << 20);
 }
 
 // int main() {}
\ No newline at end of file
@@ -0,0 +1,288 @@
+/**
+ * reverse吞吐量基准测试
+ * 按指定大小和行长分布生成输入文件，分别以不同的输入方式运行reverse，
+ * 输出每次运行的MB/s和子进程的峰值RSS，用于衡量I/O路径的改动
+ *
+ * 输入方式：
+ *   file   - reverse <input> <output>，映射输入文件
+ *   stdin  - reverse < input，标准输入是普通文件，同样走映射
+ *   pipe   - 经管道输入，走按内存预算读入缓冲区的路径
+ *   spool  - 经管道输入且REVERSE_MEMORY很小，走暂存到临时文件的路径
+ *
+ * 编译（在Reverse目录下）：
+ *   gcc -O2 bench/bench.c -lm -o reverse_bench
+ *
+ * 用法：
+ *   reverse_bench [-b reverse路径] [-s 大小MB列表] [-l short|uniform|long]
+ *                 [-m 输入方式列表] [-r 重复次数] [-k spool的内存预算] [-d 目录] [-o 输出文件]
+ * 列表以逗号分隔，如 -s 1,64,1024,10240；生成的输入留在目录中，下次运行时复用
+ */
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_SIZES   16         // 大小列表的最大长度
+#define MAX_LINE    65536      // 生成的最长行
+#define WRITE_CHUNK (1 << 20)  // 管道输入时每次写出的字节数
+
+/**
+ * xorshift64*伪随机数，固定种子保证每次生成的输入相同
+ */
+static unsigned long next_random(unsigned long* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DUL;
+}
+
+/**
+ * 按分布抽取一行的长度（不含换行符）
+ * short为8到24字节，uniform为0到200字节，long为帕累托分布的长尾，大多数行较短，偶有上万字节的行
+ */
+static int line_length(unsigned long* state, const char* dist) {
+    unsigned long r = next_random(state);
+    if (strcmp(dist, "short") == 0)
+        return 8 + r % 17;
+    if (strcmp(dist, "uniform") == 0)
+        return r % 201;
+    double u   = ((r >> 11) + 1) * (1.0 / 9007199254740992.0);
+    double len = 20 / pow(u, 1 / 1.2);
+    return len > MAX_LINE ? MAX_LINE : ( int )len;
+}
+
+/**
+ * 生成约total_bytes字节的输入文件，已存在且大小一致时直接复用
+ *
+ * @return 文件的实际大小
+ */
+static long generate_input(const char* path, long total_bytes, const char* dist) {
+    FILE* fp = fopen(path, "r");
+    if (fp != NULL) {
+        fseek(fp, 0, SEEK_END);
+        long size = ftell(fp);
+        fclose(fp);
+        if (size >= total_bytes && size < total_bytes + MAX_LINE + 1)
+            return size;
+    }
+
+    fp = fopen(path, "w");
+    if (fp == NULL) {
+        perror(path);
+        exit(1);
+    }
+    static const char letters[] = "abcdefghijklmnopqrstuvwxyz      ";
+    unsigned long     state     = 0x9E3779B97F4A7C15UL;
+    char*             line      = ( char* )malloc(MAX_LINE + 1);
+    long              written   = 0;
+    while (written < total_bytes) {
+        int len = line_length(&state, dist);
+        for (int i = 0; i < len; i += 8) {
+            unsigned long r = next_random(&state);
+            for (int j = i; j < i + 8 && j < len; ++j, r >>= 5)
+                line[j] = letters[r & 31];
+        }
+        line[len] = '\n';
+        fwrite(line, 1, len + 1, fp);
+        written += len + 1;
+    }
+    free(line);
+    if (fclose(fp) != 0) {
+        perror(path);
+        exit(1);
+    }
+    return written;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * 把文件内容写入管道，写完后关闭管道
+ */
+static void feed_pipe(const char* path, int fd) {
+    int   in  = open(path, O_RDONLY);
+    char* buf = ( char* )malloc(WRITE_CHUNK);
+    if (in < 0) {
+        perror(path);
+        exit(1);
+    }
+    ssize_t n;
+    while ((n = read(in, buf, WRITE_CHUNK)) > 0) {
+        for (ssize_t done = 0; done < n;) {
+            ssize_t w = write(fd, buf + done, n - done);
+            if (w < 0) {
+                perror("write");
+                exit(1);
+            }
+            done += w;
+        }
+    }
+    free(buf);
+    close(in);
+    close(fd);
+}
+
+/**
+ * 以指定输入方式运行一次reverse
+ *
+ * @param peak_kb 返回子进程的峰值RSS（KB）
+ * @return 返回耗时（秒），失败返回负数
+ */
+static double run_once(const char* reverse, const char* mode, const char* input, const char* output, const char* spool_memory, long* peak_kb) {
+    int fds[2] = {-1, -1};
+    int piped  = strcmp(mode, "pipe") == 0 || strcmp(mode, "spool") == 0;
+    if (piped && pipe(fds) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+
+    double start = now_seconds();
+    pid_t  pid   = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        if (strcmp(mode, "spool") == 0)
+            setenv("REVERSE_MEMORY", spool_memory, 1);
+        if (strcmp(mode, "file") == 0) {
+            execl(reverse, reverse, input, output, ( char* )NULL);
+        } else {
+            int in  = piped ? fds[0] : open(input, O_RDONLY);
+            int out = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (in < 0 || out < 0) {
+                perror("open");
+                _exit(127);
+            }
+            dup2(in, STDIN_FILENO);
+            dup2(out, STDOUT_FILENO);
+            if (piped)
+                close(fds[1]);
+            execl(reverse, reverse, ( char* )NULL);
+        }
+        perror(reverse);
+        _exit(127);
+    }
+    if (piped) {
+        close(fds[0]);
+        feed_pipe(input, fds[1]);
+    }
+
+    int           status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        perror("wait4");
+        exit(1);
+    }
+    double elapsed = now_seconds() - start;
+    *peak_kb       = usage.ru_maxrss;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return -1;
+    return elapsed;
+}
+
+/**
+ * 解析逗号分隔的列表
+ *
+ * @return 列表长度
+ */
+static int parse_list(char* arg, char** out) {
+    int   count = 0;
+    char* token;
+    while ((token = strsep(&arg, ",")) != NULL && count < MAX_SIZES) {
+        if (*token != '\0')
+            out[count++] = token;
+    }
+    return count;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [-b reverse] [-s size_mb,...] [-l short|uniform|long] [-m file,stdin,pipe,spool]\n"
+            "          [-r repeats] [-k spool_memory] [-d dir] [-o output]\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    const char* reverse      = "./reverse";
+    const char* dist         = "uniform";
+    const char* dir          = "/tmp";
+    const char* output       = "/dev/null";
+    const char* spool_memory = "4194304";
+    int         repeats      = 3;
+    char*       sizes[MAX_SIZES];
+    char*       modes[MAX_SIZES];
+    char        default_sizes[] = "1,16,256";
+    char        default_modes[] = "file,stdin,pipe,spool";
+    int         num_sizes       = parse_list(default_sizes, sizes);
+    int         num_modes       = parse_list(default_modes, modes);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "b:s:l:m:r:k:d:o:")) != -1) {
+        switch (opt) {
+        case 'b': reverse = optarg; break;
+        case 's': num_sizes = parse_list(optarg, sizes); break;
+        case 'l': dist = optarg; break;
+        case 'm': num_modes = parse_list(optarg, modes); break;
+        case 'r': repeats = atoi(optarg); break;
+        case 'k': spool_memory = optarg; break;
+        case 'd': dir = optarg; break;
+        case 'o': output = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (num_sizes == 0 || num_modes == 0 || repeats <= 0)
+        usage(argv[0]);
+    if (strcmp(dist, "short") != 0 && strcmp(dist, "uniform") != 0 && strcmp(dist, "long") != 0)
+        usage(argv[0]);
+    for (int m = 0; m < num_modes; ++m) {
+        if (strcmp(modes[m], "file") != 0 && strcmp(modes[m], "stdin") != 0 && strcmp(modes[m], "pipe") != 0 && strcmp(modes[m], "spool") != 0)
+            usage(argv[0]);
+    }
+    // 管道输入时reverse提前退出不应终止基准测试
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("# reverse=%s lines=%s repeats=%d spool_memory=%s\n", reverse, dist, repeats, spool_memory);
+    printf("%10s %8s %10s %10s %12s\n", "size_mb", "mode", "seconds", "MB/s", "peak_rss_kb");
+    for (int s = 0; s < num_sizes; ++s) {
+        long  size_mb = atol(sizes[s]);
+        char* path    = ( char* )malloc(strlen(dir) + 64);
+        if (size_mb <= 0)
+            usage(argv[0]);
+        sprintf(path, "%s/reverse_bench_%s_%ld.txt", dir, dist, size_mb);
+        long bytes = generate_input(path, size_mb << 20, dist);
+
+        for (int m = 0; m < num_modes; ++m) {
+            // 取多次运行中最快的一次，第一次运行同时预热页缓存
+            double best = -1;
+            long   peak = 0;
+            for (int r = 0; r < repeats; ++r) {
+                long   run_peak;
+                double elapsed = run_once(reverse, modes[m], path, output, spool_memory, &run_peak);
+                if (elapsed < 0) {
+                    fprintf(stderr, "reverse_bench: %s failed on %s\n", modes[m], path);
+                    exit(1);
+                }
+                if (best < 0 || elapsed < best)
+                    best = elapsed;
+                if (run_peak > peak)
+                    peak = run_peak;
+            }
+            printf("%10ld %8s %10.3f %10.1f %12ld\n", size_mb, modes[m], best, bytes / 1048576.0 / best, peak);
+            fflush(stdout);
+        }
+        free(path);
+    }
+    return 0;
+}
@@ -5,79 +5,783 @@
  *   reverse            - 从标准输入读取，输出到标准输出
  *   reverse <input>    - 从input文件读取，输出到标准输出
  *   reverse <input> <output> - 从input文件读取，输出到output文件
+ *   reverse -j <workers> [-o <suffix>] <input>... - 多个输入并行翻转：
+ *       指定suffix时每个输入input写到input<suffix>；否则按输入的相反顺序拼接输出到标准输出，
+ *       即整体翻转所有输入拼接后的内容；只有一个输入时把它在行边界处分成workers块，各块并行翻转
+ *   以上各种形式都可以加 -s <separator> 指定单字节的行分隔符，支持\0、\n、\t、\r、\\转义
+ *   reverse -n <lines> [<input> [<output>]] - 只按翻转顺序输出最后lines行，不与-j同用
  */
+#define _GNU_SOURCE    // memrchr
+#include <fcntl.h>     // fcntl
+#include <limits.h>    // IOV_MAX
+#include <pthread.h>   // 多文件模式的工作线程
 #include <stddef.h>    //引入NULL等
+#include <stdint.h>    // uintptr_t
 #include <stdio.h>     //FILE结构体等
+#include <sys/mman.h>  // mmap
 #include <sys/stat.h>  // 用于获取文件信息(inode号)和stat函数
+#include <sys/uio.h>   // writev
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+#define PREFETCH_WINDOW (16 << 20)   // 反向扫描时提前预读的字节数
+#define DEFAULT_MEMORY  (256 << 20)  // 非普通文件输入的默认内存预算，可用环境变量REVERSE_MEMORY设置
+#define MIN_MEMORY      4096         // 内存预算的下限
+#define TAIL_WINDOW     (64 << 10)   // -n模式从文件末尾向前每次读取的字节数
+
+/**
+ * 行分隔符，默认为换行符，可用-s指定其他字节（如'\0'分隔的记录流）
+ * 查找分隔符用的memrchr在glibc中已按SSE2/AVX2向量化
+ */
+char separator = '\n';
+
+/**
+ * -n指定时剩余可输出的行数，每输出一行减一，为负数时不限
+ */
+long lines_left = -1;
 
 /**
- * 将文本内容按行翻转顺序
+ * 用writev写出一批行，处理部分写入
  * 
- * @param text 输入文本数组，每个元素为一行字符串
- * @param line_count 文本的总行数
- * @return 翻转后的文本数组
- */
-char** reverse_text(char** text, int line_count) {
-    // 为翻转后的文本分配内存
-    char** ret = ( char** )malloc(sizeof(char*) * line_count);
-    if(!ret) {
-        fprintf(stderr, "malloc failed\n");
-        exit(1);
+ * @param fd 输出文件描述符
+ * @param offset 为NULL时写到文件的当前位置；否则用pwritev写到*offset处并前移*offset，
+ *               多个线程可以同时写同一个文件的不同区域
+ * @param iov 各行的地址和长度，写出过程中会被修改
+ * @param count iov中的项数
+ */
+void write_lines(int fd, off_t* offset, struct iovec* iov, int count) {
+    while (count > 0) {
+        ssize_t n = offset != NULL ? pwritev(fd, iov, count, *offset) : writev(fd, iov, count);
+        if (n < 0) {
+            fprintf(stderr, "reverse: write failed\n");
+            exit(1);
+        }
+        if (offset != NULL)
+            *offset += n;
+        // 跳过已写完的行，调整写了一部分的行
+        for (; count > 0 && ( size_t )n >= iov->iov_len; ++iov, --count)
+            n -= iov->iov_len;
+        if (count > 0) {
+            iov->iov_base = ( char* )iov->iov_base + n;
+            iov->iov_len -= n;
+        }
     }
-    // 翻转文本行的顺序
-    for (int i = 0; i < line_count; ++i) {
-        ret[i] = text[line_count - i - 1];
+}
+
+/**
+ * 将文本内容按行翻转顺序输出到指定文件
+ * 从末尾向前查找分隔符，各行直接从text写出，每IOV_MAX行调用一次writev，
+ * 不需要行索引，也不经过格式化和stdio缓冲
+ * 
+ * @param out_fd 输出文件描述符
+ * @param offset 输出位置，含义同write_lines
+ * @param text 全部输入内容
+ * @param length text中的字节数，大于0
+ * @param mapped text是否在文件映射区中；扫描方向与内核预读方向相反，
+ *               所以映射时在扫描位置之前提前预读一个窗口，保持接近顺序的I/O
+ */
+void get_output(int out_fd, off_t* offset, char* text, size_t length, int mapped) {
+    struct iovec iov[IOV_MAX];
+    int          count      = 0;
+    size_t       page       = sysconf(_SC_PAGESIZE);
+    size_t       prefetched = mapped ? length : 0;  // [prefetched, length)已请求预读
+    size_t       pos        = length;               // 当前行的结束位置（含分隔符）
+    while (pos > 0 && lines_left != 0) {
+        while (prefetched > 0 && pos < prefetched + PREFETCH_WINDOW) {
+            // text可能是映射区中间的一块，madvise的起点按地址对齐到页
+            size_t low  = prefetched > PREFETCH_WINDOW ? prefetched - PREFETCH_WINDOW : 0;
+            char*  from = ( char* )(( uintptr_t )(text + low) / page * page);
+            madvise(from, text + prefetched - from, MADV_WILLNEED);
+            prefetched = low;
+        }
+        // 在当前行的分隔符之前查找上一行的分隔符
+        char*  newline      = memrchr(text, separator, pos - (text[pos - 1] == separator));
+        size_t start        = newline != NULL ? newline - text + 1 : 0;
+        iov[count].iov_base = text + start;
+        iov[count].iov_len  = pos - start;
+        ++count;
+        // 最后一行没有分隔符时补上
+        if (pos == length && text[length - 1] != separator) {
+            iov[count].iov_base = &separator;
+            iov[count].iov_len  = 1;
+            ++count;
+        }
+        if (count >= IOV_MAX - 1) {
+            write_lines(out_fd, offset, iov, count);
+            count = 0;
+        }
+        pos = start;
+        if (lines_left > 0)
+            --lines_left;
     }
-    return ret;
+    write_lines(out_fd, offset, iov, count);
 }
 
 /**
- * 将文本内容输出到指定文件
+ * 按需扩容，容量不足时翻倍，保证追加的均摊时间为O(1)
  * 
- * @param file 输出文件指针
- * @param text 要输出的文本数组
- * @param line_count 文本的总行数
+ * @param ptr 待扩容的数组
+ * @param cap 指向数组容量（元素个数）的指针，扩容后更新
+ * @param need 需要的最小容量
+ * @param size 元素大小
+ * @return 扩容后的数组
  */
-void get_output(FILE* file, char** text, int line_count) {
-    for (int i = 0; i < line_count; ++i) {
-        fprintf(file, "%s\n", text[i]);
+void* grow(void* ptr, size_t* cap, size_t need, size_t size) {
+    if (need <= *cap)
+        return ptr;
+    size_t new_cap = *cap;
+    while (new_cap < need)
+        new_cap *= 2;
+    ptr = realloc(ptr, new_cap * size);
+    if (!ptr) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
     }
+    *cap = new_cap;
+    return ptr;
 }
 
 /**
  * 从输入文件读取文本内容
+ * 全部内容读入一块按倍增扩容的连续缓冲区，不限制行数和行长；超出内存预算时停止读取
  * 
  * @param file 输入文件指针
- * @param line_cnt 指向保存行数的变量的指针，用于返回实际读取的行数
- * @return 读取的文本数组
+ * @param budget 内存预算（字节）
+ * @param text_out 用于返回读取的文本内容
+ * @param text_len 用于返回text_out中的字节数
+ * @return 读完全部输入返回0；超出预算返回-1，此时text_out中保留已读入的内容
+ */
+int get_input(FILE* file, size_t budget, char** text_out, size_t* text_len) {
+    size_t text_cap = 4096;
+    char*  text     = ( char* )malloc(text_cap);
+    if (!text) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
+    // 读取文件内容
+    size_t length = 0;
+    size_t n;
+    do {
+        if (length > budget) {
+            *text_out = text;
+            *text_len = length;
+            return -1;
+        }
+        text = ( char* )grow(text, &text_cap, length + 1, 1);
+        n    = fread(text + length, 1, text_cap - length, file);
+        length += n;
+    } while (n > 0);
+    // 通过指针返回内容和长度
+    *text_out = text;
+    *text_len = length;
+    return 0;
+}
+
+/**
+ * 写出全部数据，处理部分写入
+ */
+void write_all(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n < 0) {
+            fprintf(stderr, "reverse: write failed\n");
+            exit(1);
+        }
+        data += n;
+        length -= n;
+    }
+}
+
+/**
+ * 从文件的指定偏移读取length字节
+ */
+void read_at(int fd, char* buf, size_t length, off_t offset) {
+    while (length > 0) {
+        ssize_t n = pread(fd, buf, length, offset);
+        if (n <= 0) {
+            fprintf(stderr, "reverse: read failed\n");
+            exit(1);
+        }
+        buf += n;
+        length -= n;
+        offset += n;
+    }
+}
+
+/**
+ * 从end向前逐个窗口查找分隔符，得到end所在行的起始偏移
+ */
+off_t find_line_start(int fd, off_t end, char* buf, size_t window) {
+    while (end > 0) {
+        off_t low = end > ( off_t )window ? end - ( off_t )window : 0;
+        read_at(fd, buf, end - low, low);
+        char* newline = memrchr(buf, separator, end - low);
+        if (newline != NULL)
+            return low + (newline - buf) + 1;
+        end = low;
+    }
+    return 0;
+}
+
+/**
+ * 后台预读：辅助线程把文件的一段读入缓冲区，调用者同时扫描和写出上一个窗口
+ */
+struct readahead_t {
+    int       fd;
+    char*     buf;
+    size_t    length;
+    off_t     offset;
+    pthread_t thread;
+    int       pending;  // 为1时辅助线程正在读取，等待完成前不能使用buf
+};
+
+void* readahead_worker(void* arg) {
+    struct readahead_t* ahead = ( struct readahead_t* )arg;
+    read_at(ahead->fd, ahead->buf, ahead->length, ahead->offset);
+    return NULL;
+}
+
+/**
+ * 开始在后台把[offset, offset + length)读入buf，无法创建线程时直接读取
+ * 每块一个线程，块至少有几KB，创建线程的开销相对一次读取可以忽略
+ */
+void readahead_start(struct readahead_t* ahead, int fd, char* buf, size_t length, off_t offset) {
+    ahead->fd      = fd;
+    ahead->buf     = buf;
+    ahead->length  = length;
+    ahead->offset  = offset;
+    ahead->pending = pthread_create(&ahead->thread, NULL, readahead_worker, ahead) == 0;
+    if (!ahead->pending)
+        read_at(fd, buf, length, offset);
+}
+
+/**
+ * 等待后台读取完成
+ */
+void readahead_wait(struct readahead_t* ahead) {
+    if (ahead->pending)
+        pthread_join(ahead->thread, NULL);
+    ahead->pending = 0;
+}
+
+/**
+ * 将文件按行翻转写出，每次只读入一个窗口
+ * 从文件末尾向前逐个窗口读取，先写出窗口内完整的行，窗口开头不完整的行留给下一个窗口；
+ * 比窗口还长的行先找到行首，再顺序分段拷贝
+ * 扫描一个窗口时辅助线程把它之前的半个窗口读入另一个缓冲区，下一个窗口由这一块和
+ * 留下的不完整的行拼成，读取的等待与扫描和写出重叠；不完整的行超过半个窗口时退回同步读取
+ * 
+ * @param fd 输入文件描述符
+ * @param size 文件大小
+ * @param out_fd 输出文件描述符
+ * @param buf 窗口缓冲区，另一个同样大小的预读缓冲区在这里分配
+ * @param window 窗口大小
+ */
+void reverse_windows(int fd, off_t size, int out_fd, char* buf, size_t window) {
+    struct iovec       iov[IOV_MAX];
+    struct readahead_t ahead = {0};
+    char*              own   = ( char* )malloc(window);
+    char*              next  = own;  // 预读缓冲区，与buf轮换
+    if (!own) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
+    char last;
+    read_at(fd, &last, 1, size - 1);
+    off_t high  = size;  // 尚未写出部分的结束位置
+    off_t carry = -1;    // buf开头留下的不完整的行在文件中的起点，即[carry, high)，为-1时buf中没有可用内容
+    while (high > 0 && lines_left != 0) {
+        off_t low;
+        readahead_wait(&ahead);
+        if (carry >= 0 && ahead.offset + ( off_t )ahead.length == carry && high - ahead.offset <= ( off_t )window) {
+            // 预读的块后面接上不完整的行
+            memcpy(next + ahead.length, buf, high - carry);
+            char* swap = buf;
+            buf        = next;
+            next       = swap;
+            low        = ahead.offset;
+        } else {
+            low = high > ( off_t )window ? high - ( off_t )window : 0;
+            read_at(fd, buf, high - low, low);
+        }
+        size_t pos   = high - low;
+        int    count = 0;
+        carry        = low;
+        if (low > 0) {
+            off_t from = low > ( off_t )(window / 2) ? low - ( off_t )(window / 2) : 0;
+            readahead_start(&ahead, fd, next, low - from, from);
+        }
+        while (pos > 0 && lines_left != 0) {
+            char* newline = memrchr(buf, separator, pos - (buf[pos - 1] == separator));
+            if (newline == NULL && low > 0)
+                break;  // 行首在窗口之前
+            size_t start        = newline != NULL ? newline - buf + 1 : 0;
+            iov[count].iov_base = buf + start;
+            iov[count].iov_len  = pos - start;
+            ++count;
+            // 最后一行没有分隔符时补上
+            if (low + ( off_t )pos == size && last != separator) {
+                iov[count].iov_base = &separator;
+                iov[count].iov_len  = 1;
+                ++count;
+            }
+            if (count >= IOV_MAX - 1) {
+                write_lines(out_fd, NULL, iov, count);
+                count = 0;
+            }
+            pos = start;
+            if (lines_left > 0)
+                --lines_left;
+        }
+        write_lines(out_fd, NULL, iov, count);
+        if (pos < ( size_t )(high - low)) {
+            high = low + pos;
+            continue;
+        }
+        // 整个窗口都在同一行中，buf用作查找行首和拷贝的缓冲区
+        carry       = -1;
+        off_t start = find_line_start(fd, low, buf, window);
+        for (off_t from = start; from < high;) {
+            size_t n = high - from > ( off_t )window ? window : ( size_t )(high - from);
+            read_at(fd, buf, n, from);
+            write_all(out_fd, buf, n);
+            from += n;
+        }
+        if (high == size && last != separator)
+            write_all(out_fd, &separator, 1);
+        high = start;
+        if (lines_left > 0)
+            --lines_left;
+    }
+    readahead_wait(&ahead);
+    free(own);
+}
+
+/**
+ * 超出内存预算时把输入暂存到临时文件，再按窗口翻转，内存占用不随输入大小增长
+ * 临时文件创建后立即删除，程序退出时自动回收
+ * 
+ * @param input 输入文件指针，已读出的部分在buf中
+ * @param output 输出文件指针
+ * @param buf 已从输入读出的内容，写入临时文件后释放
+ * @param length buf中的字节数
+ * @param budget 内存预算，一半作窗口，另一半是预读缓冲区
  */
-char** get_input(FILE* file, int* line_cnt) {
-    // 初始分配100行的内存空间
-    char** text = ( char** )malloc(sizeof(char*) * 100);
-    if(!text) {
+void reverse_spooled(FILE* input, FILE* output, char* buf, size_t length, size_t budget) {
+    const char* dir = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+    char        path[4096];
+    snprintf(path, sizeof(path), "%s/reverse-XXXXXX", dir);
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "reverse: cannot create temporary file in '%s'\n", dir);
+        exit(1);
+    }
+    unlink(path);
+
+    off_t size = length;
+    write_all(fd, buf, length);
+    free(buf);
+    size_t window = budget / 2;
+    buf           = ( char* )malloc(window);
+    if (!buf) {
         fprintf(stderr, "malloc failed\n");
         exit(1);
     }
-    // 为每行分配内存
-    for (int i = 0; i < 100; ++i) {
-        text[i] = ( char* )malloc(sizeof(char) * 100);
-        if(!text[i]) {
+    size_t n;
+    while ((n = fread(buf, 1, window, input)) > 0) {
+        write_all(fd, buf, n);
+        size += n;
+    }
+    reverse_windows(fd, size, fileno(output), buf, window);
+    free(buf);
+    close(fd);
+}
+
+/**
+ * 将普通文件映射到内存，逐行直接从映射区写出，不拷贝数据也不为每行分配内存
+ * 
+ * @param input 输入文件指针
+ * @param out_fd 输出文件描述符
+ * @param offset 输出位置，含义同write_lines
+ * @return 成功返回0；输入不是非空的普通文件或无法映射返回-1，此时未读取任何内容
+ */
+int reverse_mapped(FILE* input, int out_fd, off_t* offset) {
+    struct stat st;
+    int         in_fd = fileno(input);
+    if (fstat(in_fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+        return -1;
+    size_t size = st.st_size;
+    char*  data = ( char* )mmap(NULL, size, PROT_READ, MAP_PRIVATE, in_fd, 0);
+    if (data == MAP_FAILED)
+        return -1;
+
+    get_output(out_fd, offset, data, size, 1);
+    munmap(data, size);
+    return 0;
+}
+
+/**
+ * 读取环境变量REVERSE_MEMORY给出的内存预算
+ */
+size_t memory_budget(void) {
+    size_t budget = DEFAULT_MEMORY;
+    if (getenv("REVERSE_MEMORY") != NULL && strtoul(getenv("REVERSE_MEMORY"), NULL, 10) > 0)
+        budget = strtoul(getenv("REVERSE_MEMORY"), NULL, 10);
+    return budget < MIN_MEMORY ? MIN_MEMORY : budget;
+}
+
+/**
+ * 将一个输入按行翻转写到输出
+ * 普通文件直接映射到内存翻转；其他输入（如管道）按内存预算读入缓冲区，超出预算时暂存到临时文件
+ * 
+ * @param input 输入文件指针
+ * @param output 输出文件指针
+ * @return 成功返回0，输入为空返回-1
+ */
+int reverse_file(FILE* input, FILE* output) {
+    // 只需最后几行时从文件末尾向前逐块读取，读入量与行数而不是文件大小成正比
+    struct stat st;
+    if (lines_left >= 0 && fstat(fileno(input), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        char* buf = ( char* )malloc(TAIL_WINDOW);
+        if (!buf) {
             fprintf(stderr, "malloc failed\n");
             exit(1);
         }
+        reverse_windows(fileno(input), st.st_size, fileno(output), buf, TAIL_WINDOW);
+        free(buf);
+        return 0;
     }
-    // 读取文件内容
-    int line_count = 0;
-    for (; fscanf(file, "%s", text[line_count]) != -1; ++line_count)
-        ;
-    // 通过指针返回行数
-    *line_cnt = line_count;
-    return text;
+    if (reverse_mapped(input, fileno(output), NULL) == 0)
+        return 0;
+
+    // 读取输入内容
+    char*  text   = NULL;
+    size_t length = 0;
+    size_t budget = memory_budget();
+    if (get_input(input, budget, &text, &length) < 0) {
+        reverse_spooled(input, output, text, length, budget);
+        return 0;
+    }
+    if (length > 0)
+        get_output(fileno(output), NULL, text, length, 0);
+    free(text);
+    return length > 0 ? 0 : -1;
+}
+
+/**
+ * 打开文件，失败时输出错误信息并退出
+ */
+FILE* open_file(const char* path, const char* mode) {
+    FILE* file = fopen(path, mode);
+    if (file == NULL) {
+        fprintf(stderr, "reverse: cannot open file '%s'\n", path);
+        exit(1);
+    }
+    return file;
+}
+
+/**
+ * 多文件模式的共享状态，工作线程通过原子递增next领取输入
+ */
+struct batch_t {
+    char**      inputs;   // 输入文件路径
+    int         count;    // 输入个数
+    const char* suffix;   // 不为NULL时输入input写到input<suffix>
+    int         out_fd;   // 拼接模式的输出文件描述符
+    off_t*      offsets;  // 拼接模式下各输入的翻转结果在输出中的位置，见plan_offsets
+    int         next;     // 下一个待处理的输入下标
+};
+
+/**
+ * 多文件模式的工作线程
+ * 每个输入各自写到单独的输出文件，或按预先算好的位置写入拼接的输出
+ * 
+ * @param arg 共享状态
+ */
+void* reverse_worker(void* arg) {
+    struct batch_t* batch = ( struct batch_t* )arg;
+    int             i;
+    while ((i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) < batch->count) {
+        FILE* input = open_file(batch->inputs[i], "r");
+        if (batch->suffix != NULL) {
+            char* path = ( char* )malloc(strlen(batch->inputs[i]) + strlen(batch->suffix) + 1);
+            if (!path) {
+                fprintf(stderr, "malloc failed\n");
+                exit(1);
+            }
+            sprintf(path, "%s%s", batch->inputs[i], batch->suffix);
+            FILE* output = open_file(path, "w");
+            reverse_file(input, output);
+            fclose(output);
+            free(path);
+        } else {
+            // 第i个输入写到[offsets[i + 1], offsets[i])，空文件没有输出
+            off_t offset = batch->offsets[i + 1];
+            if (offset != batch->offsets[i] && reverse_mapped(input, batch->out_fd, &offset) < 0) {
+                fprintf(stderr, "reverse: cannot map file '%s'\n", batch->inputs[i]);
+                exit(1);
+            }
+        }
+        fclose(input);
+    }
+    return NULL;
+}
+
+/**
+ * 单个输入分块翻转时的一块，由完整的行组成
+ */
+struct chunk_t {
+    char*     text;    // 本块在映射区中的内容
+    size_t    length;  // 本块的字节数
+    int       out_fd;  // 输出文件描述符
+    off_t     offset;  // 本块的翻转结果在输出中的位置
+    pthread_t thread;
+};
+
+/**
+ * 分块翻转的工作线程，把一块的行翻转后写到预先算好的位置
+ */
+void* chunk_worker(void* arg) {
+    struct chunk_t* chunk = ( struct chunk_t* )arg;
+    get_output(chunk->out_fd, &chunk->offset, chunk->text, chunk->length, 1);
+    return NULL;
+}
+
+/**
+ * 把一个普通文件分成最多num_chunks块并行翻转，写到输出的base处
+ * 块边界取在分隔符之后，所以每块内的行翻转后，按相反的块顺序排列就是整个文件的翻转结果；
+ * 比一块还长的行整行归入一块，块数可能少于num_chunks
+ *
+ * @param path 输入文件路径
+ * @param out_fd 输出文件描述符，必须可以按位置写入
+ * @param base 翻转结果在输出中的起始位置
+ * @param num_chunks 块数，即线程数
+ */
+void reverse_chunked(const char* path, int out_fd, off_t base, int num_chunks) {
+    FILE*       input = open_file(path, "r");
+    struct stat st;
+    if (fstat(fileno(input), &st) < 0 || st.st_size == 0) {
+        fclose(input);
+        return;
+    }
+    size_t size = st.st_size;
+    char*  data = ( char* )mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(input), 0);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "reverse: cannot map file '%s'\n", path);
+        exit(1);
+    }
+    struct chunk_t* chunks = ( struct chunk_t* )malloc(sizeof(struct chunk_t) * num_chunks);
+    if (!chunks) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
+
+    // 第n块大致结束在size / num_chunks * (n + 1)，再向后延伸到行尾
+    int    count = 0;
+    size_t start = 0;
+    while (start < size) {
+        size_t end = count == num_chunks - 1 ? size : size / num_chunks * (count + 1);
+        if (end < start)
+            end = start;
+        if (end < size) {
+            char* newline = memchr(data + end, separator, size - end);
+            end           = newline != NULL ? ( size_t )(newline - data) + 1 : size;
+        }
+        chunks[count].text   = data + start;
+        chunks[count].length = end - start;
+        chunks[count].out_fd = out_fd;
+        ++count;
+        start = end;
+    }
+    // 最后一块的翻转结果在最前面，最后一行没有分隔符时多一个字节
+    off_t offset = base;
+    for (int i = count - 1; i >= 0; --i) {
+        chunks[i].offset = offset;
+        offset += chunks[i].length + (i == count - 1 && data[size - 1] != separator);
+    }
+
+    for (int i = 0; i < count; ++i) {
+        if (pthread_create(&chunks[i].thread, NULL, chunk_worker, &chunks[i]) != 0) {
+            fprintf(stderr, "reverse: cannot create worker thread\n");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < count; ++i)
+        pthread_join(chunks[i].thread, NULL);
+    free(chunks);
+    munmap(data, size);
+    fclose(input);
+}
+
+/**
+ * 计算拼接模式下各输入的翻转结果在输出中的位置
+ * 翻转后的内容与输入等长，最后一行没有分隔符时多一个字节；输入按相反顺序排列
+ * 只有所有输入都是普通文件、输出是可定位且非追加模式的普通文件时才能并行写入
+ * 
+ * @param batch 共享状态，成功时填入offsets（count + 1项，第i个输入写到[offsets[i + 1], offsets[i])）
+ * @return 可以并行写入返回0，否则返回-1
+ */
+int plan_offsets(struct batch_t* batch) {
+    struct stat st;
+    off_t       base = lseek(batch->out_fd, 0, SEEK_CUR);
+    if (base < 0 || fstat(batch->out_fd, &st) < 0 || !S_ISREG(st.st_mode) || (fcntl(batch->out_fd, F_GETFL) & O_APPEND))
+        return -1;
+
+    off_t* sizes = ( off_t* )malloc(sizeof(off_t) * (batch->count + 1));
+    if (!sizes) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
+    for (int i = 0; i < batch->count; ++i) {
+        FILE* input = open_file(batch->inputs[i], "r");
+        char  last  = separator;
+        if (fstat(fileno(input), &st) < 0 || !S_ISREG(st.st_mode)) {
+            fclose(input);
+            free(sizes);
+            return -1;
+        }
+        if (st.st_size > 0)
+            read_at(fileno(input), &last, 1, st.st_size - 1);
+        sizes[i] = st.st_size + (last != separator);
+        fclose(input);
+    }
+    // 最后一个输入的翻转结果在最前面
+    batch->offsets               = sizes;
+    batch->offsets[batch->count] = base;
+    for (int i = batch->count - 1; i >= 0; --i)
+        batch->offsets[i] = batch->offsets[i + 1] + sizes[i];
+    return 0;
+}
+
+/**
+ * 多文件模式：用num_workers个线程并行翻转多个输入
+ * 
+ * @param inputs 输入文件路径
+ * @param count 输入个数
+ * @param num_workers 工作线程数
+ * @param suffix 不为NULL时每个输入写到单独的输出文件，否则拼接输出到标准输出
+ */
+void reverse_batch(char** inputs, int count, int num_workers, const char* suffix) {
+    struct batch_t batch = {inputs, count, suffix, fileno(stdout), NULL, 0};
+
+    if (suffix == NULL) {
+        // 标准输出不能是任何一个输入
+        struct stat out_stat, in_stat;
+        if (fstat(batch.out_fd, &out_stat) == 0) {
+            for (int i = 0; i < count; ++i) {
+                if (stat(inputs[i], &in_stat) == 0 && in_stat.st_ino == out_stat.st_ino && in_stat.st_dev == out_stat.st_dev) {
+                    fprintf(stderr, "reverse: input and output file must differ\n");
+                    exit(1);
+                }
+            }
+        }
+        // 无法按位置写入时（如输出是管道），按相反顺序逐个翻转
+        if (plan_offsets(&batch) < 0) {
+            for (int i = count - 1; i >= 0; --i) {
+                FILE* input = open_file(inputs[i], "r");
+                reverse_file(input, stdout);
+                fclose(input);
+            }
+            return;
+        }
+        // 只有一个输入时在它内部分块并行
+        if (count == 1 && num_workers > 1) {
+            reverse_chunked(inputs[0], batch.out_fd, batch.offsets[1], num_workers);
+            lseek(batch.out_fd, batch.offsets[0], SEEK_SET);
+            free(batch.offsets);
+            return;
+        }
+    }
+
+    if (num_workers > count)
+        num_workers = count;
+    pthread_t* workers = ( pthread_t* )malloc(sizeof(pthread_t) * num_workers);
+    if (!workers) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
+    for (int i = 0; i < num_workers; ++i) {
+        if (pthread_create(&workers[i], NULL, reverse_worker, &batch) != 0) {
+            fprintf(stderr, "reverse: cannot create worker thread\n");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < num_workers; ++i)
+        pthread_join(workers[i], NULL);
+    free(workers);
+
+    if (batch.offsets != NULL) {
+        // 输出位置移到拼接内容之后
+        lseek(batch.out_fd, batch.offsets[0], SEEK_SET);
+        free(batch.offsets);
+    }
+}
+
+/**
+ * 解析-s的参数，只支持单字节分隔符
+ *
+ * @return 成功返回0，格式错误返回-1
+ */
+int parse_separator(const char* arg) {
+    if (arg[0] == '\\' && arg[1] != '\0' && arg[2] == '\0') {
+        const char* escapes = "0\0n\nt\tr\r\\\\";
+        for (int i = 0; i < 10; i += 2) {
+            if (arg[1] == escapes[i]) {
+                separator = escapes[i + 1];
+                return 0;
+            }
+        }
+        return -1;
+    }
+    if (arg[0] == '\0' || arg[1] != '\0')
+        return -1;
+    separator = arg[0];
+    return 0;
+}
+
+/**
+ * 解析-n的参数
+ *
+ * @return 返回行数，格式错误返回-2
+ */
+long parse_count(const char* arg) {
+    char* end;
+    long  count = strtol(arg, &end, 10);
+    return *arg != '\0' && *end == '\0' && count >= 0 ? count : -2;
 }
 
 int main(int argc, char* argv[]) {
+    // 以选项开头时先解析选项，-j表示多文件模式，其余参数的含义同下
+    int         num_workers = 0;
+    const char* suffix      = NULL;
+    if (argc > 1 && argv[1][0] == '-' && argv[1][1] != '\0') {
+        int opt;
+        while ((opt = getopt(argc, argv, "j:n:o:s:")) != -1) {
+            switch (opt) {
+            case 'j': num_workers = atoi(optarg); break;
+            case 'n': lines_left = parse_count(optarg); break;
+            case 'o': suffix = optarg; break;
+            case 's':
+                if (parse_separator(optarg) < 0)
+                    num_workers = -1;
+                break;
+            default: num_workers = -1; break;
+            }
+        }
+        if (num_workers < 0 || (num_workers > 0 && lines_left >= 0) || lines_left < -1 || (num_workers == 0 && suffix != NULL) || (num_workers > 0 && optind >= argc) || (suffix != NULL && *suffix == '\0')) {
+            fprintf(stderr, "usage: reverse [-s <separator>] [-n <lines> | -j <workers> [-o <suffix>]] <input>...\n");
+            exit(1);
+        }
+        if (num_workers > 0) {
+            reverse_batch(argv + optind, argc - optind, num_workers, suffix);
+            return 0;
+        }
+        argv[optind - 1] = argv[0];
+        argc -= optind - 1;
+        argv += optind - 1;
+    }
+
     // 初始化输入和输出文件路径
     char* input_file_path  = NULL;
     char* output_file_path = NULL;
@@ -130,14 +834,8 @@ int main(int argc, char* argv[]) {
         }
     }
 
-    // 读取文本的行数
-    int cnt = 0;
-
-    // 读取输入内容
-    char** test_text = get_input(input_file, &cnt);
+    // 读取并翻转输入内容
     // 如果没有读取到内容，退出程序
-    if (cnt == 0)
+    if (reverse_file(input_file, output_file) < 0)
         exit(1);
-    // 翻转文本并输出
-    get_output(output_file, reverse_text(test_text, cnt), cnt);
 }
\ No newline at end of file
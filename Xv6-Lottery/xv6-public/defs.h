@@ -5,6 +5,8 @@ struct inode;
 struct pipe;
 struct proc;
 struct rtcdate;
+struct rusage;
+struct schedtrace;
 struct spinlock;
 struct sleeplock;
 struct stat;
@@ -77,6 +79,8 @@ void            cmostime(struct rtcdate *r);
 int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
+void            lapicipi(int, int);
+void            lapictimer(int);
 void            lapicinit(void);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
@@ -108,6 +112,10 @@ void            exit(void);
 int             fork(void);
 int             growproc(int);
 int             kill(int);
+int             lendtickets(int, int);
+int             setcurrency(int, int);
+void            setquantum(int);
+int             getrusage(int, struct rusage*);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
@@ -162,9 +170,14 @@ void            timerinit(void);
 // trap.c
 void            idtinit(void);
 extern uint     ticks;
+extern uint     tscpertick;
 void            tvinit(void);
 extern struct spinlock tickslock;
 
+// trace.c
+void            schedrecord(int, struct proc*, uint, int, int, uint);
+int             schedread(struct schedtrace*);
+
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
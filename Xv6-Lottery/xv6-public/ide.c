@@ -146,6 +146,13 @@ iderw(struct buf *b)
   if(b->dev != 0 && !havedisk1)
     panic("iderw: ide disk 1 not present");
 
+  if(myproc()){
+    if(b->flags & B_DIRTY)
+      myproc()->ru.oublock++;
+    else
+      myproc()->ru.inblock++;
+  }
+
   acquire(&idelock);  //DOC:acquire-lock
 
   // Append b to idequeue.
@@ -1,6 +1,16 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC       512  // maximum number of processes
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
+#define BALANCETICKS 10  // ticks between run queue load balancing
+#define MIGRATEPCT   25  // min imbalance, in % of the busiest queue, to migrate
+#define CACHEHOT      2  // ticks after running during which a process stays put
+#define STRIDE1  (1<<16)  // stride of a process holding one ticket
+#define MAXQUANTUM  100  // longest time slice a process can ask for, in ticks
+#define COMPMAX       8  // max ticket inflation for a process blocking early
+#define NCURRENCY     8  // ticket currencies, including the base currency
+#define MAXFUNDING 32768  // max base tickets backing one currency
+#define TRACESIZE   256  // scheduler trace events kept per CPU
+#define TRACEREAD    64  // max trace events returned by one schedtrace()
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
@@ -5,6 +5,7 @@
 #include "mmu.h"
 #include "x86.h"
 #include "proc.h"
+#include "traps.h"
 #include "random.h"
 
 struct ptable_t ptable = {{0}};
@@ -18,36 +19,496 @@ extern void trapret(void);
 static void wakeup1(void *chan);
 
 /**
- * 系统中所有可运行进程持有的彩票总数
- * 在彩票调度算法中，这个变量用于:
- * 1. 计算随机选择进程时的范围上限(0到total_tickets)
- * 2. 当进程状态变化时(如新增、退出、睡眠、唤醒)，相应调整彩票总数
- * 3. 确保随机数生成时的概率分布与各进程彩票数成正比
+ * 按pid索引的散列表
+ * 
+ * 分配了pid、还没有被wait回收的进程按pid % PIDHASH链在这里，
+ * kill等按pid查找进程时不必扫描整个进程表。由ptable.lock保护
+ */
+#define PIDHASH NPROC
+static struct proc *pidhash[PIDHASH];
+
+static void hashproc(struct proc *p) {
+  struct proc **pp = &pidhash[p->pid % PIDHASH];
+
+  p->hashnext = *pp;
+  *pp = p;
+}
+
+static void unhashproc(struct proc *p) {
+  struct proc **pp;
+
+  for(pp = &pidhash[p->pid % PIDHASH]; *pp; pp = &(*pp)->hashnext) {
+    if(*pp == p) {
+      *pp = p->hashnext;
+      return;
+    }
+  }
+  panic("unhashproc");
+}
+
+/**
+ * 按pid查找进程，调用者必须持有ptable.lock
+ * 
+ * @param pid 要查找的pid
+ * @return 找到的进程(可能是僵尸进程)，找不到返回0
+ */
+static struct proc* findproc(int pid) {
+  struct proc *p;
+
+  for(p = pidhash[(uint)pid % PIDHASH]; p; p = p->hashnext)
+    if(p->pid == pid)
+      return p;
+  return 0;
+}
+
+/**
+ * 系统中所有未睡眠进程持有的彩票总数，即各CPU队列彩票总数之和
+ * 当进程状态变化时(如新增、退出、睡眠、唤醒)，相应调整彩票总数。
+ * 由ptable.lock保护
  */
 int total_tickets;
 
+/**
+ * 每个CPU的彩票运行队列
+ * 
+ * 每个进程属于一个CPU的队列(proc.cpu)，只由该CPU调度，
+ * 各CPU只在自己的队列中抽取，不会抽到正在别的CPU上运行的进程。
+ * tree是按进程表下标排列的树状数组(Fenwick树)，下标从1开始，
+ * tree[i]保存下标(i - lowbit(i), i]内属于本队列且未睡眠的进程的
+ * 彩票数之和，其他进程记为0。修改一个进程的彩票和抽取中奖进程
+ * 都只需O(log NPROC)步。所有字段由ptable.lock保护
+ */
+struct runq {
+  int tree[NPROC + 1];  // 彩票树状数组
+  int total;            // 队列中未睡眠进程的彩票总数
+  int nready;           // 队列中未睡眠的进程数
+  uint balanced;        // 上次负载均衡时的ticks
+#ifdef STRIDE
+  struct proc *heap[NPROC + 1];  // 按pass排列的小根堆，下标从1开始
+  int nheap;            // 堆中的进程数
+  uint pass;            // 队列的虚拟时间，即最近一次选中进程的pass
+#endif
+};
+static struct runq runqs[NCPU];
+
+/**
+ * 唤醒停在hlt上的CPU
+ * 
+ * 先清除idle再发送IPI：目标CPU在hlt前还会检查idle，
+ * 所以无论IPI早到还是晚到都不会错过。调用者必须持有ptable.lock
+ * 
+ * @param cpu 要唤醒的CPU下标
+ */
+static void wakecpu(int cpu) {
+  cpus[cpu].idle = 0;
+  if(cpu != cpuid())
+    lapicipi(cpus[cpu].apicid, T_IRQ0 + IRQ_WAKE);
+}
+
+/**
+ * 把进程在其队列树中的彩票数增加delta，并同步更新彩票总数
+ * 
+ * @param pp 要修改的进程
+ * @param delta 彩票数的变化量，可以为负
+ */
+static void addtickets(struct proc *pp, int delta) {
+  struct runq *rq = &runqs[pp->cpu];
+  int i;
+
+  total_tickets += delta;
+  rq->total += delta;
+  for(i = pp->slot + 1; i <= NPROC; i += i & -i)
+    rq->tree[i] += delta;
+  // 队列所属的CPU可能因为没有进程可运行而停在hlt上
+  if(delta > 0 && cpus[pp->cpu].idle)
+    wakecpu(pp->cpu);
+}
+
+/**
+ * 找出队列中持有第golden张彩票的进程
+ * 
+ * 从最高位开始沿树下降，跳过前缀和不超过golden的部分，
+ * 最终停在前缀和第一次大于golden的进程上
+ * 
+ * @param rq 要抽取的运行队列
+ * @param golden 中奖彩票号，必须满足0 <= golden < rq->total
+ * @return 持有该彩票的进程
+ */
+static struct proc* drawticket(struct runq *rq, int golden) {
+  int i = 0;
+  int step;
+
+  for(step = 1; step * 2 <= NPROC; step *= 2)
+    ;
+  for(; step > 0; step /= 2) {
+    if(i + step <= NPROC && rq->tree[i + step] <= golden) {
+      i += step;
+      golden -= rq->tree[i];
+    }
+  }
+  return ptable.proc[i];
+}
+
+#ifdef STRIDE
+/**
+ * 步长调度(stride scheduling)的优先队列
+ * 
+ * 与彩票树中有彩票的进程相同，堆中是队列里未睡眠的进程，
+ * 每次调度pass最小的进程，运行后pass增加stride乘以使用的时钟数。
+ * pass会回绕，所以只比较差值的符号
+ */
+static int passless(struct proc *a, struct proc *b) {
+  return (int)(a->pass - b->pass) < 0;
+}
+
+static void heapset(struct runq *rq, int i, struct proc *pp) {
+  rq->heap[i] = pp;
+  pp->heapidx = i;
+}
+
+static void siftup(struct runq *rq, int i) {
+  struct proc *pp = rq->heap[i];
+
+  while(i > 1 && passless(pp, rq->heap[i / 2])) {
+    heapset(rq, i, rq->heap[i / 2]);
+    i /= 2;
+  }
+  heapset(rq, i, pp);
+}
+
+static void siftdown(struct runq *rq, int i) {
+  struct proc *pp = rq->heap[i];
+  int child;
+
+  while((child = 2 * i) <= rq->nheap) {
+    if(child < rq->nheap && passless(rq->heap[child + 1], rq->heap[child]))
+      child++;
+    if(!passless(rq->heap[child], pp))
+      break;
+    heapset(rq, i, rq->heap[child]);
+    i = child;
+  }
+  heapset(rq, i, pp);
+}
+
+/**
+ * 让进程在堆中的状态与它在彩票树中的彩票数一致
+ * 
+ * 新加入的进程的pass不小于队列的虚拟时间，
+ * 这样睡眠很久的进程醒来后不会长时间独占CPU
+ * 
+ * @param pp 要调整的进程
+ * @param weight 进程在树中的彩票数，0表示离开队列
+ */
+static void restride(struct proc *pp, int weight) {
+  struct runq *rq = &runqs[pp->cpu];
+  struct proc *last;
+  int i;
+
+  if(weight > 0) {
+    pp->stride = STRIDE1 / weight;
+    if(pp->heapidx == 0) {
+      if((int)(pp->pass - rq->pass) < 0)
+        pp->pass = rq->pass;
+      heapset(rq, ++rq->nheap, pp);
+      siftup(rq, rq->nheap);
+    }
+  } else if(pp->heapidx != 0) {
+    i = pp->heapidx;
+    pp->heapidx = 0;
+    last = rq->heap[rq->nheap--];
+    if(last != pp) {
+      heapset(rq, i, last);
+      siftup(rq, i);
+      siftdown(rq, last->heapidx);
+    }
+  }
+}
+#endif
+
+/**
+ * 把进程移到另一个CPU的队列中
+ * 
+ * 进程在树中的彩票数(weight)要从旧队列的树中移到新队列的树中
+ * 
+ * @param pp 要移动的进程，不能正在运行
+ * @param cpu 新队列所属CPU的下标
+ */
+static void moveproc(struct proc *pp, int cpu) {
+  int n = pp->weight;
+
+  addtickets(pp, -n);
+#ifdef STRIDE
+  restride(pp, 0);
+#endif
+  if(n > 0) {
+    runqs[pp->cpu].nready--;
+    runqs[cpu].nready++;
+  }
+  pp->cpu = cpu;
+  addtickets(pp, n);
+#ifdef STRIDE
+  // 各队列的虚拟时间互不相关，从新队列的当前时间开始
+  pp->pass = runqs[cpu].pass;
+  restride(pp, n);
+#endif
+}
+
+/**
+ * 彩票总数最少的CPU，新进程放到它的队列中
+ * 
+ * @return CPU下标
+ */
+static int lightestcpu(void) {
+  int i, best = 0;
+
+  for(i = 1; i < ncpu; i++)
+    if(runqs[i].total < runqs[best].total)
+      best = i;
+  return best;
+}
+
+/**
+ * 按彩票数在CPU之间做负载均衡
+ * 
+ * 从彩票总数最多的CPU队列中按彩票抽取一个可运行进程，
+ * 如果移过来后两个队列的差距会缩小，就把它移到本CPU的队列中。
+ * 迁移会丢掉进程在原CPU缓存中的数据，所以进程默认留在上次运行的CPU上：
+ * 差距不到最忙队列的MIGRATEPCT%时不迁移，CACHEHOT个时钟内运行过的进程
+ * 也不迁移。本CPU空闲时不受这两个限制，有进程就拉过来运行。
+ * 本CPU空闲时每轮都会调用，否则每BALANCETICKS个时钟调用一次
+ * 
+ * @param cpu 本CPU的下标
+ */
+static void balance(int cpu) {
+  struct runq *rq = &runqs[cpu];
+  struct proc *p;
+  int i, diff, busiest = cpu;
+
+  rq->balanced = ticks;
+  for(i = 0; i < ncpu; i++) {
+    if(runqs[i].total > runqs[busiest].total)
+      busiest = i;
+    // 停在hlt上的CPU不会自己来均衡，本队列有进程在等待时叫醒它
+    if(cpus[i].idle && rq->nready > 1) {
+      wakecpu(i);
+      break;
+    }
+  }
+  if(busiest == cpu)
+    return;
+  diff = runqs[busiest].total - rq->total;
+  if(rq->total > 0 && diff * 100 < runqs[busiest].total * MIGRATEPCT)
+    return;
+
+  p = drawticket(&runqs[busiest], randbelow(cpu, runqs[busiest].total));
+  // 只移动等待运行的进程；超过差距一半的进程移过来只会让两边互换
+  if(p->state != RUNNABLE || p->weight * 2 > diff)
+    return;
+  if(rq->total > 0 && p->nsched > 0 && ticks - p->lastrun < CACHEHOT)
+    return;
+  // 那个CPU还在用它的页表，见scheduler()
+  if(cpus[busiest].lastproc == p)
+    return;
+  moveproc(p, cpu);
+  p->migrations++;
+}
+
+/**
+ * 彩票货币
+ * 
+ * 加入货币的进程持有的彩票以这种货币计价。一种货币总共值funding张
+ * 基础彩票，按未睡眠成员的彩票数(含借入的)分给各成员，
+ * 所以成员增减彩票只影响同一货币中的进程，不会稀释其他进程的份额。
+ * 这相当于两级抽奖：先按funding在货币之间抽，再在货币内按彩票抽。
+ * 
+ * 货币用来隔离租户：基础货币中的进程把子进程放进一种货币，
+ * 子进程和它fork出的进程就不能再离开这种货币，也不能修改它的价值，
+ * 彩票也只能借给同一货币中的进程，租户无论fork多少进程都只分得funding。
+ * currencies[0]表示基础货币，不使用。由ptable.lock保护
+ */
+struct currency {
+  int funding;  // 货币的总价值，以基础彩票计
+  int active;   // 未睡眠成员的彩票数(含借入的)之和
+};
+static struct currency currencies[NCURRENCY];
+
+/**
+ * 计算进程的彩票值多少张基础彩票
+ * 
+ * @param pp 要计算的进程
+ * @return 以基础彩票计的彩票数，进程不参与调度时为0
+ */
+static int valueof(struct proc *pp) {
+  struct currency *cur = &currencies[pp->currency];
+  uint base = pp->base;
+  uint active = cur->active;
+  int w;
+
+  if(pp->currency == 0 || base == 0)
+    return base;
+  // 缩小到16位以内，乘以funding(不超过MAXFUNDING)不会溢出
+  while(base > 0xffff) {
+    base >>= 1;
+    active >>= 1;
+  }
+  w = cur->funding * base / active;
+  return w > 0 ? w : 1;  // 可运行的进程至少有一张彩票，否则永远不会被选中
+}
+
+/**
+ * 把进程在树(和步长调度的堆)中的彩票数设为w
+ * 
+ * @param pp 要修改的进程
+ * @param w 以基础彩票计的彩票数
+ */
+static void setweight(struct proc *pp, int w) {
+  if((w > 0) != (pp->weight > 0))
+    runqs[pp->cpu].nready += w > 0 ? 1 : -1;
+  addtickets(pp, w - pp->weight);
+  pp->weight = w;
+#ifdef STRIDE
+  restride(pp, w);
+#endif
+}
+
+/**
+ * 重新计算进程的有效彩票数
+ * 
+ * 进程的有效彩票数是自己的彩票加上借入的彩票和补偿彩票，睡眠时为0。
+ * 进程属于某种货币时，该货币所有成员的价值都要重新计算
+ * 
+ * @param pp 要重新计算的进程
+ * @param awake 进程是否参与调度
+ */
+static void reweigh(struct proc *pp, int awake) {
+  struct proc *p;
+  int i;
+  int base = awake && pp->tickets > 0 ?
+             pp->tickets + pp->borrowed + pp->comp : 0;
+
+  if(pp->currency == 0) {
+    pp->base = base;
+    setweight(pp, base);
+    return;
+  }
+  currencies[pp->currency].active += base - pp->base;
+  pp->base = base;
+  for(i = 0; i < ptable.nproc; i++) {
+    p = ptable.proc[i];
+    if(p->currency == pp->currency && (p == pp || p->base > 0))
+      setweight(p, valueof(p));
+  }
+}
+
+/**
+ * 开始或结束把进程的彩票借给lendtickets指定的进程
+ * 
+ * 借出只在进程睡眠期间生效：客户进程等待服务进程时，
+ * 它的彩票不会浪费，而是帮服务进程更快地处理它的请求。
+ * 借入者已经退出并被回收时(pid不再相符)取消借出
+ * 
+ * @param pp 借出彩票的进程
+ * @param on 1表示进程开始睡眠，0表示进程被唤醒
+ */
+static void lendout(struct proc *pp, int on) {
+  struct proc *to = pp->lentto;
+
+  if(to == 0)
+    return;
+  if(to->pid != pp->lentpid || to->currency != pp->currency) {
+    pp->lentto = 0;
+    pp->given = 0;
+    return;
+  }
+  if(on) {
+    pp->given = pp->lent < pp->tickets ? pp->lent : pp->tickets;
+    to->borrowed += pp->given;
+  } else {
+    to->borrowed -= pp->given;
+    pp->given = 0;
+  }
+  reweigh(to, to->state != SLEEPING);
+}
+
+#ifndef STRIDE
+/**
+ * 给没用完时间片就睡眠的进程发放补偿彩票
+ * 
+ * 进程只用了时间片的f部分时，在下次运行前把它的彩票放大到1/f倍
+ * (最多COMPMAX倍)，这样经常等待I/O的进程也能得到与彩票数相符的CPU时间。
+ * 时钟的粒度太粗，用时间戳计数器计算用掉的比例。
+ * 步长调度按实际运行的时钟数增加pass，不需要补偿
+ * 
+ * @param p 刚运行完的进程，唤醒时补偿彩票才会加入树中
+ * @param used 本次运行的时间戳计数器周期数
+ */
+static void compensate(struct proc *p, uint used) {
+  uint f;
+
+  if(p->state != SLEEPING || tscpertick == 0 || p->tickets == 0)
+    return;
+  f = used / ((tscpertick / 256 + 1) * p->quantum);  // 用掉的时间片比例，以1/256计
+  if(f >= 256)
+    return;
+  if(f < 256 / COMPMAX)
+    p->comp = p->tickets * (COMPMAX - 1);
+  else
+    p->comp = p->tickets * (256 - f) / f;
+}
+#endif
+
 /**
  * 设置指定进程的彩票数量并更新系统彩票总数
  * 
- * 此函数会先从total_tickets中减去进程原来的彩票数，
- * 然后为进程分配新的彩票数，并将新数量加回total_tickets，
- * 以保持系统彩票总数的准确性
+ * 此函数重新计算进程的有效彩票数，把变化量加到彩票树和
+ * total_tickets中，以保持系统彩票总数的准确性。
+ * 调用者必须持有ptable.lock
  * 
  * @param pp 要设置彩票数量的进程
  * @param n 要设置的彩票数量
  */
 void setproctickets(struct proc *pp, int n) {
-  total_tickets -= pp->tickets;  // 先减去原有彩票数
-  pp->tickets = n;               // 设置新的彩票数
-  total_tickets += pp->tickets;  // 加上新的彩票数到总数中
+  pp->tickets = n;                         // 设置新的彩票数
+  reweigh(pp, pp->state != SLEEPING);      // 只把变化量加到树中
+}
+
+/**
+ * 按睡眠通道散列的等待队列
+ * 
+ * 睡眠的进程按chan链在waitq[WAITHASH(chan)]上，wakeup只需检查
+ * 同一链上的进程。storetickets和restoretickets负责进出队列。
+ * 由ptable.lock保护
+ */
+#define NWAITQ 64
+#define WAITHASH(chan) ((((uint)(chan)) >> 4) % NWAITQ)
+static struct proc *waitq[NWAITQ];
+
+static void enqueuewait(struct proc *pp) {
+  struct proc **head = &waitq[WAITHASH(pp->chan)];
+
+  pp->waitnext = *head;
+  pp->waitprev = head;
+  if(*head)
+    (*head)->waitprev = &pp->waitnext;
+  *head = pp;
+}
+
+static void dequeuewait(struct proc *pp) {
+  *pp->waitprev = pp->waitnext;
+  if(pp->waitnext)
+    pp->waitnext->waitprev = pp->waitprev;
+  pp->waitnext = 0;
+  pp->waitprev = 0;
 }
 
 /**
  * 当进程进入睡眠状态时，临时保存其彩票
  * 
  * 当进程睡眠时，它不参与CPU调度竞争，因此需要从
- * 系统总彩票数中减去该进程的彩票数，以确保调度
- * 公平性和随机性的正确计算
+ * 彩票树和系统总彩票数中减去该进程的彩票数，以确保调度
+ * 公平性和随机性的正确计算。借出的彩票在睡眠期间交给借入者，
+ * 进程同时加入pp->chan的等待队列
  * 
  * @param pp 要保存彩票的睡眠进程
  */
@@ -55,15 +516,17 @@ void storetickets(struct proc* pp) {
   if(pp->state != SLEEPING) {
     panic("Not sleeping at store tickets!");
   }
-  total_tickets -= pp->tickets;  // 从总彩票数中减去该进程的彩票数
+  reweigh(pp, 0);    // 从树中减去该进程的彩票数
+  lendout(pp, 1);
+  enqueuewait(pp);
 }
 
 /**
  * 当进程从睡眠状态被唤醒时，恢复其彩票
  * 
- * 当进程重新变为可运行状态时，需要将其彩票数
- * 重新加回到系统总彩票数中，使其能够重新参与
- * CPU调度竞争
+ * 当进程重新变为可运行状态时，需要离开等待队列、收回借出的彩票，
+ * 并将其彩票数重新加回到彩票树和系统总彩票数中，
+ * 使其能够重新参与CPU调度竞争
  * 
  * @param pp 要恢复彩票的被唤醒进程
  */
@@ -71,7 +534,103 @@ void restoretickets(struct proc* pp) {
   if(pp->state != SLEEPING) {
     panic("Not sleeping at restore tickets!");
   }
-  total_tickets += pp->tickets;  // 将进程的彩票数重新加入总彩票数
+  dequeuewait(pp);
+  lendout(pp, 0);
+  reweigh(pp, 1);    // 将进程的彩票数重新加入树中
+}
+
+/**
+ * 设置当前进程的时间片长度
+ * 
+ * 进程被选中后连续运行n个本CPU的时钟中断才让出CPU。
+ * 计算密集的批处理进程可以用较长的时间片减少上下文切换，
+ * 交互进程保持默认的1个时钟。彩票调度中每次中奖运行整个时间片，
+ * 所以获得的CPU时间与彩票数乘以时间片长度成正比；
+ * 步长调度按实际运行的时钟数增加pass，仍与彩票数成正比
+ * 
+ * @param n 时间片长度，以时钟计
+ */
+void setquantum(int n) {
+  acquire(&ptable.lock);
+  myproc()->quantum = n;
+  release(&ptable.lock);
+}
+
+/**
+ * 把当前进程的彩票借给另一个进程
+ * 
+ * 借出在当前进程每次睡眠时生效，醒来时收回，直到再次调用
+ * 本函数或当前进程退出。借出期间当前进程自己的彩票不受影响。
+ * 借入者必须和当前进程属于同一种货币
+ * 
+ * @param pid 借入彩票的进程，n为0时忽略
+ * @param n 每次睡眠时借出的彩票数，为0时取消借出
+ * @return 成功返回0，找不到进程返回-1
+ */
+int lendtickets(int pid, int n) {
+  struct proc *curproc = myproc();
+  struct proc *p;
+
+  acquire(&ptable.lock);
+  curproc->lentto = 0;
+  if(n == 0) {
+    release(&ptable.lock);
+    return 0;
+  }
+  p = findproc(pid);
+  // 不同货币的彩票价值不同，只能借给同一货币中的进程
+  if(p == 0 || p == curproc || p->state == ZOMBIE ||
+     p->currency != curproc->currency) {
+    release(&ptable.lock);
+    return -1;
+  }
+  curproc->lentto = p;
+  curproc->lentpid = pid;
+  curproc->lent = n;
+  release(&ptable.lock);
+  return 0;
+}
+
+/**
+ * 让当前进程加入一种货币
+ * 
+ * 之后当前进程的彩票以这种货币计价，fork出的子进程也属于这种货币。
+ * 只有基础货币中的进程可以加入其他货币或设置货币的价值，
+ * 已经属于其他货币的进程不能离开
+ * 
+ * @param id 货币编号，0表示基础货币
+ * @param funding 大于0时同时把货币的总价值设为这么多张基础彩票
+ * @return 成功返回0，货币还没有设置过价值或当前进程不能修改时返回-1
+ */
+int setcurrency(int id, int funding) {
+  struct proc *curproc = myproc();
+
+  acquire(&ptable.lock);
+  if((id > 0 && funding == 0 && currencies[id].funding == 0) ||
+     (curproc->currency != 0 && (id != curproc->currency || funding > 0))) {
+    release(&ptable.lock);
+    return -1;
+  }
+  reweigh(curproc, 0);    // 离开原来的货币
+  curproc->currency = id;
+  if(id > 0 && funding > 0)
+    currencies[id].funding = funding;
+  reweigh(curproc, 1);    // 新货币的所有成员都重新计算
+  release(&ptable.lock);
+  return 0;
+}
+
+/**
+ * 把进程设为可运行状态，并记下开始等待调度的时刻
+ * 
+ * 调度器选中进程时用这个时刻计算它在队列中等待了多久。
+ * 调用者必须持有ptable.lock
+ * 
+ * @param p 变为可运行的进程
+ */
+static void setrunnable(struct proc *p) {
+  p->state = RUNNABLE;
+  p->readyat = ticks;
 }
 
 void
@@ -119,8 +678,50 @@ myproc(void) {
   return p;
 }
 
+/**
+ * 放弃allocproc分配的、还没有运行过的进程
+ * 
+ * @param p 要放弃的进程
+ */
+static void unallocproc(struct proc *p) {
+  acquire(&ptable.lock);
+  unhashproc(p);
+  p->pid = 0;
+  p->state = UNUSED;
+  p->hashnext = ptable.free;
+  ptable.free = p;
+  release(&ptable.lock);
+}
+
+// Allocate a page of proc structures and add them to the free
+// list.  Caller must hold ptable.lock.
+static int
+growptable(void)
+{
+  struct proc *p;
+  char *mem;
+  int i, n;
+
+  if(ptable.nproc >= NPROC || (mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  n = PGSIZE / sizeof(struct proc);
+  if(n > NPROC - ptable.nproc)
+    n = NPROC - ptable.nproc;
+  // Push in reverse so the lowest slot is handed out first.
+  for(i = n - 1; i >= 0; i--){
+    p = (struct proc*)mem + i;
+    p->slot = ptable.nproc + i;
+    ptable.proc[p->slot] = p;
+    p->hashnext = ptable.free;
+    ptable.free = p;
+  }
+  ptable.nproc += n;
+  return 0;
+}
+
 //PAGEBREAK: 32
-// Look in the process table for an UNUSED proc.
+// Take an UNUSED proc off the free list, growing the table if needed.
 // If found, change state to EMBRYO and initialize
 // state required to run in the kernel.
 // Otherwise return 0.
@@ -132,22 +733,23 @@ allocproc(void)
 
   acquire(&ptable.lock);
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == UNUSED)
-      goto found;
-
-  release(&ptable.lock);
-  return 0;
+  if(ptable.free == 0 && growptable() < 0){
+    release(&ptable.lock);
+    return 0;
+  }
+  p = ptable.free;
+  ptable.free = p->hashnext;
 
-found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->quantum = 1;
+  hashproc(p);
 
   release(&ptable.lock);
 
   // Allocate kernel stack.
   if((p->kstack = kalloc()) == 0){
-    p->state = UNUSED;
+    unallocproc(p);
     return 0;
   }
   sp = p->kstack + KSTACKSIZE;
@@ -202,7 +804,7 @@ userinit(void)
   // because the assignment might not be atomic.
   acquire(&ptable.lock);
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
   release(&ptable.lock);
 }
@@ -247,15 +849,13 @@ fork(void)
   if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
     kfree(np->kstack);
     np->kstack = 0;
-    np->state = UNUSED;
+    unallocproc(np);
     return -1;
   }
   np->sz = curproc->sz;
   np->parent = curproc;
   *np->tf = *curproc->tf;
 
-  setproctickets(np, curproc->tickets);
-
   // Clear %eax so that fork returns 0 in the child.
   np->tf->eax = 0;
 
@@ -270,7 +870,13 @@ fork(void)
 
   acquire(&ptable.lock);
 
-  np->state = RUNNABLE;
+  np->sibling = curproc->children;
+  curproc->children = np;
+  np->cpu = lightestcpu();
+  np->currency = curproc->currency;
+  np->quantum = curproc->quantum;
+  setproctickets(np, curproc->tickets);
+  setrunnable(np);
 
   release(&ptable.lock);
 
@@ -309,15 +915,17 @@ exit(void)
   wakeup1(curproc->parent);
 
   // Pass abandoned children to init.
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->parent == curproc){
-      p->parent = initproc;
-      if(p->state == ZOMBIE)
-        wakeup1(initproc);
-    }
+  while((p = curproc->children) != 0){
+    curproc->children = p->sibling;
+    p->parent = initproc;
+    p->sibling = initproc->children;
+    initproc->children = p;
+    if(p->state == ZOMBIE)
+      wakeup1(initproc);
   }
 
   setproctickets(curproc, 0);
+  curproc->lentto = 0;
 
   // Jump into the scheduler, never to return.
   curproc->state = ZOMBIE;
@@ -325,26 +933,62 @@ exit(void)
   panic("zombie exit");
 }
 
+// Add the resource usage in b to a.
+static void
+ruadd(struct rusage *a, struct rusage *b)
+{
+  a->utime += b->utime;
+  a->stime += b->stime;
+  a->syscalls += b->syscalls;
+  a->inblock += b->inblock;
+  a->oublock += b->oublock;
+  a->faults += b->faults;
+  a->nvcsw += b->nvcsw;
+  a->nivcsw += b->nivcsw;
+}
+
+// Copy the current process's resource usage to ru, or with
+// who RUSAGE_CHILDREN that of the children it has waited for.
+// Only the process itself changes either, so no lock is needed.
+int
+getrusage(int who, struct rusage *ru)
+{
+  struct proc *curproc = myproc();
+
+  if(who == RUSAGE_SELF)
+    *ru = curproc->ru;
+  else if(who == RUSAGE_CHILDREN)
+    *ru = curproc->cru;
+  else
+    return -1;
+  return 0;
+}
+
 // Wait for a child process to exit and return its pid.
 // Return -1 if this process has no children.
 int
 wait(void)
 {
-  struct proc *p;
+  struct proc *p, **pp;
   int havekids, pid;
   struct proc *curproc = myproc();
   
   acquire(&ptable.lock);
   for(;;){
-    // Scan through table looking for exited children.
+    // Scan through the list of children looking for exited ones.
     havekids = 0;
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->parent != curproc)
-        continue;
+    for(pp = &curproc->children; (p = *pp) != 0; pp = &p->sibling){
       havekids = 1;
       if(p->state == ZOMBIE){
         // Found one.
+        *pp = p->sibling;
+        p->sibling = 0;
+        unhashproc(p);
         pid = p->pid;
+        ruadd(&curproc->cru, &p->ru);
+        ruadd(&curproc->cru, &p->cru);
+        memset(&p->ru, 0, sizeof(p->ru));
+        memset(&p->cru, 0, sizeof(p->cru));
         kfree(p->kstack);
         p->kstack = 0;
         freevm(p->pgdir);
@@ -355,7 +999,20 @@ wait(void)
         p->state = UNUSED;
 
         p->ticks = 0;
+        p->waitticks = 0;
+        p->nsched = 0;
+        p->lastrun = 0;
+        p->migrations = 0;
+#ifdef STRIDE
+        p->pass = 0;
+#endif
         setproctickets(p, 0);
+        p->currency = 0;
+        p->borrowed = 0;
+        p->comp = 0;
+        p->lentto = 0;
+        p->hashnext = ptable.free;
+        ptable.free = p;
 
         release(&ptable.lock);
         return pid;
@@ -373,6 +1030,29 @@ wait(void)
   }
 }
 
+/**
+ * 没有进程可运行时停止CPU，直到被中断唤醒
+ * 
+ * 0号CPU的时钟负责ticks，一直打开；其他CPU停止前关闭时钟，
+ * 只被IPI或设备中断唤醒，空闲时不再每个时钟醒来一次
+ * 
+ * @param c 本CPU
+ * @param cpu 本CPU的下标
+ */
+static void idle(struct cpu *c, int cpu) {
+  cli();
+  if(c->idle) {
+    if(cpu != 0)
+      lapictimer(0);
+    stihlt();
+    cli();
+    if(cpu != 0)
+      lapictimer(1);
+  }
+  c->idle = 0;
+  sti();
+}
+
 //PAGEBREAK: 42
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
@@ -386,65 +1066,93 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int cpu = c - cpus;
+  struct runq *rq = &runqs[cpu];
   c->proc = 0;
 
   acquire(&ptable.lock);
-  setproctickets(ptable.proc, 1);
+  setproctickets(initproc, 1);
   release(&ptable.lock);
 
-  int set_seed = 0;
-  if(!set_seed) {
-    srand(12345);
-  }
-  set_seed = 1;
+  srand(cpu, 12345);
   
   for(;;){
     // Enable interrupts on this processor.
     sti();
 
-    int ticket_count = 0;
-    int total_ticks = 0;
-
     acquire(&ptable.lock);
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; ++p) {
-      if(p->state == RUNNABLE) {
-        total_tickets += p->tickets;
+    const unsigned long long drawstart = rdtsc();
+    if(rq->total <= 0 || ticks - rq->balanced >= BALANCETICKS)
+      balance(cpu);
+    if(rq->total <= 0) {
+      // 没有进程可运行：停在hlt上直到下一个中断，不再反复抢ptable.lock。
+      // 给本队列加入进程或需要均衡时会清除idle并发送IPI
+      if(c->lastproc) {
+        switchkvm();
+        c->lastproc = 0;
       }
-      total_ticks += p->ticks;
+      c->idle = 1;
+      release(&ptable.lock);
+      idle(c, cpu);
+      continue;
     }
-    
-    const int golden_ticket = rand() % (total_tickets + 1);
-    total_tickets = 0;
-
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; ++p) {
-      if(p->state != RUNNABLE) {
-        ticket_count += p->tickets;
-        continue;
+
+    // 队列中的进程只在本CPU上运行，调度器运行时它们都不在运行，
+    // 树中有彩票的进程都是可运行的
+#ifdef STRIDE
+    p = rq->heap[1];
+    rq->pass = p->pass;
+#else
+    const int golden_ticket = randbelow(cpu, rq->total);
+    p = drawticket(rq, golden_ticket);
+#endif
+
+    if(p->state == RUNNABLE) {
+      if(p->comp) {
+        // 补偿只用于被选中这一次
+        p->comp = 0;
+        reweigh(p, 1);
       }
-      total_tickets += p->tickets;
-      if(total_tickets >= golden_ticket) {
-        // cprintf("Extra: %d | %d | %d\n", ticket_count, total_tickets, golden_ticket);
-        if(total_ticks % 500 <= 20) {
-          // cprintf("Current is %d ticks %d tickets %d\n", p->pid, p->ticks, p->tickets);
-          cprintf("Current is %d ticks, pid %d runs %d ticks \n", total_ticks, p->pid, p->ticks);
-        }
-        c->proc = p;
+      c->proc = p;
+      // 又选中了上次运行的进程：cr3和TSS都还是它的，不用重新加载
+      if(p != c->lastproc)
         switchuvm(p);
-        p->state = RUNNING;
-
-        p->inuse = 1;
-        const int tickstart = ticks;
-
-        swtch(&(c->scheduler), p->context);
-
-        p->ticks += ticks - tickstart;
-
+      c->lastproc = p;
+      p->state = RUNNING;
+
+      p->inuse = 1;
+      const int tickstart = ticks;
+      const unsigned long long tscstart = rdtsc();
+      const int waited = tickstart - p->readyat;
+      p->waitticks += waited;
+      p->nsched++;
+      p->lastrun = tickstart;
+      p->slice = 0;
+
+      swtch(&(c->scheduler), p->context);
+
+      p->ticks += ticks - tickstart;
+      // 只写入本CPU的缓冲区，用schedtrace程序查看
+      schedrecord(cpu, p, tickstart, waited, ticks - tickstart,
+                  tscstart - drawstart);
+#ifndef STRIDE
+      compensate(p, rdtsc() - tscstart);
+#endif
+#ifdef STRIDE
+      // 进程可能已经睡眠或退出而离开了堆，pass照样要增加
+      p->pass += p->stride * (ticks - tickstart);
+      if(p->heapidx != 0)
+        siftdown(rq, p->heapidx);
+#endif
+
+      // 内核部分在每个页表中都一样，调度器可以继续用进程的页表。
+      // 进程还在本队列中等待时保留它，balance()不会把它移走，
+      // 它就不会在别处exec或退出而释放页表；否则换回内核页表
+      if(p->state != RUNNABLE || p->cpu != cpu) {
         switchkvm();
-        c->proc = 0;
-        break;
-      } else {
-        continue;
+        c->lastproc = 0;
       }
+      c->proc = 0;
     }
     release(&ptable.lock);
 
@@ -494,6 +1202,10 @@ sched(void)
     panic("sched running");
   if(readeflags()&FL_IF)
     panic("sched interruptible");
+  if(p->state == SLEEPING)
+    p->ru.nvcsw++;
+  else if(p->state == RUNNABLE)
+    p->ru.nivcsw++;
   intena = mycpu()->intena;
   swtch(&p->context, mycpu()->scheduler);
   mycpu()->intena = intena;
@@ -508,7 +1220,7 @@ yield(void)
   if(myproc()->state == SLEEPING) {
     panic("Sleep here, we need to restore tickets");
   }
-  myproc()->state = RUNNABLE;
+  setrunnable(myproc());
   sched();
   release(&ptable.lock);
 }
@@ -581,13 +1293,16 @@ sleep(void *chan, struct spinlock *lk)
 static void
 wakeup1(void *chan)
 {
-  struct proc *p;
+  struct proc *p, *next;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == SLEEPING && p->chan == chan){
+  // Only sleepers whose chan hashes alike are on this queue.
+  for(p = waitq[WAITHASH(chan)]; p; p = next){
+    next = p->waitnext;  // restoretickets() unlinks p
+    if(p->chan == chan){
       restoretickets(p);
-      p->state = RUNNABLE;
+      setrunnable(p);
     }
+  }
 }
 
 // Wake up all processes sleeping on chan.
@@ -608,17 +1323,15 @@ kill(int pid)
   struct proc *p;
 
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == pid){
-      p->killed = 1;
-      // Wake process from sleep if necessary.
-      if(p->state == SLEEPING){
-        restoretickets(p);
-        p->state = RUNNABLE;
-      }
-      release(&ptable.lock);
-      return 0;
+  if((p = findproc(pid)) != 0){
+    p->killed = 1;
+    // Wake process from sleep if necessary.
+    if(p->state == SLEEPING){
+      restoretickets(p);
+      setrunnable(p);
     }
+    release(&ptable.lock);
+    return 0;
   }
   release(&ptable.lock);
   return -1;
@@ -639,12 +1352,13 @@ procdump(void)
   [RUNNING]   "run   ",
   [ZOMBIE]    "zombie"
   };
-  int i;
+  int i, slot;
   struct proc *p;
   char *state;
   uint pc[10];
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for(slot = 0; slot < ptable.nproc; slot++){
+    p = ptable.proc[slot];
     if(p->state == UNUSED)
       continue;
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "pstat.h"
+#include "rusage.h"
 #include "spinlock.h"
 
 // Per-CPU state
@@ -13,6 +14,8 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  volatile int idle;           // Halted in scheduler() with nothing to run
+  struct proc *lastproc;       // Process whose page table is still loaded
 };
 
 extern struct cpu cpus[NCPU];
@@ -51,9 +54,15 @@ struct proc {
   enum procstate state;        // 进程状态（UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE）
   int pid;                     // 进程ID，唯一标识一个进程
   struct proc *parent;         // 父进程指针，指向创建此进程的进程
+  struct proc *children;       // 子进程链表，由sibling链接
+  struct proc *sibling;        // 父进程子进程链表中的下一个
+  struct proc *hashnext;       // pid散列表中同一链上的下一个进程，未使用时是空闲链表中的下一个
+  int slot;                    // 在进程表中的下标，运行队列的树按它索引
   struct trapframe *tf;        // 陷阱帧指针，保存进入内核前的用户上下文
   struct context *context;     // 上下文指针，用于进程切换（swtch）
   void *chan;                  // 如果不为零，表示进程在此通道上睡眠等待
+  struct proc *waitnext;       // 等待队列中的下一个睡眠进程
+  struct proc **waitprev;      // 指向等待队列中指向本进程的指针
   int killed;                  // 如果不为零，表示进程已被标记为要终止
   struct file *ofile[NOFILE];  // 打开的文件数组，存储进程打开的所有文件
   struct inode *cwd;           // 当前工作目录的inode指针
@@ -63,6 +72,31 @@ struct proc {
   int inuse;                   // 标记此结构体是否正在使用
   int tickets;                 // 进程持有的彩票数量，决定获得CPU时间的概率
   int ticks;                   // 进程已使用的CPU时钟周期数，用于统计和性能分析
+  int cpu;                     // 进程所在运行队列的CPU下标，只在该CPU上运行
+  int weight;                  // 在运行队列树中的彩票数，以基础彩票计，睡眠时为0
+  int base;                    // 以所在货币计的有效彩票数(含借入的)，睡眠时为0
+  int currency;                // 彩票所属的货币，0表示基础货币
+  int borrowed;                // 正在睡眠的进程借给本进程的彩票数
+  int quantum;                 // 时间片长度，被选中后运行这么多个时钟中断才让出CPU
+  int slice;                   // 本次被选中后已经过的时钟中断数
+  int comp;                    // 补偿彩票，上次没用完时间片就睡眠时获得，下次运行时清零
+  struct proc *lentto;         // 睡眠时把彩票借给这个进程，0表示不借出
+  int lentpid;                 // lentto的pid，用来发现借入者已经退出
+  int lent;                    // 每次睡眠时借出的彩票数
+  int given;                   // 本次睡眠实际借出的彩票数
+  uint readyat;                // 最近一次变为可运行状态时的ticks
+  int waitticks;               // 处于可运行状态等待调度的时钟数之和
+  int nsched;                  // 被调度器选中的次数
+  uint lastrun;                // 最近一次开始运行时的ticks
+  int migrations;              // 被负载均衡移到其他CPU的次数
+  struct rusage ru;            // 本进程的资源使用统计
+  struct rusage cru;           // 已回收的子进程及其后代的资源使用之和
+#ifdef STRIDE
+  // 步长调度(Stride Scheduling)相关字段
+  uint stride;                 // 步长，STRIDE1除以彩票数
+  uint pass;                   // 已累计的pass，每次调度pass最小的进程
+  int heapidx;                 // 在运行队列堆中的下标，0表示不在堆中
+#endif
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -71,9 +105,13 @@ struct proc {
 //   fixed-size stack
 //   expandable heap
 
+// The proc structures are carved out of pages allocated as
+// processes are created, so only nproc of the NPROC slots exist.
 struct ptable_t {
   struct spinlock lock;
-  struct proc proc[NPROC];
+  struct proc *proc[NPROC];    // slots 0..nproc-1, indexed by proc.slot
+  int nproc;                   // number of allocated slots
+  struct proc *free;           // UNUSED slots, linked by hashnext
 };
 extern struct ptable_t ptable;
 
@@ -6,4 +6,9 @@ struct pstat{
     int tickets[NPROC];
     int pid[NPROC];
     int ticks[NPROC];
+    int wait[NPROC];      // 可运行但等待调度的时钟数之和
+    int nsched[NPROC];    // 被调度的次数
+    int lastrun[NPROC];   // 最近一次开始运行时的ticks
+    int currency[NPROC];  // 彩票所属的货币，0表示基础货币
+    int migrations[NPROC]; // 被移到其他CPU的次数
 };
\ No newline at end of file
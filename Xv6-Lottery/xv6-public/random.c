@@ -1,45 +1,81 @@
 /**
  * random.c - 伪随机数生成器实现
  * 
- * 此文件实现了一个简单的线性同余伪随机数生成器(Linear Congruential Generator, LCG)
+ * 此文件实现了PCG32伪随机数生成器(Permuted Congruential Generator)，
  * 用于xv6操作系统中的彩票调度算法(Lottery Scheduling)
  * 
- * LCG算法公式: X_(n+1) = (a * X_n + c) mod m
- * 其中:
- * - a是乘数(multiplier)
- * - c是增量(increment)
- * - m是模数(modulus)
- * - X_0是种子(seed)
+ * PCG用64位线性同余递推状态，再对高位做移位和循环右移得到32位输出，
+ * 低位的统计质量比直接输出线性同余结果好得多。
+ * 
+ * 每个CPU有自己的生成器，并使用不同的增量(即不同的序列)，
+ * 调度器抽奖时只写本CPU的状态，不会和其他CPU争用同一变量
  */
+#include "types.h"
+#include "param.h"
 #include "random.h"
 
-// 线性同余生成器的参数
-unsigned int ran_A = 1103515245;  // 乘数(multiplier)
-unsigned int ran_B = 12345;       // 增量(increment)
-unsigned int ran_status = 5167495;  // 当前随机数状态，初始值作为默认种子
+// PCG32的乘数
+#define PCG_MULT 6364136223846793005ULL
+
+// 每个CPU的生成器状态，按缓存行对齐以免不同CPU写同一缓存行
+struct pcg {
+    unsigned long long state;  // 当前状态
+    unsigned long long inc;    // 增量，必须是奇数，决定使用哪个序列
+} __attribute__((aligned(64)));
+
+static struct pcg ran[NCPU];
 
 /**
- * 设置随机数生成器的种子
+ * 设置CPU的随机数生成器的种子
  * 
+ * 相同的种子在不同CPU上也会产生不同的随机数序列
+ * 
+ * @param cpu CPU下标
  * @param seed 随机数生成器的种子，用于初始化随机数序列
- *             不同的种子会产生不同的随机数序列
  */
-void srand(unsigned int seed) {
-    ran_status = seed;
+void srand(int cpu, unsigned int seed) {
+    ran[cpu].inc = ((unsigned long long)cpu << 1) | 1;
+    ran[cpu].state = 0;
+    rand(cpu);
+    ran[cpu].state += seed;
+    rand(cpu);
 }
 
 /**
- * 生成下一个伪随机数
+ * 生成CPU的下一个伪随机数
  * 
- * 使用线性同余算法计算下一个随机数:
- * ran_status = (ran_A * ran_status + ran_B) mod 2^32
+ * 调用者必须保证不会被调度到其他CPU上(例如关中断)
  * 
- * 注: 在32位系统中，unsigned int溢出会自动取模2^32
+ * @param cpu CPU下标
+ * @return 返回生成的32位伪随机数
+ */
+unsigned int rand(int cpu) {
+    struct pcg *g = &ran[cpu];
+    unsigned long long old = g->state;
+    uint xorshifted, rot;
+
+    g->state = old * PCG_MULT + g->inc;
+    xorshifted = ((old >> 18) ^ old) >> 27;
+    rot = old >> 59;
+    return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+/**
+ * 生成[0, n)内均匀分布的伪随机数
  * 
- * @return 返回生成的伪随机数
+ * 直接取rand() % n时，2^32不是n的倍数，较小的余数会多出现一次。
+ * 这里丢弃最小的2^32 mod n个值，剩下的值恰好是n的整数倍
+ * 
+ * @param cpu CPU下标
+ * @param n 上界，必须大于0
+ * @return 返回0到n-1之间的伪随机数
  */
-unsigned int rand() {
-    unsigned long long tmp = ran_A * ran_status + ran_B;  // 使用64位避免中间计算溢出
-    ran_status = (unsigned int)tmp;  // 截断为32位，相当于对2^32取模
-    return ran_status;
+unsigned int randbelow(int cpu, unsigned int n) {
+    unsigned int threshold = -n % n;  // 即2^32 mod n
+    unsigned int r;
+
+    do {
+        r = rand(cpu);
+    } while(r < threshold);
+    return r % n;
 }
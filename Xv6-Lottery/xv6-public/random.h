@@ -4,25 +4,39 @@
  * 该头文件定义了xv6操作系统中使用的伪随机数生成器的接口函数。
  * 随机数生成器主要用于彩票调度(Lottery Scheduling)算法，通过随机选择
  * 持有"彩票"的进程来分配CPU时间，实现一种概率性的进程调度机制。
+ * 每个CPU有独立的生成器状态，所有函数的第一个参数都是CPU下标。
  */
 #pragma once  // 防止头文件被重复包含
 
 /**
- * 设置随机数生成器的种子值
+ * 设置CPU的随机数生成器的种子值
  * 
  * 种子值决定了随机数序列的起点，相同的种子值将产生相同的随机数序列。
  * 在系统初始化时应当设置一个合适的种子，以确保每次运行生成不同的随机数序列。
  * 
+ * @param cpu CPU下标
  * @param seed 用作随机数生成初始值的无符号整数
  */
-void srand(unsigned int);
+void srand(int, unsigned int);
 
 /**
- * 生成并返回一个伪随机数
+ * 生成并返回CPU的下一个伪随机数
  * 
- * 该函数使用线性同余算法生成伪随机数。每次调用都会更新内部状态，
- * 产生下一个随机值。在彩票调度中，该函数用于随机抽取获得CPU时间的进程。
+ * 该函数使用PCG32算法生成伪随机数。每次调用都会更新该CPU的内部状态，
+ * 产生下一个随机值。
  * 
+ * @param cpu CPU下标
  * @return 返回一个无符号整数类型的伪随机数
  */
-unsigned int rand(void);
+unsigned int rand(int);
+
+/**
+ * 生成[0, n)内均匀分布的伪随机数，没有取模带来的偏差
+ * 
+ * 在彩票调度中，该函数用于抽取中奖彩票号。
+ * 
+ * @param cpu CPU下标
+ * @param n 上界，必须大于0
+ * @return 返回0到n-1之间的伪随机数
+ */
+unsigned int randbelow(int, unsigned int);
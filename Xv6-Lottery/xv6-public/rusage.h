@@ -0,0 +1,17 @@
+#pragma once
+
+// getrusage的第一个参数
+#define RUSAGE_SELF      0   // 当前进程
+#define RUSAGE_CHILDREN  (-1) // 已被wait回收的子进程及其后代之和
+
+// 进程的资源使用统计
+struct rusage {
+    uint utime;     // 在用户态时发生的时钟中断数
+    uint stime;     // 在内核态时发生的时钟中断数
+    uint syscalls;  // 系统调用次数
+    uint inblock;   // 从磁盘读入的块数
+    uint oublock;   // 写到磁盘的块数
+    uint faults;    // 页错误次数
+    uint nvcsw;     // 睡眠而主动让出CPU的次数
+    uint nivcsw;    // 时间片用完被抢占的次数
+};
@@ -0,0 +1,161 @@
+#include "types.h"
+#include "user.h"
+#include "schedtrace.h"
+
+// 彩票调度公平性测试
+// 用法: schedbench [ticks [tickets...]]
+// 按给定的彩票数(默认10 20 30)各启动一个死循环进程，运行ticks个时钟(默认500)，
+// 每SAMPLE个时钟用getpinfo采样一次，打印:
+// - 每次采样时各进程实际获得的CPU份额与按彩票数应得份额的最大误差
+// - 收敛时间: 此后每次采样的误差都不超过TOLERANCE的最早时刻
+// - 结束时各进程的应得份额、实际份额和被调度次数
+// - 平均每次调度决定用的时间戳计数器周期数(来自schedtrace)
+// 份额都以千分之一计
+
+#define MAXCHILD  8
+#define MAXSAMPLE 200
+#define SAMPLE    10     // 采样间隔，以时钟计
+#define TOLERANCE 50     // 认为已收敛的最大误差，千分之一
+
+static struct pstat ps;
+static struct schedtrace t;
+
+int tickets[MAXCHILD];
+int pids[MAXCHILD];
+int start[MAXCHILD];     // 开始时各进程的ticks
+int got[MAXCHILD];       // 开始以来各进程的ticks
+int nsched[MAXCHILD];
+int err[MAXSAMPLE];      // 每次采样的最大误差
+int nchild;
+
+uint cycles;             // 调度决定的周期数之和
+uint ndecide;            // cycles中的决定数
+
+void spin(void) {
+    for(;;)
+        ;
+}
+
+// 读完调度跟踪记录，累计每次决定的周期数
+void drain(int count) {
+    int i;
+
+    do {
+        schedtrace(&t);
+        for(i = 0; count && i < t.n; i++) {
+            cycles += t.ev[i].cycles;
+            ndecide++;
+            if(cycles > 0x7fffffff) {   // 防止溢出，平均值不变
+                cycles /= 2;
+                ndecide /= 2;
+            }
+        }
+    } while(t.n == TRACEREAD);
+}
+
+// 用getpinfo读取各子进程的ticks和被调度次数
+void sample(int *out) {
+    int i, j;
+
+    if(getpinfo(&ps) < 0) {
+        printf(2, "schedbench: getpinfo failed\n");
+        exit();
+    }
+    for(i = 0; i < nchild; i++) {
+        out[i] = 0;
+        for(j = 0; j < NPROC; j++) {
+            if(ps.pid[j] == pids[i]) {
+                out[i] = ps.ticks[j];
+                nsched[i] = ps.nsched[j];
+            }
+        }
+    }
+}
+
+int share(int part, int whole) {
+    return whole > 0 ? part * 1000 / whole : 0;
+}
+
+int main(int argc, char* argv[]) {
+    int total = 500;
+    int sumtickets = 0, sumgot, worst, e;
+    int i, n, begin, converged;
+
+    if(argc > 1)
+        total = atoi(argv[1]);
+    for(i = 2; i < argc && nchild < MAXCHILD; i++)
+        tickets[nchild++] = atoi(argv[i]);
+    if(nchild == 0) {
+        tickets[0] = 10;
+        tickets[1] = 20;
+        tickets[2] = 30;
+        nchild = 3;
+    }
+    for(i = 0; i < nchild; i++) {
+        if(tickets[i] <= 0) {
+            printf(2, "schedbench: bad ticket count %d\n", tickets[i]);
+            exit();
+        }
+        sumtickets += tickets[i];
+    }
+
+    // 本进程大部分时间在睡眠，彩票多一些才能按时醒来采样
+    settickets(sumtickets);
+    for(i = 0; i < nchild; i++) {
+        pids[i] = fork();
+        if(pids[i] < 0) {
+            printf(2, "schedbench: fork failed\n");
+            exit();
+        }
+        if(pids[i] == 0) {
+            settickets(tickets[i]);
+            spin();
+        }
+    }
+
+    drain(0);
+    sample(start);
+    begin = uptime();
+    for(n = 0; n < MAXSAMPLE && uptime() - begin < total; n++) {
+        sleep(SAMPLE);
+        drain(1);
+        sample(got);
+        sumgot = 0;
+        for(i = 0; i < nchild; i++) {
+            got[i] -= start[i];
+            sumgot += got[i];
+        }
+        worst = 0;
+        for(i = 0; i < nchild; i++) {
+            e = share(got[i], sumgot) - share(tickets[i], sumtickets);
+            if(e < 0)
+                e = -e;
+            if(e > worst)
+                worst = e;
+        }
+        err[n] = worst;
+        printf(1, "tick %d: max error %d\n", uptime() - begin, worst);
+    }
+
+    for(i = 0; i < nchild; i++)
+        kill(pids[i]);
+    for(i = 0; i < nchild; i++)
+        wait();
+
+    converged = n;
+    while(converged > 0 && err[converged - 1] <= TOLERANCE)
+        converged--;
+    if(converged == n)
+        printf(1, "did not converge within %d\n", TOLERANCE);
+    else
+        printf(1, "converged within %d after %d ticks\n", TOLERANCE,
+               (converged + 1) * SAMPLE);
+
+    printf(1, "pid\ttickets\texpect\tgot\tnsched\n");
+    for(i = 0; i < nchild; i++)
+        printf(1, "%d\t%d\t%d\t%d\t%d\n", pids[i], tickets[i],
+               share(tickets[i], sumtickets), share(got[i], sumgot), nsched[i]);
+    if(ndecide > 0)
+        printf(1, "%d decisions, %d cycles each\n", ndecide, cycles / ndecide);
+    exit();
+}
@@ -0,0 +1,56 @@
+#include "types.h"
+#include "user.h"
+#include "schedtrace.h"
+
+// 读取调度器的跟踪记录并打印
+// 用法: schedtrace [ticks]
+// 每10个时钟读取一次，共运行ticks个时钟（默认100），
+// 最后用getpinfo打印各进程的调度统计
+// 把要观察的程序放到后台运行，例如: lotterytest &; schedtrace 200
+
+static struct schedtrace t;
+static struct pstat ps;
+
+// 读完缓冲区中的所有记录，print为0时只跳过不打印
+void drain(int print) {
+    int i;
+
+    do {
+        schedtrace(&t);
+        for(i = 0; print && i < t.n; i++)
+            printf(1, "%d\t%d\t%d\t%d\t%d\t%d\t%d\n", t.ev[i].cpu, t.ev[i].tick,
+                   t.ev[i].pid, t.ev[i].tickets, t.ev[i].waited, t.ev[i].ran,
+                   t.ev[i].cycles);
+        if(print && t.lost)
+            printf(1, "lost %d events\n", t.lost);
+    } while(t.n == TRACEREAD);
+}
+
+int main(int argc, char* argv[]) {
+    int total = 100;
+    int i, start;
+
+    if(argc > 1)
+        total = atoi(argv[1]);
+
+    // 跳过启动以来的旧记录
+    drain(0);
+    printf(1, "cpu\ttick\tpid\ttickets\twaited\tran\tcycles\n");
+    start = uptime();
+    while(uptime() - start < total) {
+        sleep(10);
+        drain(1);
+    }
+
+    if(getpinfo(&ps) < 0) {
+        printf(2, "schedtrace: getpinfo failed\n");
+        exit();
+    }
+    printf(1, "pid\ttickets\tticks\tnsched\twait\tlastrun\tmigrate\n");
+    for(i = 0; i < NPROC; i++)
+        if(ps.inuse[i] && ps.pid[i] > 0)
+            printf(1, "%d\t%d\t%d\t%d\t%d\t%d\t%d\n", ps.pid[i], ps.tickets[i],
+                   ps.ticks[i], ps.nsched[i], ps.wait[i], ps.lastrun[i],
+                   ps.migrations[i]);
+    exit();
+}
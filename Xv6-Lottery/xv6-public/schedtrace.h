@@ -0,0 +1,22 @@
+#pragma once
+#include "param.h"
+
+// 调度器的一次调度决定，进程运行结束回到调度器时记录
+struct schedevent {
+    uint seq;      // 在该CPU上的事件序号，从0开始递增
+    uint tick;     // 进程开始运行时的ticks
+    int cpu;       // 做出决定的CPU
+    int pid;       // 被选中的进程
+    int tickets;   // 被选中时持有的彩票数量
+    int waited;    // 被选中前在队列中等待的时钟数
+    int ran;       // 本次运行的时钟数
+    uint cycles;   // 从获得ptable.lock到切换到进程用的时间戳计数器周期数
+};
+
+// schedtrace系统调用的参数和结果
+struct schedtrace {
+    uint next[NCPU];   // 每个CPU下一个要读的事件序号，读完后更新
+    int lost;          // 还没读到就被覆盖的事件数
+    int n;             // ev中的事件数
+    struct schedevent ev[TRACEREAD];
+};
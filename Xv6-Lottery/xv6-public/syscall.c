@@ -105,6 +105,11 @@ extern int sys_write(void);
 extern int sys_uptime(void);
 extern int sys_settickets(void);
 extern int sys_getpinfo(void);
+extern int sys_schedtrace(void);
+extern int sys_lendtickets(void);
+extern int sys_setcurrency(void);
+extern int sys_setquantum(void);
+extern int sys_getrusage(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -130,6 +135,11 @@ static int (*syscalls[])(void) = {
 [SYS_close]   sys_close,
 [SYS_settickets] sys_settickets,
 [SYS_getpinfo] sys_getpinfo,
+[SYS_schedtrace] sys_schedtrace,
+[SYS_lendtickets] sys_lendtickets,
+[SYS_setcurrency] sys_setcurrency,
+[SYS_setquantum] sys_setquantum,
+[SYS_getrusage] sys_getrusage,
 };
 
 void
@@ -139,6 +149,7 @@ syscall(void)
   struct proc *curproc = myproc();
 
   num = curproc->tf->eax;
+  curproc->ru.syscalls++;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
     curproc->tf->eax = syscalls[num]();
   } else {
@@ -22,3 +22,8 @@
 #define SYS_close  21
 #define SYS_settickets 22
 #define SYS_getpinfo 23
+#define SYS_schedtrace 24
+#define SYS_lendtickets 25
+#define SYS_setcurrency 26
+#define SYS_setquantum 27
+#define SYS_getrusage 28
@@ -7,6 +7,7 @@
 #include "mmu.h"
 #include "proc.h"
 #include "pstat.h"
+#include "schedtrace.h"
 
 int
 sys_fork(void)
@@ -122,7 +123,8 @@ int sys_settickets(void) {
  * 
  * 此系统调用用于收集系统中所有进程的统计信息，
  * 包括彩票调度相关的数据，如进程ID、持有的彩票数量、
- * CPU使用时间（ticks）以及进程是否在使用中等
+ * CPU使用时间（ticks）、等待调度的时间、被调度次数、
+ * 最近一次运行的时刻、迁移次数以及进程是否在使用中等
  * 
  * @return 成功返回0，失败返回-1
  */
@@ -137,10 +139,10 @@ int sys_getpinfo(void) {
   // 获取进程表锁，确保在收集信息时进程状态不变
   acquire(&ptable.lock);
   struct proc* p;
-  // 遍历进程表中的所有进程
-  for(p = ptable.proc; p != &(ptable.proc[NPROC]); ++p) {
-    // 计算当前进程在进程表中的索引
-    const int index = p - ptable.proc;
+  int index;
+  // 遍历进程表中已分配的所有进程
+  for(index = 0; index < ptable.nproc; ++index) {
+    p = ptable.proc[index];
     // 只收集活跃进程的信息（状态不为UNUSED）
     if(p->state != UNUSED) {
       // 填充进程统计信息
@@ -148,9 +150,106 @@ int sys_getpinfo(void) {
       target->ticks[index] = p->ticks;   // CPU使用时间
       target->inuse[index] = p->inuse;   // 是否在使用中
       target->tickets[index] = p->tickets; // 持有的彩票数量
+      target->wait[index] = p->waitticks;  // 等待调度的时间
+      target->nsched[index] = p->nsched;   // 被调度的次数
+      target->lastrun[index] = p->lastrun; // 最近一次运行的时刻
+      target->currency[index] = p->currency; // 彩票所属的货币
+      target->migrations[index] = p->migrations; // 迁移次数
     }
   }
   // 释放进程表锁
   release(&ptable.lock);
   return 0;
-}
\ No newline at end of file
+}
+
+/**
+ * 借出彩票的系统调用实现
+ * 
+ * 当前进程每次睡眠时把n张彩票借给pid进程，醒来时收回。
+ * 客户进程在等待服务进程的回复前调用，让服务进程更快地处理请求
+ * 
+ * @return 成功返回0，失败返回-1
+ */
+int sys_lendtickets(void) {
+  int pid, n;
+  // 从用户空间获取参数：借入者的pid和借出的彩票数
+  if(argint(0, &pid) < 0 || argint(1, &n) < 0)
+    return -1;
+  // 检查彩票数量是否合法（不能为负数）
+  if(n < 0)
+    return -1;
+  return lendtickets(pid, n);
+}
+
+/**
+ * 加入彩票货币的系统调用实现
+ * 
+ * 当前进程的彩票改为以id号货币计价，funding大于0时
+ * 同时设置这种货币总共值多少张基础彩票。
+ * 用来隔离租户：先fork，子进程加入租户的货币后再exec租户的程序
+ * 
+ * @return 成功返回0，失败返回-1
+ */
+int sys_setcurrency(void) {
+  int id, funding;
+  // 从用户空间获取参数：货币编号和货币的总价值
+  if(argint(0, &id) < 0 || argint(1, &funding) < 0)
+    return -1;
+  // 检查参数是否合法
+  if(id < 0 || id >= NCURRENCY || funding < 0 || funding > MAXFUNDING)
+    return -1;
+  return setcurrency(id, funding);
+}
+
+/**
+ * 设置时间片长度的系统调用实现
+ * 
+ * 当前进程每次被选中后运行n个时钟才让出CPU，
+ * fork出的子进程继承这个长度
+ * 
+ * @return 成功返回0，失败返回-1
+ */
+int sys_setquantum(void) {
+  int n;
+  // 从用户空间获取参数：时间片长度
+  if(argint(0, &n) < 0)
+    return -1;
+  // 检查时间片长度是否合法
+  if(n < 1 || n > MAXQUANTUM)
+    return -1;
+  setquantum(n);
+  return 0;
+}
+
+/**
+ * 获取资源使用统计的系统调用实现
+ * 
+ * who为RUSAGE_SELF时返回当前进程的统计，为RUSAGE_CHILDREN时
+ * 返回已被wait回收的子进程及其后代的统计之和
+ * 
+ * @return 成功返回0，失败返回-1
+ */
+int sys_getrusage(void) {
+  int who;
+  struct rusage* ru;
+  // 从用户空间获取参数：统计对象和存放结果的结构体指针
+  if(argint(0, &who) < 0 || argptr(1, (void*)&ru, sizeof(*ru)) < 0)
+    return -1;
+  return getrusage(who, ru);
+}
+
+/**
+ * 读取调度器跟踪记录的系统调用实现
+ * 
+ * 从用户传入的struct schedtrace中记录的位置开始，
+ * 读取各CPU环形缓冲区中的调度事件，并更新读取位置
+ * 
+ * @return 读到的事件数，失败返回-1
+ */
+int sys_schedtrace(void) {
+  struct schedtrace* t;
+  // 从用户空间获取参数：读取状态和结果缓冲区
+  if(argptr(0, (void*)&t, sizeof(*t)) < 0)
+    return -1;
+  return schedread(t);
+}
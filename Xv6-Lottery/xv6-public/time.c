@@ -0,0 +1,43 @@
+#include "types.h"
+#include "user.h"
+#include "rusage.h"
+
+// 运行一个命令并打印它(及其子进程)用掉的资源
+// 用法: time command [args...]
+// 时间以时钟数计，user和sys是在用户态和内核态时发生的时钟中断数
+
+int main(int argc, char* argv[]) {
+    struct rusage before, after;
+    int start, real, pid;
+
+    if(argc < 2) {
+        printf(2, "usage: time command [args...]\n");
+        exit();
+    }
+
+    // 之前回收的子进程也记在RUSAGE_CHILDREN里，打印时减掉
+    getrusage(RUSAGE_CHILDREN, &before);
+    start = uptime();
+    pid = fork();
+    if(pid < 0) {
+        printf(2, "time: fork failed\n");
+        exit();
+    }
+    if(pid == 0) {
+        exec(argv[1], argv + 1);
+        printf(2, "time: exec %s failed\n", argv[1]);
+        exit();
+    }
+    wait();
+    real = uptime() - start;
+    getrusage(RUSAGE_CHILDREN, &after);
+
+    printf(2, "%d real %d user %d sys\n", real,
+           after.utime - before.utime, after.stime - before.stime);
+    printf(2, "%d syscalls %d blocks in %d blocks out %d faults\n",
+           after.syscalls - before.syscalls, after.inblock - before.inblock,
+           after.oublock - before.oublock, after.faults - before.faults);
+    printf(2, "%d voluntary %d involuntary context switches\n",
+           after.nvcsw - before.nvcsw, after.nivcsw - before.nivcsw);
+    exit();
+}
@@ -0,0 +1,91 @@
+/**
+ * trace.c - 调度器跟踪记录
+ * 
+ * 每个CPU有一个调度事件环形缓冲区，只由该CPU的调度器写入，
+ * 写入时不加锁也不做任何I/O，不会拉长ptable.lock的持有时间。
+ * 用户程序通过schedtrace系统调用读取，读者只读取不修改缓冲区，
+ * 各自在struct schedtrace中记录读到哪里
+ */
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "schedtrace.h"
+
+struct tracering {
+  struct schedevent ev[TRACESIZE];
+  volatile uint head;  // 下一个事件的序号
+};
+
+static struct tracering rings[NCPU];
+
+/**
+ * 记录一次调度决定，只能由cpu自己的调度器调用
+ * 
+ * 先写好事件再增加head，读者就不会读到写了一半的事件
+ * 
+ * @param cpu 做出决定的CPU
+ * @param p 被选中并刚运行完的进程
+ * @param tick 进程开始运行时的ticks
+ * @param waited 被选中前等待的时钟数
+ * @param ran 本次运行的时钟数
+ * @param cycles 做出这次决定用的时间戳计数器周期数
+ */
+void schedrecord(int cpu, struct proc *p, uint tick, int waited, int ran,
+                 uint cycles) {
+  struct tracering *r = &rings[cpu];
+  struct schedevent *e = &r->ev[r->head % TRACESIZE];
+
+  e->seq = r->head;
+  e->tick = tick;
+  e->cpu = cpu;
+  e->pid = p->pid;
+  e->tickets = p->tickets;
+  e->waited = waited;
+  e->ran = ran;
+  e->cycles = cycles;
+  __sync_synchronize();
+  r->head++;
+}
+
+/**
+ * 读取各CPU从t->next开始的调度事件
+ * 
+ * 复制一个事件后再检查head，如果写者已经开始覆盖它所在的位置，
+ * 这个事件就作废并计入lost
+ * 
+ * @param t 用户传入的读取状态，结果也写回这里
+ * @return 读到的事件数
+ */
+int schedread(struct schedtrace *t) {
+  struct tracering *r;
+  uint head, s;
+  int cpu;
+
+  t->n = 0;
+  t->lost = 0;
+  for(cpu = 0; cpu < ncpu; cpu++) {
+    r = &rings[cpu];
+    head = r->head;
+    __sync_synchronize();
+    s = t->next[cpu];
+    if(head - s > TRACESIZE) {
+      // 太旧的事件已经被覆盖
+      t->lost += head - s - TRACESIZE;
+      s = head - TRACESIZE;
+    }
+    for(; s != head && t->n < TRACEREAD; s++) {
+      t->ev[t->n] = r->ev[s % TRACESIZE];
+      __sync_synchronize();
+      if(r->head - s >= TRACESIZE) {
+        t->lost++;
+        continue;
+      }
+      t->n++;
+    }
+    t->next[cpu] = s;
+  }
+  return t->n;
+}
@@ -13,6 +13,8 @@ struct gatedesc idt[256];
 extern uint vectors[];  // in vectors.S: array of 256 entry pointers
 struct spinlock tickslock;
 uint ticks;
+uint tscpertick;  // time-stamp counter cycles per tick, 0 until measured
+static unsigned long long lasttsc;
 
 void
 tvinit(void)
@@ -49,11 +51,26 @@ trap(struct trapframe *tf)
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
     if(cpuid() == 0){
+      unsigned long long now = rdtsc();
+      if(lasttsc)
+        tscpertick = now - lasttsc;
+      lasttsc = now;
       acquire(&tickslock);
       ticks++;
       wakeup(&ticks);
       release(&tickslock);
     }
+    // 每个CPU的时钟都按同样的频率中断，记到被打断的进程上
+    if(myproc()){
+      if((tf->cs&3) == DPL_USER)
+        myproc()->ru.utime++;
+      else
+        myproc()->ru.stime++;
+    }
+    lapiceoi();
+    break;
+  case T_IRQ0 + IRQ_WAKE:
+    // Only ends the halt in scheduler().
     lapiceoi();
     break;
   case T_IRQ0 + IRQ_IDE:
@@ -87,6 +104,8 @@ trap(struct trapframe *tf)
       panic("trap");
     }
     // In user space, assume process misbehaved.
+    if(tf->trapno == T_PGFLT)
+      myproc()->ru.faults++;
     cprintf("pid %d %s: trap %d err %d on cpu %d "
             "eip 0x%x addr 0x%x--kill proc\n",
             myproc()->pid, myproc()->name, tf->trapno,
@@ -100,10 +119,12 @@ trap(struct trapframe *tf)
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
     exit();
 
-  // Force process to give up CPU on clock tick.
+  // Force process to give up CPU once its quantum of clock ticks
+  // is used up.
   // If interrupts were on while locks held, would need to check nlock.
   if(myproc() && myproc()->state == RUNNING &&
-     tf->trapno == T_IRQ0+IRQ_TIMER)
+     tf->trapno == T_IRQ0+IRQ_TIMER &&
+     ++myproc()->slice >= myproc()->quantum)
     yield();
 
   // Check if the process has been killed since we yielded
@@ -1,6 +1,8 @@
 #include "pstat.h"
 struct stat;
 struct rtcdate;
+struct schedtrace;
+struct rusage;
 
 // system calls
 int fork(void);
@@ -26,6 +28,11 @@ int sleep(int);
 int uptime(void);
 int settickets(int);
 int getpinfo(struct pstat*);
+int schedtrace(struct schedtrace*);
+int lendtickets(int, int);
+int setcurrency(int, int);
+int setquantum(int);
+int getrusage(int, struct rusage*);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -91,6 +91,15 @@ ltr(ushort sel)
   asm volatile("ltr %0" : : "r" (sel));
 }
 
+// Read the time-stamp counter.
+static inline unsigned long long
+rdtsc(void)
+{
+  uint lo, hi;
+  asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((unsigned long long)hi << 32) | lo;
+}
+
 static inline uint
 readeflags(void)
 {
@@ -117,6 +126,15 @@ sti(void)
   asm volatile("sti");
 }
 
+// Enable interrupts and halt until the next one.  No interrupt
+// can be taken between the two instructions, so one that is
+// already pending ends the halt instead of being missed.
+static inline void
+stihlt(void)
+{
+  asm volatile("sti; hlt");
+}
+
 static inline uint
 xchg(volatile uint *addr, uint newval)
 {
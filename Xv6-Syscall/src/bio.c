@@ -1,10 +1,19 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
+// The buffers are carved out of kalloc pages at boot, BCACHEPCT
+// percent of physical memory but never fewer than NBUF.  Each
+// (dev, blockno) hashes to one of NBUCKET buckets, each a linked
+// list with its own spinlock, so lookups of different blocks on
+// different cpus don't contend.  A miss recycles a buffer chosen
+// by a clock hand sweeping a ring of all buffers; the sweep holds
+// bcache.lock, so at most one cpu ever holds more than one bucket
+// lock at a time and the bucket locks cannot deadlock.
+//
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
@@ -21,75 +30,209 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
 
-struct {
+extern char end[]; // first address after kernel loaded from ELF file
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;      // buffers hashing here, through prev/next
+};
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+struct {
+  struct spinlock lock;  // serializes recycling; protects hand
+  struct bucket bucket[NBUCKET];
+  struct buf *hand;      // next buffer the clock inspects
+  uint nbuf;             // number of buffers in the ring
 } bcache;
 
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % NBUCKET];
+}
+
+static void
+bunlink(struct bucket *bk, struct buf *b)
+{
+  if(b->prev)
+    b->prev->next = b->next;
+  else
+    bk->head = b->next;
+  if(b->next)
+    b->next->prev = b->prev;
+}
+
+static void
+binsert(struct bucket *bk, struct buf *b)
+{
+  b->prev = 0;
+  b->next = bk->head;
+  if(bk->head)
+    bk->head->prev = b;
+  bk->head = b;
+}
+
+// Find the cached buffer for block blockno on dev in bk.
+// Caller must hold bk->lock.
+static struct buf*
+blookup(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head; b != 0; b = b->next)
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  return 0;
+}
+
+// Must be called after kinit2(), since it takes its buffers
+// from the full free page list.
 void
 binit(void)
 {
-  struct buf *b;
+  struct bucket *bk;
+  struct buf *b, *first;
+  char *page, *data;
+  uint npages, ndata, i;
+
+  if(BSIZE > PGSIZE || PGSIZE % BSIZE)
+    panic("binit: BSIZE");
 
   initlock(&bcache.lock, "bcache");
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    initlock(&bk->lock, "bcache.bucket");
 
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  // Fill whole pages with buffers, and more pages with their data,
+  // PGSIZE/BSIZE blocks to a page; kalloc pages need not be
+  // contiguous, so the clock ring links the buffers through cnext.
+  // Every buffer starts as block i of device 0, a unique identity
+  // that spreads the unused buffers over the buckets.
+  npages = (PHYSTOP - V2P(end)) / PGSIZE * BCACHEPCT / 100;
+  first = 0;
+  data = 0;
+  ndata = 0;
+  for(i = 0; i < npages || bcache.nbuf < NBUF; i++){
+    if((page = kalloc()) == 0)
+      break;
+    memset(page, 0, PGSIZE);
+    for(b = (struct buf*)page; (char*)(b+1) <= page+PGSIZE; b++){
+      if(ndata == 0){
+        if(i >= npages && bcache.nbuf >= NBUF)
+          break;
+        if((data = kalloc()) == 0)
+          break;
+        i++;
+        ndata = PGSIZE / BSIZE;
+      }
+      b->data = (uchar*)data;
+      data += BSIZE;
+      ndata--;
+      initsleeplock(&b->lock, "buffer");
+      b->blockno = bcache.nbuf++;
+      binsert(bhash(b->dev, b->blockno), b);
+      if(first == 0)
+        first = b;
+      b->cnext = bcache.hand;
+      bcache.hand = b;
+    }
   }
+  if(bcache.nbuf < NBUF)
+    panic("binit: out of memory");
+  first->cnext = bcache.hand;
+  cprintf("bcache: %d buffers\n", bcache.nbuf);
 }
 
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
+// With prefetch set, only a newly allocated buffer is returned;
+// if the block is already cached or no buffer is free, return 0.
 static struct buf*
-bget(uint dev, uint blockno)
+bget(uint dev, uint blockno, int prefetch)
 {
+  struct bucket *bk, *vk;
   struct buf *b;
+  uint i;
 
-  acquire(&bcache.lock);
+  bk = bhash(dev, blockno);
+  acquire(&bk->lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  if((b = blookup(bk, dev, blockno)) != 0){
+    if(prefetch){
+      release(&bk->lock);
+      return 0;
     }
+    goto found;
   }
+  release(&bk->lock);
 
-  // Not cached; recycle an unused buffer.
-  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-  // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  // Not cached; recycle an unused buffer.  Look again once
+  // bcache.lock is held, in case another cpu recycled a buffer
+  // for this block meanwhile.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  if((b = blookup(bk, dev, blockno)) != 0){
+    release(&bcache.lock);
+    if(prefetch){
+      release(&bk->lock);
+      return 0;
     }
+    goto found;
+  }
+
+  // Clock sweep: skip buffers in use, give recently used ones a
+  // second chance.  Even if refcnt==0, B_DIRTY indicates a buffer
+  // is in use because log.c has modified it but not yet committed
+  // it.  A buffer's bucket can only change under bcache.lock, so
+  // vk stays right while it is locked.
+  for(i = 0; i < 2*bcache.nbuf; i++){
+    b = bcache.hand;
+    bcache.hand = b->cnext;
+    vk = bhash(b->dev, b->blockno);
+    if(vk != bk)
+      acquire(&vk->lock);
+    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0){
+      if(b->used){
+        b->used = 0;
+      } else {
+        bunlink(vk, b);
+        b->refcnt = 1;
+        if(vk != bk)
+          release(&vk->lock);
+        b->dev = dev;
+        b->blockno = blockno;
+        b->flags = 0;
+        binsert(bk, b);
+        release(&bk->lock);
+        release(&bcache.lock);
+        acquiresleep(&b->lock);
+        return b;
+      }
+    }
+    if(vk != bk)
+      release(&vk->lock);
+  }
+  if(prefetch){
+    release(&bk->lock);
+    release(&bcache.lock);
+    return 0;
   }
   panic("bget: no buffers");
+
+found:
+  b->refcnt++;
+  b->used = 1;
+  release(&bk->lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -98,13 +241,54 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
   if((b->flags & B_VALID) == 0) {
     iderw(b);
   }
   return b;
 }
 
+// Return a locked buf for the indicated block without reading
+// it from disk.  The caller must overwrite all of b->data.
+struct buf*
+boverwrite(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno, 0);
+  b->flags |= B_VALID;
+  return b;
+}
+
+// Write the n bufs in bs to disk together, so the driver can
+// merge consecutive blocks into one transfer.  All must be locked.
+void
+bwritev(struct buf **bs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&bs[i]->lock))
+      panic("bwritev");
+    bs[i]->flags |= B_DIRTY;
+  }
+  iderwv(bs, n);
+}
+
+// Start reading the indicated block into the cache without
+// waiting for it.  A later bread of the block sleeps on the
+// buffer lock until the disk is done, then finds it valid.
+void
+bprefetch(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if((b = bget(dev, blockno, 1)) == 0)
+    return;
+  b->flags |= B_ASYNC;
+  ideread(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -116,28 +300,67 @@ bwrite(struct buf *b)
 }
 
 // Release a locked buffer.
-// Move to the head of the MRU list.
+// Mark it used so the clock passes over it once more.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  // refcnt > 0 keeps the buffer in its bucket until this release.
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
   b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+  b->used = 1;
+  release(&bk->lock);
+}
+
+// Take another reference to b, which the caller already holds
+// one to, so that b stays cached after that one is dropped.
+void
+bpin(struct buf *b)
+{
+  struct bucket *bk;
+
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
+  b->refcnt++;
+  release(&bk->lock);
+}
+
+// Drop a reference kept from an earlier bread() after its lock
+// was released, letting the buffer be recycled again.
+void
+bunpin(struct buf *b)
+{
+  struct bucket *bk;
+
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
+  b->refcnt--;
+  b->used = 1;
+  release(&bk->lock);
+}
+
+// Release a buffer once its prefetch read has finished.
+// Called by the disk interrupt, which cannot pass the
+// holdingsleep check in brelse on behalf of the process that
+// started the read.
+void
+bprefetchdone(struct buf *b)
+{
+  struct bucket *bk;
+
+  releasesleep(&b->lock);
+
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
+  b->refcnt--;
+  release(&bk->lock);
 }
 //PAGEBREAK!
 // Blank page.
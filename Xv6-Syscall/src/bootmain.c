@@ -11,6 +11,7 @@
 #include "memlayout.h"
 
 #define SECTSIZE  512
+#define MAXSECTS  128  // sectors per read command, at most 255
 
 void readseg(uchar*, uint, uint);
 
@@ -55,22 +56,26 @@ waitdisk(void)
     ;
 }
 
-// Read a single sector at offset into dst.
-void
-readsect(void *dst, uint offset)
+// Read n sectors, 1 to 255, starting at sector offset into dst,
+// with one command.
+static void
+readsects(uchar *dst, uint offset, uint n)
 {
   // Issue command.
   waitdisk();
-  outb(0x1F2, 1);   // count = 1
+  outb(0x1F2, n);
   outb(0x1F3, offset);
   outb(0x1F4, offset >> 8);
   outb(0x1F5, offset >> 16);
   outb(0x1F6, (offset >> 24) | 0xE0);
   outb(0x1F7, 0x20);  // cmd 0x20 - read sectors
 
-  // Read data.
-  waitdisk();
-  insl(0x1F0, dst, SECTSIZE/4);
+  // Read data, a sector as each is ready.
+  do {
+    waitdisk();
+    insl(0x1F0, dst, SECTSIZE/4);
+    dst += SECTSIZE;
+  } while(--n > 0);
 }
 
 // Read 'count' bytes at 'offset' from kernel into physical address 'pa'.
@@ -79,6 +84,7 @@ void
 readseg(uchar* pa, uint count, uint offset)
 {
   uchar* epa;
+  uint n;
 
   epa = pa + count;
 
@@ -88,9 +94,13 @@ readseg(uchar* pa, uint count, uint offset)
   // Translate from bytes to sectors; kernel starts at sector 1.
   offset = (offset / SECTSIZE) + 1;
 
-  // If this is too slow, we could read lots of sectors at a time.
-  // We'd write more to memory than asked, but it doesn't matter --
-  // we load in increasing order.
-  for(; pa < epa; pa += SECTSIZE, offset++)
-    readsect(pa, offset);
+  // Read up to MAXSECTS sectors per command.  We may write more
+  // to memory than asked, but it doesn't matter -- we load in
+  // increasing order.
+  for(; pa < epa; pa += n*SECTSIZE, offset += n){
+    n = ((uint)epa - (uint)pa + SECTSIZE - 1) / SECTSIZE;
+    if(n > MAXSECTS)
+      n = MAXSECTS;
+    readsects(pa, offset, n);
+  }
 }
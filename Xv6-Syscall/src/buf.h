@@ -4,11 +4,14 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  uint used;        // clock reference bit, set on each use
+  struct buf *prev; // hash bucket chain
   struct buf *next;
+  struct buf *cnext; // clock ring of all buffers
   struct buf *qnext; // disk queue
-  uchar data[BSIZE];
+  uchar *data;      // BSIZE bytes
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_ASYNC 0x8  // read started by bprefetch; ideintr releases the buffer
 
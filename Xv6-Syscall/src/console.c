@@ -111,6 +111,7 @@ panic(char *s)
 
   cli();
   cons.locking = 0;
+  uartpanic();
   // use lapiccpunum so that we can call panic from mycpu()
   cprintf("lapicid %d: panic: ", lapicid());
   cprintf(s);
@@ -0,0 +1,8 @@
+// Time-stamp counter reading returned by cycles().
+// Each cpu has its own counter; they run at the same rate but may
+// be slightly apart, so compare readings taken on one cpu.
+
+struct cycles {
+  unsigned long long now;      // Counter of the cpu the call ran on
+  unsigned long long pertick;  // Counter increments per clock tick
+};
@@ -2,10 +2,15 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kshared;
 struct pipe;
 struct proc;
 struct rtcdate;
 struct spinlock;
+struct lockstat;
+struct profsample;
+struct trapframe;
+struct iovec;
 struct sleeplock;
 struct stat;
 struct superblock;
@@ -13,8 +18,14 @@ struct superblock;
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     boverwrite(uint, uint);
 void            brelse(struct buf*);
+void            bpin(struct buf*);
+void            bunpin(struct buf*);
 void            bwrite(struct buf*);
+void            bwritev(struct buf**, int);
+void            bprefetch(uint, uint);
+void            bprefetchdone(struct buf*);
 
 // console.c
 void            consoleinit(void);
@@ -24,6 +35,7 @@ void            panic(char*) __attribute__((noreturn));
 
 // exec.c
 int             exec(char*, char**);
+pde_t*          loadimage(char*, char**, struct proc*, uint*);
 
 // file.c
 struct file*    filealloc(void);
@@ -33,15 +45,22 @@ void            fileinit(void);
 int             fileread(struct file*, char*, int n);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
+int             filesend(struct file*, struct file*, int n);
+int             filereadv(struct file*, struct iovec*, int);
+int             filewritev(struct file*, struct iovec*, int);
+int             filepread(struct file*, char*, int n, uint);
+int             filepwrite(struct file*, char*, int n, uint);
 
 // fs.c
 void            readsb(int dev, struct superblock *sb);
 int             dirlink(struct inode*, char*, uint);
+void            dirunlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit(int dev);
 void            ilock(struct inode*);
+void            ilockshared(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
@@ -50,13 +69,21 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
+void            ireadahead(struct inode*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
+// futex.c
+void            futexinit(void);
+int             futexwait(char*, int);
+int             futexwake(char*, int);
+
 // ide.c
 void            ideinit(void);
-void            ideintr(void);
+void            ideintr(int);
 void            iderw(struct buf*);
+void            ideread(struct buf*);
+void            iderwv(struct buf**, int);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -76,6 +103,7 @@ void            kbdintr(void);
 void            cmostime(struct rtcdate *r);
 int             lapicid(void);
 extern volatile uint*    lapic;
+extern unsigned long long tscpertick;
 void            lapiceoi(void);
 void            lapicinit(void);
 void            lapicstartap(uchar, uint);
@@ -84,8 +112,14 @@ void            microdelay(int);
 // log.c
 void            initlog(int dev);
 void            log_write(struct buf*);
+void            log_write_data(struct buf*);
+void            log_free(uint);
+void            log_flush(void);
+void            log_tick(void);
 void            begin_op();
+int             begin_opn(int);
 void            end_op();
+void            end_opn(int);
 
 // mp.c
 extern int      ismp;
@@ -102,12 +136,20 @@ int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
 
 //PAGEBREAK: 16
+// profile.c
+void            profinit(void);
+void            profsample(struct trapframe*);
+int             profile(int, struct profsample*, int);
+
 // proc.c
+int             clone(void (*)(void*), void*, void*);
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
 int             growproc(int);
+int             join(void**);
 int             kill(int);
+struct proc*    kthread(char*, void (*)(void));
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
@@ -115,7 +157,9 @@ void            procdump(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            setproc(struct proc*);
+void            setvm(pde_t*, uint);
 void            sleep(void*, struct spinlock*);
+int             spawn(char*, char**);
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
@@ -126,6 +170,7 @@ void            swtch(struct context**, struct context*);
 
 // spinlock.c
 void            acquire(struct spinlock*);
+int             getlockstats(struct lockstat*, int);
 void            getcallerpcs(void*, uint*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
@@ -135,7 +180,10 @@ void            popcli(void);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
+void            acquiresleepshared(struct sleeplock*);
+void            downgradesleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
+void            releasesleepshared(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
@@ -156,6 +204,9 @@ int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
 void            syscall(void);
 
+// sysfile.c
+uint            readcount(void);
+
 // timer.c
 void            timerinit(void);
 
@@ -168,11 +219,14 @@ extern struct spinlock tickslock;
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
+void            uartpanic(void);
 void            uartputc(int);
 
 // vm.c
 void            seginit(void);
 void            kvmalloc(void);
+void            ksharedinit(void);
+extern struct kshared *kshared;
 pde_t*          setupkvm(void);
 char*           uva2ka(pde_t*, char*);
 int             allocuvm(pde_t*, uint, uint);
@@ -7,8 +7,13 @@
 #include "x86.h"
 #include "elf.h"
 
-int
-exec(char *path, char **argv)
+// Build a new address space running the program at path with
+// arguments argv, for p.  On success, point p's name and trapframe
+// at the new image, set *szp to its size and return its page
+// directory, which the caller installs; p->pgdir and p->sz are left
+// alone.  Returns 0 on failure.
+pde_t*
+loadimage(char *path, char **argv, struct proc *p, uint *szp)
 {
   char *s, *last;
   int i, off;
@@ -16,17 +21,16 @@ exec(char *path, char **argv)
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
-  pde_t *pgdir, *oldpgdir;
-  struct proc *curproc = myproc();
+  pde_t *pgdir;
 
   begin_op();
 
   if((ip = namei(path)) == 0){
     end_op();
     cprintf("exec: fail\n");
-    return -1;
+    return 0;
   }
-  ilock(ip);
+  ilockshared(ip);
   pgdir = 0;
 
   // Check ELF header
@@ -91,17 +95,12 @@ exec(char *path, char **argv)
   for(last=s=path; *s; s++)
     if(*s == '/')
       last = s+1;
-  safestrcpy(curproc->name, last, sizeof(curproc->name));
+  safestrcpy(p->name, last, sizeof(p->name));
 
-  // Commit to the user image.
-  oldpgdir = curproc->pgdir;
-  curproc->pgdir = pgdir;
-  curproc->sz = sz;
-  curproc->tf->eip = elf.entry;  // main
-  curproc->tf->esp = sp;
-  switchuvm(curproc);
-  freevm(oldpgdir);
-  return 0;
+  *szp = sz;
+  p->tf->eip = elf.entry;  // main
+  p->tf->esp = sp;
+  return pgdir;
 
  bad:
   if(pgdir)
@@ -110,5 +109,19 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
-  return -1;
+  return 0;
+}
+
+int
+exec(char *path, char **argv)
+{
+  pde_t *pgdir;
+  uint sz;
+
+  if((pgdir = loadimage(path, argv, myproc(), &sz)) == 0)
+    return -1;
+
+  // Commit to the user image.
+  setvm(pgdir, sz);
+  return 0;
 }
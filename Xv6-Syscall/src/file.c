@@ -5,21 +5,82 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
+#include "proc.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "uio.h"
+
+#define FCACHE 8  // free files a cpu keeps before giving them to the pool
 
 struct devsw devsw[NDEV];
-struct {
+
+// Free files are kept on lists instead of being found by scanning
+// the table.  Each cpu allocates from and frees to its own list,
+// going to the shared pool only when its list is empty or full,
+// and stealing from other cpus only when the pool is empty too, so
+// a cpu's lock is hardly ever contended.  Reference counts change
+// with atomic instructions: filedup, and fileclose unless it drops
+// the last reference, take no lock at all.
+struct flist {
   struct spinlock lock;
+  struct file *free;
+  int nfree;
+};
+
+struct {
+  struct flist pool;
+  struct flist cpu[NCPU];
   struct file file[NFILE];
 } ftable;
 
 void
 fileinit(void)
 {
-  initlock(&ftable.lock, "ftable");
+  struct file *f;
+  int i;
+
+  initlock(&ftable.pool.lock, "ftable");
+  for(i = 0; i < NCPU; i++)
+    initlock(&ftable.cpu[i].lock, "ftable.cpu");
+  for(f = ftable.file + NFILE - 1; f >= ftable.file; f--){
+    f->next = ftable.pool.free;
+    ftable.pool.free = f;
+  }
+  ftable.pool.nfree = NFILE;
+}
+
+// Take a file off l, or return 0 if l is empty.
+static struct file*
+take(struct flist *l)
+{
+  struct file *f;
+
+  acquire(&l->lock);
+  if((f = l->free) != 0){
+    l->free = f->next;
+    l->nfree--;
+  }
+  release(&l->lock);
+  return f;
+}
+
+// Put f on l, unless l already has max files.  Returns 0 if so.
+static int
+put(struct flist *l, struct file *f, int max)
+{
+  int ok;
+
+  acquire(&l->lock);
+  if((ok = l->nfree < max) != 0){
+    f->next = l->free;
+    l->free = f;
+    l->nfree++;
+  }
+  release(&l->lock);
+  return ok;
 }
 
 // Allocate a file structure.
@@ -27,28 +88,26 @@ struct file*
 filealloc(void)
 {
   struct file *f;
+  int i, id;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  pushcli();
+  id = cpuid();
+  if((f = take(&ftable.cpu[id])) == 0 && (f = take(&ftable.pool)) == 0)
+    for(i = 0; i < ncpu && f == 0; i++)
+      if(i != id)
+        f = take(&ftable.cpu[i]);
+  popcli();
+  if(f)
+    f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
 struct file*
 filedup(struct file *f)
 {
-  acquire(&ftable.lock);
-  if(f->ref < 1)
+  if(__sync_fetch_and_add(&f->ref, 1) < 1)
     panic("filedup");
-  f->ref++;
-  release(&ftable.lock);
   return f;
 }
 
@@ -57,18 +116,20 @@ void
 fileclose(struct file *f)
 {
   struct file ff;
+  int ref;
 
-  acquire(&ftable.lock);
-  if(f->ref < 1)
+  ref = __sync_fetch_and_sub(&f->ref, 1);
+  if(ref < 1)
     panic("fileclose");
-  if(--f->ref > 0){
-    release(&ftable.lock);
+  if(ref > 1)
     return;
-  }
+  // That was the last reference, so nothing else can be using f.
   ff = *f;
-  f->ref = 0;
   f->type = FD_NONE;
-  release(&ftable.lock);
+  pushcli();
+  if(!put(&ftable.cpu[cpuid()], f, FCACHE))
+    put(&ftable.pool, f, NFILE);
+  popcli();
 
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
@@ -84,7 +145,7 @@ int
 filestat(struct file *f, struct stat *st)
 {
   if(f->type == FD_INODE){
-    ilock(f->ip);
+    ilockshared(f->ip);
     stati(f->ip, st);
     iunlock(f->ip);
     return 0;
@@ -103,55 +164,165 @@ fileread(struct file *f, char *addr, int n)
   if(f->type == FD_PIPE)
     return piperead(f->pipe, addr, n);
   if(f->type == FD_INODE){
-    ilock(f->ip);
+    // f->off is only used with f->ip locked exclusively, so that
+    // readers sharing f take turns.  A file nothing else refers
+    // to can be read with the inode locked shared, alongside
+    // readers of the inode through other files.
+    if(f->ref > 1)
+      ilock(f->ip);
+    else
+      ilockshared(f->ip);
+    // A read that starts where the last one ended is sequential;
+    // queue its blocks and the next few before copying, so the
+    // disk keeps running while readi copies.
+    if(f->off == f->raoff && n > 0)
+      ireadahead(f->ip, f->off, n);
     if((r = readi(f->ip, addr, f->off, n)) > 0)
       f->off += r;
+    f->raoff = f->off;
     iunlock(f->ip);
     return r;
   }
   panic("fileread");
 }
 
+// Read n bytes at offset off of file f, leaving f->off alone.
+// Only files and devices have offsets.
+int
+filepread(struct file *f, char *addr, int n, uint off)
+{
+  int r;
+
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+  ilockshared(f->ip);
+  r = readi(f->ip, addr, off, n);
+  iunlock(f->ip);
+  return r;
+}
+
 //PAGEBREAK!
+// Write n bytes from addr to ip at *off, advancing *off.
+// *off is only used with ip locked, so writers sharing
+// it append one after another.
+static int
+iwrite(struct inode *ip, char *addr, int n, uint *off)
+{
+  int r;
+
+  // write as many blocks at a time as a transaction of
+  // FILEOPBLOCKS can hold, if the log has room for one:
+  // besides the data, the i-node, the double-indirect
+  // block, two indirect blocks and two bitmap blocks, and
+  // 1 block of slop for non-aligned writes.
+  // this really belongs lower down, since writei()
+  // might be writing a device like the console.
+  int i = 0;
+  while(i < n){
+    int nb = begin_opn(FILEOPBLOCKS);
+    int max = (nb-1-1-2-2-1) * BSIZE;
+    int n1 = n - i;
+    if(n1 > max)
+      n1 = max;
+
+    ilock(ip);
+    if ((r = writei(ip, addr + i, *off, n1)) > 0)
+      *off += r;
+    iunlock(ip);
+    end_opn(nb);
+
+    if(r < 0)
+      break;
+    if(r != n1)
+      panic("short filewrite");
+    i += r;
+  }
+  return i == n ? n : -1;
+}
+
 // Write to file f.
 int
 filewrite(struct file *f, char *addr, int n)
 {
-  int r;
-
   if(f->writable == 0)
     return -1;
   if(f->type == FD_PIPE)
     return pipewrite(f->pipe, addr, n);
-  if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
-
-      if(r < 0)
-        break;
-      if(r != n1)
-        panic("short filewrite");
-      i += r;
+  if(f->type == FD_INODE)
+    return iwrite(f->ip, addr, n, &f->off);
+  panic("filewrite");
+}
+
+// Write n bytes to file f at offset off, leaving f->off alone.
+int
+filepwrite(struct file *f, char *addr, int n, uint off)
+{
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+  return iwrite(f->ip, addr, n, &off);
+}
+
+// Move up to n bytes from in to out, which may each be a file,
+// a device or a pipe, stopping early at the end of in.  The data
+// goes through a kernel page, a page at a time, and never through
+// user memory.  Returns the number of bytes moved, or -1.
+int
+filesend(struct file *out, struct file *in, int n)
+{
+  char *buf;
+  int tot, m, r;
+
+  if(in->readable == 0 || out->writable == 0)
+    return -1;
+  if((buf = kalloc()) == 0)
+    return -1;
+  r = 0;
+  for(tot = 0; tot < n; tot += r){
+    m = n - tot;
+    if(m > PGSIZE)
+      m = PGSIZE;
+    if((r = fileread(in, buf, m)) <= 0)
+      break;
+    if(filewrite(out, buf, r) != r){
+      r = -1;
+      break;
     }
-    return i == n ? n : -1;
   }
-  panic("filewrite");
+  kfree(buf);
+  return r < 0 ? -1 : tot;
 }
 
+// Read from f into the cnt buffers of iov in turn, stopping at
+// the first that is not filled.  Returns the number of bytes
+// read, or -1 if nothing could be.
+int
+filereadv(struct file *f, struct iovec *iov, int cnt)
+{
+  int i, r, tot;
+
+  tot = 0;
+  for(i = 0; i < cnt; i++){
+    if((r = fileread(f, iov[i].base, iov[i].len)) < 0)
+      return tot > 0 ? tot : -1;
+    tot += r;
+    if(r < iov[i].len)
+      break;
+  }
+  return tot;
+}
+
+// Write the cnt buffers of iov to f in turn.  Returns the
+// number of bytes written, or -1 if nothing could be.
+int
+filewritev(struct file *f, struct iovec *iov, int cnt)
+{
+  int i, tot;
+
+  tot = 0;
+  for(i = 0; i < cnt; i++){
+    if(filewrite(f, iov[i].base, iov[i].len) != iov[i].len)
+      return tot > 0 ? tot : -1;
+    tot += iov[i].len;
+  }
+  return tot;
+}
@@ -6,6 +6,8 @@ struct file {
   struct pipe *pipe;
   struct inode *ip;
   uint off;
+  uint raoff; // where the last read ended, to spot sequential reads
+  struct file *next; // free list, while ref is 0
 };
 
 
@@ -14,6 +16,9 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext;  // icache hash chain
+  struct inode *lprev;  // icache LRU list, while ref is 0
+  struct inode *lnext;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -22,7 +27,15 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
+  uint lastblock;     // last block balloc() gave this inode
+  struct spinlock maplock;  // protects runbn..bufbn among shared holders
+  uint runbn;         // bmap() maps file blocks runbn..runbn+runlen-1
+  uint runaddr;       // to consecutive disk blocks from runaddr
+  uint runlen;
+  struct buf *bufs[NIBLOCK];  // recently read data blocks, pinned in
+  uint bufbn[NIBLOCK];        // the buffer cache: file block bufbn[i],
+                              // with bufbn[i] % NIBLOCK == i
 };
 
 // table mapping major device number to
@@ -38,43 +38,95 @@ readsb(int dev, struct superblock *sb)
   brelse(bp);
 }
 
-// Zero a block.
+// Zero a block, which holds file data if data is set.
 static void
-bzero(int dev, int bno)
+bzero(int dev, int bno, int data)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
+  bp = boverwrite(dev, bno);
   memset(bp->data, 0, BSIZE);
-  log_write(bp);
+  if(data)
+    log_write_data(bp);
+  else
+    log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Free bits in each bitmap block, or -1 until balloc first reads
+// that block.  An entry only changes while its bitmap block's
+// buffer is locked; elsewhere it is just a hint for skipping full
+// bitmap blocks without reading them.
+static int bfreecnt[FSSIZE/BPB + 1];
+
+// Where to look first for a file that has no blocks yet.
+static uint bhint;
+
+// Take the first free block at or after bit from in the bitmap
+// block covering blocks b..b+BPB-1.  Returns 0 if there is none.
 static uint
-balloc(uint dev)
+ballocin(uint dev, uint b, uint from)
 {
-  int b, bi, m;
   struct buf *bp;
+  uint *w;
+  int bi, m;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+  if(bfreecnt[b/BPB] == 0)
+    return 0;
+  bp = bread(dev, BBLOCK(b, sb));
+  if(bfreecnt[b/BPB] < 0){
+    bfreecnt[b/BPB] = 0;
+    for(bi = 0; bi < BPB && b + bi < sb.size; bi++)
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        bfreecnt[b/BPB]++;
+  }
+  // Block b+bi is bit bi%32 of the little-endian word w[bi/32],
+  // so a full word skips 32 blocks at once.
+  w = (uint*)bp->data;
+  for(bi = from; bfreecnt[b/BPB] > 0 && bi < BPB && b + bi < sb.size; bi++){
+    if(bi % 32 == 0 && w[bi/32] == 0xffffffff){
+      bi += 31;
+      continue;
+    }
+    m = 1 << (bi % 8);
+    if((bp->data[bi/8] & m) == 0){  // Is block free?
+      bp->data[bi/8] |= m;  // Mark block in use.
+      bfreecnt[b/BPB]--;
+      log_write(bp);
+      brelse(bp);
+      return b + bi;
     }
-    brelse(bp);
   }
-  panic("balloc: out of blocks");
+  brelse(bp);
+  return 0;
+}
+
+// Allocate a zeroed disk block for ip, whose lock must be held
+// exclusively, to hold its data if data is set, else an indirect
+// block.
+// The search starts just after the block last allocated to ip,
+// so a file written sequentially gets consecutive blocks.
+static uint
+balloc(struct inode *ip, int data)
+{
+  uint goal, b, addr;
+
+  goal = ip->lastblock ? ip->lastblock + 1 : bhint;
+  if(goal >= sb.size)
+    goal = 0;
+  addr = 0;
+  for(b = goal - goal % BPB; addr == 0 && b < sb.size; b += BPB)
+    addr = ballocin(ip->dev, b, b < goal ? goal % BPB : 0);
+  for(b = 0; addr == 0 && b <= goal; b += BPB)
+    addr = ballocin(ip->dev, b, 0);
+  if(addr == 0)
+    panic("balloc: out of blocks");
+  bzero(ip->dev, addr, data);
+  ip->lastblock = addr;
+  bhint = addr + 1;
+  return addr;
 }
 
 // Free a disk block.
@@ -84,12 +136,15 @@ bfree(int dev, uint b)
   struct buf *bp;
   int bi, m;
 
+  log_free(b);
   bp = bread(dev, BBLOCK(b, sb));
   bi = b % BPB;
   m = 1 << (bi % 8);
   if((bp->data[bi/8] & m) == 0)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
+  if(bfreecnt[b/BPB] >= 0)
+    bfreecnt[b/BPB]++;
   log_write(bp);
   brelse(bp);
 }
@@ -124,17 +179,23 @@ bfree(int dev, uint b)
 //   the number of in-memory pointers to the entry (open
 //   files and current directories). iget() finds or
 //   creates a cache entry and increments its ref; iput()
-//   decrements ref.
+//   decrements ref.  A free entry keeps its inode until
+//   iget() recycles it, least recently released first, so
+//   an inode used again soon is found without a disk read.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
-//   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   the disk and sets ip->valid, while iget() clears
+//   ip->valid when it recycles an entry and iput() clears
+//   it when it frees the inode.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
-//   has first locked the inode.
+//   has first locked the inode.  Code that only examines an
+//   inode and reads its content may lock it shared with
+//   ilockshared(), letting other such readers in at once; code
+//   that changes it must lock it exclusively with ilock().
 //
 // Thus a typical sequence is:
 //   ip = iget(dev, inum)
@@ -158,27 +219,199 @@ bfree(int dev, uint b)
 // entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
 // holds, one must hold icache.lock while using any of those fields.
+// It also protects the hash chains (hnext) that iget() searches
+// and the LRU list of free entries (lprev, lnext).
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+// Readers holding it shared still update the block run and the
+// pinned blocks that bmap() and readi() keep, so those change
+// under the ip->maplock spin-lock as well.
 
 struct {
   struct spinlock lock;
   struct inode inode[NINODE];
+  struct inode *hash[NIHASH];
+  struct inode lru;  // lru.lnext is the least recently released
 } icache;
 
+static struct inode**
+ihash(uint dev, uint inum)
+{
+  return &icache.hash[(dev * 31 + inum) % NIHASH];
+}
+
+// Put ip, whose ref has dropped to 0, at the recent end of the
+// LRU list.
+static void
+lruappend(struct inode *ip)
+{
+  ip->lprev = icache.lru.lprev;
+  ip->lnext = &icache.lru;
+  icache.lru.lprev->lnext = ip;
+  icache.lru.lprev = ip;
+}
+
+static void
+lruremove(struct inode *ip)
+{
+  ip->lprev->lnext = ip->lnext;
+  ip->lnext->lprev = ip->lprev;
+}
+
+// Let go of the data blocks readi() kept for ip.  The caller
+// must hold ip->lock, or icache.lock while ip->ref is 0.
+static void
+idropbufs(struct inode *ip)
+{
+  int i;
+
+  for(i = 0; i < NIBLOCK; i++){
+    if(ip->bufs[i]){
+      bunpin(ip->bufs[i]);
+      ip->bufs[i] = 0;
+    }
+  }
+}
+
+// Directory name cache.
+//
+// Remembers what dirlookup() found for (directory, name): the inode
+// number and offset of the entry, or inum 0 if there is no entry of
+// that name.  Entries are hashed into NDCACHE sets of DCACHEWAYS
+// and the least recently used one in a set is replaced.
+//
+// A directory's entries are only read and changed with the
+// directory locked, so the cache is kept right by updating it in
+// dirlink() and dirunlink() while the caller holds that lock.
+// When a directory inode is freed, iput() drops its names, since
+// the inode number may be reused by a new directory.
+struct dcentry {
+  uint dev;
+  uint dir;        // Inode number of the directory, 0 if unused
+  char name[DIRSIZ];
+  uint inum;       // 0: the directory has no entry called name
+  uint off;
+  uint used;       // For LRU replacement
+};
+
+struct {
+  struct spinlock lock;
+  uint clock;
+  struct dcentry set[NDCACHE][DCACHEWAYS];
+} dcache;
+
+static struct dcentry*
+dcacheset(uint dev, uint dir, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev*31 + dir;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h*31 + name[i];
+  return dcache.set[h % NDCACHE];
+}
+
+// Look for dp/name.  Returns 1 and sets *inum and *off if cached.
+static int
+dcachelookup(struct inode *dp, char *name, uint *inum, uint *off)
+{
+  struct dcentry *e;
+  int i;
+
+  acquire(&dcache.lock);
+  e = dcacheset(dp->dev, dp->inum, name);
+  for(i = 0; i < DCACHEWAYS; i++){
+    if(e[i].dir == dp->inum && e[i].dev == dp->dev &&
+       namecmp(e[i].name, name) == 0){
+      e[i].used = ++dcache.clock;
+      *inum = e[i].inum;
+      *off = e[i].off;
+      release(&dcache.lock);
+      return 1;
+    }
+  }
+  release(&dcache.lock);
+  return 0;
+}
+
+// Record that dp/name is inum at offset off, or absent if inum is 0.
+static void
+dcacheput(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dcentry *e, *victim;
+  int i;
+
+  acquire(&dcache.lock);
+  e = dcacheset(dp->dev, dp->inum, name);
+  victim = &e[0];
+  for(i = 0; i < DCACHEWAYS; i++){
+    if(e[i].dir == dp->inum && e[i].dev == dp->dev &&
+       namecmp(e[i].name, name) == 0){
+      victim = &e[i];
+      break;
+    }
+    if(victim->dir != 0 && (e[i].dir == 0 || e[i].used < victim->used))
+      victim = &e[i];
+  }
+  victim->dev = dp->dev;
+  victim->dir = dp->inum;
+  strncpy(victim->name, name, DIRSIZ);
+  victim->inum = inum;
+  victim->off = off;
+  victim->used = ++dcache.clock;
+  release(&dcache.lock);
+}
+
+// Note that dp/name, if cached, has moved to offset off.
+static void
+dcachemove(struct inode *dp, char *name, uint off)
+{
+  struct dcentry *e;
+  int i;
+
+  acquire(&dcache.lock);
+  e = dcacheset(dp->dev, dp->inum, name);
+  for(i = 0; i < DCACHEWAYS; i++)
+    if(e[i].dir == dp->inum && e[i].dev == dp->dev &&
+       namecmp(e[i].name, name) == 0)
+      e[i].off = off;
+  release(&dcache.lock);
+}
+
+// Forget every name in directory inum, which is being freed.
+static void
+dcachepurge(uint dev, uint inum)
+{
+  struct dcentry *e, *end;
+
+  end = &dcache.set[0][0] + NDCACHE*DCACHEWAYS;
+  acquire(&dcache.lock);
+  for(e = &dcache.set[0][0]; e < end; e++)
+    if(e->dir == inum && e->dev == dev)
+      e->dir = 0;
+  release(&dcache.lock);
+}
+
 void
 iinit(int dev)
 {
   int i = 0;
   
   initlock(&icache.lock, "icache");
+  initlock(&dcache.lock, "dcache");
+  icache.lru.lprev = icache.lru.lnext = &icache.lru;
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&icache.inode[i].lock, "inode");
+    initlock(&icache.inode[i].maplock, "inodemap");
+    lruappend(&icache.inode[i]);
   }
 
   readsb(dev, &sb);
+  for(i = 0; i < NELEM(bfreecnt); i++)
+    bfreecnt[i] = -1;
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
  inodestart %d bmap start %d\n", sb.size, sb.nblocks,
           sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
@@ -216,7 +449,7 @@ ialloc(uint dev, short type)
 // Copy a modified in-memory inode to disk.
 // Must be called after every change to an ip->xxx field
 // that lives on disk, since i-node cache is write-through.
-// Caller must hold ip->lock.
+// Caller must hold ip->lock exclusively.
 void
 iupdate(struct inode *ip)
 {
@@ -241,31 +474,38 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = *ihash(dev, inum); ip != 0; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        lruremove(ip);
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
+  // Recycle the least recently used free entry.
+  ip = icache.lru.lnext;
+  if(ip == &icache.lru)
     panic("iget: no inodes");
+  lruremove(ip);
+  idropbufs(ip);
+  if(ip->inum != 0){
+    for(pp = ihash(ip->dev, ip->inum); *pp != ip; pp = &(*pp)->hnext)
+      ;
+    *pp = ip->hnext;
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->hnext = *ihash(dev, inum);
+  *ihash(dev, inum) = ip;
   release(&icache.lock);
 
   return ip;
@@ -282,7 +522,7 @@ idup(struct inode *ip)
   return ip;
 }
 
-// Lock the given inode.
+// Lock the given inode exclusively.
 // Reads the inode from disk if necessary.
 void
 ilock(struct inode *ip)
@@ -305,20 +545,43 @@ ilock(struct inode *ip)
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->lastblock = 0;
+    ip->runlen = 0;
+    idropbufs(ip);
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
   }
 }
 
-// Unlock the given inode.
+// Lock the given inode shared, for reading it alongside other
+// readers.  An inode not yet read from disk is read with the
+// lock held exclusively, which is then downgraded.
+void
+ilockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilockshared");
+
+  acquiresleepshared(&ip->lock);
+  if(ip->valid)
+    return;
+  releasesleepshared(&ip->lock);
+  ilock(ip);
+  downgradesleep(&ip->lock);
+}
+
+// Unlock the given inode, locked either way.
 void
 iunlock(struct inode *ip)
 {
-  if(ip == 0 || !holdingsleep(&ip->lock) || ip->ref < 1)
+  if(ip == 0 || ip->ref < 1)
     panic("iunlock");
 
-  releasesleep(&ip->lock);
+  if(holdingsleep(&ip->lock))
+    releasesleep(&ip->lock);
+  else
+    releasesleepshared(&ip->lock);
 }
 
 // Drop a reference to an in-memory inode.
@@ -338,6 +601,8 @@ iput(struct inode *ip)
     release(&icache.lock);
     if(r == 1){
       // inode has no links and no other references: truncate and free.
+      if(ip->type == T_DIR)
+        dcachepurge(ip->dev, ip->inum);
       itrunc(ip);
       ip->type = 0;
       iupdate(ip);
@@ -347,7 +612,8 @@ iput(struct inode *ip)
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  if(--ip->ref == 0)
+    lruappend(ip);
   release(&icache.lock);
 }
 
@@ -367,17 +633,55 @@ iunlockput(struct inode *ip)
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
 // listed in block ip->addrs[NDIRECT].
 
+// Remember that file block bn maps to a[i], together with the
+// following entries of a[0..n-1] that map to consecutive disk
+// blocks, so that bmap can translate the rest of the run without
+// reading the map again.
+static void
+bmaprun(struct inode *ip, uint bn, uint *a, uint i, uint n)
+{
+  uint len;
+
+  for(len = 1; i + len < n && a[i+len] == a[i] + len; len++)
+    ;
+  acquire(&ip->maplock);
+  ip->runbn = bn;
+  ip->runaddr = a[i];
+  ip->runlen = len;
+  release(&ip->maplock);
+}
+
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
+// The first NDIRECT blocks are listed in the inode, the next
+// NINDIRECT in the indirect block, and the rest in blocks listed
+// by the double-indirect block.
+// Readers holding ip->lock shared only map blocks below
+// ip->size, which are all allocated, so only holders of the
+// exclusive lock get to balloc().
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
+  uint addr, *a, fbn;
   struct buf *bp;
+  int data;
+
+  // Most lookups of a sequentially accessed file hit the last run.
+  // Runs only cover mapped blocks, which stay put until itrunc().
+  acquire(&ip->maplock);
+  if(bn - ip->runbn < ip->runlen){
+    addr = ip->runaddr + (bn - ip->runbn);
+    release(&ip->maplock);
+    return addr;
+  }
+  release(&ip->maplock);
+  fbn = bn;
+  data = ip->type == T_FILE;  // directory blocks are logged
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = balloc(ip, data);
+    bmaprun(ip, fbn, ip->addrs, bn, NDIRECT);
     return addr;
   }
   bn -= NDIRECT;
@@ -385,13 +689,38 @@ bmap(struct inode *ip, uint bn)
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+      ip->addrs[NDIRECT] = addr = balloc(ip, 0);
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+      a[bn] = addr = balloc(ip, data);
+      log_write(bp);
+    }
+    bmaprun(ip, fbn, a, bn, NINDIRECT);
+    brelse(bp);
+    return addr;
+  }
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    // Load the double-indirect block, then the indirect block
+    // it lists for bn, allocating either if necessary.
+    if((addr = ip->addrs[NDIRECT+1]) == 0)
+      ip->addrs[NDIRECT+1] = addr = balloc(ip, 0);
+    bp = bread(ip->dev, addr);
+    a = (uint*)bp->data;
+    if((addr = a[bn / NINDIRECT]) == 0){
+      a[bn / NINDIRECT] = addr = balloc(ip, 0);
+      log_write(bp);
+    }
+    brelse(bp);
+    bp = bread(ip->dev, addr);
+    a = (uint*)bp->data;
+    if((addr = a[bn % NINDIRECT]) == 0){
+      a[bn % NINDIRECT] = addr = balloc(ip, data);
       log_write(bp);
     }
+    bmaprun(ip, fbn, a, bn % NINDIRECT, NINDIRECT);
     brelse(bp);
     return addr;
   }
@@ -399,11 +728,56 @@ bmap(struct inode *ip, uint bn)
   panic("bmap: out of range");
 }
 
+// Free the indirect block addr and the blocks it lists.
+static void
+bfreeindirect(uint dev, uint addr)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j])
+      bfree(dev, a[j]);
+  }
+  brelse(bp);
+  bfree(dev, addr);
+}
+
+// Does ip keep its data in ip->addrs[] rather than in blocks?
+static int
+iinline(struct inode *ip)
+{
+  return ip->type == T_FILE && ip->size <= NINLINE;
+}
+
+// Move the data of inline file ip to a block of its own, before
+// it grows past NINLINE bytes.  Caller must hold ip->lock
+// exclusively.
+static void
+ispill(struct inode *ip)
+{
+  char data[NINLINE];
+  struct buf *bp;
+
+  memmove(data, ip->addrs, ip->size);
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+  if(ip->size == 0)
+    return;
+  bp = bread(ip->dev, bmap(ip, 0));  // balloc() left it cached
+  memmove(bp->data, data, ip->size);
+  log_write_data(bp);
+  brelse(bp);
+}
+
 // Truncate inode (discard contents).
 // Only called when the inode has no links
 // to it (no directory entries referring to it)
 // and has no in-memory reference to it (is
 // not an open file or current directory).
+// Caller must hold ip->lock exclusively.
 static void
 itrunc(struct inode *ip)
 {
@@ -411,6 +785,14 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  ip->runlen = 0;
+  idropbufs(ip);
+  if(iinline(ip)){
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -419,15 +801,20 @@ itrunc(struct inode *ip)
   }
 
   if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
+    bfreeindirect(ip->dev, ip->addrs[NDIRECT]);
+    ip->addrs[NDIRECT] = 0;
+  }
+
+  if(ip->addrs[NDIRECT+1]){
+    bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
     a = (uint*)bp->data;
     for(j = 0; j < NINDIRECT; j++){
       if(a[j])
-        bfree(ip->dev, a[j]);
+        bfreeindirect(ip->dev, a[j]);
     }
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+    bfree(ip->dev, ip->addrs[NDIRECT+1]);
+    ip->addrs[NDIRECT+1] = 0;
   }
 
   ip->size = 0;
@@ -435,7 +822,7 @@ itrunc(struct inode *ip)
 }
 
 // Copy stat information from inode.
-// Caller must hold ip->lock.
+// Caller must hold ip->lock, shared or exclusively.
 void
 stati(struct inode *ip, struct stat *st)
 {
@@ -446,9 +833,45 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Return file block bn of ip locked, for readi() to copy from
+// and brelse().  The last NIBLOCK blocks read through here stay
+// referenced from ip, so reading them again takes neither bmap()
+// nor a buffer cache lookup, and they cannot be evicted.  Other
+// readers may replace a slot while the caller copies, so the
+// caller gets a reference of its own.  Caller must hold
+// ip->lock, shared or exclusively.
+static struct buf*
+ibread(struct inode *ip, uint bn)
+{
+  struct buf *b, *old;
+  uint i;
+
+  i = bn % NIBLOCK;
+  acquire(&ip->maplock);
+  if((b = ip->bufs[i]) != 0 && ip->bufbn[i] == bn){
+    bpin(b);
+    release(&ip->maplock);
+    acquiresleep(&b->lock);
+    return b;
+  }
+  release(&ip->maplock);
+
+  b = bread(ip->dev, bmap(ip, bn));
+  acquire(&ip->maplock);
+  if((old = ip->bufs[i]) != b){
+    bpin(b);
+    ip->bufs[i] = b;
+  }
+  ip->bufbn[i] = bn;
+  release(&ip->maplock);
+  if(old && old != b)
+    bunpin(old);
+  return b;
+}
+
 //PAGEBREAK!
 // Read data from inode.
-// Caller must hold ip->lock.
+// Caller must hold ip->lock, shared or exclusively.
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
@@ -465,9 +888,13 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     return -1;
   if(off + n > ip->size)
     n = ip->size - off;
+  if(iinline(ip)){
+    memmove(dst, (char*)ip->addrs + off, n);
+    return n;
+  }
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    bp = ibread(ip, off/BSIZE);
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(dst, bp->data + off%BSIZE, m);
     brelse(bp);
@@ -475,9 +902,27 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   return n;
 }
 
+// Start reading the blocks of ip that hold the n bytes at off,
+// and the NREADAHEAD blocks after them, without waiting, so a
+// following readi finds them cached or already on their way.
+// Caller must hold ip->lock, shared or exclusively.
+void
+ireadahead(struct inode *ip, uint off, uint n)
+{
+  uint bn, end;
+
+  if(ip->type == T_DEV || iinline(ip) || off >= ip->size)
+    return;
+  end = (off + n + BSIZE - 1) / BSIZE + NREADAHEAD;
+  if(end > (ip->size + BSIZE - 1) / BSIZE)
+    end = (ip->size + BSIZE - 1) / BSIZE;
+  for(bn = off / BSIZE; bn < end; bn++)
+    bprefetch(ip->dev, bmap(ip, bn));
+}
+
 // PAGEBREAK!
 // Write data to inode.
-// Caller must hold ip->lock.
+// Caller must hold ip->lock exclusively.
 int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
@@ -492,14 +937,32 @@ writei(struct inode *ip, char *src, uint off, uint n)
 
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if((unsigned long long)off + n > (unsigned long long)MAXFILE*BSIZE)
     return -1;
+  if(iinline(ip)){
+    if(off + n <= NINLINE){
+      memmove((char*)ip->addrs + off, src, n);
+      if(off + n > ip->size)
+        ip->size = off + n;
+      if(n > 0)
+        iupdate(ip);
+      return n;
+    }
+    ispill(ip);
+  }
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
+    // A block written whole need not be read first.
+    if(m == BSIZE)
+      bp = boverwrite(ip->dev, bmap(ip, off/BSIZE));
+    else
+      bp = bread(ip->dev, bmap(ip, off/BSIZE));
     memmove(bp->data + off%BSIZE, src, m);
-    log_write(bp);
+    if(ip->type == T_FILE)
+      log_write_data(bp);
+    else
+      log_write(bp);
     brelse(bp);
   }
 
@@ -519,17 +982,117 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Dirents per directory block.
+#define DPB (BSIZE / sizeof(struct dirent))
+
+// Hash of a name, for hashed directories.
+static uint
+dirhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;  // FNV-1a
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+// Look up hash h in the index that block bn of hashed directory
+// dp holds from slot first on.  Sets *child to the block named by
+// the last entry whose hash is at most h and returns its slot.
+// Caller must hold dp->lock, shared or exclusively.
+static int
+dirindex(struct inode *dp, uint bn, int first, uint h, uint *child)
+{
+  struct dirindex *x;
+  struct buf *bp;
+  int i, slot;
+
+  bp = ibread(dp, bn);
+  x = (struct dirindex*)bp->data;
+  slot = first;
+  for(i = first+1; i < DPB && x[i].bn != 0 && x[i].hash <= h; i++)
+    slot = i;
+  *child = x[slot].bn;
+  brelse(bp);
+  if(*child == 0 || *child >= dp->size / BSIZE)
+    panic("dirindex");
+  return slot;
+}
+
+// Find the block of hashed directory dp that holds names hashing
+// to h.  Block 0 indexes the index blocks, and they index the
+// blocks of names.  Sets *rslot to the index block's slot in
+// block 0, *ib to it, and *islot to the name block's slot in it.
+static uint
+dirleaf(struct inode *dp, uint h, int *rslot, uint *ib, int *islot)
+{
+  uint bn;
+
+  *rslot = dirindex(dp, 0, 2, h, ib);
+  *islot = dirindex(dp, *ib, 0, h, &bn);
+  return bn;
+}
+
+// Look for name in block bn of directory dp.  Returns its inode
+// number and sets *poff, or returns 0 if it is not there.
+static uint
+dirscan(struct inode *dp, uint bn, char *name, uint *poff)
+{
+  struct dirent *de;
+  struct buf *bp;
+  uint i, inum;
+
+  bp = ibread(dp, bn);
+  de = (struct dirent*)bp->data;
+  inum = 0;
+  for(i = 0; i < DPB; i++){
+    if(de[i].inum != 0 && namecmp(name, de[i].name) == 0){
+      inum = de[i].inum;
+      *poff = bn*BSIZE + i*sizeof(*de);
+      break;
+    }
+  }
+  brelse(bp);
+  return inum;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// Caller must hold dp->lock, shared or exclusively.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
+  uint off, inum, bn, ib;
   struct dirent de;
+  int rslot, islot;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  if(dcachelookup(dp, name, &inum, &off)){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+
+  // "." and ".." lead a hashed directory too.
+  if(dp->major == DIRHASH && namecmp(name, ".") != 0 &&
+     namecmp(name, "..") != 0){
+    bn = dirleaf(dp, dirhash(name), &rslot, &ib, &islot);
+    if((inum = dirscan(dp, bn, name, &off)) != 0){
+      if(poff)
+        *poff = off;
+      dcacheput(dp, name, inum, off);
+      return iget(dp->dev, inum);
+    }
+    dcacheput(dp, name, 0, 0);
+    return 0;
+  }
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -540,14 +1103,227 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dcacheput(dp, name, inum, off);
       return iget(dp->dev, inum);
     }
   }
 
+  dcacheput(dp, name, 0, 0);
+  return 0;
+}
+
+// Find a free dirent in block bn of directory dp.  Returns its
+// offset, or -1 if the block is full.
+static int
+dirfree(struct inode *dp, uint bn)
+{
+  struct dirent *de;
+  struct buf *bp;
+  int i, off;
+
+  bp = ibread(dp, bn);
+  de = (struct dirent*)bp->data;
+  off = -1;
+  for(i = 0; i < DPB; i++){
+    if(de[i].inum == 0){
+      off = bn*BSIZE + i*sizeof(*de);
+      break;
+    }
+  }
+  brelse(bp);
+  return off;
+}
+
+// Is the index in block bn of hashed directory dp full?
+static int
+dirindexfull(struct inode *dp, uint bn)
+{
+  struct dirindex *x;
+  struct buf *bp;
+  int full;
+
+  bp = ibread(dp, bn);
+  x = (struct dirindex*)bp->data;
+  full = x[DPB-1].bn != 0;
+  brelse(bp);
+  return full;
+}
+
+// Add an entry for block child, holding hashes from h on, to the
+// index in block bn of hashed directory dp, after slot slot.  The
+// index must not be full.
+static void
+dirindexadd(struct inode *dp, uint bn, int slot, uint h, uint child)
+{
+  struct dirindex *x;
+  struct buf *bp;
+  int i;
+
+  bp = ibread(dp, bn);
+  x = (struct dirindex*)bp->data;
+  for(i = DPB-1; i > slot+1; i--)
+    x[i] = x[i-1];
+  memset(&x[slot+1], 0, sizeof(x[slot+1]));
+  x[slot+1].hash = h;
+  x[slot+1].bn = child;
+  log_write(bp);
+  brelse(bp);
+}
+
+// Append the block at page to directory dp and return its number.
+static uint
+dirappend(struct inode *dp, char *page)
+{
+  uint bn;
+
+  bn = dp->size / BSIZE;
+  if(writei(dp, page, bn*BSIZE, BSIZE) != BSIZE)
+    panic("dirappend");
+  return bn;
+}
+
+// Make dp, a linear directory whose one block is full, hashed:
+// its entries but "." and ".." move to a new block 1, and a new
+// index block 2 lists that for every hash.  Returns -1 if it
+// cannot.  Caller must hold dp->lock exclusively.
+static int
+dirhashinit(struct inode *dp)
+{
+  struct dirent *de, *nde;
+  struct dirindex *x;
+  struct buf *bp;
+  char *page;
+  int i;
+
+  if((page = kalloc()) == 0)
+    return -1;
+  bp = ibread(dp, 0);
+  de = (struct dirent*)bp->data;
+  if(namecmp(de[0].name, ".") != 0 || namecmp(de[1].name, "..") != 0){
+    brelse(bp);
+    kfree(page);
+    return -1;
+  }
+  memset(page, 0, BSIZE);
+  nde = (struct dirent*)page;
+  for(i = 2; i < DPB; i++){
+    nde[i] = de[i];
+    if(de[i].inum != 0)
+      dcachemove(dp, de[i].name, BSIZE + i*sizeof(*de));
+  }
+  memset(&de[2], 0, (DPB-2)*sizeof(*de));
+  x = (struct dirindex*)bp->data;
+  x[2].hash = 0;
+  x[2].bn = 2;
+  log_write(bp);
+  brelse(bp);
+  dirappend(dp, page);
+
+  memset(page, 0, BSIZE);
+  x = (struct dirindex*)page;
+  x[0].hash = 0;
+  x[0].bn = 1;
+  dirappend(dp, page);
+  kfree(page);
+
+  dp->major = DIRHASH;
+  iupdate(dp);
+  return 0;
+}
+
+// Split full name block bn of hashed directory dp, found with
+// dirleaf(): the entries in the upper half of its range of hashes
+// move to a new block at the end of dp.  A full index block is
+// split in two the same way first.  Returns -1 if it cannot,
+// because block 0 is full too or the names all hash alike.
+// Caller must hold dp->lock exclusively.
+static int
+dirsplit(struct inode *dp, int rslot, uint ib, int islot, uint bn)
+{
+  struct dirent *de, *nde;
+  struct dirindex *x;
+  struct buf *bp;
+  uint h, lo, hi, mid, nbn;
+  char *page;
+  int i, j, n;
+
+  if(dirindexfull(dp, ib) && dirindexfull(dp, 0))
+    return -1;
+  bp = ibread(dp, bn);
+  de = (struct dirent*)bp->data;
+  lo = hi = dirhash(de[0].name);
+  for(i = 1; i < DPB; i++){
+    h = dirhash(de[i].name);
+    if(h < lo)
+      lo = h;
+    if(h > hi)
+      hi = h;
+  }
+  brelse(bp);
+  if(lo == hi || (page = kalloc()) == 0)
+    return -1;
+  mid = lo + (hi - lo)/2 + 1;
+
+  if(dirindexfull(dp, ib)){
+    bp = ibread(dp, ib);
+    x = (struct dirindex*)bp->data;
+    n = DPB/2;
+    memset(page, 0, BSIZE);
+    memmove(page, &x[n], (DPB-n)*sizeof(*x));
+    memset(&x[n], 0, (DPB-n)*sizeof(*x));
+    log_write(bp);
+    brelse(bp);
+    x = (struct dirindex*)page;
+    dirindexadd(dp, 0, rslot, x[0].hash, dirappend(dp, page));
+    dirleaf(dp, lo, &rslot, &ib, &islot);
+  }
+
+  bp = ibread(dp, bn);
+  de = (struct dirent*)bp->data;
+  nbn = dp->size / BSIZE;
+  memset(page, 0, BSIZE);
+  nde = (struct dirent*)page;
+  for(i = j = 0; i < DPB; i++){
+    if(dirhash(de[i].name) >= mid){
+      nde[j] = de[i];
+      dcachemove(dp, de[i].name, nbn*BSIZE + j*sizeof(*de));
+      memset(&de[i], 0, sizeof(*de));
+      j++;
+    }
+  }
+  log_write(bp);
+  brelse(bp);
+  dirappend(dp, page);
+  kfree(page);
+  dirindexadd(dp, ib, islot, mid, nbn);
   return 0;
 }
 
+// Find a free dirent for name in hashed directory dp, splitting
+// the block it hashes to if that is full.  Returns its offset,
+// or -1 if the block cannot be split, in which case dp is made
+// linear.  Caller must hold dp->lock exclusively.
+static int
+dirhashslot(struct inode *dp, char *name)
+{
+  uint h, ib, bn;
+  int rslot, islot, off;
+
+  h = dirhash(name);
+  bn = dirleaf(dp, h, &rslot, &ib, &islot);
+  if((off = dirfree(dp, bn)) >= 0)
+    return off;
+  if(dirsplit(dp, rslot, ib, islot, bn) < 0){
+    dp->major = 0;
+    iupdate(dp);
+    return -1;
+  }
+  bn = dirleaf(dp, h, &rslot, &ib, &islot);
+  return dirfree(dp, bn);
+}
+
 // Write a new directory entry (name, inum) into the directory dp.
+// Caller must hold dp->lock exclusively.
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
@@ -561,22 +1337,44 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  off = -1;
+  if(dp->major == DIRHASH)
+    off = dirhashslot(dp, name);
+  if(off < 0){
+    // Look for an empty dirent.
+    for(off = 0; off < dp->size; off += sizeof(de)){
+      if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+        panic("dirlink read");
+      if(de.inum == 0)
+        break;
+    }
+    // A directory outgrowing its first block becomes hashed.
+    if(off == BSIZE && dp->size == BSIZE && dirhashinit(dp) == 0)
+      off = dirhashslot(dp, name);
   }
 
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dcacheput(dp, name, inum, off);
 
   return 0;
 }
 
+// Remove the entry for name, found by dirlookup() at off, from
+// the directory dp.
+void
+dirunlink(struct inode *dp, char *name, uint off)
+{
+  struct dirent de;
+
+  memset(&de, 0, sizeof(de));
+  if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+    panic("unlink: writei");
+  dcacheput(dp, name, 0, 0);
+}
+
 //PAGEBREAK!
 // Paths
 
@@ -632,7 +1430,7 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    ilockshared(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
       return 0;
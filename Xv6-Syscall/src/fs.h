@@ -3,7 +3,11 @@
 
 
 #define ROOTINO 1  // root i-number
-#define BSIZE 512  // block size
+// Block size, a multiple of the 512-byte sector no larger than a
+// page; build with make BSIZE=4096 for 4KB blocks.
+#ifndef BSIZE
+#define BSIZE 512
+#endif
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
@@ -21,20 +25,27 @@ struct superblock {
   uint bmapstart;    // Block number of first free map block
 };
 
-#define NDIRECT 12
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
 
 // On-disk inode structure
 struct dinode {
   short type;           // File type
-  short major;          // Major device number (T_DEV only)
+  short major;          // Major device number (T_DEV only),
+                        // or DIRHASH for a hashed directory
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses, then the
+                           // indirect and double-indirect blocks
 };
 
+// A regular file of at most NINLINE bytes keeps them in addrs[]
+// itself and has no blocks.
+#define NINLINE ((NDIRECT+2)*sizeof(uint))
+
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
 
@@ -55,3 +66,20 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// A directory that outgrows one block is hashed, with major set
+// to DIRHASH.  Its first block holds "." and "..", then an index
+// of the blocks after it, each of which holds the entries whose
+// names hash from its index entry's hash up to the next one's.
+// An index entry takes the place of a dirent with inum 0, so the
+// directory still reads as plain dirents, and clearing major
+// makes it a linear directory again.
+#define DIRHASH 1
+
+struct dirindex {
+  ushort inum;   // Always 0
+  ushort pad;
+  uint hash;     // Least hash of the names in block bn
+  uint bn;       // Directory block; 0 past the last index entry
+  uint pad2;
+};
+
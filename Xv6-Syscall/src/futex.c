@@ -0,0 +1,113 @@
+// Futexes: waiting on, and waking, a word of user memory.
+//
+// A user lock takes and drops the lock with atomic instructions
+// alone, and only calls futexwait when it must block, and
+// futexwake when someone may be blocked.  Waiters queue on a hash
+// bucket chosen by the kernel address of the word, so threads
+// naming the word by the same user address, or processes sharing
+// the page, find each other.  Each waiter sleeps on its own queue
+// entry, so that futexwake can wake exactly n of them.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+
+#define NFUTEXHASH 31
+
+struct fwaiter {
+  int *key;               // Kernel address of the word
+  int woken;
+  struct fwaiter *next;
+};
+
+static struct {
+  struct spinlock lock;
+  struct fwaiter *head;
+} futexes[NFUTEXHASH];
+
+void
+futexinit(void)
+{
+  int i;
+
+  for(i = 0; i < NFUTEXHASH; i++)
+    initlock(&futexes[i].lock, "futex");
+}
+
+// The kernel address of the word at user address addr, which the
+// caller has checked is in its memory.
+static int*
+futexkey(char *addr)
+{
+  char *page;
+
+  if((page = uva2ka(myproc()->pgdir, addr)) == 0)
+    return 0;
+  return (int*)(page + ((uint)addr & (PGSIZE-1)));
+}
+
+// If the word at addr still holds val, sleep until futexwake wakes
+// this process; waiters are woken in the order they came.  Returns
+// 0 once woken, -1 if the word had changed or the process was
+// killed.
+int
+futexwait(char *addr, int val)
+{
+  struct fwaiter w, **pp;
+  int *key, h;
+
+  if((key = futexkey(addr)) == 0)
+    return -1;
+  h = (uint)key % NFUTEXHASH;
+
+  // The check and the queueing happen under the bucket lock, which
+  // futexwake takes too, so a wake after the word changes is not
+  // missed.
+  acquire(&futexes[h].lock);
+  if(*(volatile int*)key != val){
+    release(&futexes[h].lock);
+    return -1;
+  }
+  w.key = key;
+  w.woken = 0;
+  w.next = 0;
+  for(pp = &futexes[h].head; *pp; pp = &(*pp)->next)
+    ;
+  *pp = &w;
+  while(!w.woken && !myproc()->killed)
+    sleep(&w, &futexes[h].lock);
+  for(pp = &futexes[h].head; *pp != &w; pp = &(*pp)->next)
+    ;
+  *pp = w.next;
+  release(&futexes[h].lock);
+  return w.woken ? 0 : -1;
+}
+
+// Wake up to n processes waiting on the word at addr.
+// Returns the number woken.
+int
+futexwake(char *addr, int n)
+{
+  struct fwaiter *w;
+  int *key, h, woken;
+
+  if((key = futexkey(addr)) == 0)
+    return -1;
+  h = (uint)key % NFUTEXHASH;
+
+  woken = 0;
+  acquire(&futexes[h].lock);
+  for(w = futexes[h].head; w && woken < n; w = w->next){
+    if(w->key == key && !w->woken){
+      w->woken = 1;
+      wakeup(w);
+      woken++;
+    }
+  }
+  release(&futexes[h].lock);
+  return woken;
+}
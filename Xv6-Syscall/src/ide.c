@@ -1,4 +1,22 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// Simple IDE driver code.
+//
+// Transfers use bus-master DMA when the PCI IDE controller
+// supports it, and PIO otherwise.  With DMA, runs of queued
+// requests for consecutive blocks in the same direction go to
+// the disk as one command, one PRD entry per buffer.
+//
+// Disks 0 and 1 are the master and slave on the primary channel.
+// If a disk 2 is the master on the secondary channel, disk 1 is
+// striped over disks 1 and 2: even blocks on disk 1, odd blocks on
+// disk 2.  The channels have their own registers, interrupts, DMA
+// engines and queues, so a run of blocks reads or writes on both
+// disks at once.
+//
+// Requests come in through per-CPU submission rings, so CPUs queue
+// I/O without taking the channel lock while the disk is busy.  The
+// interrupt handler moves ring entries into the elevator queue in
+// one pass when a command finishes; a submitter rings the doorbell
+// (takes the lock and starts the disk) only when the channel is idle.
 
 #include "types.h"
 #include "defs.h"
@@ -23,38 +41,117 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
+#define IDE_CMD_SETMUL 0xc6
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
-// You must hold idelock while manipulating queue.
+#define IDE_MAXMULT   16     // most sectors per PIO block transfer
 
-static struct spinlock idelock;
-static struct buf *idequeue;
+// Bus master registers, offsets from the controller's BAR4.
+#define BM_CMD        0      // command: start, direction
+#define BM_STATUS     2      // status: error, interrupt
+#define BM_PRDT       4      // physical address of the PRD table
+#define BM_CMD_START  0x01
+#define BM_CMD_READ   0x08   // device to memory
+#define BM_ST_ERR     0x02
+#define BM_ST_INTR    0x04
+
+#define PCI_ADDR      0xcf8
+#define PCI_DATA      0xcfc
+
+#define IDE_MAXMERGE  32     // most buffers in one DMA command
+
+// Physical region descriptor: one buffer of a DMA transfer.
+struct prd {
+  uint addr;    // physical address
+  ushort len;   // bytes
+  ushort flags; // 0x8000 marks the last entry
+};
+
+#define NCHAN         2      // primary and secondary channel
+#define IDE_RING      32     // bufs a CPU can submit before the rings are drained; a power of 2
+
+// Submission ring of one CPU for one channel.  The CPU is the only
+// producer and advances head with interrupts off; the holder of
+// the channel lock is the only consumer and advances tail.
+struct ring {
+  struct buf *slot[IDE_RING];
+  uint head;
+  uint tail;
+};
+
+// One IDE channel.  queue points to the buf now being
+// read/written to the disk.  queue->qnext points to the next buf
+// to be processed; the pending bufs are kept in elevator order
+// (see idequeue_insert).  You must hold lock while manipulating
+// queue.  Bufs submitted but not yet in queue wait in ring.
+struct channel {
+  struct spinlock lock;
+  struct buf *queue;
+  int batch;          // number of queued bufs the disk is working on, 0 if idle
+  struct ring ring[NCPU];
+  ushort port;        // command block registers
+  ushort ctl;         // device control register
+  ushort dma;         // bus master registers, 0 if PIO only
+  struct prd *prdt;
+};
+
+static struct channel chans[NCHAN];
 
 static int havedisk1;
-static void idestart(struct buf*);
+static int striped;     // disk 1 is striped over disks 1 and 2
+static void idestart(struct channel*, struct buf*);
+static void idedmainit(void);
+static void idedrain(struct channel*);
 
-// Wait for IDE disk to become ready.
+// One page, so no table crosses a 64KB boundary.
+static struct prd prdt[NCHAN][IDE_MAXMERGE] __attribute__((aligned(PGSIZE)));
+
+// Wait for the selected disk on c to become ready.
 static int
-idewait(int checkerr)
+idewait(struct channel *c, int checkerr)
 {
   int r;
 
-  while(((r = inb(0x1f7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
+  while(((r = inb(c->port+7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
     ;
   if(checkerr && (r & (IDE_DF|IDE_ERR)) != 0)
     return -1;
   return 0;
 }
 
+// Tell the selected disk on c how many sectors a READ/WRITE
+// MULTIPLE moves at once, so a block goes in one PIO transfer.
+static void
+idesetmul(struct channel *c)
+{
+  if(BSIZE > SECTOR_SIZE){
+    if(BSIZE/SECTOR_SIZE > IDE_MAXMULT)
+      panic("ideinit: BSIZE");
+    outb(c->port+2, BSIZE/SECTOR_SIZE);
+    outb(c->port+7, IDE_CMD_SETMUL);
+    idewait(c, 0);
+  }
+}
+
 void
 ideinit(void)
 {
-  int i;
+  struct channel *c;
+  int i, r;
 
-  initlock(&idelock, "ide");
+  for(i = 0; i < NCHAN; i++){
+    initlock(&chans[i].lock, "ide");
+    chans[i].prdt = prdt[i];
+  }
+  chans[0].port = 0x1f0;
+  chans[0].ctl = 0x3f6;
+  chans[1].port = 0x170;
+  chans[1].ctl = 0x376;
+
+  c = &chans[0];
   ioapicenable(IRQ_IDE, ncpu - 1);
-  idewait(0);
+  idewait(c, 0);
 
   // Check if disk 1 is present
   outb(0x1f6, 0xe0 | (1<<4));
@@ -65,69 +162,320 @@ ideinit(void)
     }
   }
 
+  for(i = 0; i <= havedisk1; i++){
+    outb(0x1f6, 0xe0 | (i<<4));
+    idesetmul(c);
+  }
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
+
+  // Check if disk 2 is present.  A channel with no disks on it
+  // reads back all ones.
+  if(havedisk1){
+    c = &chans[1];
+    outb(c->port+6, 0xe0 | (0<<4));
+    for(i=0; i<1000; i++){
+      r = inb(c->port+7);
+      if(r != 0 && r != 0xff){
+        striped = 1;
+        break;
+      }
+    }
+  }
+  if(striped){
+    ioapicenable(IRQ_IDE+1, ncpu - 1);
+    idewait(c, 0);
+    idesetmul(c);
+    cprintf("ide: disk 1 striped over disks 1 and 2\n");
+  }
+
+  idedmainit();
+}
+
+static uint
+pciread(uint bus, uint dev, uint func, uint reg)
+{
+  outl(PCI_ADDR, 0x80000000 | bus<<16 | dev<<11 | func<<8 | (reg & 0xfc));
+  return inl(PCI_DATA);
+}
+
+static void
+pciwrite(uint bus, uint dev, uint func, uint reg, uint data)
+{
+  outl(PCI_ADDR, 0x80000000 | bus<<16 | dev<<11 | func<<8 | (reg & 0xfc));
+  outl(PCI_DATA, data);
+}
+
+// Find a bus-master capable IDE controller on PCI bus 0 and
+// enable DMA through it.  Without one, the channels' dma stays 0
+// and all transfers use PIO.
+static void
+idedmainit(void)
+{
+  uint dev, func, class, bar;
+
+  for(dev = 0; dev < 32; dev++){
+    for(func = 0; func < 8; func++){
+      if((pciread(0, dev, func, 0) & 0xffff) == 0xffff)
+        continue;
+      // Class 01 (storage), subclass 01 (IDE), prog-if bit 7 (bus master).
+      class = pciread(0, dev, func, 0x08);
+      if((class >> 16) != 0x0101 || (class & 0x8000) == 0)
+        continue;
+      bar = pciread(0, dev, func, 0x20);
+      if((bar & 1) == 0)
+        continue;
+      // Enable I/O space and bus mastering.
+      pciwrite(0, dev, func, 0x04, pciread(0, dev, func, 0x04) | 0x5);
+      // The secondary channel's registers follow the primary's.
+      chans[0].dma = bar & 0xfffc;
+      chans[1].dma = chans[0].dma + 8;
+      cprintf("ide: dma at 0x%x\n", chans[0].dma);
+      return;
+    }
+  }
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Find where b lives: return its channel, and set *drive to the
+// disk on that channel (0 master, 1 slave) and *pblock to the
+// block on that disk.
+static struct channel*
+idemap(struct buf *b, int *drive, uint *pblock)
+{
+  if(b->dev == 1 && striped){
+    *drive = (b->blockno & 1) ? 0 : 1;
+    *pblock = b->blockno >> 1;
+    return &chans[b->blockno & 1];
+  }
+  *drive = b->dev & 1;
+  *pblock = b->blockno;
+  return &chans[0];
+}
+
+// Start the request for b on c.  Caller must hold c->lock.
+// With DMA, also take the queued requests after b that continue
+// it on disk, and set c->batch to the number of bufs started.
 static void
-idestart(struct buf *b)
+idestart(struct channel *c, struct buf *b)
 {
+  struct buf *e;
+  int n, i, drive, d;
+  uint pblock, p, q;
+
   if(b == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
-    panic("incorrect blockno");
+  idemap(b, &drive, &pblock);
   int sector_per_block =  BSIZE/SECTOR_SIZE;
-  int sector = b->blockno * sector_per_block;
+  int sector = pblock * sector_per_block;
   int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
   int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
-  if (sector_per_block > 7) panic("idestart");
-
-  idewait(0);
-  outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
-  outb(0x1f3, sector & 0xff);
-  outb(0x1f4, (sector >> 8) & 0xff);
-  outb(0x1f5, (sector >> 16) & 0xff);
-  outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
-    outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+  // Merge the run of consecutive blocks at the head of the queue.
+  n = 1;
+  if(c->dma)
+    for(e = b; e->qnext && n < IDE_MAXMERGE && n*sector_per_block < 256; e = e->qnext, n++){
+      idemap(e, &d, &p);
+      idemap(e->qnext, &d, &q);
+      if(e->qnext->dev != b->dev || d != drive || q != p+1 ||
+         (e->qnext->flags & B_DIRTY) != (b->flags & B_DIRTY))
+        break;
+    }
+  if(b->blockno >= FSSIZE)
+    panic("incorrect blockno");
+  c->batch = n;
+
+  idewait(c, 0);
+  outb(c->ctl, 0);  // generate interrupt
+  outb(c->port+2, n * sector_per_block);  // number of sectors
+  outb(c->port+3, sector & 0xff);
+  outb(c->port+4, (sector >> 8) & 0xff);
+  outb(c->port+5, (sector >> 16) & 0xff);
+  outb(c->port+6, 0xe0 | (drive<<4) | ((sector>>24)&0x0f));
+  if(c->dma){
+    for(i = 0, e = b; i < n; i++, e = e->qnext){
+      if(e->blockno >= FSSIZE)
+        panic("incorrect blockno");
+      c->prdt[i].addr = V2P(e->data);
+      c->prdt[i].len = BSIZE;
+      c->prdt[i].flags = i == n-1 ? 0x8000 : 0;
+    }
+    outl(c->dma+BM_PRDT, V2P(c->prdt));
+    outb(c->dma+BM_STATUS, BM_ST_ERR | BM_ST_INTR);  // clear
+    if(b->flags & B_DIRTY){
+      outb(c->dma+BM_CMD, 0);
+      outb(c->port+7, IDE_CMD_WRDMA);
+      outb(c->dma+BM_CMD, BM_CMD_START);
+    } else {
+      outb(c->dma+BM_CMD, BM_CMD_READ);
+      outb(c->port+7, IDE_CMD_RDDMA);
+      outb(c->dma+BM_CMD, BM_CMD_READ | BM_CMD_START);
+    }
+  } else if(b->flags & B_DIRTY){
+    outb(c->port+7, write_cmd);
+    outsl(c->port, b->data, BSIZE/4);
   } else {
-    outb(0x1f7, read_cmd);
+    outb(c->port+7, read_cmd);
   }
 }
 
-// Interrupt handler.
+// Interrupt handler for channel chan.
 void
-ideintr(void)
+ideintr(int chan)
 {
-  struct buf *b;
+  struct channel *c;
+  struct buf *b, *async[IDE_MAXMERGE];
+  int i, n, nasync, err;
+
+  c = &chans[chan];
+
+  // First queued buffers are the active request.
+  acquire(&c->lock);
+
+  if((b = c->queue) == 0 || c->batch == 0){
+    release(&c->lock);
+    return;
+  }
 
-  // First queued buffer is the active request.
-  acquire(&idelock);
+  if(c->dma){
+    // Stop the engine and clear its interrupt before the
+    // status read in idewait acknowledges the drive.
+    err = inb(c->dma+BM_STATUS) & BM_ST_ERR;
+    outb(c->dma+BM_CMD, 0);
+    outb(c->dma+BM_STATUS, BM_ST_ERR | BM_ST_INTR);
+    if(idewait(c, 1) < 0 || err)
+      cprintf("ide: dma error at block %d\n", b->blockno);
+  } else if(!(b->flags & B_DIRTY) && idewait(c, 1) >= 0){
+    // Read data if needed.
+    insl(c->port, b->data, BSIZE/4);
+  }
+
+  // Wake processes waiting for these bufs.
+  n = c->batch;
+  nasync = 0;
+  for(i = 0; i < n; i++){
+    b = c->queue;
+    c->queue = b->qnext;
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    if(b->flags & B_ASYNC){
+      b->flags &= ~B_ASYNC;
+      async[nasync++] = b;
+    }
+    wakeup(b);
+  }
+
+  // Start disk on next buf in queue, then take in what the CPUs
+  // submitted meanwhile.  batch is cleared before the rings are
+  // read, so a submitter that misses this drain sees the channel
+  // idle and kicks it itself (see idekick).
+  c->batch = 0;
+  if(c->queue != 0)
+    idestart(c, c->queue);
+  __sync_synchronize();
+  idedrain(c);
+  if(c->batch == 0 && c->queue != 0)
+    idestart(c, c->queue);
+
+  release(&c->lock);
+
+  // Nobody waits for a prefetch; release the buffers for them.
+  for(i = 0; i < nasync; i++)
+    bprefetchdone(async[i]);
+}
+
+// Does pending buf a go before pending buf c when the disk
+// head is at block head?  Blocks at or above head come first.
+// On a striped channel all of disk 1's blocks have the same
+// parity, so their order is the order on the disk.
+static int
+idebefore(struct buf *a, struct buf *c, uint head)
+{
+  if((a->blockno < head) != (c->blockno < head))
+    return a->blockno >= head;
+  return a->blockno < c->blockno;
+}
+
+// Insert b into c's queue in C-LOOK order: after the bufs the disk
+// is working on, the pending bufs at or above the current block
+// ascend, then the rest ascend from the lowest, so the disk sweeps
+// upward and jumps back once per pass.  Caller must hold c->lock,
+// and must start the disk if b ends up at the head of the queue.
+static void
+idequeue_insert(struct channel *c, struct buf *b)
+{
+  struct buf **pp;
+  int i;
 
-  if((b = idequeue) == 0){
-    release(&idelock);
+  b->qnext = 0;
+  if(c->queue == 0){
+    c->queue = b;
     return;
   }
-  idequeue = b->qnext;
+  pp = &c->queue->qnext;
+  for(i = 1; i < c->batch && *pp; i++)
+    pp = &(*pp)->qnext;
+  for(; *pp; pp = &(*pp)->qnext)  //DOC:insert-queue
+    if(idebefore(b, *pp, c->queue->blockno))
+      break;
+  b->qnext = *pp;
+  *pp = b;
+}
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+// Move the bufs in the CPUs' submission rings into c's queue.
+// Caller must hold c->lock, which makes it the rings' consumer.
+static void
+idedrain(struct channel *c)
+{
+  struct ring *r;
+  uint head, tail;
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+  for(r = c->ring; r < &c->ring[ncpu]; r++){
+    head = *(volatile uint*)&r->head;
+    __sync_synchronize();  // read the slots only after head
+    for(tail = r->tail; tail != head; tail++)
+      idequeue_insert(c, r->slot[tail % IDE_RING]);
+    __sync_synchronize();  // done with the slots before freeing them
+    r->tail = tail;
+  }
+}
+
+// Submit b to c through this CPU's ring.  A full ring is
+// drained under the lock first, which only happens when the
+// CPU submits faster than the interrupts come in.
+static void
+idesubmit(struct channel *c, struct buf *b)
+{
+  struct ring *r;
 
-  // Start disk on next buf in queue.
-  if(idequeue != 0)
-    idestart(idequeue);
+  pushcli();  // stay on this CPU, the ring's only producer
+  r = &c->ring[cpuid()];
+  while(r->head - *(volatile uint*)&r->tail == IDE_RING){
+    acquire(&c->lock);
+    idedrain(c);
+    release(&c->lock);
+  }
+  r->slot[r->head % IDE_RING] = b;
+  __sync_synchronize();  // publish the slot before head
+  r->head++;
+  popcli();
+}
 
-  release(&idelock);
+// Doorbell: start c if it is idle.  A busy channel drains the
+// rings in ideintr when the command finishes.  The fence orders
+// the submitter's head store before the batch load, against
+// ideintr's batch store before its ring loads.
+static void
+idekick(struct channel *c)
+{
+  __sync_synchronize();
+  if(*(volatile int*)&c->batch != 0)
+    return;
+  acquire(&c->lock);
+  idedrain(c);
+  if(c->batch == 0 && c->queue != 0)
+    idestart(c, c->queue);
+  release(&c->lock);
 }
 
 //PAGEBREAK!
@@ -137,7 +485,9 @@ ideintr(void)
 void
 iderw(struct buf *b)
 {
-  struct buf **pp;
+  struct channel *c;
+  uint pblock;
+  int drive;
 
   if(!holdingsleep(&b->lock))
     panic("iderw: buf not locked");
@@ -146,23 +496,82 @@ iderw(struct buf *b)
   if(b->dev != 0 && !havedisk1)
     panic("iderw: ide disk 1 not present");
 
-  acquire(&idelock);  //DOC:acquire-lock
-
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
-  *pp = b;
+  c = idemap(b, &drive, &pblock);
+  idesubmit(c, b);
 
   // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
+  idekick(c);
 
   // Wait for request to finish.
+  acquire(&c->lock);  //DOC:acquire-lock
   while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
-    sleep(b, &idelock);
+    sleep(b, &c->lock);
   }
 
 
-  release(&idelock);
+  release(&c->lock);
+}
+
+// Start reading b from disk and return without waiting.
+// b must be locked, not valid and marked B_ASYNC; ideintr
+// marks it valid and releases it.
+void
+ideread(struct buf *b)
+{
+  struct channel *c;
+  uint pblock;
+  int drive;
+
+  if(!holdingsleep(&b->lock))
+    panic("ideread: buf not locked");
+  if(b->flags & (B_VALID|B_DIRTY))
+    panic("ideread: nothing to do");
+  if(b->dev != 0 && !havedisk1)
+    panic("ideread: ide disk 1 not present");
+
+  c = idemap(b, &drive, &pblock);
+  idesubmit(c, b);
+  idekick(c);
+}
+
+// Write the n locked bufs in bs to disk and wait for all of them.
+// They are submitted together in block order and each channel is
+// kicked once after, so with DMA a run of consecutive blocks goes
+// out as one transfer, and on a striped disk both channels start
+// before waiting on either.
+void
+iderwv(struct buf **bs, int n)
+{
+  struct channel *c;
+  struct buf *b;
+  uint pblock;
+  int i, j, drive;
+
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&bs[i]->lock))
+      panic("iderwv: buf not locked");
+    if(!(bs[i]->flags & B_DIRTY))
+      panic("iderwv: buf not dirty");
+    if(bs[i]->dev != 0 && !havedisk1)
+      panic("iderwv: ide disk 1 not present");
+  }
+  for(i = 1; i < n; i++)
+    for(j = i; j > 0 && bs[j-1]->blockno > bs[j]->blockno; j--){
+      b = bs[j];
+      bs[j] = bs[j-1];
+      bs[j-1] = b;
+    }
+
+  for(i = 0; i < n; i++)
+    idesubmit(idemap(bs[i], &drive, &pblock), bs[i]);
+  // Start only once the whole batch is submitted, so it can merge.
+  for(c = chans; c < &chans[NCHAN]; c++)
+    idekick(c);
+  for(i = 0; i < n; i++){
+    c = idemap(bs[i], &drive, &pblock);
+    acquire(&c->lock);
+    while((bs[i]->flags & (B_VALID|B_DIRTY)) != B_VALID)
+      sleep(bs[i], &c->lock);
+    release(&c->lock);
+  }
 }
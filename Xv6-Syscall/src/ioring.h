@@ -0,0 +1,35 @@
+// Submission and completion rings that a process shares with the
+// kernel, to make many reads, writes, opens and closes with one
+// submit() call.  The process fills sq[sqtail % NRING] and bumps
+// sqtail; submit() takes entries from sqhead, carries each out and
+// posts its result at cq[cqtail % NRING].  The process takes
+// completions from cqhead.
+
+#define NRING 32  // entries in each ring
+
+#define IORING_READ  1  // read(fd, buf, n)
+#define IORING_WRITE 2  // write(fd, buf, n)
+#define IORING_OPEN  3  // open(buf, fd): fd holds the mode
+#define IORING_CLOSE 4  // close(fd)
+
+struct sqe {
+  int op;
+  int fd;
+  void *buf;
+  int n;
+  int data;     // copied to the completion, for the process
+};
+
+struct cqe {
+  int data;     // from the submission
+  int res;      // what the system call would have returned
+};
+
+struct ioring {
+  uint sqhead;  // advanced by the kernel
+  uint sqtail;  // advanced by the process
+  uint cqhead;  // advanced by the process
+  uint cqtail;  // advanced by the kernel
+  struct sqe sq[NRING];
+  struct cqe cq[NRING];
+};
@@ -8,19 +8,35 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "spinlock.h"
+#include "proc.h"
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
                    // defined by the kernel linker script in kernel.ld
 
+#define KBATCH 32  // pages moved between a cpu's list and the pool at once
+
 struct run {
   struct run *next;
 };
 
+// Each cpu allocates from and frees to its own list, refilling it
+// a batch at a time from the global pool, or failing that by
+// stealing from other cpus, and returning a batch to the pool once
+// it holds 2*KBATCH pages.  A cpu's lock is only contended when
+// another cpu steals, and no cpu holds two of these locks at once.
+struct kcpu {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+};
+
 struct {
   struct spinlock lock;
   int use_lock;
   struct run *freelist;
+  int nfree;
+  struct kcpu cpu[NCPU];
 } kmem;
 
 // Initialization happens in two phases.
@@ -28,10 +44,16 @@ struct {
 // the pages mapped by entrypgdir on free list.
 // 2. main() calls kinit2() with the rest of the physical pages
 // after installing a full page table that maps them on all cores.
+// Until kinit2() returns only the global pool is used, since the
+// cpus are not set up yet.
 void
 kinit1(void *vstart, void *vend)
 {
+  int i;
+
   initlock(&kmem.lock, "kmem");
+  for(i = 0; i < NCPU; i++)
+    initlock(&kmem.cpu[i].lock, "kmem.cpu");
   kmem.use_lock = 0;
   freerange(vstart, vend);
 }
@@ -51,6 +73,66 @@ freerange(void *vstart, void *vend)
   for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
     kfree(p);
 }
+
+// Unlink up to want pages from the front of *list, which holds
+// *n pages, and return them as a null-terminated chain.
+// Caller must hold the list's lock.
+static struct run*
+takebatch(struct run **list, int *n, int want)
+{
+  struct run *first, *r;
+  int i;
+
+  first = *list;
+  if(first == 0 || want <= 0)
+    return 0;
+  for(r = first, i = 1; i < want && r->next; i++)
+    r = r->next;
+  *list = r->next;
+  r->next = 0;
+  *n -= i;
+  return first;
+}
+
+// Put the chain of pages batch on the front of *list.
+static void
+putbatch(struct run **list, int *n, struct run *batch)
+{
+  struct run *r;
+
+  if(batch == 0)
+    return;
+  for(r = batch, (*n)++; r->next; r = r->next)
+    (*n)++;
+  r->next = *list;
+  *list = batch;
+}
+
+// Find pages for cpu id's empty list: a batch from the pool, or
+// half of another cpu's list.  Caller must have interrupts off
+// and must not hold any kmem lock.
+static struct run*
+refill(int id)
+{
+  struct run *batch;
+  struct kcpu *c;
+  int i;
+
+  acquire(&kmem.lock);
+  batch = takebatch(&kmem.freelist, &kmem.nfree, KBATCH);
+  release(&kmem.lock);
+
+  for(i = 0; batch == 0 && i < ncpu; i++){
+    if(i == id)
+      continue;
+    c = &kmem.cpu[i];
+    acquire(&c->lock);
+    batch = takebatch(&c->freelist, &c->nfree, (c->nfree + 1) / 2);
+    release(&c->lock);
+  }
+  return batch;
+}
+
 //PAGEBREAK: 21
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
@@ -59,7 +141,8 @@ freerange(void *vstart, void *vend)
 void
 kfree(char *v)
 {
-  struct run *r;
+  struct run *r, *batch;
+  struct kcpu *c;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
@@ -67,13 +150,27 @@ kfree(char *v)
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
+  r->next = 0;
+  if(!kmem.use_lock){
+    putbatch(&kmem.freelist, &kmem.nfree, r);
+    return;
+  }
+
+  pushcli();
+  c = &kmem.cpu[cpuid()];
+  acquire(&c->lock);
+  putbatch(&c->freelist, &c->nfree, r);
+  batch = 0;
+  if(c->nfree >= 2*KBATCH)
+    batch = takebatch(&c->freelist, &c->nfree, KBATCH);
+  release(&c->lock);
+  if(batch){
+    acquire(&kmem.lock);
+    putbatch(&kmem.freelist, &kmem.nfree, batch);
     release(&kmem.lock);
+  }
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -83,14 +180,26 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct kcpu *c;
+  int id;
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+  if(!kmem.use_lock){
+    r = takebatch(&kmem.freelist, &kmem.nfree, 1);
+    return (char*)r;
+  }
+
+  pushcli();
+  id = cpuid();
+  c = &kmem.cpu[id];
+  acquire(&c->lock);
+  if(c->freelist == 0){
+    release(&c->lock);
+    r = refill(id);
+    acquire(&c->lock);
+    putbatch(&c->freelist, &c->nfree, r);
+  }
+  r = takebatch(&c->freelist, &c->nfree, 1);
+  release(&c->lock);
+  popcli();
   return (char*)r;
 }
-
@@ -0,0 +1,16 @@
+// The page the kernel shares read-only with every process, at
+// KSHARED, just below the kernel.  A process reads these counters
+// with plain loads instead of system calls; the kernel updates
+// them as it goes, so two fields read one after the other may be
+// from different moments.  Include param.h first.
+
+#define KSHARED 0x7FFFF000      // KERNBASE - PGSIZE, top of user space
+
+struct kshared {
+  uint ticks;                   // Clock ticks since boot, as uptime()
+  uint readcount;               // Sum of cpu[].readcount at the last tick
+  uint ncpu;                    // Entries of cpu[] in use
+  struct {
+    uint readcount;             // read() calls on this cpu
+  } cpu[NCPU];
+};
@@ -43,6 +43,11 @@
 
 volatile uint *lapic;  // Initialized in mp.c
 
+#define TICKCOUNT 10000000  // Timer counts between clock interrupts
+#define CALCOUNT  1000000   // Timer counts the tsc is calibrated over
+
+unsigned long long tscpertick;  // Time-stamp counter cycles per tick
+
 //PAGEBREAK!
 static void
 lapicw(int index, int value)
@@ -54,6 +59,9 @@ lapicw(int index, int value)
 void
 lapicinit(void)
 {
+  uint c0;
+  unsigned long long t0;
+
   if(!lapic)
     return;
 
@@ -66,7 +74,18 @@ lapicinit(void)
   // TICR would be calibrated using an external time source.
   lapicw(TDCR, X1);
   lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
-  lapicw(TICR, 10000000);
+  lapicw(TICR, TICKCOUNT);
+
+  // Time the first CALCOUNT counts of the timer with the time-stamp
+  // counter, to let user programs turn cycles into ticks.  Once is
+  // enough: every cpu's timer runs off the same bus clock.
+  if(tscpertick == 0){
+    c0 = lapic[TCCR];
+    t0 = rdtsc();
+    while(c0 - lapic[TCCR] < CALCOUNT)
+      ;
+    tscpertick = (rdtsc() - t0) * (TICKCOUNT / CALCOUNT);
+  }
 
   // Disable logical interrupt lines.
   lapicw(LINT0, MASKED);
@@ -0,0 +1,60 @@
+// Print spinlock contention statistics, one line per lock name.
+//
+//   lockstat            totals since boot
+//   lockstat cmd args   counts for the duration of running cmd
+//
+// maxhold is always the longest hold since boot.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "lockstat.h"
+
+static struct lockstat before[NLOCKSTAT], after[NLOCKSTAT];
+
+int
+main(int argc, char *argv[])
+{
+  int i, n, pid;
+
+  n = 0;
+  if(argc > 1){
+    if((n = getlockstats(before, NLOCKSTAT)) < 0){
+      printf(2, "lockstat: getlockstats failed\n");
+      exit();
+    }
+    pid = fork();
+    if(pid < 0){
+      printf(2, "lockstat: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      exec(argv[1], argv+1);
+      printf(2, "lockstat: exec %s failed\n", argv[1]);
+      exit();
+    }
+    wait();
+  }
+  if(getlockstats(after, NLOCKSTAT) < 0){
+    printf(2, "lockstat: getlockstats failed\n");
+    exit();
+  }
+
+  printf(1, "lock acquires contended spins maxhold khold\n");
+  for(i = 0; i < NLOCKSTAT && after[i].name[0]; i++){
+    // Names are only ever added, so the first n entries are the
+    // same names as in before[].
+    if(i < n){
+      after[i].acquires -= before[i].acquires;
+      after[i].contended -= before[i].contended;
+      after[i].spins -= before[i].spins;
+      after[i].khold -= before[i].khold;
+    }
+    if(after[i].acquires == 0)
+      continue;
+    printf(1, "%s %d %d %d %d %d\n", after[i].name, after[i].acquires,
+           after[i].contended, after[i].spins, after[i].maxhold,
+           after[i].khold);
+  }
+  exit();
+}
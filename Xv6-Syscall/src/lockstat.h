@@ -0,0 +1,16 @@
+// Spinlock statistics returned by getlockstats().
+// Locks are counted by name: all locks initialized with the same
+// name (e.g. every "pipe" lock) share one entry.
+
+#define NLOCKSTAT 32  // lock names the kernel keeps statistics for
+#define LOCKNAME  16  // bytes of the name kept, including the 0
+
+// Hold times are in cycles of the time-stamp counter.
+struct lockstat {
+  char name[LOCKNAME];
+  uint acquires;   // Completed acquire() calls
+  uint contended;  // Acquires that found the lock held
+  uint spins;      // Times the lock was polled while waiting
+  uint maxhold;    // Longest time the lock was held
+  uint khold;      // Total time held, in units of 1024 cycles
+};
@@ -14,6 +14,52 @@
 // any reasoning required about whether a commit might
 // write an uncommitted system call's updates to disk.
 //
+// Commits are grouped and done by a kernel thread, logthread().
+// A transaction is due once the log could not admit another
+// system call, or it has been open COMMITTICKS ticks; until then
+// it stays open for the next system calls, which absorb their
+// writes to the same blocks into it.  When a due transaction has
+// no active system calls, the thread closes it, copies its blocks
+// to the log and writes the header with the last of them, then
+// lets a new transaction start filling while it installs the
+// closed one.  end_op() never waits for the disk; sync() waits
+// for the commit point.
+//
+// The header carries a checksum of itself and the logged blocks,
+// so it need not wait for them to reach the disk before it is
+// written: recovery installs the transaction only if the blocks
+// in the log match the checksum, and a commit cut short by a
+// crash leaves either a header or blocks that do not.  Nor is the
+// header cleared once the transaction has been installed.  The
+// next commit is only written after that, so the header on disk
+// only ever names the last committed transaction, and installing
+// it again at recovery rewrites its blocks with what they already
+// hold.
+//
+// Installing writes each block's logged copy through a private
+// shadow buf, not through the cache, because the next
+// transaction may already have changed the cached block.  Only
+// after a block is installed, and unless the new transaction
+// has logged it too, is its cache copy unpinned.
+//
+// File data is not logged.  write() hands a regular file's data
+// blocks to log_write_data(), which only lists them with the open
+// transaction and pins them; the commit thread writes them home,
+// and all of them, before the log blocks and header, so the data
+// written in a transaction costs one disk write instead of two,
+// and a committed inode or indirect block never names a block
+// holding whatever was there before.  The exception is a block
+// freed earlier in the same transaction: until that commits, a
+// crash leaves it belonging to its old file, so writing it home
+// now would corrupt that file, and it is logged like metadata
+// instead.  A transaction may list only data blocks; committing
+// it still writes a header, with no blocks, so that recovery no
+// longer replays the one before.
+//
+// The log holds as many blocks as mkfs gave it in the
+// superblock, up to LOGMAX, so it can be resized without
+// rebuilding the kernel.
+//
 // A system call should call begin_op()/end_op() to mark
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
@@ -23,187 +69,472 @@
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
 //   header block, containing block #s for block A, B, C, ...
+//     and the checksum
 //   block A
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Log appends are done by the commit thread.
+
+#define LOGBATCH MAXOPBLOCKS  // blocks written to disk per batch
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
-  int block[LOGSIZE];
+  uint seq;     // number of the transaction
+  uint sum;     // checksum of n, seq, block[] and the logged blocks
+  int block[LOGMAX];
 };
 
 struct log {
   struct spinlock lock;
   int start;
   int size;
+  int cap;         // blocks usable in one transaction, logged or not
+  uint opened;     // tick the open transaction logged its first block
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // log blocks the executing sys calls may still write
+  int committing;  // blocks are being copied to the log, please wait.
+  int force;       // sync() wants the open transaction committed
+  uint seq;        // number of the open transaction
+  uint committed;  // number of the last transaction on disk
   int dev;
-  struct logheader lh;
+  struct logheader lh;   // open transaction
+  struct logheader clh;  // transaction the thread is committing
+  int ndata;       // file data blocks of the open transaction
+  int cndata;      // and of the one the thread is committing
+  int data[LOGMAX];
+  int cdata[LOGMAX];
 };
 struct log log;
 
+// Blocks freed in the open transaction, which must not be written
+// home before it commits.
+static uchar freed[FSSIZE/8 + 1];
+
+// Private bufs for installing, never in the cache.  Kept below
+// 8KB and aligned to it so no data crosses a 64KB DMA boundary.
+static struct buf shadow[LOGBATCH] __attribute__((aligned(8192)));
+
 static void recover_from_log(void);
-static void commit();
+static void logthread(void);
 
 void
 initlog(int dev)
 {
+  int i;
+
   if (sizeof(struct logheader) >= BSIZE)
     panic("initlog: too big logheader");
+  if (sizeof(shadow) > 8192)
+    panic("initlog: shadow bufs too big");
 
   struct superblock sb;
   initlock(&log.lock, "log");
   readsb(dev, &sb);
   log.start = sb.logstart;
   log.size = sb.nlog;
+  log.cap = sb.nlog - 1 < LOGMAX ? sb.nlog - 1 : LOGMAX;
   log.dev = dev;
+  log.seq = 1;
+  for (i = 0; i < LOGBATCH; i++)
+    initsleeplock(&shadow[i].lock, "shadow");
   recover_from_log();
+  if (kthread("logthread", logthread) == 0)
+    panic("initlog: no commit thread");
+}
+
+#define SUMSEED  2166136261  // FNV-1a offset basis
+#define SUMPRIME 16777619
+
+// Fold the n bytes at p, a multiple of 4, into the checksum sum.
+static uint
+checksum(uint sum, void *p, int n)
+{
+  uint *w;
+  int i;
+
+  w = (uint*)p;
+  for (i = 0; i < n / 4; i++)
+    sum = (sum ^ w[i]) * SUMPRIME;
+  return sum;
 }
 
-// Copy committed blocks from log to their home location
+// Start the checksum of a transaction with its header fields.
+static uint
+head_sum(struct logheader *lh)
+{
+  uint sum;
+
+  sum = checksum(SUMSEED, &lh->n, sizeof(lh->n));
+  sum = checksum(sum, &lh->seq, sizeof(lh->seq));
+  return checksum(sum, lh->block, lh->n * sizeof(lh->block[0]));
+}
+
+// Sort the positions of lh's blocks by home block number into
+// order, dropping any block logged again at a later position, and
+// return how many are left.  log_write absorbs a block written
+// twice in one transaction, so a header written by this kernel
+// has no repeats, but recovery need not trust that.
+static int
+sort_trans(struct logheader *lh, int *order)
+{
+  int i, j, n;
+
+  n = 0;
+  for (i = 0; i < lh->n; i++) {
+    for (j = 0; j < n; j++)
+      if (lh->block[order[j]] == lh->block[i])
+        break;
+    if (j < n) {
+      order[j] = i;  // superseded: keep the later copy
+      continue;
+    }
+    for (j = n++; j > 0 && lh->block[order[j-1]] > lh->block[i]; j--)
+      order[j] = order[j-1];
+    order[j] = i;
+  }
+  return n;
+}
+
+// Copy committed blocks from log to their home location through
+// the cache, in home block order and LOGBATCH at a time so the
+// disk driver can merge neighbours into one transfer.  The home
+// blocks are overwritten whole, so they are not read first, and
+// each batch's log blocks are read ahead while the batch before is
+// being written.  Only used for recovery, when nothing else is
+// running.
 static void
-install_trans(void)
+install_trans(struct logheader *lh)
 {
-  int tail;
+  static int order[LOGMAX];
+  struct buf *dbuf[LOGBATCH];
+  int ntrans, tail, n, i;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    brelse(lbuf);
-    brelse(dbuf);
+  ntrans = sort_trans(lh, order);
+  for (i = 0; i < LOGBATCH && i < ntrans; i++)
+    bprefetch(log.dev, log.start+order[i]+1);
+  for (tail = 0; tail < ntrans; tail += n) {
+    for (n = 0; n < LOGBATCH && tail+n < ntrans; n++) {
+      struct buf *lbuf = bread(log.dev, log.start+order[tail+n]+1); // read log block
+      dbuf[n] = boverwrite(log.dev, lh->block[order[tail+n]]);
+      memmove(dbuf[n]->data, lbuf->data, BSIZE);  // copy block to dst
+      brelse(lbuf);
+    }
+    for (i = tail+n; i < tail+n+LOGBATCH && i < ntrans; i++)
+      bprefetch(log.dev, log.start+order[i]+1);
+    bwritev(dbuf, n);  // write dsts to disk
+    for (i = 0; i < n; i++)
+      brelse(dbuf[i]);
   }
 }
 
-// Read the log header from disk into the in-memory log header
+// Copy committed blocks from log to their home location through
+// the shadow bufs, leaving the cache alone, then unpin the cached
+// blocks the open transaction has not written again.
+static void
+install_shadow(struct logheader *lh)
+{
+  struct buf *sbuf[LOGBATCH], *b;
+  int tail, n, i, j;
+
+  for (tail = 0; tail < lh->n; tail += n) {
+    for (n = 0; n < LOGBATCH && tail+n < lh->n; n++) {
+      struct buf *lbuf = bread(log.dev, log.start+tail+n+1); // read log block
+      sbuf[n] = &shadow[n];
+      acquiresleep(&sbuf[n]->lock);
+      sbuf[n]->dev = log.dev;
+      sbuf[n]->blockno = lh->block[tail+n];
+      memmove(sbuf[n]->data, lbuf->data, BSIZE);
+      brelse(lbuf);
+    }
+    bwritev(sbuf, n);  // write dsts to disk
+    for (i = 0; i < n; i++)
+      releasesleep(&shadow[i].lock);
+  }
+
+  for (i = 0; i < lh->n; i++) {
+    b = bread(log.dev, lh->block[i]);  // pinned, so no disk read
+    acquire(&log.lock);
+    for (j = 0; j < log.lh.n; j++)
+      if (log.lh.block[j] == b->blockno)
+        break;
+    if (j == log.lh.n)
+      for (j = 0; j < log.ndata; j++)
+        if (log.data[j] == b->blockno)
+          break;
+    if (j == log.ndata)
+      b->flags &= ~B_DIRTY;
+    release(&log.lock);
+    brelse(b);
+  }
+}
+
+// Read the log header from disk into the in-memory log header.
+// A header whose count cannot be right reads as an empty log.
 static void
 read_head(void)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
+  log.lh.n = lh->n < 0 || lh->n > log.cap ? 0 : lh->n;
+  log.lh.seq = lh->seq;
+  log.lh.sum = lh->sum;
   for (i = 0; i < log.lh.n; i++) {
     log.lh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
-static void
-write_head(void)
+// Return a locked buf holding lh as the log header block, for
+// the caller to write.
+static struct buf*
+head_buf(struct logheader *lh)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = boverwrite(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  memset(buf->data, 0, BSIZE);
+  hb->n = lh->n;
+  hb->seq = lh->seq;
+  hb->sum = lh->sum;
+  for (i = 0; i < lh->n; i++) {
+    hb->block[i] = lh->block[i];
   }
+  return buf;
+}
+
+// Write a log header to disk.
+static void
+write_head(struct logheader *lh)
+{
+  struct buf *buf = head_buf(lh);
   bwrite(buf);
   brelse(buf);
 }
 
+// Did the last commit reach the disk whole?  Checks the blocks
+// in the log against the header's checksum.
+static int
+log_complete(struct logheader *lh)
+{
+  uint sum;
+  int i;
+
+  sum = head_sum(lh);
+  for (i = 0; i < lh->n; i++) {
+    struct buf *lbuf = bread(log.dev, log.start+i+1);
+    sum = checksum(sum, lbuf->data, BSIZE);
+    brelse(lbuf);
+  }
+  return sum == lh->sum;
+}
+
 static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(); // if committed, copy from log to disk
+  if (log.lh.n > 0 && log_complete(&log.lh))
+    install_trans(&log.lh); // if committed, copy from log to disk
   log.lh.n = 0;
-  write_head(); // clear the log
+  log.lh.seq = 0;
+  log.lh.sum = 0;
+  write_head(&log.lh); // clear the log
 }
 
 // called at the start of each FS system call.
 void
 begin_op(void)
 {
+  begin_opn(MAXOPBLOCKS);
+}
+
+// Start an FS system call that may write up to n blocks, fewer if
+// the log cannot hold that many.  Returns the number of blocks
+// reserved, which the caller passes to end_opn().
+int
+begin_opn(int n)
+{
+  if(n > log.cap)
+    n = log.cap;
   acquire(&log.lock);
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.ndata + log.reserved + n > log.cap){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
       release(&log.lock);
-      break;
+      return n;
     }
   }
 }
 
+// Should the open transaction be committed now that no FS
+// system call is active?  Caller must hold log.lock.
+static int
+commit_due(void)
+{
+  if(log.lh.n + log.ndata == 0)
+    return 0;
+  // begin_op() would not admit another system call.
+  if(log.force || log.lh.n + log.ndata + MAXOPBLOCKS > log.cap)
+    return 1;
+  return ticks - log.opened >= COMMITTICKS;
+}
+
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// hands the transaction to the commit thread if this was the
+// last outstanding operation and a commit is due.
 void
 end_op(void)
 {
-  int do_commit = 0;
+  end_opn(MAXOPBLOCKS);
+}
 
+// End a system call started with begin_opn(), which returned n.
+void
+end_opn(int n)
+{
+  if(n > log.cap)
+    n = log.cap;
   acquire(&log.lock);
   log.outstanding -= 1;
+  log.reserved -= n;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
+  if(log.outstanding == 0 && commit_due())
+    wakeup(&log.clh);
+  // begin_op() may be waiting for log space,
+  // and decrementing log.reserved has decreased
+  // the amount of reserved space.
+  wakeup(&log);
+  release(&log.lock);
+}
+
+// Called on every clock tick: wake the commit thread if the
+// open transaction may have grown old.  The check without the
+// lock is only a hint; the thread looks again under log.lock.
+void
+log_tick(void)
+{
+  if((log.lh.n > 0 || log.ndata > 0) && log.outstanding == 0)
+    wakeup(&log.clh);
+}
+
+// Wait until everything logged so far has been committed.
+void
+log_flush(void)
+{
+  uint target;
+
+  acquire(&log.lock);
+  target = log.lh.n + log.ndata > 0 ? log.seq : log.seq - 1;
+  if(log.lh.n + log.ndata > 0){
+    log.force = 1;
+    wakeup(&log.clh);
   }
+  while(log.committed < target)
+    sleep(&log, &log.lock);
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+// Write the n file data blocks listed in data home from the
+// cache, where they are pinned, LOGBATCH at a time.
+static void
+write_data(int *data, int n)
+{
+  struct buf *b[LOGBATCH];
+  int tail, m, i;
+
+  for (tail = 0; tail < n; tail += m) {
+    for (m = 0; m < LOGBATCH && tail+m < n; m++)
+      b[m] = bread(log.dev, data[tail+m]);  // pinned, so no disk read
+    bwritev(b, m);  // the disk write leaves them clean
+    for (i = 0; i < m; i++)
+      brelse(b[i]);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy modified blocks from cache to log, summing them, and write
+// the header along with the last batch.  Once that is on disk the
+// transaction has committed.  The log blocks are consecutive and
+// follow the header, so each batch goes to the disk as one
+// transfer, and a transaction of fewer than LOGBATCH blocks is
+// written in a single one, header and all.
 static void
-write_log(void)
+write_log(struct logheader *lh)
 {
-  int tail;
+  struct buf *to[LOGBATCH+1];
+  int tail, m, n, i;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  lh->sum = head_sum(lh);
+  for (tail = 0; ; tail += m) {
+    for (m = 0; m < LOGBATCH && tail+m < lh->n; m++) {
+      to[m] = boverwrite(log.dev, log.start+tail+m+1); // log block
+      struct buf *from = bread(log.dev, lh->block[tail+m]); // cache block
+      memmove(to[m]->data, from->data, BSIZE);
+      brelse(from);
+      lh->sum = checksum(lh->sum, to[m]->data, BSIZE);
+    }
+    n = m;
+    if (tail+m == lh->n)
+      to[n++] = head_buf(lh);
+    bwritev(to, n);  // write the log
+    for (i = 0; i < n; i++)
+      brelse(to[i]);
+    if (tail+m == lh->n)
+      break;
   }
 }
 
+// The commit thread.  Waits for a due transaction with no active
+// system calls, then commits it while the next one fills.
 static void
-commit()
+logthread(void)
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
+  acquire(&log.lock);
+  for(;;){
+    while(log.outstanding > 0 || !commit_due())
+      sleep(&log.clh, &log.lock);
+
+    // Close the transaction and keep new system calls out until
+    // its blocks are copied, so it commits none of their writes.
+    log.committing = 1;
+    log.force = 0;
+    log.clh = log.lh;
+    log.clh.seq = log.seq;
+    log.cndata = log.ndata;
+    memmove(log.cdata, log.data, log.ndata * sizeof(log.data[0]));
     log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    log.ndata = 0;
+    memset(freed, 0, sizeof(freed));
+    log.seq++;
+    release(&log.lock);
+
+    write_data(log.cdata, log.cndata);  // File data goes home first
+    write_log(&log.clh);       // Write blocks and header -- the real commit
+
+    acquire(&log.lock);
+    log.committing = 0;
+    log.committed = log.seq - 1;
+    wakeup(&log);
+    release(&log.lock);
+
+    install_shadow(&log.clh);  // Now install writes to home locations
+
+    acquire(&log.lock);
   }
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache with B_DIRTY.
-// commit()/write_log() will do the disk write.
+// The commit thread will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -215,8 +546,6 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
-    panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
@@ -225,10 +554,78 @@ log_write(struct buf *b)
     if (log.lh.block[i] == b->blockno)   // log absorbtion
       break;
   }
-  log.lh.block[i] = b->blockno;
-  if (i == log.lh.n)
+  if (i == log.lh.n) {
+    if (log.lh.n + log.ndata >= log.cap)
+      panic("too big a transaction");
+    if (log.lh.n + log.ndata == 0)
+      log.opened = ticks;
+    log.lh.block[i] = b->blockno;
     log.lh.n++;
+  }
+  b->flags |= B_DIRTY; // prevent eviction
+  release(&log.lock);
+}
+
+// Like log_write(), for a block of a regular file's data: the
+// commit thread writes it home just before the transaction
+// commits, rather than through the log.
+void
+log_write_data(struct buf *b)
+{
+  int i;
+
+  if (log.outstanding < 1)
+    panic("log_write_data outside of trans");
+
+  acquire(&log.lock);
+  if (freed[b->blockno/8] & (1 << (b->blockno%8))) {
+    release(&log.lock);
+    log_write(b);
+    return;
+  }
+  for (i = 0; i < log.ndata; i++) {
+    if (log.data[i] == b->blockno)
+      break;
+  }
+  if (i == log.ndata) {
+    if (log.lh.n + log.ndata >= log.cap)
+      panic("too big a transaction");
+    if (log.lh.n + log.ndata == 0)
+      log.opened = ticks;
+    log.data[log.ndata++] = b->blockno;
+  }
   b->flags |= B_DIRTY; // prevent eviction
   release(&log.lock);
 }
 
+// Block bno is being freed in the open transaction.  Remember
+// that until it commits, and forget any data written to it.
+void
+log_free(uint bno)
+{
+  struct buf *b;
+  int i, j;
+
+  acquire(&log.lock);
+  freed[bno/8] |= 1 << (bno%8);
+  for (i = 0; i < log.ndata; i++) {
+    if (log.data[i] == bno)
+      break;
+  }
+  if (i == log.ndata) {
+    release(&log.lock);
+    return;
+  }
+  log.data[i] = log.data[--log.ndata];
+  release(&log.lock);
+
+  b = bread(log.dev, bno);  // pinned, so no disk read
+  acquire(&log.lock);
+  for (j = 0; j < log.clh.n; j++)
+    if (log.clh.block[j] == bno)
+      break;
+  if (j == log.clh.n)  // else install_shadow() unpins it
+    b->flags &= ~B_DIRTY;
+  release(&log.lock);
+  brelse(b);
+}
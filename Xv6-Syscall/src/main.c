@@ -12,11 +12,6 @@ static void mpmain(void)  __attribute__((noreturn));
 extern pde_t *kpgdir;
 extern char end[]; // first address after kernel loaded from ELF file
 
-extern struct {
-  struct spinlock lock;
-  int count;
-} readcount;
-
 // Bootstrap processor starts running C code here.
 // Allocate a real stack and switch to it, first
 // doing some setup required for memory allocator to work.
@@ -26,6 +21,7 @@ main(void)
   kinit1(end, P2V(4*1024*1024)); // phys page allocator
   kvmalloc();      // kernel page table
   mpinit();        // detect other processors
+  ksharedinit();   // page shared with user space
   lapicinit();     // interrupt controller
   seginit();       // segment descriptors
   picinit();       // disable pic
@@ -34,13 +30,13 @@ main(void)
   uartinit();      // serial port
   pinit();         // process table
   tvinit();        // trap vectors
-  binit();         // buffer cache
+  profinit();      // sampling profiler
   fileinit();      // file table
-  initlock(&readcount.lock, "readcount");  // initialize readcount lock
-  readcount.count = 0;  // initialize counter
+  futexinit();     // user lock wait queues
   ideinit();       // disk 
   startothers();   // start other processors
   kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
+  binit();         // buffer cache, sized from the memory kinit2 freed
   userinit();      // first user process
   mpmain();        // finish this processor's setup
 }
@@ -96,10 +92,16 @@ startothers(void)
 
     lapicstartap(c->apicid, V2P(code));
 
-    // wait for cpu to finish mpmain()
-    while(c->started == 0)
+    // wait for cpu to take its stack; the others can start
+    // while it finishes mpenter()
+    while(*(void* volatile*)(code-4) != 0)
       ;
   }
+
+  // wait for all of them to finish mpmain()
+  for(c = cpus; c < cpus+ncpu; c++)
+    while(c->started == 0)
+      ;
 }
 
 // The boot page table used in entry.S and entryother.S.
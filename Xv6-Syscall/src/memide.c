@@ -27,7 +27,7 @@ ideinit(void)
 
 // Interrupt handler.
 void
-ideintr(void)
+ideintr(int chan)
 {
   // no-op
 }
@@ -58,3 +58,22 @@ iderw(struct buf *b)
     memmove(b->data, p, BSIZE);
   b->flags |= B_VALID;
 }
+
+// Reads from memory finish at once, so release the buffer right
+// away, as ideintr would after a real disk read.
+void
+ideread(struct buf *b)
+{
+  b->flags &= ~B_ASYNC;
+  iderw(b);
+  bprefetchdone(b);
+}
+
+void
+iderwv(struct buf **bs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    iderw(bs[i]);
+}
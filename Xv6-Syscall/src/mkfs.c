@@ -27,17 +27,16 @@ int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
 int fsfd;
+uchar *img;  // the whole image, built in memory and written out once
 struct superblock sb;
-char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
 
 
 void balloc(int);
-void wsect(uint, void*);
+uchar *blk(uint);
 void winode(uint, struct dinode*);
 void rinode(uint inum, struct dinode *ip);
-void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
 
@@ -90,7 +89,13 @@ main(int argc, char *argv[])
     exit(1);
   }
 
-  // 1 fs block = 1 disk sector
+  img = calloc(FSSIZE, BSIZE);
+  if(img == 0){
+    perror("calloc");
+    exit(1);
+  }
+
+  // 1 fs block = BSIZE/512 disk sectors
   nmeta = 2 + nlog + ninodeblocks + nbitmap;
   nblocks = FSSIZE - nmeta;
 
@@ -107,12 +112,7 @@ main(int argc, char *argv[])
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
-    wsect(i, zeroes);
-
-  memset(buf, 0, sizeof(buf));
-  memmove(buf, &sb, sizeof(sb));
-  wsect(1, buf);
+  memmove(blk(1), &sb, sizeof(sb));
 
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
@@ -164,62 +164,39 @@ main(int argc, char *argv[])
 
   balloc(freeblock);
 
+  if(write(fsfd, img, FSSIZE * BSIZE) != FSSIZE * BSIZE){
+    perror("write");
+    exit(1);
+  }
   exit(0);
 }
 
-void
-wsect(uint sec, void *buf)
+// Address of block sec in the image.
+uchar*
+blk(uint sec)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
-    perror("lseek");
-    exit(1);
-  }
-  if(write(fsfd, buf, BSIZE) != BSIZE){
-    perror("write");
-    exit(1);
-  }
+  assert(sec < FSSIZE);
+  return img + sec * BSIZE;
 }
 
 void
 winode(uint inum, struct dinode *ip)
 {
-  char buf[BSIZE];
-  uint bn;
   struct dinode *dip;
 
-  bn = IBLOCK(inum, sb);
-  rsect(bn, buf);
-  dip = ((struct dinode*)buf) + (inum % IPB);
+  dip = ((struct dinode*)blk(IBLOCK(inum, sb))) + (inum % IPB);
   *dip = *ip;
-  wsect(bn, buf);
 }
 
 void
 rinode(uint inum, struct dinode *ip)
 {
-  char buf[BSIZE];
-  uint bn;
   struct dinode *dip;
 
-  bn = IBLOCK(inum, sb);
-  rsect(bn, buf);
-  dip = ((struct dinode*)buf) + (inum % IPB);
+  dip = ((struct dinode*)blk(IBLOCK(inum, sb))) + (inum % IPB);
   *ip = *dip;
 }
 
-void
-rsect(uint sec, void *buf)
-{
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
-    perror("lseek");
-    exit(1);
-  }
-  if(read(fsfd, buf, BSIZE) != BSIZE){
-    perror("read");
-    exit(1);
-  }
-}
-
 uint
 ialloc(ushort type)
 {
@@ -237,17 +214,16 @@ ialloc(ushort type)
 void
 balloc(int used)
 {
-  uchar buf[BSIZE];
+  uchar *bits;
   int i;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < BSIZE*8);
-  bzero(buf, BSIZE);
+  assert(used <= nbitmap*BPB);
+  bits = blk(xint(sb.bmapstart));
   for(i = 0; i < used; i++){
-    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+    bits[i/8] = bits[i/8] | (0x1 << (i%8));
   }
-  printf("balloc: write bitmap block at sector %d\n", sb.bmapstart);
-  wsect(sb.bmapstart, buf);
+  printf("balloc: write bitmap blocks from sector %d\n", xint(sb.bmapstart));
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
@@ -258,12 +234,24 @@ iappend(uint inum, void *xp, int n)
   char *p = (char*)xp;
   uint fbn, off, n1;
   struct dinode din;
-  char buf[BSIZE];
-  uint indirect[NINDIRECT];
+  uint *indirect;
   uint x;
 
   rinode(inum, &din);
   off = xint(din.size);
+  if(xshort(din.type) == T_FILE && off <= NINLINE){
+    if(off + n <= NINLINE){
+      memmove((char*)din.addrs + off, p, n);
+      din.size = xint(off + n);
+      winode(inum, &din);
+      return;
+    }
+    // Too big to stay inline: move what is there to a block.
+    x = freeblock++;
+    bcopy(din.addrs, blk(x), off);
+    memset(din.addrs, 0, sizeof(din.addrs));
+    din.addrs[0] = xint(x);
+  }
   // printf("append inum %d at off %d sz %d\n", inum, off, n);
   while(n > 0){
     fbn = off / BSIZE;
@@ -273,21 +261,33 @@ iappend(uint inum, void *xp, int n)
         din.addrs[fbn] = xint(freeblock++);
       }
       x = xint(din.addrs[fbn]);
-    } else {
+    } else if(fbn < NDIRECT + NINDIRECT){
       if(xint(din.addrs[NDIRECT]) == 0){
         din.addrs[NDIRECT] = xint(freeblock++);
       }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
+      indirect = (uint*)blk(xint(din.addrs[NDIRECT]));
       if(indirect[fbn - NDIRECT] == 0){
         indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
       }
       x = xint(indirect[fbn-NDIRECT]);
+    } else {
+      fbn -= NDIRECT + NINDIRECT;
+      if(xint(din.addrs[NDIRECT+1]) == 0){
+        din.addrs[NDIRECT+1] = xint(freeblock++);
+      }
+      indirect = (uint*)blk(xint(din.addrs[NDIRECT+1]));
+      if(indirect[fbn / NINDIRECT] == 0){
+        indirect[fbn / NINDIRECT] = xint(freeblock++);
+      }
+      indirect = (uint*)blk(xint(indirect[fbn / NINDIRECT]));
+      if(indirect[fbn % NINDIRECT] == 0){
+        indirect[fbn % NINDIRECT] = xint(freeblock++);
+      }
+      x = xint(indirect[fbn % NINDIRECT]);
+      fbn += NDIRECT + NINDIRECT;
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
-    rsect(x, buf);
-    bcopy(p, buf + off - (fbn * BSIZE), n1);
-    wsect(x, buf);
+    bcopy(p, blk(x) + off - (fbn * BSIZE), n1);
     n -= n1;
     off += n1;
     p += n1;
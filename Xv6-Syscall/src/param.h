@@ -3,12 +3,25 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE      100  // maximum number of active i-nodes
+#define NIHASH       61  // hash chains in the inode cache
+#define NIBLOCK       4  // data blocks each cached inode keeps for readi
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define FILEOPBLOCKS (MAXOPBLOCKS*4)  // blocks one filewrite() op may write
+#define DIROPBLOCKS  (MAXOPBLOCKS*2)  // blocks an op adding a name may write
+#define LOGSIZE      (MAXOPBLOCKS*9)  // blocks in the on-disk log mkfs makes
+#define LOGMAX       124  // most data blocks one log header can list
+#define COMMITTICKS  100  // oldest an open log transaction may get
+#define NBUF         (LOGMAX+MAXOPBLOCKS*3)  // minimum size of disk block cache
+#define BCACHEPCT     5  // percent of physical memory for the block cache
+#define NBUCKET    1021  // hash buckets in the block cache
+#define NREADAHEAD    8  // blocks read ahead of a sequential reader
+#define PIPEPAGES     4  // pages of buffer in each pipe
+#define FSSIZE      (10240000/BSIZE)  // size of file system in blocks
+#define NDCACHE       64  // sets in the directory name cache
+#define DCACHEWAYS     4  // names cached per set
+#define SLEEPSPIN   2000  // most polls of a sleep lock whose holder is running
 
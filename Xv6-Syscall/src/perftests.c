@@ -0,0 +1,262 @@
+// Kernel microbenchmarks.  Unlike usertests, which checks that
+// the kernel works, perftests times how fast it is, so a kernel
+// change can be compared against the one before it:
+//
+//   perftests           run every benchmark
+//   perftests name ...  run only the named ones
+//
+// Each result is one line, "name value unit": latencies in
+// time-stamp counter cycles per operation, throughputs in KB per
+// clock tick.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "cycles.h"
+
+#define NSYSCALL  10000
+#define NFORK     100
+#define NEXEC     50
+#define NCREATE   100
+#define PIPEBYTES (1024*1024)
+#define FILEBYTES (1024*1024)
+#define SBRKBYTES (4*1024*1024)
+#define NSBRK     4
+
+static char *self;
+static char buf[4096];
+static unsigned long long pertick;
+
+static unsigned long long
+now(void)
+{
+  struct cycles c;
+
+  cycles(&c);
+  return c.now;
+}
+
+// n / d, by hand: user programs are not linked with the compiler's
+// helper for 64-bit division.
+static unsigned long long
+divide(unsigned long long n, unsigned long long d)
+{
+  unsigned long long q, bit;
+
+  if(d == 0)
+    return 0;
+  q = 0;
+  bit = 1;
+  while(d < n && !(d >> 63)){
+    d <<= 1;
+    bit <<= 1;
+  }
+  for(; bit; d >>= 1, bit >>= 1){
+    if(n >= d){
+      n -= d;
+      q |= bit;
+    }
+  }
+  return q;
+}
+
+static void
+latency(char *name, unsigned long long t, int n)
+{
+  printf(1, "%s %d cycles/op\n", name, (int)divide(t, n));
+}
+
+static void
+throughput(char *name, unsigned long long t, int bytes)
+{
+  printf(1, "%s %d KB/tick\n", name, (int)divide(bytes * pertick, t * 1024));
+}
+
+static void
+fail(char *what)
+{
+  printf(2, "perftests: %s failed\n", what);
+  exit();
+}
+
+// Round trip into the kernel and back.
+void
+syscallperf(void)
+{
+  unsigned long long t;
+  int i;
+
+  t = now();
+  for(i = 0; i < NSYSCALL; i++)
+    getpid();
+  latency("syscall", now() - t, NSYSCALL);
+}
+
+// fork, then the child's exit and the parent's wait.
+void
+forkperf(void)
+{
+  unsigned long long t;
+  int i, pid;
+
+  t = now();
+  for(i = 0; i < NFORK; i++){
+    if((pid = fork()) < 0)
+      fail("fork");
+    if(pid == 0)
+      exit();
+    wait();
+  }
+  latency("fork", now() - t, NFORK);
+}
+
+// fork, exec of this program (which exits straight away), wait.
+void
+execperf(void)
+{
+  unsigned long long t;
+  char *argv[] = { self, "-exit", 0 };
+  int i, pid;
+
+  t = now();
+  for(i = 0; i < NEXEC; i++){
+    if((pid = fork()) < 0)
+      fail("fork");
+    if(pid == 0){
+      exec(self, argv);
+      fail("exec");
+    }
+    wait();
+  }
+  latency("exec", now() - t, NEXEC);
+}
+
+// Bytes from parent to child through a pipe.
+void
+pipeperf(void)
+{
+  unsigned long long t;
+  int fds[2], n, pid;
+
+  if(pipe(fds) < 0)
+    fail("pipe");
+  t = now();
+  if((pid = fork()) < 0)
+    fail("fork");
+  if(pid == 0){
+    close(fds[1]);
+    while(read(fds[0], buf, sizeof(buf)) > 0)
+      ;
+    exit();
+  }
+  close(fds[0]);
+  for(n = 0; n < PIPEBYTES; n += sizeof(buf))
+    if(write(fds[1], buf, sizeof(buf)) != sizeof(buf))
+      fail("pipe write");
+  close(fds[1]);
+  wait();
+  throughput("pipe", now() - t, PIPEBYTES);
+}
+
+// Creating and removing an empty file.
+void
+createperf(void)
+{
+  unsigned long long t;
+  int i, fd;
+
+  t = now();
+  for(i = 0; i < NCREATE; i++){
+    if((fd = open("perffile", O_CREATE|O_RDWR)) < 0)
+      fail("create");
+    close(fd);
+    unlink("perffile");
+  }
+  latency("create", now() - t, NCREATE);
+}
+
+// Writing a file and reading it back.
+void
+fileperf(void)
+{
+  unsigned long long t;
+  int fd, n;
+
+  if((fd = open("perffile", O_CREATE|O_RDWR)) < 0)
+    fail("create");
+  t = now();
+  for(n = 0; n < FILEBYTES; n += sizeof(buf))
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf))
+      fail("file write");
+  close(fd);
+  throughput("filewrite", now() - t, FILEBYTES);
+
+  if((fd = open("perffile", O_RDONLY)) < 0)
+    fail("open");
+  t = now();
+  for(n = 0; n < FILEBYTES; n += sizeof(buf))
+    if(read(fd, buf, sizeof(buf)) != sizeof(buf))
+      fail("file read");
+  close(fd);
+  throughput("fileread", now() - t, FILEBYTES);
+  unlink("perffile");
+}
+
+// Growing the address space and giving the memory back.
+void
+sbrkperf(void)
+{
+  unsigned long long t;
+  int i;
+
+  t = now();
+  for(i = 0; i < NSBRK; i++){
+    if(sbrk(SBRKBYTES) == (char*)-1)
+      fail("sbrk");
+    sbrk(-SBRKBYTES);
+  }
+  throughput("sbrk", now() - t, NSBRK * SBRKBYTES);
+}
+
+struct test {
+  char *name;
+  void (*f)(void);
+} tests[] = {
+  { "syscall", syscallperf },
+  { "fork", forkperf },
+  { "exec", execperf },
+  { "pipe", pipeperf },
+  { "create", createperf },
+  { "file", fileperf },
+  { "sbrk", sbrkperf },
+};
+
+#define NTEST (sizeof(tests) / sizeof(tests[0]))
+
+int
+main(int argc, char *argv[])
+{
+  struct cycles c;
+  int i, j;
+
+  if(argc > 1 && strcmp(argv[1], "-exit") == 0)
+    exit();
+  self = argv[0];
+  if(cycles(&c) < 0 || c.pertick == 0)
+    fail("cycles");
+  pertick = c.pertick;
+
+  printf(1, "pertick %d cycles\n", (int)pertick);
+  for(i = 0; i < NTEST; i++){
+    if(argc > 1){
+      for(j = 1; j < argc; j++)
+        if(strcmp(argv[j], tests[i].name) == 0)
+          break;
+      if(j == argc)
+        continue;
+    }
+    tests[i].f();
+  }
+  exit();
+}
@@ -8,21 +8,36 @@
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+// The buffer is a ring of PIPEPAGES pages, which kalloc need
+// not give contiguously, so data is moved in runs that stop at
+// page boundaries as well as at the end of the ring.
+#define PIPESIZE (PIPEPAGES*PGSIZE)
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data[PIPEPAGES];
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
 };
 
+static void
+pipefree(struct pipe *p)
+{
+  int i;
+
+  for(i = 0; i < PIPEPAGES; i++)
+    if(p->data[i])
+      kfree(p->data[i]);
+  kfree((char*)p);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
   struct pipe *p;
+  int i;
 
   p = 0;
   *f0 = *f1 = 0;
@@ -30,6 +45,10 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((p = (struct pipe*)kalloc()) == 0)
     goto bad;
+  memset(p, 0, sizeof(*p));
+  for(i = 0; i < PIPEPAGES; i++)
+    if((p->data[i] = kalloc()) == 0)
+      goto bad;
   p->readopen = 1;
   p->writeopen = 1;
   p->nwrite = 0;
@@ -48,7 +67,7 @@ pipealloc(struct file **f0, struct file **f1)
 //PAGEBREAK: 20
  bad:
   if(p)
-    kfree((char*)p);
+    pipefree(p);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -69,30 +88,51 @@ pipeclose(struct pipe *p, int writable)
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
-    kfree((char*)p);
+    pipefree(p);
   } else
     release(&p->lock);
 }
 
 //PAGEBREAK: 40
+// Length of the run of data that can be moved at offset off of
+// the ring in one memmove: at most n bytes, and no further than
+// the end of off's page.
+static uint
+piperun(uint off, uint n)
+{
+  uint left;
+
+  left = PGSIZE - off % PGSIZE;
+  return n < left ? n : left;
+}
+
+// Readers sleep only while the pipe is empty and writers only
+// while it is full, so a side is woken only when the other one
+// changes that.
 int
 pipewrite(struct pipe *p, char *addr, int n)
 {
+  uint off, m;
   int i;
 
   acquire(&p->lock);
-  for(i = 0; i < n; i++){
+  for(i = 0; i < n; i += m){
     while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
       if(p->readopen == 0 || myproc()->killed){
         release(&p->lock);
         return -1;
       }
-      wakeup(&p->nread);
       sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    off = p->nwrite % PIPESIZE;
+    m = piperun(off, PIPESIZE - (p->nwrite - p->nread));
+    if(m > n - i)
+      m = n - i;
+    memmove(p->data[off / PGSIZE] + off % PGSIZE, addr + i, m);
+    if(p->nwrite == p->nread)
+      wakeup(&p->nread);  //DOC: pipewrite-wakeup1
+    p->nwrite += m;
   }
-  wakeup(&p->nread);  //DOC: pipewrite-wakeup1
   release(&p->lock);
   return n;
 }
@@ -100,6 +140,7 @@ pipewrite(struct pipe *p, char *addr, int n)
 int
 piperead(struct pipe *p, char *addr, int n)
 {
+  uint off, m;
   int i;
 
   acquire(&p->lock);
@@ -110,12 +151,16 @@ piperead(struct pipe *p, char *addr, int n)
     }
     sleep(&p->nread, &p->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
-      break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+  for(i = 0; i < n && p->nread != p->nwrite; i += m){  //DOC: piperead-copy
+    off = p->nread % PIPESIZE;
+    m = piperun(off, p->nwrite - p->nread);
+    if(m > n - i)
+      m = n - i;
+    memmove(addr + i, p->data[off / PGSIZE] + off % PGSIZE, m);
+    if(p->nwrite == p->nread + PIPESIZE)
+      wakeup(&p->nwrite);  //DOC: piperead-wakeup
+    p->nread += m;
   }
-  wakeup(&p->nwrite);  //DOC: piperead-wakeup
   release(&p->lock);
   return i;
 }
@@ -115,6 +115,31 @@ found:
   return p;
 }
 
+// Create a kernel thread running fn, which must never return.
+// It has no user memory.  Like a new child it starts in forkret,
+// but forkret returns into fn instead of trapret.
+struct proc*
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    return 0;
+  if((p->pgdir = setupkvm()) == 0){
+    kfree(p->kstack);
+    p->kstack = 0;
+    p->state = UNUSED;
+    return 0;
+  }
+  *(uint*)(p->context + 1) = (uint)fn;  // forkret's return address
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  acquire(&ptable.lock);
+  p->state = RUNNABLE;
+  release(&ptable.lock);
+  return p;
+}
+
 //PAGEBREAK: 32
 // Set up first user process.
 void
@@ -159,17 +184,30 @@ int
 growproc(int n)
 {
   uint sz;
+  struct proc *p;
   struct proc *curproc = myproc();
 
+  // Threads share the memory they grow, so ptable.lock keeps two
+  // of them from changing it at once, and all of them get the new
+  // size.  No other cpu's TLB is flushed: a thread that shrinks
+  // memory its siblings are still using is on its own.
+  acquire(&ptable.lock);
   sz = curproc->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0){
+      release(&ptable.lock);
       return -1;
+    }
   } else if(n < 0){
-    if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0){
+      release(&ptable.lock);
       return -1;
+    }
   }
-  curproc->sz = sz;
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    if(p->pgdir == curproc->pgdir)
+      p->sz = sz;
+  release(&ptable.lock);
   switchuvm(curproc);
   return 0;
 }
@@ -221,6 +259,140 @@ fork(void)
   return pid;
 }
 
+// Create a new process running the program at path, as fork
+// followed by exec would, but without copying the caller's memory
+// only to throw it away.  The child gets the caller's descriptors
+// 0, 1 and 2, and no others, so that a caller setting up the
+// child's input and output (a shell building a pipeline) need not
+// worry about its other descriptors leaking into the child.
+// Returns the child's pid, or -1.
+int
+spawn(char *path, char **argv)
+{
+  int i, pid;
+  struct proc *np;
+  struct proc *curproc = myproc();
+
+  if((np = allocproc()) == 0)
+    return -1;
+
+  // The caller's trapframe supplies the user segments and flags;
+  // loadimage replaces the registers that matter.
+  *np->tf = *curproc->tf;
+  np->tf->eax = 0;
+  if((np->pgdir = loadimage(path, argv, np, &np->sz)) == 0){
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+  np->parent = curproc;
+
+  for(i = 0; i < 3; i++)
+    if(curproc->ofile[i])
+      np->ofile[i] = filedup(curproc->ofile[i]);
+  np->cwd = idup(curproc->cwd);
+
+  pid = np->pid;
+
+  acquire(&ptable.lock);
+
+  np->state = RUNNABLE;
+
+  release(&ptable.lock);
+
+  return pid;
+}
+
+// Create a thread: a child process that shares the caller's
+// memory and runs fn(arg) on the page at stack, which must be
+// page-aligned and lie inside the caller's memory.  Like fork, the
+// thread gets its own copies of the open file descriptors.  join
+// waits for it; when fn returns, it returns to 0xffffffff and
+// faults, so it should call exit instead.  Returns the thread's
+// pid, or -1.
+int
+clone(void (*fn)(void*), void *arg, void *stack)
+{
+  int i, pid;
+  uint sp, ustack[2];
+  struct proc *np;
+  struct proc *curproc = myproc();
+
+  if((uint)stack % PGSIZE != 0 || (uint)stack + PGSIZE > curproc->sz)
+    return -1;
+
+  if((np = allocproc()) == 0)
+    return -1;
+
+  sp = (uint)stack + PGSIZE;
+  ustack[0] = 0xffffffff;  // fake return PC
+  ustack[1] = (uint)arg;
+  sp -= sizeof(ustack);
+  if(copyout(curproc->pgdir, sp, ustack, sizeof(ustack)) < 0){
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+
+  np->pgdir = curproc->pgdir;
+  np->sz = curproc->sz;
+  np->parent = curproc;
+  np->ustack = stack;
+  *np->tf = *curproc->tf;
+  np->tf->eip = (uint)fn;
+  np->tf->esp = sp;
+
+  for(i = 0; i < NOFILE; i++)
+    if(curproc->ofile[i])
+      np->ofile[i] = filedup(curproc->ofile[i]);
+  np->cwd = idup(curproc->cwd);
+
+  safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+
+  pid = np->pid;
+
+  acquire(&ptable.lock);
+
+  np->state = RUNNABLE;
+
+  release(&ptable.lock);
+
+  return pid;
+}
+
+// Free the address space pgdir, which p is done with, unless some
+// other thread of p's still has it.  Caller must hold ptable.lock.
+static void
+putvm(pde_t *pgdir, struct proc *p)
+{
+  struct proc *q;
+
+  for(q = ptable.proc; q < &ptable.proc[NPROC]; q++)
+    if(q != p && q->state != UNUSED && q->pgdir == pgdir)
+      return;
+  freevm(pgdir);
+}
+
+// Switch the current process to the address space pgdir, of sz
+// bytes, as exec does, freeing the old one unless other threads
+// still run in it.
+void
+setvm(pde_t *pgdir, uint sz)
+{
+  pde_t *oldpgdir;
+  struct proc *curproc = myproc();
+
+  acquire(&ptable.lock);
+  oldpgdir = curproc->pgdir;
+  curproc->pgdir = pgdir;
+  curproc->sz = sz;
+  putvm(oldpgdir, curproc);
+  release(&ptable.lock);
+  switchuvm(curproc);
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait() to find out it exited.
@@ -252,8 +424,15 @@ exit(void)
   // Parent might be sleeping in wait().
   wakeup1(curproc->parent);
 
-  // Pass abandoned children to init.
+  // Pass abandoned children to init, killing the threads this
+  // one started first.
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->parent == curproc && p->pgdir == curproc->pgdir &&
+       p->state != ZOMBIE){
+      p->killed = 1;
+      if(p->state == SLEEPING)
+        p->state = RUNNABLE;
+    }
     if(p->parent == curproc){
       p->parent = initproc;
       if(p->state == ZOMBIE)
@@ -278,10 +457,11 @@ wait(void)
   
   acquire(&ptable.lock);
   for(;;){
-    // Scan through table looking for exited children.
+    // Scan through table looking for exited children,
+    // leaving threads to join.
     havekids = 0;
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->parent != curproc)
+      if(p->parent != curproc || p->pgdir == curproc->pgdir)
         continue;
       havekids = 1;
       if(p->state == ZOMBIE){
@@ -289,7 +469,8 @@ wait(void)
         pid = p->pid;
         kfree(p->kstack);
         p->kstack = 0;
-        freevm(p->pgdir);
+        putvm(p->pgdir, p);
+        p->pgdir = 0;
         p->pid = 0;
         p->parent = 0;
         p->name[0] = 0;
@@ -311,6 +492,49 @@ wait(void)
   }
 }
 
+// Wait for a thread started by clone to exit, store the stack it
+// was given in *stack, and return its pid.
+// Return -1 if this process has no threads.
+int
+join(void **stack)
+{
+  struct proc *p;
+  int havekids, pid;
+  struct proc *curproc = myproc();
+
+  acquire(&ptable.lock);
+  for(;;){
+    havekids = 0;
+    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+      if(p->parent != curproc || p->pgdir != curproc->pgdir)
+        continue;
+      havekids = 1;
+      if(p->state == ZOMBIE){
+        pid = p->pid;
+        *stack = p->ustack;
+        kfree(p->kstack);
+        p->kstack = 0;
+        p->pgdir = 0;
+        p->ustack = 0;
+        p->pid = 0;
+        p->parent = 0;
+        p->name[0] = 0;
+        p->killed = 0;
+        p->state = UNUSED;
+        release(&ptable.lock);
+        return pid;
+      }
+    }
+
+    if(!havekids || curproc->killed){
+      release(&ptable.lock);
+      return -1;
+    }
+
+    sleep(curproc, &ptable.lock);
+  }
+}
+
 //PAGEBREAK: 42
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
@@ -0,0 +1,199 @@
+// Sampling profiler: run a command with the timer-interrupt sampler
+// on and print where the cpus spent their time.
+//
+//   prof cmd args
+//
+// Kernel addresses are looked up in kernel.sym and user addresses in
+// name.sym, where name is the sampled process's name.  The Makefile
+// copies these files into the file system.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "memlayout.h"
+#include "profile.h"
+
+#define NSYMTAB 16  // symbol files kept in memory
+#define NTOP    20  // functions printed
+
+struct symtab {
+  char name[16];  // "kernel" or the program name
+  int n;          // Symbols, or -1 if the file could not be read
+  uint *addr;
+  char **sym;
+  uint *count;    // Samples that hit each symbol
+  uint other;     // Samples below the first symbol
+};
+
+static struct symtab tabs[NSYMTAB];
+static struct profsample buf[NPROFSAMPLE];
+
+// Source file names share the address of the code in them.
+static int
+isfilename(char *s)
+{
+  int n = strlen(s);
+
+  return n > 2 && s[n-2] == '.' && (s[n-1] == 'c' || s[n-1] == 'S');
+}
+
+static uint
+parsehex(char *s)
+{
+  uint v = 0;
+
+  for(;; s++){
+    if(*s >= '0' && *s <= '9')
+      v = v*16 + *s - '0';
+    else if(*s >= 'a' && *s <= 'f')
+      v = v*16 + *s - 'a' + 10;
+    else
+      return v;
+  }
+}
+
+// Read name.sym, which has one "address name" line per symbol.
+static void
+loadsyms(struct symtab *t)
+{
+  char path[32], *data, *p, *line;
+  struct stat st;
+  int fd, n;
+
+  t->n = -1;
+  strcpy(path, t->name);
+  strcpy(path + strlen(path), ".sym");
+  if((fd = open(path, O_RDONLY)) < 0)
+    return;
+  if(fstat(fd, &st) < 0 || (data = malloc(st.size + 1)) == 0){
+    close(fd);
+    return;
+  }
+  n = read(fd, data, st.size);
+  close(fd);
+  if(n < 0)
+    return;
+  data[n] = 0;
+
+  t->n = 0;
+  for(p = data; *p; p++)
+    if(*p == '\n')
+      t->n++;
+  t->addr = malloc(t->n * sizeof(uint));
+  t->sym = malloc(t->n * sizeof(char*));
+  t->count = malloc(t->n * sizeof(uint));
+  t->n = 0;
+  for(line = p = data; *p; p++){
+    if(*p != '\n')
+      continue;
+    *p = 0;
+    if(strchr(line, ' ') && !isfilename(strchr(line, ' ') + 1)){
+      t->addr[t->n] = parsehex(line);
+      t->sym[t->n] = strchr(line, ' ') + 1;
+      t->count[t->n] = 0;
+      t->n++;
+    }
+    line = p + 1;
+  }
+}
+
+static struct symtab*
+findtab(char *name)
+{
+  int i;
+
+  for(i = 0; i < NSYMTAB && tabs[i].name[0]; i++)
+    if(strcmp(tabs[i].name, name) == 0)
+      return &tabs[i];
+  if(i == NSYMTAB)
+    return 0;
+  strcpy(tabs[i].name, name);
+  loadsyms(&tabs[i]);
+  return &tabs[i];
+}
+
+// Charge one sample to the symbol with the highest address not
+// above eip.
+static void
+count(struct profsample *s)
+{
+  struct symtab *t;
+  int i, best;
+
+  t = findtab(s->eip >= KERNBASE ? "kernel" : s->name);
+  if(t == 0)
+    return;
+  best = -1;
+  for(i = 0; i < t->n; i++)
+    if(t->addr[i] <= s->eip && (best < 0 || t->addr[i] > t->addr[best]))
+      best = i;
+  if(best < 0)
+    t->other++;
+  else
+    t->count[best]++;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, j, n, pid, total, top, bestt, besti;
+  uint c, max;
+
+  if(argc < 2){
+    printf(2, "usage: prof cmd args\n");
+    exit();
+  }
+
+  // Throw away samples from an earlier run.
+  while(profile(1, buf, NPROFSAMPLE) > 0)
+    ;
+  pid = fork();
+  if(pid < 0){
+    printf(2, "prof: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    exec(argv[1], argv+1);
+    printf(2, "prof: exec %s failed\n", argv[1]);
+    exit();
+  }
+  wait();
+  profile(0, 0, 0);
+
+  total = 0;
+  while((n = profile(0, buf, NPROFSAMPLE)) > 0){
+    for(i = 0; i < n; i++)
+      count(&buf[i]);
+    total += n;
+  }
+  if(total == 0){
+    printf(1, "prof: no samples\n");
+    exit();
+  }
+
+  printf(1, "samples %d\n", total);
+  for(top = 0; top < NTOP; top++){
+    max = 0;
+    bestt = besti = 0;
+    for(i = 0; i < NSYMTAB && tabs[i].name[0]; i++){
+      for(j = -1; j < tabs[i].n; j++){
+        c = j < 0 ? tabs[i].other : tabs[i].count[j];
+        if(c > max){
+          max = c;
+          bestt = i;
+          besti = j;
+        }
+      }
+    }
+    if(max == 0)
+      break;
+    printf(1, "%d %d%% %s:%s\n", max, max*100/total, tabs[bestt].name,
+           besti < 0 ? "?" : tabs[bestt].sym[besti]);
+    if(besti < 0)
+      tabs[bestt].other = 0;
+    else
+      tabs[bestt].count[besti] = 0;
+  }
+  exit();
+}
@@ -0,0 +1,85 @@
+// Sampling profiler.
+//
+// While profiling is on, every timer interrupt records the
+// interrupted eip in a per-cpu buffer.  The prof user program
+// drains the buffers with the profile system call and looks the
+// addresses up in kernel.sym and the user programs' .sym files.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "spinlock.h"
+#include "profile.h"
+
+struct profbuf {
+  struct spinlock lock;
+  uint n;                          // Samples in s[]
+  struct profsample s[NPROFSAMPLE];
+};
+
+static struct profbuf profbufs[NCPU];
+static int profiling;
+
+void
+profinit(void)
+{
+  int i;
+
+  for(i = 0; i < NCPU; i++)
+    initlock(&profbufs[i].lock, "prof");
+}
+
+// Called from the timer interrupt on every cpu.  Samples are
+// dropped while the buffer is full.
+void
+profsample(struct trapframe *tf)
+{
+  struct profbuf *b;
+  struct profsample *s;
+  struct proc *p;
+
+  if(!profiling)
+    return;
+  b = &profbufs[cpuid()];
+  p = myproc();
+  acquire(&b->lock);
+  if(b->n < NPROFSAMPLE){
+    s = &b->s[b->n++];
+    s->eip = tf->eip;
+    s->pid = p ? p->pid : 0;
+    if(p)
+      safestrcpy(s->name, p->name, sizeof(s->name));
+    else
+      safestrcpy(s->name, "scheduler", sizeof(s->name));
+  }
+  release(&b->lock);
+}
+
+// Turn sampling on or off, then move up to n samples into buf.
+// Returns the number of samples moved.
+int
+profile(int on, struct profsample *buf, int n)
+{
+  struct profbuf *b;
+  int i, k, got;
+
+  profiling = on;
+  got = 0;
+  for(i = 0; i < ncpu && got < n; i++){
+    b = &profbufs[i];
+    acquire(&b->lock);
+    k = b->n;
+    if(k > n - got)
+      k = n - got;
+    memmove(buf + got, b->s, k*sizeof(b->s[0]));
+    memmove(b->s, b->s + k, (b->n - k)*sizeof(b->s[0]));
+    b->n -= k;
+    got += k;
+    release(&b->lock);
+  }
+  return got;
+}
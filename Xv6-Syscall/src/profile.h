@@ -0,0 +1,9 @@
+// Timer-interrupt samples returned by profile().
+
+#define NPROFSAMPLE 1024  // samples kept per cpu
+
+struct profsample {
+  uint eip;       // Interrupted instruction, >= KERNBASE in the kernel
+  int pid;        // Interrupted process, 0 in the scheduler
+  char name[16];  // Its name, to find name.sym in the file system
+};
@@ -52,6 +52,9 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
+int spawncmd(struct cmd*);
+void startpipe(struct cmd*, int, int*);
 
 // Execute cmd.  Never returns.
 void
@@ -91,7 +94,7 @@ runcmd(struct cmd *cmd)
 
   case LIST:
     lcmd = (struct listcmd*)cmd;
-    if(fork1() == 0)
+    if(!spawncmd(lcmd->left) && fork1() == 0)
       runcmd(lcmd->left);
     wait();
     runcmd(lcmd->right);
@@ -101,20 +104,8 @@ runcmd(struct cmd *cmd)
     pcmd = (struct pipecmd*)cmd;
     if(pipe(p) < 0)
       panic("pipe");
-    if(fork1() == 0){
-      close(1);
-      dup(p[1]);
-      close(p[0]);
-      close(p[1]);
-      runcmd(pcmd->left);
-    }
-    if(fork1() == 0){
-      close(0);
-      dup(p[0]);
-      close(p[0]);
-      close(p[1]);
-      runcmd(pcmd->right);
-    }
+    startpipe(pcmd->left, 1, p);
+    startpipe(pcmd->right, 0, p);
     close(p[0]);
     close(p[1]);
     wait();
@@ -130,6 +121,45 @@ runcmd(struct cmd *cmd)
   exit();
 }
 
+// If cmd is a plain command, start it with spawn, which loads the
+// program straight into a new process instead of copying the shell
+// with fork only for exec to throw the copy away.  Returns 0 if cmd
+// needs a forked shell to run it after all.
+int
+spawncmd(struct cmd *cmd)
+{
+  struct execcmd *ecmd;
+
+  ecmd = (struct execcmd*)cmd;
+  if(cmd == 0 || cmd->type != EXEC || ecmd->argv[0] == 0)
+    return 0;
+  if(spawn(ecmd->argv[0], ecmd->argv) < 0)
+    printf(2, "exec %s failed\n", ecmd->argv[0]);
+  return 1;
+}
+
+// Start cmd as one side of pipe p: in a new process whose file
+// descriptor fd is p[fd].  The shell's own fd is swapped out while
+// the child starts, since spawn passes on descriptors 0-2 only.
+void
+startpipe(struct cmd *cmd, int fd, int *p)
+{
+  int save;
+
+  save = dup(fd);
+  close(fd);
+  dup(p[fd]);
+  if(!spawncmd(cmd) && fork1() == 0){
+    close(save);
+    close(p[0]);
+    close(p[1]);
+    runcmd(cmd);
+  }
+  close(fd);
+  dup(save);
+  close(save);
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -145,6 +175,7 @@ int
 main(void)
 {
   static char buf[100];
+  struct cmd *cmd;
   int fd;
 
   // Ensure that three file descriptors are open.
@@ -164,9 +195,11 @@ main(void)
         printf(2, "cannot cd %s\n", buf+3);
       continue;
     }
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
+    cmd = parsecmd(buf);
+    if(!spawncmd(cmd) && fork1() == 0)
+      runcmd(cmd);
     wait();
+    freecmd(cmd);
   }
   exit();
 }
@@ -491,3 +524,41 @@ nulterminate(struct cmd *cmd)
   }
   return cmd;
 }
+
+// Free the nodes of cmd, which are all malloc'ed by parsecmd.
+void
+freecmd(struct cmd *cmd)
+{
+  struct backcmd *bcmd;
+  struct listcmd *lcmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  if(cmd == 0)
+    return;
+
+  switch(cmd->type){
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    freecmd(rcmd->cmd);
+    break;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    freecmd(pcmd->left);
+    freecmd(pcmd->right);
+    break;
+
+  case LIST:
+    lcmd = (struct listcmd*)cmd;
+    freecmd(lcmd->left);
+    freecmd(lcmd->right);
+    break;
+
+  case BACK:
+    bcmd = (struct backcmd*)cmd;
+    freecmd(bcmd->cmd);
+    break;
+  }
+  free(cmd);
+}
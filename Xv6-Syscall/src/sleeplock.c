@@ -16,18 +16,51 @@ initsleeplock(struct sleeplock *lk, char *name)
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->nshared = 0;
+  lk->xwant = 0;
   lk->pid = 0;
+  lk->owner = 0;
 }
 
+// Is lk held exclusively by a process running on another CPU?
+// Read without lk->lk, so only a hint.
+static int
+holderrunning(struct sleeplock *lk)
+{
+  struct proc *p;
+
+  if(!*(volatile uint*)&lk->locked)
+    return 0;
+  p = *(struct proc* volatile*)&lk->owner;
+  return p != 0 && *(volatile enum procstate*)&p->state == RUNNING;
+}
+
+// A holder that is running will likely release the lock soon,
+// as for a buffer being copied, so poll for up to SLEEPSPIN
+// times before sleeping, which would cost a wakeup and two
+// context switches.
 void
 acquiresleep(struct sleeplock *lk)
 {
+  int i;
+
   acquire(&lk->lk);
-  while (lk->locked) {
+  lk->xwant++;
+  while (lk->locked || lk->nshared) {
+    if(holderrunning(lk)){
+      release(&lk->lk);
+      for(i = 0; i < SLEEPSPIN && holderrunning(lk); i++)
+        pause();
+      acquire(&lk->lk);
+      if(!lk->locked && !lk->nshared)
+        break;
+    }
     sleep(lk, &lk->lk);
   }
+  lk->xwant--;
   lk->locked = 1;
   lk->pid = myproc()->pid;
+  lk->owner = myproc();
   release(&lk->lk);
 }
 
@@ -37,6 +70,50 @@ releasesleep(struct sleeplock *lk)
   acquire(&lk->lk);
   lk->locked = 0;
   lk->pid = 0;
+  lk->owner = 0;
+  wakeup(lk);
+  release(&lk->lk);
+}
+
+// Hold lk shared: any number of processes may hold it so at
+// once, but not while someone holds it exclusively.  A process
+// waiting for it exclusively holds off new shared holders, so
+// that a steady stream of them cannot starve it.
+void
+acquiresleepshared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  while (lk->locked || lk->xwant) {
+    sleep(lk, &lk->lk);
+  }
+  lk->nshared++;
+  release(&lk->lk);
+}
+
+void
+releasesleepshared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  if(lk->nshared == 0)
+    panic("releasesleepshared");
+  if(--lk->nshared == 0)
+    wakeup(lk);
+  release(&lk->lk);
+}
+
+// Turn the caller's exclusive hold on lk into a shared one,
+// letting other shared holders in without a window in which
+// a writer could take the lock.
+void
+downgradesleep(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  if(!lk->locked || lk->pid != myproc()->pid)
+    panic("downgradesleep");
+  lk->locked = 0;
+  lk->pid = 0;
+  lk->owner = 0;
+  lk->nshared++;
   wakeup(lk);
   release(&lk->lk);
 }
@@ -1,10 +1,14 @@
 // Long-term locks for processes
 struct sleeplock {
-  uint locked;       // Is the lock held?
+  uint locked;       // Is the lock held exclusively?
+  uint nshared;      // Processes holding it shared
+  uint xwant;        // Processes waiting to hold it exclusively
   struct spinlock lk; // spinlock protecting this sleep lock
   
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+
+  struct proc *owner; // Process holding lock exclusively, 0 if none
 };
 
@@ -8,49 +8,115 @@
 #include "mmu.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "lockstat.h"
+
+// Contention statistics, one class per lock name, so that e.g. all
+// the "pipe" locks are counted together.  Each class has a row per
+// cpu that only that cpu updates, while holding a lock of the class
+// with interrupts off, so the counters need no lock of their own.
+struct lockclass {
+  char *name;
+  struct {
+    uint acquires;
+    uint contended;
+    uint spins;
+    uint maxhold;
+    unsigned long long hold;
+  } cpu[NCPU];
+};
+
+static struct lockclass lockclasses[NLOCKSTAT];
+
+// Find or claim the class for name.  Returns 0 if the table is
+// full, in which case locks of that name are not profiled.
+static struct lockclass*
+lockclass(char *name)
+{
+  char *old;
+  int i;
+
+  for(i = 0; i < NLOCKSTAT; i++){
+    old = __sync_val_compare_and_swap(&lockclasses[i].name, 0, name);
+    if(old == 0 || strncmp(old, name, LOCKNAME) == 0)
+      return &lockclasses[i];
+  }
+  return 0;
+}
 
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
   lk->locked = 0;
+  lk->next = 0;
+  lk->owner = 0;
   lk->cpu = 0;
+  lk->class = lockclass(name);
 }
 
 // Acquire the lock.
 // Loops (spins) until the lock is acquired.
 // Holding a lock for a long time may cause
 // other CPUs to waste time spinning to acquire it.
+// This is a ticket lock: CPUs get the lock in the order they asked
+// for it, and waiters only read owner while spinning instead of
+// bouncing the cache line between them with xchg.
 void
 acquire(struct spinlock *lk)
 {
+  uint ticket, spins;
+
   pushcli(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  // The xchg is atomic.
-  while(xchg(&lk->locked, 1) != 0)
-    ;
+  // The fetch-and-add is atomic.
+  ticket = __sync_fetch_and_add(&lk->next, 1);
+  spins = 0;
+  while(lk->owner != ticket){
+    spins++;
+    pause();
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
   // references happen after the lock is acquired.
   __sync_synchronize();
+  lk->locked = 1;
 
   // Record info about lock acquisition for debugging.
   lk->cpu = mycpu();
   getcallerpcs(&lk, lk->pcs);
+
+  if(lk->class){
+    lk->class->cpu[lk->cpu - cpus].acquires++;
+    if(spins){
+      lk->class->cpu[lk->cpu - cpus].contended++;
+      lk->class->cpu[lk->cpu - cpus].spins += spins;
+    }
+    lk->start = rdtsc();
+  }
 }
 
 // Release the lock.
 void
 release(struct spinlock *lk)
 {
+  uint held;
+
   if(!holding(lk))
     panic("release");
 
+  if(lk->class){
+    held = rdtsc() - lk->start;
+    lk->class->cpu[lk->cpu - cpus].hold += held;
+    if(held > lk->class->cpu[lk->cpu - cpus].maxhold)
+      lk->class->cpu[lk->cpu - cpus].maxhold = held;
+  }
+
   lk->pcs[0] = 0;
   lk->cpu = 0;
+  lk->locked = 0;
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that all the stores in the critical
@@ -59,14 +125,47 @@ release(struct spinlock *lk)
   // stores; __sync_synchronize() tells them both not to.
   __sync_synchronize();
 
-  // Release the lock, equivalent to lk->locked = 0.
-  // This code can't use a C assignment, since it might
-  // not be atomic. A real OS would use C atomics here.
-  asm volatile("movl $0, %0" : "+m" (lk->locked) : );
+  // Hand the lock to the next ticket, equivalent to lk->owner++.
+  // Only the holder writes owner, so the increment need not be
+  // locked, but it must be a single store. A real OS would use C
+  // atomics here.
+  asm volatile("incl %0" : "+m" (lk->owner) : );
 
   popcli();
 }
 
+// Copy the statistics of the first n lock classes, summed over all
+// cpus, to st and return the number of classes in use.
+int
+getlockstats(struct lockstat *st, int n)
+{
+  struct lockclass *lc;
+  unsigned long long hold;
+  int i, c, used;
+
+  used = 0;
+  for(i = 0; i < NLOCKSTAT && lockclasses[i].name; i++)
+    used++;
+  if(n > used)
+    n = used;
+  for(i = 0; i < n; i++){
+    lc = &lockclasses[i];
+    memset(&st[i], 0, sizeof(st[i]));
+    safestrcpy(st[i].name, lc->name, LOCKNAME);
+    hold = 0;
+    for(c = 0; c < ncpu; c++){
+      st[i].acquires += lc->cpu[c].acquires;
+      st[i].contended += lc->cpu[c].contended;
+      st[i].spins += lc->cpu[c].spins;
+      if(lc->cpu[c].maxhold > st[i].maxhold)
+        st[i].maxhold = lc->cpu[c].maxhold;
+      hold += lc->cpu[c].hold;
+    }
+    st[i].khold = hold >> 10;
+  }
+  return used;
+}
+
 // Record the current call stack in pcs[] by following the %ebp chain.
 void
 getcallerpcs(void *v, uint pcs[])
@@ -1,11 +1,17 @@
 // Mutual exclusion lock.
 struct spinlock {
   uint locked;       // Is the lock held?
+  volatile uint next;   // Next ticket to hand out.
+  volatile uint owner;  // Ticket now allowed to hold the lock.
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
   uint pcs[10];      // The call stack (an array of program counters)
                      // that locked the lock.
+
+  // For profiling (see lockstat.h):
+  struct lockclass *class;   // Statistics shared by locks of this name.
+  unsigned long long start;  // rdtsc() when the lock was acquired.
 };
 
@@ -1,14 +1,33 @@
 #include "types.h"
 #include "x86.h"
 
+// Bytes to go from p to the next 4-byte boundary, at most n.
+static uint
+headbytes(const void *p, uint n)
+{
+  uint h;
+
+  h = -(uint)p % 4;
+  return h < n ? h : n;
+}
+
+// memset and memmove store 4 bytes at a time once the
+// destination is aligned, with a byte at a time only at the
+// ends.
 void*
 memset(void *dst, int c, uint n)
 {
-  if ((int)dst%4 == 0 && n%4 == 0){
-    c &= 0xFF;
-    stosl(dst, (c<<24)|(c<<16)|(c<<8)|c, n/4);
-  } else
-    stosb(dst, c, n);
+  char *d;
+  uint h;
+
+  d = dst;
+  c &= 0xFF;
+  h = headbytes(d, n);
+  stosb(d, c, h);
+  d += h;
+  n -= h;
+  stosl(d, (c<<24)|(c<<16)|(c<<8)|c, n/4);
+  stosb(d + n - n%4, c, n%4);
   return dst;
 }
 
@@ -34,16 +53,26 @@ memmove(void *dst, const void *src, uint n)
   const char *s;
   char *d;
 
+  uint h;
+
   s = src;
   d = dst;
   if(s < d && s + n > d){
+    // Overlapping, with dst above src: copy backward.
     s += n;
     d += n;
     while(n-- > 0)
       *--d = *--s;
+  } else if(((uint)s - (uint)d) % 4 == 0){
+    h = headbytes(d, n);
+    movsb(d, s, h);
+    d += h;
+    s += h;
+    n -= h;
+    movsl(d, s, n/4);
+    movsb(d + n - n%4, s + n - n%4, n%4);
   } else
-    while(n-- > 0)
-      *d++ = *s++;
+    movsb(d, s, n);
 
   return dst;
 }
@@ -0,0 +1,25 @@
+#!/usr/bin/perl
+
+# Split a file system image for a disk striped over two:
+# even blocks go to the first output, odd blocks to the second.
+# usage: stripe.pl blocksize fs.img fs0.img fs1.img
+
+($bsize, $in, $out0, $out1) = @ARGV;
+
+open(IN, $in) || die "open $in: $!";
+open(OUT0, ">$out0") || die "open >$out0: $!";
+open(OUT1, ">$out1") || die "open >$out1: $!";
+binmode IN;
+binmode OUT0;
+binmode OUT1;
+
+for($i = 0; sysread(IN, $buf, $bsize) == $bsize; $i++){
+  if($i % 2 == 0){
+    print OUT0 $buf;
+  } else {
+    print OUT1 $buf;
+  }
+}
+
+close OUT0;
+close OUT1;
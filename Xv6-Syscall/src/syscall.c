@@ -6,6 +6,7 @@
 #include "proc.h"
 #include "x86.h"
 #include "syscall.h"
+#include "sysstat.h"
 
 // User code makes a system call with INT T_SYSCALL.
 // System call number in %eax.
@@ -32,6 +33,7 @@ int
 fetchstr(uint addr, char **pp)
 {
   char *s, *ep;
+  uint w;
   struct proc *curproc = myproc();
 
   if(addr >= curproc->sz)
@@ -39,6 +41,15 @@ fetchstr(uint addr, char **pp)
   *pp = (char*)addr;
   ep = (char*)curproc->sz;
   for(s = *pp; s < ep; s++){
+    // Skip aligned words with no zero byte in them, which are
+    // those where (w - 0x01010101) & ~w & 0x80808080 is 0.
+    if((uint)s % 4 == 0 && s + 4 <= ep){
+      w = *(uint*)s;
+      if(((w - 0x01010101) & ~w & 0x80808080) == 0){
+        s += 3;
+        continue;
+      }
+    }
     if(*s == 0)
       return s - *pp;
   }
@@ -104,6 +115,22 @@ extern int sys_wait(void);
 extern int sys_write(void);
 extern int sys_uptime(void);
 extern int sys_getreadcount(void);
+static int sys_getsysstats(void);
+extern int sys_sync(void);
+extern int sys_getlockstats(void);
+extern int sys_profile(void);
+extern int sys_sendfile(void);
+extern int sys_readv(void);
+extern int sys_writev(void);
+extern int sys_pread(void);
+extern int sys_pwrite(void);
+extern int sys_submit(void);
+extern int sys_cycles(void);
+extern int sys_spawn(void);
+extern int sys_clone(void);
+extern int sys_join(void);
+extern int sys_futex_wait(void);
+extern int sys_futex_wake(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -128,17 +155,88 @@ static int (*syscalls[])(void) = {
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
 [SYS_getreadcount] sys_getreadcount,
+[SYS_getsysstats] sys_getsysstats,
+[SYS_sync]    sys_sync,
+[SYS_getlockstats] sys_getlockstats,
+[SYS_profile] sys_profile,
+[SYS_sendfile] sys_sendfile,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_submit]  sys_submit,
+[SYS_cycles]  sys_cycles,
+[SYS_spawn]   sys_spawn,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_futex_wait] sys_futex_wait,
+[SYS_futex_wake] sys_futex_wake,
 };
 
+// Per-cpu statistics for every system call number below NSYSCALL,
+// which must stay one past the last entry of syscalls[].  A cpu only
+// updates its own row, with interrupts off, so no lock is needed;
+// getsysstats sums the rows.  Calls that never return (exit) are
+// not counted.
+static struct sysstat sysstats[NCPU][NSYSSTAT];
+
+// Record one call of num that started at tick start.
+static void
+sysstat_record(int num, uint start)
+{
+  struct sysstat *st;
+  uint elapsed, b;
+
+  if(num >= NSYSSTAT)
+    return;
+  elapsed = ticks - start;
+  for(b = 0; b < NSYSHIST-1 && elapsed >= (1 << b); b++)
+    ;
+  pushcli();
+  st = &sysstats[cpuid()][num];
+  st->calls++;
+  st->ticks += elapsed;
+  st->hist[b]++;
+  popcli();
+}
+
+// getsysstats(struct sysstat *st, int n): copy the first n entries
+// of the table, summed over all cpus, and return the number of
+// entries the kernel keeps.
+static int
+sys_getsysstats(void)
+{
+  struct sysstat *st;
+  int n, num, c, b;
+
+  if(argint(1, &n) < 0 || n < 0 || argptr(0, (char**)&st, n*sizeof(*st)) < 0)
+    return -1;
+  if(n > NSYSSTAT)
+    n = NSYSSTAT;
+  for(num = 0; num < n; num++){
+    memset(&st[num], 0, sizeof(st[num]));
+    for(c = 0; c < ncpu; c++){
+      st[num].calls += sysstats[c][num].calls;
+      st[num].ticks += sysstats[c][num].ticks;
+      for(b = 0; b < NSYSHIST; b++)
+        st[num].hist[b] += sysstats[c][num].hist[b];
+    }
+  }
+  return NSYSSTAT;
+}
+
 void
 syscall(void)
 {
   int num;
+  uint start;
   struct proc *curproc = myproc();
 
   num = curproc->tf->eax;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
+    start = ticks;
     curproc->tf->eax = syscalls[num]();
+    sysstat_record(num, start);
   } else {
     cprintf("%d %s: unknown sys call %d\n",
             curproc->pid, curproc->name, num);
@@ -21,6 +21,24 @@
 #define SYS_mkdir  20
 #define SYS_close  21
 #define SYS_getreadcount 22
+#define SYS_getsysstats 23
+#define SYS_sync   24
+#define SYS_getlockstats 25
+#define SYS_profile 26
+#define SYS_sendfile 27
+#define SYS_readv  28
+#define SYS_writev 29
+#define SYS_pread  30
+#define SYS_pwrite 31
+#define SYS_submit 32
+#define SYS_cycles 33
+#define SYS_spawn  34
+#define SYS_clone  35
+#define SYS_join   36
+#define SYS_futex_wait 37
+#define SYS_futex_wake 38
+
+#define NSYSCALL (SYS_futex_wake+1)  // one past the highest number
 
 
 
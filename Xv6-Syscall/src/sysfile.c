@@ -15,11 +15,18 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "uio.h"
+#include "ioring.h"
+#include "kshared.h"
 
-struct {
-  struct spinlock lock;
-  int count;
-} readcount;
+// Return the current process's open file for fd, or 0.
+static struct file*
+fdfile(int fd)
+{
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  return myproc()->ofile[fd];
+}
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -31,7 +38,7 @@ argfd(int n, int *pfd, struct file **pf)
 
   if(argint(n, &fd) < 0)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if((f = fdfile(fd)) == 0)
     return -1;
   if(pfd)
     *pfd = fd;
@@ -71,13 +78,33 @@ sys_dup(void)
   return fd;
 }
 
+// Sum the per-cpu read counters.  Each counter is only written by
+// its own cpu, so the total is a snapshot rather than an exact
+// instant, which is all a counter needs.
+uint
+readcount(void)
+{
+  uint count = 0;
+  int i;
+
+  for(i = 0; i < ncpu; i++)
+    count += kshared->cpu[i].readcount;
+  return count;
+}
+
 int
 sys_getreadcount(void)
 {
-  acquire(&readcount.lock);
-  int count = readcount.count;
-  release(&readcount.lock);
-  return count;
+  return readcount();
+}
+
+// Wait for the commit thread to commit everything logged so
+// far, so it is on disk when sync returns.
+int
+sys_sync(void)
+{
+  log_flush();
+  return 0;
 }
 
 int
@@ -87,9 +114,10 @@ sys_read(void)
   int n;
   char *p;
 
-  acquire(&readcount.lock);
-  readcount.count++;
-  release(&readcount.lock);
+  // No lock: interrupts are off, so nothing else touches this cpu's counter.
+  pushcli();
+  kshared->cpu[cpuid()].readcount++;
+  popcli();
 
   if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
     return -1;
@@ -109,6 +137,107 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+// Fetch the nth system call argument, an array of cnt iovecs,
+// into iov, checking that each buffer lies inside the process.
+static int
+argiov(int n, int cnt, struct iovec *iov)
+{
+  struct proc *curproc = myproc();
+  char *p;
+  int i;
+
+  if(cnt < 0 || cnt > NIOV)
+    return -1;
+  if(argptr(n, &p, cnt*sizeof(struct iovec)) < 0)
+    return -1;
+  memmove(iov, p, cnt*sizeof(struct iovec));
+  for(i = 0; i < cnt; i++)
+    if(iov[i].len < 0 || (uint)iov[i].base >= curproc->sz ||
+       (uint)iov[i].base + iov[i].len > curproc->sz)
+      return -1;
+  return 0;
+}
+
+// readv(fd, iov, cnt): read into cnt buffers with one call,
+// counted as one read.
+int
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[NIOV];
+  int cnt;
+
+  pushcli();
+  kshared->cpu[cpuid()].readcount++;
+  popcli();
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &cnt) < 0 || argiov(1, cnt, iov) < 0)
+    return -1;
+  return filereadv(f, iov, cnt);
+}
+
+// writev(fd, iov, cnt): write cnt buffers with one call.
+int
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[NIOV];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &cnt) < 0 || argiov(1, cnt, iov) < 0)
+    return -1;
+  return filewritev(f, iov, cnt);
+}
+
+// pread(fd, buf, n, off): read n bytes at offset off without
+// moving the file's offset, counted as a read.
+int
+sys_pread(void)
+{
+  struct file *f;
+  int n, off;
+  char *p;
+
+  pushcli();
+  kshared->cpu[cpuid()].readcount++;
+  popcli();
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  return filepread(f, p, n, off);
+}
+
+// pwrite(fd, buf, n, off): write n bytes at offset off without
+// moving the file's offset.
+int
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  return filepwrite(f, p, n, off);
+}
+
+// sendfile(out, in, n): move up to n bytes from fd in to fd out
+// inside the kernel, stopping early at the end of in.
+int
+sys_sendfile(void)
+{
+  struct file *out, *in;
+  int n;
+
+  if(argfd(0, 0, &out) < 0 || argfd(1, 0, &in) < 0 || argint(2, &n) < 0)
+    return -1;
+  if(n < 0)
+    return -1;
+  return filesend(out, in, n);
+}
+
 int
 sys_close(void)
 {
@@ -139,20 +268,21 @@ sys_link(void)
 {
   char name[DIRSIZ], *new, *old;
   struct inode *dp, *ip;
+  int nb;
 
   if(argstr(0, &old) < 0 || argstr(1, &new) < 0)
     return -1;
 
-  begin_op();
+  nb = begin_opn(DIROPBLOCKS);
   if((ip = namei(old)) == 0){
-    end_op();
+    end_opn(nb);
     return -1;
   }
 
   ilock(ip);
   if(ip->type == T_DIR){
     iunlockput(ip);
-    end_op();
+    end_opn(nb);
     return -1;
   }
 
@@ -170,7 +300,7 @@ sys_link(void)
   iunlockput(dp);
   iput(ip);
 
-  end_op();
+  end_opn(nb);
 
   return 0;
 
@@ -179,7 +309,7 @@ bad:
   ip->nlink--;
   iupdate(ip);
   iunlockput(ip);
-  end_op();
+  end_opn(nb);
   return -1;
 }
 
@@ -204,7 +334,6 @@ int
 sys_unlink(void)
 {
   struct inode *ip, *dp;
-  struct dirent de;
   char name[DIRSIZ], *path;
   uint off;
 
@@ -234,9 +363,7 @@ sys_unlink(void)
     goto bad;
   }
 
-  memset(&de, 0, sizeof(de));
-  if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-    panic("unlink: writei");
+  dirunlink(dp, name, off);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -301,34 +428,32 @@ create(char *path, short type, short major, short minor)
   return ip;
 }
 
-int
-sys_open(void)
+// Open path with mode omode in a new file descriptor.
+static int
+openpath(char *path, int omode)
 {
-  char *path;
-  int fd, omode;
+  int fd;
   struct file *f;
   struct inode *ip;
+  int nb;
 
-  if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
-    return -1;
-
-  begin_op();
+  nb = begin_opn(omode & O_CREATE ? DIROPBLOCKS : MAXOPBLOCKS);
 
   if(omode & O_CREATE){
     ip = create(path, T_FILE, 0, 0);
     if(ip == 0){
-      end_op();
+      end_opn(nb);
       return -1;
     }
   } else {
     if((ip = namei(path)) == 0){
-      end_op();
+      end_opn(nb);
       return -1;
     }
-    ilock(ip);
+    ilockshared(ip);
     if(ip->type == T_DIR && omode != O_RDONLY){
       iunlockput(ip);
-      end_op();
+      end_opn(nb);
       return -1;
     }
   }
@@ -337,33 +462,46 @@ sys_open(void)
     if(f)
       fileclose(f);
     iunlockput(ip);
-    end_op();
+    end_opn(nb);
     return -1;
   }
   iunlock(ip);
-  end_op();
+  end_opn(nb);
 
   f->type = FD_INODE;
   f->ip = ip;
   f->off = 0;
+  f->raoff = 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
   return fd;
 }
 
+int
+sys_open(void)
+{
+  char *path;
+  int omode;
+
+  if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
+    return -1;
+  return openpath(path, omode);
+}
+
 int
 sys_mkdir(void)
 {
   char *path;
   struct inode *ip;
+  int nb;
 
-  begin_op();
+  nb = begin_opn(DIROPBLOCKS);
   if(argstr(0, &path) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
-    end_op();
+    end_opn(nb);
     return -1;
   }
   iunlockput(ip);
-  end_op();
+  end_opn(nb);
   return 0;
 }
 
@@ -372,18 +510,18 @@ sys_mknod(void)
 {
   struct inode *ip;
   char *path;
-  int major, minor;
+  int major, minor, nb;
 
-  begin_op();
+  nb = begin_opn(DIROPBLOCKS);
   if((argstr(0, &path)) < 0 ||
      argint(1, &major) < 0 ||
      argint(2, &minor) < 0 ||
      (ip = create(path, T_DEV, major, minor)) == 0){
-    end_op();
+    end_opn(nb);
     return -1;
   }
   iunlockput(ip);
-  end_op();
+  end_opn(nb);
   return 0;
 }
 
@@ -399,7 +537,7 @@ sys_chdir(void)
     end_op();
     return -1;
   }
-  ilock(ip);
+  ilockshared(ip);
   if(ip->type != T_DIR){
     iunlockput(ip);
     end_op();
@@ -412,19 +550,19 @@ sys_chdir(void)
   return 0;
 }
 
-int
-sys_exec(void)
+// Fetch the path and argument vector of exec and spawn.
+static int
+argexec(char **path, char *argv[MAXARG])
 {
-  char *path, *argv[MAXARG];
   int i;
   uint uargv, uarg;
 
-  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0){
+  if(argstr(0, path) < 0 || argint(1, (int*)&uargv) < 0){
     return -1;
   }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(argv[0]));
   for(i=0;; i++){
-    if(i >= NELEM(argv))
+    if(i >= MAXARG)
       return -1;
     if(fetchint(uargv+4*i, (int*)&uarg) < 0)
       return -1;
@@ -435,9 +573,31 @@ sys_exec(void)
     if(fetchstr(uarg, &argv[i]) < 0)
       return -1;
   }
+  return 0;
+}
+
+int
+sys_exec(void)
+{
+  char *path, *argv[MAXARG];
+
+  if(argexec(&path, argv) < 0)
+    return -1;
   return exec(path, argv);
 }
 
+// spawn(path, argv): start the program at path in a new child
+// process and return its pid.
+int
+sys_spawn(void)
+{
+  char *path, *argv[MAXARG];
+
+  if(argexec(&path, argv) < 0)
+    return -1;
+  return spawn(path, argv);
+}
+
 int
 sys_pipe(void)
 {
@@ -461,3 +621,62 @@ sys_pipe(void)
   fd[1] = fd1;
   return 0;
 }
+
+// Carry out submission e from an I/O ring and return what the
+// system call it stands for would have.
+static int
+ioringop(struct sqe *e)
+{
+  struct proc *curproc = myproc();
+  struct file *f;
+  char *path;
+
+  switch(e->op){
+  case IORING_READ:
+  case IORING_WRITE:
+    if((f = fdfile(e->fd)) == 0 || e->n < 0 ||
+       (uint)e->buf >= curproc->sz || (uint)e->buf + e->n > curproc->sz)
+      return -1;
+    if(e->op == IORING_READ)
+      return fileread(f, e->buf, e->n);
+    return filewrite(f, e->buf, e->n);
+  case IORING_OPEN:
+    if(fetchstr((uint)e->buf, &path) < 0)
+      return -1;
+    return openpath(path, e->fd);
+  case IORING_CLOSE:
+    if((f = fdfile(e->fd)) == 0)
+      return -1;
+    curproc->ofile[e->fd] = 0;
+    fileclose(f);
+    return 0;
+  }
+  return -1;
+}
+
+// submit(ring): carry out the queued submissions of ring in
+// order, posting a completion for each, until the submission
+// ring is empty or the completion ring is full.  Returns the
+// number carried out.
+int
+sys_submit(void)
+{
+  struct ioring *r;
+  struct sqe e;
+  struct cqe *c;
+  char *p;
+  int n;
+
+  if(argptr(0, &p, sizeof(struct ioring)) < 0)
+    return -1;
+  r = (struct ioring*)p;
+  for(n = 0; r->sqhead != r->sqtail && r->cqtail - r->cqhead < NRING; n++){
+    e = r->sq[r->sqhead % NRING];
+    r->sqhead++;
+    c = &r->cq[r->cqtail % NRING];
+    c->data = e.data;
+    c->res = ioringop(&e);
+    r->cqtail++;
+  }
+  return n;
+}
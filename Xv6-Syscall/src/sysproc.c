@@ -6,6 +6,9 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "lockstat.h"
+#include "cycles.h"
+#include "profile.h"
 
 int
 sys_fork(void)
@@ -26,6 +29,58 @@ sys_wait(void)
   return wait();
 }
 
+// clone(fn, arg, stack): start a thread running fn(arg) on the
+// page at stack.
+int
+sys_clone(void)
+{
+  int fn, arg;
+  char *stack;
+
+  if(argint(0, &fn) < 0 || argint(1, &arg) < 0 ||
+     argptr(2, &stack, PGSIZE) < 0)
+    return -1;
+  return clone((void (*)(void*))fn, (void*)arg, stack);
+}
+
+// join(void **stack): wait for a thread to exit.
+int
+sys_join(void)
+{
+  void **stack;
+
+  if(argptr(0, (char**)&stack, sizeof(*stack)) < 0)
+    return -1;
+  return join(stack);
+}
+
+// futex_wait(addr, val): sleep until woken if the word at addr
+// holds val.
+int
+sys_futex_wait(void)
+{
+  char *addr;
+  int val;
+
+  if(argptr(0, &addr, sizeof(int)) < 0 || (uint)addr % sizeof(int) != 0 ||
+     argint(1, &val) < 0)
+    return -1;
+  return futexwait(addr, val);
+}
+
+// futex_wake(addr, n): wake up to n processes waiting on addr.
+int
+sys_futex_wake(void)
+{
+  char *addr;
+  int n;
+
+  if(argptr(0, &addr, sizeof(int)) < 0 || (uint)addr % sizeof(int) != 0 ||
+     argint(1, &n) < 0)
+    return -1;
+  return futexwake(addr, n);
+}
+
 int
 sys_kill(void)
 {
@@ -89,3 +144,44 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// getlockstats(struct lockstat *st, int n): copy the statistics of
+// the first n lock classes and return the number of classes in use.
+int
+sys_getlockstats(void)
+{
+  struct lockstat *st;
+  int n;
+
+  if(argint(1, &n) < 0 || n < 0 || argptr(0, (char**)&st, n*sizeof(*st)) < 0)
+    return -1;
+  return getlockstats(st, n);
+}
+
+// cycles(struct cycles *c): read this cpu's time-stamp counter,
+// and how fast it runs as measured against the lapic timer.
+int
+sys_cycles(void)
+{
+  struct cycles *c;
+
+  if(argptr(0, (char**)&c, sizeof(*c)) < 0)
+    return -1;
+  c->now = rdtsc();
+  c->pertick = tscpertick;
+  return 0;
+}
+
+// profile(int on, struct profsample *buf, int n): turn the sampling
+// profiler on or off and move up to n samples into buf.
+int
+sys_profile(void)
+{
+  struct profsample *buf;
+  int on, n;
+
+  if(argint(0, &on) < 0 || argint(2, &n) < 0 || n < 0 ||
+     argptr(1, (char**)&buf, n*sizeof(*buf)) < 0)
+    return -1;
+  return profile(on, buf, n);
+}
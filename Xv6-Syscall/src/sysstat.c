@@ -0,0 +1,94 @@
+// Print per-syscall call counts and latency histograms.
+//
+//   sysstat            totals since boot
+//   sysstat cmd args   counts for the duration of running cmd
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "syscall.h"
+#include "sysstat.h"
+
+static char *names[NSYSSTAT] = {
+[SYS_fork]    "fork",
+[SYS_exit]    "exit",
+[SYS_wait]    "wait",
+[SYS_pipe]    "pipe",
+[SYS_read]    "read",
+[SYS_kill]    "kill",
+[SYS_exec]    "exec",
+[SYS_fstat]   "fstat",
+[SYS_chdir]   "chdir",
+[SYS_dup]     "dup",
+[SYS_getpid]  "getpid",
+[SYS_sbrk]    "sbrk",
+[SYS_sleep]   "sleep",
+[SYS_uptime]  "uptime",
+[SYS_open]    "open",
+[SYS_write]   "write",
+[SYS_mknod]   "mknod",
+[SYS_unlink]  "unlink",
+[SYS_link]    "link",
+[SYS_mkdir]   "mkdir",
+[SYS_close]   "close",
+[SYS_getreadcount] "getreadcount",
+[SYS_getsysstats]  "getsysstats",
+[SYS_sync]    "sync",
+[SYS_getlockstats] "getlockstats",
+[SYS_profile] "profile",
+[SYS_sendfile] "sendfile",
+[SYS_readv]   "readv",
+[SYS_writev]  "writev",
+[SYS_pread]   "pread",
+[SYS_pwrite]  "pwrite",
+[SYS_submit]  "submit",
+[SYS_cycles]  "cycles",
+[SYS_spawn]   "spawn",
+[SYS_clone]   "clone",
+[SYS_join]    "join",
+[SYS_futex_wait] "futex_wait",
+[SYS_futex_wake] "futex_wake",
+};
+
+static struct sysstat before[NSYSSTAT], after[NSYSSTAT];
+
+int
+main(int argc, char *argv[])
+{
+  int num, b, pid;
+
+  if(argc > 1){
+    if(getsysstats(before, NSYSSTAT) < 0){
+      printf(2, "sysstat: getsysstats failed\n");
+      exit();
+    }
+    pid = fork();
+    if(pid < 0){
+      printf(2, "sysstat: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      exec(argv[1], argv+1);
+      printf(2, "sysstat: exec %s failed\n", argv[1]);
+      exit();
+    }
+    wait();
+  }
+  if(getsysstats(after, NSYSSTAT) < 0){
+    printf(2, "sysstat: getsysstats failed\n");
+    exit();
+  }
+
+  printf(1, "syscall calls ticks hist(0 1 2-3 4-7 8-15 16-31 32-63 64+)\n");
+  for(num = 1; num < NSYSSTAT; num++){
+    after[num].calls -= before[num].calls;
+    after[num].ticks -= before[num].ticks;
+    if(after[num].calls == 0)
+      continue;
+    printf(1, "%s %d %d", names[num] ? names[num] : "?", after[num].calls, after[num].ticks);
+    for(b = 0; b < NSYSHIST; b++)
+      printf(1, " %d", after[num].hist[b] - before[num].hist[b]);
+    printf(1, "\n");
+  }
+  exit();
+}
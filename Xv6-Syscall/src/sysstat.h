@@ -0,0 +1,15 @@
+// Per-syscall statistics returned by getsysstats().
+// Entry i describes system call number i (see syscall.h, which
+// must be included first).
+
+#define NSYSSTAT NSYSCALL  // entries in the statistics table
+#define NSYSHIST 8   // latency buckets per system call
+
+// Bucket 0 counts calls that finished in the tick they started,
+// bucket b > 0 counts calls that took [2^(b-1), 2^b) ticks, and the
+// last bucket also holds everything slower.
+struct sysstat {
+  uint calls;           // Completed calls
+  uint ticks;           // Total ticks spent in the call
+  uint hist[NSYSHIST];  // Latency histogram in ticks
+};
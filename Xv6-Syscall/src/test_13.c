@@ -0,0 +1,53 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define N 2000
+
+lock_t lk;
+volatile int counter;
+int word;
+
+void
+worker(void *arg)
+{
+  int i;
+
+  for (i = 0; i < N; i++) {
+    lock_acquire(&lk);
+    counter++;
+    lock_release(&lk);
+  }
+}
+
+void
+waiter(void *arg)
+{
+  *(int*)arg = futex_wait(&word, 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, r = -5, woken = 0;
+
+  lock_init(&lk);
+  for (i = 0; i < 4; i++)
+    thread_create(worker, 0);
+  for (i = 0; i < 4; i++)
+    thread_join();
+
+  // A changed word returns straight away.
+  int changed = futex_wait(&word, 1);
+  thread_create(waiter, &r);
+  while (woken == 0) {
+    sleep(1);
+    woken = futex_wake(&word, 1);
+  }
+  thread_join();
+  int bad = futex_wait((char*)&word + 1, 0);
+
+  printf(1, "XV6_TEST_OUTPUT %d %d %d %d %d\n",
+         counter, changed, woken, r, bad);
+  exit();
+}
@@ -0,0 +1,29 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "syscall.h"
+#include "sysstat.h"
+
+struct sysstat s1[NSYSSTAT], s2[NSYSSTAT];
+
+int
+main(int argc, char *argv[]) {
+  int n = getsysstats(s1, NSYSSTAT);
+  int i;
+  for (i = 0; i < 100; i++) {
+    (void) getpid();
+  }
+  char buf[100];
+  (void) read(4, buf, 1);
+  (void) getsysstats(s2, NSYSSTAT);
+
+  int hist = 0;
+  for (i = 0; i < NSYSHIST; i++) {
+    hist += s2[SYS_getpid].hist[i] - s1[SYS_getpid].hist[i];
+  }
+  printf(1, "XV6_TEST_OUTPUT %d %d %d %d %d\n", n == NSYSSTAT,
+         s2[SYS_getpid].calls - s1[SYS_getpid].calls, hist,
+         s2[SYS_read].calls - s1[SYS_read].calls,
+         getsysstats(s1, -1));
+  exit();
+}
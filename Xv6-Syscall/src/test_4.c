@@ -0,0 +1,37 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "lockstat.h"
+
+struct lockstat s1[NLOCKSTAT], s2[NLOCKSTAT];
+
+// Index of the entry for name, or -1.
+int
+find(struct lockstat *st, int n, char *name) {
+  int i;
+  for (i = 0; i < n; i++) {
+    if (strcmp(st[i].name, name) == 0)
+      return i;
+  }
+  return -1;
+}
+
+int
+main(int argc, char *argv[]) {
+  int n1 = getlockstats(s1, NLOCKSTAT);
+  int i;
+  for (i = 0; i < 10; i++) {
+    if (fork() == 0)
+      exit();
+    wait();
+  }
+  int n2 = getlockstats(s2, NLOCKSTAT);
+
+  int p1 = find(s1, n1, "ptable");
+  int p2 = find(s2, n2, "ptable");
+  printf(1, "XV6_TEST_OUTPUT %d %d %d %d\n", p1 >= 0 && p1 == p2,
+         p1 >= 0 && s2[p2].acquires - s1[p1].acquires >= 20,
+         find(s2, n2, "kmem") >= 0,
+         getlockstats(s1, -1));
+  exit();
+}
@@ -0,0 +1,34 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "memlayout.h"
+#include "profile.h"
+
+struct profsample buf[NPROFSAMPLE];
+volatile int sink;
+
+int
+main(int argc, char *argv[]) {
+  while (profile(1, buf, NPROFSAMPLE) > 0)
+    ;
+  int start = uptime();
+  int i;
+  while (uptime() - start < 5) {
+    for (i = 0; i < 100000; i++)
+      sink += i;
+  }
+  profile(0, 0, 0);
+
+  int n = profile(0, buf, NPROFSAMPLE);
+  int mine = 0, user = 0;
+  for (i = 0; i < n; i++) {
+    if (buf[i].pid == getpid() && strcmp(buf[i].name, "test_5") == 0) {
+      mine++;
+      if (buf[i].eip < KERNBASE)
+        user++;
+    }
+  }
+  printf(1, "XV6_TEST_OUTPUT %d %d %d\n", mine > 0, user > 0,
+         profile(0, buf, -1));
+  exit();
+}
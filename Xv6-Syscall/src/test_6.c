@@ -0,0 +1,67 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define N 10000
+
+char buf[N + 1];
+
+// Is buf[0..n) the pattern written to the source file?
+static int
+pattern(int n)
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+    if (buf[i] != 'a' + i % 26)
+      return 0;
+  return 1;
+}
+
+int
+main(int argc, char *argv[]) {
+  int fd, in, out, p[2], i, n, moved;
+
+  for (i = 0; i < N; i++)
+    buf[i] = 'a' + i % 26;
+  fd = open("sendsrc", O_CREATE | O_RDWR);
+  write(fd, buf, N);
+  close(fd);
+
+  // File to file: everything, then nothing more at the end.
+  in = open("sendsrc", O_RDONLY);
+  out = open("senddst", O_CREATE | O_RDWR);
+  moved = sendfile(out, in, N + 100);
+  int more = sendfile(out, in, 100);
+  close(in);
+  close(out);
+  memset(buf, 0, sizeof(buf));
+  fd = open("senddst", O_RDONLY);
+  n = read(fd, buf, sizeof(buf));
+  close(fd);
+  int filetofile = moved == N && more == 0 && n == N && pattern(N);
+
+  // File to pipe: only the n bytes asked for.
+  pipe(p);
+  in = open("sendsrc", O_RDONLY);
+  moved = sendfile(p[1], in, 3000);
+  close(in);
+  close(p[1]);
+  memset(buf, 0, sizeof(buf));
+  n = 0;
+  while ((i = read(p[0], buf + n, sizeof(buf) - n)) > 0)
+    n += i;
+  close(p[0]);
+  int filetopipe = moved == 3000 && n == 3000 && pattern(3000);
+
+  // A read-only file cannot be the destination.
+  in = open("sendsrc", O_RDONLY);
+  int bad = sendfile(in, in, 10);
+  close(in);
+
+  unlink("sendsrc");
+  unlink("senddst");
+  printf(1, "XV6_TEST_OUTPUT %d %d %d\n", filetofile, filetopipe, bad);
+  exit();
+}
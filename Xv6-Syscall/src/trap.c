@@ -7,6 +7,7 @@
 #include "x86.h"
 #include "traps.h"
 #include "spinlock.h"
+#include "kshared.h"
 
 // Interrupt descriptor table (shared by all CPUs).
 struct gatedesc idt[256];
@@ -32,17 +33,25 @@ idtinit(void)
   lidt(idt, sizeof(idt));
 }
 
+// A system call, made with int $T_SYSCALL, or with sysenter,
+// which comes straight here from sysentry in trapasm.S.
+void
+systrap(struct trapframe *tf)
+{
+  if(myproc()->killed)
+    exit();
+  myproc()->tf = tf;
+  syscall();
+  if(myproc()->killed)
+    exit();
+}
+
 //PAGEBREAK: 41
 void
 trap(struct trapframe *tf)
 {
   if(tf->trapno == T_SYSCALL){
-    if(myproc()->killed)
-      exit();
-    myproc()->tf = tf;
-    syscall();
-    if(myproc()->killed)
-      exit();
+    systrap(tf);
     return;
   }
 
@@ -53,15 +62,22 @@ trap(struct trapframe *tf)
       ticks++;
       wakeup(&ticks);
       release(&tickslock);
+      kshared->ticks = ticks;
+      kshared->readcount = readcount();
+      log_tick();
     }
+    profsample(tf);
     lapiceoi();
     break;
   case T_IRQ0 + IRQ_IDE:
-    ideintr();
+    ideintr(0);
     lapiceoi();
     break;
   case T_IRQ0 + IRQ_IDE+1:
-    // Bochs generates spurious IDE1 interrupts.
+    // The secondary channel, when disk 2 is present.  Bochs
+    // generates spurious IDE1 interrupts, which find nothing queued.
+    ideintr(1);
+    lapiceoi();
     break;
   case T_IRQ0 + IRQ_KBD:
     kbdintr();
@@ -13,16 +13,33 @@
 #include "x86.h"
 
 #define COM1    0x3f8
+#define TXFIFO  16      // bytes the 16550 transmit FIFO holds
 
 static int uart;    // is there a uart?
 
+// Output waits here for the transmitter instead of the writer
+// spinning on it a character at a time.  uartputc queues a byte
+// and uartintr refills the transmit FIFO each time it empties.
+// Only if the ring is full (or after a panic) does uartputc wait
+// for the hardware itself.
+#define UARTBUF 512
+static struct {
+  struct spinlock lock;
+  char buf[UARTBUF];
+  uint r;  // Next byte to send
+  uint w;  // Next free slot
+  int sync;  // Set by uartpanic: write straight to the port
+} tx;
+
 void
 uartinit(void)
 {
   char *p;
 
-  // Turn off the FIFO
-  outb(COM1+2, 0);
+  initlock(&tx.lock, "uart");
+
+  // Turn on and clear the FIFOs, receive trigger at 1 byte.
+  outb(COM1+2, 0x07);
 
   // 9600 baud, 8 data bits, 1 stop bit, parity off.
   outb(COM1+3, 0x80);    // Unlock divisor
@@ -30,7 +47,7 @@ uartinit(void)
   outb(COM1+1, 0);
   outb(COM1+3, 0x03);    // Lock divisor, 8 data bits.
   outb(COM1+4, 0);
-  outb(COM1+1, 0x01);    // Enable receive interrupts.
+  outb(COM1+1, 0x03);    // Enable receive and transmit interrupts.
 
   // If status is 0xFF, no serial port.
   if(inb(COM1+5) == 0xFF)
@@ -48,16 +65,66 @@ uartinit(void)
     uartputc(*p);
 }
 
+// Wait for the transmitter to be empty.
+static void
+uartwait(void)
+{
+  int i;
+
+  for(i = 0; i < 128 && !(inb(COM1+5) & 0x20); i++)
+    microdelay(10);
+}
+
+// If the transmitter is empty, hand it as many queued bytes as
+// its FIFO holds.  Caller must hold tx.lock.
+static void
+uartstart(void)
+{
+  int i;
+
+  if(tx.r == tx.w || !(inb(COM1+5) & 0x20))
+    return;
+  for(i = 0; i < TXFIFO && tx.r != tx.w; i++)
+    outb(COM1+0, tx.buf[tx.r++ % UARTBUF]);
+}
+
 void
 uartputc(int c)
 {
-  int i;
+  if(!uart)
+    return;
+  if(tx.sync){
+    uartwait();
+    outb(COM1+0, c);
+    return;
+  }
 
+  acquire(&tx.lock);
+  while(tx.w - tx.r == UARTBUF){
+    // Full, perhaps because interrupts are off and nothing is
+    // draining it: make room the slow way.
+    uartwait();
+    uartstart();
+  }
+  tx.buf[tx.w++ % UARTBUF] = c;
+  uartstart();
+  release(&tx.lock);
+}
+
+// Send whatever is queued and stop buffering, so that a panic
+// message gets out even though no interrupt will come.  Takes no
+// lock: the panicking cpu may hold it, and the others are about
+// to freeze anyway.
+void
+uartpanic(void)
+{
   if(!uart)
     return;
-  for(i = 0; i < 128 && !(inb(COM1+5) & 0x20); i++)
-    microdelay(10);
-  outb(COM1+0, c);
+  tx.sync = 1;
+  while(tx.r != tx.w){
+    uartwait();
+    outb(COM1+0, tx.buf[tx.r++ % UARTBUF]);
+  }
 }
 
 static int
@@ -73,5 +140,13 @@ uartgetc(void)
 void
 uartintr(void)
 {
-  consoleintr(uartgetc);
+  // Reading IIR acknowledges a transmitter empty interrupt.  Go on
+  // until no cause is pending, or the line stays raised and the
+  // IOAPIC, which sees only edges, never interrupts again.
+  while((inb(COM1+2) & 0x01) == 0){
+    acquire(&tx.lock);
+    uartstart();
+    release(&tx.lock);
+    consoleintr(uartgetc);
+  }
 }
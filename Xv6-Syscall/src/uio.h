@@ -0,0 +1,8 @@
+// Buffers of a readv() or writev() call.
+
+#define NIOV 16  // most buffers in one call
+
+struct iovec {
+  void *base;  // user address of the buffer
+  int len;     // bytes in it
+};
@@ -104,3 +104,90 @@ memmove(void *vdst, const void *vsrc, int n)
     *dst++ = *src++;
   return vdst;
 }
+
+#define PGSIZE 4096
+
+// Bottom of a thread's stack page: what the thread is to run, and
+// the memory the page was carved from, to free after join.
+struct tstart {
+  void *mem;
+  void (*fn)(void*);
+  void *arg;
+};
+
+static void
+tstart(void *a)
+{
+  struct tstart *t = a;
+
+  t->fn(t->arg);
+  exit();
+}
+
+// Start a thread running fn(arg), which exits when fn returns.
+// Returns its pid, or -1.
+int
+thread_create(void (*fn)(void*), void *arg)
+{
+  char *mem, *stack;
+  struct tstart *t;
+  int pid;
+
+  // clone wants a whole page-aligned page.
+  if((mem = malloc(2*PGSIZE)) == 0)
+    return -1;
+  stack = (char*)(((uint)mem + PGSIZE - 1) & ~(PGSIZE - 1));
+  t = (struct tstart*)stack;
+  t->mem = mem;
+  t->fn = fn;
+  t->arg = arg;
+  if((pid = clone(tstart, t, stack)) < 0)
+    free(mem);
+  return pid;
+}
+
+// Wait for a thread to exit and free its stack.  Returns its pid,
+// or -1 if there are no threads.
+int
+thread_join(void)
+{
+  void *stack;
+  int pid;
+
+  if((pid = join(&stack)) >= 0)
+    free(((struct tstart*)stack)->mem);
+  return pid;
+}
+
+// Ticket locks, handed out in the order asked for.  A waiter
+// sleeps in futex_wait until its turn comes, and the holder calls
+// futex_wake only if tickets are out, so a lock nobody else wants
+// never enters the kernel.
+void
+lock_init(lock_t *lk)
+{
+  lk->next = 0;
+  lk->owner = 0;
+}
+
+void
+lock_acquire(lock_t *lk)
+{
+  uint ticket;
+
+  uint owner;
+
+  ticket = __sync_fetch_and_add(&lk->next, 1);
+  while((owner = *(volatile uint*)&lk->owner) != ticket)
+    futex_wait(&lk->owner, owner);
+  __sync_synchronize();
+}
+
+void
+lock_release(lock_t *lk)
+{
+  __sync_synchronize();
+  // Each waiter is after its own ticket, so wake them all.
+  if(__sync_add_and_fetch(&lk->owner, 1) != *(volatile uint*)&lk->next)
+    futex_wake(&lk->owner, 0x7fffffff);
+}
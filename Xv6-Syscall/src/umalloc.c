@@ -3,8 +3,22 @@
 #include "user.h"
 #include "param.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Memory allocator.
+//
+// Small blocks, up to MAXSMALL bytes with their header, come in
+// size classes of powers of two, each with its own free list, so
+// that malloc and free of a small block take constant time.  They
+// are carved from an arena that grows ARENA bytes of sbrk at a
+// time, and stay in their class once freed.  Larger blocks come
+// from the allocator by Kernighan and Ritchie, The C programming
+// Language, 2nd ed.  Section 8.7, which searches its free list.  A
+// small block's size field holds its class, marked with SMALL.
+
+#define NCLASS    8
+#define MINSMALL  16                          // class 0 block size
+#define MAXSMALL  (MINSMALL << (NCLASS-1))    // 2048
+#define SMALL     0x80000000
+#define ARENA     (64*1024)
 
 typedef long Align;
 
@@ -21,12 +35,48 @@ typedef union header Header;
 static Header base;
 static Header *freep;
 
+static Header *classfree[NCLASS];
+static char *arena, *arenaend;
+
+// Allocate a block of class c.
+static void*
+smalloc(int c)
+{
+  Header *hp;
+  uint n;
+  char *p;
+
+  if((hp = classfree[c]) != 0){
+    classfree[c] = hp->s.ptr;
+    return (void*)(hp + 1);
+  }
+  n = MINSMALL << c;
+  if(arenaend - arena < n){
+    if((p = sbrk(ARENA)) == (char*)-1)
+      return 0;
+    // The rest of the old arena is lost unless the new one
+    // follows it.
+    if(p != arenaend)
+      arena = p;
+    arenaend = p + ARENA;
+  }
+  hp = (Header*)arena;
+  arena += n;
+  hp->s.size = SMALL | c;
+  return (void*)(hp + 1);
+}
+
 void
 free(void *ap)
 {
   Header *bp, *p;
 
   bp = (Header*)ap - 1;
+  if(bp->s.size & SMALL){
+    bp->s.ptr = classfree[bp->s.size & ~SMALL];
+    classfree[bp->s.size & ~SMALL] = bp;
+    return;
+  }
   for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
     if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
       break;
@@ -65,6 +115,13 @@ malloc(uint nbytes)
 {
   Header *p, *prevp;
   uint nunits;
+  int c;
+
+  if(nbytes <= MAXSMALL - sizeof(Header)){
+    for(c = 0; (MINSMALL << c) < nbytes + sizeof(Header); c++)
+      ;
+    return smalloc(c);
+  }
 
   nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
   if((prevp = freep) == 0){
@@ -1,5 +1,11 @@
 struct stat;
 struct rtcdate;
+struct sysstat;
+struct lockstat;
+struct profsample;
+struct iovec;
+struct ioring;
+struct cycles;
 
 // system calls
 int fork(void);
@@ -24,6 +30,22 @@ char* sbrk(int);
 int sleep(int);
 int uptime(void);
 int getreadcount(void);
+int getsysstats(struct sysstat*, int);
+int getlockstats(struct lockstat*, int);
+int profile(int, struct profsample*, int);
+int sendfile(int, int, int);
+int readv(int, struct iovec*, int);
+int writev(int, struct iovec*, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int submit(struct ioring*);
+int cycles(struct cycles*);
+int spawn(char*, char**);
+int clone(void (*)(void*), void*, void*);
+int join(void**);
+int futex_wait(void*, int);
+int futex_wake(void*, int);
+int sync(void);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -36,5 +58,19 @@ char* gets(char*, int max);
 uint strlen(const char*);
 void* memset(void*, int, uint);
 void* malloc(uint);
+
 void free(void*);
 int atoi(const char*);
+
+// Threads.  thread_create and thread_join use malloc, which is not
+// thread-safe, so call them from one thread only.
+typedef struct {
+  uint next;   // Next ticket to hand out
+  uint owner;  // Ticket allowed to hold the lock
+} lock_t;
+
+int thread_create(void (*)(void*), void*);
+int thread_join(void);
+void lock_init(lock_t*);
+void lock_acquire(lock_t*);
+void lock_release(lock_t*);
@@ -13,6 +13,14 @@ char name[3];
 char *echoargv[] = { "echo", "ALL", "TESTS", "PASSED", 0 };
 int stdout = 1;
 
+// 512-byte writes the big files test makes: a whole file of the
+// largest size with 512-byte blocks, 8MB with larger blocks.
+#if BSIZE == 512
+#define NBIG MAXFILE
+#else
+#define NBIG 16384
+#endif
+
 // does chdir() call iput(p->cwd) in a transaction?
 void
 iputtest(void)
@@ -197,7 +205,7 @@ writetest1(void)
     exit();
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < NBIG; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, 512) != 512){
       printf(stdout, "error: write big file failed\n", i);
@@ -217,7 +225,7 @@ writetest1(void)
   for(;;){
     i = read(fd, buf, 512);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n == NBIG - 1){
         printf(stdout, "read only %d blocks from big", n);
         exit();
       }
@@ -1347,8 +1355,8 @@ iref(void)
 
   printf(1, "empty file name\n");
 
-  // the 50 is NINODE
-  for(i = 0; i < 50 + 1; i++){
+  // the 100 is NINODE
+  for(i = 0; i < 100 + 1; i++){
     if(mkdir("irefd") != 0){
       printf(1, "mkdir irefd failed\n");
       exit();
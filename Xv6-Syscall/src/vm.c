@@ -6,9 +6,12 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "kshared.h"
 
 extern char data[];  // defined by kernel.ld
+extern void sysentry(void);  // in trapasm.S
 pde_t *kpgdir;  // for use in scheduler()
+struct kshared *kshared;
 
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
@@ -27,6 +30,13 @@ seginit(void)
   c->gdt[SEG_UCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, DPL_USER);
   c->gdt[SEG_UDATA] = SEG(STA_W, 0, 0xffffffff, DPL_USER);
   lgdt(c->gdt, sizeof(c->gdt));
+
+  // sysenter enters the kernel at sysentry.  It and sysexit
+  // take the other segments from the descriptors after
+  // SEG_KCODE, which must be kernel data, user code and user
+  // data in that order.  switchuvm sets the stack.
+  wrmsr(MSR_SYSENTER_CS, SEG_KCODE << 3, 0);
+  wrmsr(MSR_SYSENTER_EIP, (uint)sysentry, 0);
 }
 
 // Return the address of the PTE in page table pgdir
@@ -132,9 +142,26 @@ setupkvm(void)
       freevm(pgdir);
       return 0;
     }
+  if(kshared && mappages(pgdir, (void*)KSHARED, PGSIZE, V2P(kshared),
+                         PTE_U) < 0){
+    freevm(pgdir);
+    return 0;
+  }
   return pgdir;
 }
 
+// Allocate the page shared read-only with every process (see
+// kshared.h).  Page tables made by setupkvm from now on map it;
+// the kernel's own, made before, does not need to.
+void
+ksharedinit(void)
+{
+  if((kshared = (struct kshared*)kalloc()) == 0)
+    panic("ksharedinit");
+  memset(kshared, 0, PGSIZE);
+  kshared->ncpu = ncpu;
+}
+
 // Allocate one page table for the machine for the kernel address
 // space for scheduler processes.
 void
@@ -169,6 +196,7 @@ switchuvm(struct proc *p)
   mycpu()->gdt[SEG_TSS].s = 0;
   mycpu()->ts.ss0 = SEG_KDATA << 3;
   mycpu()->ts.esp0 = (uint)p->kstack + KSTACKSIZE;
+  wrmsr(MSR_SYSENTER_ESP, (uint)p->kstack + KSTACKSIZE, 0);
   // setting IOPL=0 in eflags *and* iomb beyond the tss segment limit
   // forbids I/O instructions (e.g., inb and outb) from user space
   mycpu()->ts.iomb = (ushort) 0xFFFF;
@@ -224,7 +252,7 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   char *mem;
   uint a;
 
-  if(newsz >= KERNBASE)
+  if(newsz > KSHARED)
     return 0;
   if(newsz < oldsz)
     return oldsz;
@@ -283,10 +311,14 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 void
 freevm(pde_t *pgdir)
 {
+  pte_t *pte;
   uint i;
 
   if(pgdir == 0)
     panic("freevm: no pgdir");
+  // The shared page is not this page table's to free.
+  if((pte = walkpgdir(pgdir, (char*)KSHARED, 0)) != 0)
+    *pte = 0;
   deallocuvm(pgdir, KERNBASE, 0);
   for(i = 0; i < NPDENTRIES; i++){
     if(pgdir[i] & PTE_P){
@@ -361,27 +393,44 @@ uva2ka(pde_t *pgdir, char *uva)
 
 // Copy len bytes from p to user address va in page table pgdir.
 // Most useful when pgdir is not the current page table.
-// uva2ka ensures this only works for PTE_U pages.
+// This only works for PTE_U pages.  Each page table page is
+// looked up once, and pages that follow each other in physical
+// memory too are copied with one memmove.
 int
 copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
-  char *buf, *pa0;
-  uint n, va0;
+  char *buf, *src, *dst, *ka;
+  pte_t *pgtab, pte;
+  uint n, run;
 
   buf = (char*)p;
+  src = dst = 0;
+  run = 0;
   while(len > 0){
-    va0 = (uint)PGROUNDDOWN(va);
-    pa0 = uva2ka(pgdir, (char*)va0);
-    if(pa0 == 0)
+    if(!(pgdir[PDX(va)] & PTE_P))
       return -1;
-    n = PGSIZE - (va - va0);
-    if(n > len)
-      n = len;
-    memmove(pa0 + (va - va0), buf, n);
-    len -= n;
-    buf += n;
-    va = va0 + PGSIZE;
+    pgtab = (pte_t*)P2V(PTE_ADDR(pgdir[PDX(va)]));
+    do {
+      pte = pgtab[PTX(va)];
+      if((pte & (PTE_P|PTE_U)) != (PTE_P|PTE_U))
+        return -1;
+      ka = (char*)P2V(PTE_ADDR(pte)) + va % PGSIZE;
+      n = PGSIZE - va % PGSIZE;
+      if(n > len)
+        n = len;
+      if(ka != dst + run){
+        memmove(dst, src, run);
+        src = buf;
+        dst = ka;
+        run = 0;
+      }
+      run += n;
+      len -= n;
+      buf += n;
+      va += n;
+    } while(len > 0 && PTX(va) != 0);
   }
+  memmove(dst, src, run);
   return 0;
 }
 
@@ -0,0 +1,21 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "cycles.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct cycles a, b;
+
+  int r = cycles(&a);
+  sleep(2);
+  cycles(&b);
+  int bad = cycles((struct cycles*)0xffffff00);
+
+  // Two ticks of sleep span at least one whole tick.
+  printf(1, "XV6_TEST_OUTPUT %d %d %d %d %d\n",
+         r, a.pertick > 0, b.now > a.now,
+         b.now - a.now >= a.pertick / 2, bad);
+  exit();
+}
@@ -0,0 +1,24 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+int
+main(int argc, char *argv[])
+{
+  char *args[] = { "test_11", "child", 0 };
+
+  if(argc > 1){
+    // Only descriptors 0-2 are passed on.
+    printf(1, "XV6_TEST_OUTPUT %s %d %d\n", argv[1], argc, write(3, "x", 1));
+    exit();
+  }
+
+  int fd = dup(1);
+  int pid = spawn("test_11", args);
+  int w = wait();
+  int bad = spawn("nosuchfile", args);
+  close(fd);
+
+  printf(1, "XV6_TEST_OUTPUT %d %d %d %d\n", fd, pid > 0, w == pid, bad);
+  exit();
+}
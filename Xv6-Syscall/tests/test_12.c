@@ -0,0 +1,44 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define N 1000
+
+lock_t lk;
+volatile int counter;
+int *shared;
+
+void
+worker(void *arg)
+{
+  int i;
+
+  for (i = 0; i < N; i++) {
+    lock_acquire(&lk);
+    counter++;
+    lock_release(&lk);
+  }
+  // Memory grown by a thread is the process's memory.
+  if (*(int*)arg == 1)
+    shared = (int*)sbrk(4096);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int one = 1, two = 2;
+
+  lock_init(&lk);
+  int p1 = thread_create(worker, &one);
+  int p2 = thread_create(worker, &two);
+  int j1 = thread_join();
+  int j2 = thread_join();
+  int none = thread_join();
+  shared[0] = 7;
+  int badstack = clone(worker, &one, (char*)sbrk(0) - 100);
+
+  printf(1, "XV6_TEST_OUTPUT %d %d %d %d %d %d\n",
+         counter, p1 > 0 && p2 > 0, (j1 == p1 && j2 == p2) || (j1 == p2 && j2 == p1),
+         none, shared[0], badstack);
+  exit();
+}
@@ -0,0 +1,33 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "kshared.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct kshared *ks = (struct kshared*)KSHARED;
+  uint t0, t1, k, rc, sum;
+  int i;
+
+  // The shared tick count is uptime()'s, give or take the tick
+  // that may land between the two updates.
+  t0 = uptime();
+  k = ks->ticks;
+  t1 = uptime();
+  int ticksok = k + 1 >= t0 && k <= t1;
+
+  // Reads show up per cpu at once, and in the total by the next tick.
+  rc = getreadcount();
+  for(i = 0; i < 10; i++)
+    read(-1, 0, 0);
+  sum = 0;
+  for(i = 0; i < ks->ncpu; i++)
+    sum += ks->cpu[i].readcount;
+  sleep(2);
+
+  printf(1, "XV6_TEST_OUTPUT %d %d %d %d\n",
+         ticksok, ks->ncpu > 0, sum >= rc + 10, ks->readcount >= rc + 10);
+  exit();
+}
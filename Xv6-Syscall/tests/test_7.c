@@ -0,0 +1,57 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "uio.h"
+
+// Does p start with the n bytes of s?
+static int
+same(char *p, char *s, int n)
+{
+  while (n-- > 0)
+    if (*p++ != *s++)
+      return 0;
+  return 1;
+}
+
+int
+main(int argc, char *argv[]) {
+  struct iovec iov[3];
+  char a[4], b[8], c[16];
+  int fd;
+
+  // Gather three buffers into one write.
+  iov[0].base = "one,";
+  iov[0].len = 4;
+  iov[1].base = "two,";
+  iov[1].len = 4;
+  iov[2].base = "three";
+  iov[2].len = 5;
+  fd = open("vecfile", O_CREATE | O_RDWR);
+  int w = writev(fd, iov, 3);
+  close(fd);
+
+  // Scatter it back over buffers of other sizes; the last is not filled.
+  memset(c, 0, sizeof(c));
+  iov[0].base = a;
+  iov[0].len = sizeof(a);
+  iov[1].base = b;
+  iov[1].len = sizeof(b);
+  iov[2].base = c;
+  iov[2].len = sizeof(c);
+  fd = open("vecfile", O_RDONLY);
+  int x1 = getreadcount();
+  int r = readv(fd, iov, 3);
+  int x2 = getreadcount();
+  close(fd);
+  unlink("vecfile");
+  int ok = same(a, "one,", 4) && same(b, "two,thre", 8) &&
+           strcmp(c, "e") == 0;
+
+  // A buffer outside the process is refused.
+  iov[0].base = (void*)0x7fffff00;
+  int bad = readv(0, iov, 1);
+
+  printf(1, "XV6_TEST_OUTPUT %d %d %d %d %d\n", w, r, x2 - x1, ok, bad);
+  exit();
+}
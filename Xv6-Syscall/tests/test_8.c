@@ -0,0 +1,40 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+int
+main(int argc, char *argv[]) {
+  char a[8], b[8], c[16];
+  int fd, p[2];
+
+  fd = open("posfile", O_CREATE | O_RDWR);
+  write(fd, "0123456789", 10);
+  close(fd);
+
+  // pread at an offset leaves the file offset where it was.
+  fd = open("posfile", O_RDWR);
+  memset(a, 0, sizeof(a));
+  memset(b, 0, sizeof(b));
+  int r1 = pread(fd, a, 4, 3);
+  int r2 = read(fd, b, 4);
+  int ok1 = strcmp(a, "3456") == 0 && strcmp(b, "0123") == 0;
+
+  // pwrite past the end grows the file; the offset stays at 4.
+  int w = pwrite(fd, "XYZ", 3, 8);
+  memset(c, 0, sizeof(c));
+  int r3 = read(fd, c, sizeof(c));
+  int ok2 = strcmp(c, "4567XYZ") == 0;
+
+  int past = pread(fd, a, 1, 20);
+  close(fd);
+  unlink("posfile");
+
+  // Pipes have no offsets.
+  pipe(p);
+  int nopipe = pread(p[0], a, 1, 0);
+
+  printf(1, "XV6_TEST_OUTPUT %d %d %d %d %d %d %d %d\n",
+         r1, r2, ok1, w, r3, ok2, past, nopipe);
+  exit();
+}
@@ -0,0 +1,70 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "ioring.h"
+
+struct ioring ring;
+
+// Queue one submission.
+static void
+queue(int op, int fd, void *buf, int n, int data)
+{
+  struct sqe *e = &ring.sq[ring.sqtail % NRING];
+
+  e->op = op;
+  e->fd = fd;
+  e->buf = buf;
+  e->n = n;
+  e->data = data;
+  ring.sqtail++;
+}
+
+// Take the next completion, checking it is for data.
+static int
+reap(int data)
+{
+  struct cqe *c = &ring.cq[ring.cqhead % NRING];
+
+  ring.cqhead++;
+  return c->data == data ? c->res : -100;
+}
+
+int
+main(int argc, char *argv[]) {
+  char buf[32];
+  int fd, i;
+
+  queue(IORING_OPEN, O_CREATE | O_RDWR, "ringfile", 0, 1);
+  int s1 = submit(&ring);
+  fd = reap(1);
+
+  // Two writes and a close in one call.
+  queue(IORING_WRITE, fd, "hello ", 6, 2);
+  queue(IORING_WRITE, fd, "ring", 4, 3);
+  queue(IORING_CLOSE, fd, 0, 0, 4);
+  int s2 = submit(&ring);
+  int w1 = reap(2), w2 = reap(3), c = reap(4);
+
+  queue(IORING_OPEN, O_RDONLY, "ringfile", 0, 5);
+  submit(&ring);
+  fd = reap(5);
+  memset(buf, 0, sizeof(buf));
+  queue(IORING_READ, fd, buf, sizeof(buf), 6);
+  queue(IORING_READ, 99, buf, sizeof(buf), 7);
+  submit(&ring);
+  int r = reap(6);
+  close(fd);
+  unlink("ringfile");
+
+  // With one completion not yet taken, only NRING-1 more fit.
+  for (i = 0; i < NRING; i++)
+    queue(IORING_CLOSE, 99, 0, 0, i);
+  int full = submit(&ring);
+  int bad = reap(7);
+
+  printf(1, "XV6_TEST_OUTPUT %d %d %d %d %d %d %d %d %d\n",
+         s1, fd >= 0, s2, w1 + w2, c, r, strcmp(buf, "hello ring") == 0,
+         bad, full);
+  exit();
+}
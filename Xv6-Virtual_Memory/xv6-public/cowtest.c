@@ -0,0 +1,104 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "mmu.h"
+
+#define NPAGE 8   // 测试用的页面数
+#define NCHILD 4  // 同时存在的子进程数
+
+/**
+ * 写时复制测试程序
+ *
+ * 该程序测试fork后父子进程共享页面、第一次写入时复制的功能：
+ * 1. 分配若干页内存并写入初始值
+ * 2. fork多个子进程，每个子进程改写这些页面并检查自己的值
+ * 3. 父进程检查自己的页面没有被子进程改动
+ * 4. 子进程经过read系统调用写入共享页面（由内核触发复制）
+ * 5. fork后mprotect/munprotect共享页面，写入后父进程的值不变
+ * 6. 运行同一程序的进程共享程序页面，改写已初始化的全局变量后再exec本程序，新进程看到的仍是初值
+ */
+static char* buf;
+static char marker[] = "text"; // 位于程序段中，由lazyfault从页缓存映射
+
+static void check(int ok, char* what) {
+    if(!ok) {
+        printf(1, "cowtest: %s failed\n", what);
+        exit();
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int i, j, pid, fds[2];
+    char *args[] = { "cowtest", "exec", 0 };
+
+    // 由第6步exec出来：程序页面应是文件中的内容，而不是父进程改写后的
+    if(argc > 1 && strcmp(argv[1], "exec") == 0) {
+        check(strcmp(marker, "text") == 0, "program page after exec");
+        exit();
+    }
+
+    // 分配页面并写入初始值
+    buf = sbrk(NPAGE * PGSIZE);
+    for(i = 0; i < NPAGE; i++)
+        buf[i * PGSIZE] = 'a' + i;
+
+    // 子进程各自改写页面
+    for(j = 0; j < NCHILD; j++) {
+        pid = fork();
+        check(pid >= 0, "fork");
+        if(pid == 0) {
+            for(i = 0; i < NPAGE; i++)
+                buf[i * PGSIZE] = 'A' + j;
+            for(i = 0; i < NPAGE; i++)
+                check(buf[i * PGSIZE] == 'A' + j, "child write");
+            exit();
+        }
+    }
+    for(j = 0; j < NCHILD; j++)
+        wait();
+    for(i = 0; i < NPAGE; i++)
+        check(buf[i * PGSIZE] == 'a' + i, "parent unchanged");
+
+    // 内核代替子进程写入共享页面
+    check(pipe(fds) == 0, "pipe");
+    pid = fork();
+    check(pid >= 0, "fork");
+    if(pid == 0) {
+        close(fds[1]);
+        check(read(fds[0], buf, 1) == 1, "read");
+        check(buf[0] == 'Z', "kernel write");
+        exit();
+    }
+    close(fds[0]);
+    write(fds[1], "Z", 1);
+    close(fds[1]);
+    wait();
+    check(buf[0] == 'a', "parent unchanged after read");
+
+    // 共享页面经mprotect/munprotect后仍然写时复制
+    pid = fork();
+    check(pid >= 0, "fork");
+    if(pid == 0) {
+        check(mprotect((void*)buf, 1) == 0, "mprotect");
+        check(munprotect((void*)buf, 1) == 0, "munprotect");
+        buf[0] = 'Y';
+        check(buf[0] == 'Y', "write after munprotect");
+        exit();
+    }
+    wait();
+    check(buf[0] == 'a', "parent unchanged after munprotect");
+
+    // 改写共享的程序页面只复制本进程的一页
+    marker[0] = 'X';
+    pid = fork();
+    check(pid >= 0, "fork");
+    if(pid == 0) {
+        exec("cowtest", args);
+        check(0, "exec");
+    }
+    wait();
+    check(marker[0] == 'X', "write to program page");
+
+    printf(1, "cowtest ok\n");
+    exit();
+}
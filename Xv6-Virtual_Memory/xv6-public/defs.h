@@ -5,6 +5,7 @@ struct inode;
 struct pipe;
 struct proc;
 struct rtcdate;
+struct slabcache;
 struct spinlock;
 struct sleeplock;
 struct stat;
@@ -50,6 +51,7 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
+int             readiblocks(struct inode*, char*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
@@ -65,7 +67,12 @@ void            ioapicinit(void);
 
 // kalloc.c
 char*           kalloc(void);
+char*           kzalloc(void);
+int             kzero(void);
 void            kfree(char*);
+void            kref(char*);
+int             krefcount(char*);
+void            kmemstat(uint*, uint*, uint*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
 
@@ -95,7 +102,23 @@ void            mpinit(void);
 void            picenable(int);
 void            picinit(void);
 
+// mmap.c
+int             mmap(uint, int, int, int, struct file*, int);
+int             munmap(uint, int);
+int             mmapfault(struct proc*, uint);
+int             mmapfork(struct proc*, struct proc*);
+void            munmapall(struct proc*, pde_t*);
+int             mmapcontains(struct proc*, uint, uint);
+
+// pagecache.c
+void            pcinit(void);
+char*           pcget(struct inode*, uint);
+void            pcupdate(struct inode*, char*, uint, uint);
+void            pcinval(struct inode*);
+char*           pctext(struct inode*, uint, uint);
+
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
@@ -108,6 +131,8 @@ void            exit(void);
 int             fork(void);
 int             growproc(int);
 int             kill(int);
+int             getprocfaults(int, uint*);
+int             pageout(void);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
@@ -133,6 +158,20 @@ void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
 
+// shm.c
+void            shminit(void);
+int             shmget(int, int);
+int             shmat(int);
+int             shmdt(uint);
+int             shmfork(struct proc*, struct proc*);
+void            shmrelease(struct proc*);
+int             shmcontains(struct proc*, uint, uint);
+
+// slab.c
+void            slabinit(struct slabcache*, char*, uint);
+void*           slaballoc(struct slabcache*);
+void            slabfree(struct slabcache*, void*);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -160,6 +199,8 @@ void            syscall(void);
 void            timerinit(void);
 
 // trap.c
+void            countfault(struct proc*, int);
+void            getfaults(uint*);
 void            idtinit(void);
 extern uint     ticks;
 void            tvinit(void);
@@ -170,6 +211,17 @@ void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
 
+// swap.c
+void            swapinit(int);
+int             swapalloc(void);
+void            swapcancel(int);
+void            swapdup(int);
+void            swapfree(int);
+void            swapwrite(int, char*);
+void            swapread(int, char*);
+uint            swapouts(void);
+char*           ualloc(int);
+
 // vm.c
 void            seginit(void);
 void            kvmalloc(void);
@@ -181,6 +233,14 @@ void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
+int             uvmshare(pde_t*, pde_t*, uint, uint, int);
+int             uvmmap(pde_t*, uint, char*, int);
+char*           uvmdirty(pde_t*, uint);
+char*           uvmevict(pde_t*, uint, uint*, int);
+int             cowfault(pde_t*, uint);
+int             lazyfault(struct proc*, uint);
+int             uvmpopulate(struct proc*, uint, uint);
+int             shmmap(pde_t*, uint, char**, int);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
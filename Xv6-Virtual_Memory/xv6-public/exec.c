@@ -16,14 +16,14 @@
  * 执行流程：
  * 1. 打开可执行文件并检查ELF头
  * 2. 创建新的页表结构
- * 3. 加载程序段到内存（代码段和数据段）
+ * 3. 记录程序段（代码段和数据段），不读入内存，第一次访问某页时再从文件读入（见lazyfault）
  * 4. 为用户栈分配空间
  * 5. 在栈上设置命令行参数
  * 6. 设置程序入口点和栈指针
  * 7. 切换到新地址空间并释放旧地址空间
  * 
  * 空指针保护机制：
- * - 在地址空间的开始部分预留一页并设置为不可访问
+ * - 在地址空间的开始部分预留一页，不映射，也不会被延迟分配
  * - 这样当程序尝试解引用空指针时会触发页错误异常
  * 
  * @param path 要执行的程序路径
@@ -34,13 +34,15 @@ int
 exec(char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
+  int i, off, nseg;
   uint argc, sz, sp, ustack[3+MAXARG+1];  // ustack用于构建用户栈的初始内容
   struct elfhdr elf;                       // ELF文件头结构，包含程序入口点等信息
   struct inode *ip;                        // 文件inode指针，用于访问程序文件
   struct proghdr ph;                       // 程序头结构，描述每个可加载段的信息
   pde_t *pgdir, *oldpgdir;                 // 新旧页目录指针，指向页表的顶层结构
   struct proc *curproc = myproc();         // 获取当前进程结构
+  struct segment seg[NSEG];                // 按需从文件读入的程序段
+  struct inode *exe, *oldexe;              // 新旧程序文件
 
   begin_op();  // 开始文件系统操作，确保文件系统的一致性
 
@@ -53,6 +55,7 @@ exec(char *path, char **argv)
   }
   ilock(ip);    // 锁定文件inode，防止并发访问导致不一致
   pgdir = 0;    // 初始化页目录指针为0
+  exe = 0;
 
   // 读取并检查ELF文件头
   // readi函数从inode读取数据到指定内存位置
@@ -66,9 +69,10 @@ exec(char *path, char **argv)
   if((pgdir = setupkvm()) == 0)
     goto bad;  // 内存不足，页表创建失败
 
-  // 加载程序到内存
-  // 逐个处理ELF文件中的程序头，加载可执行段
+  // 记录程序段
+  // 逐个处理ELF文件中的程序头，只记录可执行段在文件中的位置，不分配内存
   sz = 0;  // 初始化进程大小为0
+  nseg = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     // 读取第i个程序头
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
@@ -79,26 +83,33 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)  // 检查地址是否溢出
       goto bad;
-    // 为程序段分配虚拟内存空间
-    // allocuvm扩展进程的地址空间并分配物理内存
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
-      goto bad;  // 内存分配失败
+    if(ph.vaddr + ph.memsz >= MMAPBASE)  // 程序段不能进入mmap、共享内存和内核地址空间
+      goto bad;
     if(ph.vaddr % PGSIZE != 0)    // 程序段的虚拟地址必须页对齐
       goto bad;
-    // 将程序段从文件加载到内存
-    // loaduvm将数据从文件复制到指定的虚拟地址
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
-      goto bad;  // 加载失败
+    if(ph.off + ph.filesz < ph.off)  // 检查文件偏移是否溢出
+      goto bad;
+    if(nseg == NSEG)              // 程序段太多
+      goto bad;
+    // 第一次访问某页时，从文件读入filesz以内的部分，其余清零
+    seg[nseg].va = ph.vaddr;
+    seg[nseg].off = ph.off;
+    seg[nseg].filesz = ph.filesz;
+    nseg++;
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
   }
+  exe = idup(ip);  // 进程运行期间保留程序文件的引用，供缺页时读取
   iunlockput(ip);  // 解锁并释放文件inode
   end_op();        // 结束文件系统操作
   ip = 0;          // 清空文件指针，防止后续错误处理时重复释放
 
-  // 使第一页不可访问，用于防止空指针解引用
-  clearpteu(pgdir, (char*)0);
+  // 第一页不映射，lazyfault也不会分配它，用于防止空指针解引用
 
   // 分配用户栈
   sz = PGROUNDUP(sz);
+  if(sz + PGSIZE > MMAPBASE)
+    goto bad;
   if((sz = allocuvm(pgdir, sz, sz + PGSIZE)) == 0)
     goto bad;
   sp = sz;
@@ -136,12 +147,23 @@ exec(char *path, char **argv)
 
   // 提交到用户镜像：更新进程的页表和寄存器状态
   oldpgdir = curproc->pgdir;        // 保存旧页目录
+  oldexe = curproc->exe;            // 保存旧程序文件
   curproc->pgdir = pgdir;           // 设置新页目录
   curproc->sz = sz;                 // 更新进程大小
+  curproc->exe = exe;               // 设置新程序文件和程序段
+  curproc->nseg = nseg;
+  memmove(curproc->seg, seg, sizeof(seg));
   curproc->tf->eip = elf.entry;     // 设置程序计数器指向入口点
   curproc->tf->esp = sp;            // 设置栈指针
   switchuvm(curproc);               // 切换到新地址空间（更新硬件页表寄存器）
+  shmrelease(curproc);              // 新程序不继承共享内存，旧的映射随旧页表释放
+  munmapall(curproc, oldpgdir);     // 新程序不继承mmap映射，写回旧页表中修改过的页
   freevm(oldpgdir);                 // 释放旧地址空间占用的资源
+  if(oldexe){                       // 释放旧程序文件
+    begin_op();
+    iput(oldexe);
+    end_op();
+  }
   return 0;                         // 成功返回
 
  bad:
@@ -152,5 +174,10 @@ exec(char *path, char **argv)
     iunlockput(ip);  // 解锁并释放文件inode
     end_op();        // 结束文件系统操作
   }
+  if(exe){
+    begin_op();
+    iput(exe);       // 释放为新程序保留的文件引用
+    end_op();
+  }
   return -1;  // 执行失败返回
 }
@@ -23,6 +23,7 @@ struct inode {
   short nlink;
   uint size;
   uint addrs[NDIRECT+1];
+  int text;           // program pages of it may be cached (pctext)
 };
 
 // table mapping major device number to
@@ -305,6 +305,7 @@ ilock(struct inode *ip)
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->text = 1;  // the page cache may still hold some from before
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -411,6 +412,7 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  pcinval(ip);
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -449,11 +451,12 @@ stati(struct inode *ip, struct stat *st)
 //PAGEBREAK!
 // Read data from inode.
 // Caller must hold ip->lock.
+// Regular files are read through the page cache.
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
   uint tot, m;
-  struct buf *bp;
+  char *mem;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
@@ -465,6 +468,29 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     return -1;
   if(off + n > ip->size)
     n = ip->size - off;
+  if(ip->type != T_FILE)
+    return readiblocks(ip, dst, off, n);
+
+  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    if((mem = pcget(ip, off/PGSIZE)) == 0){
+      // Out of memory: read around the page cache.
+      readiblocks(ip, dst, off, m);
+      continue;
+    }
+    memmove(dst, mem + off%PGSIZE, m);
+    kfree(mem);
+  }
+  return n;
+}
+
+// Read the n bytes at off, which must lie inside the file,
+// from the buffer cache.  Caller must hold ip->lock.
+int
+readiblocks(struct inode *ip, char *dst, uint off, uint n)
+{
+  uint tot, m;
+  struct buf *bp;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
@@ -478,6 +504,7 @@ readi(struct inode *ip, char *dst, uint off, uint n)
 // PAGEBREAK!
 // Write data to inode.
 // Caller must hold ip->lock.
+// Cached pages of a regular file are updated as well.
 int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
@@ -502,6 +529,8 @@ writei(struct inode *ip, char *src, uint off, uint n)
     log_write(bp);
     brelse(bp);
   }
+  if(ip->type == T_FILE)
+    pcupdate(ip, src - n, off - n, n);
 
   if(n > 0 && off > ip->size){
     ip->size = off;
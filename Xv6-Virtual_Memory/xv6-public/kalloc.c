@@ -1,6 +1,6 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and the slabs of small kernel objects. Allocates 4096-byte pages.
 
 #include "types.h"
 #include "defs.h"
@@ -17,10 +17,24 @@ struct run {
   struct run *next;
 };
 
+// Pages shared copy-on-write after fork are counted in ref,
+// indexed by physical page number; kfree only frees a page
+// when its last reference goes.
+//
+// Idle cpus zero free pages ahead of time (kzero), up to
+// NZEROPAGES of them, and keep them on zerolist so that kzalloc
+// rarely has to zero one itself.  A page on zerolist is all zero
+// but for its next pointer.
 struct {
   struct spinlock lock;
   int use_lock;
   struct run *freelist;
+  struct run *zerolist;
+  ushort ref[PHYSTOP / PGSIZE];
+  uint nfree;     // pages on freelist and zerolist
+  uint nzero;     // pages on zerolist
+  uint allocs;    // pages handed out since kinit2
+  uint frees;     // pages freed since kinit2
 } kmem;
 
 // Initialization happens in two phases.
@@ -64,14 +78,25 @@ kfree(char *v)
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  if(kmem.ref[V2P(v) / PGSIZE] > 1){
+    kmem.ref[V2P(v) / PGSIZE]--;
+    if(kmem.use_lock)
+      release(&kmem.lock);
+    return;
+  }
+  kmem.ref[V2P(v) / PGSIZE] = 0;
+
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
   r->next = kmem.freelist;
   kmem.freelist = r;
+  kmem.nfree++;
+  if(kmem.use_lock)
+    kmem.frees++;
   if(kmem.use_lock)
     release(&kmem.lock);
 }
@@ -86,11 +111,111 @@ kalloc(void)
 
   if(kmem.use_lock)
     acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
+  if((r = kmem.freelist) != 0){
     kmem.freelist = r->next;
+  } else if((r = kmem.zerolist) != 0){
+    kmem.zerolist = r->next;
+    kmem.nzero--;
+  }
+  if(r){
+    kmem.ref[V2P((char*)r) / PGSIZE] = 1;
+    kmem.nfree--;
+    kmem.allocs++;
+  }
   if(kmem.use_lock)
     release(&kmem.lock);
   return (char*)r;
 }
 
+// Allocate one 4096-byte page of physical memory, filled with
+// zeros.  Returns 0 if the memory cannot be allocated.
+char*
+kzalloc(void)
+{
+  struct run *r;
+
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  if((r = kmem.zerolist) != 0){
+    kmem.zerolist = r->next;
+    kmem.nzero--;
+    kmem.ref[V2P((char*)r) / PGSIZE] = 1;
+    kmem.nfree--;
+    kmem.allocs++;
+  }
+  if(kmem.use_lock)
+    release(&kmem.lock);
+  if(r){
+    r->next = 0;
+    return (char*)r;
+  }
+  if((r = (struct run*)kalloc()) != 0)
+    memset(r, 0, PGSIZE);
+  return (char*)r;
+}
+
+// Zero a page from freelist and move it to zerolist, if zerolist
+// is short of NZEROPAGES.  Called by cpus with nothing to run.
+// Returns 0 if there was nothing to do.
+int
+kzero(void)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  if(kmem.nzero >= NZEROPAGES || (r = kmem.freelist) == 0){
+    release(&kmem.lock);
+    return 0;
+  }
+  // Off both lists while it is zeroed, without the lock, but
+  // still counted in nfree.
+  kmem.freelist = r->next;
+  release(&kmem.lock);
+
+  memset(r, 0, PGSIZE);
+
+  acquire(&kmem.lock);
+  r->next = kmem.zerolist;
+  kmem.zerolist = r;
+  kmem.nzero++;
+  release(&kmem.lock);
+  return 1;
+}
+
+// Add a reference to the allocated page v, which another
+// page table now maps too.
+void
+kref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+    panic("kref");
+  acquire(&kmem.lock);
+  if(kmem.ref[V2P(v) / PGSIZE] == 0)
+    panic("kref: free page");
+  kmem.ref[V2P(v) / PGSIZE]++;
+  release(&kmem.lock);
+}
+
+// Return the number of references to the allocated page v.
+int
+krefcount(char *v)
+{
+  int n;
+
+  acquire(&kmem.lock);
+  n = kmem.ref[V2P(v) / PGSIZE];
+  release(&kmem.lock);
+  return n;
+}
+
+// Report page allocator counters.
+void
+kmemstat(uint *allocs, uint *frees, uint *nfree)
+{
+  acquire(&kmem.lock);
+  *allocs = kmem.allocs;
+  *frees = kmem.frees;
+  *nfree = kmem.nfree;
+  release(&kmem.lock);
+}
+
@@ -0,0 +1,58 @@
+// Print page fault and memory counters.
+//
+//   memstat            system-wide totals since boot
+//   memstat pid        page faults taken by process pid
+//   memstat cmd args   system-wide counts for the duration of running cmd
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "memstat.h"
+
+static void
+get(int pid, struct memstat *st)
+{
+  if(getmemstat(pid, st) < 0){
+    printf(2, "memstat: no process %d\n", pid);
+    exit();
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct memstat before, after;
+  int pid;
+
+  pid = 0;
+  memset(&before, 0, sizeof(before));
+  if(argc > 1 && argv[1][0] >= '0' && argv[1][0] <= '9'){
+    pid = atoi(argv[1]);
+  } else if(argc > 1){
+    get(0, &before);
+    pid = fork();
+    if(pid < 0){
+      printf(2, "memstat: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      exec(argv[1], argv+1);
+      printf(2, "memstat: exec %s failed\n", argv[1]);
+      exit();
+    }
+    wait();
+    pid = 0;
+  }
+  get(pid, &after);
+
+  printf(1, "faults: lazy %d mmap %d cow %d (copied %d) bad %d\n",
+         after.lazy - before.lazy, after.mmap - before.mmap,
+         after.cow - before.cow, after.cowcopy - before.cowcopy,
+         after.bad - before.bad);
+  printf(1, "pages: allocated %d freed %d free now %d\n",
+         after.allocs - before.allocs, after.frees - before.frees,
+         after.freepages);
+  printf(1, "swap: in %d out %d\n",
+         after.swapin - before.swapin, after.swapout - before.swapout);
+  exit();
+}
@@ -0,0 +1,15 @@
+// Page fault and memory counters returned by getmemstat.
+// Fault counts are one process's, or system-wide for pid 0;
+// the page and swap-out counts are always system-wide.
+struct memstat {
+  uint lazy;        // heap or program pages faulted in
+  uint mmap;        // mmap'd file pages faulted in
+  uint cow;         // writes to copy-on-write pages
+  uint cowcopy;     // ... that had to copy the page
+  uint bad;         // faults that killed a process
+  uint swapin;      // paged out pages read back in
+  uint swapout;     // pages paged out since boot
+  uint allocs;      // pages allocated since boot
+  uint frees;       // pages freed since boot
+  uint freepages;   // pages free now
+};
@@ -0,0 +1,5 @@
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+
+#define MAP_SHARED  0x1
+#define MAP_PRIVATE 0x2
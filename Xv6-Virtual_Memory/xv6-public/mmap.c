@@ -0,0 +1,272 @@
+// Memory-mapped files.
+//
+// mmap(addr, len, prot, flags, fd, off) reserves a region of the
+// mmap area, [MMAPBASE, SHMBASE), in the calling process and
+// records it in one of the process's NVMA vma slots; nothing is
+// read yet.  The first touch of each page faults (see lazyfault)
+// and mmapfault maps the file's page from the page cache, the
+// same page read and write use, so a MAP_SHARED mapping sees
+// writes to the file at once and read sees stores to it.
+// MAP_PRIVATE maps it copy-on-write, so the first store copies
+// it.  Pages of a MAP_SHARED writable mapping that the hardware
+// marked dirty are written back to the file when they are
+// unmapped, by munmap, exec or exit, never past the end of the
+// file.  MAP_PRIVATE pages are never written back.  fork gives
+// the child the same regions: pages already faulted in are shared
+// with it, copy-on-write for MAP_PRIVATE.  munmap can remove a
+// whole region or a piece at either end of one.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "stat.h"
+#include "mman.h"
+
+// Return p's vma holding va, or 0.
+static struct vma*
+vmafind(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->va && va >= v->va && va < v->va + v->len)
+      return v;
+  return 0;
+}
+
+// Is [va, va+len) free of p's regions?
+static int
+vmafree(struct proc *p, uint va, uint len)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->va && va < v->va + v->len && v->va < va + len)
+      return 0;
+  return 1;
+}
+
+// Choose where a len-byte region goes: at addr if it is a free
+// page-aligned place in the mmap area, otherwise at the lowest one.
+// Returns 0 if there is no room.
+static uint
+vmaplace(struct proc *p, uint addr, uint len)
+{
+  struct vma *v;
+  uint va;
+
+  if(addr % PGSIZE == 0 && addr >= MMAPBASE && addr + len > addr &&
+     addr + len <= SHMBASE && vmafree(p, addr, len))
+    return addr;
+  va = MMAPBASE;
+  while(va + len > va && va + len <= SHMBASE){
+    for(v = p->vma; v < &p->vma[NVMA]; v++)
+      if(v->va && va < v->va + v->len && v->va < va + len)
+        break;
+    if(v == &p->vma[NVMA])
+      return va;
+    va = v->va + v->len;
+  }
+  return 0;
+}
+
+// Map len bytes of f from offset off into the current process.
+// Returns the address of the mapping, or -1.
+int
+mmap(uint addr, int len, int prot, int flags, struct file *f, int off)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint va;
+
+  if(len <= 0 || off < 0 || off % PGSIZE != 0)
+    return -1;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  if((prot & ~(PROT_READ|PROT_WRITE)) != 0 || prot == 0)
+    return -1;
+  if(f->type != FD_INODE || f->ip->type != T_FILE || !f->readable)
+    return -1;
+  if(flags == MAP_SHARED && (prot & PROT_WRITE) && !f->writable)
+    return -1;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->va == 0)
+      break;
+  if(v == &p->vma[NVMA])
+    return -1;
+  len = PGROUNDUP(len);
+  if((va = vmaplace(p, addr, len)) == 0)
+    return -1;
+
+  v->va = va;
+  v->len = len;
+  v->prot = prot;
+  v->flags = flags;
+  v->f = filedup(f);
+  v->off = off;
+  return va;
+}
+
+// Map the cached page of v's file that va falls in, for the
+// current process p.  May sleep reading the file.  Returns 0
+// or -1.
+int
+mmapfault(struct proc *p, uint va)
+{
+  struct vma *v;
+  char *mem;
+  int perm;
+
+  if((v = vmafind(p, va)) == 0)
+    return -1;
+  va = PGROUNDDOWN(va);
+  ilock(v->f->ip);
+  mem = pcget(v->f->ip, (v->off + (va - v->va)) / PGSIZE);
+  iunlock(v->f->ip);
+  if(mem == 0){
+    cprintf("mmapfault out of memory\n");
+    return -1;
+  }
+
+  perm = PTE_U;
+  if(v->prot & PROT_WRITE)
+    perm |= v->flags == MAP_SHARED ? PTE_W : PTE_COW;
+  if(uvmmap(p->pgdir, va, mem, perm) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Write the dirty page mem at va of v back to its file, stopping
+// at the end of the file, in pieces that fit in a log transaction
+// like filewrite.  Stores past the end of the file are cleared,
+// so that the next mapping of the cached page sees zeros there.
+static void
+writeback(struct vma *v, uint va, char *mem)
+{
+  struct inode *ip = v->f->ip;
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
+  uint off, n, i, n1;
+
+  off = v->off + (va - v->va);
+  ilock(ip);
+  n = off < ip->size ? ip->size - off : 0;
+  if(n > PGSIZE)
+    n = PGSIZE;
+  memset(mem + n, 0, PGSIZE - n);
+  iunlock(ip);
+  for(i = 0; i < n; i += n1){
+    n1 = n - i;
+    if(n1 > max)
+      n1 = max;
+    begin_op();
+    ilock(ip);
+    if(writei(ip, mem + i, off + i, n1) != n1)
+      n1 = n - i;  // give up on the rest of the page
+    iunlock(ip);
+    end_op();
+  }
+}
+
+// Remove [start, end) of v from pgdir, writing back dirty pages
+// of a shared writable mapping, and the region itself once none
+// of it is left.
+static void
+vmaunmap(struct vma *v, pde_t *pgdir, uint start, uint end)
+{
+  char *mem;
+  uint a;
+
+  if(v->flags == MAP_SHARED && (v->prot & PROT_WRITE)){
+    for(a = start; a < end; a += PGSIZE)
+      if((mem = uvmdirty(pgdir, a)) != 0)
+        writeback(v, a, mem);
+  }
+  deallocuvm(pgdir, end, start);
+
+  if(start == v->va){
+    v->off += end - start;
+    v->va = end;
+  }
+  v->len -= end - start;
+  if(v->len == 0){
+    fileclose(v->f);
+    v->va = 0;
+    v->f = 0;
+  }
+}
+
+// Unmap len bytes at addr from the current process.  The range
+// must be a whole region or begin or end one.
+int
+munmap(uint addr, int len)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint end;
+
+  if(len <= 0 || addr % PGSIZE != 0)
+    return -1;
+  if((v = vmafind(p, addr)) == 0)
+    return -1;
+  end = addr + PGROUNDUP(len);
+  if(end < addr || end > v->va + v->len)
+    return -1;
+  if(addr != v->va && end != v->va + v->len)
+    return -1;
+  vmaunmap(v, p->pgdir, addr, end);
+  lcr3(V2P(p->pgdir));
+  return 0;
+}
+
+// Give np, just created by fork, p's regions, sharing the pages
+// p has faulted in.
+int
+mmapfork(struct proc *p, struct proc *np)
+{
+  int i;
+
+  for(i = 0; i < NVMA; i++){
+    if(p->vma[i].va == 0)
+      continue;
+    np->vma[i] = p->vma[i];
+    filedup(np->vma[i].f);
+    if(uvmshare(p->pgdir, np->pgdir, p->vma[i].va,
+                p->vma[i].va + p->vma[i].len,
+                p->vma[i].flags == MAP_PRIVATE) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Unmap all of p's regions from pgdir, for exit or exec.
+void
+munmapall(struct proc *p, pde_t *pgdir)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->va)
+      vmaunmap(v, pgdir, v->va, v->va + v->len);
+}
+
+// Is [va, va+len) inside one of p's regions?
+int
+mmapcontains(struct proc *p, uint va, uint len)
+{
+  struct vma *v;
+
+  if((v = vmafind(p, va)) == 0)
+    return 0;
+  return va + len >= va && va + len <= v->va + v->len;
+}
@@ -0,0 +1,121 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "mman.h"
+#include "mmu.h"
+
+#define FILESZ (2 * PGSIZE + 100)  // 测试文件大小，最后一页不满
+
+/**
+ * mmap测试程序
+ *
+ * 该程序测试mmap和munmap系统调用的功能：
+ * 1. 创建一个两页多的测试文件
+ * 2. MAP_PRIVATE映射后读到文件内容，写入不影响文件
+ * 3. MAP_SHARED映射后写入，munmap时写回文件，文件大小不变
+ * 4. fork后子进程经由继承的MAP_SHARED映射写入，子进程退出时写回
+ * 5. MAP_SHARED映射与read/write共用页面缓存，不用munmap就互相可见
+ * 6. 只读映射不能写入
+ */
+static char buf[FILESZ];
+
+static void check(int ok, char* what) {
+    if(!ok) {
+        printf(1, "mmaptest: %s failed\n", what);
+        exit();
+    }
+}
+
+// 读回整个测试文件
+static void readfile(char* path) {
+    int fd = open(path, O_RDONLY);
+    check(fd >= 0, "open for read");
+    check(read(fd, buf, FILESZ) == FILESZ, "read back");
+    check(read(fd, buf, 1) == 0, "file size unchanged");
+    close(fd);
+}
+
+int main(int argc, char *argv[]) {
+    char* path = "mmaptest.tmp";
+    char* p;
+    int fd, fd2, i, pid;
+
+    // 创建测试文件
+    for(i = 0; i < FILESZ; i++)
+        buf[i] = 'a' + i % 26;
+    fd = open(path, O_CREATE | O_RDWR);
+    check(fd >= 0, "create");
+    check(write(fd, buf, FILESZ) == FILESZ, "write");
+    close(fd);
+
+    // 私有映射：读到文件内容，写入只改自己的副本
+    fd = open(path, O_RDWR);
+    check(fd >= 0, "open");
+    p = mmap(0, FILESZ, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    check(p != (char*)-1, "mmap private");
+    for(i = 0; i < FILESZ; i++)
+        check(p[i] == 'a' + i % 26, "private contents");
+    check(p[FILESZ] == 0, "zero past end of file");
+    p[0] = 'X';
+    check(munmap(p, FILESZ) == 0, "munmap private");
+    readfile(path);
+    check(buf[0] == 'a', "private write not written back");
+
+    // 共享映射：写入在munmap时写回文件
+    p = mmap(0, FILESZ, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    check(p != (char*)-1, "mmap shared");
+    p[0] = 'Y';
+    p[FILESZ - 1] = 'Z';
+    p[FILESZ] = 'W';  // 文件末尾之后的部分不写回
+    check(munmap(p, PGSIZE) == 0, "munmap first page");
+    check(munmap(p + PGSIZE, 2 * PGSIZE) == 0, "munmap rest");
+    check(munmap(p, PGSIZE) < 0, "munmap twice");
+    readfile(path);
+    check(buf[0] == 'Y' && buf[FILESZ - 1] == 'Z', "shared write back");
+
+    // fork继承的共享映射
+    p = mmap(0, FILESZ, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    check(p != (char*)-1, "mmap shared again");
+    pid = fork();
+    check(pid >= 0, "fork");
+    if(pid == 0) {
+        p[PGSIZE] = 'C';
+        exit();
+    }
+    wait();
+    check(munmap(p, FILESZ) == 0, "munmap after fork");
+    readfile(path);
+    check(buf[PGSIZE] == 'C', "child write back");
+
+    // 共享映射和read/write用的是页面缓存中的同一页
+    p = mmap(0, FILESZ, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    check(p != (char*)-1, "mmap shared cached");
+    p[0] = 'N';
+    readfile(path);
+    check(buf[0] == 'N', "read sees store to mapping");
+    fd2 = open(path, O_RDWR);
+    check(fd2 >= 0, "open second fd");
+    check(write(fd2, "Y", 1) == 1, "write under mapping");
+    close(fd2);
+    check(p[0] == 'Y', "mapping sees write");
+    check(munmap(p, FILESZ) == 0, "munmap cached");
+
+    // 只读映射不能写入
+    p = mmap(0, PGSIZE, PROT_READ, MAP_SHARED, fd, 0);
+    check(p != (char*)-1, "mmap read-only");
+    pid = fork();
+    check(pid >= 0, "fork");
+    if(pid == 0) {
+        p[0] = 'R';
+        printf(1, "mmaptest: write to read-only mapping succeeded\n");
+        exit();
+    }
+    wait();
+    check(p[0] == 'Y', "read-only contents");
+    close(fd);
+    unlink(path);
+
+    printf(1, "mmaptest ok\n");
+    exit();
+}
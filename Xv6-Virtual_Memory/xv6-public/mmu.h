@@ -82,6 +82,7 @@ struct segdesc {
 // Page directory and page table constants.
 #define NPDENTRIES      1024    // # directory entries per page directory
 #define NPTENTRIES      1024    // # PTEs per page table
+#define PDSIZE          (PGSIZE*NPTENTRIES)  // bytes mapped by a page directory entry
 #define PGSIZE          4096    // bytes mapped by a page
 
 #define PTXSHIFT        12      // offset of PTX in a linear address
@@ -94,12 +95,20 @@ struct segdesc {
 #define PTE_P           0x001   // Present
 #define PTE_W           0x002   // Writeable
 #define PTE_U           0x004   // User
+#define PTE_A           0x020   // Accessed
+#define PTE_D           0x040   // Dirty
 #define PTE_PS          0x080   // Page Size
+#define PTE_COW         0x200   // Copy-on-write (software, uses an AVL bit)
+#define PTE_SWAP        0x400   // Not present: paged out (software, AVL bit)
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)   ((uint)(pte) & ~0xFFF)
 #define PTE_FLAGS(pte)  ((uint)(pte) &  0xFFF)
 
+// A PTE_SWAP entry holds a swap slot where the address would be.
+#define SWAPPTE(slot)   (((uint)(slot) << 12) | PTE_SWAP)
+#define SWAPSLOT(pte)   ((uint)(pte) >> 12)
+
 #ifndef __ASSEMBLER__
 typedef uint pte_t;
 
@@ -0,0 +1,247 @@
+// Page cache.
+//
+// The page cache holds whole 4096-byte pages of regular files,
+// named by (dev, inum, page number), so that readi copies file
+// data out of memory a page at a time and mmap maps the very
+// pages the cache holds instead of reading the file into private
+// copies.  Each cached page holds one kalloc reference of its
+// own; pcget hands the caller another, which mmapfault gives to
+// the page table, so a page that is mapped stays alive even if
+// the cache drops it.  Only pages whose last reference is the
+// cache's are evicted, least recently used first.
+//
+// Pages are filled from the buffer cache (readiblocks) and kept
+// up to date by writei (pcupdate), always with the inode locked,
+// so a cached page never disagrees with the file and two
+// processes never fill the same page at once.  itrunc drops a
+// file's pages (pcinval).  The buffer cache only passes file data
+// through on the way to and from the disk and the log; it is the
+// page cache that keeps it.
+//
+// The cache also holds program pages (pctext): a page of a
+// program segment as lazyfault maps it, which starts at whatever
+// file offset the segment puts there and may end in zeros, so it
+// is not a file page.  Every process running the program maps
+// the same page copy-on-write.  A write to the file drops the
+// file's program pages rather than updating them, so processes
+// that fault them in afterwards see the new contents.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+#define PCHASH(dev, inum, off) (((dev) * 31 + (inum) * 17 + (off) / PGSIZE) % NPCHASH)
+
+struct cpage {
+  uint dev;
+  uint inum;
+  uint off;             // File offset of the page
+  uint len;             // 0 for a file page; for a program page,
+                        // the bytes from the file, the rest zero
+  char *mem;            // 0 if the slot is free
+  uint used;            // pcache.clock when last used
+  struct cpage *next;   // hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct cpage page[NPCPAGE];
+  struct cpage *hash[NPCHASH];
+  uint clock;
+} pcache;
+
+void
+pcinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+// Find the page of (dev, inum) at off holding len bytes of the
+// file, or a file page if len is 0.  Caller must hold pcache.lock.
+static struct cpage*
+pcfind(uint dev, uint inum, uint off, uint len)
+{
+  struct cpage *c;
+
+  for(c = pcache.hash[PCHASH(dev, inum, off)]; c; c = c->next)
+    if(c->dev == dev && c->inum == inum && c->off == off && c->len == len)
+      return c;
+  return 0;
+}
+
+// Unhash c and give up the cache's reference to its page.
+// Caller must hold pcache.lock.
+static void
+pcdrop(struct cpage *c)
+{
+  struct cpage **pp;
+
+  pp = &pcache.hash[PCHASH(c->dev, c->inum, c->off)];
+  while(*pp != c)
+    pp = &(*pp)->next;
+  *pp = c->next;
+  kfree(c->mem);
+  c->mem = 0;
+}
+
+// Return a reference to the cached page of ip at off holding len
+// bytes, or 0 if it is not cached.
+static char*
+pclookup(struct inode *ip, uint off, uint len)
+{
+  struct cpage *c;
+  char *mem;
+
+  acquire(&pcache.lock);
+  mem = 0;
+  if((c = pcfind(ip->dev, ip->inum, off, len)) != 0){
+    c->used = ++pcache.clock;
+    mem = c->mem;
+    kref(mem);
+  }
+  release(&pcache.lock);
+  return mem;
+}
+
+// Cache mem, just filled, as the page of ip at off holding len
+// bytes, unless every slot holds a page that is mapped somewhere.
+static void
+pcinsert(struct inode *ip, uint off, uint len, char *mem)
+{
+  struct cpage *c, *victim;
+  uint h;
+
+  acquire(&pcache.lock);
+  victim = 0;
+  for(c = pcache.page; c < &pcache.page[NPCPAGE]; c++){
+    if(c->mem == 0){
+      victim = c;
+      break;
+    }
+    if((victim == 0 || c->used < victim->used) && krefcount(c->mem) == 1)
+      victim = c;
+  }
+  if(victim){
+    if(victim->mem)
+      pcdrop(victim);
+    victim->dev = ip->dev;
+    victim->inum = ip->inum;
+    victim->off = off;
+    victim->len = len;
+    victim->mem = mem;
+    victim->used = ++pcache.clock;
+    h = PCHASH(ip->dev, ip->inum, off);
+    victim->next = pcache.hash[h];
+    pcache.hash[h] = victim;
+    kref(mem);
+  }
+  release(&pcache.lock);
+}
+
+// Return a reference to the cached page pgno of ip, a regular
+// file, reading it in if it is not cached.  Bytes past the end of
+// the file read as zeros.  The caller gives the reference up with
+// kfree.  If every slot holds a page that is mapped somewhere, the
+// page is returned without being cached.  Caller must hold
+// ip->lock.  Returns 0 if memory ran out.
+char*
+pcget(struct inode *ip, uint pgno)
+{
+  char *mem;
+  uint off, n;
+
+  off = pgno * PGSIZE;
+  if((mem = pclookup(ip, off, 0)) != 0)
+    return mem;
+
+  if((mem = kzalloc()) == 0)
+    return 0;
+  if(off < ip->size){
+    n = ip->size - off;
+    if(n > PGSIZE)
+      n = PGSIZE;
+    readiblocks(ip, mem, off, n);
+  }
+  pcinsert(ip, off, 0, mem);
+  return mem;
+}
+
+// Return a reference to the program page of ip holding the n
+// bytes of the file at off, which need not be page aligned,
+// followed by zeros, reading it in if it is not cached; see
+// pcget.  Caller must hold ip->lock.  Returns 0 if the bytes are
+// not all in the file or memory ran out.
+char*
+pctext(struct inode *ip, uint off, uint n)
+{
+  char *mem;
+
+  if(n == 0 || n > PGSIZE || off + n < off || off + n > ip->size)
+    return 0;
+  if((mem = pclookup(ip, off, n)) != 0)
+    return mem;
+
+  if((mem = ualloc(1)) == 0)
+    return 0;
+  readiblocks(ip, mem, off, n);
+  pcinsert(ip, off, n, mem);
+  ip->text = 1;
+  return mem;
+}
+
+// Copy the n bytes at src, just written to ip at off, into the
+// file pages of ip that are cached, and drop its program pages.
+// Caller must hold ip->lock.
+void
+pcupdate(struct inode *ip, char *src, uint off, uint n)
+{
+  struct cpage *c;
+  char *mem;
+  uint m;
+
+  if(ip->text && n > 0){
+    acquire(&pcache.lock);
+    for(c = pcache.page; c < &pcache.page[NPCPAGE]; c++)
+      if(c->mem && c->len && c->dev == ip->dev && c->inum == ip->inum)
+        pcdrop(c);
+    release(&pcache.lock);
+    ip->text = 0;
+  }
+  for(; n > 0; n -= m, off += m, src += m){
+    m = PGSIZE - off%PGSIZE;
+    if(m > n)
+      m = n;
+    acquire(&pcache.lock);
+    mem = 0;
+    if((c = pcfind(ip->dev, ip->inum, PGROUNDDOWN(off), 0)) != 0){
+      mem = c->mem;
+      kref(mem);
+    }
+    release(&pcache.lock);
+    if(mem == 0)
+      continue;
+    // writeback writes a mapped page from the page itself.
+    if(mem + off%PGSIZE != src)
+      memmove(mem + off%PGSIZE, src, m);
+    kfree(mem);
+  }
+}
+
+// Drop all of ip's cached pages, because its contents are going
+// away.  Caller must hold ip->lock.
+void
+pcinval(struct inode *ip)
+{
+  struct cpage *c;
+
+  acquire(&pcache.lock);
+  for(c = pcache.page; c < &pcache.page[NPCPAGE]; c++)
+    if(c->mem && c->dev == ip->dev && c->inum == ip->inum)
+      pcdrop(c);
+  release(&pcache.lock);
+}
@@ -7,8 +7,18 @@
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define NSEG          4  // max program segments paged in from the file
+#define NSHM          8  // shared memory segments per system
+#define SHMPAGES     16  // max pages in a shared memory segment
+#define NSHMAT        4  // shared memory segments a process can attach
+#define NVMA          8  // mmap regions per process
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       1000  // size of file system in blocks
+#define NSWAP        1024  // pages of swap space, on disk after the file system
+#define SWAPSIZE     (NSWAP*8)  // size of swap space in blocks
+#define NPCPAGE     256  // pages in the file page cache
+#define NPCHASH      61  // buckets in the page cache hash table
+#define NZEROPAGES   64  // free pages kept zeroed for kzalloc
 
@@ -88,6 +88,8 @@ allocproc(void)
 found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->insyscall = 0;
+  memset(p->faults, 0, sizeof(p->faults));
 
   release(&ptable.lock);
 
@@ -154,6 +156,8 @@ userinit(void)
 }
 
 // Grow current process's memory by n bytes.
+// Growing only raises sz; the pages are allocated when first
+// touched (see lazyfault).
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
@@ -163,8 +167,9 @@ growproc(int n)
 
   sz = curproc->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    if(sz + n < sz || sz + n > MMAPBASE)
       return -1;
+    sz += n;
   } else if(n < 0){
     if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
@@ -196,6 +201,16 @@ fork(void)
     np->state = UNUSED;
     return -1;
   }
+  if(shmfork(curproc, np) < 0 || mmapfork(curproc, np) < 0){
+    munmapall(np, np->pgdir);
+    shmrelease(np);
+    freevm(np->pgdir);
+    np->pgdir = 0;
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
   np->sz = curproc->sz;
   np->parent = curproc;
   *np->tf = *curproc->tf;
@@ -207,6 +222,10 @@ fork(void)
     if(curproc->ofile[i])
       np->ofile[i] = filedup(curproc->ofile[i]);
   np->cwd = idup(curproc->cwd);
+  if(curproc->exe)
+    np->exe = idup(curproc->exe);
+  np->nseg = curproc->nseg;
+  memmove(np->seg, curproc->seg, sizeof(np->seg));
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
@@ -242,10 +261,17 @@ exit(void)
     }
   }
 
+  munmapall(curproc, curproc->pgdir);
+  shmrelease(curproc);
+
   begin_op();
   iput(curproc->cwd);
+  if(curproc->exe)
+    iput(curproc->exe);
   end_op();
   curproc->cwd = 0;
+  curproc->exe = 0;
+  curproc->nseg = 0;
 
   acquire(&ptable.lock);
 
@@ -324,6 +350,7 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int ran;
   c->proc = 0;
   
   for(;;){
@@ -331,10 +358,12 @@ scheduler(void)
     sti();
 
     // Loop over process table looking for process to run.
+    ran = 0;
     acquire(&ptable.lock);
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
       if(p->state != RUNNABLE)
         continue;
+      ran = 1;
 
       // Switch to chosen process.  It is the process's job
       // to release ptable.lock and then reacquire it
@@ -352,6 +381,9 @@ scheduler(void)
     }
     release(&ptable.lock);
 
+    // Nothing to run: zero a page for kzalloc meanwhile.
+    if(!ran)
+      kzero();
   }
 }
 
@@ -407,6 +439,7 @@ forkret(void)
     first = 0;
     iinit(ROOTDEV);
     initlog(ROOTDEV);
+    swapinit(ROOTDEV);
   }
 
   // Return to "caller", actually trapret (see allocproc).
@@ -496,6 +529,70 @@ kill(int pid)
   return -1;
 }
 
+// Copy the page fault counts of process pid to out.
+// Returns 0, or -1 if there is no such process.
+int
+getprocfaults(int pid, uint *out)
+{
+  struct proc *p;
+
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->pid == pid && p->state != UNUSED){
+      memmove(out, p->faults, sizeof(p->faults));
+      release(&ptable.lock);
+      return 0;
+    }
+  }
+  release(&ptable.lock);
+  return -1;
+}
+
+// Clock hand of pageout: the process slot and user address it
+// looks at next.  Protected by ptable.lock.
+static struct {
+  int proc;
+  uint va;
+} hand;
+
+// Page out one user page of some other process to swap, sweeping
+// the processes' pages like a clock hand: a page touched since the
+// hand last passed is spared this time round.  A process running
+// on a cpu, or in a system call, is skipped, since the kernel may
+// touch its memory holding a spinlock and so unable to fault it
+// back in.  Sleeps writing the page.  Returns 0, or -1 if no page
+// or no swap slot is free.
+int
+pageout(void)
+{
+  struct proc *p;
+  char *mem;
+  int slot, n;
+
+  if((slot = swapalloc()) < 0)
+    return -1;
+  mem = 0;
+  acquire(&ptable.lock);
+  // Twice round, so that the accessed bits cleared the first time
+  // can let pages go the second.
+  for(n = 0; n <= 2*NPROC; n++){
+    p = &ptable.proc[hand.proc];
+    if((p->state == SLEEPING || p->state == RUNNABLE) && !p->insyscall &&
+       p != myproc() && (mem = uvmevict(p->pgdir, p->sz, &hand.va, slot)) != 0)
+      break;
+    hand.proc = (hand.proc + 1) % NPROC;
+    hand.va = 0;
+  }
+  release(&ptable.lock);
+  if(mem == 0){
+    swapcancel(slot);
+    return -1;
+  }
+  swapwrite(slot, mem);
+  kfree(mem);
+  return 0;
+}
+
 //PAGEBREAK: 36
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
@@ -32,8 +32,38 @@ struct context {
   uint eip;
 };
 
+// A region of a file mapped by mmap, faulted in a page at a time.
+struct vma {
+  uint va;                     // Start, page aligned; 0 if unused
+  uint len;                    // Bytes, a multiple of PGSIZE
+  int prot;                    // PROT_ bits, see mman.h
+  int flags;                   // MAP_SHARED or MAP_PRIVATE
+  struct file *f;              // Mapped file
+  uint off;                    // File offset of va
+};
+
+// Kinds of page fault counted in proc->faults and system-wide;
+// see memstat.h.
+enum faultkind {
+  FAULT_LAZY,                  // Heap or program page faulted in
+  FAULT_MMAP,                  // mmap'd file page faulted in
+  FAULT_COW,                   // Write to a copy-on-write page
+  FAULT_COWCOPY,               // ... that had to copy the page
+  FAULT_BAD,                   // Fault that killed the process
+  FAULT_SWAP,                  // Paged out page read back in
+  NFAULTKIND
+};
+
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// A program segment exec left in the file, to be read into
+// memory a page at a time as it is touched.
+struct segment {
+  uint va;                     // Start, page aligned
+  uint off;                    // File offset of va
+  uint filesz;                 // Bytes from the file; the rest is zero
+};
+
 // Per-process state
 struct proc {
   uint sz;                     // Size of process memory (bytes)
@@ -48,6 +78,13 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct inode *exe;           // Program file the segments are paged in from
+  struct segment seg[NSEG];    // Program segments
+  int nseg;                    // Number of valid entries in seg
+  int shm[NSHMAT];             // Attached shared segment id+1 per slot, 0 if free
+  struct vma vma[NVMA];        // mmap regions
+  uint faults[NFAULTKIND];     // Page faults taken, by kind
+  int insyscall;               // In a system call: pageout leaves it alone
   char name[16];               // Process name (debugging)
 };
 
@@ -0,0 +1,224 @@
+// Shared memory segments.
+//
+// shmget(key, size) finds or creates the segment named key, and
+// shmat(id) maps all its pages into the calling process, so that
+// processes attached to one segment see each other's writes with
+// no copying.  Each process has NSHMAT attachment slots; slot i
+// is mapped at a fixed address, SHMBASE + i*SHMPAGES*PGSIZE,
+// above anything growproc can reach.  The segment table holds one
+// reference to each page and every mapping one more, so a page
+// lives until the last process unmaps it.  A segment is destroyed
+// when its last attachment goes, by shmdt, exec or exit; fork
+// attaches the child to the parent's segments.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+
+struct shmseg {
+  int key;
+  int npages;                  // 0 if the slot is free
+  int nattach;                 // attachments in all processes
+  char *pages[SHMPAGES];
+};
+
+struct {
+  struct spinlock lock;
+  struct shmseg seg[NSHM];
+} shmtable;
+
+void
+shminit(void)
+{
+  initlock(&shmtable.lock, "shm");
+}
+
+static uint
+shmva(int slot)
+{
+  return SHMBASE + slot*SHMPAGES*PGSIZE;
+}
+
+// Drop an attachment of s.  Caller must hold shmtable.lock.
+static void
+shmput(struct shmseg *s)
+{
+  int i;
+
+  if(--s->nattach > 0)
+    return;
+  for(i = 0; i < s->npages; i++)
+    kfree(s->pages[i]);
+  s->npages = 0;
+}
+
+// Return the id of the segment named key, creating it with
+// size bytes if there is none.  An existing segment must be
+// at least size bytes.
+int
+shmget(int key, int size)
+{
+  struct shmseg *s, *free;
+  int i, npages;
+
+  npages = PGROUNDUP(size) / PGSIZE;
+  if(size <= 0 || npages > SHMPAGES)
+    return -1;
+
+  acquire(&shmtable.lock);
+  free = 0;
+  for(s = shmtable.seg; s < &shmtable.seg[NSHM]; s++){
+    if(s->npages == 0){
+      if(free == 0)
+        free = s;
+    } else if(s->key == key){
+      release(&shmtable.lock);
+      return s->npages >= npages ? s - shmtable.seg : -1;
+    }
+  }
+  if((s = free) == 0){
+    release(&shmtable.lock);
+    return -1;
+  }
+  for(i = 0; i < npages; i++){
+    if((s->pages[i] = kzalloc()) == 0){
+      while(--i >= 0)
+        kfree(s->pages[i]);
+      release(&shmtable.lock);
+      return -1;
+    }
+  }
+  s->key = key;
+  s->npages = npages;
+  // No attachment yet; the first shmat makes it 1.
+  s->nattach = 0;
+  release(&shmtable.lock);
+  return s - shmtable.seg;
+}
+
+// Attach segment id to process p in its slot'th slot, which must
+// be free.  Caller must hold shmtable.lock.
+static int
+shmattach(struct proc *p, int slot, int id)
+{
+  struct shmseg *s;
+
+  s = &shmtable.seg[id];
+  if(shmmap(p->pgdir, shmva(slot), s->pages, s->npages) < 0)
+    return -1;
+  s->nattach++;
+  p->shm[slot] = id + 1;
+  return 0;
+}
+
+// Map segment id into the current process.
+// Returns the address it is mapped at, or -1.
+int
+shmat(int id)
+{
+  struct proc *p = myproc();
+  int slot;
+
+  if(id < 0 || id >= NSHM)
+    return -1;
+  for(slot = 0; slot < NSHMAT; slot++)
+    if(p->shm[slot] == 0)
+      break;
+  if(slot == NSHMAT)
+    return -1;
+
+  acquire(&shmtable.lock);
+  if(shmtable.seg[id].npages == 0 || shmattach(p, slot, id) < 0){
+    release(&shmtable.lock);
+    return -1;
+  }
+  release(&shmtable.lock);
+  return shmva(slot);
+}
+
+// Unmap the segment the current process attached at addr.
+int
+shmdt(uint addr)
+{
+  struct proc *p = myproc();
+  struct shmseg *s;
+  int slot;
+
+  for(slot = 0; slot < NSHMAT; slot++)
+    if(p->shm[slot] && shmva(slot) == addr)
+      break;
+  if(slot == NSHMAT)
+    return -1;
+
+  acquire(&shmtable.lock);
+  s = &shmtable.seg[p->shm[slot] - 1];
+  deallocuvm(p->pgdir, addr + s->npages*PGSIZE, addr);
+  lcr3(V2P(p->pgdir));
+  p->shm[slot] = 0;
+  shmput(s);
+  release(&shmtable.lock);
+  return 0;
+}
+
+// Attach child np, which has just been created by fork, to the
+// segments its parent p is attached to, in the same slots.
+int
+shmfork(struct proc *p, struct proc *np)
+{
+  int slot;
+
+  acquire(&shmtable.lock);
+  for(slot = 0; slot < NSHMAT; slot++){
+    if(p->shm[slot] && shmattach(np, slot, p->shm[slot] - 1) < 0){
+      release(&shmtable.lock);
+      return -1;
+    }
+  }
+  release(&shmtable.lock);
+  return 0;
+}
+
+// Drop all of p's attachments, for exit or exec.  The mappings
+// are left to go with the old page table; their references keep
+// the pages alive until then.
+void
+shmrelease(struct proc *p)
+{
+  int slot;
+
+  acquire(&shmtable.lock);
+  for(slot = 0; slot < NSHMAT; slot++){
+    if(p->shm[slot]){
+      shmput(&shmtable.seg[p->shm[slot] - 1]);
+      p->shm[slot] = 0;
+    }
+  }
+  release(&shmtable.lock);
+}
+
+// Is [va, va+len) inside one of p's attached segments?
+int
+shmcontains(struct proc *p, uint va, uint len)
+{
+  int slot, npages;
+
+  if(va + len < va)
+    return 0;
+  acquire(&shmtable.lock);
+  for(slot = 0; slot < NSHMAT; slot++){
+    if(p->shm[slot] == 0)
+      continue;
+    npages = shmtable.seg[p->shm[slot] - 1].npages;
+    if(va >= shmva(slot) && va + len <= shmva(slot) + npages*PGSIZE){
+      release(&shmtable.lock);
+      return 1;
+    }
+  }
+  release(&shmtable.lock);
+  return 0;
+}
@@ -0,0 +1,75 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "mmu.h"
+
+#define KEY 42      // 测试用的共享内存段名
+#define N   1000    // 生产者写入的整数个数
+
+/**
+ * 共享内存测试程序
+ *
+ * 该程序测试shmget、shmat和shmdt系统调用的功能：
+ * 1. 父进程创建并映射一个两页的共享内存段
+ * 2. 子进程用同一个key找到该段并映射，作为生产者写入数据
+ * 3. 父进程作为消费者直接读取子进程写入的数据
+ * 4. fork继承映射：子进程不经shmat就能写入，父进程能看到
+ * 5. shmdt之后再次shmat，数据仍然保留
+ */
+static void check(int ok, char* what) {
+    if(!ok) {
+        printf(1, "shmtest: %s failed\n", what);
+        exit();
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int id, i, pid;
+    int* buf;
+    int* cbuf;
+
+    // 创建并映射共享内存段
+    id = shmget(KEY, 2 * PGSIZE);
+    check(id >= 0, "shmget");
+    buf = (int*)shmat(id);
+    check(buf != (int*)-1, "shmat");
+    check(shmget(KEY, 4 * PGSIZE) < 0, "shmget larger than segment");
+
+    // 子进程作为生产者写入数据
+    pid = fork();
+    check(pid >= 0, "fork");
+    if(pid == 0) {
+        cbuf = (int*)shmat(shmget(KEY, PGSIZE));
+        check(cbuf != (int*)-1, "child shmat");
+        for(i = 1; i <= N; i++)
+            cbuf[i] = i * i;
+        cbuf[0] = N;
+        exit();
+    }
+    wait();
+
+    // 父进程直接读取
+    check(buf[0] == N, "consumer sees count");
+    for(i = 1; i <= N; i++)
+        check(buf[i] == i * i, "consumer sees data");
+
+    // fork继承的映射
+    pid = fork();
+    check(pid >= 0, "fork");
+    if(pid == 0) {
+        buf[0] = -1;
+        exit();
+    }
+    wait();
+    check(buf[0] == -1, "inherited mapping");
+
+    // shmdt之后再次shmat
+    cbuf = (int*)shmat(id);
+    check(cbuf != (int*)-1 && cbuf != buf, "second shmat");
+    check(shmdt(buf) == 0, "shmdt");
+    check(cbuf[0] == -1 && cbuf[N] == N * N, "data kept after shmdt");
+    check(shmdt(buf) < 0, "shmdt twice");
+
+    printf(1, "shmtest ok\n");
+    exit();
+}
@@ -0,0 +1,154 @@
+// Slab allocator for small kernel objects.
+//
+// A slabcache hands out objects of one size, carved from pages
+// that kalloc gives it.  Each page, a slab, starts with a struct
+// slab and holds as many objects as fit after it, the free ones
+// threaded on the slab's free list; an object's slab is found by
+// rounding its address down to the page.  A slab whose objects are
+// all free goes back to kalloc, except that the cache keeps one,
+// so that allocating and freeing one object over and over does not
+// take and give back a page each time.
+//
+// In front of the slabs each cpu keeps a magazine of up to MAGSIZE
+// free objects, which slaballoc and slabfree use with interrupts
+// off and no lock.  Only when its magazine is empty or full does a
+// cpu take the cache's lock, to move half a magazine of objects
+// from or to the slabs.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "slab.h"
+
+struct obj {
+  struct obj *next;
+};
+
+struct slab {
+  struct slabcache *cache;
+  struct slab *next;          // On cache->slabs
+  struct obj *free;
+  uint nfree;
+};
+
+void
+slabinit(struct slabcache *c, char *name, uint size)
+{
+  initlock(&c->lock, name);
+  c->name = name;
+  if(size < sizeof(struct obj))
+    size = sizeof(struct obj);
+  c->size = (size + 3) & ~3;
+  c->perslab = (PGSIZE - sizeof(struct slab)) / c->size;
+  if(c->perslab == 0)
+    panic("slabinit");
+}
+
+// Take a free object from the slabs, adding a slab if none has
+// one.  Caller must hold c->lock.  Returns 0 if memory ran out.
+static void*
+slabget(struct slabcache *c)
+{
+  struct slab *s;
+  struct obj *o;
+  uint i;
+
+  if((s = c->slabs) == 0){
+    if((s = (struct slab*)kalloc()) == 0)
+      return 0;
+    s->cache = c;
+    s->free = 0;
+    for(i = 0; i < c->perslab; i++){
+      o = (struct obj*)((char*)(s + 1) + i*c->size);
+      o->next = s->free;
+      s->free = o;
+    }
+    s->nfree = c->perslab;
+    s->next = 0;
+    c->slabs = s;
+    c->nempty++;
+  }
+  if(s->nfree == c->perslab)
+    c->nempty--;
+  o = s->free;
+  s->free = o->next;
+  if(--s->nfree == 0)
+    c->slabs = s->next;
+  return o;
+}
+
+// Give the object v back to its slab.  Caller must hold c->lock.
+static void
+slabput(struct slabcache *c, void *v)
+{
+  struct slab *s, **pp;
+  struct obj *o;
+
+  s = (struct slab*)PGROUNDDOWN((uint)v);
+  if(s->cache != c)
+    panic("slabfree");
+  if(s->nfree == 0){
+    s->next = c->slabs;
+    c->slabs = s;
+  }
+  o = (struct obj*)v;
+  o->next = s->free;
+  s->free = o;
+  if(++s->nfree < c->perslab)
+    return;
+  if(c->nempty == 0){
+    c->nempty++;
+    return;
+  }
+  for(pp = &c->slabs; *pp != s; pp = &(*pp)->next)
+    ;
+  *pp = s->next;
+  kfree((char*)s);
+}
+
+// Allocate an object from c.
+// Returns 0 if the memory cannot be allocated.
+void*
+slaballoc(struct slabcache *c)
+{
+  struct magazine *m;
+  void *v;
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == 0){
+    acquire(&c->lock);
+    while(m->n < MAGSIZE/2 && (v = slabget(c)) != 0)
+      m->obj[m->n++] = v;
+    release(&c->lock);
+  }
+  v = 0;
+  if(m->n > 0)
+    v = m->obj[--m->n];
+  popcli();
+  return v;
+}
+
+// Free the object v, which slaballoc(c) returned.
+void
+slabfree(struct slabcache *c, void *v)
+{
+  struct magazine *m;
+
+  // Fill with junk to catch dangling refs.
+  memset(v, 1, c->size);
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == MAGSIZE){
+    acquire(&c->lock);
+    while(m->n > MAGSIZE/2)
+      slabput(c, m->obj[--m->n]);
+    release(&c->lock);
+  }
+  m->obj[m->n++] = v;
+  popcli();
+}
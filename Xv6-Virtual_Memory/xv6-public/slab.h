@@ -0,0 +1,20 @@
+// Caches of small kernel objects of one size; see slab.c.
+
+#define MAGSIZE 8   // free objects a cpu keeps on hand per cache
+
+struct slab;
+
+struct magazine {
+  int n;
+  void *obj[MAGSIZE];
+};
+
+struct slabcache {
+  struct spinlock lock;
+  char *name;
+  uint size;                  // Bytes per object
+  uint perslab;               // Objects per slab
+  struct slab *slabs;         // Slabs with a free object
+  uint nempty;                // ... of which all free
+  struct magazine mag[NCPU];  // Free objects each cpu keeps
+};
@@ -0,0 +1,182 @@
+// Swap space.
+//
+// mkfs leaves SWAPSIZE blocks after the file system for paging
+// out user memory, one page per slot.  When kalloc runs dry,
+// ualloc has pageout (proc.c) take a page that only one page
+// table maps, chosen by a clock sweep over all the processes, and
+// write it to a free slot; the page's PTE then holds the slot
+// number with PTE_SWAP instead of a physical address (see mmu.h).
+// When the process touches the page again, lazyfault reads it back
+// into a fresh page.  fork copies a swapped PTE and counts a second
+// reference to the slot, so each process reads in its own copy,
+// and the slot is free once the last of them has.
+//
+// A slot being written is busy: reading it in waits for the write,
+// and it cannot be handed out again until the write is done.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+
+#define SLOTBLOCKS (PGSIZE / BSIZE)
+#define NPAGEOUT   4  // pages ualloc pages out before giving up
+
+struct {
+  struct spinlock lock;
+  uint dev;
+  uint start;          // First block of the swap area
+  uint nslot;          // Slots in it, at most NSWAP
+  uchar ref[NSWAP];    // PTEs naming each slot
+  uchar busy[NSWAP];   // Slot is being written
+  uint outs;           // Pages written out since boot
+} swap;
+
+// Find the swap area.  Until this runs there is none, and ualloc
+// is just kalloc.  Called from forkret, after iinit.
+void
+swapinit(int dev)
+{
+  struct superblock sb;
+
+  initlock(&swap.lock, "swap");
+  readsb(dev, &sb);
+  swap.dev = dev;
+  swap.start = sb.swapstart;
+  swap.nslot = sb.nswap / SLOTBLOCKS;
+  if(swap.nslot > NSWAP)
+    swap.nslot = NSWAP;
+}
+
+// Claim a free slot for a page about to be written out, busy
+// until swapwrite finishes.  Returns -1 if swap is full.
+int
+swapalloc(void)
+{
+  int i;
+
+  acquire(&swap.lock);
+  for(i = 0; i < swap.nslot; i++){
+    if(swap.ref[i] == 0 && !swap.busy[i]){
+      swap.ref[i] = 1;
+      swap.busy[i] = 1;
+      release(&swap.lock);
+      return i;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+// Give back a slot from swapalloc that no page went to after all.
+void
+swapcancel(int slot)
+{
+  acquire(&swap.lock);
+  swap.ref[slot] = 0;
+  swap.busy[slot] = 0;
+  release(&swap.lock);
+}
+
+// Add a reference to slot, for a PTE that fork copied.
+void
+swapdup(int slot)
+{
+  acquire(&swap.lock);
+  if(swap.ref[slot] == 0)
+    panic("swapdup");
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+// Drop a reference to slot: a PTE naming it has been read in or
+// freed.
+void
+swapfree(int slot)
+{
+  acquire(&swap.lock);
+  if(swap.ref[slot] == 0)
+    panic("swapfree");
+  swap.ref[slot]--;
+  release(&swap.lock);
+}
+
+// Write the page mem to slot, and mark the slot idle.
+void
+swapwrite(int slot, char *mem)
+{
+  struct buf *b;
+  int i;
+
+  for(i = 0; i < SLOTBLOCKS; i++){
+    b = bread(swap.dev, swap.start + slot*SLOTBLOCKS + i);
+    memmove(b->data, mem + i*BSIZE, BSIZE);
+    bwrite(b);
+    brelse(b);
+  }
+  acquire(&swap.lock);
+  swap.busy[slot] = 0;
+  swap.outs++;
+  wakeup(&swap.busy[slot]);
+  release(&swap.lock);
+}
+
+// Read slot into the page mem, once any write to it is done.
+void
+swapread(int slot, char *mem)
+{
+  struct buf *b;
+  int i;
+
+  acquire(&swap.lock);
+  while(swap.busy[slot])
+    sleep(&swap.busy[slot], &swap.lock);
+  release(&swap.lock);
+  for(i = 0; i < SLOTBLOCKS; i++){
+    b = bread(swap.dev, swap.start + slot*SLOTBLOCKS + i);
+    memmove(mem + i*BSIZE, b->data, BSIZE);
+    brelse(b);
+  }
+}
+
+// Report how many pages have been paged out.
+uint
+swapouts(void)
+{
+  uint n;
+
+  acquire(&swap.lock);
+  n = swap.outs;
+  release(&swap.lock);
+  return n;
+}
+
+// Allocate a page for user memory like kalloc, or kzalloc if zero
+// is set, but when memory has run out page out other processes'
+// pages to make room, if the caller is a process holding no
+// spinlock and so can sleep on the disk.  Returns 0 if that fails
+// too.
+char*
+ualloc(int zero)
+{
+  char *mem;
+  int i, cansleep;
+
+  if((mem = zero ? kzalloc() : kalloc()) != 0 || swap.nslot == 0)
+    return mem;
+  pushcli();
+  cansleep = mycpu()->ncli == 1 && myproc() != 0;
+  popcli();
+  for(i = 0; cansleep && i < NPAGEOUT; i++){
+    if(pageout() < 0)
+      break;
+    if((mem = zero ? kzalloc() : kalloc()) != 0)
+      break;
+  }
+  return mem;
+}
@@ -21,6 +21,8 @@ fetchint(uint addr, int *ip)
 
   if(addr >= curproc->sz || addr+4 > curproc->sz)
     return -1;
+  if(uvmpopulate(curproc, addr, 4) < 0)
+    return -1;
   *ip = *(int*)(addr);
   return 0;
 }
@@ -39,6 +41,9 @@ fetchstr(uint addr, char **pp)
   *pp = (char*)addr;
   ep = (char*)curproc->sz;
   for(s = *pp; s < ep; s++){
+    if((s == *pp || (uint)s % PGSIZE == 0) &&
+       uvmpopulate(curproc, (uint)s, 1) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
   }
@@ -63,7 +68,12 @@ argptr(int n, char **pp, int size)
  
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  if(size < 0)
+    return -1;
+  if(((uint)i >= curproc->sz || (uint)i+size > curproc->sz) &&
+     !shmcontains(curproc, i, size) && !mmapcontains(curproc, i, size))
+    return -1;
+  if(uvmpopulate(curproc, i, size) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
@@ -105,6 +115,12 @@ extern int sys_write(void);
 extern int sys_uptime(void);
 extern int sys_mprotect(void);
 extern int sys_munprotect(void);
+extern int sys_shmget(void);
+extern int sys_shmat(void);
+extern int sys_shmdt(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_getmemstat(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -130,6 +146,12 @@ static int (*syscalls[])(void) = {
 [SYS_close]   sys_close,
 [SYS_mprotect] sys_mprotect,
 [SYS_munprotect] sys_munprotect,
+[SYS_shmget]  sys_shmget,
+[SYS_shmat]   sys_shmat,
+[SYS_shmdt]   sys_shmdt,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_getmemstat] sys_getmemstat,
 };
 
 void
@@ -22,3 +22,9 @@
 #define SYS_close  21
 #define SYS_mprotect 22
 #define SYS_munprotect 23
+#define SYS_shmget 24
+#define SYS_shmat  25
+#define SYS_shmdt  26
+#define SYS_mmap   27
+#define SYS_munmap 28
+#define SYS_getmemstat 29
@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "memstat.h"
 
 int
 sys_fork(void)
@@ -124,4 +125,83 @@ int sys_munprotect(void) {
         return -1;
     }
     return munprotect(addr, len);
-}
\ No newline at end of file
+}
+
+/**
+ * sys_getmemstat - getmemstat系统调用的包装函数
+ *
+ * 返回进程pid的页面错误计数（pid为0时返回全系统的计数）以及全系统的
+ * 页面分配计数，供memstat程序使用。
+ *
+ * @return 成功返回0，进程不存在时返回-1
+ */
+int sys_getmemstat(void) {
+    int pid;
+    struct memstat* st;
+    uint faults[NFAULTKIND];
+    // 从用户空间获取参数
+    if(argint(0, &pid) < 0 || argptr(1, (char**)&st, sizeof(*st)) < 0) {
+        return -1;
+    }
+    if(pid == 0)
+        getfaults(faults);
+    else if(getprocfaults(pid, faults) < 0)
+        return -1;
+    st->lazy = faults[FAULT_LAZY];
+    st->mmap = faults[FAULT_MMAP];
+    st->cow = faults[FAULT_COW];
+    st->cowcopy = faults[FAULT_COWCOPY];
+    st->bad = faults[FAULT_BAD];
+    st->swapin = faults[FAULT_SWAP];
+    st->swapout = swapouts();
+    kmemstat(&st->allocs, &st->frees, &st->freepages);
+    return 0;
+}
+
+/**
+ * sys_shmget - shmget系统调用的包装函数
+ *
+ * 查找名为key的共享内存段，不存在时创建一个size字节的段。
+ *
+ * @return 成功返回段号，失败返回-1
+ */
+int sys_shmget(void) {
+    int key, size;
+    // 从用户空间获取参数
+    if(argint(0, &key) < 0 || argint(1, &size) < 0) {
+        return -1;
+    }
+    return shmget(key, size);
+}
+
+/**
+ * sys_shmat - shmat系统调用的包装函数
+ *
+ * 把共享内存段映射到调用进程的地址空间。
+ *
+ * @return 成功返回映射的地址，失败返回-1
+ */
+int sys_shmat(void) {
+    int id;
+    // 从用户空间获取参数
+    if(argint(0, &id) < 0) {
+        return -1;
+    }
+    return shmat(id);
+}
+
+/**
+ * sys_shmdt - shmdt系统调用的包装函数
+ *
+ * 解除调用进程在addr处映射的共享内存段。
+ *
+ * @return 成功返回0，失败返回-1
+ */
+int sys_shmdt(void) {
+    int addr;
+    // 从用户空间获取参数
+    if(argint(0, &addr) < 0) {
+        return -1;
+    }
+    return shmdt((uint)addr);
+}
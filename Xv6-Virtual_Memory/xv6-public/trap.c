@@ -14,6 +14,8 @@ struct gatedesc idt[256];
 extern uint vectors[];  // in vectors.S: array of 256 entry pointers
 struct spinlock tickslock;  // 时钟滴答锁
 uint ticks;  // 系统时钟滴答计数
+static struct spinlock faultlock;  // 保护faults
+static uint faults[NFAULTKIND];    // 全系统按类型统计的页面错误，见memstat.h
 
 // 初始化中断描述符表
 // 设置所有中断和异常的处理函数入口
@@ -30,6 +32,30 @@ tvinit(void)
 
   // 初始化时钟滴答锁
   initlock(&tickslock, "time");
+  initlock(&faultlock, "faults");
+}
+
+// 统计进程p（可以为0）和全系统的一次页面错误
+void
+countfault(struct proc *p, int kind)
+{
+  if(p)
+    p->faults[kind]++;
+  acquire(&faultlock);
+  faults[kind]++;
+  release(&faultlock);
+}
+
+// 读取全系统的页面错误计数
+void
+getfaults(uint *out)
+{
+  int i;
+
+  acquire(&faultlock);
+  for(i = 0; i < NFAULTKIND; i++)
+    out[i] = faults[i];
+  release(&faultlock);
 }
 
 // 加载中断描述符表到CPU
@@ -49,14 +75,29 @@ trap(struct trapframe *tf)
   if(tf->trapno == T_PGFLT){
     // 获取导致页面错误的地址
     uint addr = rcr2();
-    
+
+    // 延迟分配的页面：exec和sbrk都不分配内存，第一次访问时才分配，程序段从文件读入
+    // 第0页从不分配，所以空指针访问不会在这里被处理
+    if(!(tf->err & PTE_P) && myproc() &&
+       lazyfault(myproc(), addr) == 0)
+      return;
+
+    // 写时复制的页面：复制后返回，重新执行写入指令
+    // 内核代替进程写用户内存（如read系统调用）时也会走到这里
+    if((tf->err & PTE_P) && (tf->err & PTE_W) && myproc() &&
+       cowfault(myproc()->pgdir, addr) == 0)
+      return;
+
+    // 以下的页面错误都会终止进程（或在内核中panic）
+    countfault(myproc(), FAULT_BAD);
+
     // 检查是否是空指针访问
     if(addr == 0){
       cprintf("pid %d %s: null pointer dereference at addr 0x%x\n",
               myproc()->pid, myproc()->name, addr);
       exit(); // 立即退出进程
     }
-    
+
     // 检查是否是写保护错误
     if(tf->err & PTE_W){
       cprintf("pid %d %s: write to protected page at addr 0x%x\n",
@@ -72,8 +113,10 @@ trap(struct trapframe *tf)
       exit();
     // 保存trap frame到进程结构
     myproc()->tf = tf;
-    // 执行系统调用
+    // 执行系统调用；期间pageout不会换出本进程的页面
+    myproc()->insyscall = 1;
     syscall();
+    myproc()->insyscall = 0;
     // 检查系统调用后进程是否被标记为killed
     if(myproc()->killed)
       exit();
@@ -1,5 +1,6 @@
 struct stat;
 struct rtcdate;
+struct memstat;
 
 // system calls
 int fork(void);
@@ -25,6 +26,12 @@ int sleep(int);
 int uptime(void);
 int mprotect(void*, int);
 int munprotect(void*, int);
+int shmget(int, int);
+void* shmat(int);
+int shmdt(void*);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int getmemstat(int, struct memstat*);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -39,13 +39,14 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   pte_t *pgtab;
 
   pde = &pgdir[PDX(va)];
+  if(*pde & PTE_PS)
+    panic("walkpgdir: superpage");
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    if(!alloc || (pgtab = (pte_t*)kzalloc()) == 0)
+      return 0;
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -114,21 +115,62 @@ static struct kmap {
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
-// Set up kernel part of a page table.
+// Map the size bytes of kernel memory at va to physical
+// addresses from pa.  Every 4MB piece with va and pa both 4MB
+// aligned gets a single PTE_PS page directory entry instead of
+// a page table; the rest is mapped with 4KB pages.  Only the
+// first 4MB, holding the kernel text, needs a page table, and
+// kernel accesses use far fewer TLB entries.  entry.S turns on
+// CR4_PSE.
+static int
+mapkernel(pde_t *pgdir, void *va, uint size, uint pa, int perm)
+{
+  char *a;
+  uint n;
+
+  a = (char*)PGROUNDDOWN((uint)va);
+  n = PGROUNDDOWN((uint)va + size - 1) - (uint)a + PGSIZE;
+  while(n > 0){
+    if((uint)a % PDSIZE == 0 && pa % PDSIZE == 0 && n >= PDSIZE){
+      if(pgdir[PDX(a)] & PTE_P)
+        panic("remap");
+      pgdir[PDX(a)] = pa | perm | PTE_P | PTE_PS;
+      a += PDSIZE;
+      pa += PDSIZE;
+      n -= PDSIZE;
+    } else {
+      if(mappages(pgdir, a, PGSIZE, pa, perm) < 0)
+        return -1;
+      a += PGSIZE;
+      pa += PGSIZE;
+      n -= PGSIZE;
+    }
+  }
+  return 0;
+}
+
+// Set up kernel part of a page table.  The kernel's page table
+// pages are made once, for kpgdir; every other page directory
+// points at them, so they are never copied and freevm leaves
+// them alone.
 pde_t*
 setupkvm(void)
 {
   pde_t *pgdir;
   struct kmap *k;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
+  if((pgdir = (pde_t*)kzalloc()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
+  if(kpgdir){
+    memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+            (NPDENTRIES - PDX(KERNBASE)) * sizeof(pde_t));
+    return pgdir;
+  }
   if (P2V(PHYSTOP) > (void*)DEVSPACE)
     panic("PHYSTOP too high");
   for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
+    if(mapkernel(pgdir, k->virt, k->phys_end - k->phys_start,
+                 (uint)k->phys_start, k->perm) < 0) {
       freevm(pgdir);
       return 0;
     }
@@ -186,8 +228,7 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kzalloc();
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
@@ -231,13 +272,12 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = ualloc(1);
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       cprintf("allocuvm out of memory (2)\n");
       deallocuvm(pgdir, newsz, oldsz);
@@ -273,6 +313,9 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
       char *v = P2V(pa);
       kfree(v);
       *pte = 0;
+    } else if(*pte & PTE_SWAP){
+      swapfree(SWAPSLOT(*pte));
+      *pte = 0;
     }
   }
   return newsz;
@@ -288,7 +331,8 @@ freevm(pde_t *pgdir)
   if(pgdir == 0)
     panic("freevm: no pgdir");
   deallocuvm(pgdir, KERNBASE, 0);
-  for(i = 0; i < NPDENTRIES; i++){
+  // The kernel half's page tables belong to kpgdir (see setupkvm).
+  for(i = 0; i < PDX(KERNBASE); i++){
     if(pgdir[i] & PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
@@ -310,37 +354,276 @@ clearpteu(pde_t *pgdir, char *uva)
   *pte &= ~PTE_U;
 }
 
+// Map the pages of src in [start, end) into dst, sharing them:
+// with cow set, writable ones become read-only and PTE_COW in
+// both, and the first write to one copies it (see cowfault);
+// otherwise they stay shared.  Pages already read-only, e.g.
+// after mprotect, stay so, pages not faulted in yet stay lazy in
+// dst, and paged out ones share the swap slot until read back in.
+// src must be loaded, to flush its TLB.
+// Returns 0 or -1; on failure dst may hold some of the pages.
+int
+uvmshare(pde_t *src, pde_t *dst, uint start, uint end, int cow)
+{
+  pte_t *pte, *dpte;
+  uint pa, i, flags;
+
+  for(i = start; i < end; i += PGSIZE){
+    if((pte = walkpgdir(src, (void *) i, 0)) == 0)
+      continue;
+    if(*pte & PTE_SWAP){
+      if((dpte = walkpgdir(dst, (void*)i, 1)) == 0){
+        lcr3(V2P(src));
+        return -1;
+      }
+      *dpte = *pte;
+      swapdup(SWAPSLOT(*pte));
+      continue;
+    }
+    if(!(*pte & PTE_P))
+      continue;
+    if(cow && (*pte & PTE_W))
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+    pa = PTE_ADDR(*pte);
+    flags = PTE_FLAGS(*pte);
+    if(mappages(dst, (void*)i, PGSIZE, pa, flags) < 0){
+      lcr3(V2P(src));
+      return -1;
+    }
+    kref(P2V(pa));
+  }
+  lcr3(V2P(src));
+  return 0;
+}
+
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child, sharing its pages copy-on-write.
+// Must be called with pgdir loaded.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
-  pte_t *pte;
-  uint pa, i, flags;
-  char *mem;
 
   if((d = setupkvm()) == 0)
     return 0;
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
-    pa = PTE_ADDR(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
+  if(uvmshare(pgdir, d, 0, sz, 1) < 0){
+    freevm(d);
+    return 0;
+  }
+  return d;
+}
+
+// Map the page mem at user address va in pgdir with
+// permissions perm.  Returns 0 or -1.
+int
+uvmmap(pde_t *pgdir, uint va, char *mem, int perm)
+{
+  return mappages(pgdir, (char*)va, PGSIZE, V2P(mem), perm);
+}
+
+// Return the kernel address of the page at user address va in
+// pgdir if it is present and has been written to, otherwise 0.
+char*
+uvmdirty(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+
+  pte = walkpgdir(pgdir, (void*)va, 0);
+  if(pte == 0 || (*pte & (PTE_P|PTE_D)) != (PTE_P|PTE_D))
+    return 0;
+  return P2V(PTE_ADDR(*pte));
+}
+
+// Advance the clock hand *va of pageout through the user pages of
+// pgdir below sz: clear the accessed bit of pages that have it,
+// and stop at the first one found without it that no other page
+// table maps, giving it PTE_SWAP and swap slot slot in place of
+// its address.  Returns that page, for the caller to write out and
+// free, with *va its address; or 0 with *va = sz if there is none.
+// pgdir must not be in use on any cpu, so that its TLB entries
+// are flushed before it is used again.
+char*
+uvmevict(pde_t *pgdir, uint sz, uint *va, int slot)
+{
+  pte_t *pte;
+  char *mem;
+  uint a;
+
+  for(a = PGROUNDDOWN(*va); a < sz; a += PGSIZE){
+    if((pte = walkpgdir(pgdir, (void*)a, 0)) == 0){
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if((*pte & (PTE_P|PTE_U)) != (PTE_P|PTE_U))
+      continue;
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      continue;
+    }
+    mem = P2V(PTE_ADDR(*pte));
+    if(krefcount(mem) != 1)
+      continue;
+    *pte = SWAPPTE(slot) | (*pte & (PTE_W|PTE_U|PTE_COW));
+    *va = a;
+    return mem;
+  }
+  *va = sz;
+  return 0;
+}
+
+// Handle a write fault at user address va in pgdir, which
+// must be loaded.  If the page is copy-on-write, give this
+// page table its own writable copy, or just make the page
+// writable if no other page table shares it any more.
+// Return 0 if the write may be retried, -1 if the fault
+// was not a copy-on-write one or memory ran out.
+int
+cowfault(pde_t *pgdir, uint va)
+{
+  pte_t *pte, old;
+  uint pa, flags;
+  char *mem;
+
+  if(va >= KERNBASE)
+    return -1;
+  pte = walkpgdir(pgdir, (void*)va, 0);
+  if(pte == 0 || (*pte & (PTE_P|PTE_U|PTE_COW)) != (PTE_P|PTE_U|PTE_COW))
+    return -1;
+  old = *pte;
+  pa = PTE_ADDR(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+  if(krefcount(P2V(pa)) > 1){
+    if((mem = ualloc(0)) == 0)
+      return -1;
+    // ualloc may have slept paging out, and the page have been
+    // paged out too if its other users went meanwhile.
+    if(*pte != old){
+      kfree(mem);
+      return 0;
+    }
     memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
+    *pte = V2P(mem) | flags;
+    kfree(P2V(pa));
+    countfault(myproc(), FAULT_COWCOPY);
+  } else {
+    *pte = pa | flags;
+  }
+  invlpg((void*)va);
+  countfault(myproc(), FAULT_COW);
+  return 0;
+}
+
+// Handle a fault at user address va of process p, whose page
+// table must be loaded, on a page that is not present.  Faults
+// in the mmap area are mmapfault's.  Otherwise, neither
+// exec nor growproc allocates memory, so a missing page below
+// p->sz is being touched for the first time: map the program
+// file's page from the page cache if it holds part of a segment,
+// copy-on-write so that every process running the program shares
+// it until it stores to it; or else a zeroed page, filled from
+// swap if it was paged out.  Page 0 is never mapped, to catch
+// null pointers.  May sleep reading the file.  Return 0 if the access may be
+// retried, -1 if va is outside the process, memory ran out or
+// the file could not be read.
+int
+lazyfault(struct proc *p, uint va)
+{
+  struct segment *s;
+  pte_t *pte;
+  char *mem;
+  uint n;
+  int i, swapped;
+
+  if(va >= MMAPBASE && va < SHMBASE){
+    if(mmapfault(p, va) < 0)
+      return -1;
+    countfault(p, FAULT_MMAP);
+    return 0;
+  }
+  if(va >= p->sz || va >= KERNBASE || va < PGSIZE)
+    return -1;
+  va = PGROUNDDOWN(va);
+  pte = walkpgdir(p->pgdir, (void*)va, 0);
+  if(pte && (*pte & PTE_P))
+    return -1;
+  swapped = pte && (*pte & PTE_SWAP);
+  for(i = 0; !swapped && p->exe && i < p->nseg; i++){
+    s = &p->seg[i];
+    if(va < s->va || va >= s->va + s->filesz)
+      continue;
+    n = s->va + s->filesz - va;
+    if(n > PGSIZE)
+      n = PGSIZE;
+    ilock(p->exe);
+    mem = pctext(p->exe, s->off + (va - s->va), n);
+    iunlock(p->exe);
+    if(mem == 0)
+      return -1;
+    if(uvmmap(p->pgdir, va, mem, PTE_U|PTE_COW) < 0){
+      cprintf("lazyfault out of memory (2)\n");
       kfree(mem);
-      goto bad;
+      return -1;
     }
+    countfault(p, FAULT_LAZY);
+    return 0;
   }
-  return d;
+  if((mem = ualloc(!swapped)) == 0){
+    cprintf("lazyfault out of memory\n");
+    return -1;
+  }
+  if(swapped){
+    // Only p changes its own missing pages, so *pte stays put
+    // while swapread sleeps.
+    swapread(SWAPSLOT(*pte), mem);
+    swapfree(SWAPSLOT(*pte));
+    *pte = V2P(mem) | (*pte & (PTE_W|PTE_U|PTE_COW)) | PTE_P;
+    countfault(p, FAULT_SWAP);
+    return 0;
+  }
+  if(mappages(p->pgdir, (char*)va, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
+    cprintf("lazyfault out of memory (2)\n");
+    kfree(mem);
+    return -1;
+  }
+  countfault(p, FAULT_LAZY);
+  return 0;
+}
 
-bad:
-  freevm(d);
+// Fault in any lazy pages covering the len bytes at user address
+// va of process p, so the kernel can use them without faulting,
+// where it could neither report running out of memory nor sleep
+// reading the program file.  Returns 0 or -1.
+int
+uvmpopulate(struct proc *p, uint va, uint len)
+{
+  pte_t *pte;
+  uint a;
+
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE){
+    pte = walkpgdir(p->pgdir, (void*)a, 0);
+    if(pte && (*pte & PTE_P))
+      continue;
+    if(lazyfault(p, a) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Map the n pages in pages at user address va in pgdir, shared
+// with whoever else maps them; each mapping holds a reference.
+// Returns 0, or -1 having unmapped them again.
+int
+shmmap(pde_t *pgdir, uint va, char **pages, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(mappages(pgdir, (char*)va + i*PGSIZE, PGSIZE, V2P(pages[i]), PTE_W|PTE_U) < 0){
+      deallocuvm(pgdir, va + i*PGSIZE, va);
+      return -1;
+    }
+    kref(pages[i]);
+  }
   return 0;
 }
 
@@ -385,11 +668,65 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
   return 0;
 }
 
+#define INVLPGMAX 32  // pages beyond which a range change reloads cr3
+
+// Set (writable) or clear write permission on the npages user
+// pages from va in p's page table, which must be loaded.  Pages
+// shared copy-on-write get PTE_COW rather than PTE_W.  Walks each
+// page table page once instead of calling walkpgdir per page, and
+// flushes just the changed TLB entries with invlpg unless there
+// are more than INVLPGMAX.  Returns -1 if it meets a page that is
+// not a present user page, having changed the pages before it.
+static int
+uvmsetwrite(struct proc *p, uint va, int npages, int writable)
+{
+  pde_t *pde;
+  pte_t *pgtab, *pte;
+  uint a, next, end;
+  int n, r;
+
+  end = va + npages * PGSIZE;
+  n = 0;
+  r = 0;
+  for(a = va; a < end && r == 0; a = next){
+    next = PGADDR(PDX(a) + 1, 0, 0);
+    if(next > end)
+      next = end;
+    pde = &p->pgdir[PDX(a)];
+    if(!(*pde & PTE_P)){
+      r = -1;
+      break;
+    }
+    pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
+    for(; a < next; a += PGSIZE){
+      pte = &pgtab[PTX(a)];
+      if(!(*pte & PTE_P) || !(*pte & PTE_U)){
+        r = -1;
+        break;
+      }
+      if(!writable)
+        *pte &= ~(PTE_W | PTE_COW);
+      else if(krefcount(P2V(PTE_ADDR(*pte))) > 1)
+        *pte |= PTE_COW;
+      else
+        *pte |= PTE_W;
+      n++;
+    }
+  }
+
+  if(n > INVLPGMAX)
+    lcr3(V2P(p->pgdir));
+  else
+    for(a = va; a < va + n * PGSIZE; a += PGSIZE)
+      invlpg((void*)a);
+  return r;
+}
+
 /**
  * mprotect - 将指定内存区域设置为只读
  * 
  * 该函数实现了类似Linux中mprotect系统调用的功能，用于将指定内存区域设置为只读，
- * 防止写入操作。这对于实现写时复制(copy-on-write)等高级内存管理功能非常重要。
+ * 防止写入操作。写时复制的共享页面也不再写时复制，保持只读。
  * 
  * @param addr 需要保护的内存区域的起始地址，必须页对齐
  * @param len 需要保护的页面数量
@@ -410,30 +747,19 @@ int mprotect(void* addr, int len) {
         return -1;
     }
 
-    pte_t* pte;
-    // 遍历指定范围内的所有页面
-    for(int i = (int)addr; i < (int)addr + PGSIZE * len; i += PGSIZE) {
-        // 在页表中查找对应的页表项
-        pte = walkpgdir(proc->pgdir, (void*)i, 0);
-
-        // 检查页面是否存在且属于用户空间
-        if(pte && *pte & PTE_U && *pte & PTE_P) {
-            *pte &= ~PTE_W;  // 清除写权限位，使页面变为只读
-        } else {
-            return -1;  // 页面不存在或不可访问
-        }
-    }
+    // 尚未访问过的延迟分配页面先分配出来
+    if(uvmpopulate(proc, (uint)addr, len * PGSIZE) < 0)
+        return -1;
 
-    // 刷新TLB以使保护生效
-    lcr3(V2P(proc->pgdir));
-    return 0;
+    // 清除写权限位，使页面变为只读，并刷新对应的TLB项
+    return uvmsetwrite(proc, (uint)addr, len, 0);
 }
 
 /**
  * munprotect - 将指定内存区域恢复为可写
  * 
  * 该函数是mprotect的逆操作，用于恢复之前被保护为只读的内存页的写权限。
- * 在写时复制(copy-on-write)等内存管理机制中，当需要实际修改内存时使用。
+ * 与其他进程共享的页面恢复为写时复制，第一次写入时再复制。
  * 
  * @param addr 需要取消保护的内存区域的起始地址，必须页对齐
  * @param len 需要取消保护的页面数量
@@ -454,23 +780,12 @@ int munprotect(void* addr, int len) {
         return -1;
     }
 
-    pte_t* pte;
-    // 遍历指定范围内的所有页面
-    for(int i = (int)addr; i < (int)addr + PGSIZE * len; i += PGSIZE) {
-        // 在页表中查找对应的页表项
-        pte = walkpgdir(proc->pgdir, (void*)i, 0);
-
-        // 检查页面是否存在且属于用户空间
-        if(pte && *pte & PTE_U && *pte & PTE_P) {
-            *pte |= PTE_W;  // 设置写权限位，使页面变为可写
-        } else {
-            return -1;  // 页面不存在或不可访问
-        }
-    }
+    // 尚未访问过的延迟分配页面先分配出来
+    if(uvmpopulate(proc, (uint)addr, len * PGSIZE) < 0)
+        return -1;
 
-    // 刷新TLB以使权限修改生效
-    lcr3(V2P(proc->pgdir));
-    return 0;
+    // 设置写权限位，使页面变为可写，并刷新对应的TLB项
+    return uvmsetwrite(proc, (uint)addr, len, 1);
 }
 
 //PAGEBREAK!